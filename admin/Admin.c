@@ -17,6 +17,7 @@
 #include "benc/Int.h"
 #include "benc/Dict.h"
 #include "benc/serialization/BencSerializer.h"
+#include "benc/serialization/standard/BencTape.h"
 #include "benc/serialization/standard/StandardBencSerializer.h"
 #include "interface/addressable/AddrInterface.h"
 #include "io/Reader.h"
@@ -33,7 +34,6 @@
 #include "util/Identity.h"
 #include "util/platform/Sockaddr.h"
 
-#define string_strstr
 #define string_strcmp
 #define string_strlen
 #include "util/platform/libc/string.h"
@@ -50,49 +50,117 @@ static String* INTEGER =  String_CONST_SO("Int");
 static String* DICT =     String_CONST_SO("Dict");
 static String* LIST =     String_CONST_SO("List");
 static String* TXID =     String_CONST_SO("txid");
+static String* BATCH =    String_CONST_SO("Admin_batch");
+
+/**
+ * Space reserved up front for each admin request, parsing the request and building
+ * the response is usually done without any further allocation.
+ */
+#define REQUEST_SCRATCH_SIZE 4096
 
 /** Number of milliseconds before a session times out and outgoing messages are failed. */
 #define TIMEOUT_MILLISECONDS 30000
 
-/** map values for tracking time of last message by source address */
-struct MapValue
-{
-    /** time when the last incoming message was received. */
-    uint64_t timeOfLastMessage;
+/**
+ * The responses to the calls in an Admin_batch request are sent as a list in this, followed by
+ * more if another datagram follows and the txid of the batch request.
+ */
+#define BATCH_HEAD "d5:batchl"
+#define BATCH_MORE "4:morei1e"
+#define BATCH_TXID "4:txid%u:"
 
-    /** used to allocate the memory for the key (Sockaddr) and value (this). */
-    struct Allocator* allocator;
-};
+/** Room for everything but the responses and the user's txid. */
+#define BATCH_OVERHEAD 40
 
 //////// generate time-of-last-message-by-address map
 
 #define Map_USE_HASH
 #define Map_USE_COMPARATOR
 #define Map_NAME LastMessageTimeByAddr
-#define Map_KEY_TYPE struct Sockaddr*
-#define Map_VALUE_TYPE struct MapValue*
+#define Map_KEY_TYPE struct Sockaddr_Key
+/** Time when the last incoming message was received. */
+#define Map_VALUE_TYPE uint64_t
 #include "util/Map.h"
 
-static inline uint32_t Map_LastMessageTimeByAddr_hash(struct Sockaddr** key)
+static inline uint32_t Map_LastMessageTimeByAddr_hash(struct Sockaddr_Key* key)
+{
+    return Sockaddr_Key_hash(key);
+}
+
+static inline int Map_LastMessageTimeByAddr_compare(struct Sockaddr_Key* keyA,
+                                                    struct Sockaddr_Key* keyB)
 {
-    uint32_t* k = (uint32_t*) *key;
-    return k[ ((*key)->addrLen / 4)-1 ];
+    return Sockaddr_Key_compare(keyA, keyB);
 }
 
-static inline int Map_LastMessageTimeByAddr_compare(struct Sockaddr** keyA, struct Sockaddr** keyB)
+/** Clients of some other family than IPv4 or IPv6 all share the zero key. */
+static inline void keyForAddr(struct Sockaddr* addr, struct Sockaddr_Key* key)
 {
-    return Bits_memcmp(*keyA, *keyB, (*keyA)->addrLen);
+    if (Sockaddr_asKey(addr, key)) {
+        Bits_memset(key, 0, sizeof(struct Sockaddr_Key));
+    }
 }
 
 /////// end map
 
+//////// generate function-index-by-name map
+
+#define Map_USE_HASH
+#define Map_USE_COMPARATOR
+#define Map_NAME FunctionByName
+#define Map_KEY_TYPE String*
+#define Map_VALUE_TYPE int
+#include "util/Map.h"
+
+static inline uint32_t Map_FunctionByName_hash(String** key)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < (int)(*key)->len; i++) {
+        hash = (hash ^ (uint8_t)(*key)->bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static inline int Map_FunctionByName_compare(String** keyA, String** keyB)
+{
+    return String_compare(*keyA, *keyB);
+}
+
+/////// end map
+
+enum ArgType
+{
+    ArgType_STRING,
+    ArgType_INTEGER,
+    ArgType_DICT,
+    ArgType_LIST
+};
+
+/** An argument which must be present for a function to be called. */
+struct RequiredArg
+{
+    String* name;
+    String* typeName;
+    enum ArgType type;
+};
+
 struct Function
 {
     String* name;
     Admin_Function call;
     void* context;
     bool needsAuth;
+
+    /** The arguments as they are described by Admin_availableFunctions(). */
     Dict* args;
+
+    /** The required arguments, checked before each call. */
+    struct RequiredArg* requiredArgs;
+    int requiredArgCount;
+
+    /** Index in functions of the next one registered with the same name plus one, 0 if none. */
+    int nextWithSameName;
 };
 
 struct Admin
@@ -102,6 +170,9 @@ struct Admin
     struct Function* functions;
     int functionCount;
 
+    /** Index in functions of the first function registered under each name. */
+    struct Map_FunctionByName functionsByName;
+
     struct Allocator* allocator;
 
     String* password;
@@ -120,10 +191,26 @@ struct Admin
     /** Length of addresses of clients which communicate with admin. */
     uint32_t addrLen;
 
+    /** The responses to a batch request which are waiting to be sent together. */
+    struct {
+        /** Where the batch came from, NULL if not in a batch request. */
+        struct Sockaddr* dest;
+
+        /** The txid of the batch request, sent back with each datagram. */
+        String userTxid;
+
+        /** Admin_MAX_RESPONSE_SIZE bytes, allocated for the first batch. */
+        uint8_t* bytes;
+        int length;
+
+        /** Number of datagrams which were sent for this batch. */
+        int sent;
+    } batch;
+
     Identity
 };
 
-static uint8_t sendMessage(struct Message* message, struct Sockaddr* dest, struct Admin* admin)
+static uint8_t sendTo(struct Message* message, struct Sockaddr* dest, struct Admin* admin)
 {
     // stack overflow when used with admin logger.
     //Log_keys(admin->logger, "sending message to angel [%s]", message->bytes);
@@ -131,6 +218,65 @@ static uint8_t sendMessage(struct Message* message, struct Sockaddr* dest, struc
     return admin->iface->generic.sendMessage(message, &admin->iface->generic);
 }
 
+/**
+ * Send the responses which have been gathered for a batch request in one datagram.
+ *
+ * @param more true if more responses to the batch will follow.
+ */
+static uint8_t flushBatch(bool more, struct Admin* admin)
+{
+    String* userTxid = &admin->batch.userTxid;
+    char trailer[BATCH_OVERHEAD];
+    int trailerLen = snprintf(trailer, sizeof(trailer), "e%s", (more) ? BATCH_MORE : "");
+    if (userTxid->len) {
+        trailerLen += snprintf(trailer + trailerLen, sizeof(trailer) - trailerLen,
+                               BATCH_TXID, (uint32_t) userTxid->len);
+    }
+
+    struct Message* msg =
+        Message_new(sizeof(BATCH_HEAD) - 1 + admin->batch.length + trailerLen + userTxid->len + 1,
+                    sizeof(struct Sockaddr_storage),
+                    admin->currentRequest->alloc);
+    uint8_t* out = msg->bytes;
+    Bits_memcpyConst(out, BATCH_HEAD, sizeof(BATCH_HEAD) - 1);
+    out += sizeof(BATCH_HEAD) - 1;
+    Bits_memcpy(out, admin->batch.bytes, admin->batch.length);
+    out += admin->batch.length;
+    Bits_memcpy(out, trailer, trailerLen);
+    out += trailerLen;
+    Bits_memcpy(out, userTxid->bytes, userTxid->len);
+    out[userTxid->len] = 'e';
+
+    admin->batch.length = 0;
+    admin->batch.sent++;
+    return sendTo(msg, admin->batch.dest, admin);
+}
+
+/**
+ * Send a serialized response, if it is for the client whose batch request is being handled
+ * then it is held and sent with the other responses to the batch.
+ */
+static uint8_t sendMessage(struct Message* message, struct Sockaddr* dest, struct Admin* admin)
+{
+    struct Sockaddr* batchDest = admin->batch.dest;
+    if (!batchDest || batchDest->addrLen != dest->addrLen
+        || Bits_memcmp(batchDest, dest, dest->addrLen))
+    {
+        return sendTo(message, dest, admin);
+    }
+    int room = Admin_MAX_RESPONSE_SIZE - BATCH_OVERHEAD - admin->batch.userTxid.len;
+    if (message->length > room) {
+        // Too big to go in the envelope, it carries its own txid anyway.
+        return sendTo(message, dest, admin);
+    }
+    if (admin->batch.length + message->length > room) {
+        flushBatch(true, admin);
+    }
+    Bits_memcpy(&admin->batch.bytes[admin->batch.length], message->bytes, message->length);
+    admin->batch.length += message->length;
+    return 0;
+}
+
 static int sendBenc(Dict* message,
                     struct Sockaddr* dest,
                     struct Allocator* alloc,
@@ -161,10 +307,9 @@ static int sendBenc(Dict* message,
  */
 static int checkAddress(struct Admin* admin, int index, uint64_t now)
 {
-    uint64_t diff = now - admin->map.values[index]->timeOfLastMessage;
+    uint64_t diff = now - admin->map.values[index];
     // check for backwards time
     if (diff > TIMEOUT_MILLISECONDS && diff < ((uint64_t)INT64_MAX)) {
-        Allocator_free(admin->map.values[index]->allocator);
         Map_LastMessageTimeByAddr_remove(index, &admin->map);
         return -1;
     }
@@ -185,6 +330,29 @@ static void clearExpiredAddresses(void* vAdmin)
     Log_debug(admin->logger, "Cleared [%d] expired sessions", count);
 }
 
+/**
+ * Get the allocator to build a response in, if this is an asynchronous message and the client
+ * has not been heard from lately then the channel is closed and NULL is returned.
+ */
+static struct Allocator* responseAlloc(struct Sockaddr* addr, struct Admin* admin)
+{
+    if (admin->currentRequest) {
+        return admin->currentRequest->alloc;
+    }
+
+    // if this is an async call, check if we've got any input from that client.
+    // if the client is nresponsive then fail the call so logs don't get sent
+    // out forever after a disconnection.
+    struct Sockaddr_Key key;
+    keyForAddr(addr, &key);
+    int index = Map_LastMessageTimeByAddr_indexForKey(&key, &admin->map);
+    uint64_t now = Time_currentTimeMilliseconds(admin->eventBase);
+    if (index < 0 || checkAddress(admin, index, now)) {
+        return NULL;
+    }
+    return Allocator_scratch(admin->allocator, REQUEST_SCRATCH_SIZE);
+}
+
 /**
  * public function to send responses
  */
@@ -199,20 +367,9 @@ int Admin_sendMessage(Dict* message, String* txid, struct Admin* admin)
     struct Sockaddr_storage addr;
     Bits_memcpy(&addr, txid->bytes, admin->addrLen);
 
-    // if this is an async call, check if we've got any input from that client.
-    // if the client is nresponsive then fail the call so logs don't get sent
-    // out forever after a disconnection.
-    struct Allocator* alloc;
-    if (!admin->currentRequest) {
-        struct Sockaddr* addrPtr = (struct Sockaddr*) &addr.addr;
-        int index = Map_LastMessageTimeByAddr_indexForKey(&addrPtr, &admin->map);
-        uint64_t now = Time_currentTimeMilliseconds(admin->eventBase);
-        if (index < 0 || checkAddress(admin, index, now)) {
-            return -1;
-        }
-        alloc = Allocator_child(admin->allocator);
-    } else {
-        alloc = admin->currentRequest->alloc;
+    struct Allocator* alloc = responseAlloc(&addr.addr, admin);
+    if (!alloc) {
+        return Admin_sendMessage_CHANNEL_CLOSED;
     }
 
     // Bounce back the user-supplied txid.
@@ -233,26 +390,92 @@ int Admin_sendMessage(Dict* message, String* txid, struct Admin* admin)
     return ret;
 }
 
-static inline bool authValid(Dict* message, struct Message* messageBytes, struct Admin* admin)
+/** See: Admin.h */
+int Admin_sendSerialized(uint8_t* bencDict, uint32_t length, String* txid, struct Admin* admin)
 {
-    String* cookieStr = Dict_getString(message, String_CONST("cookie"));
-    uint32_t cookie = (cookieStr != NULL) ? strtoll(cookieStr->bytes, NULL, 10) : 0;
-    if (!cookie) {
-        int64_t* cookieInt = Dict_getInt(message, String_CONST("cookie"));
-        cookie = (cookieInt) ? *cookieInt : 0;
+    if (!admin) {
+        return 0;
+    }
+    Identity_check(admin);
+    Assert_true(txid && txid->len >= admin->addrLen);
+    Assert_true(length >= 2 && bencDict[0] == 'd' && bencDict[length - 1] == 'e');
+
+    struct Sockaddr_storage addr;
+    Bits_memcpy(&addr, txid->bytes, admin->addrLen);
+
+    uint32_t userTxidLen = txid->len - admin->addrLen;
+    char txidHeader[32] = "";
+    if (userTxidLen) {
+        snprintf(txidHeader, sizeof(txidHeader), "4:txid%u:", userTxidLen);
+    }
+    uint32_t headerLen = strlen(txidHeader);
+    uint32_t total = length + headerLen + userTxidLen;
+    if (total > Admin_MAX_RESPONSE_SIZE) {
+        return Admin_sendSerialized_TOO_BIG;
+    }
+
+    struct Allocator* alloc = responseAlloc(&addr.addr, admin);
+    if (!alloc) {
+        return Admin_sendMessage_CHANNEL_CLOSED;
+    }
+
+    // Drop the closing 'e' of the dictionary, add the txid and close it again.
+    struct Message* msg = Message_new(total, sizeof(struct Sockaddr_storage), alloc);
+    uint8_t* out = msg->bytes;
+    Bits_memcpy(out, bencDict, length - 1);
+    out += length - 1;
+    Bits_memcpy(out, txidHeader, headerLen);
+    out += headerLen;
+    Bits_memcpy(out, txid->bytes + admin->addrLen, userTxidLen);
+    out[userTxidLen] = 'e';
+
+    int ret = sendMessage(msg, &addr.addr, admin);
+
+    if (!admin->currentRequest) {
+        Allocator_free(alloc);
+    }
+
+    return ret;
+}
+
+static inline bool authValid(struct BencTape* tape,
+                             struct Message* messageBytes,
+                             struct Admin* admin)
+{
+    // The cookie may be sent as a string of digits or as an integer.
+    uint32_t cookie = 0;
+    String cookieStr;
+    int64_t cookieInt;
+    int cookieTok = BencTape_dictGet(tape, 0, String_CONST("cookie"));
+    if (BencTape_string(tape, cookieTok, &cookieStr)) {
+        for (uint32_t i = 0; i < cookieStr.len && i < 10; i++) {
+            if (cookieStr.bytes[i] < '0' || cookieStr.bytes[i] > '9') {
+                break;
+            }
+            cookie = cookie * 10 + (cookieStr.bytes[i] - '0');
+        }
+    } else if (BencTape_int(tape, cookieTok, &cookieInt)) {
+        cookie = cookieInt;
     }
     uint64_t nowSecs = Time_currentTimeSeconds(admin->eventBase);
-    String* submittedHash = Dict_getString(message, String_CONST("hash"));
-    if (cookie >  nowSecs || cookie < nowSecs - 20 || !submittedHash || submittedHash->len != 64) {
+    String submittedHash;
+    int hashTok = BencTape_dictGet(tape, 0, String_CONST("hash"));
+    if (cookie > nowSecs || cookie < nowSecs - 20
+        || !BencTape_string(tape, hashTok, &submittedHash) || submittedHash.len != 64)
+    {
         return false;
     }
 
-    uint8_t* hashPtr = (uint8_t*) strstr((char*) messageBytes->bytes, submittedHash->bytes);
-
-    if (!hashPtr || !admin->password) {
+    if (!admin->password) {
         return false;
     }
 
+    // The hash is checked against the message with the hash field replaced by the hash of
+    // password and cookie, it is written over the submitted one in place so keep a copy.
+    uint8_t* hashPtr = &messageBytes->bytes[tape->tokens[hashTok].offset];
+    uint8_t submitted[64];
+    Bits_memcpyConst(submitted, hashPtr, 64);
+
     uint8_t passAndCookie[64];
     snprintf((char*) passAndCookie, 64, "%s%u", admin->password->bytes, cookie);
     uint8_t hash[32];
@@ -261,7 +484,7 @@ static inline bool authValid(Dict* message, struct Message* messageBytes, struct
 
     crypto_hash_sha256(hash, messageBytes->bytes, messageBytes->length);
     Hex_encode(hashPtr, 64, hash, 32);
-    return Bits_memcmp(hashPtr, submittedHash->bytes, 64) == 0;
+    return Bits_memcmp(hashPtr, submitted, 64) == 0;
 }
 
 static bool checkArgs(Dict* args,
@@ -270,26 +493,22 @@ static bool checkArgs(Dict* args,
                       struct Allocator* requestAlloc,
                       struct Admin* admin)
 {
-    struct Dict_Entry* entry = *func->args;
     String* error = NULL;
-    while (entry != NULL) {
-        String* key = (String*) entry->key;
-        Assert_true(entry->val->type == Object_DICT);
-        Dict* value = entry->val->as.dictionary;
-        entry = entry->next;
-        if (*Dict_getInt(value, String_CONST("required")) == 0) {
-            continue;
+    for (int i = 0; i < func->requiredArgCount; i++) {
+        struct RequiredArg* arg = &func->requiredArgs[i];
+        bool present;
+        switch (arg->type) {
+            case ArgType_STRING: present = Dict_getString(args, arg->name) != NULL; break;
+            case ArgType_INTEGER: present = Dict_getInt(args, arg->name) != NULL; break;
+            case ArgType_DICT: present = Dict_getDict(args, arg->name) != NULL; break;
+            case ArgType_LIST: present = Dict_getList(args, arg->name) != NULL; break;
+            default: Assert_true(0);
         }
-        String* type = Dict_getString(value, String_CONST("type"));
-        if ((type == STRING && !Dict_getString(args, key))
-            || (type == DICT && !Dict_getDict(args, key))
-            || (type == INTEGER && !Dict_getInt(args, key))
-            || (type == LIST && !Dict_getList(args, key)))
-        {
+        if (!present) {
             error = String_printf(requestAlloc,
                                   "Entry [%s] is required and must be of type [%s]",
-                                  key->bytes,
-                                  type->bytes);
+                                  arg->name->bytes,
+                                  arg->typeName->bytes);
             break;
         }
     }
@@ -308,6 +527,15 @@ static void asyncEnabled(Dict* args, void* vAdmin, String* txid, struct Allocato
     Admin_sendMessage(&d, txid, admin);
 }
 
+/** Admin_batch is handled before the functions are looked up, unless it is inside a batch. */
+static void nestedBatch(Dict* args, void* vAdmin, String* txid, struct Allocator* requestAlloc)
+{
+    struct Admin* admin = Identity_cast((struct Admin*) vAdmin);
+    Dict d = Dict_CONST(String_CONST("error"),
+                        String_OBJ(String_CONST("Admin_batch cannot be called in a batch")), NULL);
+    Admin_sendMessage(&d, txid, admin);
+}
+
 #define ENTRIES_PER_PAGE 8
 static void availableFunctions(Dict* args, void* vAdmin, String* txid, struct Allocator* tempAlloc)
 {
@@ -330,26 +558,144 @@ static void availableFunctions(Dict* args, void* vAdmin, String* txid, struct Al
     Admin_sendMessage(d, txid, admin);
 }
 
-static void handleRequest(Dict* messageDict,
+/**
+ * Make the txid which is passed to the functions, the address of the client followed by
+ * the txid which the client supplied in a query.
+ *
+ * @param dict the token of the query in the tape.
+ */
+static String* makeTxid(struct BencTape* tape,
+                        int dict,
+                        struct Sockaddr* src,
+                        struct Allocator* allocator)
+{
+    String userTxidStr;
+    String* userTxid = BencTape_string(tape, BencTape_dictGet(tape, dict, TXID), &userTxidStr);
+    uint32_t txidlen = ((userTxid) ? userTxid->len : 0) + src->addrLen;
+    String* txid = String_newBinary(NULL, txidlen, allocator);
+    Bits_memcpy(txid->bytes, src, src->addrLen);
+    if (userTxid) {
+        Bits_memcpy(txid->bytes + src->addrLen, userTxid->bytes, userTxid->len);
+    }
+    return txid;
+}
+
+/**
+ * Call the functions which are registered under the name of a query.
+ *
+ * @param dict the token of the query in the tape, its args are given to the functions.
+ */
+static void callFunctions(struct BencTape* tape,
+                          int dict,
+                          String* query,
+                          String* txid,
+                          bool authed,
+                          struct Message* message,
+                          struct Allocator* allocator,
+                          struct Admin* admin)
+{
+    // Only the arguments are decoded into a Dict, everything else was read from the tape.
+    Dict* args = NULL;
+    int argsTok = BencTape_dictGet(tape, dict, String_CONST("args"));
+    if (argsTok >= 0 && tape->tokens[argsTok].type == BencTape_Type_DICT) {
+        struct BencTape_Token* t = &tape->tokens[argsTok];
+        struct Reader* reader = ArrayReader_new(&message->bytes[t->offset], t->length, allocator);
+        args = Allocator_malloc(allocator, sizeof(Dict));
+        if (StandardBencSerializer_get()->parseDictionary(reader, allocator, args)) {
+            args = NULL;
+        }
+    }
+    bool noFunctionsCalled = true;
+    int fuIndex = (query) ? Map_FunctionByName_indexForKey(&query, &admin->functionsByName) : -1;
+    int i = (fuIndex < 0) ? -1 : admin->functionsByName.values[fuIndex];
+    for (; i >= 0; i = admin->functions[i].nextWithSameName - 1) {
+        struct Function* fu = &admin->functions[i];
+        if (authed || !fu->needsAuth) {
+            if (checkArgs(args, fu, txid, message->alloc, admin)) {
+                fu->call(args, fu->context, txid, message->alloc);
+            }
+            noFunctionsCalled = false;
+        }
+    }
+
+    if (noFunctionsCalled) {
+        Dict d = Dict_CONST(
+            String_CONST("error"),
+            String_OBJ(String_CONST("No functions matched your request, "
+                                    "try Admin_availableFunctions()")),
+            NULL
+        );
+        Admin_sendMessage(&d, txid, admin);
+    }
+}
+
+/**
+ * Handle an Admin_batch request, each query in args.calls is called as if it had come in its
+ * own request with the same auth and the responses are sent back together.
+ */
+static void handleBatch(struct BencTape* tape,
+                        String* txid,
+                        bool authed,
+                        struct Message* message,
+                        struct Sockaddr* src,
+                        struct Allocator* allocator,
+                        struct Admin* admin)
+{
+    int argsTok = BencTape_dictGet(tape, 0, String_CONST("args"));
+    int list = BencTape_dictGet(tape, argsTok, String_CONST("calls"));
+    if (list < 0 || tape->tokens[list].type != BencTape_Type_LIST) {
+        Dict d = Dict_CONST(String_CONST("error"), String_OBJ(
+            String_CONST("Entry [calls] is required and must be of type [List]")), NULL);
+        Admin_sendMessage(&d, txid, admin);
+        return;
+    }
+
+    if (!admin->batch.bytes) {
+        admin->batch.bytes = Allocator_malloc(admin->allocator, Admin_MAX_RESPONSE_SIZE);
+    }
+    admin->batch.dest = src;
+    admin->batch.userTxid.bytes = txid->bytes + src->addrLen;
+    admin->batch.userTxid.len = txid->len - src->addrLen;
+    admin->batch.length = 0;
+    admin->batch.sent = 0;
+
+    uint32_t end = tape->tokens[list].next;
+    for (uint32_t i = list + 1; i < end; i = tape->tokens[i].next) {
+        String queryStr;
+        String* query = BencTape_string(tape, BencTape_dictGet(tape, i, String_CONST("q")),
+                                        &queryStr);
+        String* entryTxid = makeTxid(tape, i, src, allocator);
+        if (!query) {
+            Dict d = Dict_CONST(String_CONST("error"), String_OBJ(
+                String_CONST("Each entry in [calls] must be a query")), NULL);
+            Admin_sendMessage(&d, entryTxid, admin);
+            continue;
+        }
+        callFunctions(tape, i, query, entryTxid, authed, message, allocator, admin);
+    }
+
+    // Always answer so that the client knows the batch is done.
+    if (admin->batch.length || !admin->batch.sent) {
+        flushBatch(false, admin);
+    }
+    admin->batch.dest = NULL;
+}
+
+static void handleRequest(struct BencTape* tape,
                           struct Message* message,
                           struct Sockaddr* src,
                           struct Allocator* allocator,
                           struct Admin* admin)
 {
-    String* query = Dict_getString(messageDict, String_CONST("q"));
+    String queryStr;
+    String* query = BencTape_string(tape, BencTape_dictGet(tape, 0, String_CONST("q")), &queryStr);
     if (!query) {
         Log_info(admin->logger, "Got a non-query from admin interface");
         return;
     }
 
     // txid becomes the user supplied txid combined with the channel num.
-    String* userTxid = Dict_getString(messageDict, TXID);
-    uint32_t txidlen = ((userTxid) ? userTxid->len : 0) + src->addrLen;
-    String* txid = String_newBinary(NULL, txidlen, allocator);
-    Bits_memcpy(txid->bytes, src, src->addrLen);
-    if (userTxid) {
-        Bits_memcpy(txid->bytes + src->addrLen, userTxid->bytes, userTxid->len);
-    }
+    String* txid = makeTxid(tape, 0, src, allocator);
 
     // If they're asking for a cookie then lets give them one.
     String* cookie = String_CONST("cookie");
@@ -368,58 +714,38 @@ static void handleRequest(Dict* messageDict,
     String* auth = String_CONST("auth");
     bool authed = false;
     if (String_equals(query, auth)) {
-        if (!authValid(messageDict, message, admin)) {
+        if (!authValid(tape, message, admin)) {
             Dict* d = Dict_new(allocator);
             Dict_putString(d, String_CONST("error"), String_CONST("Auth failed."), allocator);
             Admin_sendMessage(d, txid, admin);
             return;
         }
-        query = Dict_getString(messageDict, String_CONST("aq"));
+        int aqTok = BencTape_dictGet(tape, 0, String_CONST("aq"));
+        query = BencTape_string(tape, aqTok, &queryStr);
         authed = true;
     }
 
     // Then sent a valid authed query, lets track their address so they can receive
     // asynchronous messages.
-    int index = Map_LastMessageTimeByAddr_indexForKey(&src, &admin->map);
+    struct Sockaddr_Key key;
+    keyForAddr(src, &key);
+    int index = Map_LastMessageTimeByAddr_indexForKey(&key, &admin->map);
     uint64_t now = Time_currentTimeMilliseconds(admin->eventBase);
     admin->asyncEnabled = 1;
     if (index >= 0) {
-        admin->map.values[index]->timeOfLastMessage = now;
+        admin->map.values[index] = now;
     } else if (authed) {
-        struct Allocator* entryAlloc = Allocator_child(admin->allocator);
-        struct MapValue* mv = Allocator_calloc(entryAlloc, sizeof(struct MapValue), 1);
-        mv->timeOfLastMessage = now;
-        mv->allocator = entryAlloc;
-        struct Sockaddr* storedAddr = Sockaddr_clone(src, entryAlloc);
-        Map_LastMessageTimeByAddr_put(&storedAddr, &mv, &admin->map);
+        Map_LastMessageTimeByAddr_put(&key, &now, &admin->map);
     } else {
         admin->asyncEnabled = 0;
     }
 
-    Dict* args = Dict_getDict(messageDict, String_CONST("args"));
-    bool noFunctionsCalled = true;
-    for (int i = 0; i < admin->functionCount; i++) {
-        if (String_equals(query, admin->functions[i].name)
-            && (authed || !admin->functions[i].needsAuth))
-        {
-            if (checkArgs(args, &admin->functions[i], txid, message->alloc, admin)) {
-                admin->functions[i].call(args, admin->functions[i].context, txid, message->alloc);
-            }
-            noFunctionsCalled = false;
-        }
-    }
-
-    if (noFunctionsCalled) {
-        Dict d = Dict_CONST(
-            String_CONST("error"),
-            String_OBJ(String_CONST("No functions matched your request, "
-                                    "try Admin_availableFunctions()")),
-            NULL
-        );
-        Admin_sendMessage(&d, txid, admin);
+    if (query && String_equals(query, BATCH)) {
+        handleBatch(tape, txid, authed, message, src, allocator, admin);
+        return;
     }
 
-    return;
+    callFunctions(tape, 0, query, txid, authed, message, allocator, admin);
 }
 
 static void handleMessage(struct Message* message,
@@ -445,16 +771,17 @@ static void handleMessage(struct Message* message,
         return;
     }
 
-    struct Reader* reader = ArrayReader_new(message->bytes, message->length, alloc);
-    Dict messageDict;
-    if (StandardBencSerializer_get()->parseDictionary(reader, alloc, &messageDict)) {
+    struct BencTape_Token tokens[Admin_MAX_REQUEST_SIZE / 2 + 1];
+    struct BencTape tape;
+    int amount = BencTape_parse(&tape, (char*) message->bytes, message->length,
+                                tokens, Admin_MAX_REQUEST_SIZE / 2 + 1);
+    if (amount < 0 || tokens[0].type != BencTape_Type_DICT) {
         Log_warn(admin->logger,
                  "Unparsable data from [%s] content: [%s]",
                  Sockaddr_print(src, alloc), message->bytes);
         return;
     }
 
-    int amount = reader->bytesRead;
     if (amount < message->length) {
         Log_warn(admin->logger,
                  "Message from [%s] contained garbage after byte [%d] content: [%s]",
@@ -462,7 +789,7 @@ static void handleMessage(struct Message* message,
         return;
     }
 
-    handleRequest(&messageDict, message, src, alloc, admin);
+    handleRequest(&tape, message, src, alloc, admin);
 }
 
 static uint8_t receiveMessage(struct Message* message, struct Interface* iface)
@@ -473,7 +800,7 @@ static uint8_t receiveMessage(struct Message* message, struct Interface* iface)
     struct Sockaddr_storage addrStore = { .addr = { .addrLen = 0 } };
     Message_pop(message, &addrStore, admin->addrLen, NULL);
 
-    struct Allocator* alloc = Allocator_child(admin->allocator);
+    struct Allocator* alloc = Allocator_scratch(admin->allocator, REQUEST_SCRATCH_SIZE);
     admin->currentRequest = message;
 
     handleMessage(message, &addrStore.addr, alloc, admin);
@@ -501,25 +828,33 @@ void Admin_registerFunctionWithArgCount(char* name,
         Allocator_realloc(admin->allocator,
                           admin->functions,
                           sizeof(struct Function) * (admin->functionCount + 1));
-    struct Function* fu = &admin->functions[admin->functionCount];
-    admin->functionCount++;
+    int fuIndex = admin->functionCount++;
+    struct Function* fu = &admin->functions[fuIndex];
 
     fu->name = str;
     fu->call = callback;
     fu->context = callbackContext;
     fu->needsAuth = needsAuth;
     fu->args = Dict_new(admin->allocator);
+    fu->requiredArgs = Allocator_calloc(admin->allocator, sizeof(struct RequiredArg), argCount + 1);
+    fu->requiredArgCount = 0;
+    fu->nextWithSameName = 0;
     for (int i = 0; arguments && i < argCount; i++) {
         // "type" must be one of: [ "String", "Int", "Dict", "List" ]
         String* type = NULL;
+        enum ArgType argType;
         if (!strcmp(arguments[i].type, STRING->bytes)) {
             type = STRING;
+            argType = ArgType_STRING;
         } else if (!strcmp(arguments[i].type, INTEGER->bytes)) {
             type = INTEGER;
+            argType = ArgType_INTEGER;
         } else if (!strcmp(arguments[i].type, DICT->bytes)) {
             type = DICT;
+            argType = ArgType_DICT;
         } else if (!strcmp(arguments[i].type, LIST->bytes)) {
             type = LIST;
+            argType = ArgType_LIST;
         } else {
             abort();
         }
@@ -528,7 +863,27 @@ void Admin_registerFunctionWithArgCount(char* name,
         Dict_putInt(arg, REQUIRED, arguments[i].required, admin->allocator);
         String* name = String_new(arguments[i].name, admin->allocator);
         Dict_putDict(fu->args, name, arg, admin->allocator);
+
+        if (arguments[i].required) {
+            fu->requiredArgs[fu->requiredArgCount++] = (struct RequiredArg) {
+                .name = name,
+                .typeName = type,
+                .type = argType
+            };
+        }
+    }
+
+    int index = Map_FunctionByName_indexForKey(&str, &admin->functionsByName);
+    if (index < 0) {
+        Map_FunctionByName_put(&str, &fuIndex, &admin->functionsByName);
+        return;
+    }
+    // Functions registered under the same name are all called, in the order of registration.
+    struct Function* last = &admin->functions[admin->functionsByName.values[index]];
+    while (last->nextWithSameName) {
+        last = &admin->functions[last->nextWithSameName - 1];
     }
+    last->nextWithSameName = fuIndex + 1;
 }
 
 struct Admin* Admin_new(struct AddrInterface* iface,
@@ -545,6 +900,9 @@ struct Admin* Admin_new(struct AddrInterface* iface,
         .addrLen = iface->addr->addrLen,
         .map = {
             .allocator = alloc
+        },
+        .functionsByName = {
+            .allocator = alloc
         }
     }));
     Identity_set(admin);
@@ -561,6 +919,10 @@ struct Admin* Admin_new(struct AddrInterface* iface,
         ((struct Admin_FunctionArg[]) {
             { .name = "page", .required = 0, .type = "Int" }
         }), admin);
+    Admin_registerFunction("Admin_batch", nestedBatch, admin, false,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "calls", .required = 1, .type = "List" }
+        }), admin);
 
     return admin;
 }
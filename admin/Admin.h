@@ -39,7 +39,8 @@ struct Admin_FunctionArg
     bool required;
 };
 
-#define Admin_MAX_REQUEST_SIZE 512
+/** Big enough for the bulk calls such as AuthorizedPasswords_addMany to carry many entries. */
+#define Admin_MAX_REQUEST_SIZE 4096
 
 // This must not exceed PipeInterface_MAX_MESSAGE_SIZE
 #define Admin_MAX_RESPONSE_SIZE 65536
@@ -68,6 +69,21 @@ void Admin_registerFunctionWithArgCount(char* name,
 #define Admin_sendMessage_CHANNEL_CLOSED -1
 int Admin_sendMessage(Dict* message, String* txid, struct Admin* admin);
 
+/**
+ * Send a response which the caller has serialized itself rather than building a Dict,
+ * for large responses which are written straight out of a table.
+ *
+ * @param bencDict a benc dictionary, the txid is added at the end of it so all of its keys
+ *                 must sort before "txid".
+ * @param length the length of bencDict.
+ * @param txid the txid which was passed to the admin function.
+ * @param admin the admin.
+ * @return 0 on success, Admin_sendMessage_CHANNEL_CLOSED if an asynchronous message can't be sent
+ *         because the client has gone away or Admin_sendSerialized_TOO_BIG.
+ */
+#define Admin_sendSerialized_TOO_BIG -2
+int Admin_sendSerialized(uint8_t* bencDict, uint32_t length, String* txid, struct Admin* admin);
+
 struct Admin* Admin_new(struct AddrInterface* iface,
                         struct Allocator* alloc,
                         struct Log* logger,
@@ -115,8 +115,12 @@ static int calculateAuth(Dict* message,
 static void done(struct Request* req, enum AdminClient_Error err)
 {
     req->res.err = err;
+    // The callback may free the request so the timeout needs to be stopped first.
+    if (req->timeoutAlloc) {
+        Allocator_free(req->timeoutAlloc);
+        req->timeoutAlloc = NULL;
+    }
     req->callback(req);
-    Allocator_free(req->timeoutAlloc);
 }
 
 static void timeout(void* vreq)
@@ -52,7 +52,7 @@ enum AdminClient_Error
 };
 
 /** The biggest message that can be sent or received. */
-#define AdminClient_MAX_MESSAGE_SIZE 1023
+#define AdminClient_MAX_MESSAGE_SIZE 4095
 
 /** The amount of message padding. */
 #define AdminClient_Result_PADDING_SIZE (sizeof(struct Sockaddr_storage))
@@ -19,9 +19,12 @@
 #include "admin/AdminLog.h"
 #include "benc/Dict.h"
 #include "benc/String.h"
+#include "benc/serialization/standard/BencWriter.h"
 #include "crypto/random/Random.h"
+#include "io/ArrayWriter.h"
 #include "io/Writer.h"
 #include "memory/BufferAllocator.h"
+#include "util/Bits.h"
 #include "util/log/Log.h"
 #include "util/log/Log_impl.h"
 #include "util/Hex.h"
@@ -38,6 +41,7 @@
 
 #define MAX_SUBSCRIPTIONS 64
 #define FILE_NAME_COUNT 32
+#define CALL_SITE_CACHE_SIZE 256
 
 struct Subscription
 {
@@ -66,11 +70,32 @@ struct Subscription
     struct Allocator* alloc;
 };
 
+/** Which subscriptions match the log calls at one line, so a log call is matched once. */
+struct CallSite
+{
+    const char* file;
+    int line;
+    enum Log_Level level;
+
+    /** Bit n is set if subscriptions[n] matches. */
+    uint64_t matches;
+
+    /** The entry is stale unless this is the current subscriptionGeneration. */
+    uint32_t generation;
+};
+
 struct AdminLog
 {
     struct Log pub;
     struct Subscription subscriptions[MAX_SUBSCRIPTIONS];
     uint32_t subscriptionCount;
+
+    /** Incremented whenever the subscriptions change, 0 is never used. */
+    uint32_t subscriptionGeneration;
+
+    /** Direct mapped by file and line. */
+    struct CallSite callSites[CALL_SITE_CACHE_SIZE];
+
     const char* fileNames[FILE_NAME_COUNT];
     struct Admin* admin;
     struct Allocator* alloc;
@@ -129,44 +154,77 @@ static inline bool isMatch(struct Subscription* subscription,
     return true;
 }
 
-static Dict* makeLogMessage(struct Subscription* subscription,
-                            struct AdminLog* logger,
-                            enum Log_Level logLevel,
-                            const char* fullFilePath,
-                            uint32_t line,
-                            const char* format,
-                            va_list vaArgs,
-                            struct Allocator* alloc)
+/** @return a bit for each subscription which matches the call site. */
+static uint64_t getMatches(struct AdminLog* log,
+                           enum Log_Level logLevel,
+                           const char* file,
+                           int line)
 {
-    time_t now;
-    time(&now);
-
-    Dict* out = Dict_new(alloc);
-    char* buff = Allocator_malloc(alloc, 20);
-    Hex_encode((uint8_t*)buff, 20, subscription->streamId, 8);
-    Dict_putString(out, String_new("streamId", alloc), String_new(buff, alloc), alloc);
-    Dict_putInt(out, String_new("time", alloc), now, alloc);
-    Dict_putString(out,
-                   String_new("level", alloc),
-                   String_new(Log_nameForLevel(logLevel), alloc),
-                   alloc);
-    const char* shortName = getShortName(fullFilePath);
-    Dict_putString(out, String_new("file", alloc), String_new((char*)shortName, alloc), alloc);
-    Dict_putInt(out, String_new("line", alloc), line, alloc);
-    String* message = String_vprintf(alloc, format, vaArgs);
-
-    // Strip all of the annoying \n marks in the log entries.
-    if (message->len > 0 && message->bytes[message->len - 1] == '\n') {
-        message->len--;
+    // The file names are string constants so each file has one pointer.
+    uint32_t hash = ((uint32_t) (uintptr_t) file + (uint32_t) line) * 2654435761u;
+    struct CallSite* site = &log->callSites[(hash >> 24) % CALL_SITE_CACHE_SIZE];
+    if (site->generation == log->subscriptionGeneration
+        && site->file == file
+        && site->line == line
+        && site->level == logLevel)
+    {
+        return site->matches;
     }
-    Dict_putString(out, String_new("message", alloc), message, alloc);
+    uint64_t matches = 0;
+    for (int i = 0; i < (int)log->subscriptionCount; i++) {
+        if (isMatch(&log->subscriptions[i], log, logLevel, file, line)) {
+            matches |= ((uint64_t)1) << i;
+        }
+    }
+    site->file = file;
+    site->line = line;
+    site->level = logLevel;
+    site->matches = matches;
+    site->generation = log->subscriptionGeneration;
+    return matches;
+}
 
-    return out;
+static void subscriptionsChanged(struct AdminLog* log)
+{
+    if (!++log->subscriptionGeneration) {
+        // Wrapped around, the old entries could look current.
+        Bits_memset(log->callSites, 0, sizeof(log->callSites));
+        log->subscriptionGeneration = 1;
+    }
+}
+
+/** Serialize a log message for one subscription, the keys are in sorted order. */
+static int writeLogMessage(struct Writer* w,
+                           struct Subscription* subscription,
+                           enum Log_Level logLevel,
+                           const char* fullFilePath,
+                           uint32_t line,
+                           String* message,
+                           time_t now)
+{
+    char streamId[20];
+    Hex_encode((uint8_t*)streamId, 20, subscription->streamId, 8);
+
+    BencWriter_beginDict(w);
+    BencWriter_cstring(w, "file");
+    BencWriter_cstring(w, getShortName(fullFilePath));
+    BencWriter_cstring(w, "level");
+    BencWriter_cstring(w, Log_nameForLevel(logLevel));
+    BencWriter_cstring(w, "line");
+    BencWriter_int(w, line);
+    BencWriter_cstring(w, "message");
+    BencWriter_string(w, message);
+    BencWriter_cstring(w, "streamId");
+    BencWriter_cstring(w, streamId);
+    BencWriter_cstring(w, "time");
+    BencWriter_int(w, now);
+    return BencWriter_end(w);
 }
 
 static void removeSubscription(struct AdminLog* log, struct Subscription* sub)
 {
     Allocator_free(sub->alloc);
+    subscriptionsChanged(log);
     log->subscriptionCount--;
     if (log->subscriptionCount == 0 || sub == &log->subscriptions[log->subscriptionCount]) {
         return;
@@ -184,24 +242,44 @@ static void doLog(struct Log* genericLog,
                   va_list args)
 {
     struct AdminLog* log = (struct AdminLog*) genericLog;
-    Dict* message = NULL;
+    if (!log->subscriptionCount) {
+        return;
+    }
+    uint64_t matches = getMatches(log, logLevel, fullFilePath, line);
+    if (!matches) {
+        return;
+    }
+
+    String* message = NULL;
+    struct Allocator* alloc = NULL;
+    time_t now = 0;
     #define ALLOC_BUFFER_SZ 4096
     uint8_t allocBuffer[ALLOC_BUFFER_SZ];
+    uint8_t frame[ALLOC_BUFFER_SZ + 256];
 
-    for (int i = 0; i < (int)log->subscriptionCount; i++) {
-        if (isMatch(&log->subscriptions[i], log, logLevel, fullFilePath, line)) {
+    // Highest first because a removed subscription is replaced by the last one.
+    for (int i = log->subscriptionCount - 1; i >= 0; i--) {
+        if (matches & (((uint64_t)1) << i)) {
             if (!message) {
-                struct Allocator* alloc = BufferAllocator_new(allocBuffer, ALLOC_BUFFER_SZ);
-                message = makeLogMessage(&log->subscriptions[i],
-                                         log,
-                                         logLevel,
-                                         fullFilePath,
-                                         line,
-                                         format,
-                                         args,
-                                         alloc);
+                alloc = BufferAllocator_new(allocBuffer, ALLOC_BUFFER_SZ);
+                time(&now);
+                message = String_vprintf(alloc, format, args);
+
+                // Strip all of the annoying \n marks in the log entries.
+                if (message->len > 0 && message->bytes[message->len - 1] == '\n') {
+                    message->len--;
+                }
+            }
+            struct Writer* w = ArrayWriter_new(frame, sizeof(frame), alloc);
+            if (writeLogMessage(w, &log->subscriptions[i], logLevel, fullFilePath, line,
+                                message, now))
+            {
+                continue;
             }
-            int ret = Admin_sendMessage(message, log->subscriptions[i].txid, log->admin);
+            int ret = Admin_sendSerialized(frame,
+                                           Writer_bytesWritten(w),
+                                           log->subscriptions[i].txid,
+                                           log->admin);
             if (ret) {
                 removeSubscription(log, &log->subscriptions[i]);
             }
@@ -209,6 +287,15 @@ static void doLog(struct Log* genericLog,
     }
 }
 
+static bool isEnabled(struct Log* genericLog,
+                      enum Log_Level logLevel,
+                      const char* fullFilePath,
+                      int line)
+{
+    struct AdminLog* log = (struct AdminLog*) genericLog;
+    return log->subscriptionCount && getMatches(log, logLevel, fullFilePath, line);
+}
+
 static void subscribe(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
 {
     struct AdminLog* log = (struct AdminLog*) vcontext;
@@ -255,6 +342,7 @@ static void subscribe(Dict* args, void* vcontext, String* txid, struct Allocator
         ));
         Admin_sendMessage(&response, txid, log->admin);
         log->subscriptionCount++;
+        subscriptionsChanged(log);
         return;
     }
 
@@ -293,11 +381,13 @@ struct Log* AdminLog_registerNew(struct Admin* admin, struct Allocator* alloc, s
 {
     struct AdminLog* log = Allocator_clone(alloc, (&(struct AdminLog) {
         .pub = {
-            .print = doLog
+            .print = doLog,
+            .isEnabled = isEnabled
         },
         .admin = admin,
         .alloc = alloc,
-        .rand = rand
+        .rand = rand,
+        .subscriptionGeneration = 1
     }));
 
     Admin_registerFunction("AdminLog_subscribe", subscribe, log, true,
@@ -12,11 +12,13 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define string_strcmp
 #include "admin/AuthorizedPasswords.h"
 #include "benc/Int.h"
 #include "benc/List.h"
 #include "benc/String.h"
 #include "util/platform/libc/strlen.h"
+#include "util/platform/libc/string.h"
 
 struct Context
 {
@@ -32,41 +34,116 @@ static void sendResponse(String* msg, struct Admin* admin, String* txid, struct
     Admin_sendMessage(output, txid, admin);
 }
 
-static void add(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+/** @return an error string, NULL if args are a good user. */
+static char* parseUser(Dict* args, struct CryptoAuth_User* out)
 {
-    struct Context* context = (struct Context*) vcontext;
-
     String* passwd = Dict_getString(args, String_CONST("password"));
     int64_t* authType = Dict_getInt(args, String_CONST("authType"));
     String* user = Dict_getString(args, String_CONST("user"));
-    int64_t one = 1;
-    if (!authType) {
-        authType = &one;
-    } else if (*authType < 1 || *authType > 255) {
-        sendResponse(String_CONST("Specified auth type is not supported."),
-                     context->admin, txid, alloc);
-        return;
+    if (!passwd || !user) {
+        return "password and user are required.";
     }
-    int32_t ret = CryptoAuth_addUser(passwd, *authType, user, context->ca);
+    if (authType && (*authType < 1 || *authType > 255)) {
+        return "Specified auth type is not supported.";
+    }
+    out->password = passwd;
+    out->authType = (authType) ? *authType : 1;
+    out->user = user;
+    return NULL;
+}
 
+static char* errorString(int32_t ret)
+{
     switch (ret) {
         case 0:
-            sendResponse(String_CONST("none"), context->admin, txid, alloc);
-            break;
+            return "none";
         case CryptoAuth_addUser_INVALID_AUTHTYPE:
-            sendResponse(String_CONST("Specified auth type is not supported."),
-                         context->admin, txid, alloc);
-            break;
+            return "Specified auth type is not supported.";
         case CryptoAuth_addUser_OUT_OF_SPACE:
-            sendResponse(String_CONST("Out of memory to store password."),
-                         context->admin, txid, alloc);
-            break;
+            return "Out of memory to store password.";
         case CryptoAuth_addUser_DUPLICATE:
-            sendResponse(String_CONST("Password already added."), context->admin, txid, alloc);
-            break;
+            return "Password already added.";
         default:
-            sendResponse(String_CONST("Unknown error."), context->admin, txid, alloc);
+            return "Unknown error.";
+    }
+}
+
+/** @return an error string, "none" if the password was added. */
+static char* addUser(Dict* args, struct Context* context)
+{
+    struct CryptoAuth_User u;
+    char* error = parseUser(args, &u);
+    if (error) {
+        return error;
+    }
+    return errorString(CryptoAuth_addUser(u.password, u.authType, u.user, context->ca));
+}
+
+static void add(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* context = (struct Context*) vcontext;
+    char* error = addUser(args, context);
+    sendResponse(String_CONST(error), context->admin, txid, alloc);
+}
+
+/**
+ * Add a list of passwords in one call, each entry takes the same arguments as
+ * AuthorizedPasswords_add(). It stops at the first which fails and reports its index.
+ */
+static void addMany(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* context = (struct Context*) vcontext;
+    List* passwords = Dict_getList(args, String_CONST("passwords"));
+    int32_t count = List_size(passwords);
+    char* error = "none";
+    int32_t i;
+    for (i = 0; i < count; i++) {
+        Dict* password = List_getDict(passwords, i);
+        error = (password) ? addUser(password, context) : "entry is not a dictionary";
+        if (strcmp(error, "none")) {
+            break;
+        }
+    }
+
+    Dict* output = Dict_new(alloc);
+    Dict_putString(output, String_CONST("error"), String_new(error, alloc), alloc);
+    String* indexKey = String_CONST("index");
+    if (i < count) {
+        Dict_putInt(output, indexKey, i, alloc);
+    }
+    Admin_sendMessage(output, txid, context->admin);
+}
+
+/**
+ * Replace all of the passwords with a list like the one given to AuthorizedPasswords_addMany().
+ * Nothing changes unless every entry is good, in which case the index of the bad one is reported.
+ */
+static void replace(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* context = (struct Context*) vcontext;
+    List* passwords = Dict_getList(args, String_CONST("passwords"));
+    uint32_t count = List_size(passwords);
+    struct CryptoAuth_User* users = Allocator_calloc(alloc, sizeof(struct CryptoAuth_User), count);
+    char* error = NULL;
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        Dict* password = List_getDict(passwords, i);
+        error = (password) ? parseUser(password, &users[i]) : "entry is not a dictionary";
+        if (error) {
+            break;
+        }
     }
+    if (!error) {
+        error = errorString(CryptoAuth_setUsers(users, count, &i, context->ca));
+    }
+
+    Dict* output = Dict_new(alloc);
+    Dict_putString(output, String_CONST("error"), String_new(error, alloc), alloc);
+    String* indexKey = String_CONST("index");
+    if (strcmp(error, "none")) {
+        Dict_putInt(output, indexKey, i, alloc);
+    }
+    Admin_sendMessage(output, txid, context->admin);
 }
 
 static void remove(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
@@ -115,6 +192,14 @@ void AuthorizedPasswords_init(struct Admin* admin,
             { .name = "user", .required = 1, .type = "String" },
             { .name = "authType", .required = 0, .type = "Int" }
         }), admin);
+    Admin_registerFunction("AuthorizedPasswords_addMany", addMany, context, true,
+        ((struct Admin_FunctionArg[]){
+            { .name = "passwords", .required = 1, .type = "List" }
+        }), admin);
+    Admin_registerFunction("AuthorizedPasswords_replace", replace, context, true,
+        ((struct Admin_FunctionArg[]){
+            { .name = "passwords", .required = 1, .type = "List" }
+        }), admin);
     Admin_registerFunction("AuthorizedPasswords_remove", remove, context, true,
         ((struct Admin_FunctionArg[]){
             { .name = "user", .required = 1, .type = "String" }
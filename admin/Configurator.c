@@ -13,6 +13,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #define string_strrchr
+#define string_strcmp
 #define string_strlen
 #include "admin/AdminClient.h"
 #include "admin/Configurator.h"
@@ -21,6 +22,8 @@
 #include "benc/Dict.h"
 #include "benc/Int.h"
 #include "benc/List.h"
+#include "benc/serialization/standard/StandardBencSerializer.h"
+#include "io/ArrayWriter.h"
 #include "memory/Allocator.h"
 #include "util/events/Event.h"
 #include "util/Bits.h"
@@ -30,6 +33,12 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+/** The most calls made by rpcBatchCall() which may be waiting for an answer at once. */
+#define MAX_IN_FLIGHT 16
+
+/** The most entries to put in one bulk call, leaves room in Admin_MAX_REQUEST_SIZE for auth. */
+#define BULK_CALL_MAX_BYTES 3072
+
 struct Context
 {
     struct Log* logger;
@@ -39,9 +48,25 @@ struct Context
     struct Allocator* currentReqAlloc;
     struct AdminClient_Result* currentResult;
 
+    /** The number of calls made by rpcBatchCall() which have not been answered yet. */
+    int outstandingCalls;
+
+    /** True if rpcBatchCall() is waiting for MAX_IN_FLIGHT to no longer be reached. */
+    bool waitingForRoom;
+
+    /** The first of the batched calls to fail and its result, NULL if none have failed. */
+    String* failedFunction;
+    struct AdminClient_Result* failedResult;
+
     struct EventBase* base;
 };
 
+struct BatchCall
+{
+    String* function;
+    struct Context* ctx;
+};
+
 static void rpcCallback(struct AdminClient_Promise* p, struct AdminClient_Result* res)
 {
     struct Context* ctx = p->userData;
@@ -121,6 +146,117 @@ static void rpcCall(String* function, Dict* args, struct Context* ctx, struct Al
     rpcCall0(function, args, ctx, alloc, true);
 }
 
+static void batchCallback(struct AdminClient_Promise* p, struct AdminClient_Result* res)
+{
+    struct BatchCall* call = p->userData;
+    struct Context* ctx = call->ctx;
+    String* error = (res->err) ? NULL : Dict_getString(res->responseDict, String_CONST("error"));
+    if (!ctx->failedResult
+        && (res->err || (error && !String_equals(error, String_CONST("none")))))
+    {
+        // Keep the result and the function name until rpcBatchWait() reports them.
+        Allocator_adopt(ctx->alloc, p->alloc);
+        ctx->failedResult = res;
+        ctx->failedFunction = call->function;
+    }
+    ctx->outstandingCalls--;
+    if (!ctx->outstandingCalls || (ctx->waitingForRoom && ctx->outstandingCalls < MAX_IN_FLIGHT)) {
+        ctx->waitingForRoom = false;
+        EventBase_endLoop(ctx->base);
+    }
+}
+
+/**
+ * Make a call without waiting for the answer so that many calls can be on the wire at once,
+ * rpcBatchWait() must be called before the results are needed, any error is fatal.
+ * No more than MAX_IN_FLIGHT calls are outstanding, beyond that this waits for answers.
+ */
+static void rpcBatchCall(String* function, Dict* args, struct Context* ctx)
+{
+    while (ctx->outstandingCalls >= MAX_IN_FLIGHT) {
+        ctx->waitingForRoom = true;
+        EventBase_beginLoop(ctx->base);
+    }
+    struct AdminClient_Promise* promise =
+        AdminClient_rpcCall(function, args, ctx->client, ctx->alloc);
+    promise->callback = batchCallback;
+    promise->userData = Allocator_clone(promise->alloc, (&(struct BatchCall) {
+        .function = String_clone(function, promise->alloc),
+        .ctx = ctx
+    }));
+    ctx->outstandingCalls++;
+}
+
+/** Wait for every call made by rpcBatchCall() to be answered. */
+static void rpcBatchWait(struct Context* ctx)
+{
+    if (ctx->outstandingCalls) {
+        EventBase_beginLoop(ctx->base);
+    }
+    Assert_always(!ctx->outstandingCalls);
+
+    struct AdminClient_Result* res = ctx->failedResult;
+    if (!res) {
+        return;
+    }
+    if (res->err) {
+        Log_critical(ctx->logger,
+                      "Failed to make function call [%s], error: [%s]",
+                      AdminClient_errorString(res->err),
+                      ctx->failedFunction->bytes);
+    } else {
+        Log_critical(ctx->logger,
+                     "Got error [%s] calling [%s]",
+                     Dict_getString(res->responseDict, String_CONST("error"))->bytes,
+                     ctx->failedFunction->bytes);
+    }
+    die(res, ctx, ctx->alloc);
+}
+
+/** @return the number of bytes which the dictionary takes up when serialized. */
+static uint32_t serializedSize(Dict* dict, struct Allocator* alloc)
+{
+    uint8_t buff[BULK_CALL_MAX_BYTES];
+    struct Writer* w = ArrayWriter_new(buff, BULK_CALL_MAX_BYTES, alloc);
+    if (StandardBencSerializer_get()->serializeDictionary(w, dict)) {
+        return BULK_CALL_MAX_BYTES;
+    }
+    return Writer_bytesWritten(w);
+}
+
+/**
+ * Send a list of entries using a bulk admin function, splitting it into as many calls
+ * as is needed to keep each under BULK_CALL_MAX_BYTES. Calls are made with rpcBatchCall().
+ *
+ * @param function the bulk function such as AuthorizedPasswords_addMany.
+ * @param listName the name of the argument which the list of entries is passed as.
+ * @param entries the entries, all of them dictionaries.
+ */
+static void rpcBulkCall(String* function, String* listName, List* entries, struct Context* ctx)
+{
+    struct Allocator* alloc = Allocator_child(ctx->alloc);
+    List* chunk = NULL;
+    uint32_t chunkBytes = 0;
+    uint32_t count = List_size(entries);
+    for (uint32_t i = 0; i < count; i++) {
+        Dict* entry = List_getDict(entries, i);
+        uint32_t size = serializedSize(entry, alloc);
+        if (chunk && chunkBytes + size > BULK_CALL_MAX_BYTES) {
+            Dict args = Dict_CONST(listName, List_OBJ(chunk), NULL);
+            rpcBatchCall(function, &args, ctx);
+            chunk = NULL;
+            chunkBytes = 0;
+        }
+        chunk = List_addDict(chunk, entry, alloc);
+        chunkBytes += size;
+    }
+    if (chunk) {
+        Dict args = Dict_CONST(listName, List_OBJ(chunk), NULL);
+        rpcBatchCall(function, &args, ctx);
+    }
+    Allocator_free(alloc);
+}
+
 static void authorizedPasswords(List* list, struct Context* ctx)
 {
     uint32_t count = List_size(list);
@@ -138,8 +274,14 @@ static void authorizedPasswords(List* list, struct Context* ctx)
         }
     }
 
+    // The passwords are sent as few calls as will fit and then the answers are collected.
+    struct Allocator* child = Allocator_child(ctx->alloc);
+    List* passwords = NULL;
+    // Dict keys are not copied so they must outlive the loop.
+    String* authTypeKey = String_CONST("authType");
+    String* passwordKey = String_CONST("password");
+    String* userKey = String_CONST("user");
     for (uint32_t i = 0; i < count; i++) {
-        struct Allocator* child = Allocator_child(ctx->alloc);
         Dict* d = List_getDict(list, i);
         String* passwd = Dict_getString(d, String_CONST("password"));
         String* user = Dict_getString(d, String_CONST("user"));
@@ -149,14 +291,16 @@ static void authorizedPasswords(List* list, struct Context* ctx)
 
         Log_info(ctx->logger, "Adding authorized password #[%d] for user [%s].", i, user->bytes);
 
-        Dict args = Dict_CONST(
-            String_CONST("authType"), Int_OBJ(1), Dict_CONST(
-            String_CONST("password"), String_OBJ(passwd), Dict_CONST(
-            String_CONST("user"), String_OBJ(user), NULL
-        )));
-        rpcCall(String_CONST("AuthorizedPasswords_add"), &args, ctx, child);
-        Allocator_free(child);
+        Dict* args = Dict_new(child);
+        Dict_putInt(args, authTypeKey, 1, child);
+        Dict_putString(args, passwordKey, passwd, child);
+        Dict_putString(args, userKey, user, child);
+        passwords = List_addDict(passwords, args, child);
     }
+    rpcBulkCall(String_CONST("AuthorizedPasswords_addMany"),
+                String_CONST("passwords"), passwords, ctx);
+    rpcBatchWait(ctx);
+    Allocator_free(child);
 }
 
 static void dns(Dict* dns, struct Context* ctx, struct Except* eh)
@@ -191,14 +335,25 @@ static void dns(Dict* dns, struct Context* ctx, struct Except* eh)
         Dict_putInt(d, String_CONST("count"), *minSigs, ctx->alloc);
         rpcCall(String_CONST("RainflyClient_minSignatures"), d, ctx, ctx->alloc);
     }
+
+    int64_t* parallel = Dict_getInt(dns, String_CONST("parallelRequests"));
+    if (parallel) {
+        Dict* d = Dict_new(ctx->alloc);
+        Dict_putInt(d, String_CONST("count"), *parallel, ctx->alloc);
+        rpcCall(String_CONST("RainflyClient_parallelRequests"), d, ctx, ctx->alloc);
+    }
 }
 
-static void udpInterface(Dict* config, struct Context* ctx)
+/**
+ * Setup the UDPInterface or TCPInterface blocks of the config, they take the same settings.
+ *
+ * @param type "UDPInterface" or "TCPInterface", the prefix of the admin functions to call.
+ */
+static void ipInterface(char* type, Dict* config, struct Context* ctx)
 {
-    List* ifaces = Dict_getList(config, String_CONST("UDPInterface"));
+    List* ifaces = Dict_getList(config, String_CONST(type));
     if (!ifaces) {
-        ifaces = List_addDict(ifaces,
-                Dict_getDict(config, String_CONST("UDPInterface")), ctx->alloc);
+        ifaces = List_addDict(ifaces, Dict_getDict(config, String_CONST(type)), ctx->alloc);
     }
 
     uint32_t count = List_size(ifaces);
@@ -210,21 +365,29 @@ static void udpInterface(Dict* config, struct Context* ctx)
         // Setup the interface.
         String* bindStr = Dict_getString(udp, String_CONST("bind"));
         Dict* d = Dict_new(ctx->alloc);
-        if (bindStr) {
-            Dict_putString(d, String_CONST("bindAddress"), bindStr, ctx->alloc);
+        // Nothing is put if there is no bind address, the key must outlive the call.
+        Dict_putString(d, String_CONST("bindAddress"), bindStr, ctx->alloc);
+        String* maxBufferSizeKey = String_CONST("maxBufferSize");
+        int64_t* maxBufferSize = Dict_getInt(udp, maxBufferSizeKey);
+        if (maxBufferSize && !strcmp(type, "UDPInterface")) {
+            Dict_putInt(d, maxBufferSizeKey, *maxBufferSize, ctx->alloc);
         }
-        rpcCall(String_CONST("UDPInterface_new"), d, ctx, ctx->alloc);
+        rpcCall(String_printf(ctx->alloc, "%s_new", type), d, ctx, ctx->alloc);
 
         // Make the connections.
         Dict* connectTo = Dict_getDict(udp, String_CONST("connectTo"));
         if (connectTo) {
             struct Dict_Entry* entry = *connectTo;
             struct Allocator* perCallAlloc = Allocator_child(ctx->alloc);
+            // UDPInterface can take many connections in one call, TCPInterface takes one each.
+            bool bulk = !strcmp(type, "UDPInterface");
+            List* connections = NULL;
+            String* addressKey = String_CONST("address");
             while (entry != NULL) {
                 String* key = (String*) entry->key;
                 if (entry->val->type != Object_DICT) {
-                    Log_critical(ctx->logger, "interfaces.UDPInterface.connectTo: entry [%s] "
-                                               "is not a dictionary type.", key->bytes);
+                    Log_critical(ctx->logger, "interfaces.%s.connectTo: entry [%s] "
+                                               "is not a dictionary type.", type, key->bytes);
                     exit(-1);
                 }
                 Dict* value = entry->val->as.dictionary;
@@ -252,10 +415,20 @@ static void udpInterface(Dict* config, struct Context* ctx)
                         continue;
                     }
                 }
-                Dict_putString(value, String_CONST("address"), key, perCallAlloc);
-                rpcCall(String_CONST("UDPInterface_beginConnection"), value, ctx, perCallAlloc);
+                Dict_putString(value, addressKey, key, perCallAlloc);
+                if (bulk) {
+                    connections = List_addDict(connections, value, perCallAlloc);
+                } else {
+                    rpcBatchCall(String_printf(perCallAlloc, "%s_beginConnection", type),
+                                 value, ctx);
+                }
                 entry = entry->next;
             }
+            if (connections) {
+                rpcBulkCall(String_printf(perCallAlloc, "%s_beginConnections", type),
+                            String_CONST("connections"), connections, ctx);
+            }
+            rpcBatchWait(ctx);
             Allocator_free(perCallAlloc);
         }
     }
@@ -309,12 +482,71 @@ static void ipTunnel(Dict* ifaceConf, struct Allocator* tempAlloc, struct Contex
             Dict_CONST(String_CONST("publicKeyOfNodeToConnectTo"), String_OBJ(s), NULL);
         rpcCall0(String_CONST("IpTunnel_connectTo"), &requestDict, ctx, tempAlloc, true);
     }
+
+    List* nat = Dict_getList(ifaceConf, String_CONST("natAddresses"));
+    for (int i = 0; (s = List_getString(nat, i)) != NULL; i++) {
+        Log_debug(ctx->logger, "Translating IpTunnel clients to [%s]", s->bytes);
+        Dict requestDict = Dict_CONST(String_CONST("address"), String_OBJ(s), NULL);
+        rpcCall0(String_CONST("IpTunnel_setNat"), &requestDict, ctx, tempAlloc, true);
+    }
+}
+
+static void sessionWarmup(Dict* conf, struct Allocator* tempAlloc, struct Context* ctx)
+{
+    if (!conf) {
+        return;
+    }
+    // Like the snapshot, the file must be opened before permissions are dropped.
+    String* file = Dict_getString(conf, String_CONST("file"));
+    if (file) {
+        Dict* d = Dict_new(tempAlloc);
+        Dict_putString(d, String_CONST("path"), file, tempAlloc);
+        String* countKey = String_CONST("count");
+        int64_t* count = Dict_getInt(conf, countKey);
+        if (count) {
+            Dict_putInt(d, countKey, *count, tempAlloc);
+        }
+        rpcCall0(String_CONST("SessionWarmup_open"), d, ctx, tempAlloc, false);
+    }
+
+    List* destinations = Dict_getList(conf, String_CONST("destinations"));
+    String* ip6;
+    for (int i = 0; (ip6 = List_getString(destinations, i)) != NULL; i++) {
+        Log_debug(ctx->logger, "Warming session to [%s]", ip6->bytes);
+        Dict requestDict = Dict_CONST(String_CONST("ip6"), String_OBJ(ip6), NULL);
+        rpcCall0(String_CONST("SessionWarmup_warm"), &requestDict, ctx, tempAlloc, false);
+    }
 }
 
 static void routerConfig(Dict* routerConf, struct Allocator* tempAlloc, struct Context* ctx)
 {
     tunInterface(Dict_getDict(routerConf, String_CONST("interface")), tempAlloc, ctx);
     ipTunnel(Dict_getDict(routerConf, String_CONST("ipTunnel")), tempAlloc, ctx);
+
+    int64_t* budget = Dict_getInt(routerConf, String_CONST("nodeStoreMemoryBudget"));
+    if (budget) {
+        Dict* d = Dict_new(tempAlloc);
+        Dict_putInt(d, String_CONST("bytes"), *budget, tempAlloc);
+        rpcCall(String_CONST("NodeStore_setMemoryBudget"), d, ctx, tempAlloc);
+    }
+
+    // Must come before security() so the snapshot is read before permissions are dropped.
+    String* snapshot = Dict_getString(routerConf, String_CONST("nodeStoreSnapshot"));
+    if (snapshot) {
+        Dict* d = Dict_new(tempAlloc);
+        Dict_putString(d, String_CONST("path"), snapshot, tempAlloc);
+        // Starting without the snapshot only means a slower start.
+        rpcCall0(String_CONST("NodeStoreSnapshot_open"), d, ctx, tempAlloc, false);
+    }
+
+    sessionWarmup(Dict_getDict(routerConf, String_CONST("sessionWarmup")), tempAlloc, ctx);
+
+    int64_t* maxPaths = Dict_getInt(routerConf, String_CONST("maxPaths"));
+    if (maxPaths) {
+        Dict* d = Dict_new(tempAlloc);
+        Dict_putInt(d, String_CONST("maxPaths"), *maxPaths, tempAlloc);
+        rpcCall(String_CONST("Ducttape_setMaxPaths"), d, ctx, tempAlloc);
+    }
 }
 
 #ifdef HAS_ETH_INTERFACE
@@ -390,16 +622,37 @@ static void ethInterface(Dict* config, struct Context* ctx)
 }
 #endif
 
-static void security(List* securityConf, struct Allocator* tempAlloc, struct Context* ctx)
+/** Descriptors left for the metrics server to accept connections after permissions are dropped. */
+#define METRICS_SPARE_FILES 8
+
+static void security(List* securityConf,
+                     bool metricsServer,
+                     struct Allocator* tempAlloc,
+                     struct Context* ctx)
 {
     Dict* d = Dict_new(tempAlloc);
     Dict_putString(d, String_CONST("user"), String_CONST("nobody"), tempAlloc);
     // it's ok if this fails
     rpcCall0(String_CONST("Security_setUser"), d, ctx, tempAlloc, false);
     d = Dict_new(tempAlloc);
+    int64_t spareFiles = (metricsServer) ? METRICS_SPARE_FILES : 0;
+    Dict_putInt(d, String_CONST("spareFiles"), spareFiles, tempAlloc);
     rpcCall(String_CONST("Security_dropPermissions"), d, ctx, tempAlloc);
 }
 
+/** @return true if a metrics server was started. */
+static bool metrics(Dict* metricsConf, struct Allocator* tempAlloc, struct Context* ctx)
+{
+    String* bind = Dict_getString(metricsConf, String_CONST("bind"));
+    if (!bind) {
+        return false;
+    }
+    Dict* d = Dict_new(tempAlloc);
+    Dict_putString(d, String_CONST("bind"), bind, tempAlloc);
+    rpcCall(String_CONST("Metrics_listen"), d, ctx, tempAlloc);
+    return true;
+}
+
 void Configurator_config(Dict* config,
                          struct Sockaddr* sockAddr,
                          String* adminPassword,
@@ -424,18 +677,42 @@ void Configurator_config(Dict* config,
         authorizedPasswords(authedPasswords, &ctx);
     }
 
+    // Before the interfaces because their sockets are set up for it when they are opened.
+    Dict* routerConf = Dict_getDict(config, String_CONST("router"));
+    int64_t* hugePages = Dict_getInt(routerConf, String_CONST("hugePages"));
+    if (hugePages && *hugePages) {
+        // Not worth refusing to start over.
+        rpcCall0(String_CONST("PoolAllocator_useHugePages"), Dict_new(tempAlloc), &ctx, tempAlloc,
+                 false);
+    }
+    int64_t* busyPoll = Dict_getInt(routerConf, String_CONST("busyPollMicroseconds"));
+    if (busyPoll) {
+        Dict* d = Dict_new(tempAlloc);
+        Dict_putInt(d, String_CONST("microseconds"), *busyPoll, tempAlloc);
+        rpcCall(String_CONST("EventBase_setBusyPoll"), d, &ctx, tempAlloc);
+    }
+    List* cpus = Dict_getList(routerConf, String_CONST("cpuAffinity"));
+    if (cpus) {
+        Dict* d = Dict_new(tempAlloc);
+        Dict_putList(d, String_CONST("cpus"), cpus, tempAlloc);
+        rpcCall(String_CONST("EventBase_setCpuAffinity"), d, &ctx, tempAlloc);
+    }
+
     Dict* ifaces = Dict_getDict(config, String_CONST("interfaces"));
-    udpInterface(ifaces, &ctx);
+    ipInterface("UDPInterface", ifaces, &ctx);
+    ipInterface("TCPInterface", ifaces, &ctx);
 
     #ifdef HAS_ETH_INTERFACE
         ethInterface(ifaces, &ctx);
     #endif
 
-    Dict* routerConf = Dict_getDict(config, String_CONST("router"));
     routerConfig(routerConf, tempAlloc, &ctx);
 
+    Dict* metricsConf = Dict_getDict(config, String_CONST("metrics"));
+    bool metricsServer = metrics(metricsConf, tempAlloc, &ctx);
+
     List* securityList = Dict_getList(config, String_CONST("security"));
-    security(securityList, tempAlloc, &ctx);
+    security(securityList, metricsServer, tempAlloc, &ctx);
 
     Dict* dnsConf = Dict_getDict(config, String_CONST("dns"));
     dns(dnsConf, &ctx, eh);
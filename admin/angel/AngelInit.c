@@ -13,6 +13,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "admin/angel/Angel.h"
+#include "admin/angel/Core.h"
 #include "admin/angel/InterfaceWaiter.h"
 #include "benc/Dict.h"
 #include "benc/String.h"
@@ -161,6 +162,9 @@ static void clientDisconnected(struct Pipe* p, int status)
  * given by "toCore".
  *
  * "user" is optional, if set the angel will setuid() that user's uid.
+ *
+ * If "singleProcess" is set to 1 in "admin", "core" is not needed and the core is run in a
+ * thread of the angel process, see Core_startThread().
  */
 int AngelInit_main(int argc, char** argv)
 {
@@ -196,25 +200,33 @@ int AngelInit_main(int argc, char** argv)
     String* pass = Dict_getString(admin, String_CONST("pass"));
     String* user = Dict_getString(admin, String_CONST("user"));
     String* corePipeName = Dict_getString(admin, String_CONST("corePipeName"));
+    int64_t* singleProcess = Dict_getInt(admin, String_CONST("singleProcess"));
 
-    if (!bind || !pass || (!core && !corePipeName)) {
+    if (!bind || !pass || (!core && !corePipeName && !(singleProcess && *singleProcess))) {
         Except_throw(eh, "missing configuration params in preconfig. [%s]", preConf->bytes);
     }
 
-    if (!corePipeName) {
-        char name[32] = {0};
-        Random_base32(rand, (uint8_t*)name, 31);
-        corePipeName = String_new(name, tempAlloc);
-    }
-
-    struct Pipe* corePipe = Pipe_named(corePipeName->bytes, eventBase, eh, alloc);
-    corePipe->logger = logger;
-    corePipe->onClose = coreDied;
-    struct Interface* coreIface = FramingInterface_new(65535, &corePipe->iface, alloc);
+    struct Interface* coreIface;
+    if (singleProcess && *singleProcess) {
+        Log_info(logger, "Initializing core in a thread of the angel process");
+        coreIface = Core_startThread(eventBase, alloc, eh);
 
-    if (core) {
-        Log_info(logger, "Initializing core [%s]", core->bytes);
-        initCore(core->bytes, corePipeName, eventBase, alloc, eh);
+    } else {
+        if (!corePipeName) {
+            char name[32] = {0};
+            Random_base32(rand, (uint8_t*)name, 31);
+            corePipeName = String_new(name, tempAlloc);
+        }
+
+        struct Pipe* corePipe = Pipe_named(corePipeName->bytes, eventBase, eh, alloc);
+        corePipe->logger = logger;
+        corePipe->onClose = coreDied;
+        coreIface = FramingInterface_new(65535, &corePipe->iface, alloc);
+
+        if (core) {
+            Log_info(logger, "Initializing core [%s]", core->bytes);
+            initCore(core->bytes, corePipeName, eventBase, alloc, eh);
+        }
     }
 
     Log_debug(logger, "Sending pre-configuration to core.");
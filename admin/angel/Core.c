@@ -12,6 +12,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include "util/events/libuv/UvWrapper.h"
 #include "admin/Admin.h"
 #include "admin/AdminLog.h"
 #include "admin/angel/Angel.h"
@@ -23,6 +24,7 @@
 #include "benc/serialization/BencSerializer.h"
 #include "benc/serialization/standard/StandardBencSerializer.h"
 #include "crypto/AddressCalc.h"
+#include "crypto/CryptoAuth_admin.h"
 #include "crypto/random/Random.h"
 #include "crypto/random/libuv/LibuvEntropyProvider.h"
 #include "dht/ReplyModule.h"
@@ -31,14 +33,17 @@
 #include "dht/dhtcore/RouterModule.h"
 #include "dht/dhtcore/RouterModule_admin.h"
 #include "dht/dhtcore/RouteTracer.h"
+#include "dht/dhtcore/RouteTracer_admin.h"
 #include "dht/dhtcore/SearchRunner.h"
 #include "dht/dhtcore/SearchRunner_admin.h"
 #include "dht/dhtcore/NodeStore_admin.h"
+#include "dht/dhtcore/NodeStoreSnapshot_admin.h"
 #include "dht/dhtcore/Janitor.h"
 #include "exception/Jmp.h"
 #include "interface/addressable/AddrInterface.h"
 #include "interface/addressable/UDPAddrInterface.h"
 #include "interface/UDPInterface_admin.h"
+#include "interface/TCPInterface_admin.h"
 #ifdef HAS_ETH_INTERFACE
 #include "interface/ETHInterface_admin.h"
 #endif
@@ -46,6 +51,7 @@
 #include "interface/InterfaceConnector.h"
 #include "interface/InterfaceController_admin.h"
 #include "interface/FramingInterface.h"
+#include "interface/ThreadInterface.h"
 #include "interface/ICMP6Generator.h"
 #include "interface/RainflyClient.h"
 #include "interface/RainflyClient_admin.h"
@@ -57,20 +63,32 @@
 #include "io/Reader.h"
 #include "io/Writer.h"
 #include "memory/Allocator.h"
-#include "memory/MallocAllocator.h"
+#include "memory/Allocator_admin.h"
+#include "memory/PoolAllocator_admin.h"
+#include "memory/PoolAllocator.h"
 #include "net/Ducttape.h"
+#include "net/Ducttape_admin.h"
+#include "net/SessionWarmup.h"
+#include "net/SessionWarmup_admin.h"
 #include "net/DefaultInterfaceController.h"
 #include "net/SwitchPinger.h"
 #include "net/SwitchPinger_admin.h"
 #include "switch/SwitchCore.h"
+#include "switch/SwitchCore_admin.h"
 #include "tunnel/IpTunnel.h"
 #include "tunnel/IpTunnel_admin.h"
 #include "util/events/Timeout.h"
 #include "util/events/EventBase.h"
 #include "util/events/Pipe.h"
 #include "util/events/Timeout.h"
+#include "util/log/BufferedLog.h"
 #include "util/log/FileWriterLog.h"
 #include "util/log/IndirectLog.h"
+#include "util/Metrics.h"
+#include "util/Metrics_admin.h"
+#include "util/events/EventBase_admin.h"
+#include "util/PacketCapture_admin.h"
+#include "util/PacketTrace_admin.h"
 #include "util/Security_admin.h"
 #include "util/Security.h"
 #include "util/platform/netdev/NetDev.h"
@@ -147,6 +165,9 @@ struct Context
     struct Hermes* hermes;
     struct EventBase* base;
     String* exitTxid;
+
+    /** True if the angel is a thread of this process, see Core_startThread(). */
+    bool singleProcess;
 };
 
 static void adminMemory(Dict* input, void* vcontext, String* txid, struct Allocator* requestAlloc)
@@ -158,28 +179,39 @@ static void adminMemory(Dict* input, void* vcontext, String* txid, struct Alloca
     Admin_sendMessage(&d, txid, context->admin);
 }
 
-static void shutdown(void* vcontext)
+static void shutdownCore(void* vcontext)
 {
     struct Context* context = vcontext;
     Allocator_free(context->allocator);
 }
 
-static void onAngelExitResponse(Dict* message, void* vcontext)
+static void exitCore(struct Context* context)
 {
-    struct Context* context = vcontext;
-    Log_info(context->logger, "Angel stopped");
     Log_info(context->logger, "Exiting");
     Dict d = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST("none")), NULL);
     Admin_sendMessage(&d, context->exitTxid, context->admin);
-    Timeout_setTimeout(shutdown, context, 1, context->base, context->allocator);
+    Timeout_setTimeout(shutdownCore, context, 1, context->base, context->allocator);
+}
+
+static void onAngelExitResponse(Dict* message, void* vcontext)
+{
+    struct Context* context = vcontext;
+    Log_info(context->logger, "Angel stopped");
+    exitCore(context);
 }
 
 static void adminExit(Dict* input, void* vcontext, String* txid, struct Allocator* requestAlloc)
 {
     struct Context* context = vcontext;
     Log_info(context->logger, "Got request to exit");
-    Log_info(context->logger, "Stopping angel");
     context->exitTxid = String_clone(txid, context->allocator);
+    if (context->singleProcess) {
+        // The angel would take the whole process down before this could answer,
+        // when the core thread stops the process exits.
+        exitCore(context);
+        return;
+    }
+    Log_info(context->logger, "Stopping angel");
     Dict angelExit = Dict_CONST(String_CONST("q"), String_OBJ(String_CONST("Angel_exit")), NULL);
     Hermes_callAngel(&angelExit,
                      onAngelExitResponse,
@@ -310,6 +342,124 @@ static void angelResponse(Dict* resp, void* vNULL)
     // do nothing
 }
 
+static struct SwitchCore_Stats switchTotals(struct SwitchCore* core)
+{
+    struct SwitchCore_Stats total = { .forwardedPackets = 0 };
+    struct SwitchCore_Stats stats;
+    uint64_t label;
+    for (uint32_t i = 0; ; i++) {
+        int ret = SwitchCore_getStats(i, &stats, &label, core);
+        if (ret == SwitchCore_getStats_END) {
+            break;
+        } else if (ret) {
+            continue;
+        }
+        total.forwardedPackets += stats.forwardedPackets;
+        total.forwardedBytes += stats.forwardedBytes;
+        total.errorPackets += stats.errorPackets;
+        for (int j = 0; j < SwitchCore_DropReason_COUNT; j++) {
+            total.droppedPackets[0] += stats.droppedPackets[j];
+        }
+    }
+    return total;
+}
+
+static uint64_t switchForwardedPackets(void* vcore)
+{
+    return switchTotals((struct SwitchCore*) vcore).forwardedPackets;
+}
+
+static uint64_t switchForwardedBytes(void* vcore)
+{
+    return switchTotals((struct SwitchCore*) vcore).forwardedBytes;
+}
+
+static uint64_t switchErrorPackets(void* vcore)
+{
+    return switchTotals((struct SwitchCore*) vcore).errorPackets;
+}
+
+static uint64_t switchDroppedPackets(void* vcore)
+{
+    return switchTotals((struct SwitchCore*) vcore).droppedPackets[0];
+}
+
+static uint64_t sessionCount(void* vsm)
+{
+    return SessionManager_getSessionCount((struct SessionManager*) vsm);
+}
+
+static uint64_t nodeStoreSize(void* vnodeStore)
+{
+    return ((struct NodeStore*) vnodeStore)->size;
+}
+
+static uint64_t bytesAllocated(void* valloc)
+{
+    return Allocator_bytesAllocated((struct Allocator*) valloc);
+}
+
+static uint64_t loopBusyNanoseconds(void* vbase)
+{
+    return EventBase_stats((struct EventBase*) vbase)->busyNanoseconds;
+}
+
+static uint64_t loopIdleNanoseconds(void* vbase)
+{
+    return EventBase_stats((struct EventBase*) vbase)->idleNanoseconds;
+}
+
+static uint64_t loopStalls(void* vbase)
+{
+    return EventBase_stats((struct EventBase*) vbase)->stalls;
+}
+
+static void registerMetrics(struct Metrics* metrics,
+                            struct SwitchCore* switchCore,
+                            struct CryptoAuth* cryptoAuth,
+                            struct SessionManager* sm,
+                            struct NodeStore* nodeStore,
+                            struct RouterModule* routerModule,
+                            struct SwitchPinger* sp,
+                            struct PacketTrace* packetTrace,
+                            struct EventBase* eventBase,
+                            struct Allocator* alloc)
+{
+    Metrics_addRead(metrics, Metrics_Type_COUNTER, "cjdns_switch_forwarded_packets_total",
+                    "Packets forwarded by the switch.", switchForwardedPackets, switchCore);
+    Metrics_addRead(metrics, Metrics_Type_COUNTER, "cjdns_switch_forwarded_bytes_total",
+                    "Bytes forwarded by the switch.", switchForwardedBytes, switchCore);
+    Metrics_addRead(metrics, Metrics_Type_COUNTER, "cjdns_switch_error_packets_total",
+                    "Errors sent back by the switch.", switchErrorPackets, switchCore);
+    Metrics_addRead(metrics, Metrics_Type_COUNTER, "cjdns_switch_dropped_packets_total",
+                    "Packets dropped by the switch.", switchDroppedPackets, switchCore);
+    Metrics_addHistogram(metrics, "cjdns_cryptoauth_handshake_milliseconds",
+                         "Time from sending a hello or key to getting the answer.",
+                         cryptoAuth->handshakeTimes);
+    Metrics_addRead(metrics, Metrics_Type_GAUGE, "cjdns_sessions",
+                    "End to end sessions.", sessionCount, sm);
+    Metrics_addRead(metrics, Metrics_Type_GAUGE, "cjdns_nodestore_nodes",
+                    "Nodes in the routing table.", nodeStoreSize, nodeStore);
+    Metrics_addHistogram(metrics, "cjdns_dht_response_milliseconds",
+                         "Response times of DHT queries.",
+                         RouterModule_responseTimes(routerModule));
+    Metrics_addHistogram(metrics, "cjdns_switch_ping_milliseconds",
+                         "Round trip times of switch pings.", SwitchPinger_rtts(sp));
+    Metrics_addHistogram(metrics, "cjdns_packet_nanoseconds",
+                         "Time to handle sampled packets, see PacketTrace_setSampling().",
+                         &packetTrace->histograms[PacketTrace_Stage_TOTAL]);
+    Metrics_addRead(metrics, Metrics_Type_GAUGE, "cjdns_allocated_bytes",
+                    "Memory allocated by the core.", bytesAllocated, alloc);
+    Metrics_addRead(metrics, Metrics_Type_COUNTER, "cjdns_eventloop_busy_nanoseconds_total",
+                    "Time the event loop spent running callbacks.",
+                    loopBusyNanoseconds, eventBase);
+    Metrics_addRead(metrics, Metrics_Type_COUNTER, "cjdns_eventloop_idle_nanoseconds_total",
+                    "Time the event loop spent waiting for events.",
+                    loopIdleNanoseconds, eventBase);
+    Metrics_addRead(metrics, Metrics_Type_COUNTER, "cjdns_eventloop_stalls_total",
+                    "Callbacks which took longer than the stall threshold.", loopStalls, eventBase);
+}
+
 void Core_init(struct Allocator* alloc,
                struct Log* logger,
                struct EventBase* eventBase,
@@ -326,6 +476,7 @@ void Core_init(struct Allocator* alloc,
     Dict* adminConf = Dict_getDict(config, String_CONST("admin"));
     String* pass = Dict_getString(adminConf, String_CONST("pass"));
     String* bind = Dict_getString(adminConf, String_CONST("bind"));
+    int64_t* singleProcess = Dict_getInt(adminConf, String_CONST("singleProcess"));
     if (!(pass && privateKeyHex && bind)) {
         if (!pass) {
             Except_throw(eh, "Expected 'pass'");
@@ -370,12 +521,16 @@ void Core_init(struct Allocator* alloc,
     // --------------------- Setup the Logger --------------------- //
     Dict* logging = Dict_getDict(config, String_CONST("logging"));
     String* logTo = Dict_getString(logging, String_CONST("logTo"));
+    // Messages are written once the current event has been handled so that a burst of logging
+    // does not hold up the packets.
     if (logTo && String_equals(logTo, String_CONST("stdout"))) {
-        // do nothing, continue logging to stdout.
+        // continue logging to stdout.
+        logger = BufferedLog_new(logger, eventBase, alloc);
     } else {
         struct Log* adminLogger = AdminLog_registerNew(admin, alloc, rand);
-        IndirectLog_set(logger, adminLogger);
-        logger = adminLogger;
+        struct Log* bufferedLogger = BufferedLog_new(adminLogger, eventBase, alloc);
+        IndirectLog_set(logger, bufferedLogger);
+        logger = bufferedLogger;
     }
 
     // CryptoAuth
@@ -385,7 +540,7 @@ void Core_init(struct Allocator* alloc,
 
     struct Sockaddr* myAddr = Sockaddr_fromBytes(addr.ip6.bytes, Sockaddr_AF_INET6, alloc);
 
-    struct SwitchCore* switchCore = SwitchCore_new(logger, alloc);
+    struct SwitchCore* switchCore = SwitchCore_new(logger, eventBase, alloc);
     struct DHTModuleRegistry* registry = DHTModuleRegistry_new(alloc);
     ReplyModule_register(registry, alloc);
 
@@ -416,7 +571,7 @@ void Core_init(struct Allocator* alloc,
                 eventBase,
                 rand);
 
-    EncodingSchemeModule_register(registry, nodeStore, logger, alloc);
+    EncodingSchemeModule_register(registry, nodeStore, logger, eventBase, alloc);
 
     SerializationModule_register(registry, logger, alloc);
 
@@ -435,6 +590,7 @@ void Core_init(struct Allocator* alloc,
 
     struct SwitchPinger* sp =
         SwitchPinger_new(&dt->switchPingerIf, eventBase, rand, logger, alloc);
+    Ducttape_setSwitchPinger(dt, sp);
 
     // Interfaces.
     struct InterfaceController* ifController =
@@ -446,6 +602,24 @@ void Core_init(struct Allocator* alloc,
                                        sp,
                                        rand,
                                        alloc);
+    Ducttape_setInterfaceController(dt, ifController);
+
+    // Off until it is turned on with PacketTrace_setSampling().
+    struct PacketTrace* packetTrace = PacketTrace_new(alloc);
+    dt->packetTrace = packetTrace;
+    ifController->packetTrace = packetTrace;
+
+    // Nothing is copied until PacketCapture_start() is called.
+    struct PacketCapture* packetCapture = PacketCapture_new(eventBase, alloc);
+    ifController->packetCapture = packetCapture;
+    dt->packetCapture = packetCapture;
+
+    struct SessionWarmup* warmup = SessionWarmup_new(searchRunner,
+                                                     routerModule,
+                                                     dt->sessionManager,
+                                                     eventBase,
+                                                     logger,
+                                                     alloc);
 
     // ------------------- DNS -------------------------//
 
@@ -457,26 +631,44 @@ void Core_init(struct Allocator* alloc,
     Assert_true(!Sockaddr_parse("[fc00::1]:53", &rainflyAddr));
     struct AddrInterface* magicUDP =
         PacketHeaderToUDPAddrInterface_new(&dt->magicInterface, alloc, &rainflyAddr.addr);
-    DNSServer_new(magicUDP, logger, rainfly);
+    DNSServer_new(magicUDP, eventBase, logger, rainfly);
 
 
     // ------------------- Register RPC functions ----------------------- //
     InterfaceController_admin_register(ifController, admin, alloc);
     SwitchPinger_admin_register(sp, admin, alloc);
+    SwitchCore_admin_register(switchCore, admin, alloc);
     UDPInterface_admin_register(eventBase, alloc, logger, admin, ifController);
+    TCPInterface_admin_register(eventBase, alloc, logger, admin, ifController);
 #ifdef HAS_ETH_INTERFACE
     ETHInterface_admin_register(eventBase, alloc, logger, admin, ifController);
 #endif
-    NodeStore_admin_register(nodeStore, admin, alloc);
-    RouterModule_admin_register(routerModule, admin, alloc);
+    NodeStore_admin_register(nodeStore, admin, eventBase, alloc);
+    NodeStoreSnapshot_admin_register(nodeStore, routerModule, eventBase, logger, admin, alloc);
+    RouterModule_admin_register(routerModule, nodeStore, admin, alloc);
+    RouteTracer_admin_register(routeTracer, nodeStore, admin, alloc);
     SearchRunner_admin_register(searchRunner, admin, alloc);
     AuthorizedPasswords_init(admin, cryptoAuth, alloc);
+    CryptoAuth_admin_register(cryptoAuth, admin, alloc);
     Admin_registerFunction("ping", adminPing, admin, false, NULL, admin);
     Core_admin_register(myAddr, dt, logger, ipTun, alloc, admin, eventBase);
     Security_admin_register(alloc, logger, admin);
+    Allocator_admin_register(alloc, admin);
+    PoolAllocator_admin_register(alloc, logger, admin);
     IpTunnel_admin_register(ipTun, admin, alloc);
     SessionManager_admin_register(dt->sessionManager, admin, alloc);
+    Ducttape_admin_register(dt, admin, alloc);
+    SessionWarmup_admin_register(warmup, admin, alloc);
     RainflyClient_admin_register(rainfly, admin, alloc);
+    PacketTrace_admin_register(packetTrace, admin, alloc);
+    PacketCapture_admin_register(packetCapture, admin, alloc);
+    EventBase_admin_register(eventBase, logger, admin, alloc);
+
+    // Served once the metrics section of the config calls Metrics_listen().
+    struct Metrics* metrics = Metrics_new(alloc);
+    registerMetrics(metrics, switchCore, cryptoAuth, dt->sessionManager, nodeStore,
+                    routerModule, sp, packetTrace, eventBase, alloc);
+    Metrics_admin_register(metrics, eventBase, logger, admin, alloc);
 
     struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
         .allocator = alloc,
@@ -484,12 +676,77 @@ void Core_init(struct Allocator* alloc,
         .logger = logger,
         .hermes = hermes,
         .base = eventBase,
+        .singleProcess = (singleProcess && *singleProcess)
     }));
     Admin_registerFunction("memory", adminMemory, ctx, false, NULL, admin);
     Admin_registerFunction("Core_exit", adminExit, ctx, true, NULL, admin);
 }
 
 
+/** Setup the logger which is used until Core_init() reads the logging configuration. */
+static struct Log* newPreLogger(struct Allocator* alloc)
+{
+    struct Log* preLogger = FileWriterLog_new(stderr, alloc);
+    struct Log* logger = IndirectLog_new(alloc);
+    IndirectLog_set(logger, preLogger);
+    return logger;
+}
+
+/** Setup the PRNG and change the canary value of the core's allocator. */
+static struct Random* newRandom(struct EventBase* eventBase,
+                                struct Log* logger,
+                                struct Allocator* alloc,
+                                struct Except* eh)
+{
+    struct Random* rand = LibuvEntropyProvider_newDefaultRandom(eventBase, logger, eh, alloc);
+    Allocator_setCanary(alloc, (unsigned long)Random_uint64(rand));
+    return rand;
+}
+
+struct CoreThread
+{
+    struct Allocator* alloc;
+    struct EventBase* eventBase;
+    struct Interface* angelIface;
+};
+
+static void coreThread(void* vCoreThread)
+{
+    struct CoreThread* ct = vCoreThread;
+    struct Except* eh = NULL;
+    struct Log* logger = newPreLogger(ct->alloc);
+    struct Random* rand = newRandom(ct->eventBase, logger, ct->alloc, eh);
+
+    Core_init(ct->alloc, logger, ct->eventBase, ct->angelIface, rand, eh);
+    EventBase_beginLoop(ct->eventBase);
+
+    // The loop only ends once Core_exit has been called.
+    exit(0);
+}
+
+/** See: Core.h */
+struct Interface* Core_startThread(struct EventBase* angelBase,
+                                   struct Allocator* angelAlloc,
+                                   struct Except* eh)
+{
+    // Everything the core uses is made here and then given to the thread, the angel must
+    // never touch it again.
+    struct Allocator* alloc = PoolAllocator_new(ALLOCATOR_FAILSAFE);
+    struct CoreThread* ct = Allocator_calloc(alloc, sizeof(struct CoreThread), 1);
+    ct->alloc = alloc;
+    ct->eventBase = EventBase_new(alloc);
+
+    struct Interface* coreIface;
+    ThreadInterface_newPair(&coreIface, angelBase, angelAlloc,
+                            &ct->angelIface, ct->eventBase, alloc);
+
+    uv_thread_t* thread = Allocator_malloc(angelAlloc, sizeof(uv_thread_t));
+    if (uv_thread_create(thread, coreThread, ct)) {
+        Except_throw(eh, "Failed to start core thread.");
+    }
+    return coreIface;
+}
+
 int Core_main(int argc, char** argv)
 {
     struct Except* eh = NULL;
@@ -498,19 +755,10 @@ int Core_main(int argc, char** argv)
         Except_throw(eh, "This is internal to cjdns and shouldn't started manually.");
     }
 
-    struct Allocator* alloc = MallocAllocator_new(ALLOCATOR_FAILSAFE);
-    struct Log* preLogger = FileWriterLog_new(stderr, alloc);
+    struct Allocator* alloc = PoolAllocator_new(ALLOCATOR_FAILSAFE);
     struct EventBase* eventBase = EventBase_new(alloc);
-
-    // -------------------- Setup the Pre-Logger ---------------------- //
-    struct Log* logger = IndirectLog_new(alloc);
-    IndirectLog_set(logger, preLogger);
-
-    // -------------------- Setup the PRNG ---------------------- //
-    struct Random* rand = LibuvEntropyProvider_newDefaultRandom(eventBase, logger, eh, alloc);
-
-    // -------------------- Change Canary Value ---------------------- //
-    Allocator_setCanary(alloc, (unsigned long)Random_uint64(rand));
+    struct Log* logger = newPreLogger(alloc);
+    struct Random* rand = newRandom(eventBase, logger, alloc, eh);
 
     // The first read inside of getInitialConfig() will begin it waiting.
     struct Pipe* angelPipe = Pipe_named(argv[2], eventBase, eh, alloc);
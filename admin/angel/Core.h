@@ -39,6 +39,21 @@ void Core_init(struct Allocator* alloc,
                struct Random* rand,
                struct Except* eh);
 
+/**
+ * Run the core in a new thread of this process rather than spawning a process for it.
+ * It gets an allocator and event loop of its own and talks to the angel over a
+ * ThreadInterface. This saves memory on small devices, but everything the core does
+ * to drop privileges, such as setuid(), applies to the angel too.
+ *
+ * @param angelBase the angel's event loop, which messages from the core are received on.
+ * @param angelAlloc the angel's allocator.
+ * @param eh thrown to if the thread cannot be started.
+ * @return the angel's end of the connection, which Core_init() expects its config on.
+ */
+struct Interface* Core_startThread(struct EventBase* angelBase,
+                                   struct Allocator* angelAlloc,
+                                   struct Except* eh);
+
 int Core_main(int argc, char** argv);
 
 #endif
@@ -26,6 +26,7 @@
 #include "crypto/AddressCalc.h"
 #include "crypto/CryptoAuth.h"
 #include "crypto/CryptoAuth_benchmark.h"
+#include "crypto/KeySearch.h"
 #include "dht/ReplyModule.h"
 #include "dht/SerializationModule.h"
 #include "dht/dhtcore/RouterModule_admin.h"
@@ -35,7 +36,6 @@
 #include "io/Reader.h"
 #include "io/ArrayReader.h"
 #include "io/ArrayWriter.h"
-#include "io/FileReader.h"
 #include "io/Writer.h"
 #include "io/FileWriter.h"
 #include "benc/serialization/BencSerializer.h"
@@ -49,47 +49,89 @@
 #include "net/SwitchPinger.h"
 #include "net/SwitchPinger_admin.h"
 #include "switch/SwitchCore.h"
+#include "switch/SwitchCore_benchmark.h"
+#include "test/Benchmarks.h"
+#include "test/Pipeline_benchmark.h"
+#include "test/Simulator.h"
 #include "util/platform/libc/string.h"
 #include "util/events/EventBase.h"
 #include "util/events/Pipe.h"
 #include "util/events/Process.h"
 #include "util/Assert.h"
 #include "util/Base32.h"
+#include "util/Bits.h"
 #include "util/Hex.h"
 #include "util/Security.h"
 #include "util/log/WriterLog.h"
 #include "util/version/Version.h"
 
-#include "crypto_scalarmult_curve25519.h"
-
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #define DEFAULT_TUN_DEV "tun0"
 
+static void keySearchProgress(uint64_t keysTried, uint64_t milliseconds, void* context)
+{
+    uint64_t perSecond = (milliseconds) ? keysTried * 1000 / milliseconds : keysTried;
+    fprintf(stderr, "Tried [%llu] keys in [%llu] milliseconds, [%llu] keys per second.\n",
+            (unsigned long long) keysTried,
+            (unsigned long long) milliseconds,
+            (unsigned long long) perSecond);
+}
+
+/**
+ * Parse an address prefix, written as hex digits such as "fc00ab".
+ *
+ * @return the number of bits in the prefix or -1 if it is not valid.
+ */
+static int parsePrefix(uint8_t prefixOut[16], char* hex)
+{
+    int length = strlen(hex);
+    if (length < 2 || length > 32) {
+        return -1;
+    }
+    Bits_memset(prefixOut, 0, 16);
+    for (int i = 0; i < length; i++) {
+        if (!Hex_isHexEntity(hex[i])) {
+            return -1;
+        }
+        int nibble = Hex_decodeByte('0', hex[i]);
+        prefixOut[i / 2] |= (i % 2) ? nibble : nibble << 4;
+    }
+    return length * 4;
+}
+
 static int genAddress(uint8_t addressOut[40],
                       uint8_t privateKeyHexOut[65],
                       uint8_t publicKeyBase32Out[53],
-                      struct Random* rand)
+                      uint8_t prefix[16],
+                      int prefixBits,
+                      struct Random* rand,
+                      struct Allocator* alloc)
 {
-    struct Address address;
-    uint8_t privateKey[32];
-
-    for (;;) {
-        Random_bytes(rand, privateKey, 32);
-        crypto_scalarmult_curve25519_base(address.key, privateKey);
-        // Brute force for keys until one matches FC00:/8
-        if (AddressCalc_addressForPublicKey(address.ip6.bytes, address.key)) {
-            Hex_encode(privateKeyHexOut, 65, privateKey, 32);
-            Base32_encode(publicKeyBase32Out, 53, address.key, 32);
-            Address_printIp(addressOut, &address);
-            return 0;
-        }
+    struct KeySearch_Key key;
+    // Brute force on every core for a key whose address begins with the prefix.
+    if (KeySearch_find(&key, prefix, prefixBits, 0, keySearchProgress, NULL, rand, alloc)) {
+        return -1;
     }
+
+    struct Address address;
+    Bits_memcpyConst(address.key, key.publicKey, 32);
+    Bits_memcpyConst(address.ip6.bytes, key.ip6, 16);
+    Hex_encode(privateKeyHexOut, 65, key.privateKey, 32);
+    Base32_encode(publicKeyBase32Out, 53, address.key, 32);
+    Address_printIp(addressOut, &address);
+    Bits_memset(&key, 0, sizeof(struct KeySearch_Key));
+    return 0;
 }
 
-static int genconf(struct Random* rand)
+/**
+ * @param prefix the bytes which the generated address must begin with.
+ * @param prefixBits the number of bits of the prefix, 8 if only AddressCalc_PREFIX is wanted.
+ */
+static int genconf(uint8_t prefix[16], int prefixBits, struct Random* rand, struct Allocator* alloc)
 {
     uint8_t password[32];
     uint8_t password2[32];
@@ -111,7 +153,10 @@ static int genconf(struct Random* rand)
     uint8_t publicKeyBase32[53];
     uint8_t address[40];
     uint8_t privateKeyHex[65];
-    genAddress(address, privateKeyHex, publicKeyBase32, rand);
+    if (genAddress(address, privateKeyHex, publicKeyBase32, prefix, prefixBits, rand, alloc)) {
+        fprintf(stderr, "Address prefix must begin with fc.\n");
+        return -1;
+    }
 
     printf("{\n");
     printf("    // Private key:\n"
@@ -168,7 +213,11 @@ static int genconf(struct Random* rand)
            "        \"password\": \"%s\"\n", adminPassword);
     printf("    },\n"
            "\n"
-           "\n\n" // TODO: Why is this needed and where are these newlines going?!!
+           "    // Serve counters and latencies over HTTP at /metrics in the Prometheus text\n"
+           "    // format so that monitoring can scrape them, keep it on a loopback address.\n"
+           "    //\"metrics\": { \"bind\": \"127.0.0.1:9153\" },\n"
+           "\n");
+    printf("\n\n" // TODO: Why is this needed and where are these newlines going?!!
            "\n"
            "    // Interfaces to connect to the switch core.\n"
            "    \"interfaces\":\n"
@@ -243,8 +292,44 @@ static int genconf(struct Random* rand)
            "            //\"tunDevice\": \"" DEFAULT_TUN_DEV "\"\n"
 #endif
            "        },\n"
+           "\n");
+    printf("        // The most memory, in bytes, which the table of known nodes may use.\n"
+           "        // When it is full, the nodes with the least reach are replaced.\n"
+           "        // Lower this on devices with little RAM.\n"
+           "        //\"nodeStoreMemoryBudget\": 1048576,\n"
+           "\n"
+           "        // On a dedicated router, keep checking for packets for this many\n"
+           "        // microseconds after the last one before going to sleep. This lowers\n"
+           "        // the latency of each hop at the cost of keeping a core busy.\n"
+           "        //\"busyPollMicroseconds\": 50,\n"
+           "\n"
+           "        // Run the router only on these CPUs, on a machine with more than one\n"
+           "        // socket pick the ones beside the network card.\n"
+           "        //\"cpuAffinity\": [ 2, 3 ],\n"
+           "\n"
+           "        // Keep the tables and packet buffers of a big router in huge pages.\n"
+           "        // Memory taken this way is kept until cjdns exits.\n"
+           "        //\"hugePages\": 1,\n"
            "\n"
-           "        // System for tunneling IPv4 and ICANN IPv6 through cjdns.\n"
+           "        // A file to save the table of known nodes to every minute and load it from\n"
+           "        // at startup so that a restarted node can find routes right away.\n"
+           "        //\"nodeStoreSnapshot\": \"./cjdroute.nodes\",\n"
+           "\n"
+           "        // Set up sessions to these nodes at startup, and to the nodes which were\n"
+           "        // used the most before the last shutdown, so the first packets to them\n"
+           "        // don't have to wait for a search and a key exchange.\n"
+           "        //\"sessionWarmup\":\n"
+           "        //{\n"
+           "        //    \"file\": \"./cjdroute.sessions\",\n"
+           "        //    \"count\": 16,\n"
+           "        //    \"destinations\": [ \"fc00:0000:0000:0000:0000:0000:0000:0001\" ]\n"
+           "        //},\n"
+           "\n"
+           "        // Spread the flows to a peer across up to this many paths which don't\n"
+           "        // share a link, each flow keeps to one path so it is not reordered.\n"
+           "        //\"maxPaths\": 2,\n"
+           "\n");
+    printf("        // System for tunneling IPv4 and ICANN IPv6 through cjdns.\n"
            "        // This is using the cjdns switch layer as a VPN carrier.\n"
            "        \"ipTunnel\":\n"
            "        {\n"
@@ -275,11 +360,20 @@ static int genconf(struct Random* rand)
            "                // \"6743gf5tw80ExampleExampleExampleExamplevlyb23zfnuzv0.k\",\n"
            "                // \"pw9tfmr8pcrExampleExampleExampleExample8rhg1pgwpwf80.k\",\n"
            "                // \"g91lxyxhq0kExampleExampleExampleExample6t0mknuhw75l0.k\"\n"
+           "            ],\n"
+           "\n"
+           "            // Translate the nodes which are allowed to connect to one public address\n"
+           "            // for each of IPv4 and IPv6 instead of using iptables. The address must\n"
+           "            // be routed to the TUN device but not assigned to any interface.\n"
+           "            \"natAddresses\":\n"
+           "            [\n"
+           "                // \"2001:123:ab::1\",\n"
+           "                // \"192.0.2.1\"\n"
            "            ]\n"
            "        }\n"
            "    },\n"
-           "\n"
-           "    // Tear down inactive CryptoAuth sessions after this number of seconds\n"
+           "\n");
+    printf("    // Tear down inactive CryptoAuth sessions after this number of seconds\n"
            "    // to make them more forgiving in the event that they become desynchronized.\n"
            "    \"resetAfterInactivitySeconds\": 100,\n"
            "\n"
@@ -311,6 +405,11 @@ static int genconf(struct Random* rand)
            "    // Recommended for use in conjunction with \"logTo\":\"stdout\".\n"
            "    \"noBackground\":0,\n"
            "\n");
+    printf("    // If set to non-zero, the core runs as a thread of the angel process rather than\n"
+           "    // as a process of its own. This saves memory on small devices but the angel is\n"
+           "    // then bound by the \"security\" settings just as the core is.\n"
+           "    \"singleProcess\":0,\n"
+           "\n");
     printf("    // DNS, this server will be available at address fc00::1\n"
            "    \"dns\":\n"
            "    {\n"
@@ -331,7 +430,10 @@ static int genconf(struct Random* rand)
            "        ],\n"
            "\n"
            "        // At least this many of \"keys\" must agree or else the request will fail.\n"
-           "        \"minSignatures\":2\n"
+           "        \"minSignatures\":2,\n"
+           "\n"
+           "        // Ask this many of the fastest \"servers\" at once, first good answer wins.\n"
+           "        \"parallelRequests\":1\n"
            "    }\n"
            "\n"
            "}\n");
@@ -341,12 +443,15 @@ static int genconf(struct Random* rand)
 
 static int usage(char* appName)
 {
-    printf("Usage: %s [--help] [--genconf] [--bench] [--version] [--cleanconf]\n"
+    printf("Usage: %s [--help] [--genconf [--prefix <hex>]] [--bench [name]]\n"
+           "    [--simulate [nodes]] [--replay <file.pcapng>] [--version] [--cleanconf]\n"
            "\n"
            "To get the router up and running.\n"
            "Step 1:\n"
            "  Generate a new configuration file.\n"
            "    %s --genconf > cjdroute.conf\n"
+           "  Add --prefix fc1234 to search on every core for an address beginning with fc12:34,\n"
+           "  each hex digit after fc makes the search take 16 times longer.\n"
            "\n"
            "Step 2:\n"
            "  Find somebody to connect to.\n"
@@ -363,16 +468,114 @@ static int usage(char* appName)
     return 0;
 }
 
-static int benchmark()
+/** The largest capture which is replayed. */
+#define REPLAY_MAX_BYTES (1<<28)
+
+/**
+ * Replay the packets from the TUN in a capture made with PacketCapture_start() at the tunIn
+ * point, see test/Pipeline_benchmark.h.
+ */
+static int replay(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Unable to open [%s]\n", path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    if (length < 0 || length > REPLAY_MAX_BYTES) {
+        fprintf(stderr, "[%s] is not a capture which can be replayed\n", path);
+        fclose(file);
+        return -1;
+    }
+    struct Allocator* alloc = MallocAllocator_new(length + (1<<22));
+    uint8_t* pcapng = Allocator_malloc(alloc, length + 1);
+    length = fread(pcapng, 1, length, file);
+    fclose(file);
+
+    Dict* result = Pipeline_replay(pcapng, length, alloc);
+    if (!result) {
+        fprintf(stderr, "No packets from the TUN in [%s]\n", path);
+        return -1;
+    }
+    printf("\nJSON results:\n");
+    struct Writer* stdoutWriter = FileWriter_new(stdout, alloc);
+    JsonBencSerializer_get()->serializeDictionary(stdoutWriter, result);
+    printf("\n");
+    return 0;
+}
+
+/**
+ * Run the benchmark cases and print the results as JSON so they can be compared across commits,
+ * if no prefix is given to pick some of the cases, the benchmarks of whole components follow.
+ */
+static int benchmark(const char* prefix)
 {
     struct Allocator* alloc = MallocAllocator_new(1<<22);
+    printf("These metrics are the time taken by one operation of each case.\n");
+    List* results = Benchmarks_run(prefix, alloc);
+    if (!results) {
+        fprintf(stderr, "No benchmark begins with [%s]\n", prefix);
+        return -1;
+    }
+    Dict* out = Dict_new(alloc);
+    Dict_putInt(out, String_CONST("protocolVersion"), Version_CURRENT_PROTOCOL, alloc);
+    Dict_putList(out, String_CONST("cases"), results, alloc);
+    printf("\nJSON results:\n");
+    struct Writer* stdoutWriter = FileWriter_new(stdout, alloc);
+    JsonBencSerializer_get()->serializeDictionary(stdoutWriter, out);
+    printf("\n\n");
+    if (prefix) {
+        return 0;
+    }
+
     struct EventBase* base = EventBase_new(alloc);
     struct Writer* logWriter = FileWriter_new(stdout, alloc);
     struct Log* logger = WriterLog_new(logWriter, alloc);
     CryptoAuth_benchmark(base, logger, alloc);
+    SwitchCore_benchmark(base, logger, alloc);
+    Pipeline_benchmark(base, logger, alloc);
     return 0;
 }
 
+/** Memory for each simulated node, mostly its NodeStore. */
+#define SIMULATOR_BYTES_PER_NODE (1<<20)
+
+/** Simulate a network of many nodes in virtual time, see test/Simulator.h. */
+static int simulate(int nodeCount)
+{
+    struct Simulator_Config conf = { .nodeCount = nodeCount };
+    unsigned long nodes = (nodeCount > 0) ? nodeCount : 1000;
+    struct Allocator* alloc = MallocAllocator_new(nodes * SIMULATOR_BYTES_PER_NODE);
+    struct Writer* logWriter = FileWriter_new(stdout, alloc);
+    struct Log* logger = WriterLog_new(logWriter, alloc);
+    struct Simulator_Result* result = Simulator_run(&conf, alloc);
+    Simulator_log(&conf, result, logger);
+    return 0;
+}
+
+/**
+ * Read all of the configuration into memory so that it is parsed from a buffer rather
+ * than a byte at a time from the file.
+ */
+static struct Reader* readConfig(FILE* file, struct Allocator* alloc)
+{
+    uint32_t size = 4096;
+    uint32_t length = 0;
+    uint8_t* buff = Allocator_malloc(alloc, size);
+    size_t amount;
+    while ((amount = fread(&buff[length], 1, size - length, file)) > 0) {
+        length += amount;
+        if (length == size) {
+            size *= 2;
+            buff = Allocator_realloc(alloc, buff, size);
+        }
+    }
+    return ArrayReader_new(buff, length, alloc);
+}
+
 struct CheckRunningInstanceContext
 {
     struct EventBase* base;
@@ -455,12 +658,31 @@ int main(int argc, char** argv)
     struct Random* rand = Random_new(allocator, NULL, eh);
     struct EventBase* eventBase = EventBase_new(allocator);
 
-    if (argc == 2) {
+    uint8_t prefix[16] = { AddressCalc_PREFIX };
+    if (argc == 4 && !strcmp(argv[1], "--genconf") && !strcmp(argv[2], "--prefix")) {
+        int prefixBits = parsePrefix(prefix, argv[3]);
+        if (prefixBits < 0) {
+            fprintf(stderr, "%s: [%s] is not a hex address prefix\n", argv[0], argv[3]);
+            return -1;
+        }
+        return genconf(prefix, prefixBits, rand, allocator);
+    } else if (argc == 3 && !strcmp(argv[1], "--bench")) {
+        return benchmark(argv[2]);
+    } else if (argc == 3 && !strcmp(argv[1], "--simulate")) {
+        int nodeCount = atoi(argv[2]);
+        if (nodeCount < 2) {
+            fprintf(stderr, "%s: [%s] is not a number of nodes\n", argv[0], argv[2]);
+            return -1;
+        }
+        return simulate(nodeCount);
+    } else if (argc == 3 && !strcmp(argv[1], "--replay")) {
+        return replay(argv[2]);
+    } else if (argc == 2) {
         // one argument
         if ((strcmp(argv[1], "--help") == 0) || (strcmp(argv[1], "-h") == 0)) {
             return usage(argv[0]);
         } else if (strcmp(argv[1], "--genconf") == 0) {
-            return genconf(rand);
+            return genconf(prefix, 8, rand, allocator);
         } else if (strcmp(argv[1], "--pidfile") == 0) {
             // deprecated
             fprintf(stderr, "'--pidfile' option is deprecated.\n");
@@ -468,7 +690,9 @@ int main(int argc, char** argv)
         } else if (strcmp(argv[1], "--reconf") == 0) {
             // Performed after reading the configuration
         } else if (strcmp(argv[1], "--bench") == 0) {
-            return benchmark();
+            return benchmark(NULL);
+        } else if (strcmp(argv[1], "--simulate") == 0) {
+            return simulate(0);
         } else if ((strcmp(argv[1], "--version") == 0) || (strcmp(argv[1], "-v") == 0)) {
             printf("Cjdns protocol version: %d\n", Version_CURRENT_PROTOCOL);
             return 0;
@@ -501,12 +725,15 @@ int main(int argc, char** argv)
         // start routing
     }
 
-    struct Reader* stdinReader = FileReader_new(stdin, allocator);
+    struct Allocator* confAlloc = Allocator_child(allocator);
+    struct Reader* stdinReader = readConfig(stdin, confAlloc);
     Dict config;
     if (JsonBencSerializer_get()->parseDictionary(stdinReader, allocator, &config)) {
         fprintf(stderr, "Failed to parse configuration.\n");
         return -1;
     }
+    // The parsed configuration does not refer to the text.
+    Allocator_free(confAlloc);
 
     if (argc == 2 && strcmp(argv[1], "--cleanconf") == 0) {
         struct Writer* stdoutWriter = FileWriter_new(stdout, allocator);
@@ -584,13 +811,16 @@ int main(int argc, char** argv)
     Dict_putString(preConf, String_CONST("privateKey"), privateKey, allocator);
     Dict_putString(adminPreConf, String_CONST("bind"), adminBind, allocator);
     Dict_putString(adminPreConf, String_CONST("pass"), adminPass, allocator);
-    if (securityUser) {
-        Dict_putString(adminPreConf, String_CONST("user"), securityUser, allocator);
-    }
+    // Keys are not copied so a String_CONST() key must not be in an inner block,
+    // nothing is put if the value is NULL.
+    Dict_putString(adminPreConf, String_CONST("user"), securityUser, allocator);
+    int64_t* singleProcess = Dict_getInt(&config, String_CONST("singleProcess"));
+    Dict_putInt(adminPreConf,
+                String_CONST("singleProcess"),
+                (singleProcess && *singleProcess),
+                allocator);
     Dict* logging = Dict_getDict(&config, String_CONST("logging"));
-    if (logging) {
-        Dict_putDict(preConf, String_CONST("logging"), logging, allocator);
-    }
+    Dict_putDict(preConf, String_CONST("logging"), logging, allocator);
 
     #define CONFIG_BUFF_SIZE 1024
     uint8_t buff[CONFIG_BUFF_SIZE] = {0};
@@ -16,6 +16,7 @@
 #include "benc/Dict.h"
 #include "benc/String.h"
 #include "benc/Int.h"
+#include "benc/List.h"
 #include "memory/Allocator.h"
 #include "util/Assert.h"
 #include "util/platform/libc/strlen.h"
@@ -36,23 +37,37 @@ static void adminFunc(Dict* input, void* vcontext, String* txid, struct Allocato
     Admin_sendMessage(&d, txid, ctx->framework->admin);
 }
 
+static void serializedFunc(Dict* input,
+                           void* vcontext,
+                           String* txid,
+                           struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    ctx->called = true;
+    char* response = "d7:called!i1e4:listl1:a1:bee";
+    Admin_sendSerialized((uint8_t*)response, strlen(response), txid, ctx->framework->admin);
+}
+
 static void standardClientCallback(struct AdminClient_Promise* p, struct AdminClient_Result* res)
 {
     struct Context* ctx = p->userData;
     //printf("%d\n", res->err);
     Assert_always(!res->err);
-    Assert_always(Dict_getInt(res->responseDict, String_CONST("called!")));
-    Assert_always(ctx->called);
+    if (ctx->called) {
+        Assert_always(Dict_getInt(res->responseDict, String_CONST("called!")));
+    } else {
+        Assert_always(Dict_getString(res->responseDict, String_CONST("error")));
+    }
 
     EventBase_endLoop(ctx->framework->eventBase);
 }
 
-static void standardClient(struct Context* ctx)
+static void standardClient(struct Context* ctx, String* function, Dict* args)
 {
     ctx->called = false;
     struct AdminClient_Promise* promise =
-        AdminClient_rpcCall(String_CONST("adminFunc"),
-                            NULL,
+        AdminClient_rpcCall(function,
+                            args,
                             ctx->framework->client,
                             ctx->framework->alloc);
 
@@ -62,6 +77,55 @@ static void standardClient(struct Context* ctx)
     EventBase_beginLoop(ctx->framework->eventBase);
 }
 
+static void batchCallback(struct AdminClient_Promise* p, struct AdminClient_Result* res)
+{
+    struct Context* ctx = p->userData;
+    Assert_always(!res->err);
+    List* responses = Dict_getList(res->responseDict, String_CONST("batch"));
+    Assert_always(List_size(responses) == 3);
+    Assert_always(!Dict_getInt(res->responseDict, String_CONST("more")));
+    for (int i = 0; i < 3; i++) {
+        Dict* response = List_getDict(responses, i);
+        String* txid = Dict_getString(response, String_CONST("txid"));
+        Assert_always(txid && txid->len == 1);
+        if (txid->bytes[0] == 'n') {
+            Assert_always(Dict_getString(response, String_CONST("error")));
+        } else {
+            Assert_always(Dict_getInt(response, String_CONST("called!")));
+        }
+    }
+    EventBase_endLoop(ctx->framework->eventBase);
+}
+
+static Dict* batchEntry(char* query, char* txid, struct Allocator* alloc)
+{
+    Dict* entry = Dict_new(alloc);
+    // The keys must outlive this function.
+    Dict_putString(entry, String_new("q", alloc), String_new(query, alloc), alloc);
+    Dict_putString(entry, String_new("txid", alloc), String_new(txid, alloc), alloc);
+    return entry;
+}
+
+/** All of the calls in a batch are answered in one response. */
+static void batchClient(struct Context* ctx)
+{
+    struct Allocator* alloc = ctx->framework->alloc;
+    List* calls = NULL;
+    calls = List_addDict(calls, batchEntry("adminFunc", "a", alloc), alloc);
+    calls = List_addDict(calls, batchEntry("noSuchFunc", "n", alloc), alloc);
+    calls = List_addDict(calls, batchEntry("serializedFunc", "s", alloc), alloc);
+    Dict* args = Dict_new(alloc);
+    Dict_putList(args, String_CONST("calls"), calls, alloc);
+
+    ctx->called = false;
+    struct AdminClient_Promise* promise =
+        AdminClient_rpcCall(String_CONST("Admin_batch"), args, ctx->framework->client, alloc);
+    promise->callback = batchCallback;
+    promise->userData = ctx;
+
+    EventBase_beginLoop(ctx->framework->eventBase);
+}
+
 int main(int argc, char** argv)
 {
     struct AdminTestFramework* framework = AdminTestFramework_setUp(argc, argv, "Admin_test");
@@ -70,7 +134,40 @@ int main(int argc, char** argv)
     };
     Admin_registerFunction("adminFunc", adminFunc, &ctx, true, NULL, framework->admin);
 
-    standardClient(&ctx);
+    Admin_registerFunction("serializedFunc", serializedFunc, &ctx, true, NULL, framework->admin);
+
+    // Registered twice under one name, each is called if its own arguments are present.
+    Admin_registerFunction("argFunc", adminFunc, &ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "optional", .required = 0, .type = "String" }
+        }), framework->admin);
+    Admin_registerFunction("argFunc", adminFunc, &ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "optional", .required = 0, .type = "String" },
+            { .name = "number", .required = 1, .type = "Int" }
+        }), framework->admin);
+
+    standardClient(&ctx, String_CONST("adminFunc"), NULL);
+    Assert_always(ctx.called);
+
+    // The txid is added to the end of a response which was serialized by the function.
+    standardClient(&ctx, String_CONST("serializedFunc"), NULL);
+    Assert_always(ctx.called);
+
+    standardClient(&ctx, String_CONST("noSuchFunc"), NULL);
+    Assert_always(!ctx.called);
+
+    Dict* args = Dict_new(framework->alloc);
+    Dict_putString(args, String_CONST("number"), String_CONST("not a number"), framework->alloc);
+    standardClient(&ctx, String_CONST("argFunc"), args);
+    Assert_always(ctx.called);
+
+    Dict_putInt(args, String_CONST("number"), 1, framework->alloc);
+    standardClient(&ctx, String_CONST("argFunc"), args);
+    Assert_always(ctx.called);
+
+    batchClient(&ctx);
+    Assert_always(ctx.called);
 
     AdminTestFramework_tearDown(framework);
     return 0;
@@ -15,13 +15,81 @@
 #include "memory/Allocator.h"
 #include "benc/Dict.h"
 #include "benc/String.h"
+#include "util/Bits.h"
 
 #include <stddef.h>
 
+/** Hash index of a large dictionary, the list of entries still holds the sorted order. */
+struct Dict_Index
+{
+    /** Open addressed table of entries, a power of 2 in size, NULL is an empty slot. */
+    struct Dict_Entry** slots;
+    uint32_t size;
+
+    uint32_t count;
+
+    /** The last entry in the list, keys which sort after it are appended without a walk. */
+    struct Dict_Entry* tail;
+
+    struct Allocator* alloc;
+};
+
+static uint32_t hashKey(const String* key)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < (int)key->len; i++) {
+        hash = (hash ^ (uint8_t)key->bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/** Get the slot which holds the entry for a key or the empty slot where it would go. */
+static struct Dict_Entry** findSlot(const struct Dict_Index* index, const String* key)
+{
+    uint32_t mask = index->size - 1;
+    for (uint32_t i = hashKey(key) & mask;; i = (i + 1) & mask) {
+        struct Dict_Entry** slot = &index->slots[i];
+        if (!*slot || String_equals(key, (*slot)->key)) {
+            return slot;
+        }
+    }
+}
+
+/** (Re)build the index with room for at least twice the number of entries in the list. */
+static void indexAll(struct Dict_Index* index, struct Dict_Entry* head)
+{
+    uint32_t count = 0;
+    for (struct Dict_Entry* e = head; e; e = e->next) {
+        count++;
+    }
+    if (index->size < count * 2) {
+        while (index->size < count * 2) {
+            index->size = (index->size) ? index->size * 2 : Dict_INDEX_THRESHOLD * 2;
+        }
+        index->slots = Allocator_malloc(index->alloc, sizeof(uintptr_t) * index->size);
+    }
+    Bits_memset(index->slots, 0, sizeof(uintptr_t) * index->size);
+    index->count = count;
+    index->tail = NULL;
+    for (struct Dict_Entry* e = head; e; e = e->next) {
+        *findSlot(index, e->key) = e;
+        // an index left behind on an entry which was once the head would go stale.
+        e->index = NULL;
+        index->tail = e;
+    }
+    if (head) {
+        head->index = index;
+    }
+}
+
 int32_t Dict_size(const Dict* dictionary)
 {
     if (dictionary != NULL) {
         struct Dict_Entry* entry = *dictionary;
+        if (entry && entry->index) {
+            return entry->index->count;
+        }
         int32_t i;
         for (i = 0; entry != NULL; i++) {
             entry = entry->next;
@@ -37,6 +105,10 @@ static Object* lookupObject(const Dict* dictionary, const String* key)
         return NULL;
     }
     const struct Dict_Entry* curr = *dictionary;
+    if (curr && curr->index) {
+        struct Dict_Entry* entry = *findSlot(curr->index, key);
+        return (entry) ? entry->val : NULL;
+    }
     while (curr != NULL) {
         if (String_equals(key, curr->key)) {
             return curr->val;
@@ -110,31 +182,83 @@ Dict* Dict_new(struct Allocator* allocator)
  *         Otherwise: if the key already exists in the dictionary then the value which was
  *         displaced by the put, if not then NULL.
  */
+static struct Dict_Entry* newEntry(const String* key, Object* value, struct Allocator* alloc)
+{
+    struct Dict_Entry* entry = Allocator_malloc(alloc, sizeof(struct Dict_Entry));
+    entry->key = (String*) key; // need to drop the const :(
+    entry->val = value;
+    entry->index = NULL;
+    return entry;
+}
+
 static Object* putObject(Dict* dictionary,
                          const String* key,
                          Object* value,
                          struct Allocator* allocator)
 {
-    struct Dict_Entry** prev_p = dictionary;
-    struct Dict_Entry* current = *dictionary;
-    while (current != NULL) {
-        int cmp = String_compare(key, current->key);
-        if (cmp < 0) {
-            break;
-        } else if (cmp == 0) {
-            Object* out = current->val;
-            current->val = value;
+    struct Dict_Index* index = (*dictionary) ? (*dictionary)->index : NULL;
+    if (index) {
+        struct Dict_Entry** slot = findSlot(index, key);
+        if (*slot) {
+            Object* out = (*slot)->val;
+            (*slot)->val = value;
             return out;
         }
-        prev_p = &(current->next);
-        current = current->next;
     }
-    struct Dict_Entry* entry = Allocator_malloc(allocator, sizeof(struct Dict_Entry));
-    entry->key = (String*) key; // need to drop the const :(
-    entry->val = value;
-    entry->next = current;
-    *prev_p = entry;
 
+    struct Dict_Entry* entry;
+    if (index && String_compare(key, index->tail->key) > 0) {
+        entry = newEntry(key, value, allocator);
+        entry->next = NULL;
+        index->tail->next = entry;
+        index->tail = entry;
+    } else {
+        int count = 0;
+        struct Dict_Entry** prev_p = dictionary;
+        struct Dict_Entry* current = *dictionary;
+        while (current != NULL) {
+            int cmp = String_compare(key, current->key);
+            if (cmp < 0) {
+                break;
+            } else if (cmp == 0) {
+                Object* out = current->val;
+                current->val = value;
+                return out;
+            }
+            prev_p = &(current->next);
+            current = current->next;
+            count++;
+        }
+        entry = newEntry(key, value, allocator);
+        entry->next = current;
+        *prev_p = entry;
+
+        if (!index) {
+            for (; current; current = current->next) {
+                count++;
+            }
+            if (count + 1 >= Dict_INDEX_THRESHOLD) {
+                index = Allocator_calloc(allocator, sizeof(struct Dict_Index), 1);
+                index->alloc = allocator;
+                indexAll(index, *dictionary);
+            }
+            return NULL;
+        }
+        if (!entry->next) {
+            index->tail = entry;
+        }
+        if (prev_p == dictionary) {
+            entry->index = index;
+            entry->next->index = NULL;
+        }
+    }
+
+    if ((index->count + 1) * 2 > index->size) {
+        indexAll(index, *dictionary);
+    } else {
+        *findSlot(index, key) = entry;
+        index->count++;
+    }
     return NULL;
 }
 
@@ -203,11 +327,16 @@ Object* Dict_putDict(Dict* dictionary,
 /** @see Object.h */
 int32_t Dict_remove(Dict* dictionary, const String* key)
 {
+    struct Dict_Index* index = (*dictionary) ? (*dictionary)->index : NULL;
     struct Dict_Entry** prev_p = dictionary;
     struct Dict_Entry* current = *dictionary;
     while (current != NULL) {
         if (String_equals(key, current->key)) {
             *prev_p = current->next;
+            if (index) {
+                current->index = NULL;
+                indexAll(index, *dictionary);
+            }
             return 1;
         }
 
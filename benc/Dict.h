@@ -20,11 +20,23 @@
 #include "util/Linker.h"
 Linker_require("benc/Dict.c")
 
+/** Dictionaries with at least this many entries are given a hash index by the put functions. */
+#define Dict_INDEX_THRESHOLD 16
+
+struct Dict_Index;
+
 struct Dict_Entry;
 struct Dict_Entry {
     struct Dict_Entry* next;
     String* key;
     Object* val;
+
+    /**
+     * Only set on the first entry of a large dictionary, code which builds the list of entries
+     * itself must set this to NULL. Once a dictionary is indexed, entries must only be added and
+     * removed with these functions, using allocators which live as long as the dictionary.
+     */
+    struct Dict_Index* index;
 };
 
 /**
@@ -17,25 +17,52 @@
 #include "benc/List.h"
 #include "benc/Dict.h"
 #include "benc/String.h"
+#include "util/Bits.h"
 
 static Object* clone(Object* orig, struct Allocator* alloc);
 
+/** The string and its content in one allocation. */
+static String* cloneString(String* orig, struct Allocator* alloc)
+{
+    String* out = Allocator_malloc(alloc, sizeof(String) + orig->len + 1);
+    out->len = orig->len;
+    out->bytes = (char*) &out[1];
+    Bits_memcpy(out->bytes, orig->bytes, orig->len);
+    out->bytes[orig->len] = '\0';
+    return out;
+}
+
+// Lists and dictionaries are copied in one pass along the chain so a long list does not take
+// a stack frame for every entry.
+
 static struct List_Item* cloneList(struct List_Item* orig, struct Allocator* alloc)
 {
-    if (!orig) { return NULL; }
-    struct List_Item* out = Allocator_malloc(alloc, sizeof(struct List_Item));
-    out->elem = clone(orig->elem, alloc);
-    out->next = cloneList(orig->next, alloc);
+    struct List_Item* out = NULL;
+    struct List_Item** next = &out;
+    for (; orig; orig = orig->next) {
+        struct List_Item* item = Allocator_malloc(alloc, sizeof(struct List_Item));
+        item->elem = clone(orig->elem, alloc);
+        *next = item;
+        next = &item->next;
+    }
+    *next = NULL;
     return out;
 }
 
 static struct Dict_Entry* cloneDict(struct Dict_Entry* orig, struct Allocator* alloc)
 {
-    if (!orig) { return NULL; }
-    struct Dict_Entry* out = Allocator_malloc(alloc, sizeof(struct Dict_Entry));
-    out->key = String_clone(orig->key, alloc);
-    out->val = clone(orig->val, alloc);
-    out->next = cloneDict(orig->next, alloc);
+    struct Dict_Entry* out = NULL;
+    struct Dict_Entry** next = &out;
+    for (; orig; orig = orig->next) {
+        struct Dict_Entry* entry = Allocator_malloc(alloc, sizeof(struct Dict_Entry));
+        entry->key = cloneString(orig->key, alloc);
+        entry->val = clone(orig->val, alloc);
+        // A big dictionary is indexed again by the first put which adds a key to the clone.
+        entry->index = NULL;
+        *next = entry;
+        next = &entry->next;
+    }
+    *next = NULL;
     return out;
 }
 
@@ -45,7 +72,7 @@ static Object* clone(Object* orig, struct Allocator* alloc)
     out->type = orig->type;
     switch (orig->type) {
         case Object_INTEGER: out->as.number = orig->as.number; break;
-        case Object_STRING: out->as.string = String_clone(orig->as.string, alloc); break;
+        case Object_STRING: out->as.string = cloneString(orig->as.string, alloc); break;
         case Object_LIST: out->as.list = Cloner_cloneList(orig->as.list, alloc); break;
         case Object_DICT: out->as.dictionary = Cloner_cloneDict(orig->as.dictionary, alloc); break;
         default: Assert_always(0);
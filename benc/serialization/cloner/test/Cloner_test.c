@@ -0,0 +1,77 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "benc/serialization/cloner/Cloner.h"
+#include "benc/serialization/standard/StandardBencSerializer.h"
+#include "io/ArrayWriter.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#define BUFF_SZ (1<<17)
+
+static int serialize(Dict* d, uint8_t* out, struct Allocator* alloc)
+{
+    struct Writer* w = ArrayWriter_new(out, BUFF_SZ, alloc);
+    Assert_always(!StandardBencSerializer_get()->serializeDictionary(w, d));
+    return Writer_bytesWritten(w);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<24);
+    struct Allocator* origAlloc = Allocator_child(alloc);
+
+    // A long list, a big (indexed) dictionary and a string with a null in it.
+    List* list = NULL;
+    for (int i = 0; i < 10000; i++) {
+        list = List_addInt(list, i, origAlloc);
+    }
+    Dict* big = Dict_new(origAlloc);
+    for (int i = 0; i < 100; i++) {
+        Dict_putInt(big, String_printf(origAlloc, "key%d", i), i, origAlloc);
+    }
+    Dict* orig = Dict_new(origAlloc);
+    Dict_putList(orig, String_CONST("list"), list, origAlloc);
+    Dict_putDict(orig, String_CONST("big"), big, origAlloc);
+    Dict_putString(orig, String_CONST("bin"), String_newBinary("a\0b", 3, origAlloc), origAlloc);
+
+    static uint8_t expected[BUFF_SZ];
+    int expectedLen = serialize(orig, expected, alloc);
+
+    struct Allocator* cloneAlloc = Allocator_child(alloc);
+    Dict* copy = Cloner_cloneDict(orig, cloneAlloc);
+
+    // The clone owns everything so it outlives the original.
+    Allocator_free(origAlloc);
+
+    static uint8_t out[BUFF_SZ];
+    Assert_always(serialize(copy, out, alloc) == expectedLen);
+    Assert_always(!Bits_memcmp(out, expected, expectedLen));
+    String* bin = Dict_getString(copy, String_CONST("bin"));
+    Assert_always(bin->len == 3 && bin->bytes[3] == '\0');
+
+    // The cloned big dictionary still works for lookups and puts.
+    Dict* bigCopy = Dict_getDict(copy, String_CONST("big"));
+    Assert_always(*Dict_getInt(bigCopy, String_CONST("key42")) == 42);
+    Dict_putInt(bigCopy, String_CONST("key100"), 100, cloneAlloc);
+    Assert_always(Dict_size(bigCopy) == 101);
+    Assert_always(*Dict_getInt(bigCopy, String_CONST("key99")) == 99);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,125 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/serialization/json/JsonBencSerializer.h"
+#include "benc/serialization/standard/StandardBencSerializer.h"
+#include "io/ArrayReader.h"
+#include "io/ArrayWriter.h"
+#include "io/Reader.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/CString.h"
+#include "util/Identity.h"
+
+/** Hides the buffer of an ArrayReader so the parser must read a byte at a time. */
+struct ByteReader
+{
+    struct Reader generic;
+    struct Reader* inner;
+    Identity
+};
+
+static int byteRead(struct Reader* reader, void* readInto, unsigned long length)
+{
+    struct ByteReader* br = Identity_cast((struct ByteReader*) reader);
+    int ret = Reader_read(br->inner, readInto, length);
+    reader->bytesRead = br->inner->bytesRead;
+    return ret;
+}
+
+static void byteSkip(struct Reader* reader, unsigned long byteCount)
+{
+    struct ByteReader* br = Identity_cast((struct ByteReader*) reader);
+    Reader_skip(br->inner, byteCount);
+    reader->bytesRead = br->inner->bytesRead;
+}
+
+/** Parse json and serialize it as benc into out, returns the parser's result. */
+static int toBenc(struct Reader* reader, char* out, struct Allocator* alloc)
+{
+    Dict d;
+    int ret = JsonBencSerializer_get()->parseDictionary(reader, alloc, &d);
+    Bits_memset(out, 0, 1024);
+    if (!ret) {
+        struct Writer* w = ArrayWriter_new(out, 1023, alloc);
+        StandardBencSerializer_get()->serializeDictionary(w, &d);
+    }
+    return ret;
+}
+
+/** Parsing from a buffer and a byte at a time must give the same result. */
+static void check(const char* json, const char* expected, struct Allocator* alloc)
+{
+    struct Reader* fast = ArrayReader_new(json, CString_strlen(json), alloc);
+    struct ByteReader* br = Allocator_clone(alloc, (&(struct ByteReader) {
+        .generic = {
+            .read = byteRead,
+            .skip = byteSkip
+        },
+        .inner = ArrayReader_new(json, CString_strlen(json), alloc)
+    }));
+    Identity_set(br);
+    Assert_always(!Reader_buffer(&br->generic, &(unsigned long){0}));
+
+    char fastOut[1024];
+    char slowOut[1024];
+    int fastRet = toBenc(fast, fastOut, alloc);
+    int slowRet = toBenc(&br->generic, slowOut, alloc);
+    Assert_always(fastRet == slowRet);
+    Assert_always(Reader_bytesRead(fast) == Reader_bytesRead(&br->generic));
+    Assert_always(!Bits_memcmp(fastOut, slowOut, 1024));
+    if (expected) {
+        Assert_always(!fastRet);
+        Assert_always(!CString_strcmp(fastOut, expected));
+    } else {
+        Assert_always(fastRet);
+    }
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+
+    check("{}", "de", alloc);
+    check("  \n\t\r {  \"a\":1 }  ", "d1:ai1ee", alloc);
+
+    // Long runs of whitespace and long strings cross the 16 byte blocks.
+    check("{\n"
+          "                              \"aLongKeyWhichIsMoreThanSixteenBytes\"\n"
+          "                        :     \"and a value which is even longer than that\",\n"
+          "    /* a comment which is long enough to be scanned in blocks */ \"list\": [\n"
+          "        1, 2, \"x\", { \"d\": [] }  // trailing comment\n"
+          "    ],\n"
+          "    \"esc\": \"0123456789abcdef\\x41\\x7ez\"\n"
+          "}",
+          "d"
+            "3:esc" "19:0123456789abcdefA~z"
+            "4:list" "li1ei2e1:xd1:dleee"
+            "35:aLongKeyWhichIsMoreThanSixteenBytes"
+                "42:and a value which is even longer than that"
+          "e",
+          alloc);
+
+    // Errors must come out the same either way.
+    check("{ \"a\": \"unterminated", NULL, alloc);
+    check("{ \"a\": \"bad escape \\xZZ\" }", NULL, alloc);
+    check("{ \"a\": 1,                         ", NULL, alloc);
+    check("{ \"a\" : [ 1, 2 ", NULL, alloc);
+    check("   ", NULL, alloc);
+
+    Allocator_free(alloc);
+    return 0;
+}
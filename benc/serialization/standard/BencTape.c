@@ -0,0 +1,193 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/serialization/standard/BencTape.h"
+#include "util/Bits.h"
+
+#include <stdbool.h>
+
+#include <stdint.h>
+
+/** Read the digits of a string length, returns the index of the ':' or -1. */
+static int readLength(const char* bytes, int index, int limit, uint32_t* lengthOut)
+{
+    uint64_t length = 0;
+    int start = index;
+    for (; index < limit && bytes[index] >= '0' && bytes[index] <= '9'; index++) {
+        length = length * 10 + (bytes[index] - '0');
+        if (length > UINT32_MAX) {
+            return -1;
+        }
+    }
+    if (index == start || index >= limit || bytes[index] != ':') {
+        return -1;
+    }
+    *lengthOut = length;
+    return index;
+}
+
+/** See: BencTape.h */
+int BencTape_parse(struct BencTape* tape,
+                   const char* bytes,
+                   uint32_t length,
+                   struct BencTape_Token* tokens,
+                   int maxTokens)
+{
+    // Tokens of the containers which are open and how many values each holds so far.
+    int open[BencTape_MAX_DEPTH];
+    uint32_t held[BencTape_MAX_DEPTH];
+    int depth = 0;
+    int count = 0;
+    int index = 0;
+    int limit = (int) length;
+    do {
+        if (index >= limit) {
+            return -1;
+        }
+        if (bytes[index] == 'e') {
+            if (!depth) {
+                return -1;
+            }
+            struct BencTape_Token* c = &tokens[open[--depth]];
+            // A dictionary must hold pairs.
+            if (c->type == BencTape_Type_DICT && (held[depth] & 1)) {
+                return -1;
+            }
+            index++;
+            c->length = index - c->offset;
+            c->next = count;
+            continue;
+        }
+
+        if (count >= maxTokens) {
+            return -1;
+        }
+
+        if (depth) {
+            // Keys in a dictionary must be strings.
+            if (tokens[open[depth - 1]].type == BencTape_Type_DICT
+                && !(held[depth - 1] & 1)
+                && (bytes[index] < '0' || bytes[index] > '9'))
+            {
+                return -1;
+            }
+            held[depth - 1]++;
+        }
+
+        struct BencTape_Token* t = &tokens[count++];
+        t->offset = index;
+        t->next = count;
+        switch (bytes[index]) {
+            case 'i': {
+                int start = ++index;
+                if (index < limit && bytes[index] == '-') {
+                    index++;
+                }
+                int digits = index;
+                while (index < limit && bytes[index] >= '0' && bytes[index] <= '9') {
+                    index++;
+                }
+                if (index == digits || index >= limit || bytes[index] != 'e') {
+                    return -1;
+                }
+                index++;
+                t->type = BencTape_Type_INT;
+                t->length = index - (start - 1);
+                break;
+            }
+            case 'l':
+            case 'd': {
+                if (depth >= BencTape_MAX_DEPTH) {
+                    return -1;
+                }
+                t->type = (bytes[index] == 'l') ? BencTape_Type_LIST : BencTape_Type_DICT;
+                held[depth] = 0;
+                open[depth++] = count - 1;
+                index++;
+                break;
+            }
+            default: {
+                uint32_t len;
+                if ((index = readLength(bytes, index, limit, &len)) < 0) {
+                    return -1;
+                }
+                index++;
+                if (len > (uint32_t)(limit - index)) {
+                    return -1;
+                }
+                t->type = BencTape_Type_STRING;
+                t->offset = index;
+                t->length = len;
+                index += len;
+            }
+        }
+    } while (depth);
+
+    tape->bytes = bytes;
+    tape->tokens = tokens;
+    tape->count = count;
+    return index;
+}
+
+/** See: BencTape.h */
+int BencTape_dictGet(const struct BencTape* tape, int dict, const String* key)
+{
+    if (dict < 0 || dict >= tape->count || tape->tokens[dict].type != BencTape_Type_DICT) {
+        return -1;
+    }
+    uint32_t end = tape->tokens[dict].next;
+    for (uint32_t i = dict + 1; i < end; i = tape->tokens[tape->tokens[i].next].next) {
+        struct BencTape_Token* k = &tape->tokens[i];
+        if (k->length == key->len && !Bits_memcmp(&tape->bytes[k->offset], key->bytes, key->len)) {
+            return k->next;
+        }
+    }
+    return -1;
+}
+
+/** See: BencTape.h */
+String* BencTape_string(const struct BencTape* tape, int token, String* out)
+{
+    if (token < 0 || token >= tape->count || tape->tokens[token].type != BencTape_Type_STRING) {
+        return NULL;
+    }
+    out->len = tape->tokens[token].length;
+    out->bytes = (char*) &tape->bytes[tape->tokens[token].offset];
+    return out;
+}
+
+/** See: BencTape.h */
+int64_t* BencTape_int(const struct BencTape* tape, int token, int64_t* out)
+{
+    if (token < 0 || token >= tape->count || tape->tokens[token].type != BencTape_Type_INT) {
+        return NULL;
+    }
+    const char* bytes = &tape->bytes[tape->tokens[token].offset + 1];
+    const char* end = &tape->bytes[tape->tokens[token].offset + tape->tokens[token].length - 1];
+    bool negative = (*bytes == '-');
+    bytes += negative;
+    uint64_t number = 0;
+    for (; bytes < end; bytes++) {
+        uint64_t digit = *bytes - '0';
+        if (number > (UINT64_MAX - digit) / 10) {
+            return NULL;
+        }
+        number = number * 10 + digit;
+    }
+    if (number > (uint64_t)INT64_MAX + negative) {
+        return NULL;
+    }
+    *out = (negative) ? (int64_t)(0 - number) : (int64_t)number;
+    return out;
+}
@@ -0,0 +1,109 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BencTape_H
+#define BencTape_H
+
+#include "benc/String.h"
+#include "util/Linker.h"
+Linker_require("benc/serialization/standard/BencTape.c")
+
+#include <stdint.h>
+
+/**
+ * A one pass tokenizer for benc which records where each value is in the buffer rather than
+ * decoding it. Nothing is allocated and nothing is copied, values are decoded when they are
+ * asked for and strings are returned as views of the buffer.
+ *
+ * NOTE: A string view is NOT null terminated, use its length.
+ */
+
+enum BencTape_Type
+{
+    BencTape_Type_INT = 'i',
+    BencTape_Type_STRING = 's',
+    BencTape_Type_LIST = 'l',
+    BencTape_Type_DICT = 'd'
+};
+
+struct BencTape_Token
+{
+    /** One of enum BencTape_Type. */
+    uint8_t type;
+
+    /** Where the value begins in the buffer, for a string this is where the content begins. */
+    uint32_t offset;
+
+    /** For a string the length of the content, otherwise the length of the whole encoding. */
+    uint32_t length;
+
+    /**
+     * The index of the token after this one and everything which it contains.
+     * A dictionary or list contains the tokens between its own index + 1 and next, in a
+     * dictionary they alternate key, value.
+     */
+    uint32_t next;
+};
+
+struct BencTape
+{
+    const char* bytes;
+    struct BencTape_Token* tokens;
+    int count;
+};
+
+/** Containers nested deeper than this are refused. */
+#define BencTape_MAX_DEPTH 32
+
+/**
+ * Tokenize one benc value from the beginning of a buffer.
+ *
+ * @param tape filled in, tape->tokens[0] is the value.
+ * @param bytes the buffer, it must outlive the tape.
+ * @param length the length of the buffer.
+ * @param tokens space for the tokens.
+ * @param maxTokens the number of tokens which there is space for.
+ * @return the number of bytes which make up the value or -1 if it is not valid benc, it has
+ *         more than maxTokens tokens or it is nested too deep.
+ */
+int BencTape_parse(struct BencTape* tape,
+                   const char* bytes,
+                   uint32_t length,
+                   struct BencTape_Token* tokens,
+                   int maxTokens);
+
+/**
+ * Look up a key in a dictionary.
+ *
+ * @return the index of the value's token or -1 if the token is not a dictionary or the key is
+ *         not in it.
+ */
+int BencTape_dictGet(const struct BencTape* tape, int dict, const String* key);
+
+/**
+ * Get a view of a string value.
+ *
+ * @param out filled in with the length and a pointer into the buffer.
+ * @return out or NULL if the token is not a string.
+ */
+String* BencTape_string(const struct BencTape* tape, int token, String* out);
+
+/**
+ * Decode an integer value.
+ *
+ * @return out or NULL if the token is not an integer or does not fit in 64 bits.
+ */
+int64_t* BencTape_int(const struct BencTape* tape, int token, int64_t* out);
+
+#endif
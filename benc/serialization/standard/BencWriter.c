@@ -0,0 +1,43 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/serialization/standard/BencWriter.h"
+#define string_strlen
+#include "util/platform/libc/string.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+/** See: BencWriter.h */
+int BencWriter_bytes(struct Writer* w, const void* bytes, uint32_t length)
+{
+    char header[16];
+    int len = snprintf(header, sizeof(header), "%u:", length);
+    Writer_write(w, header, len);
+    return Writer_write(w, bytes, length);
+}
+
+/** See: BencWriter.h */
+int BencWriter_cstring(struct Writer* w, const char* str)
+{
+    return BencWriter_bytes(w, str, strlen(str));
+}
+
+/** See: BencWriter.h */
+int BencWriter_int(struct Writer* w, int64_t number)
+{
+    char buffer[32];
+    int len = snprintf(buffer, sizeof(buffer), "i%" PRId64 "e", number);
+    return Writer_write(w, buffer, len);
+}
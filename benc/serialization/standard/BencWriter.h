@@ -0,0 +1,63 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BencWriter_H
+#define BencWriter_H
+
+#include "benc/String.h"
+#include "io/Writer.h"
+#include "util/Linker.h"
+Linker_require("benc/serialization/standard/BencWriter.c")
+
+#include <stdint.h>
+
+/**
+ * Write benc straight into a Writer without building a tree of Objects first.
+ * The caller is responsible for the structure: every BencWriter_beginDict() or
+ * BencWriter_beginList() must be matched by a BencWriter_end() and the keys of a dictionary
+ * must be written in sorted order, each one followed by exactly one value.
+ *
+ * Like the Writer, all of these return 0 on success and -1 if there is no more space,
+ * once a write fails all subsequent writes fail so the result need only be checked at the end.
+ */
+
+static inline int BencWriter_beginDict(struct Writer* w)
+{
+    return Writer_write(w, "d", 1);
+}
+
+static inline int BencWriter_beginList(struct Writer* w)
+{
+    return Writer_write(w, "l", 1);
+}
+
+static inline int BencWriter_end(struct Writer* w)
+{
+    return Writer_write(w, "e", 1);
+}
+
+/** Write a string of bytes, this is also how dictionary keys are written. */
+int BencWriter_bytes(struct Writer* w, const void* bytes, uint32_t length);
+
+/** Write a null terminated string. */
+int BencWriter_cstring(struct Writer* w, const char* str);
+
+static inline int BencWriter_string(struct Writer* w, const String* str)
+{
+    return BencWriter_bytes(w, str->bytes, str->len);
+}
+
+int BencWriter_int(struct Writer* w, int64_t number);
+
+#endif
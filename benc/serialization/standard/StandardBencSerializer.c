@@ -318,6 +318,7 @@ static int32_t parseDictionary(struct Reader* reader,
         entryPointer->next = lastEntryPointer;
         entryPointer->key = key;
         entryPointer->val = value;
+        entryPointer->index = NULL;
         lastEntryPointer = entryPointer;
     }
 
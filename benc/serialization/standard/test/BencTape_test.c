@@ -0,0 +1,116 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/String.h"
+#include "benc/serialization/standard/BencTape.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#define string_strlen
+#include "util/platform/libc/string.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_TOKENS 32
+
+static int parse(struct BencTape* tape, struct BencTape_Token* tokens, const char* benc)
+{
+    return BencTape_parse(tape, benc, strlen(benc), tokens, MAX_TOKENS);
+}
+
+static bool hasString(struct BencTape* tape, int token, const char* expected)
+{
+    String out;
+    return BencTape_string(tape, token, &out)
+        && out.len == strlen(expected)
+        && !Bits_memcmp(out.bytes, expected, out.len);
+}
+
+int main()
+{
+    struct BencTape_Token tokens[MAX_TOKENS];
+    struct BencTape tape;
+
+    const char* msg = "d1:q4:auth4:argsd3:numi-42e4:listl1:ai1eee4:txid0:e--trailing";
+    int len = parse(&tape, tokens, msg);
+    Assert_always(len == (int)strlen(msg) - (int)strlen("--trailing"));
+    Assert_always(tokens[0].type == BencTape_Type_DICT);
+    Assert_always(tokens[0].next == (uint32_t)tape.count);
+
+    Assert_always(hasString(&tape, BencTape_dictGet(&tape, 0, String_CONST("q")), "auth"));
+    Assert_always(hasString(&tape, BencTape_dictGet(&tape, 0, String_CONST("txid")), ""));
+    Assert_always(BencTape_dictGet(&tape, 0, String_CONST("missing")) == -1);
+    // Keys of nested dictionaries are not keys of the outer one.
+    Assert_always(BencTape_dictGet(&tape, 0, String_CONST("num")) == -1);
+
+    // The string view points into the buffer.
+    String view;
+    Assert_always(BencTape_string(&tape, BencTape_dictGet(&tape, 0, String_CONST("q")), &view));
+    Assert_always(view.bytes == &msg[6]);
+
+    int args = BencTape_dictGet(&tape, 0, String_CONST("args"));
+    Assert_always(tokens[args].type == BencTape_Type_DICT);
+    Assert_always(!Bits_memcmp(&msg[tokens[args].offset], "d3:num", 6));
+    Assert_always(msg[tokens[args].offset + tokens[args].length - 1] == 'e');
+    int64_t num;
+    Assert_always(BencTape_int(&tape, BencTape_dictGet(&tape, args, String_CONST("num")), &num));
+    Assert_always(num == -42);
+    int list = BencTape_dictGet(&tape, args, String_CONST("list"));
+    Assert_always(tokens[list].type == BencTape_Type_LIST);
+    Assert_always(tokens[list].next - list == 3);
+    Assert_always(hasString(&tape, list + 1, "a"));
+
+    // Wrong types are refused by the accessors.
+    Assert_always(!BencTape_int(&tape, list, &num));
+    Assert_always(!BencTape_string(&tape, args, &view));
+    Assert_always(BencTape_dictGet(&tape, list, String_CONST("a")) == -1);
+
+    // The extremes of 64 bits are decoded, one beyond is not.
+    Assert_always(parse(&tape, tokens, "i-9223372036854775808e") > 0);
+    Assert_always(BencTape_int(&tape, 0, &num) && num == INT64_MIN);
+    Assert_always(parse(&tape, tokens, "i9223372036854775808e") > 0);
+    Assert_always(!BencTape_int(&tape, 0, &num));
+
+    // Invalid benc.
+    const char* bad[] = {
+        "",
+        "d",
+        "e",
+        "d1:ae",
+        "di1e1:ae",
+        "5:abc",
+        "i12",
+        "ie",
+        "l1:a",
+        "d1:ai1e1:be",
+        "4294967296:a",
+        NULL
+    };
+    Assert_always(parse(&tape, tokens, "de") == 2);
+    for (int i = 0; bad[i]; i++) {
+        Assert_always(parse(&tape, tokens, bad[i]) == -1);
+    }
+
+    // Too deep and too many tokens.
+    char deep[BencTape_MAX_DEPTH * 2 + 3];
+    Bits_memset(deep, 'l', BencTape_MAX_DEPTH + 1);
+    Bits_memset(&deep[BencTape_MAX_DEPTH + 1], 'e', BencTape_MAX_DEPTH + 1);
+    deep[BencTape_MAX_DEPTH * 2 + 2] = '\0';
+    Assert_always(parse(&tape, tokens, deep) == -1);
+    Assert_always(parse(&tape, tokens, &deep[1]) == BencTape_MAX_DEPTH * 2);
+    Assert_always(BencTape_parse(&tape, "li1ei2ee", 8, tokens, 2) == -1);
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "benc/serialization/standard/BencWriter.h"
+#include "benc/serialization/standard/StandardBencSerializer.h"
+#include "io/ArrayWriter.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+
+    // The same structure built as a Dict and serialized must come out byte for byte the same.
+    Dict* inner = Dict_new(alloc);
+    Dict_putInt(inner, String_CONST("negative"), -12345678901ll, alloc);
+    // Lists are added to at the front.
+    List* list = List_addDict(NULL, inner, alloc);
+    List_addString(list, String_CONST("one"), alloc);
+    Dict* d = Dict_new(alloc);
+    Dict_putString(d, String_CONST("bin"), String_newBinary("a\0b", 3, alloc), alloc);
+    Dict_putList(d, String_CONST("list"), list, alloc);
+    Dict_putInt(d, String_CONST("zero"), 0, alloc);
+
+    uint8_t expected[256];
+    struct Writer* w = ArrayWriter_new(expected, sizeof(expected), alloc);
+    Assert_always(!StandardBencSerializer_get()->serializeDictionary(w, d));
+    int expectedLen = Writer_bytesWritten(w);
+
+    uint8_t out[256];
+    w = ArrayWriter_new(out, sizeof(out), alloc);
+    BencWriter_beginDict(w);
+    BencWriter_cstring(w, "bin");
+    BencWriter_bytes(w, "a\0b", 3);
+    BencWriter_cstring(w, "list");
+    BencWriter_beginList(w);
+    BencWriter_string(w, String_CONST("one"));
+    BencWriter_beginDict(w);
+    BencWriter_cstring(w, "negative");
+    BencWriter_int(w, -12345678901ll);
+    BencWriter_end(w);
+    BencWriter_end(w);
+    BencWriter_cstring(w, "zero");
+    BencWriter_int(w, 0);
+    Assert_always(!BencWriter_end(w));
+
+    Assert_always((int)Writer_bytesWritten(w) == expectedLen);
+    Assert_always(!Bits_memcmp(out, expected, expectedLen));
+
+    // Running out of space fails and keeps failing.
+    w = ArrayWriter_new(out, 4, alloc);
+    BencWriter_cstring(w, "too long");
+    Assert_always(BencWriter_end(w));
+
+    Allocator_free(alloc);
+    return 0;
+}
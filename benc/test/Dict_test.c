@@ -0,0 +1,96 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "benc/Int.h"
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+
+#include <stdio.h>
+
+#define KEYS 256
+
+static String* keys[KEYS];
+static int64_t values[KEYS];
+
+/** The entries must come out sorted and match what was put, whether indexed or not. */
+static void check(Dict* d)
+{
+    int count = 0;
+    String* last = NULL;
+    String* key;
+    Dict_forEach(d, key) {
+        Assert_always(!last || String_compare(last, key) < 0);
+        last = key;
+        count++;
+    }
+    Assert_always(Dict_size(d) == count);
+
+    int expected = 0;
+    for (int i = 0; i < KEYS; i++) {
+        int64_t* val = Dict_getInt(d, keys[i]);
+        if (values[i] < 0) {
+            Assert_always(!val);
+        } else {
+            Assert_always(val && *val == values[i]);
+            expected++;
+        }
+    }
+    Assert_always(expected == count);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+
+    for (int i = 0; i < KEYS; i++) {
+        char buff[16];
+        snprintf(buff, sizeof(buff), "key%d", i);
+        keys[i] = String_new(buff, alloc);
+        values[i] = -1;
+    }
+
+    Dict* d = Dict_new(alloc);
+    for (int round = 0; round < 4000; round++) {
+        int i = Random_uint32(rand) % KEYS;
+        // Mostly puts so the dictionary grows past the point where it is indexed.
+        if (Random_uint32(rand) % 4) {
+            int64_t val = Random_uint32(rand) % 1000;
+            Object* old = Dict_putInt(d, keys[i], val, alloc);
+            Assert_always((old != NULL) == (values[i] >= 0));
+            values[i] = val;
+        } else {
+            Assert_always(Dict_remove(d, keys[i]) == (values[i] >= 0));
+            values[i] = -1;
+        }
+        if (!(round % 97)) {
+            check(d);
+        }
+    }
+    check(d);
+
+    // An entry stuck on the front of an indexed dictionary must still be found.
+    Dict front = Dict_CONST(String_CONST("aaa"), Int_OBJ(5), *d);
+    Assert_always(Dict_getInt(&front, String_CONST("aaa")));
+    Assert_always(Dict_size(&front) == Dict_size(d) + 1);
+    for (int i = 0; i < KEYS; i++) {
+        Assert_always((Dict_getInt(&front, keys[i]) != NULL) == (values[i] >= 0));
+    }
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -95,7 +95,7 @@ int main(int argc, char** argv)
     String* bind = Dict_getString(dns, String_CONST("bind"));
     Assert_true(!Sockaddr_parse(bind ? bind->bytes : "[::]:5353", &addr));
     struct AddrInterface* iface = UDPAddrInterface_new(base, &addr.addr, alloc, NULL, logger);
-    struct DNSServer* dnsServer = DNSServer_new(iface, logger, client);
+    struct DNSServer* dnsServer = DNSServer_new(iface, base, logger, client);
 
     List* auth = Dict_getList(dns, String_CONST("authorities"));
     for (int i = 0; i < (int)List_size(auth); i++) {
@@ -12,12 +12,14 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include "crypto/AddressCalc.h"
 #include "crypto_hash_sha512.h"
 #include "util/Bits.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 
-int AddressCalc_addressForPublicKey(uint8_t addressOut[16], const uint8_t key[32])
+bool AddressCalc_addressForPublicKey(uint8_t addressOut[16], const uint8_t key[32])
 {
     uint8_t hash[crypto_hash_sha512_BYTES];
     crypto_hash_sha512(hash, key, 32);
@@ -26,7 +28,7 @@ int AddressCalc_addressForPublicKey(uint8_t addressOut[16], const uint8_t key[32
     return hash[0] == 0xFC;
 }
 
-int AddressCalc_validKey(const uint8_t key[32])
+bool AddressCalc_validKey(const uint8_t key[32])
 {
     uint8_t hash[crypto_hash_sha512_BYTES];
     crypto_hash_sha512(hash, key, 32);
@@ -34,7 +36,16 @@ int AddressCalc_validKey(const uint8_t key[32])
     return hash[0] == 0xFC;
 }
 
-int AddressCalc_validAddress(const uint8_t address[16])
+bool AddressCalc_cachedAddressForPublicKey(uint8_t addressOut[16],
+                                           const uint8_t key[32],
+                                           struct AddressCalc_Cache* cache)
 {
-    return address[0] == 0xFC;
+    struct AddressCalc_CacheEntry* entry = &cache->entries[key[0] % AddressCalc_CACHE_SIZE];
+    if (!entry->used || Bits_memcmp(entry->key, key, 32)) {
+        AddressCalc_addressForPublicKey(entry->ip6, key);
+        Bits_memcpyConst(entry->key, key, 32);
+        entry->used = true;
+    }
+    Bits_memcpyConst(addressOut, entry->ip6, 16);
+    return entry->ip6[0] == 0xFC;
 }
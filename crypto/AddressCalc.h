@@ -37,11 +37,45 @@ bool AddressCalc_addressForPublicKey(uint8_t addressOut[16], const uint8_t key[3
  */
 bool AddressCalc_validKey(const uint8_t key[32]);
 
+#define AddressCalc_CACHE_SIZE 64
+
+struct AddressCalc_CacheEntry
+{
+    uint8_t key[32];
+    uint8_t ip6[16];
+    bool used;
+};
+
+/** Addresses of recently seen keys, direct mapped by the first byte of the key. */
+struct AddressCalc_Cache
+{
+    struct AddressCalc_CacheEntry entries[AddressCalc_CACHE_SIZE];
+};
+
+/**
+ * Same as AddressCalc_addressForPublicKey() but look in a cache first so that keys which are
+ * seen over and over do not cost two sha512 operations each time.
+ *
+ * @param addressOut put the address here.
+ * @param key the 256 bit curve25519 public key.
+ * @param cache the cache to look in and to store the result in.
+ * @return true if the key hashes to a valid cjdns address.
+ */
+bool AddressCalc_cachedAddressForPublicKey(uint8_t addressOut[16],
+                                           const uint8_t key[32],
+                                           struct AddressCalc_Cache* cache);
+
+/** The first byte of every cjdns address. */
+#define AddressCalc_PREFIX 0xFC
+
 /**
  * Check if an address is valid given the IPv6
  *
  * @return true if the IPv6 is a valid cjdns address.
  */
-bool AddressCalc_validAddress(const uint8_t address[16]);
+static inline bool AddressCalc_validAddress(const uint8_t address[16])
+{
+    return address[0] == AddressCalc_PREFIX;
+}
 
 #endif
@@ -27,7 +27,9 @@
 #include "util/Bits.h"
 #include "util/Endian.h"
 #include "util/Hex.h"
+#include "util/Probe.h"
 #include "util/events/Time.h"
+#include "util/events/WorkQueue.h"
 #include "wire/Error.h"
 #include "wire/Headers.h"
 #include "wire/Message.h"
@@ -84,14 +86,16 @@ static inline void printHexPubKey(uint8_t output[65], uint8_t privateKey[32])
  *                     whatever she happens to send me in the Auth field is NOT ok.
  *                     If this field is null, the secret will be generated without the password.
  */
-static inline void getSharedSecret(uint8_t outputSecret[32],
-                                   uint8_t myPrivateKey[32],
-                                   uint8_t herPublicKey[32],
-                                   uint8_t passwordHash[32],
-                                   struct Log* logger)
+static inline void getSharedSecretFromKey(uint8_t outputSecret[32],
+                                          uint8_t key[32],
+                                          uint8_t myPrivateKey[32],
+                                          uint8_t herPublicKey[32],
+                                          uint8_t passwordHash[32],
+                                          struct Log* logger)
 {
     if (passwordHash == NULL) {
-        crypto_box_curve25519xsalsa20poly1305_beforenm(outputSecret, herPublicKey, myPrivateKey);
+        // Same as crypto_box_curve25519xsalsa20poly1305_beforenm() after the scalar multiply.
+        crypto_core_hsalsa20(outputSecret, keyHashNonce, key, keyHashSigma);
     } else {
         union {
             struct {
@@ -101,7 +105,7 @@ static inline void getSharedSecret(uint8_t outputSecret[32],
             uint8_t bytes[64];
         } buff;
 
-        crypto_scalarmult_curve25519(buff.components.key, myPrivateKey, herPublicKey);
+        Bits_memcpyConst(buff.components.key, key, 32);
         Bits_memcpyConst(buff.components.passwd, passwordHash, 32);
         crypto_hash_sha256(outputSecret, buff.bytes, 64);
     }
@@ -124,6 +128,87 @@ static inline void getSharedSecret(uint8_t outputSecret[32],
     #endif
 }
 
+static inline void getSharedSecret(uint8_t outputSecret[32],
+                                   uint8_t myPrivateKey[32],
+                                   uint8_t herPublicKey[32],
+                                   uint8_t passwordHash[32],
+                                   struct Log* logger)
+{
+    uint8_t key[32];
+    crypto_scalarmult_curve25519(key, myPrivateKey, herPublicKey);
+    getSharedSecretFromKey(outputSecret, key, myPrivateKey, herPublicKey, passwordHash, logger);
+}
+
+/**
+ * Get a shared secret between our permanent key and her permanent key,
+ * using the cache if we have done this recently.
+ * See getSharedSecret() for the meaning of passwordHash.
+ */
+/** Get the cache entry for a key, or NULL if we have not seen it recently. */
+static inline struct CryptoAuth_CachedSecret* getCachedSecret(uint8_t herPublicKey[32],
+                                                              struct CryptoAuth_pvt* context)
+{
+    for (int i = 0; i < CryptoAuth_SECRET_CACHE_SIZE; i++) {
+        if (!Bits_memcmp(context->secretCache[i].herPublicKey, herPublicKey, 32)) {
+            return &context->secretCache[i];
+        }
+    }
+    return NULL;
+}
+
+static inline void getPermanentSharedSecret(uint8_t outputSecret[32],
+                                            uint8_t herPublicKey[32],
+                                            uint8_t passwordHash[32],
+                                            struct CryptoAuth_pvt* context)
+{
+    struct CryptoAuth_CachedSecret* entry = getCachedSecret(herPublicKey, context);
+    if (!entry) {
+        entry = &context->secretCache[0];
+        for (int i = 1; i < CryptoAuth_SECRET_CACHE_SIZE; i++) {
+            if (context->secretCache[i].lastUsed < entry->lastUsed) {
+                entry = &context->secretCache[i];
+            }
+        }
+        crypto_scalarmult_curve25519(entry->key, context->privateKey, herPublicKey);
+        Bits_memcpyConst(entry->herPublicKey, herPublicKey, 32);
+    }
+
+    entry->lastUsed = ++context->secretCacheClock;
+    getSharedSecretFromKey(outputSecret,
+                           entry->key,
+                           context->privateKey,
+                           herPublicKey,
+                           passwordHash,
+                           context->logger);
+}
+
+/**
+ * Take one handshake from the budget.
+ *
+ * @return true if there is budget left for a handshake which needs a curve25519 operation.
+ */
+static inline bool allowHandshake(struct CryptoAuth_pvt* context)
+{
+    uint32_t rate = context->pub.handshakesPerSecond;
+    if (!rate) {
+        return true;
+    }
+    uint64_t now = Time_currentTimeMilliseconds(context->eventBase);
+    uint64_t refill = (now - context->handshakeTokensUpdated) * rate / 1000;
+    if (refill) {
+        // Don't move the time forward unless at least one token was added or slow trickles of
+        // handshakes would never refill the bucket.
+        context->handshakeTokensUpdated = now;
+        uint64_t tokens = context->handshakeTokens + refill;
+        context->handshakeTokens = (tokens > rate) ? rate : tokens;
+    }
+    if (!context->handshakeTokens) {
+        return false;
+    }
+    context->handshakeTokens--;
+    return true;
+}
+
 static inline void hashPassword_sha256(struct CryptoAuth_Auth* auth, const String* password)
 {
     uint8_t tempBuff[32];
@@ -148,6 +233,64 @@ static inline uint8_t* hashPassword(struct CryptoAuth_Auth* auth,
     return auth->secret;
 }
 
+/** The lookup bytes of the challenge are part of a hash so they are already well distributed. */
+static inline uint32_t passwordHashCode(union Headers_AuthChallenge* challenge)
+{
+    uint32_t out;
+    Bits_memcpyConst(&out, &challenge->bytes[Headers_AuthChallenge_KEYSIZE - 4], 4);
+    return out;
+}
+
+/** FNV-1a, user names are chosen by people so they are not well distributed. */
+static inline uint32_t userHashCode(String* user)
+{
+    uint32_t out = 2166136261u;
+    for (size_t i = 0; i < user->len; i++) {
+        out = (out ^ (uint8_t) user->bytes[i]) * 16777619u;
+    }
+    return out;
+}
+
+static void indexPassword(struct CryptoAuth_Users* users, uint32_t i)
+{
+    uint32_t mask = users->capacity * 2 - 1;
+    uint32_t slot = passwordHashCode(&users->passwords[i].challenge) & mask;
+    while (users->passwordIndex[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    users->passwordIndex[slot] = i + 1;
+
+    slot = userHashCode(users->passwords[i].user) & mask;
+    while (users->userIndex[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    users->userIndex[slot] = i + 1;
+}
+
+/** Rebuild the password index after passwords have been removed or moved. */
+static void indexPasswords(struct CryptoAuth_Users* users)
+{
+    Bits_memset(users->passwordIndex, 0, users->capacity * 2 * sizeof(uint32_t));
+    Bits_memset(users->userIndex, 0, users->capacity * 2 * sizeof(uint32_t));
+    for (uint32_t i = 0; i < users->count; i++) {
+        indexPassword(users, i);
+    }
+}
+
+static void newUsers(struct CryptoAuth_Users* users,
+                     uint32_t capacity,
+                     struct Allocator* allocator)
+{
+    struct Allocator* alloc = Allocator_child(allocator);
+    Bits_memcpyConst(users, (&(struct CryptoAuth_Users) {
+        .passwords = Allocator_calloc(alloc, sizeof(struct CryptoAuth_Auth), capacity),
+        .capacity = capacity,
+        .passwordIndex = Allocator_calloc(alloc, sizeof(uint32_t), capacity * 2),
+        .userIndex = Allocator_calloc(alloc, sizeof(uint32_t), capacity * 2),
+        .alloc = alloc
+    }), sizeof(struct CryptoAuth_Users));
+}
+
 /**
  * Search the authorized passwords for one matching this auth header.
  *
@@ -161,13 +304,64 @@ static inline struct CryptoAuth_Auth* getAuth(union Headers_AuthChallenge auth,
     if (auth.challenge.type != 1) {
         return NULL;
     }
-    for (uint32_t i = 0; i < context->passwordCount; i++) {
-        if (Bits_memcmp(auth.bytes, &context->passwords[i], Headers_AuthChallenge_KEYSIZE) == 0) {
-            return &context->passwords[i];
+    struct CryptoAuth_Users* users = &context->users;
+    uint32_t mask = users->capacity * 2 - 1;
+    for (uint32_t slot = passwordHashCode(&auth) & mask;
+         users->passwordIndex[slot];
+         slot = (slot + 1) & mask)
+    {
+        struct CryptoAuth_Auth* a = &users->passwords[users->passwordIndex[slot] - 1];
+        if (Bits_memcmp(auth.bytes, a, Headers_AuthChallenge_KEYSIZE) == 0) {
+            return a;
         }
     }
     Log_debug(context->logger, "Got unrecognized auth, password count = [%d]",
-              context->passwordCount);
+              context->users.count);
+    return NULL;
+}
+
+/** @return true if a password with the same secret or the same user name is already added. */
+static bool isDuplicateUser(struct CryptoAuth_Users* users,
+                            struct CryptoAuth_Auth* auth,
+                            String* user)
+{
+    uint32_t mask = users->capacity * 2 - 1;
+    for (uint32_t slot = passwordHashCode(&auth->challenge) & mask;
+         users->passwordIndex[slot];
+         slot = (slot + 1) & mask)
+    {
+        struct CryptoAuth_Auth* a = &users->passwords[users->passwordIndex[slot] - 1];
+        if (!Bits_memcmp(auth->secret, a->secret, 32)) {
+            return true;
+        }
+    }
+    for (uint32_t slot = userHashCode(user) & mask;
+         users->userIndex[slot];
+         slot = (slot + 1) & mask)
+    {
+        if (String_equals(user, users->passwords[users->userIndex[slot] - 1].user)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @return the user name object of an entry with the same name and password as auth, sessions
+ *         which were authenticated with it hold this pointer.
+ */
+static String* existingUser(struct CryptoAuth_Users* users, struct CryptoAuth_Auth* auth)
+{
+    uint32_t mask = users->capacity * 2 - 1;
+    for (uint32_t slot = userHashCode(auth->user) & mask;
+         users->userIndex[slot];
+         slot = (slot + 1) & mask)
+    {
+        struct CryptoAuth_Auth* a = &users->passwords[users->userIndex[slot] - 1];
+        if (String_equals(auth->user, a->user) && !Bits_memcmp(auth->secret, a->secret, 32)) {
+            return a->user;
+        }
+    }
     return NULL;
 }
 
@@ -307,15 +501,36 @@ static inline void encrypt(uint32_t nonce,
     encryptRndNonce(nonceAs.bytes, msg, secret);
 }
 
+/**
+ * The caller cannot know whether a message will become a handshake so the space for the
+ * handshake header is always required, this allows encryption to always be done in place.
+ */
 static inline void setRequiredPadding(struct CryptoAuth_Wrapper* wrapper)
 {
-    uint32_t padding = (wrapper->nextNonce < 4) ? 36 : sizeof(union Headers_CryptoAuth) + 32;
+    uint32_t padding = sizeof(union Headers_CryptoAuth) + 32;
     wrapper->externalInterface.requiredPadding =
         wrapper->wrappedInterface->requiredPadding + padding;
     wrapper->externalInterface.maxMessageLength =
         wrapper->wrappedInterface->maxMessageLength - padding;
 }
 
+/** Time the handshake if this packet answers the first hello or key which we sent. */
+static inline void handshakeAnswered(struct CryptoAuth_Wrapper* wrapper)
+{
+    if (wrapper->timeOfHandshakeSent) {
+        uint64_t now = Time_currentTimeMilliseconds(wrapper->context->eventBase);
+        wrapper->stats.rttMilliseconds = now - wrapper->timeOfHandshakeSent;
+        Histogram_add(wrapper->context->pub.handshakeTimes, wrapper->stats.rttMilliseconds);
+        wrapper->timeOfHandshakeSent = 0;
+    }
+}
+
+static inline void countSent(struct CryptoAuth_Wrapper* wrapper, uint32_t length)
+{
+    wrapper->stats.packetsOut++;
+    wrapper->stats.bytesOut += length;
+}
+
 static inline bool knowHerKey(struct CryptoAuth_Wrapper* wrapper)
 {
     return !Bits_isZero(wrapper->herPerminentPubKey, 32);
@@ -325,7 +540,9 @@ static void getIp6(struct CryptoAuth_Wrapper* wrapper, uint8_t* addr)
 {
     if (knowHerKey(wrapper)) {
         uint8_t ip6[16];
-        AddressCalc_addressForPublicKey(ip6, wrapper->herPerminentPubKey);
+        AddressCalc_cachedAddressForPublicKey(ip6,
+                                              wrapper->herPerminentPubKey,
+                                              wrapper->context->pub.addressCache);
         AddrTools_printIp(addr, ip6);
     }
 }
@@ -355,6 +572,75 @@ static void reset(struct CryptoAuth_Wrapper* wrapper)
     Bits_memset(&wrapper->replayProtector, 0, sizeof(struct ReplayProtector));
 }
 
+/** Reset the session but keep accepting packets which were sent with the keys it had. */
+static void rekey(struct CryptoAuth_Wrapper* wrapper)
+{
+    if (wrapper->established) {
+        Bits_memcpyConst(wrapper->previousSecret, wrapper->sharedSecret, 32);
+        wrapper->previousIsInitiator = wrapper->isInitiator;
+        wrapper->previousSecretExpires = Time_currentTimeSeconds(wrapper->context->eventBase)
+            + CryptoAuth_PREVIOUS_EPOCH_SECONDS;
+        Bits_memcpyConst(&wrapper->previousReplayProtector,
+                         &wrapper->replayProtector,
+                         sizeof(struct ReplayProtector));
+    }
+    reset(wrapper);
+}
+
+/** Hold an outgoing message until the other node's key is known. */
+static void bufferMessage(struct Message* message, struct CryptoAuth_Wrapper* wrapper)
+{
+    uint32_t max = wrapper->context->pub.maxBufferedMessages;
+    max = (max > CryptoAuth_MAX_BUFFERED_MESSAGES) ? CryptoAuth_MAX_BUFFERED_MESSAGES : max;
+    max = (max) ? max : 1;
+    while (wrapper->bufferedCount >= max) {
+        // Not exactly a drop but a message is not going to reach the destination.
+        cryptoAuthDebug0(wrapper,
+            "DROP Expelled a message because a session has not yet been setup");
+        Allocator_free(wrapper->bufferedMessages[0]->alloc);
+        wrapper->bufferedCount--;
+        Bits_memmove(wrapper->bufferedMessages,
+                     &wrapper->bufferedMessages[1],
+                     wrapper->bufferedCount * sizeof(struct Message*));
+        Bits_memmove(wrapper->timeBuffered,
+                     &wrapper->timeBuffered[1],
+                     wrapper->bufferedCount * sizeof(uint64_t));
+    }
+
+    cryptoAuthDebug0(wrapper, "Buffered a message");
+    struct Allocator* bmalloc = Allocator_child(wrapper->externalInterface.allocator);
+    wrapper->bufferedMessages[wrapper->bufferedCount] = Message_clone(message, bmalloc);
+    wrapper->timeBuffered[wrapper->bufferedCount] =
+        Time_currentTimeMilliseconds(wrapper->context->eventBase);
+    wrapper->bufferedCount++;
+}
+
+static uint8_t sendMessage(struct Message* message, struct Interface* interface);
+
+/** Send the messages which were buffered by bufferMessage() unless they have waited too long. */
+static void sendBufferedMessages(struct CryptoAuth_Wrapper* wrapper)
+{
+    // Taken off the wrapper first because sending them goes back through encryptHandshake().
+    struct Message* messages[CryptoAuth_MAX_BUFFERED_MESSAGES];
+    uint64_t times[CryptoAuth_MAX_BUFFERED_MESSAGES];
+    uint32_t count = wrapper->bufferedCount;
+    Bits_memcpy(messages, wrapper->bufferedMessages, count * sizeof(struct Message*));
+    Bits_memcpy(times, wrapper->timeBuffered, count * sizeof(uint64_t));
+    wrapper->bufferedCount = 0;
+
+    uint64_t now = Time_currentTimeMilliseconds(wrapper->context->eventBase);
+    uint32_t ttl = wrapper->context->pub.bufferedMessageTTLMilliseconds;
+    for (uint32_t i = 0; i < count; i++) {
+        if (ttl && now - times[i] > ttl) {
+            cryptoAuthDebug0(wrapper, "DROP Buffered message expired before sending");
+        } else {
+            cryptoAuthDebug0(wrapper, "Sending buffered message");
+            sendMessage(messages[i], &wrapper->externalInterface);
+        }
+        Allocator_free(messages[i]->alloc);
+    }
+}
+
 /**
  * If we don't know her key, the handshake has to be done backwards.
  * Reverse handshake requests are signaled by sending a non-obfuscated zero nonce.
@@ -367,16 +653,7 @@ static uint8_t genReverseHandshake(struct Message* message,
     Message_shift(message, -Headers_CryptoAuth_SIZE, NULL);
 
     // Buffer the packet so it can be sent ASAP
-    if (wrapper->bufferedMessage != NULL) {
-        // Not exactly a drop but a message is not going to reach the destination.
-        cryptoAuthDebug0(wrapper,
-            "DROP Expelled a message because a session has not yet been setup");
-        Allocator_free(wrapper->bufferedMessage->alloc);
-    }
-
-    cryptoAuthDebug0(wrapper, "Buffered a message");
-    struct Allocator* bmalloc = Allocator_child(wrapper->externalInterface.allocator);
-    wrapper->bufferedMessage = Message_clone(message, bmalloc);
+    bufferMessage(message, wrapper);
     Assert_true(wrapper->nextNonce == 0);
 
     Message_shift(message, Headers_CryptoAuth_SIZE, NULL);
@@ -394,8 +671,6 @@ static uint8_t genReverseHandshake(struct Message* message,
     return wrapper->wrappedInterface->sendMessage(message, wrapper->wrappedInterface);
 }
 
-static uint8_t sendMessage(struct Message* message, struct Interface* interface);
-
 static uint8_t encryptHandshake(struct Message* message,
                                 struct CryptoAuth_Wrapper* wrapper,
                                 int setupMessage)
@@ -418,26 +693,29 @@ static uint8_t encryptHandshake(struct Message* message,
         // result of getHerPublicKey() then we want to make sure they didn't memcpy in an invalid
         // key.
         uint8_t calculatedIp6[16];
-        AddressCalc_addressForPublicKey(calculatedIp6, wrapper->herPerminentPubKey);
+        AddressCalc_cachedAddressForPublicKey(calculatedIp6,
+                                              wrapper->herPerminentPubKey,
+                                              wrapper->context->pub.addressCache);
         Assert_always(!Bits_memcmp(wrapper->herIp6, calculatedIp6, 16));
     }
 
-    if (wrapper->bufferedMessage) {
-        // We wanted to send a message but we didn't know the peer's key so we buffered it
+    // A message which is buffered behind a connectToMe is counted when it is really sent,
+    // setup packets carry nothing from the user and are not counted at all.
+    if (!setupMessage) {
+        countSent(wrapper, message->length - sizeof(union Headers_CryptoAuth));
+    }
+
+    if (wrapper->bufferedCount) {
+        // We wanted to send messages but we didn't know the peer's key so we buffered them
         // and sent a connectToMe.
         // Now we just discovered their key and we're sending a hello packet.
-        // Lets send 2 hello packets instead and on one will attach our buffered message.
+        // Lets send a hello packet for each buffered message before this one.
 
         // This can never happen when the machine is beyond the first hello packet because
-        // it should have been sent either by this or in the recipet of a hello packet from
+        // they should have been sent either by this or in the recipet of a hello packet from
         // the other node.
         Assert_true(wrapper->nextNonce == 0);
-
-        struct Message* bm = wrapper->bufferedMessage;
-        wrapper->bufferedMessage = NULL;
-        cryptoAuthDebug0(wrapper, "Sending buffered message");
-        sendMessage(bm, &wrapper->externalInterface);
-        Allocator_free(bm->alloc);
+        sendBufferedMessages(wrapper);
     }
 
     // Password auth
@@ -462,6 +740,9 @@ static uint8_t encryptHandshake(struct Message* message,
     header->nonce = sessionState_be;
 
     if (wrapper->nextNonce == 0 || wrapper->nextNonce == 2) {
+        // Repeats are not timed, there's no telling which one the answer is to.
+        wrapper->timeOfHandshakeSent = Time_currentTimeMilliseconds(wrapper->context->eventBase);
+
         // If we're sending a hello or a key
         // Here we make up a temp keypair
         Random_bytes(wrapper->context->rand, wrapper->ourTempPrivKey, 32);
@@ -496,11 +777,10 @@ static uint8_t encryptHandshake(struct Message* message,
 
     uint8_t sharedSecret[32];
     if (wrapper->nextNonce < 2) {
-        getSharedSecret(sharedSecret,
-                        wrapper->context->privateKey,
-                        wrapper->herPerminentPubKey,
-                        passwordHash,
-                        wrapper->context->logger);
+        getPermanentSharedSecret(sharedSecret,
+                                 wrapper->herPerminentPubKey,
+                                 passwordHash,
+                                 wrapper->context);
 
         wrapper->isInitiator = true;
 
@@ -555,11 +835,103 @@ static uint8_t encryptHandshake(struct Message* message,
     return wrapper->wrappedInterface->sendMessage(message, wrapper->wrappedInterface);
 }
 
+/** A message which is being encrypted or decrypted on the thread pool. */
+struct CryptoAuth_Job
+{
+    /** Owns the job and holds the message in existence. */
+    struct Allocator* alloc;
+
+    struct Message* message;
+    uint8_t secret[32];
+    uint32_t nonce;
+    bool isInitiator;
+
+    /** Set once the message has been processed and is ready to send or pass up. */
+    bool done;
+
+    /** Set if the message could not be decrypted with the secret it was queued with. */
+    bool failed;
+
+    struct CryptoAuth_Wrapper* wrapper;
+
+    Identity
+};
+
+/** Runs on the thread pool, only the job may be touched. */
+static void encryptJob(void* vjob)
+{
+    struct CryptoAuth_Job* job = vjob;
+    encrypt(job->nonce, job->message, job->secret, job->isInitiator);
+    Message_shift(job->message, 4, NULL);
+    union Headers_CryptoAuth* header = (union Headers_CryptoAuth*) job->message->bytes;
+    header->nonce = Endian_hostToBigEndian32(job->nonce);
+}
+
+/** Runs on the event loop, send every job which is done and not waiting on an earlier one. */
+static void encryptJobComplete(void* vjob)
+{
+    struct CryptoAuth_Job* job = Identity_cast((struct CryptoAuth_Job*) vjob);
+    struct CryptoAuth_Wrapper* wrapper = job->wrapper;
+    job->done = true;
+    for (;;) {
+        struct CryptoAuth_Job** next = &wrapper->jobs[wrapper->jobsSent % CryptoAuth_MAX_JOBS];
+        if (!*next || !(*next)->done) {
+            return;
+        }
+        struct CryptoAuth_Job* toSend = *next;
+        *next = NULL;
+        wrapper->jobsSent++;
+        wrapper->wrappedInterface->sendMessage(toSend->message, wrapper->wrappedInterface);
+        Allocator_free(toSend->alloc);
+    }
+}
+
+static inline uint8_t encryptMessageAsync(struct Message* message,
+                                          struct CryptoAuth_Wrapper* wrapper)
+{
+    if (wrapper->jobsQueued - wrapper->jobsSent >= CryptoAuth_MAX_JOBS) {
+        cryptoAuthDebug0(wrapper, "DROP too many messages waiting to be encrypted");
+        return Error_NONE;
+    }
+
+    // The caller may reuse the buffer as soon as this returns so the message must be copied.
+    struct Allocator* alloc = Allocator_child(wrapper->externalInterface.allocator);
+    message = Message_clone(message, alloc);
+
+    struct CryptoAuth_Job* job = Allocator_clone(alloc, (&(struct CryptoAuth_Job) {
+        .alloc = alloc,
+        .message = message,
+        .nonce = wrapper->nextNonce,
+        .isInitiator = wrapper->isInitiator,
+        .wrapper = wrapper
+    }));
+    Bits_memcpyConst(job->secret, wrapper->sharedSecret, 32);
+    Identity_set(job);
+
+    if (WorkQueue_run(encryptJob, encryptJobComplete, job, wrapper->context->eventBase, alloc)) {
+        cryptoAuthDebug0(wrapper, "DROP failed to queue message for encryption");
+        Allocator_free(alloc);
+        return Error_NONE;
+    }
+
+    wrapper->jobs[wrapper->jobsQueued % CryptoAuth_MAX_JOBS] = job;
+    wrapper->jobsQueued++;
+    wrapper->nextNonce++;
+    return Error_NONE;
+}
+
 static inline uint8_t encryptMessage(struct Message* message,
                                      struct CryptoAuth_Wrapper* wrapper)
 {
     Assert_true(message->padding >= 36 || !"not enough padding");
 
+    countSent(wrapper, message->length);
+
+    // If anything is still being encrypted, this must queue behind it to keep the order.
+    if (wrapper->context->pub.asyncEncryption || wrapper->jobsQueued != wrapper->jobsSent) {
+        return encryptMessageAsync(message, wrapper);
+    }
+
     encrypt(wrapper->nextNonce,
             message,
             wrapper->sharedSecret,
@@ -586,13 +958,16 @@ static uint8_t sendMessage(struct Message* message, struct Interface* interface)
 
     // If the nonce wraps, start over.
     if (wrapper->nextNonce >= 0xfffffff0) {
-        reset(wrapper);
+        rekey(wrapper);
     }
 
     #ifdef Log_DEBUG
         Assert_true(!((uintptr_t)message->bytes % 4) || !"alignment fault");
     #endif
 
+    // Encryption is always done in place, the caller must provide the space for it.
+    Assert_true(message->padding >= interface->requiredPadding || !"not enough padding");
+
     // nextNonce 0: sending hello, we are initiating connection.
     // nextNonce 1: sending another hello, nothing received yet.
     // nextNonce 2: sending key, hello received.
@@ -626,6 +1001,8 @@ static inline uint8_t callReceivedMessage(struct CryptoAuth_Wrapper* wrapper,
                                           struct Message* message)
 {
     wrapper->timeOfLastPacket = Time_currentTimeSeconds(wrapper->context->eventBase);
+    wrapper->stats.packetsIn++;
+    wrapper->stats.bytesIn += message->length;
 
     uint8_t ret = 0;
     if (wrapper->externalInterface.receiveMessage != NULL) {
@@ -676,7 +1053,9 @@ static uint8_t decryptHandshake(struct CryptoAuth_Wrapper* wrapper,
         }
     } else if (!Bits_isZero(wrapper->herIp6, 16)) {
         uint8_t calculatedIp6[16];
-        AddressCalc_addressForPublicKey(calculatedIp6, header->handshake.publicKey);
+        AddressCalc_cachedAddressForPublicKey(calculatedIp6,
+                                              header->handshake.publicKey,
+                                              wrapper->context->pub.addressCache);
         if (Bits_memcmp(wrapper->herIp6, calculatedIp6, 16)) {
             cryptoAuthDebug0(wrapper, "DROP packet with public key not matching ip6 for session");
             return Error_AUTHENTICATION;
@@ -688,6 +1067,12 @@ static uint8_t decryptHandshake(struct CryptoAuth_Wrapper* wrapper,
         // this is because we don't know that the other end knows our key until we
         // have received a valid packet from them.
         // We can't allow the upper layer to see this message because it's not authenticated.
+        if (!getCachedSecret(header->handshake.publicKey, wrapper->context)
+            && !allowHandshake(wrapper->context))
+        {
+            cryptoAuthDebug0(wrapper, "DROP connect-to-me, too many handshakes");
+            return Error_FLOOD;
+        }
         if (!knowHerKey(wrapper)) {
             Bits_memcpyConst(wrapper->herPerminentPubKey, header->handshake.publicKey, 32);
         }
@@ -744,11 +1129,11 @@ static uint8_t decryptHandshake(struct CryptoAuth_Wrapper* wrapper,
             }
         }
 
-        getSharedSecret(sharedSecret,
-                        wrapper->context->privateKey,
-                        herPermKey,
-                        passwordHash,
-                        wrapper->context->logger);
+        if (!getCachedSecret(herPermKey, wrapper->context) && !allowHandshake(wrapper->context)) {
+            cryptoAuthDebug0(wrapper, "DROP hello, too many handshakes");
+            return Error_FLOOD;
+        }
+        getPermanentSharedSecret(sharedSecret, herPermKey, passwordHash, wrapper->context);
         nextNonce = 2;
     } else {
         if (nonce == 2) {
@@ -766,6 +1151,10 @@ static uint8_t decryptHandshake(struct CryptoAuth_Wrapper* wrapper,
             cryptoAuthDebug0(wrapper, "DROP a stray key packet");
             return Error_AUTHENTICATION;
         }
+        if (!allowHandshake(wrapper->context)) {
+            cryptoAuthDebug0(wrapper, "DROP key packet, too many handshakes");
+            return Error_FLOOD;
+        }
         // We sent the hello, this is a key
         getSharedSecret(sharedSecret,
                         wrapper->ourTempPrivKey,
@@ -863,6 +1252,7 @@ static uint8_t decryptHandshake(struct CryptoAuth_Wrapper* wrapper,
 
             wrapper->user = user;
             Bits_memcpyConst(wrapper->herTempPubKey, header->handshake.encryptedTempKey, 32);
+            handshakeAnswered(wrapper);
         } else {
             // It's a (possibly repeat) key packet and we have begun sending run data.
             // We will change the shared secret to the one specified in the new key packet but
@@ -884,7 +1274,7 @@ static uint8_t decryptHandshake(struct CryptoAuth_Wrapper* wrapper,
         // they are the sender of the hello packet or their permanent public key is lower.
         // this is a tie-breaker in case hello packets cross on the wire.
         if (wrapper->established) {
-            reset(wrapper);
+            rekey(wrapper);
         }
         // We got a (possibly repeat) hello packet and we have not sent any hello packet,
         // new session.
@@ -924,15 +1314,10 @@ static uint8_t decryptHandshake(struct CryptoAuth_Wrapper* wrapper,
     // If this is a handshake which was initiated in reverse because we
     // didn't know the other node's key, now send what we were going to send.
 
-    if (wrapper->bufferedMessage) {
+    if (wrapper->bufferedCount) {
         // This can only happen when we have received a (maybe repeat) hello packet.
         Assert_true(wrapper->nextNonce == 2);
-
-        struct Message* bm = wrapper->bufferedMessage;
-        wrapper->bufferedMessage = NULL;
-        cryptoAuthDebug0(wrapper, "Sending buffered message");
-        sendMessage(bm, &wrapper->externalInterface);
-        Allocator_free(bm->alloc);
+        sendBufferedMessages(wrapper);
     }
 
     if (message->length == 0 && Headers_isSetupPacket(&header->handshake.auth)) {
@@ -945,6 +1330,114 @@ static uint8_t decryptHandshake(struct CryptoAuth_Wrapper* wrapper,
     return callReceivedMessage(wrapper, message);
 }
 
+/**
+ * Try to decrypt a run message with the keys from before the last rekey.
+ *
+ * @return 1 if the message was decrypted, -1 if it was sent with the previous keys but is a
+ *         replay, 0 if it was not sent with the previous keys, in this case it is not altered.
+ */
+static inline int decryptPreviousEpoch(struct CryptoAuth_Wrapper* wrapper,
+                                       uint32_t nonce,
+                                       struct Message* content)
+{
+    if (Bits_isZero(wrapper->previousSecret, 32)) {
+        return 0;
+    }
+    if (Time_currentTimeSeconds(wrapper->context->eventBase) > wrapper->previousSecretExpires) {
+        Bits_memset(wrapper->previousSecret, 0, 32);
+        return 0;
+    }
+    if (decrypt(nonce, content, wrapper->previousSecret, wrapper->previousIsInitiator)) {
+        return 0;
+    }
+    if (!ReplayProtector_checkNonce(nonce, &wrapper->previousReplayProtector)) {
+        cryptoAuthDebug(wrapper, "DROP nonce checking failed for previous keys nonce=[%u]", nonce);
+        return -1;
+    }
+    cryptoAuthDebug(wrapper, "Received message sent with previous keys nonce=[%u]", nonce);
+    return 1;
+}
+
+/** Runs on the thread pool, only the job may be touched. */
+static void decryptJob(void* vjob)
+{
+    struct CryptoAuth_Job* job = vjob;
+    job->failed = decrypt(job->nonce, job->message, job->secret, job->isInitiator) != 0;
+}
+
+/** Runs on the event loop, pass up every job which is done and not waiting on an earlier one. */
+static void decryptJobComplete(void* vjob)
+{
+    struct CryptoAuth_Job* job = Identity_cast((struct CryptoAuth_Job*) vjob);
+    struct CryptoAuth_Wrapper* wrapper = job->wrapper;
+    job->done = true;
+    for (;;) {
+        struct CryptoAuth_Job** next =
+            &wrapper->decryptJobs[wrapper->decryptJobsDelivered % CryptoAuth_MAX_JOBS];
+        if (!*next || !(*next)->done) {
+            return;
+        }
+        struct CryptoAuth_Job* toDeliver = *next;
+        *next = NULL;
+        wrapper->decryptJobsDelivered++;
+
+        // The replay check must be made in the order the messages arrived, if the session was
+        // rekeyed in the meantime the message belongs to the previous keys.
+        struct Message* msg = toDeliver->message;
+        uint32_t nonce = toDeliver->nonce;
+        struct ReplayProtector* rp = Bits_memcmp(toDeliver->secret, wrapper->sharedSecret, 32)
+            ? &wrapper->previousReplayProtector : &wrapper->replayProtector;
+        if (!wrapper->established) {
+            cryptoAuthDebug0(wrapper, "DROP session was reset while the message was decrypted");
+        } else if (toDeliver->failed
+            ? decryptPreviousEpoch(wrapper, nonce, msg) <= 0
+            : !ReplayProtector_checkNonce(nonce, rp))
+        {
+            wrapper->stats.decryptFailures++;
+            Probe_fire2(decryptFail, nonce, msg->length);
+            cryptoAuthDebug(wrapper, "DROP Failed to decrypt message nonce=[%u]", nonce);
+        } else {
+            callReceivedMessage(wrapper, msg);
+        }
+        Allocator_free(toDeliver->alloc);
+    }
+}
+
+/** Queue a run message in an established session for decryption on the thread pool. */
+static inline uint8_t decryptMessageAsync(struct CryptoAuth_Wrapper* wrapper,
+                                          uint32_t nonce,
+                                          struct Message* message)
+{
+    if (wrapper->decryptJobsQueued - wrapper->decryptJobsDelivered >= CryptoAuth_MAX_JOBS) {
+        cryptoAuthDebug0(wrapper, "DROP too many messages waiting to be decrypted");
+        return Error_NONE;
+    }
+
+    // The caller may reuse the buffer as soon as this returns so the message must be copied.
+    struct Allocator* alloc = Allocator_child(wrapper->externalInterface.allocator);
+    message = Message_clone(message, alloc);
+
+    struct CryptoAuth_Job* job = Allocator_clone(alloc, (&(struct CryptoAuth_Job) {
+        .alloc = alloc,
+        .message = message,
+        .nonce = nonce,
+        .isInitiator = wrapper->isInitiator,
+        .wrapper = wrapper
+    }));
+    Bits_memcpyConst(job->secret, wrapper->sharedSecret, 32);
+    Identity_set(job);
+
+    if (WorkQueue_run(decryptJob, decryptJobComplete, job, wrapper->context->eventBase, alloc)) {
+        cryptoAuthDebug0(wrapper, "DROP failed to queue message for decryption");
+        Allocator_free(alloc);
+        return Error_NONE;
+    }
+
+    wrapper->decryptJobs[wrapper->decryptJobsQueued % CryptoAuth_MAX_JOBS] = job;
+    wrapper->decryptJobsQueued++;
+    return Error_NONE;
+}
+
 static uint8_t receiveMessage(struct Message* received, struct Interface* interface)
 {
     struct CryptoAuth_Wrapper* wrapper =
@@ -966,6 +1459,11 @@ static uint8_t receiveMessage(struct Message* received, struct Interface* interf
 
     if (!wrapper->established) {
         if (nonce > 3 && nonce != UINT32_MAX) {
+            switch (decryptPreviousEpoch(wrapper, nonce, received)) {
+                case 1: return callReceivedMessage(wrapper, received);
+                case -1: return Error_UNDELIVERABLE;
+                default: break;
+            }
             if (wrapper->nextNonce < 3) {
                 // This is impossible because we have not exchanged hello and key messages.
                 cryptoAuthDebug0(wrapper, "DROP Received a run message to an un-setup session");
@@ -996,9 +1494,11 @@ static uint8_t receiveMessage(struct Message* received, struct Interface* interf
                 Bits_memset(wrapper->ourTempPubKey, 0, 32);
                 Bits_memset(wrapper->herTempPubKey, 0, 32);
                 wrapper->established = true;
+                handshakeAnswered(wrapper);
 
                 return callReceivedMessage(wrapper, received);
             }
+            wrapper->stats.decryptFailures++;
             CryptoAuth_reset(&wrapper->externalInterface);
             cryptoAuthDebug0(wrapper, "DROP Final handshake step failed");
             return Error_UNDELIVERABLE;
@@ -1009,9 +1509,20 @@ static uint8_t receiveMessage(struct Message* received, struct Interface* interf
 
     } else if (nonce > 3 && nonce != UINT32_MAX) {
         Assert_true(!Bits_isZero(wrapper->sharedSecret, 32));
+        // If anything is still being decrypted, this must queue behind it to keep the order.
+        if (wrapper->context->pub.asyncDecryption
+            || wrapper->decryptJobsQueued != wrapper->decryptJobsDelivered)
+        {
+            return decryptMessageAsync(wrapper, nonce, received);
+        }
         if (decryptMessage(wrapper, nonce, received, wrapper->sharedSecret)) {
             return callReceivedMessage(wrapper, received);
+        } else if (decryptPreviousEpoch(wrapper, nonce, received) > 0) {
+            // A packet which was delayed past the rekey.
+            return callReceivedMessage(wrapper, received);
         } else {
+            wrapper->stats.decryptFailures++;
+            Probe_fire2(decryptFail, nonce, received->length);
             cryptoAuthDebug0(wrapper, "DROP Failed to decrypt message");
             return Error_UNDELIVERABLE;
         }
@@ -1027,6 +1538,82 @@ static uint8_t receiveMessage(struct Message* received, struct Interface* interf
     Assert_always(0);
 }
 
+/** Pass decrypted messages up, the time of last packet is only updated once for all of them. */
+static inline void deliverBatch(struct CryptoAuth_Wrapper* wrapper,
+                                struct Message** msgs,
+                                int count)
+{
+    if (!count) {
+        return;
+    }
+    wrapper->timeOfLastPacket = Time_currentTimeSeconds(wrapper->context->eventBase);
+    wrapper->stats.packetsIn += count;
+    for (int i = 0; i < count; i++) {
+        wrapper->stats.bytesIn += msgs[i]->length;
+        if (wrapper->externalInterface.receiveMessage) {
+            wrapper->externalInterface.receiveMessage(msgs[i], &wrapper->externalInterface);
+        }
+    }
+}
+
+void CryptoAuth_receiveBatch(struct Message** msgs, int count, struct Interface* interface)
+{
+    struct CryptoAuth_Wrapper* wrapper =
+        Identity_cast((struct CryptoAuth_Wrapper*) interface->receiverContext);
+
+    // Anything which is still being decrypted must be delivered first so each message queues
+    // behind it, see receiveMessage().
+    if (wrapper->context->pub.asyncDecryption
+        || wrapper->decryptJobsQueued != wrapper->decryptJobsDelivered)
+    {
+        for (int i = 0; i < count; i++) {
+            receiveMessage(msgs[i], interface);
+        }
+        return;
+    }
+
+    struct Message* decrypted[CryptoAuth_BATCH_MAX];
+    int decryptedCount = 0;
+
+    for (int i = 0; i < count; i++) {
+        struct Message* msg = msgs[i];
+        uint32_t nonce = (msg->length < 20)
+            ? 0 : Endian_bigEndianToHost32(((union Headers_CryptoAuth*) msg->bytes)->nonce);
+
+        if (!wrapper->established || nonce < 4 || nonce == UINT32_MAX) {
+            // Anything but a run message in an established session could change the state of
+            // the session so everything before it must be passed up first.
+            deliverBatch(wrapper, decrypted, decryptedCount);
+            decryptedCount = 0;
+            receiveMessage(msg, interface);
+            continue;
+        }
+
+        Assert_true(msg->padding >= 12 || "need at least 12 bytes of padding in incoming message");
+        #ifdef Log_DEBUG
+            Assert_true(!((uintptr_t)msg->bytes % 4) || !"alignment fault");
+        #endif
+        Message_shift(msg, -4, NULL);
+
+        if (!decryptMessage(wrapper, nonce, msg, wrapper->sharedSecret)
+            && decryptPreviousEpoch(wrapper, nonce, msg) <= 0)
+        {
+            wrapper->stats.decryptFailures++;
+            Probe_fire2(decryptFail, nonce, msg->length);
+            cryptoAuthDebug0(wrapper, "DROP Failed to decrypt message");
+            continue;
+        }
+
+        decrypted[decryptedCount++] = msg;
+        if (decryptedCount == CryptoAuth_BATCH_MAX) {
+            deliverBatch(wrapper, decrypted, decryptedCount);
+            decryptedCount = 0;
+        }
+    }
+
+    deliverBatch(wrapper, decrypted, decryptedCount);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct CryptoAuth* CryptoAuth_new(struct Allocator* allocator,
@@ -1038,13 +1625,18 @@ struct CryptoAuth* CryptoAuth_new(struct Allocator* allocator,
     struct CryptoAuth_pvt* ca = Allocator_calloc(allocator, sizeof(struct CryptoAuth_pvt), 1);
     ca->allocator = allocator;
 
-    ca->passwords = Allocator_calloc(allocator, sizeof(struct CryptoAuth_Auth), 256);
-    ca->passwordCount = 0;
-    ca->passwordCapacity = 256;
+    newUsers(&ca->users, 256, allocator);
     ca->eventBase = eventBase;
     ca->logger = logger;
     ca->pub.resetAfterInactivitySeconds = CryptoAuth_DEFAULT_RESET_AFTER_INACTIVITY_SECONDS;
+    ca->pub.handshakesPerSecond = CryptoAuth_DEFAULT_HANDSHAKES_PER_SECOND;
+    ca->pub.maxBufferedMessages = CryptoAuth_DEFAULT_MAX_BUFFERED_MESSAGES;
+    ca->pub.bufferedMessageTTLMilliseconds = CryptoAuth_DEFAULT_BUFFERED_MESSAGE_TTL_MILLISECONDS;
+    ca->handshakeTokens = CryptoAuth_DEFAULT_HANDSHAKES_PER_SECOND;
+    ca->handshakeTokensUpdated = Time_currentTimeMilliseconds(eventBase);
     ca->rand = rand;
+    ca->pub.addressCache = Allocator_calloc(allocator, sizeof(struct AddressCalc_Cache), 1);
+    ca->pub.handshakeTimes = Allocator_calloc(allocator, sizeof(struct Histogram), 1);
     Identity_set(ca);
 
     if (privateKey != NULL) {
@@ -1077,47 +1669,113 @@ int32_t CryptoAuth_addUser(String* password,
     if (authType != 1) {
         return CryptoAuth_addUser_INVALID_AUTHTYPE;
     }
-    if (context->passwordCount == context->passwordCapacity) {
-        // TODO: realloc password space and increase buffer.
-        return CryptoAuth_addUser_OUT_OF_SPACE;
-    }
     struct CryptoAuth_Auth a;
     hashPassword_sha256(&a, password);
-    for (uint32_t i = 0; i < context->passwordCount; i++) {
-        if (!Bits_memcmp(a.secret, context->passwords[i].secret, 32) ||
-            String_equals(user, context->passwords[i].user)) {
-            return CryptoAuth_addUser_DUPLICATE;
-        }
+    struct CryptoAuth_Users* users = &context->users;
+    if (isDuplicateUser(users, &a, user)) {
+        return CryptoAuth_addUser_DUPLICATE;
+    }
+    if (users->count == users->capacity) {
+        uint32_t capacity = users->capacity * 2;
+        users->passwords = Allocator_realloc(users->alloc, users->passwords, capacity * sizeof(a));
+        users->passwordIndex = Allocator_realloc(users->alloc,
+                                                 users->passwordIndex,
+                                                 capacity * 2 * sizeof(uint32_t));
+        users->userIndex = Allocator_realloc(users->alloc,
+                                             users->userIndex,
+                                             capacity * 2 * sizeof(uint32_t));
+        users->capacity = capacity;
+        indexPasswords(users);
     }
     a.user = String_new(user->bytes, context->allocator);
-    Bits_memcpyConst(&context->passwords[context->passwordCount],
-                     &a,
-                     sizeof(struct CryptoAuth_Auth));
-    context->passwordCount++;
+    Bits_memcpyConst(&users->passwords[users->count], &a, sizeof(struct CryptoAuth_Auth));
+    indexPassword(users, users->count++);
+    return 0;
+}
+
+int32_t CryptoAuth_setUsers(struct CryptoAuth_User* list,
+                            uint32_t count,
+                            uint32_t* failedIndex,
+                            struct CryptoAuth* ca)
+{
+    struct CryptoAuth_pvt* context = Identity_cast((struct CryptoAuth_pvt*) ca);
+    uint32_t capacity = 256;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    struct CryptoAuth_Users users;
+    newUsers(&users, capacity, context->allocator);
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct CryptoAuth_Auth* a = &users.passwords[i];
+        int32_t ret = 0;
+        if (list[i].authType != 1) {
+            ret = CryptoAuth_addUser_INVALID_AUTHTYPE;
+        } else {
+            hashPassword_sha256(a, list[i].password);
+            if (isDuplicateUser(&users, a, list[i].user)) {
+                ret = CryptoAuth_addUser_DUPLICATE;
+            }
+        }
+        if (ret) {
+            Allocator_free(users.alloc);
+            if (failedIndex) {
+                *failedIndex = i;
+            }
+            return ret;
+        }
+        // The caller's string until the whole list is known to be good.
+        a->user = list[i].user;
+        indexPassword(&users, users.count++);
+    }
+
+    // Users who are still authorized with the same password keep their sessions.
+    for (uint32_t i = 0; i < count; i++) {
+        struct CryptoAuth_Auth* a = &users.passwords[i];
+        String* user = existingUser(&context->users, a);
+        a->user = (user) ? user : String_clone(a->user, context->allocator);
+    }
+
+    Allocator_free(context->users.alloc);
+    Bits_memcpyConst(&context->users, &users, sizeof(struct CryptoAuth_Users));
+
+    // Nodes which have been deauthorized should not be able to reuse cached keys.
+    Bits_memset(context->secretCache, 0, sizeof(context->secretCache));
+    context->secretCacheClock = 0;
+
+    Log_debug(context->logger, "Replaced the users with [%u] new ones", count);
     return 0;
 }
 
 int CryptoAuth_removeUsers(struct CryptoAuth* context, String* user)
 {
     struct CryptoAuth_pvt* ctx = Identity_cast((struct CryptoAuth_pvt*) context);
+
+    // Nodes which have been deauthorized should not be able to reuse cached keys.
+    Bits_memset(ctx->secretCache, 0, sizeof(ctx->secretCache));
+    ctx->secretCacheClock = 0;
+
+    struct CryptoAuth_Users* users = &ctx->users;
     if (!user) {
-        int count = ctx->passwordCount;
+        int count = users->count;
         Log_debug(ctx->logger, "Flushing [%d] users", count);
-        ctx->passwordCount = 0;
+        users->count = 0;
+        indexPasswords(users);
         return count;
     }
     int count = 0;
     int i = 0;
-    while (i < (int)ctx->passwordCount) {
-        if (String_equals(ctx->passwords[i].user, user)) {
-            Bits_memcpyConst(&ctx->passwords[i],
-                             &ctx->passwords[ctx->passwordCount--],
+    while (i < (int)users->count) {
+        if (String_equals(users->passwords[i].user, user)) {
+            Bits_memcpyConst(&users->passwords[i],
+                             &users->passwords[--users->count],
                              sizeof(struct CryptoAuth_Auth));
             count++;
         } else {
             i++;
         }
     }
+    indexPasswords(users);
     Log_debug(ctx->logger, "Removing [%d] user(s) identified by [%s]", count, user->bytes);
     return count;
 }
@@ -1125,13 +1783,13 @@ int CryptoAuth_removeUsers(struct CryptoAuth* context, String* user)
 List* CryptoAuth_getUsers(struct CryptoAuth* context, struct Allocator* alloc)
 {
     struct CryptoAuth_pvt* ctx = Identity_cast((struct CryptoAuth_pvt*) context);
-    uint32_t count = ctx->passwordCount;
+    uint32_t count = ctx->users.count;
 
     List* users = NULL;
 
     for (uint32_t i = 0; i < count; i++ )
     {
-        users = List_addString(users, String_clone(ctx->passwords[i].user, alloc), alloc);
+        users = List_addString(users, String_clone(ctx->users.passwords[i].user, alloc), alloc);
     }
 
     return users;
@@ -1145,8 +1803,13 @@ String* CryptoAuth_getUser(struct Interface* interface)
     String* user = wrapper->user;
     if (user) {
         // If the user was lost in flushusers, then we need to return null.
-        for (uint32_t i = 0; i < wrapper->context->passwordCount; i++) {
-            if (user == wrapper->context->passwords[i].user) {
+        struct CryptoAuth_Users* users = &wrapper->context->users;
+        uint32_t mask = users->capacity * 2 - 1;
+        for (uint32_t slot = userHashCode(user) & mask;
+             users->userIndex[slot];
+             slot = (slot + 1) & mask)
+        {
+            if (user == users->passwords[users->userIndex[slot] - 1].user) {
                 return user;
             }
         }
@@ -1283,6 +1946,13 @@ struct ReplayProtector* CryptoAuth_getReplayProtector(struct Interface* iface)
     return &wrapper->replayProtector;
 }
 
+struct CryptoAuth_Stats* CryptoAuth_getStats(struct Interface* iface)
+{
+    struct CryptoAuth_Wrapper* wrapper =
+        Identity_cast((struct CryptoAuth_Wrapper*)iface->senderContext);
+    return &wrapper->stats;
+}
+
 // For testing:
 void CryptoAuth_encryptRndNonce(uint8_t nonce[24], struct Message* msg, uint8_t secret[32])
 {
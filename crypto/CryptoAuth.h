@@ -17,9 +17,11 @@
 
 #include "benc/Object.h"
 #include "crypto/random/Random.h"
+#include "crypto/AddressCalc.h"
 #include "interface/Interface.h"
 #include "memory/Allocator.h"
 #include "util/Endian.h"
+#include "util/Histogram.h"
 #include "util/log/Log.h"
 #include "util/events/EventBase.h"
 #include "util/Linker.h"
@@ -29,6 +31,12 @@ Linker_require("crypto/CryptoAuth.c")
 #include <stdbool.h>
 
 #define CryptoAuth_DEFAULT_RESET_AFTER_INACTIVITY_SECONDS 60
+#define CryptoAuth_DEFAULT_HANDSHAKES_PER_SECOND 128
+#define CryptoAuth_DEFAULT_MAX_BUFFERED_MESSAGES 8
+#define CryptoAuth_DEFAULT_BUFFERED_MESSAGE_TTL_MILLISECONDS 3000
+
+/** The most messages which a session can hold while it waits for the other node's key. */
+#define CryptoAuth_MAX_BUFFERED_MESSAGES 32
 
 struct CryptoAuth
 {
@@ -39,6 +47,47 @@ struct CryptoAuth
      * a connection will be reset to prevent them hanging in a bad state.
      */
     uint32_t resetAfterInactivitySeconds;
+
+    /**
+     * The number of incoming handshake packets per second which may cost a curve25519 operation,
+     * handshakes beyond this are dropped before doing any public key crypto.
+     * Hellos from nodes whose key is in the shared secret cache are not counted.
+     * Zero means unlimited.
+     */
+    uint32_t handshakesPerSecond;
+
+    /**
+     * If true, data packets in established sessions are encrypted on the event base's thread
+     * pool rather than in line so that encryption can use more than one core.
+     * Packets of each session are still sent in order but a send which is done this way never
+     * returns an error. Handshake packets are always done in line. Default false.
+     */
+    bool asyncEncryption;
+
+    /**
+     * If true, data packets in established sessions are decrypted on the event base's thread
+     * pool so that traffic from many peers is decrypted on more than one core.
+     * Packets of each session are still passed up in the order which they arrived and replay
+     * protection is checked on the event loop. Handshake packets are always done in line.
+     * Default false.
+     */
+    bool asyncDecryption;
+
+    /**
+     * The number of outgoing messages which a session holds while it asks the other node for
+     * its key, they are all sent once the key is known. When there are more the oldest is
+     * dropped. Values above CryptoAuth_MAX_BUFFERED_MESSAGES are taken as that, zero as one.
+     */
+    uint32_t maxBufferedMessages;
+
+    /** Buffered messages which have waited longer than this are dropped. Zero means forever. */
+    uint32_t bufferedMessageTTLMilliseconds;
+
+    /** Addresses of the keys this CryptoAuth has seen, for users of the same keys. */
+    struct AddressCalc_Cache* addressCache;
+
+    /** Milliseconds from sending a hello or key to getting the answer, for every session. */
+    struct Histogram* handshakeTimes;
 };
 
 /** The internal interface wrapper struct. */
@@ -70,6 +119,30 @@ int32_t CryptoAuth_addUser(String* password,
                            String* user,
                            struct CryptoAuth* context);
 
+/** An entry for CryptoAuth_setUsers(), the arguments of CryptoAuth_addUser(). */
+struct CryptoAuth_User
+{
+    String* password;
+    uint8_t authType;
+    String* user;
+};
+
+/**
+ * Replace all of the users in one step, the lookup tables are built once for the whole list and
+ * nothing is changed unless every entry is good. Sessions which were authenticated by a user
+ * who is in the new list with the same password keep their user.
+ *
+ * @param list the new users, the strings are copied.
+ * @param count the number of entries in list.
+ * @param failedIndex if not NULL, set to the index of the entry which failed.
+ * @param context the CryptoAuth context.
+ * @return 0 if all goes well, otherwise one of the CryptoAuth_addUser_ errors.
+ */
+int32_t CryptoAuth_setUsers(struct CryptoAuth_User* list,
+                            uint32_t count,
+                            uint32_t* failedIndex,
+                            struct CryptoAuth* context);
+
 /**
  * Remove all users registered with this CryptoAuth.
  *
@@ -213,4 +286,45 @@ struct Interface* CryptoAuth_getConnectedInterface(struct Interface* iface);
  */
 struct ReplayProtector* CryptoAuth_getReplayProtector(struct Interface* iface);
 
+/** Traffic counters of a session, the lengths are of the plaintext. */
+struct CryptoAuth_Stats
+{
+    uint64_t packetsIn;
+    uint64_t bytesIn;
+    uint64_t packetsOut;
+    uint64_t bytesOut;
+
+    /** Run messages which were dropped because they failed authentication or were replays. */
+    uint64_t decryptFailures;
+
+    /**
+     * Milliseconds between sending the first hello or key packet and getting the answer to it,
+     * 0 until a handshake has been timed.
+     */
+    uint32_t rttMilliseconds;
+};
+
+/**
+ * Get the traffic counters of a session.
+ *
+ * @param iface the interface which was returned by CryptoAuth_wrapInterface().
+ */
+struct CryptoAuth_Stats* CryptoAuth_getStats(struct Interface* iface);
+
+/**
+ * Decrypt a burst of packets which all came in for the same session.
+ * In an established session, all packets are decrypted and checked against the replay
+ * protector back to back while the session state is hot and then the ones which pass are
+ * handed up to the wrapping interface in their original order. Handshake packets, or any
+ * packets while the session is not yet established, are handled one at a time exactly as if
+ * they had come in by themselves, everything before them is handed up first.
+ *
+ * @param msgs the packets, each message must be valid until the call returns.
+ * @param count the number of packets in msgs.
+ * @param iface the interface which was wrapped by CryptoAuth_wrapInterface(), the one which
+ *              the packets came in on.
+ */
+#define CryptoAuth_BATCH_MAX 32
+void CryptoAuth_receiveBatch(struct Message** msgs, int count, struct Interface* iface);
+
 #endif
@@ -0,0 +1,44 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "crypto/CryptoAuth.h"
+#include "crypto/CryptoAuth_admin.h"
+#include "util/Histogram.h"
+
+struct Context
+{
+    struct CryptoAuth* ca;
+    struct Admin* admin;
+};
+
+static void handshakeTimes(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    Dict* out = Histogram_toDict(context->ca->handshakeTimes, requestAlloc);
+    Admin_sendMessage(out, txid, context->admin);
+}
+
+void CryptoAuth_admin_register(struct CryptoAuth* ca,
+                               struct Admin* admin,
+                               struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .ca = ca,
+        .admin = admin
+    }));
+
+    Admin_registerFunction("CryptoAuth_handshakeTimes", handshakeTimes, ctx, true, NULL, admin);
+}
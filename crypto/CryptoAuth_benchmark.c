@@ -14,16 +14,25 @@
  */
 #include "crypto/random/Random.h"
 #include "crypto/CryptoAuth.h"
+#include "crypto/CryptoAuth_benchmark.h"
 #include "io/FileWriter.h"
+#include "benc/Dict.h"
+#include "benc/List.h"
 #include "benc/Object.h"
+#include "benc/String.h"
+#include "benc/serialization/json/JsonBencSerializer.h"
 #include "memory/MallocAllocator.h"
 #include "util/Bits.h"
 #include "util/Hex.h"
+#include "util/Order.h"
 #include "util/Endian.h"
 #include "util/events/Time.h"
 #include "util/events/EventBase.h"
 #include "wire/Error.h"
 
+#include "crypto_onetimeauth_poly1305.h"
+#include "crypto_stream_salsa20.h"
+
 #include "util/Assert.h"
 #include <stdio.h>
 
@@ -35,10 +44,20 @@ static const uint8_t* publicKey = (uint8_t*)
     "\x51\xaf\x8d\xd9\x35\xe8\x61\x86\x3e\x94\x2b\x1b\x6d\x21\x22\xe0"
     "\x2f\xb2\xd0\x88\x20\xbb\xf3\xf0\x6f\xcd\xe5\x85\x30\xe0\x08\x34";
 
+/** Packet sizes for the size sweep, the largest is a jumbo frame. */
+static const int SIZES[] = { 64, 128, 256, 512, 1024, 1500, 4096, 9000 };
+#define SIZE_COUNT ((int) (sizeof(SIZES) / sizeof(*SIZES)))
+
+/** Number of packets which are individually timed for each measurement. */
+#define SAMPLES 10000
+
+/** Number of established sessions for the multi-session measurement. */
+#define SESSIONS 10000
+
 struct Context
 {
     uint8_t padding[256];
-    uint8_t buffer[2048];
+    uint8_t buffer[9216];
     struct Message message;
     struct CryptoAuth* ca1;
     struct CryptoAuth* ca2;
@@ -107,6 +126,145 @@ static inline void sendMessages(struct Context* ctx,
     printf("\tFinished in %dms. %d Kb/s\n\n", (int)time, (int)kbps);
 }
 
+/** Two wrapped interfaces which send to each other. */
+struct Pair
+{
+    struct Interface if1;
+    struct Interface* cif1;
+    struct Interface if2;
+    struct Interface* cif2;
+};
+
+static struct Pair* newPair(struct Context* ctx, struct Allocator* alloc)
+{
+    struct Pair* pair = Allocator_calloc(alloc, sizeof(struct Pair), 1);
+    Bits_memcpyConst(&pair->if1, (&(struct Interface) {
+        .sendMessage = transferMessage,
+        .senderContext = &pair->if2,
+        .allocator = alloc
+    }), sizeof(struct Interface));
+    Bits_memcpyConst(&pair->if2, (&(struct Interface) {
+        .sendMessage = transferMessage,
+        .senderContext = &pair->if1,
+        .allocator = alloc
+    }), sizeof(struct Interface));
+    pair->cif2 = CryptoAuth_wrapInterface(&pair->if2, NULL, NULL, false, "cif2", ctx->ca2);
+    pair->cif1 = CryptoAuth_wrapInterface(&pair->if1, publicKey, NULL, false, "cif1", ctx->ca1);
+    return pair;
+}
+
+/** Hello, key and the first data packet. */
+static void handshake(struct Context* ctx, struct Pair* pair)
+{
+    setupMessage(ctx, 64);
+    pair->cif1->sendMessage(&ctx->message, pair->cif1);
+    setupMessage(ctx, 64);
+    pair->cif2->sendMessage(&ctx->message, pair->cif2);
+    setupMessage(ctx, 64);
+    pair->cif1->sendMessage(&ctx->message, pair->cif1);
+    Assert_true(CryptoAuth_getState(pair->cif2) == CryptoAuth_ESTABLISHED);
+}
+
+static int compareTimes(const void* a, const void* b)
+{
+    uint64_t x = *((uint64_t*) a);
+    uint64_t y = *((uint64_t*) b);
+    return (x > y) - (x < y);
+}
+
+/**
+ * Time sending SAMPLES packets from cif1 to cif2 of a pair picked by the caller.
+ *
+ * @param pairs the pairs to send over, packets go to pairs[random % count].
+ * @return a dict containing the median and 99th percentile ns per packet and the throughput.
+ */
+static Dict* timePackets(struct Context* ctx,
+                         struct Pair** pairs,
+                         int count,
+                         int size,
+                         struct Random* rand,
+                         struct Allocator* alloc)
+{
+    uint64_t* times = Allocator_malloc(alloc, SAMPLES * sizeof(uint64_t));
+    uint64_t total = 0;
+    for (int i = 0; i < SAMPLES; i++) {
+        struct Pair* pair = pairs[(count > 1) ? Random_uint32(rand) % count : 0];
+        setupMessage(ctx, size);
+        uint64_t start = Time_hrtime();
+        pair->cif1->sendMessage(&ctx->message, pair->cif1);
+        times[i] = Time_hrtime() - start;
+        total += times[i];
+    }
+    Order_qsort(times, SAMPLES, sizeof(uint64_t), compareTimes);
+
+    uint64_t kbps = (total) ? ((uint64_t) size * SAMPLES * 8 * 1000000000ull) / total / 1024 : 0;
+    // The keys must outlive this function.
+    Dict* out = Dict_new(alloc);
+    Dict_putInt(out, String_new("size", alloc), size, alloc);
+    Dict_putInt(out, String_new("p50Ns", alloc), times[SAMPLES / 2], alloc);
+    Dict_putInt(out, String_new("p99Ns", alloc), times[SAMPLES * 99 / 100], alloc);
+    Dict_putInt(out, String_new("kbps", alloc), kbps, alloc);
+    printf("\t%d bytes\tp50 %dns\tp99 %dns\t%d Kb/s\n",
+           size, (int) times[SAMPLES / 2], (int) times[SAMPLES * 99 / 100], (int) kbps);
+    return out;
+}
+
+static void extendedBenchmark(struct Context* ctx,
+                              struct Random* rand,
+                              struct Allocator* alloc)
+{
+    Dict* results = Dict_new(alloc);
+    Dict_putString(results,
+                   String_CONST("salsa20"),
+                   String_new(crypto_stream_salsa20_IMPLEMENTATION, alloc),
+                   alloc);
+    Dict_putString(results,
+                   String_CONST("poly1305"),
+                   String_new(crypto_onetimeauth_poly1305_IMPLEMENTATION, alloc),
+                   alloc);
+
+    // Handshakes are never throttled here, they are what is being measured.
+    ctx->ca1->handshakesPerSecond = 0;
+    ctx->ca2->handshakesPerSecond = 0;
+
+    // Sessions are too big for the caller's allocator.
+    struct Allocator* sessionAlloc = MallocAllocator_new(1<<30);
+    struct Pair** pairs = Allocator_malloc(sessionAlloc, SESSIONS * sizeof(struct Pair*));
+    printf("Test %d complete handshakes\n", SESSIONS);
+    uint64_t startTime = Time_hrtime();
+    for (int i = 0; i < SESSIONS; i++) {
+        pairs[i] = newPair(ctx, sessionAlloc);
+        handshake(ctx, pairs[i]);
+    }
+    uint64_t time = Time_hrtime() - startTime;
+    uint64_t handshakesPerSecond = (time) ? (SESSIONS * 1000000000ull) / time : 0;
+    printf("\t%d handshakes per second\n\n", (int) handshakesPerSecond);
+    Dict_putInt(results, String_CONST("handshakesPerSecond"), handshakesPerSecond, alloc);
+
+    printf("Test packet size sweep over one session\n");
+    Dict* sweepResults[SIZE_COUNT];
+    for (int i = 0; i < SIZE_COUNT; i++) {
+        sweepResults[i] = timePackets(ctx, pairs, 1, SIZES[i], rand, alloc);
+    }
+    // List_addDict() prepends.
+    List* sweep = NULL;
+    for (int i = SIZE_COUNT - 1; i >= 0; i--) {
+        sweep = List_addDict(sweep, sweepResults[i], alloc);
+    }
+    Dict_putList(results, String_CONST("sizes"), sweep, alloc);
+
+    printf("\nTest 1500 byte packets spread over %d sessions\n", SESSIONS);
+    Dict* sessions = timePackets(ctx, pairs, SESSIONS, 1500, rand, alloc);
+    Dict_putInt(sessions, String_CONST("sessions"), SESSIONS, alloc);
+    Dict_putDict(results, String_CONST("sessions"), sessions, alloc);
+    Allocator_free(sessionAlloc);
+
+    printf("\nJSON results:\n");
+    struct Writer* stdoutWriter = FileWriter_new(stdout, alloc);
+    JsonBencSerializer_get()->serializeDictionary(stdoutWriter, results);
+    printf("\n");
+}
+
 void CryptoAuth_benchmark(struct EventBase* base,
                           struct Log* logger,
                           struct Allocator* alloc)
@@ -129,6 +287,9 @@ void CryptoAuth_benchmark(struct EventBase* base,
     };
     printf("These metrics are speed of encryption and decryption similar to the usage pattern\n"
            "when decrypting a packet, switching it, and re-encrypting it with another key.\n");
+    printf("Using %s and %s\n\n",
+           crypto_stream_salsa20_IMPLEMENTATION,
+           crypto_onetimeauth_poly1305_IMPLEMENTATION);
 
     sendMessages(&ctx, 1000, 64, HELLO);
     sendMessages(&ctx, 1000, 1500, HELLO);
@@ -140,4 +301,6 @@ void CryptoAuth_benchmark(struct EventBase* base,
 
     printf("This is the switch configuration so this indicates expected switch throughput:\n");
     sendMessages(&ctx, 100000, 1500, TRAFFIC);
+
+    extendedBenchmark(&ctx, rand, alloc);
 }
@@ -35,15 +35,47 @@ struct CryptoAuth_Auth {
     String* user;
 };
 
+/** The result of the curve25519 step between our permanent key and her permanent key. */
+struct CryptoAuth_CachedSecret {
+    /** All zeros if the entry is unused. */
+    uint8_t herPublicKey[32];
+
+    uint8_t key[32];
+
+    /** Value of CryptoAuth_pvt.secretCacheClock when this entry was last used. */
+    uint32_t lastUsed;
+};
+
+/** The authorized passwords with their indexes, CryptoAuth_setUsers() swaps in a new one. */
+struct CryptoAuth_Users
+{
+    struct CryptoAuth_Auth* passwords;
+    uint32_t count;
+    uint32_t capacity;
+
+    /**
+     * Open addressed hash table of (index in passwords + 1) keyed on the auth challenge,
+     * zero is an empty slot. Always twice the size of capacity.
+     */
+    uint32_t* passwordIndex;
+
+    /** Like passwordIndex but keyed on the user name so adding users is not quadratic. */
+    uint32_t* userIndex;
+
+    /**
+     * Holds the arrays but not the user names, sessions keep pointers to those so they are
+     * allocated on the CryptoAuth's allocator.
+     */
+    struct Allocator* alloc;
+};
+
 struct CryptoAuth_pvt
 {
     struct CryptoAuth pub;
 
     uint8_t privateKey[32];
 
-    struct CryptoAuth_Auth* passwords;
-    uint32_t passwordCount;
-    uint32_t passwordCapacity;
+    struct CryptoAuth_Users users;
 
     struct Log* logger;
     struct EventBase* eventBase;
@@ -51,10 +83,24 @@ struct CryptoAuth_pvt
     struct Allocator* allocator;
     struct Random* rand;
 
+    /**
+     * Handshakes with a node which we have seen recently reuse the key from this cache rather
+     * than doing the scalar multiplication again, the least recently used entry is replaced.
+     */
+    #define CryptoAuth_SECRET_CACHE_SIZE 64
+    struct CryptoAuth_CachedSecret secretCache[CryptoAuth_SECRET_CACHE_SIZE];
+    uint32_t secretCacheClock;
+
+    /** Budget of expensive handshakes, see CryptoAuth.handshakesPerSecond. */
+    uint32_t handshakeTokens;
+    uint64_t handshakeTokensUpdated;
+
     Identity
 };
 
 
+struct CryptoAuth_Job;
+
 struct CryptoAuth_Wrapper
 {
     /** The public key of the other node, all zeros is taken to mean "don't know" */
@@ -81,8 +127,13 @@ struct CryptoAuth_Wrapper
 
     uint8_t ourTempPubKey[32];
 
-    /** An outgoing message which is buffered in the event that a reverse handshake is required. */
-    struct Message* bufferedMessage;
+    /**
+     * Outgoing messages which are buffered while a reverse handshake is done, oldest first,
+     * and the times in milliseconds when they were buffered. See CryptoAuth.maxBufferedMessages.
+     */
+    struct Message* bufferedMessages[CryptoAuth_MAX_BUFFERED_MESSAGES];
+    uint64_t timeBuffered[CryptoAuth_MAX_BUFFERED_MESSAGES];
+    uint32_t bufferedCount;
 
     /** A password to use for authing with the other party. */
     String* password;
@@ -90,12 +141,28 @@ struct CryptoAuth_Wrapper
     /** Used for preventing replay attacks. */
     struct ReplayProtector replayProtector;
 
+    /**
+     * The keys of the session before it was rekeyed, run packets which were sent with them are
+     * still accepted for CryptoAuth_PREVIOUS_EPOCH_SECONDS so that the packets which are in flight
+     * while the new session is set up are not lost. previousSecret is all zeros if there is none.
+     */
+    #define CryptoAuth_PREVIOUS_EPOCH_SECONDS 10
+    uint8_t previousSecret[32];
+    bool previousIsInitiator;
+    uint32_t previousSecretExpires;
+    struct ReplayProtector previousReplayProtector;
+
     /** The next nonce to use. */
     uint32_t nextNonce;
 
     /** Used to reset the connection if it's in a bad state (no traffic coming in). */
     uint32_t timeOfLastPacket;
 
+    struct CryptoAuth_Stats stats;
+
+    /** When the first hello or key packet was sent in milliseconds, 0 once it is answered. */
+    uint64_t timeOfHandshakeSent;
+
     /** The method to use for trying to auth with the server. */
     uint8_t authType;
 
@@ -113,6 +180,24 @@ struct CryptoAuth_Wrapper
     /** The internal interface which we are wrapping. */
     struct Interface* const wrappedInterface;
 
+    /**
+     * Messages which are being encrypted on the thread pool, indexed by their sequence number
+     * modulo CryptoAuth_MAX_JOBS, they are sent in the order which they were queued.
+     * See CryptoAuth.asyncEncryption.
+     */
+    #define CryptoAuth_MAX_JOBS 64
+    struct CryptoAuth_Job* jobs[CryptoAuth_MAX_JOBS];
+    uint32_t jobsQueued;
+    uint32_t jobsSent;
+
+    /**
+     * Messages which are being decrypted on the thread pool, like jobs they are passed up in
+     * the order which they arrived. See CryptoAuth.asyncDecryption.
+     */
+    struct CryptoAuth_Job* decryptJobs[CryptoAuth_MAX_JOBS];
+    uint32_t decryptJobsQueued;
+    uint32_t decryptJobsDelivered;
+
     /** The interface which this wrapper provides. */
     struct Interface externalInterface;
 
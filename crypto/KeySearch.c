@@ -0,0 +1,194 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "crypto/AddressCalc.h"
+#include "crypto/KeySearch.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#include "crypto_scalarmult_curve25519.h"
+
+#include <stdbool.h>
+
+/**
+ * How many keys each thread tries between looking at whether another thread has found one,
+ * this keeps the threads from contending for the lock.
+ */
+#define BATCH_SIZE 64
+
+struct Search
+{
+    const uint8_t* prefix;
+    int prefixBits;
+
+    /** Everything below is protected by the lock. */
+    uv_mutex_t lock;
+
+    /** Signaled when a key is found. */
+    uv_cond_t cond;
+
+    bool found;
+    struct KeySearch_Key key;
+    uint64_t keysTried;
+};
+
+struct Worker
+{
+    struct Search* search;
+
+    /** Forked from the caller's generator so the thread does not share it. */
+    struct Random* rand;
+
+    uv_thread_t thread;
+};
+
+static bool matches(const uint8_t ip6[16], const uint8_t* prefix, int prefixBits)
+{
+    int bytes = prefixBits / 8;
+    if (Bits_memcmp(ip6, prefix, bytes)) {
+        return false;
+    }
+    int remainder = prefixBits % 8;
+    if (!remainder) {
+        return true;
+    }
+    uint8_t mask = 0xff << (8 - remainder);
+    return !((ip6[bytes] ^ prefix[bytes]) & mask);
+}
+
+static void searchThread(void* vWorker)
+{
+    struct Worker* worker = vWorker;
+    struct Search* search = worker->search;
+
+    uint8_t privateKeys[BATCH_SIZE][32];
+    struct KeySearch_Key key;
+
+    for (;;) {
+        Random_bytes(worker->rand, (uint8_t*) privateKeys, sizeof(privateKeys));
+        for (int i = 0; i < BATCH_SIZE; i++) {
+            Bits_memcpyConst(key.privateKey, privateKeys[i], 32);
+            crypto_scalarmult_curve25519_base(key.publicKey, key.privateKey);
+            AddressCalc_addressForPublicKey(key.ip6, key.publicKey);
+            if (!matches(key.ip6, search->prefix, search->prefixBits)) {
+                continue;
+            }
+            uv_mutex_lock(&search->lock);
+            search->keysTried += i + 1;
+            if (!search->found) {
+                search->found = true;
+                Bits_memcpyConst(&search->key, &key, sizeof(struct KeySearch_Key));
+                uv_cond_signal(&search->cond);
+            }
+            uv_mutex_unlock(&search->lock);
+            Bits_memset(&key, 0, sizeof(struct KeySearch_Key));
+            Bits_memset(privateKeys, 0, sizeof(privateKeys));
+            return;
+        }
+        uv_mutex_lock(&search->lock);
+        search->keysTried += BATCH_SIZE;
+        bool stop = search->found;
+        uv_mutex_unlock(&search->lock);
+        if (stop) {
+            Bits_memset(&key, 0, sizeof(struct KeySearch_Key));
+            Bits_memset(privateKeys, 0, sizeof(privateKeys));
+            return;
+        }
+    }
+}
+
+static int cpuCount()
+{
+    uv_cpu_info_t* cpus;
+    int count;
+    if (uv_cpu_info(&cpus, &count).code != UV_OK) {
+        return 1;
+    }
+    uv_free_cpu_info(cpus, count);
+    return (count > 0) ? count : 1;
+}
+
+/** See: KeySearch.h */
+int KeySearch_find(struct KeySearch_Key* keyOut,
+                   const uint8_t* prefix,
+                   int prefixBits,
+                   int threadCount,
+                   KeySearch_Progress progress,
+                   void* callbackContext,
+                   struct Random* rand,
+                   struct Allocator* alloc)
+{
+    if (prefixBits < 8 || prefixBits > 128 || prefix[0] != AddressCalc_PREFIX) {
+        return -1;
+    }
+    if (threadCount <= 0) {
+        threadCount = cpuCount();
+    }
+    if (threadCount > KeySearch_MAX_THREADS) {
+        threadCount = KeySearch_MAX_THREADS;
+    }
+
+    struct Allocator* child = Allocator_child(alloc);
+    struct Search* search = Allocator_calloc(child, sizeof(struct Search), 1);
+    search->prefix = prefix;
+    search->prefixBits = prefixBits;
+    Assert_always(!uv_mutex_init(&search->lock));
+    Assert_always(!uv_cond_init(&search->cond));
+
+    uint64_t startTime = uv_hrtime();
+    struct Worker* workers = Allocator_calloc(child, sizeof(struct Worker), threadCount);
+    int started = 0;
+    for (int i = 0; i < threadCount; i++) {
+        workers[started].search = search;
+        workers[started].rand = Random_fork(rand, child);
+        if (!uv_thread_create(&workers[started].thread, searchThread, &workers[started])) {
+            started++;
+        }
+    }
+
+    uint64_t lastReport = startTime;
+    uv_mutex_lock(&search->lock);
+    while (started && !search->found) {
+        uv_cond_timedwait(&search->cond, &search->lock, 1000000000);
+        uint64_t now = uv_hrtime();
+        if (progress && !search->found && now - lastReport >= 1000000000) {
+            uint64_t keysTried = search->keysTried;
+            uv_mutex_unlock(&search->lock);
+            progress(keysTried, (now - startTime) / 1000000, callbackContext);
+            lastReport = now;
+            uv_mutex_lock(&search->lock);
+        }
+    }
+    uv_mutex_unlock(&search->lock);
+
+    for (int i = 0; i < started; i++) {
+        uv_thread_join(&workers[i].thread);
+    }
+    if (progress && started) {
+        progress(search->keysTried, (uv_hrtime() - startTime) / 1000000, callbackContext);
+    }
+
+    int ret = -1;
+    if (started) {
+        Bits_memcpyConst(keyOut, &search->key, sizeof(struct KeySearch_Key));
+        ret = 0;
+    }
+    uv_cond_destroy(&search->cond);
+    uv_mutex_destroy(&search->lock);
+    Bits_memset(search, 0, sizeof(struct Search));
+    Bits_memset(workers, 0, sizeof(struct Worker) * threadCount);
+    Allocator_free(child);
+    return ret;
+}
@@ -0,0 +1,72 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KeySearch_H
+#define KeySearch_H
+
+#include "crypto/random/Random.h"
+#include "memory/Allocator.h"
+#include "util/Linker.h"
+Linker_require("crypto/KeySearch.c")
+
+#include <stdint.h>
+
+/** A key pair and the address which it hashes to. */
+struct KeySearch_Key
+{
+    uint8_t privateKey[32];
+    uint8_t publicKey[32];
+    uint8_t ip6[16];
+};
+
+/**
+ * Called from the thread which called KeySearch_find() about once a second while the search
+ * runs and once more when it is done.
+ *
+ * @param keysTried the number of keys which have been tried so far.
+ * @param milliseconds the time since the search began.
+ * @param callbackContext the context which was passed to KeySearch_find().
+ */
+typedef void (* KeySearch_Progress)(uint64_t keysTried,
+                                    uint64_t milliseconds,
+                                    void* callbackContext);
+
+/** The most threads which KeySearch_find() will use. */
+#define KeySearch_MAX_THREADS 64
+
+/**
+ * Generate keys on many threads until one is found whose address begins with a prefix.
+ * Every cjdns address begins with AddressCalc_PREFIX so the prefix must begin with it too,
+ * each bit after the first 8 doubles the time that the search is expected to take.
+ *
+ * @param keyOut the key which was found.
+ * @param prefix the bytes which the address must begin with.
+ * @param prefixBits the number of bits of prefix which must match, between 8 and 128.
+ * @param threadCount the number of threads to use, 0 for one per CPU.
+ * @param progress called to report how fast the search is going, may be NULL.
+ * @param callbackContext passed to progress.
+ * @param rand the random source which the threads' private keys are derived from.
+ * @param alloc for the threads' state, freed before this returns.
+ * @return 0 if a key was found, -1 if the prefix is invalid or no thread could be started.
+ */
+int KeySearch_find(struct KeySearch_Key* keyOut,
+                   const uint8_t* prefix,
+                   int prefixBits,
+                   int threadCount,
+                   KeySearch_Progress progress,
+                   void* callbackContext,
+                   struct Random* rand,
+                   struct Allocator* alloc);
+
+#endif
@@ -19,10 +19,24 @@
 
 #include <stdbool.h>
 
+/**
+ * The number of nonces behind the highest seen nonce which can still be accepted.
+ * Links which reorder packets heavily (multi-path or bursty) will drop fewer packets
+ * as false replays with a wider window, at the cost of 8 bytes per 64 bits per session.
+ * Must be a multiple of 64.
+ */
+#ifndef ReplayProtector_WINDOW_BITS
+    #define ReplayProtector_WINDOW_BITS 256
+#endif
+#if (ReplayProtector_WINDOW_BITS % 64) || (ReplayProtector_WINDOW_BITS < 64)
+    #error ReplayProtector_WINDOW_BITS must be a multiple of 64
+#endif
+#define ReplayProtector_WORDS (ReplayProtector_WINDOW_BITS / 64)
+
 struct ReplayProtector
 {
-    /** internal bitfield. */
-    uint64_t bitfield;
+    /** internal bitfield, bit 0 of the first word is baseOffset. */
+    uint64_t bitfield[ReplayProtector_WORDS];
 
     /** Internal offset. */
     uint32_t baseOffset;
@@ -42,15 +56,43 @@ struct ReplayProtector
     uint32_t receivedOutOfRange;
 };
 
-static inline int RelayProtector_lostInShift(uint64_t bitfield, int shiftAmount)
+/**
+ * Move the window forward.
+ *
+ * @param bits the number of nonces to move forward by.
+ * @param context the context
+ * @return the number of nonces which were shifted out without being seen.
+ */
+static inline int ReplayProtector_shift(const uint32_t bits, struct ReplayProtector* context)
 {
-    if (shiftAmount == 0) {
-        return 0;
+    context->baseOffset += bits;
+    int seen = 0;
+    if (bits >= ReplayProtector_WINDOW_BITS) {
+        for (int i = 0; i < ReplayProtector_WORDS; i++) {
+            seen += Bits_popCountx64(context->bitfield[i]);
+            context->bitfield[i] = 0;
+        }
+        return bits - seen;
+    }
+
+    const int words = bits / 64;
+    const int rem = bits % 64;
+    for (int i = 0; i < words; i++) {
+        seen += Bits_popCountx64(context->bitfield[i]);
     }
-    if (shiftAmount > 63) {
-        return shiftAmount - Bits_popCountx64(bitfield);
+    if (rem) {
+        seen += Bits_popCountx64(context->bitfield[words] << (64 - rem));
     }
-    return shiftAmount - Bits_popCountx64(bitfield << (64 - shiftAmount));
+    for (int i = 0; i < ReplayProtector_WORDS; i++) {
+        uint64_t low = (i + words < ReplayProtector_WORDS) ? context->bitfield[i + words] : 0;
+        if (rem) {
+            uint64_t high =
+                (i + words + 1 < ReplayProtector_WORDS) ? context->bitfield[i + words + 1] : 0;
+            low = (low >> rem) | (high << (64 - rem));
+        }
+        context->bitfield[i] = low;
+    }
+    return bits - seen;
 }
 
 /**
@@ -58,8 +100,9 @@ static inline int RelayProtector_lostInShift(uint64_t bitfield, int shiftAmount)
  * Don't call this until the packet has been authenticated or else forged packets will
  * make legit ones appear to be duplicates.
  *
- * @param nonce the number to check, this should be a counter nonce as numbers less than 32 minus
- *              the highest seen nonce will be dropped erroniously.
+ * @param nonce the number to check, this should be a counter nonce as numbers less than
+ *              ReplayProtector_WINDOW_BITS minus the highest seen nonce will be dropped
+ *              erroniously.
  * @param context the context
  * @return true if the packet is provably not a replay, otherwise false.
  */
@@ -72,34 +115,28 @@ static inline bool ReplayProtector_checkNonce(const uint32_t nonce, struct Repla
 
     uint32_t offset = nonce - context->baseOffset;
 
-    while (offset > 63) {
-
-        #define ReplayProtector_DO_SHIFT(bits) \
-            context->baseOffset += (bits);     \
-            if ((bits) > 63) {                 \
-                context->bitfield = 0;         \
-            } else {                           \
-                context->bitfield >>= (bits);  \
-            }                                  \
-            offset -= (bits);
-
-        if ((context->bitfield & 0xffffffffu) == 0xffffffffu) {
+    while (offset >= ReplayProtector_WINDOW_BITS) {
+        if ((context->bitfield[0] & 0xffffffffu) == 0xffffffffu) {
             // happy path, low 32 bits are checked in, rotate and continue.
-            ReplayProtector_DO_SHIFT(32);
+            ReplayProtector_shift(32, context);
+            offset -= 32;
 
         } else {
-            // we are going to have to accept some losses, take offset - 47 to mitigate that
-            // as much as possible.
-            context->lostPackets += RelayProtector_lostInShift(context->bitfield, offset - 47);
-            ReplayProtector_DO_SHIFT(offset - 47);
+            // we are going to have to accept some losses, leave 16 bits of headroom above
+            // this nonce to mitigate that as much as possible.
+            uint32_t bits = offset - (ReplayProtector_WINDOW_BITS - 17);
+            context->lostPackets += ReplayProtector_shift(bits, context);
+            offset -= bits;
         }
     }
 
-    if (context->bitfield & (((uint64_t)1) << offset)) {
+    uint64_t* word = &context->bitfield[offset / 64];
+    uint64_t bit = ((uint64_t)1) << (offset % 64);
+    if (*word & bit) {
         context->duplicates++;
         return false;
     }
-    context->bitfield |= (((uint64_t)1) << offset);
+    *word |= bit;
     return true;
 }
 
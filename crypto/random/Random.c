@@ -187,12 +187,11 @@ void Random_bytes(struct Random* rand, uint8_t* location, uint64_t count)
 {
     Identity_check(rand);
     if (count > BUFFSIZE) {
-        // big request, don't buffer it.
-        crypto_stream_salsa20_xor((uint8_t*)location,
-                                  (uint8_t*)location,
-                                  count,
-                                  (uint8_t*)&rand->nonce,
-                                  (uint8_t*)rand->tempSeed);
+        // big request, don't buffer it, the stream is written over whatever is in the location.
+        crypto_stream_salsa20((uint8_t*)location,
+                              count,
+                              (uint8_t*)&rand->nonce,
+                              (uint8_t*)rand->tempSeed);
         rand->nonce++;
         return;
     }
@@ -224,17 +223,10 @@ void Random_base32(struct Random* rand, uint8_t* output, uint32_t length)
     output[length - 1] = '\0';
 }
 
-struct Random* Random_newWithSeed(struct Allocator* alloc,
-                                  struct Log* logger,
-                                  struct RandomSeed* seed,
-                                  struct Except* eh)
+static struct Random* newWithSeedGen(union Random_SeedGen* seedGen,
+                                     struct RandomSeed* seed,
+                                     struct Allocator* alloc)
 {
-    union Random_SeedGen* seedGen = Allocator_calloc(alloc, sizeof(union Random_SeedGen), 1);
-
-    if (RandomSeed_get(seed, seedGen->buff)) {
-        Except_throw(eh, "Unable to initialize secure random number generator");
-    }
-
     struct Random* rand = Allocator_calloc(alloc, sizeof(struct Random), 1);
     rand->seedGen = seedGen;
     rand->seed = seed;
@@ -249,6 +241,28 @@ struct Random* Random_newWithSeed(struct Allocator* alloc,
     return rand;
 }
 
+struct Random* Random_newWithSeed(struct Allocator* alloc,
+                                  struct Log* logger,
+                                  struct RandomSeed* seed,
+                                  struct Except* eh)
+{
+    union Random_SeedGen* seedGen = Allocator_calloc(alloc, sizeof(union Random_SeedGen), 1);
+
+    if (RandomSeed_get(seed, seedGen->buff)) {
+        Except_throw(eh, "Unable to initialize secure random number generator");
+    }
+
+    return newWithSeedGen(seedGen, seed, alloc);
+}
+
+struct Random* Random_fork(struct Random* parent, struct Allocator* alloc)
+{
+    Identity_check(parent);
+    union Random_SeedGen* seedGen = Allocator_calloc(alloc, sizeof(union Random_SeedGen), 1);
+    Random_bytes(parent, (uint8_t*) seedGen->buff, sizeof(union Random_SeedGen));
+    return newWithSeedGen(seedGen, parent->seed, alloc);
+}
+
 struct Random* Random_new(struct Allocator* alloc, struct Log* logger, struct Except* eh)
 {
     struct RandomSeed* rs = SystemRandomSeed_new(NULL, 0, logger, alloc);
@@ -26,6 +26,15 @@ Linker_require("crypto/random/Random.c")
 
 struct Random;
 
+/**
+ * Fill a buffer with random bytes.
+ * Requests which are larger than the internal buffer are generated in one pass directly into
+ * the location so filling nonces, keys and padding is best done with one call for all of it.
+ *
+ * @param rand the random generator.
+ * @param location the place to write the random bytes.
+ * @param count the number of bytes to write.
+ */
 void Random_bytes(struct Random* rand, uint8_t* location, uint64_t count);
 
 /**
@@ -108,4 +117,15 @@ struct Random* Random_newWithSeed(struct Allocator* alloc,
 
 struct Random* Random_new(struct Allocator* alloc, struct Log* logger, struct Except* eh);
 
+/**
+ * Create a new random generator which is seeded from the output of another.
+ * The new generator shares no state with the parent so one may be given to each thread which
+ * needs random numbers rather than locking around a shared generator.
+ * The parent is only used during this call which must be made on the parent's thread.
+ *
+ * @param parent the generator to take the seed from.
+ * @param alloc the allocator for the new generator.
+ */
+struct Random* Random_fork(struct Random* parent, struct Allocator* alloc);
+
 #endif
@@ -56,6 +56,7 @@ struct RandomSeed* BsdKernArndSysctlRandomSeed_new(struct Allocator* alloc)
 {
     return Allocator_clone(alloc, (&(struct RandomSeed) {
         .get = get,
-        .name = "sysctl(KERN_ARND) (BSD)"
+        .name = "sysctl(KERN_ARND) (BSD)",
+        .kernelPool = 1
     }));
 }
@@ -62,6 +62,7 @@ struct RandomSeed* DevUrandomRandomSeed_new(struct Allocator* alloc)
 {
     return Allocator_clone(alloc, (&(struct RandomSeed) {
         .get = get,
-        .name = "/dev/urandom"
+        .name = "/dev/urandom",
+        .kernelPool = 1
     }));
 }
@@ -0,0 +1,70 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE // CHECKFILES_IGNORE for syscall()
+#endif
+#include "crypto/random/seed/GetRandomRandomSeed.h"
+#include "util/Bits.h"
+
+#include <unistd.h>
+#include <errno.h>
+#ifdef linux
+    #include <sys/syscall.h>
+#endif
+
+/**
+ * Read the kernel's generator without opening any file, this works inside of a chroot and
+ * does not use a file descriptor. Blocks only until the kernel pool is first seeded.
+ */
+static int getRandom(uint8_t* output, int length)
+{
+#if defined(linux) && defined(SYS_getrandom)
+    while (length > 0) {
+        long ret = syscall(SYS_getrandom, output, length, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // ENOSYS when the kernel is older than 3.17.
+            return -1;
+        }
+        output += ret;
+        length -= ret;
+    }
+    return 0;
+#elif defined(__OpenBSD__)
+    return getentropy(output, length);
+#else
+    return -1;
+#endif
+}
+
+static int get(struct RandomSeed* randomSeed, uint64_t output[8])
+{
+    Bits_memset(output, 0, 64);
+    if (getRandom((uint8_t*) output, 64) || Bits_isZero(output, 64)) {
+        return -1;
+    }
+    return 0;
+}
+
+struct RandomSeed* GetRandomRandomSeed_new(struct Allocator* alloc)
+{
+    return Allocator_clone(alloc, (&(struct RandomSeed) {
+        .get = get,
+        .name = "getrandom() (Linux) / getentropy() (OpenBSD)",
+        .kernelPool = 1
+    }));
+}
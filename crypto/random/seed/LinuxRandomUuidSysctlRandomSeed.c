@@ -46,6 +46,7 @@ struct RandomSeed* LinuxRandomUuidSysctlRandomSeed_new(struct Allocator* alloc)
 {
     return Allocator_clone(alloc, (&(struct RandomSeed) {
         .get = get,
-        .name = "sysctl(RANDOM_UUID) (Linux)"
+        .name = "sysctl(RANDOM_UUID) (Linux)",
+        .kernelPool = 1
     }));
 }
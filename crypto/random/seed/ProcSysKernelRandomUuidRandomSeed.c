@@ -94,6 +94,7 @@ struct RandomSeed* ProcSysKernelRandomUuidRandomSeed_new(struct Allocator* alloc
 {
     return Allocator_clone(alloc, (&(struct RandomSeed) {
         .get = get,
-        .name = "/proc/sys/kernel/random/uuid (Linux)"
+        .name = "/proc/sys/kernel/random/uuid (Linux)",
+        .kernelPool = 1
     }));
 }
@@ -45,13 +45,20 @@ static int get(struct RandomSeed* rs, uint64_t buffer[8])
     struct RandomSeed_Buffer buff = { .output = {0} };
 
     int successCount = 0;
+    int haveKernelPool = 0;
     for (int i = 0; i < ctx->rsCount; i++) {
+        if (haveKernelPool && ctx->rsList[i]->kernelPool) {
+            Log_debug(ctx->logger, "Skipping random seed [%s], the kernel pool is already in",
+                      ctx->rsList[i]->name);
+            continue;
+        }
         if (!ctx->rsList[i]->get(ctx->rsList[i], buff.input)) {
             Log_info(ctx->logger, "Trying random seed [%s] Success", ctx->rsList[i]->name);
             crypto_hash_sha512((uint8_t*)buff.output,
                                (uint8_t*)&buff,
                                RandomSeed_Buffer_SIZE);
             successCount++;
+            haveKernelPool |= ctx->rsList[i]->kernelPool;
         } else {
             Log_info(ctx->logger, "Trying random seed [%s] Failed", ctx->rsList[i]->name);
         }
@@ -79,7 +86,7 @@ struct RandomSeed* RandomSeed_new(RandomSeed_Provider* providers,
                                   struct Log* logger,
                                   struct Allocator* alloc)
 {
-    struct RandomSeed** rsList = Allocator_calloc(alloc, sizeof(struct RandomSeed), providerCount);
+    struct RandomSeed** rsList = Allocator_calloc(alloc, sizeof(struct RandomSeed*), providerCount);
     int i = 0;
     for (int j = 0; j < providerCount; j++) {
         struct RandomSeed* rs = providers[j](alloc);
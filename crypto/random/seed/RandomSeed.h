@@ -40,6 +40,12 @@ struct RandomSeed
 
     /** A human friendly name for the random generator seed provider. */
     const char* name;
+
+    /**
+     * Nonzero if the provider reads the kernel's entropy pool, once one of these succeeds the
+     * rest are skipped because they would add nothing but syscalls to startup.
+     */
+    int kernelPool;
 };
 
 struct RandomSeed* RandomSeed_new(RandomSeed_Provider* providers,
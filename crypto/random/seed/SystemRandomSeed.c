@@ -16,6 +16,7 @@
 #include "util/log/Log.h"
 
 #include "crypto/random/seed/RandomSeedProvider.h"
+#include "crypto/random/seed/GetRandomRandomSeed.h"
 #include "crypto/random/seed/RtlGenRandomSeed.h"
 #include "crypto/random/seed/BsdKernArndSysctlRandomSeed.h"
 #include "crypto/random/seed/DevUrandomRandomSeed.h"
@@ -87,6 +87,38 @@ static void test179(struct Allocator* alloc, struct Log* logger)
     Assert_always(Bits_memcmp(buff, buff2, 32));
 }
 
+static void testFork(struct Random* rand, struct Allocator* alloc)
+{
+    struct Random* child = Random_fork(rand, alloc);
+    struct Random* child2 = Random_fork(rand, alloc);
+
+    uint8_t buff[32];
+    uint8_t buff2[32];
+    uint8_t buff3[32];
+    Random_bytes(rand, buff, 32);
+    Random_bytes(child, buff2, 32);
+    Random_bytes(child2, buff3, 32);
+
+    Assert_always(Bits_memcmp(buff, buff2, 32));
+    Assert_always(Bits_memcmp(buff, buff3, 32));
+    Assert_always(Bits_memcmp(buff2, buff3, 32));
+}
+
+/** Big requests skip the buffer, make sure they fill all of the buffer and nothing more. */
+static void testBulk(struct Random* rand)
+{
+    uint8_t buff[1024 + 16] = {0};
+    uint8_t buff2[1024 + 16] = {0};
+    Random_bytes(rand, &buff[8], 1024);
+    Random_bytes(rand, &buff2[8], 1024);
+    Assert_always(Bits_isZero(buff, 8) && Bits_isZero(&buff[1024 + 8], 8));
+    Assert_always(Bits_isZero(buff2, 8) && Bits_isZero(&buff2[1024 + 8], 8));
+    for (int i = 8; i < 1024 + 8; i += 32) {
+        Assert_always(!Bits_isZero(&buff[i], 32));
+        Assert_always(Bits_memcmp(&buff[i], &buff2[i], 32));
+    }
+}
+
 int main()
 {
     struct Allocator* alloc = MallocAllocator_new(1<<20);
@@ -123,6 +155,9 @@ int main()
 
     test179(alloc, logger);
 
+    testFork(rand, alloc);
+    testBulk(rand);
+
 
     /* torture
     uint8_t selections[2];
@@ -0,0 +1,56 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crypto/AddressCalc.h"
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+static void checkKey(uint8_t key[32], struct AddressCalc_Cache* cache)
+{
+    uint8_t ip6[16];
+    uint8_t cachedIp6[16];
+    bool valid = AddressCalc_addressForPublicKey(ip6, key);
+    Assert_always(AddressCalc_cachedAddressForPublicKey(cachedIp6, key, cache) == valid);
+    Assert_always(!Bits_memcmp(ip6, cachedIp6, 16));
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+    struct AddressCalc_Cache* cache =
+        Allocator_calloc(alloc, sizeof(struct AddressCalc_Cache), 1);
+
+    uint8_t keys[AddressCalc_CACHE_SIZE * 4][32];
+    Random_bytes(rand, (uint8_t*) keys, sizeof(keys));
+
+    // The all zero key must not be confused with an empty entry.
+    Bits_memset(keys[0], 0, 32);
+
+    // Keys which collide in the cache must not be confused with each other.
+    Bits_memcpyConst(keys[1], keys[2], 32);
+    keys[1][31] ^= 1;
+
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < AddressCalc_CACHE_SIZE * 4; i++) {
+            checkKey(keys[i], cache);
+            checkKey(keys[i], cache);
+        }
+    }
+
+    Allocator_free(alloc);
+    return 0;
+}
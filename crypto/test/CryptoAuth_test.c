@@ -17,6 +17,7 @@
 #define string_strlen
 #include "crypto/random/Random.h"
 #include "crypto/CryptoAuth.h"
+#include "crypto/CryptoAuth_pvt.h"
 #include "io/FileWriter.h"
 #include "benc/String.h"
 #include "memory/MallocAllocator.h"
@@ -68,12 +69,28 @@ static bool suppressMessages = false;
 static int if1Messages = 0;
 static int if2Messages = 0;
 
+/** If non-zero, the event loop is stopped when if2Messages reaches this. */
+static int if2EndLoopAt = 0;
+static struct EventBase* base;
+
+/** If true, messages to if2 must be sent in nonce order. */
+static bool checkNonceOrder = false;
+static uint32_t lastNonceToIf2 = 0;
+
+/** If non-null, messages to if2 are stored here instead of being delivered. */
+static struct Message** capturedMessages = NULL;
+static int capturedCount = 0;
+
 
 static uint8_t sendMessageToIf2(struct Message* message, struct Interface* iface)
 {
     uint32_t nonce = Endian_bigEndianToHost32(((uint32_t*)message->bytes)[0]);
     printf("sent message -->  nonce=%d%s\n", nonce, suppressMessages ? " SUPPRESSED" : "");
-    if (!suppressMessages) {
+    Assert_always(!checkNonceOrder || nonce == lastNonceToIf2 + 1);
+    lastNonceToIf2 = nonce;
+    if (capturedMessages) {
+        capturedMessages[capturedCount++] = Message_clone(message, iface->allocator);
+    } else if (!suppressMessages) {
         Assert_always(message->length + message->padding <= BUFFER_SIZE);
         if2->receiveMessage(message, if2);
     }
@@ -108,6 +125,9 @@ static uint8_t recvMessageOnIf2(struct Message* message, struct Interface* iface
     fwrite(message->bytes, 1, message->length, stdout);
     puts("");
     if2Msg = Message_clone(message, iface->allocator)->bytes;
+    if (if2EndLoopAt && if2Messages == if2EndLoopAt) {
+        EventBase_endLoop(base);
+    }
     return Error_NONE;
 }
 
@@ -122,7 +142,7 @@ static int init(const uint8_t* privateKey,
     struct Log* logger = WriterLog_new(logwriter, allocator);
     struct Random* rand = Random_new(allocator, logger, NULL);
 
-    struct EventBase* base = EventBase_new(allocator);
+    base = EventBase_new(allocator);
 
     ca1 = CryptoAuth_new(allocator, NULL, base, logger, rand);
     if1 = Allocator_clone(allocator, (&(struct Interface) {
@@ -250,6 +270,57 @@ static int auth()
       | sendToIf1("goodbye");
 }
 
+static int authManyUsers()
+{
+    init(privateKey, publicKey, (uint8_t*)"password");
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    for (int i = 0; i < 600; i++) {
+        String* str = String_printf(alloc, "user%d", i);
+        Assert_always(!CryptoAuth_addUser(str, 1, str, ca2));
+    }
+    // Same password as another user and same user as another password.
+    Assert_always(CryptoAuth_addUser(String_CONST("user300"), 1, String_CONST("other"), ca2)
+        == CryptoAuth_addUser_DUPLICATE);
+    Assert_always(CryptoAuth_addUser(String_CONST("other"), 1, String_CONST("user599"), ca2)
+        == CryptoAuth_addUser_DUPLICATE);
+    Assert_always(CryptoAuth_removeUsers(ca2, String_CONST("user0")) == 1);
+    int ret = sendToIf2("hello world")
+      | sendToIf1("hello cjdns")
+      | sendToIf2("hai")
+      | sendToIf1("goodbye");
+    Assert_always(String_equals(CryptoAuth_getUser(cif2), String_CONST(userObj)));
+    Allocator_free(alloc);
+    return ret;
+}
+
+static int replaceUsers()
+{
+    init(privateKey, publicKey, (uint8_t*)"password");
+    int ret = sendToIf2("hello world")
+      | sendToIf1("hello cjdns");
+    Assert_always(String_equals(CryptoAuth_getUser(cif2), String_CONST(userObj)));
+
+    struct CryptoAuth_User users[] = {
+        { .password = String_CONST("other"), .authType = 1, .user = String_CONST("other") },
+        { .password = String_CONST("password"), .authType = 1, .user = String_CONST(userObj) },
+        { .password = String_CONST("other"), .authType = 1, .user = String_CONST("dupe") }
+    };
+    uint32_t failed = 0;
+    Assert_always(CryptoAuth_setUsers(users, 3, &failed, ca2) == CryptoAuth_addUser_DUPLICATE);
+    Assert_always(failed == 2);
+    Assert_always(String_equals(CryptoAuth_getUser(cif2), String_CONST(userObj)));
+
+    // Still authorized with the same password so the session keeps its user.
+    Assert_always(!CryptoAuth_setUsers(users, 2, NULL, ca2));
+    Assert_always(String_equals(CryptoAuth_getUser(cif2), String_CONST(userObj)));
+    ret |= sendToIf2("hai")
+      | sendToIf1("goodbye");
+
+    Assert_always(!CryptoAuth_setUsers(users, 1, NULL, ca2));
+    Assert_always(!CryptoAuth_getUser(cif2));
+    return ret;
+}
+
 static int authWithoutKey()
 {
     init(NULL, NULL, (uint8_t*)"password");
@@ -326,6 +397,211 @@ static void connectToMeDropMsg()
     sendToIf1("goodbye");
 }
 
+/** Every message sent before the key is known is delivered once it is, up to the limit. */
+static void connectToMeBufferMany()
+{
+    simpleInit();
+    ca2->maxBufferedMessages = 2;
+    suppressMessages = true;
+    sendToIf1("expelled");
+    sendToIf1("buffered one");
+    sendToIf1("buffered two");
+    suppressMessages = false;
+
+    uint8_t* pk = CryptoAuth_getHerPublicKey(cif2);
+    Bits_memcpyConst(pk, ca1->publicKey, 32);
+
+    int before = if1Messages;
+    sendToIf1("hello again world");
+    Assert_always(if1Messages == before + 3);
+    sendToIf2("hai");
+    sendToIf1("goodbye");
+}
+
+static void batch()
+{
+    simpleInit();
+    sendToIf2("hello world");
+    sendToIf1("hello cjdns");
+    sendToIf2("hai");
+
+    struct Message* captured[6];
+    capturedMessages = captured;
+    capturedCount = 0;
+    const char* texts[] = { "one", "two", "three", "four" };
+    for (int i = 0; i < 4; i++) {
+        MK_MSG(texts[i]);
+        cif1->sendMessage(&msg, cif1);
+    }
+    capturedMessages = NULL;
+    Assert_always(capturedCount == 4);
+
+    // A replay of the first message and a forgery of the second one, both must be dropped.
+    captured[4] = Message_clone(captured[0], if2->allocator);
+    captured[5] = Message_clone(captured[1], if2->allocator);
+    captured[5]->bytes[captured[5]->length - 1] ^= 1;
+    struct Message* batch[6] = {
+        captured[0], captured[4], captured[1], captured[2], captured[5], captured[3]
+    };
+
+    int before = if2Messages;
+    CryptoAuth_receiveBatch(batch, 6, if2);
+    Assert_always(if2Messages == before + 4);
+    Assert_always(!strncmp((char*)if2Msg, "four", 4));
+
+    // Handshake messages go through the normal path.
+    simpleInit();
+    capturedMessages = captured;
+    capturedCount = 0;
+    MK_MSG("hello world");
+    cif1->sendMessage(&msg, cif1);
+    capturedMessages = NULL;
+    before = if2Messages;
+    CryptoAuth_receiveBatch(captured, 1, if2);
+    Assert_always(if2Messages == before + 1);
+    Assert_always(!strncmp((char*)if2Msg, "hello world", 11));
+}
+
+static void rekey()
+{
+    simpleInit();
+    sendToIf2("hello world");
+    sendToIf1("hello cjdns");
+    sendToIf2("hai");
+    sendToIf1("goodbye");
+
+    // A packet which is still on the wire when the other end rekeys.
+    struct Message* captured[1];
+    capturedMessages = captured;
+    capturedCount = 0;
+    MK_MSG("in flight");
+    cif1->sendMessage(&msg, cif1);
+    capturedMessages = NULL;
+    Assert_always(capturedCount == 1);
+    struct Message* replay = Message_clone(captured[0], if2->allocator);
+
+    // The nonce is about to wrap so cif2 rekeys, the hello also resets cif1.
+    ((struct CryptoAuth_Wrapper*) cif2->senderContext)->nextNonce = 0xfffffff0;
+    sendToIf1("rekey");
+    Assert_always(CryptoAuth_getState(cif2) != CryptoAuth_ESTABLISHED);
+
+    int before = if2Messages;
+    if2->receiveMessage(captured[0], if2);
+    Assert_always(if2Messages == before + 1);
+    Assert_always(!strncmp((char*)if2Msg, "in flight", 9));
+
+    // It is still a replay.
+    if2->receiveMessage(replay, if2);
+    Assert_always(if2Messages == before + 1);
+
+    sendToIf2("new session");
+    sendToIf1("established");
+    sendToIf2("again");
+    Assert_always(CryptoAuth_getState(cif1) == CryptoAuth_ESTABLISHED);
+    Assert_always(CryptoAuth_getState(cif2) == CryptoAuth_ESTABLISHED);
+}
+
+static void stats()
+{
+    simpleInit();
+    sendToIf2("hello world");
+    sendToIf1("hello cjdns");
+    sendToIf2("hai");
+    sendToIf1("goodbye");
+
+    struct CryptoAuth_Stats* stats1 = CryptoAuth_getStats(cif1);
+    struct CryptoAuth_Stats* stats2 = CryptoAuth_getStats(cif2);
+    Assert_always(stats1->packetsOut == 2 && stats2->packetsIn == 2);
+    Assert_always(stats1->bytesOut == 14 && stats2->bytesIn == 14);
+    Assert_always(stats2->packetsOut == 2 && stats1->packetsIn == 2);
+    Assert_always(stats2->bytesOut == 18 && stats1->bytesIn == 18);
+    Assert_always(!stats1->decryptFailures && !stats2->decryptFailures);
+
+    struct Message* captured[1];
+    capturedMessages = captured;
+    capturedCount = 0;
+    MK_MSG("twice");
+    cif1->sendMessage(&msg, cif1);
+    capturedMessages = NULL;
+    struct Message* replay = Message_clone(captured[0], if2->allocator);
+    if2->receiveMessage(captured[0], if2);
+    if2->receiveMessage(replay, if2);
+    Assert_always(stats2->packetsIn == 3 && stats2->decryptFailures == 1);
+}
+
+static void asyncEncryption()
+{
+    simpleInit();
+    sendToIf2("hello world");
+    sendToIf1("hello cjdns");
+    sendToIf2("hai");
+
+    ca1->asyncEncryption = true;
+    const char* texts[] = { "one", "two", "three", "four", "five", "six", "seven", "eight" };
+    int before = if2Messages;
+    for (int i = 0; i < 8; i++) {
+        MK_MSG(texts[i]);
+        cif1->sendMessage(&msg, cif1);
+        // The caller's buffer may be reused as soon as sendMessage() returns.
+        Bits_memset(textBuff, 0, BUFFER_SIZE);
+    }
+    Assert_always(if2Messages == before);
+
+    checkNonceOrder = true;
+    if2EndLoopAt = before + 8;
+    EventBase_beginLoop(base);
+    if2EndLoopAt = 0;
+    Assert_always(if2Messages == before + 8);
+    Assert_always(!strncmp((char*)if2Msg, "eight", 5));
+
+    ca1->asyncEncryption = false;
+    sendToIf2("nine");
+    checkNonceOrder = false;
+}
+
+static void asyncDecryption()
+{
+    simpleInit();
+    sendToIf2("hello world");
+    sendToIf1("hello cjdns");
+    sendToIf2("hai");
+
+    const char* texts[] = { "one", "two", "three", "four", "five", "six", "seven", "eight" };
+    struct Message* captured[8];
+    capturedMessages = captured;
+    capturedCount = 0;
+    for (int i = 0; i < 8; i++) {
+        MK_MSG(texts[i]);
+        cif1->sendMessage(&msg, cif1);
+    }
+    capturedMessages = NULL;
+    struct Message* replay = Message_clone(captured[0], if2->allocator);
+
+    ca2->asyncDecryption = true;
+    struct CryptoAuth_Stats* stats2 = CryptoAuth_getStats(cif2);
+    int before = if2Messages;
+    for (int i = 0; i < 4; i++) {
+        if2->receiveMessage(captured[i], if2);
+        // The caller's buffer may be reused as soon as receiveMessage() returns.
+        Bits_memset(captured[i]->bytes, 0, captured[i]->length);
+    }
+    if2->receiveMessage(replay, if2);
+
+    // With jobs still pending, a batch must queue behind them rather than overtake them.
+    ca2->asyncDecryption = false;
+    CryptoAuth_receiveBatch(&captured[4], 4, if2);
+    Assert_always(if2Messages == before);
+
+    if2EndLoopAt = before + 8;
+    EventBase_beginLoop(base);
+    if2EndLoopAt = 0;
+    Assert_always(if2Messages == before + 8);
+    Assert_always(!strncmp((char*)if2Msg, "eight", 5));
+    Assert_always(stats2->decryptFailures == 1);
+
+    sendToIf2("nine");
+}
+
 int main()
 {
     normal();
@@ -334,11 +610,19 @@ int main()
     chatter();
     auth();
     authWithoutKey();
+    authManyUsers();
+    replaceUsers();
     poly1305();
     poly1305UnknownKey();
     poly1305AndPassword();
     poly1305UnknownKeyAndPassword();
     connectToMe();
     connectToMeDropMsg();
+    connectToMeBufferMany();
+    batch();
+    rekey();
+    stats();
+    asyncEncryption();
+    asyncDecryption();
     return 0;
 }
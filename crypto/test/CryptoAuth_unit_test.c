@@ -106,7 +106,7 @@ static struct CryptoAuth_Wrapper* setUp(uint8_t* myPrivateKey,
                                         uint8_t* authPassword,
                                         struct Message** resultMessage)
 {
-    struct Allocator* allocator = MallocAllocator_new(8192*2);
+    struct Allocator* allocator = MallocAllocator_new(8192*4);
     struct Writer* writer = FileWriter_new(stdout, allocator);
     struct Log* logger = WriterLog_new(writer, allocator);
     struct CryptoAuth* ca =
@@ -222,6 +222,50 @@ static void receiveHelloWithNoAuth()
     //printf("bytes=%s  length=%u\n", finalOut->bytes, finalOut->length);
 }
 
+static void handshakeFlood()
+{
+    uint8_t* messageHex = (uint8_t*)
+        "0000000000ffffffffffffff7fffffffffffffffffffffffffffffffffffffff"
+        "ffffffffffffffff847c0d2c375234f365e660955187a3735a0f7613d1609d3a"
+        "6a4d8c53aeaa5a22ea9cf275eee0185edf7f211192f12e8e642a325ed76925fe"
+        "3c76d313b767a10aca584ca0b979dee990a737da7d68366fa3846d43d541de91"
+        "29ea3e12";
+    uint8_t message[132];
+    Assert_always(Hex_decode(message, 132, messageHex, strlen((char*)messageHex)) > 0);
+
+    struct CryptoAuth_Wrapper* wrapper = setUp(privateKey, NULL, NULL, NULL);
+    struct Message* finalOut = NULL;
+    wrapper->externalInterface.receiveMessage = receiveMessage;
+    wrapper->externalInterface.receiverContext = &finalOut;
+
+    // The clock is not running so the budget will not refill.
+    wrapper->context->pub.handshakesPerSecond = 1;
+    wrapper->context->handshakeTokens = 0;
+
+    // Out of budget, dropped before doing any curve25519.
+    uint8_t buff[132];
+    Bits_memcpyConst(buff, message, 132);
+    struct Message incoming = { .length = 132, .padding = 0, .bytes = buff };
+    Assert_always(Error_FLOOD ==
+        CryptoAuth_receiveMessage(&incoming, &(struct Interface) { .receiverContext = wrapper }));
+    Assert_always(!finalOut);
+
+    wrapper->context->handshakeTokens = 1;
+    Bits_memcpyConst(buff, message, 132);
+    incoming = (struct Message) { .length = 132, .padding = 0, .bytes = buff };
+    CryptoAuth_receiveMessage(&incoming, &(struct Interface) { .receiverContext = wrapper });
+    Assert_always(finalOut && finalOut->length == 12);
+    Assert_always(!wrapper->context->handshakeTokens);
+
+    // Her key is now cached so a repeat of the hello from a new session costs nothing.
+    finalOut = NULL;
+    CryptoAuth_reset(&(struct Interface) { .senderContext = wrapper });
+    Bits_memcpyConst(buff, message, 132);
+    incoming = (struct Message) { .length = 132, .padding = 0, .bytes = buff };
+    CryptoAuth_receiveMessage(&incoming, &(struct Interface) { .receiverContext = wrapper });
+    Assert_always(finalOut && finalOut->length == 12);
+}
+
 static void repeatHello()
 {
     struct Allocator* allocator = MallocAllocator_new(1<<20);
@@ -285,6 +329,43 @@ static void repeatHello()
     Allocator_free(allocator);
 }
 
+static void secretCache()
+{
+    struct Message* outMessage;
+    struct CryptoAuth_Wrapper* wrapper =
+        setUp(NULL, (uint8_t*) "wxyzabcdefghijklmnopqrstuv987654", NULL, &outMessage);
+    struct CryptoAuth_pvt* ctx = wrapper->context;
+
+    // Two hellos from a reset session, the second one must use the cached key.
+    uint8_t msgBuff[Headers_CryptoAuth_SIZE + 12];
+    for (int i = 0; i < 2; i++) {
+        struct Message msg = {
+            .length = 12,
+            .padding = Headers_CryptoAuth_SIZE,
+            .bytes = msgBuff + Headers_CryptoAuth_SIZE
+        };
+        Bits_memcpyConst(msg.bytes, hello, 12);
+        wrapper->nextNonce = 0;
+        CryptoAuth_encryptHandshake(&msg, wrapper, 0);
+        Assert_always(outMessage->length == Headers_CryptoAuth_SIZE + 12);
+    }
+
+    int used = 0;
+    for (int i = 0; i < CryptoAuth_SECRET_CACHE_SIZE; i++) {
+        if (!Bits_isZero(ctx->secretCache[i].herPublicKey, 32)) {
+            used++;
+            Assert_always(!Bits_memcmp(ctx->secretCache[i].herPublicKey,
+                                       wrapper->herPerminentPubKey,
+                                       32));
+        }
+    }
+    Assert_always(used == 1);
+    Assert_always(ctx->secretCacheClock == 2);
+
+    CryptoAuth_removeUsers(&ctx->pub, NULL);
+    Assert_always(Bits_isZero(ctx->secretCache, sizeof(ctx->secretCache)));
+}
+
 static void testGetUsers()
 {
     struct Allocator* allocator = MallocAllocator_new(1<<20);
@@ -319,9 +400,11 @@ int main()
     helloNoAuth();
     helloWithAuth();
     receiveHelloWithNoAuth();
+    handshakeFlood();
     encryptRndNonceTest();
     createNew();
     repeatHello();
+    secretCache();
     Allocator_free(allocator);
     return 0;
 }
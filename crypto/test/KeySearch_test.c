@@ -0,0 +1,70 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crypto/AddressCalc.h"
+#include "crypto/KeySearch.h"
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#include "crypto_scalarmult_curve25519.h"
+
+static void progress(uint64_t keysTried, uint64_t milliseconds, void* vCount)
+{
+    uint64_t* lastCount = vCount;
+    Assert_always(keysTried >= *lastCount);
+    *lastCount = keysTried;
+}
+
+static void checkKey(struct KeySearch_Key* key, uint8_t* prefix, int prefixBits)
+{
+    uint8_t publicKey[32];
+    crypto_scalarmult_curve25519_base(publicKey, key->privateKey);
+    Assert_always(!Bits_memcmp(publicKey, key->publicKey, 32));
+
+    uint8_t ip6[16];
+    Assert_always(AddressCalc_addressForPublicKey(ip6, publicKey));
+    Assert_always(!Bits_memcmp(ip6, key->ip6, 16));
+    Assert_always(!Bits_memcmp(ip6, prefix, prefixBits / 8));
+    if (prefixBits % 8) {
+        uint8_t mask = 0xff << (8 - prefixBits % 8);
+        Assert_always(!((ip6[prefixBits / 8] ^ prefix[prefixBits / 8]) & mask));
+    }
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+    struct KeySearch_Key key;
+
+    uint8_t prefix[16] = { 0xfc, 0x50 };
+    uint64_t keysTried = 0;
+    Assert_always(!KeySearch_find(&key, prefix, 12, 3, progress, &keysTried, rand, alloc));
+    Assert_always(keysTried > 0);
+    checkKey(&key, prefix, 12);
+
+    // One thread per CPU and no progress callback.
+    Assert_always(!KeySearch_find(&key, prefix, 8, 0, NULL, NULL, rand, alloc));
+    checkKey(&key, prefix, 8);
+
+    // Every address begins with fc.
+    uint8_t badPrefix[16] = { 0xfd };
+    Assert_always(KeySearch_find(&key, badPrefix, 8, 1, NULL, NULL, rand, alloc));
+    Assert_always(KeySearch_find(&key, prefix, 4, 1, NULL, NULL, rand, alloc));
+
+    Allocator_free(alloc);
+    return 0;
+}
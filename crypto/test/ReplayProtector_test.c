@@ -26,7 +26,7 @@ static void testDuplicates(struct Random* rand)
 {
     uint16_t randomShorts[8192];
     uint16_t out[8192];
-    struct ReplayProtector rp = {.bitfield = 0};
+    struct ReplayProtector rp = { .baseOffset = 0 };
 
     Random_bytes(rand, (uint8_t*)randomShorts, sizeof(randomShorts));
 
@@ -45,6 +45,36 @@ static void testDuplicates(struct Random* rand)
     }
 }
 
+static void testReorder()
+{
+    struct ReplayProtector rp = { .baseOffset = 0 };
+
+    // A whole window arriving backwards is all accepted once.
+    for (int i = ReplayProtector_WINDOW_BITS - 1; i >= 0; i--) {
+        Assert_always(ReplayProtector_checkNonce(i, &rp));
+    }
+    for (int i = 0; i < ReplayProtector_WINDOW_BITS; i++) {
+        Assert_always(!ReplayProtector_checkNonce(i, &rp));
+    }
+    Assert_always(rp.duplicates == ReplayProtector_WINDOW_BITS);
+    Assert_always(!rp.lostPackets && !rp.receivedOutOfRange);
+
+    // Everything was seen so moving forward a little loses nothing.
+    Assert_always(ReplayProtector_checkNonce(ReplayProtector_WINDOW_BITS + 40, &rp));
+    Assert_always(!rp.lostPackets);
+    Assert_always(ReplayProtector_checkNonce(ReplayProtector_WINDOW_BITS, &rp));
+
+    // A long jump forward counts all of the nonces which were skipped, bar the 2 which were seen.
+    uint32_t jump = ReplayProtector_WINDOW_BITS * 10;
+    Assert_always(ReplayProtector_checkNonce(jump, &rp));
+    Assert_always(rp.baseOffset == jump - (ReplayProtector_WINDOW_BITS - 17));
+    Assert_always(rp.lostPackets == rp.baseOffset - ReplayProtector_WINDOW_BITS - 2);
+    Assert_always(!ReplayProtector_checkNonce(rp.baseOffset - 1, &rp));
+    Assert_always(rp.receivedOutOfRange == 1);
+    Assert_always(ReplayProtector_checkNonce(rp.baseOffset, &rp));
+    Assert_always(!ReplayProtector_checkNonce(jump, &rp));
+}
+
 int main()
 {
     struct Allocator* alloc = MallocAllocator_new(4096);
@@ -52,5 +82,6 @@ int main()
     for (int i = 0; i < CYCLES; i++) {
         testDuplicates(rand);
     }
+    testReorder();
     return 0;
 }
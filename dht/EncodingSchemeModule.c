@@ -19,12 +19,16 @@
 #include "dht/DHTModule.h"
 #include "dht/DHTModuleRegistry.h"
 #include "benc/String.h"
+#include "util/Bits.h"
 #include "util/Identity.h"
+#include "util/events/Timeout.h"
 #include "switch/NumberCompress.h"
 #include "switch/EncodingScheme.h"
 #include "util/version/Version.h"
 #include "dht/dhtcore/NodeStore.h"
 
+#include <stdbool.h>
+
 /**
  * The encoding scheme module tags each message with our encoding scheme
  * representation as well as the number of the smallest encoding form which
@@ -34,8 +38,27 @@
  * the node sending the message and if the node is pre-version-6, it converts
  * the query responses from the pre-version-6 representation to the version-6
  * representation.
+ *
+ * The nodes which are heard from during one turn of the event loop are given to NodeStore
+ * together so it can share the work of placing them in the graph.
  */
 
+/** Most discoveries which are held for one batch. */
+#define MAX_PENDING 64
+
+/**
+ * Most distinct schemes which are kept, nearly every node uses one of a few so this is only
+ * reached by nodes which make up schemes, theirs are parsed each time as before.
+ */
+#define MAX_SCHEMES 32
+
+/** A scheme which has been heard and the form it was heard in. */
+struct KnownScheme
+{
+    String* definition;
+    struct EncodingScheme* scheme;
+};
+
 struct EncodingSchemeModule_pvt
 {
     struct DHTModule module;
@@ -48,9 +71,99 @@ struct EncodingSchemeModule_pvt
 
     struct Log* logger;
 
+    /** Schemes of other nodes, by the definition they send, so nodes share them. */
+    struct KnownScheme known[MAX_SCHEMES];
+    int knownCount;
+
+    struct EventBase* base;
+
+    struct Allocator* alloc;
+
+    /**
+     * The nodes heard from in this turn of the loop, schemes which are not in known are
+     * copied to pendingAlloc.
+     */
+    struct NodeStore_Discovery pending[MAX_PENDING];
+    int pendingCount;
+    struct Allocator* pendingAlloc;
+
+    /** Fires at the end of the loop turn, created the first time it is needed. */
+    struct Timeout* flushTimeout;
+
     Identity
 };
 
+static void flushPending(void* vcontext)
+{
+    struct EncodingSchemeModule_pvt* ctx =
+        Identity_cast((struct EncodingSchemeModule_pvt*) vcontext);
+    if (!ctx->pendingCount) {
+        return;
+    }
+    NodeStore_discoverNodes(ctx->ns, ctx->pending, ctx->pendingCount);
+    ctx->pendingCount = 0;
+    Allocator_free(ctx->pendingAlloc);
+    ctx->pendingAlloc = NULL;
+}
+
+static void discoverLater(struct Address* addr,
+                          uint32_t version,
+                          struct EncodingScheme* scheme,
+                          int encodingFormNumber,
+                          bool interned,
+                          struct EncodingSchemeModule_pvt* ctx)
+{
+    if (ctx->pendingCount == MAX_PENDING) {
+        flushPending(ctx);
+    }
+    if (!ctx->pendingAlloc) {
+        ctx->pendingAlloc = Allocator_child(ctx->alloc);
+        if (ctx->flushTimeout) {
+            Timeout_resetTimeout(ctx->flushTimeout, 0);
+        } else {
+            ctx->flushTimeout = Timeout_setTimeout(flushPending, ctx, 0, ctx->base, ctx->alloc);
+        }
+    }
+    struct NodeStore_Discovery* d = &ctx->pending[ctx->pendingCount++];
+    Bits_memcpyConst(&d->addr, addr, sizeof(struct Address));
+    d->reachDiff = 2;
+    d->version = version;
+    d->scheme = (interned) ? scheme : EncodingScheme_clone(scheme, ctx->pendingAlloc);
+    d->encodingFormNumber = encodingFormNumber;
+}
+
+/**
+ * Get the scheme for a definition, parsing it only the first time it is heard.
+ *
+ * @param definition the serialized scheme which the node sent.
+ * @param interned set true if the scheme is kept by the module, otherwise it is in tempAlloc.
+ * @param tempAlloc where to put the scheme if the table of known schemes is full.
+ * @param ctx the module.
+ * @return the scheme or NULL if it could not be parsed.
+ */
+static struct EncodingScheme* internScheme(String* definition,
+                                           bool* interned,
+                                           struct Allocator* tempAlloc,
+                                           struct EncodingSchemeModule_pvt* ctx)
+{
+    for (int i = 0; i < ctx->knownCount; i++) {
+        if (String_equals(definition, ctx->known[i].definition)) {
+            *interned = true;
+            return ctx->known[i].scheme;
+        }
+    }
+    *interned = (ctx->knownCount < MAX_SCHEMES);
+    struct Allocator* alloc = (*interned) ? ctx->alloc : tempAlloc;
+    struct EncodingScheme* scheme = EncodingScheme_deserialize(definition, alloc);
+    if (!scheme || !*interned) {
+        return scheme;
+    }
+    struct KnownScheme* known = &ctx->known[ctx->knownCount++];
+    known->definition = String_clone(definition, ctx->alloc);
+    known->scheme = scheme;
+    return scheme;
+}
+
 static int handleIncoming(struct DHTMessage* message, void* vcontext)
 {
     struct EncodingSchemeModule_pvt* ctx =
@@ -60,8 +173,9 @@ static int handleIncoming(struct DHTMessage* message, void* vcontext)
     if (!schemeDefinition) {
         return 0;
     }
+    bool interned;
     struct EncodingScheme* scheme =
-        EncodingScheme_deserialize(schemeDefinition, message->allocator);
+        internScheme(schemeDefinition, &interned, message->allocator, ctx);
     if (!scheme) {
         Log_debug(ctx->logger, "Failed to parse encoding scheme");
         return -1;
@@ -79,7 +193,7 @@ static int handleIncoming(struct DHTMessage* message, void* vcontext)
         return -1;
     }
 
-    NodeStore_discoverNode(ctx->ns, message->address, 2, *version, scheme, *encIdx);
+    discoverLater(message->address, *version, scheme, *encIdx, interned, ctx);
 
     return 0;
 }
@@ -105,6 +219,7 @@ static int handleOutgoing(struct DHTMessage* dmesg, void* vcontext)
 void EncodingSchemeModule_register(struct DHTModuleRegistry* reg,
                                    struct NodeStore* ns,
                                    struct Log* logger,
+                                   struct EventBase* base,
                                    struct Allocator* alloc)
 {
     struct EncodingScheme* scheme = NumberCompress_defineScheme(alloc);
@@ -118,6 +233,8 @@ void EncodingSchemeModule_register(struct DHTModuleRegistry* reg,
                 .handleOutgoing = handleOutgoing
             },
             .logger = logger,
+            .base = base,
+            .alloc = alloc,
             .scheme = scheme,
             .schemeDefinition = schemeDefinition,
             .ns = ns
@@ -125,5 +242,10 @@ void EncodingSchemeModule_register(struct DHTModuleRegistry* reg,
     Identity_set(ctx);
     ctx->module.context = ctx;
 
+    // Most nodes use the same scheme as us.
+    ctx->known[0].definition = schemeDefinition;
+    ctx->known[0].scheme = scheme;
+    ctx->knownCount = 1;
+
     DHTModuleRegistry_register(&ctx->module, reg);
 }
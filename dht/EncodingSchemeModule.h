@@ -18,6 +18,7 @@
 #include "dht/DHTModuleRegistry.h"
 #include "memory/Allocator.h"
 #include "dht/dhtcore/NodeStore.h"
+#include "util/events/EventBase.h"
 #include "util/log/Log.h"
 #include "util/Linker.h"
 Linker_require("dht/EncodingSchemeModule.c")
@@ -25,6 +26,7 @@ Linker_require("dht/EncodingSchemeModule.c")
 void EncodingSchemeModule_register(struct DHTModuleRegistry* reg,
                                    struct NodeStore* ns,
                                    struct Log* logger,
+                                   struct EventBase* base,
                                    struct Allocator* alloc);
 
 #endif
@@ -13,6 +13,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "benc/Object.h"
+#include "benc/Dict.h"
 #include "dht/DHTMessage.h"
 #include "dht/DHTModule.h"
 #include "dht/DHTModuleRegistry.h"
@@ -81,6 +82,181 @@ static int handleOutgoing(struct DHTMessage* message,
     return 0;
 }
 
+/** A dictionary entry with its key and value so that a whole message needs one allocation. */
+struct FlatEntry
+{
+    struct Dict_Entry entry;
+    String key;
+    Object val;
+    String string;
+};
+
+/** Longest string length which will be read, nothing in a DHT message is this big. */
+#define FLAT_MAX_LENGTH_DIGITS 4
+
+/** Longest integer which will be read, anything bigger goes to the full parser. */
+#define FLAT_MAX_INT_DIGITS 18
+
+/**
+ * Read the header of a benc string "<length>:".
+ *
+ * @return the index of the first byte of content or -1 if it is not a string.
+ */
+static inline int flatStringLength(const char* bytes, int index, int limit, int* lengthOut)
+{
+    int start = index;
+    int length = 0;
+    for (; index < limit && bytes[index] >= '0' && bytes[index] <= '9'; index++) {
+        if (index - start >= FLAT_MAX_LENGTH_DIGITS) {
+            return -1;
+        }
+        length = length * 10 + (bytes[index] - '0');
+    }
+    if (index == start || index >= limit || bytes[index] != ':') {
+        return -1;
+    }
+    index++;
+    if (length > limit - index) {
+        return -1;
+    }
+    *lengthOut = length;
+    return index;
+}
+
+/**
+ * Read a benc integer "i<number>e".
+ *
+ * @return the index after the integer or -1 if it is not an integer.
+ */
+static inline int flatInt(const char* bytes, int index, int limit, int64_t* numberOut)
+{
+    if (index >= limit || bytes[index++] != 'i') {
+        return -1;
+    }
+    int negative = (index < limit && bytes[index] == '-');
+    index += negative;
+    int start = index;
+    int64_t number = 0;
+    for (; index < limit && bytes[index] >= '0' && bytes[index] <= '9'; index++) {
+        if (index - start >= FLAT_MAX_INT_DIGITS) {
+            return -1;
+        }
+        number = number * 10 + (bytes[index] - '0');
+    }
+    if (index == start || index >= limit || bytes[index] != 'e') {
+        return -1;
+    }
+    *numberOut = (negative) ? -number : number;
+    return index + 1;
+}
+
+/**
+ * Walk a dictionary containing only strings and integers, which covers all of the common DHT
+ * queries and replies. When entries is NULL this only measures the dictionary.
+ *
+ * @param bytes the message.
+ * @param limit the number of bytes which may be read.
+ * @param entries if non-NULL, filled in with the entries.
+ * @param space if non-NULL, where the content of the keys and strings is copied.
+ * @param entryCount set to the number of entries.
+ * @param spaceNeeded set to the number of bytes of space needed, including null terminators.
+ * @return 0 if parsed or -1 if the message needs the full parser.
+ */
+static int flatWalk(const char* bytes,
+                    int limit,
+                    struct FlatEntry* entries,
+                    char* space,
+                    int* entryCount,
+                    int* spaceNeeded)
+{
+    int index = 0;
+    int count = 0;
+    int used = 0;
+    if (limit < 2 || bytes[index++] != 'd') {
+        return -1;
+    }
+    while (index < limit && bytes[index] != 'e') {
+        struct FlatEntry* e = (entries) ? &entries[count] : NULL;
+
+        int length;
+        if ((index = flatStringLength(bytes, index, limit, &length)) < 0) {
+            return -1;
+        }
+        if (e) {
+            Bits_memcpy(&space[used], &bytes[index], length);
+            space[used + length] = '\0';
+            e->key = (String) { .len = length, .bytes = &space[used] };
+        }
+        used += length + 1;
+        index += length;
+
+        if (index < limit && bytes[index] == 'i') {
+            int64_t number;
+            if ((index = flatInt(bytes, index, limit, &number)) < 0) {
+                return -1;
+            }
+            if (e) {
+                e->val = (Object) { .type = Object_INTEGER, .as.number = number };
+            }
+        } else {
+            // Lists and dictionaries are left to the full parser.
+            if ((index = flatStringLength(bytes, index, limit, &length)) < 0) {
+                return -1;
+            }
+            if (e) {
+                Bits_memcpy(&space[used], &bytes[index], length);
+                space[used + length] = '\0';
+                e->string = (String) { .len = length, .bytes = &space[used] };
+                e->val = (Object) { .type = Object_STRING, .as.string = &e->string };
+            }
+            used += length + 1;
+            index += length;
+        }
+
+        if (e) {
+            // Same order as StandardBencSerializer, the last entry is the head of the list.
+            e->entry = (struct Dict_Entry) {
+                .next = (count > 0) ? &entries[count - 1].entry : NULL,
+                .key = &e->key,
+                .val = &e->val
+            };
+        }
+        count++;
+    }
+    if (index >= limit) {
+        return -1;
+    }
+    *entryCount = count;
+    *spaceNeeded = used;
+    return 0;
+}
+
+/**
+ * Parse a message with only strings and integers into a dictionary using a single allocation
+ * rather than several for every entry.
+ *
+ * @return 0 if parsed or -1 if the message needs the full parser.
+ */
+static int parseFlat(struct DHTMessage* message)
+{
+    int limit = (message->length) ? message->length : DHTMessage_MAX_SIZE;
+    int count;
+    int spaceNeeded;
+    if (flatWalk(message->bytes, limit, NULL, NULL, &count, &spaceNeeded)) {
+        return -1;
+    }
+
+    size_t entriesSize = sizeof(struct FlatEntry) * count;
+    char* block = Allocator_malloc(message->allocator, entriesSize + sizeof(Dict) + spaceNeeded);
+    struct FlatEntry* entries = (struct FlatEntry*) block;
+    message->asDict = (Dict*) &block[entriesSize];
+
+    char* space = &block[entriesSize + sizeof(Dict)];
+    flatWalk(message->bytes, limit, entries, space, &count, &spaceNeeded);
+    *message->asDict = (count > 0) ? &entries[count - 1].entry : NULL;
+    return 0;
+}
+
 /**
  * Take an incoming message and deserialize the bencoded message.
  *
@@ -89,6 +265,10 @@ static int handleOutgoing(struct DHTMessage* message,
 static int handleIncoming(struct DHTMessage* message,
                           void* vcontext)
 {
+    if (!parseFlat(message)) {
+        return 0;
+    }
+
     message->asDict = Allocator_malloc(message->allocator, sizeof(Dict));
 
     struct Reader* reader =
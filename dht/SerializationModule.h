@@ -16,6 +16,7 @@
 #define SerializationModule_H
 
 #include "dht/DHTModuleRegistry.h"
+#include "util/log/Log.h"
 #include "util/Linker.h"
 Linker_require("dht/SerializationModule.c")
 
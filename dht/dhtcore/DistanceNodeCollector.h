@@ -15,7 +15,6 @@
 #ifndef DistanceNodeCollector_H
 #define DistanceNodeCollector_H
 
-#include "dht/dhtcore/NodeHeader.h"
 #include "dht/dhtcore/NodeCollector.h"
 #include "util/Bits.h"
 
@@ -26,16 +25,18 @@
  * Filter a node through the collector.
  * If this node is better than all of the ones known to the collector, it will be collected.
  *
- * @param header the header of the node to add.
+ * @param addressPrefix the first 4 bytes of the node's address in host order.
+ * @param reach the reach of the node.
  * @param body the node which is used in case the prefix is an exact match and it needs to
  *             look at more bits.
  * @param collector the collector to filter the node through.
  */
-static inline void DistanceNodeCollector_addNode(struct NodeHeader* header,
+static inline void DistanceNodeCollector_addNode(uint32_t addressPrefix,
+                                                 uint32_t reach,
                                                  struct Node* body,
                                                  struct NodeCollector* collector)
 {
-    uint32_t nodeDistance = header->addressPrefix ^ collector->targetPrefix;
+    uint32_t nodeDistance = addressPrefix ^ collector->targetPrefix;
 
     // This is a hack because we don't really care about
     // beyond the first 4 bytes unless it's a match.
@@ -67,7 +68,7 @@ static inline void DistanceNodeCollector_addNode(struct NodeHeader* header,
             }
             if (i == 0) {
                 reachAndPath =
-                    ((uint64_t)(64 - Bits_log2x64(body->address.path)) << 32) | (header->reach);
+                    ((uint64_t)(64 - Bits_log2x64(body->address.path)) << 32) | reach;
             }
             if (nodeDistance < nodes[i].distance) {
                 // smaller distance.
@@ -82,7 +83,6 @@ static inline void DistanceNodeCollector_addNode(struct NodeHeader* header,
             if (i > 1) {
                 Bits_memmove(nodes, &nodes[1], (i - 1) * sizeof(struct NodeCollector_Element));
             }
-            nodes[i - 1].node = header;
             nodes[i - 1].body = body;
             nodes[i - 1].value = reachAndPath;
             nodes[i - 1].distance = nodeDistance;
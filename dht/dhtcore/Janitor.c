@@ -17,7 +17,6 @@
 #include "dht/dhtcore/Janitor.h"
 #include "dht/dhtcore/Node.h"
 #include "dht/dhtcore/NodeList.h"
-#include "dht/dhtcore/NodeHeader.h"
 #include "dht/dhtcore/RouterModule.h"
 #include "dht/dhtcore/SearchRunner.h"
 #include "dht/dhtcore/RouteTracer.h"
@@ -25,6 +24,7 @@
 #include "memory/Allocator.h"
 #include "util/AverageRoller.h"
 #include "util/Bits.h"
+#include "util/Endian.h"
 #include "util/events/EventBase.h"
 #include "util/Hex.h"
 #include "util/events/Timeout.h"
@@ -34,6 +34,18 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/**
+ * The keyspace is split into buckets by this many bits of the address following the leading 0xfc.
+ * Each cycle, maintenance goes to the bucket which has gone the longest without a visit
+ * relative to the number of live nodes known in it, so sparse areas are explored more often
+ * than well covered ones.
+ */
+#define KEYSPACE_BUCKET_BITS 6
+#define KEYSPACE_BUCKETS (1 << KEYSPACE_BUCKET_BITS)
+
+/** The number of address prefixes in each bucket. */
+#define KEYSPACE_BUCKET_SPAN (1u << (24 - KEYSPACE_BUCKET_BITS))
+
 /**
  * The goal of this is to run searches in the local area of this node.
  * it searches for hashes every localMaintainenceSearchPeriod milliseconds.
@@ -68,6 +80,9 @@ struct Janitor
 
     /** Number of concurrent searches taking place. */
     int searches;
+
+    /** When maintenance last searched or pinged in each keyspace bucket. */
+    uint64_t timeOfLastVisit[KEYSPACE_BUCKETS];
 };
 
 struct Janitor_Search
@@ -138,7 +153,8 @@ static void search(uint8_t target[16], struct Janitor* janitor, int searchType)
 
     struct Allocator* searchAlloc = Allocator_child(janitor->allocator);
     struct RouterModule_Promise* rp =
-        SearchRunner_search(target, janitor->searchRunner, searchAlloc);
+        SearchRunner_search(target, SearchRunner_Priority_MAINTENANCE,
+                            janitor->searchRunner, searchAlloc);
 
     if (!rp) {
         Log_debug(janitor->logger, "RouterModule_search() returned NULL, probably full.");
@@ -159,6 +175,43 @@ static void search(uint8_t target[16], struct Janitor* janitor, int searchType)
     rp->userData = search;
 }
 
+static inline uint32_t bucketPrefix(int bucket)
+{
+    return 0xfc000000 | (((uint32_t) bucket) << (24 - KEYSPACE_BUCKET_BITS));
+}
+
+/** Pick the bucket most in need of maintenance, the staler and sparser the more in need. */
+static int neediestBucket(struct Janitor* janitor, uint64_t now)
+{
+    // Start at a random bucket so that ties are broken randomly.
+    int offset = Random_uint32(janitor->rand) % KEYSPACE_BUCKETS;
+    int best = offset;
+    uint64_t bestScore = 0;
+    for (int i = 0; i < KEYSPACE_BUCKETS; i++) {
+        int bucket = (i + offset) % KEYSPACE_BUCKETS;
+        uint32_t first = bucketPrefix(bucket);
+        int nodes = NodeStore_nonZeroNodesInRange(first,
+                                                  first + (KEYSPACE_BUCKET_SPAN - 1),
+                                                  janitor->nodeStore);
+        uint64_t score = (now - janitor->timeOfLastVisit[bucket]) / (nodes + 1);
+        if (score > bestScore) {
+            best = bucket;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+/** Choose a random search target in a bucket. */
+static void targetInBucket(uint8_t target[16], int bucket, struct Janitor* janitor)
+{
+    Random_bytes(janitor->rand, target, Address_SEARCH_TARGET_SIZE);
+    uint32_t prefix = bucketPrefix(bucket)
+        | (Random_uint32(janitor->rand) & (KEYSPACE_BUCKET_SPAN - 1));
+    uint32_t prefix_be = Endian_hostToBigEndian32(prefix);
+    Bits_memcpyConst(target, &prefix_be, 4);
+}
+
 static void maintanenceCycle(void* vcontext)
 {
     struct Janitor* const janitor = (struct Janitor*) vcontext;
@@ -174,28 +227,29 @@ static void maintanenceCycle(void* vcontext)
         return;
     }
 
-    struct Address targetAddr;
-
-    // Ping a random node.
-    struct Node* randomNode = RouterModule_getNode(0, janitor->routerModule);
-    if (randomNode) {
-        RouterModule_pingNode(randomNode, 0, janitor->routerModule, janitor->allocator);
+    if (!RouterModule_hasQueryBudget(janitor->routerModule)) {
+        // Maintenance can wait for the next cycle.
+        return;
     }
 
-    // If the node's reach is zero, run a search for it, otherwise run a random search.
-    int searchType;
-    if (randomNode && randomNode->reach == 0) {
-        searchType = search_searchType_COMPLETE;
-        Bits_memcpyConst(&targetAddr, &randomNode->address, Address_SIZE);
-    } else {
-        searchType = search_searchType_PARTIAL;
-        Random_bytes(janitor->rand, targetAddr.ip6.bytes, Address_SEARCH_TARGET_SIZE);
-    }
+    struct Address targetAddr;
+    int bucket = neediestBucket(janitor, now);
+    janitor->timeOfLastVisit[bucket] = now;
+    targetInBucket(targetAddr.ip6.bytes, bucket, janitor);
 
     struct Node* n = RouterModule_lookup(targetAddr.ip6.bytes, janitor->routerModule);
 
-    // If the best next node doesn't exist or has 0 reach, run a local maintenance search.
-    if (n == NULL || n->reach == 0) {
+    if (n && n->reach > 0) {
+        // Reconfirm the node which we would use to reach that part of the keyspace.
+        RouterModule_pingNode(n, 0, janitor->routerModule, janitor->allocator);
+    } else {
+        // If the best next node has 0 reach, search for it, if there is none then search the
+        // bucket to discover some.
+        int searchType = search_searchType_PARTIAL;
+        if (n) {
+            searchType = search_searchType_COMPLETE;
+            Bits_memcpyConst(&targetAddr, &n->address, Address_SIZE);
+        }
         #ifdef Log_DEBUG
             uint8_t printable[40];
             Address_printIp(printable, &targetAddr);
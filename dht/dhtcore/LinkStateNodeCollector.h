@@ -17,7 +17,6 @@
 
 #include "dht/Address.h"
 #include "dht/dhtcore/Node.h"
-#include "dht/dhtcore/NodeHeader.h"
 #include "dht/dhtcore/NodeCollector.h"
 #include "util/log/Log.h"
 #include "util/version/Version.h"
@@ -30,16 +29,18 @@
  * Filter a node through the collector.
  * If this node is better than any one of the ones known to the collector, it will be collected.
  *
- * @param header the header of the node to add.
+ * @param addressPrefix the first 4 bytes of the node's address in host order.
+ * @param reach the reach of the node.
  * @param body the node which is used in case the prefix is an exact match and it needs to
  *             look at more bits.
  * @param collector the collector to filter the node through.
  */
-static inline void LinkStateNodeCollector_addNode(struct NodeHeader* header,
+static inline void LinkStateNodeCollector_addNode(uint32_t addressPrefix,
+                                                  uint32_t reach,
                                                   struct Node* body,
                                                   struct NodeCollector* collector)
 {
-    uint32_t nodeDistance = header->addressPrefix ^ collector->targetPrefix;
+    uint32_t nodeDistance = addressPrefix ^ collector->targetPrefix;
 
     // This is a hack because we don't really care about
     // beyond the first 4 bytes unless it's a match.
@@ -58,9 +59,9 @@ static inline void LinkStateNodeCollector_addNode(struct NodeHeader* header,
     if (nodeDistance < collector->thisNodeDistance) {
 
         uint64_t value = 0;
-        #define LinkStateNodeCollector_getValue(value, header, body, nodeDistance)               \
-            if (value == 0 && header->reach > 0) {                                               \
-                value = header->reach * (64 - Bits_log2x64(body->address.path));                 \
+        #define LinkStateNodeCollector_getValue(value, reach, body, nodeDistance)                \
+            if (value == 0 && reach > 0) {                                                       \
+                value = reach * (64 - Bits_log2x64(body->address.path));                         \
             }
 
         // 0 distance (match) always wins,
@@ -100,7 +101,7 @@ static inline void LinkStateNodeCollector_addNode(struct NodeHeader* header,
             }
 
             // Get the "value" of the node.
-            LinkStateNodeCollector_getValue(value, header, body, nodeDistance);
+            LinkStateNodeCollector_getValue(value, reach, body, nodeDistance);
 
             // If it's less than the value of the stored node then reject
             if (value < nodes[i].value) {
@@ -120,9 +121,8 @@ static inline void LinkStateNodeCollector_addNode(struct NodeHeader* header,
             } else if (i > 1) {
                 Bits_memmove(nodes, &nodes[1], (i - 1) * sizeof(struct NodeCollector_Element));
             }
-            nodes[i - 1].node = header;
             nodes[i - 1].body = body;
-            LinkStateNodeCollector_getValue(value, header, body, nodeDistance);
+            LinkStateNodeCollector_getValue(value, reach, body, nodeDistance);
             nodes[i - 1].value = value;
             nodes[i - 1].distance = nodeDistance;
         }
@@ -30,7 +30,7 @@ struct Node
      */
     uint32_t reach;
 
-    /** The version of the node, must be synchronized with NodeHeader */
+    /** The version of the node, must be synchronized with the NodeStore versions. */
     uint32_t version;
 
     /** The address of the node. */
@@ -42,6 +42,15 @@ struct Node
      */
     uint64_t timeOfNextPing;
 
+    /**
+     * Smoothed round trip time of queries to this node in milliseconds, 0 if never measured.
+     * Kept as in TCP (RFC 6298) and used to time out queries to this node.
+     */
+    uint32_t smoothedRtt;
+
+    /** Mean deviation of the round trip time from smoothedRtt in milliseconds. */
+    uint32_t rttVariance;
+
     /**
      * Used to count the number of consecutive missed pings when testing reach.
      * Not allowing 1 or 2 before penalizing was causing us to switch paths too often,
@@ -60,7 +69,7 @@ struct Node_Two
      */
     uint32_t reach;
 
-    /** The version of the node, must be synchronized with NodeHeader */
+    /** The version of the node, must be synchronized with the NodeStore versions. */
     uint32_t version;
 
     /** The address of the node. */
@@ -72,9 +81,18 @@ struct Node_Two
      */
     uint64_t timeOfNextPing;
 
+    /**
+     * Smoothed round trip time of queries to this node in milliseconds, 0 if never measured.
+     * Kept as in TCP (RFC 6298) and used to time out queries to this node.
+     */
+    uint32_t smoothedRtt;
+
+    /** Mean deviation of the round trip time from smoothedRtt in milliseconds. */
+    uint32_t rttVariance;
+
     // new stuff
 
-    /** The encoding method used by this node. */
+    /** The encoding method used by this node, shared with every node which uses the same. */
     struct EncodingScheme* encodingScheme;
 
     /**
@@ -88,8 +106,6 @@ struct Node_Two
     /** Used for freeing the links associated with this node. */
     struct Node_Link* reversePeers;
 
-    struct Allocator* alloc;
-
     Identity
 };
 
@@ -100,6 +116,8 @@ Node_ASSERT_MATCHES(reach);
 Node_ASSERT_MATCHES(version);
 Node_ASSERT_MATCHES(address);
 Node_ASSERT_MATCHES(timeOfNextPing);
+Node_ASSERT_MATCHES(smoothedRtt);
+Node_ASSERT_MATCHES(rttVariance);
 #undef Node_ASSERT_MATCHES
 
 /**
@@ -17,7 +17,6 @@
 
 #include "dht/Address.h"
 #include "dht/dhtcore/Node.h"
-#include "dht/dhtcore/NodeHeader.h"
 #include "util/log/Log.h"
 #include "memory/Allocator.h"
 
@@ -26,7 +25,6 @@
 
 struct NodeCollector_Element
 {
-    struct NodeHeader* node;
     struct Node* body;
     uint64_t value;
     uint32_t distance;
@@ -84,7 +82,6 @@ static struct NodeCollector* NodeCollector_new(struct Address* targetAddress,
     for (uint32_t i = 0; i < capacity; i++) {
         out->nodes[i].value = 0;
         out->nodes[i].distance = UINT32_MAX;
-        out->nodes[i].node = NULL;
         out->nodes[i].body = NULL;
     }
 
@@ -104,16 +101,18 @@ static struct NodeCollector* NodeCollector_new(struct Address* targetAddress,
  * Filter a node through the collector.
  * If this node is better than all of the ones known to the collector, it will be collected.
  *
- * @param header the header of the node to add.
+ * @param addressPrefix the first 4 bytes of the node's address in host order.
+ * @param reach the reach of the node.
  * @param body the node which is used in case the prefix is an exact match and it needs to
  *             look at more bits.
  * @param collector the collector to filter the node through.
  */
-static inline void NodeCollector_addNode(struct NodeHeader* header,
+static inline void NodeCollector_addNode(uint32_t addressPrefix,
+                                         uint32_t reach,
                                          struct Node* body,
                                          struct NodeCollector* collector)
 {
-    uint32_t nodeDistance = header->addressPrefix ^ collector->targetPrefix;
+    uint32_t nodeDistance = addressPrefix ^ collector->targetPrefix;
 
     // This is a hack because we don't really care about
     // beyond the first 4 bytes unless it's a match.
@@ -132,10 +131,10 @@ static inline void NodeCollector_addNode(struct NodeHeader* header,
     if (nodeDistance < collector->thisNodeDistance) {
 
         uint64_t value = 0;
-        #define NodeCollector_getValue(value, header, body, nodeDistance) \
+        #define NodeCollector_getValue(value, reach, body, nodeDistance) \
             if (value == 0) {                                                            \
                 value = 64 - Bits_log2x64(body->address.path);                           \
-                value |= (uint64_t) (UINT32_MAX - nodeDistance) * header->reach * value; \
+                value |= (uint64_t) (UINT32_MAX - nodeDistance) * reach * value;         \
             }
 
         // 0 distance (match) always wins,
@@ -147,7 +146,7 @@ static inline void NodeCollector_addNode(struct NodeHeader* header,
         uint32_t match = 0;
         for (i = 0; i < collector->capacity; i++) {
             if ((nodes[i].distance == 0) == (nodeDistance == 0)) {
-                NodeCollector_getValue(value, header, body, nodeDistance);
+                NodeCollector_getValue(value, reach, body, nodeDistance);
                 if (value <= nodes[i].value) {
                     break;
                 }
@@ -170,9 +169,8 @@ static inline void NodeCollector_addNode(struct NodeHeader* header,
             } else if (i > 1) {
                 Bits_memmove(nodes, &nodes[1], (i - 1) * sizeof(struct NodeCollector_Element));
             }
-            nodes[i - 1].node = header;
             nodes[i - 1].body = body;
-            NodeCollector_getValue(value, header, body, nodeDistance);
+            NodeCollector_getValue(value, reach, body, nodeDistance);
             nodes[i - 1].value = value;
             nodes[i - 1].distance = nodeDistance;
         }
@@ -18,12 +18,12 @@
 #include "dht/dhtcore/DistanceNodeCollector.h"
 #include "dht/dhtcore/LinkStateNodeCollector.h"
 #include "dht/dhtcore/Node.h"
-#include "dht/dhtcore/NodeHeader.h"
 #include "dht/dhtcore/NodeStore.h"
 #include "dht/dhtcore/NodeCollector.h"
 #include "dht/dhtcore/NodeList.h"
 #include "util/Assert.h"
 #include "util/Bits.h"
+#include "util/Probe.h"
 #include "util/log/Log.h"
 #include "util/version/Version.h"
 #include "switch/NumberCompress.h"
@@ -40,6 +40,55 @@ struct Ip6 { uint8_t bytes[16]; };
 #define Map_VALUE_TYPE struct Node_Two*
 #include "util/Map.h"
 
+struct RouteKey
+{
+    uint64_t pathToParent;
+    uint8_t childAddress[16];
+};
+#define Map_NAME OfRoutesByKey
+#define Map_KEY_TYPE struct RouteKey
+#define Map_VALUE_TYPE uint64_t
+#include "util/Map.h"
+
+/** The route cache is emptied when it grows past this many entries. */
+#define ROUTE_CACHE_SIZE 1024
+
+/**
+ * Fixed size objects carved out of slabs, freed objects are kept on a list for reuse and the
+ * slabs are only released when the store is freed.
+ */
+struct ObjectPool
+{
+    /** The first free object, each free object begins with a pointer to the next. */
+    void* freeList;
+
+    uint32_t objectSize;
+
+    struct Allocator* alloc;
+};
+
+/** Number of objects in each slab which is allocated. */
+#define ObjectPool_SLAB_SIZE 256
+
+/** A node in the table, each is allocated alone so it stays in place as the table grows. */
+struct TableNode
+{
+    struct Node node;
+
+    /** The position of the node in the table, updated when it is moved. */
+    int index;
+};
+
+/** A node which was found by NodeStore_discoverNodes() and the link to it. */
+struct Walk
+{
+    uint64_t path;
+    struct Node_Link* link;
+};
+
+/** The longest chain of discoveries, each behind the one before, which is remembered. */
+#define WALK_DEPTH 16
+
 /** A list of DHT nodes. */
 struct NodeStore_pvt
 {
@@ -54,30 +103,108 @@ struct NodeStore_pvt
 
     struct Allocator* alloc;
 
-    #define LINK_CAPACITY 5000
-    struct Node_Link* links[LINK_CAPACITY];
+    /**
+     * Results of NodeStore_getRouteLabel(), valid while routeCacheVersion equals graphVersion.
+     * Changes to link state do not affect the labels so only adding or removing a link, or
+     * changing its encoding form, bumps graphVersion.
+     */
+    struct Map_OfRoutesByKey routeCache;
+    struct Allocator* routeCacheAlloc;
+    uint32_t routeCacheVersion;
+    uint32_t graphVersion;
+
+    /** Storage for the Node_Link and Node_Two objects in the graph. */
+    struct ObjectPool linkPool;
+    struct ObjectPool nodePool;
+
+    /** Storage for the TableNodes of the flat table. */
+    struct ObjectPool tableNodePool;
+
+    /**
+     * Every distinct encoding scheme of a node in the graph, nodes point to these so that
+     * the many nodes which use the same scheme share one copy.
+     */
+    struct EncodingScheme** schemes;
+    int schemeCount;
+
+    /** Every link in the store, linkCapacity long and grown as needed. */
+    struct Node_Link** links;
     int linkCount;
+    int linkCapacity;
+
+    /**
+     * While NodeStore_discoverNodes() runs, the nodes it found which are each behind the one
+     * before so the walk to a node behind them need not start from us.
+     * Emptied when any link is freed so it never points to a freed link.
+     */
+    struct Walk walk[WALK_DEPTH];
+    int walkDepth;
+    bool batching;
 
 //////////////////////////////////////////////////
 //
 // old flat table stuff
 
 
-    /** A pointer to the first of an array of node headers. */
-    struct NodeHeader* headers;
+    /**
+     * The fields of each node which are read by scans of the whole table, each in its own
+     * array so that a scan only touches the field which it needs.
+     */
+
+    /** The first 4 bytes of each node's address, swapped into host order for easy sorting. */
+    uint32_t* prefixes;
+
+    /** The reach of each node, see: Node.h */
+    uint32_t* reaches;
+
+    /** The number interface of the next hop to get to each node. */
+    uint32_t* switchIndexes;
+
+    /** The protocol version of each node. */
+    uint32_t* versions;
 
     /** Source of random numbers. */
     struct Random* rand;
 
     /**
-     * A pointer to the first of the array of nodes
-     * Each node corrisponds to the header at the same index in the header array.
+     * A pointer to the first of the array of nodes, each is a TableNode.
+     * Each node corrisponds to the entries at the same index in the arrays above.
+     * Only the pointers move when the table is resized so a node which has been handed out
+     * stays valid until it is removed.
+     */
+    struct Node** nodes;
+
+    /**
+     * The path of each node, kept in sync with nodes[i].address.path so that the whole table
+     * can be checked against a path with the bulk LabelSplicer functions.
      */
-    struct Node* nodes;
+    uint64_t* paths;
 
-    /** The maximum number of nodes which can be allocated. */
+    /** Scratch space for the results of bulk LabelSplicer functions, capacity entries. */
+    uint8_t* behind;
+
+    /**
+     * Counting Bloom filter of the addresses in the table, filterBlocks blocks of
+     * FILTER_BLOCK_SIZE counters, rebuilt whenever the table is resized. See filterUpdate().
+     */
+    uint8_t* filter;
+    uint32_t filterBlocks;
+
+    /**
+     * The indexes of the nodes sorted by addressPrefix, pub.size long, so that the nodes
+     * in a region of the keyspace can be found without scanning the whole table.
+     */
+    uint32_t* byPrefix;
+
+    /** The maximum number of nodes which can be allocated, set by the memory budget. */
     int capacity;
 
+    /** The number of nodes which the table currently has room for, never more than capacity. */
+    int allocated;
+
+    /** The allocator for the node table. */
+    struct Allocator* tableAlloc;
+
     /** The sum of the logs base 2 of all node labels. */
     int32_t labelSum;
 
@@ -130,6 +257,54 @@ static inline void insertReversePeer(struct Node_Two* child,
     *currentP = peer;
 }
 
+static void poolAddSlab(struct ObjectPool* pool, int count)
+{
+    char* slab = Allocator_malloc(pool->alloc, pool->objectSize * count);
+    for (int i = count - 1; i >= 0; i--) {
+        void** object = (void**) &slab[pool->objectSize * i];
+        *object = pool->freeList;
+        pool->freeList = object;
+    }
+}
+
+static void* poolGet(struct ObjectPool* pool)
+{
+    if (!pool->freeList) {
+        poolAddSlab(pool, ObjectPool_SLAB_SIZE);
+    }
+    void** object = pool->freeList;
+    pool->freeList = *object;
+    Bits_memset(object, 0, pool->objectSize);
+    return object;
+}
+
+static void poolPut(struct ObjectPool* pool, void* object)
+{
+    *((void**) object) = pool->freeList;
+    pool->freeList = object;
+}
+
+/** @return the copy of the scheme which is shared by every node which uses it. */
+static struct EncodingScheme* internScheme(struct EncodingScheme* scheme,
+                                           struct NodeStore_pvt* store)
+{
+    for (int i = 0; i < store->schemeCount; i++) {
+        if (scheme == store->schemes[i]) {
+            return scheme;
+        }
+    }
+    for (int i = 0; i < store->schemeCount; i++) {
+        if (EncodingScheme_equals(scheme, store->schemes[i])) {
+            return store->schemes[i];
+        }
+    }
+    store->schemes = Allocator_realloc(store->alloc,
+                                       store->schemes,
+                                       (store->schemeCount + 1) * sizeof(char*));
+    store->schemes[store->schemeCount] = EncodingScheme_clone(scheme, store->alloc);
+    return store->schemes[store->schemeCount++];
+}
+
 static inline void freeLink(struct Node_Link* link, struct NodeStore_pvt* store)
 {
     for (int i = 0; i < store->linkCount; i++) {
@@ -138,13 +313,19 @@ static inline void freeLink(struct Node_Link* link, struct NodeStore_pvt* store)
             break;
         }
     }
-    Allocator_realloc(store->alloc, link, 0);
+    poolPut(&store->linkPool, link);
+    store->walkDepth = 0;
 }
 
 static inline struct Node_Link* getLink(struct NodeStore_pvt* store)
 {
-    struct Node_Link* link = Allocator_calloc(store->alloc, sizeof(struct Node_Link), 1);
-    Assert_true(store->linkCount < LINK_CAPACITY);
+    struct Node_Link* link = poolGet(&store->linkPool);
+    if (store->linkCount == store->linkCapacity) {
+        store->linkCapacity = (store->linkCapacity) ? store->linkCapacity * 2 : 64;
+        store->links = Allocator_realloc(store->alloc,
+                                         store->links,
+                                         store->linkCapacity * sizeof(char*));
+    }
     store->links[store->linkCount++] = link;
     return link;
 }
@@ -253,6 +434,7 @@ static inline void unlinkNodes(struct Node_Link* link, struct NodeStore_pvt* sto
     rbRemove(parent, link, store);
 
     freeLink(link, store);
+    store->graphVersion++;
 
     verifyLinks(store);
     verifyNode(child);
@@ -346,6 +528,7 @@ static inline void linkNodes(struct Node_Two* parent,
                 // This can happen when C renumbers but B->C is the same because B did
                 // not renumber, EG: if C restarts.
                 link->inverseLinkEncodingFormNumber = inverseLinkEncodingFormNumber;
+                store->graphVersion++;
             }
             update(link, linkStateDiff, store);
             return;
@@ -371,6 +554,7 @@ static inline void linkNodes(struct Node_Two* parent,
     Identity_set(link);
     insertReversePeer(child, link);
     rbInsert(parent, link);
+    store->graphVersion++;
 
     // update the child's link state and possibly change it's preferred path
     update(link, linkStateDiff, store);
@@ -387,23 +571,26 @@ static inline void linkNodes(struct Node_Two* parent,
  * @param output a pointer to be set to the link to the closest node.
  * @param store
  * @return the label fragment linking outputNode with the given path.
+ *
+ * findClosestFrom() walks from part way along the path instead of from us.
+ *
+ * @param label the label fragment from the child of link to the wanted node, the director of
+ *              the child need not be cannonical.
+ * @param link the link to start the walk at.
  */
 #define findClosest_INVALID (~((uint64_t)0))
-static inline uint64_t findClosest(uint64_t path,
-                                   struct Node_Link** output,
-                                   struct NodeStore_pvt* store)
+static inline uint64_t findClosestFrom(uint64_t label,
+                                       struct Node_Link* link,
+                                       struct Node_Link** output,
+                                       struct NodeStore_pvt* store)
 {
     struct Node_Link tmpl = {
-        // The path from us is always cannonical
-        .cannonicalLabel = path
+        .cannonicalLabel = label
     };
 
     struct Node_Link* nextLink;
-    struct Node_Link* link = store->selfLink;
     for (;;) {
         //uint64_t origLabel = tmpl.cannonicalLabel;
-        // First we splice off the parent's Director leaving the child's Director.
-        tmpl.cannonicalLabel = LabelSplicer_unsplice(tmpl.cannonicalLabel, link->cannonicalLabel);
 
         //Log_debug(store->logger, "unspliced %08lx to %08lx lcl=%08lx",
         //          origLabel, tmpl.cannonicalLabel, link ? link->cannonicalLabel : 0);
@@ -484,6 +671,9 @@ static inline uint64_t findClosest(uint64_t path,
         #endif*/
 
         link = nextLink;
+
+        // Splice off the parent's Director leaving the child's Director.
+        tmpl.cannonicalLabel = LabelSplicer_unsplice(tmpl.cannonicalLabel, link->cannonicalLabel);
     }
 
     /*#ifdef Log_DEBUG
@@ -503,6 +693,54 @@ static inline uint64_t findClosest(uint64_t path,
     return tmpl.cannonicalLabel;
 }
 
+static inline uint64_t findClosest(uint64_t path,
+                                   struct Node_Link** output,
+                                   struct NodeStore_pvt* store)
+{
+    // The path from us is always cannonical
+    return findClosestFrom(LabelSplicer_unsplice(path, store->selfLink->cannonicalLabel),
+                           store->selfLink,
+                           output,
+                           store);
+}
+
+/**
+ * Like findClosest() but during NodeStore_discoverNodes(), the walk starts from the last node
+ * found in the batch which the path goes through.
+ */
+static uint64_t findClosestInBatch(uint64_t path,
+                                   struct Node_Link** output,
+                                   struct NodeStore_pvt* store)
+{
+    while (store->walkDepth
+        && !LabelSplicer_routesThrough(path, store->walk[store->walkDepth - 1].path))
+    {
+        store->walkDepth--;
+    }
+    if (!store->walkDepth) {
+        return findClosest(path, output, store);
+    }
+    struct Walk* walk = &store->walk[store->walkDepth - 1];
+    if (walk->path == path) {
+        *output = walk->link;
+        return 1;
+    }
+    return findClosestFrom(LabelSplicer_unsplice(path, walk->path), walk->link, output, store);
+}
+
+/** Remember the link to a node found by NodeStore_discoverNodes(). */
+static void pushWalk(uint64_t path, struct Node_Link* link, struct NodeStore_pvt* store)
+{
+    if (!store->batching) {
+        return;
+    }
+    if (store->walkDepth == WALK_DEPTH) {
+        Bits_memmove(store->walk, &store->walk[1], (WALK_DEPTH - 1) * sizeof(struct Walk));
+        store->walkDepth--;
+    }
+    store->walk[store->walkDepth++] = (struct Walk) { .path = path, .link = link };
+}
+
 /**
  * Extend a route by splicing on another link.
  * This will modify the Encoding Form of the first Director in next section of the route to make
@@ -546,12 +784,10 @@ struct Node_Two* NodeStore_discoverNode(struct NodeStore* nodeStore,
     int index = Map_OfNodesByAddress_indexForKey((struct Ip6*)&addr->ip6, &store->nodeMap);
     struct Node_Two* node;
     if (index < 0) {
-        struct Allocator* alloc = Allocator_child(store->alloc);
-        node = Allocator_calloc(alloc, sizeof(struct Node_Two), 1);
-        node->alloc = alloc;
+        node = poolGet(&store->nodePool);
         Bits_memcpyConst(&node->address, addr, sizeof(struct Address));
         index = Map_OfNodesByAddress_put((struct Ip6*)&addr->ip6, &node, &store->nodeMap);
-        node->encodingScheme = EncodingScheme_clone(scheme, node->alloc);
+        node->encodingScheme = internScheme(scheme, store);
         Identity_set(node);
     } else {
         node = store->nodeMap.values[index];
@@ -568,7 +804,7 @@ struct Node_Two* NodeStore_discoverNode(struct NodeStore* nodeStore,
     Assert_true(EncodingScheme_equals(scheme, node->encodingScheme));//TODO
 
     struct Node_Link* closest = NULL;
-    uint64_t path = findClosest(addr->path, &closest, store);
+    uint64_t path = findClosestInBatch(addr->path, &closest, store);
 
     if (path == findClosest_INVALID) {
         return NULL;
@@ -579,6 +815,7 @@ struct Node_Two* NodeStore_discoverNode(struct NodeStore* nodeStore,
     if (closest->child == node) {
         // Link is already known.
         update(closest, 0, store);
+        pushWalk(addr->path, closest, store);
         return node;
     } else if (path == 1) {
         logLink(store, closest, "Node at end of path appears to have changed");
@@ -665,6 +902,15 @@ struct Node_Two* NodeStore_discoverNode(struct NodeStore* nodeStore,
 
     verifyLinks(store);
 
+    if (store->batching) {
+        struct Node_Link* link = rbFind(closest->child, &(struct Node_Link) {
+            .cannonicalLabel = path
+        });
+        if (link && link->child == node) {
+            pushWalk(addr->path, link, store);
+        }
+    }
+
     #ifdef PARANOIA
         path = findClosest(addr->path, &closest, store);
         Assert_true(path == 1);
@@ -674,6 +920,56 @@ struct Node_Two* NodeStore_discoverNode(struct NodeStore* nodeStore,
     return node;
 }
 
+/**
+ * Order paths so that each comes right before the paths which go through it, a path is read
+ * from the lowest bit like the switch reads it.
+ */
+static inline int compareDiscoveries(const struct NodeStore_Discovery* a,
+                                     const struct NodeStore_Discovery* b)
+{
+    uint64_t x = a->addr.path;
+    uint64_t y = b->addr.path;
+    if (x == y) {
+        return 0;
+    }
+    int firstDifference = Bits_ffs64(x ^ y) - 1;
+    int lengthX = Bits_log2x64(x);
+    int lengthY = Bits_log2x64(y);
+    if (firstDifference >= lengthX || firstDifference >= lengthY) {
+        // The shorter path ends before they differ so the longer one goes through it.
+        return (lengthX < lengthY) ? -1 : 1;
+    }
+    return ((x >> firstDifference) & 1) ? 1 : -1;
+}
+
+#define Order_NAME OfDiscoveries
+#define Order_TYPE struct NodeStore_Discovery
+#define Order_COMPARE compareDiscoveries
+#include "util/Order.h"
+
+void NodeStore_discoverNodes(struct NodeStore* nodeStore,
+                             struct NodeStore_Discovery* discoveries,
+                             int count)
+{
+    #ifndef EXPERIMENTAL_PATHFINDER
+        return;
+    #endif
+    struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
+    Order_OfDiscoveries_qsort(discoveries, count);
+    store->batching = true;
+    for (int i = 0; i < count; i++) {
+        struct NodeStore_Discovery* d = &discoveries[i];
+        NodeStore_discoverNode(nodeStore,
+                               &d->addr,
+                               d->reachDiff,
+                               d->version,
+                               d->scheme,
+                               d->encodingFormNumber);
+    }
+    store->batching = false;
+    store->walkDepth = 0;
+}
+
 struct Node_Two* NodeStore_getNode2(struct NodeStore* nodeStore, uint8_t addr[16])
 {
     struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
@@ -720,11 +1016,10 @@ char* NodeStore_getRouteLabel_strerror(uint64_t returnVal)
     }
 }
 
-uint64_t NodeStore_getRouteLabel(struct NodeStore* nodeStore,
-                                 uint64_t pathToParent,
-                                 uint8_t childAddress[16])
+static uint64_t getRouteLabel(struct NodeStore_pvt* store,
+                              uint64_t pathToParent,
+                              uint8_t childAddress[16])
 {
-    struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
     struct Node_Link* linkToParent;
     if (findClosest(pathToParent, &linkToParent, store) != 1) {
         return NodeStore_getRouteLabel_PARENT_NOT_FOUND;
@@ -751,6 +1046,38 @@ uint64_t NodeStore_getRouteLabel(struct NodeStore* nodeStore,
     return NodeStore_getRouteLabel_PARENT_NOT_LINKED_TO_CHILD;
 }
 
+uint64_t NodeStore_getRouteLabel(struct NodeStore* nodeStore,
+                                 uint64_t pathToParent,
+                                 uint8_t childAddress[16])
+{
+    struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
+
+    if (store->routeCacheVersion != store->graphVersion
+        || store->routeCache.count >= ROUTE_CACHE_SIZE)
+    {
+        Allocator_free(store->routeCacheAlloc);
+        store->routeCacheAlloc = Allocator_child(store->alloc);
+        Bits_memset(&store->routeCache, 0, sizeof(struct Map_OfRoutesByKey));
+        store->routeCache.allocator = store->routeCacheAlloc;
+        store->routeCacheVersion = store->graphVersion;
+    }
+
+    struct RouteKey key = { .pathToParent = pathToParent };
+    Bits_memcpyConst(key.childAddress, childAddress, 16);
+    int index = Map_OfRoutesByKey_indexForKey(&key, &store->routeCache);
+    if (index > -1) {
+        return store->routeCache.values[index];
+    }
+
+    uint64_t label = getRouteLabel(store, pathToParent, childAddress);
+
+    // Errors are not cached, a child might become known without any link changing.
+    if (!NodeStore_getRouteLabel_strerror(label)) {
+        Map_OfRoutesByKey_put(&key, &label, &store->routeCache);
+    }
+    return label;
+}
+
 uint32_t NodeStore_linkCount(struct Node_Two* node)
 {
     uint32_t i = 0;
@@ -773,11 +1100,30 @@ struct NodeStore* NodeStore_new(struct Address* myAddress,
     // The allocator for the old NodeStore, seperated to improve debugging
     struct Allocator* oldAlloc = Allocator_child(alloc);
 
+    struct Allocator* routeCacheAlloc = Allocator_child(alloc);
+
     struct NodeStore_pvt* out = Allocator_clone(oldAlloc, (&(struct NodeStore_pvt) {
         .nodeMap = {
             .allocator = alloc
         },
         .capacity = capacity,
+        .tableAlloc = oldAlloc,
+        .routeCache = {
+            .allocator = routeCacheAlloc
+        },
+        .routeCacheAlloc = routeCacheAlloc,
+        .linkPool = {
+            .objectSize = sizeof(struct Node_Link),
+            .alloc = alloc
+        },
+        .nodePool = {
+            .objectSize = sizeof(struct Node_Two),
+            .alloc = alloc
+        },
+        .tableNodePool = {
+            .objectSize = sizeof(struct TableNode),
+            .alloc = oldAlloc
+        },
         .logger = logger,
         .rand = rand,
         .alloc = alloc
@@ -785,11 +1131,10 @@ struct NodeStore* NodeStore_new(struct Address* myAddress,
     Identity_set(out);
 
     // Create the self node
-    struct Node_Two* selfNode = Allocator_calloc(alloc, sizeof(struct Node_Two), 1);
+    struct Node_Two* selfNode = poolGet(&out->nodePool);
     Bits_memcpyConst(&selfNode->address, myAddress, sizeof(struct Address));
-    selfNode->encodingScheme = NumberCompress_defineScheme(alloc);
+    selfNode->encodingScheme = internScheme(NumberCompress_defineScheme(alloc), out);
     selfNode->version = Version_CURRENT_PROTOCOL;
-    selfNode->alloc = alloc;
     Identity_set(selfNode);
     Map_OfNodesByAddress_put((struct Ip6*)&myAddress->ip6, &selfNode, &out->nodeMap);
     linkNodes(selfNode, selfNode, 1, 0xffffffffu, 0, 1, out);
@@ -798,24 +1143,178 @@ struct NodeStore* NodeStore_new(struct Address* myAddress,
 
     out->pub.selfAddress = &out->selfLink->child->address;
 
-    // Create the node table
-    out->headers = Allocator_calloc(oldAlloc, sizeof(struct NodeHeader), capacity);
-    out->nodes = Allocator_calloc(oldAlloc, sizeof(struct Node), capacity);
-
     return &out->pub;
 }
 
+/** Counters in each block of the filter, a block is one cache line. */
+#define FILTER_BLOCK_SIZE 64
+
+/** Counters in the filter for each entry of the table before rounding up to a power of 2. */
+#define FILTER_COUNTERS_PER_NODE 8
+
+/** Counters which are set for each address, all of them in the same block. */
+#define FILTER_HASHES 4
+
+/** The number of bytes used by each entry in the node table. */
+#define BYTES_PER_NODE (sizeof(struct TableNode) + sizeof(char*) \
+    + sizeof(uint32_t) * 5 + sizeof(uint64_t) + 1 + FILTER_COUNTERS_PER_NODE)
+
+/** The table starts this small and doubles as it fills. */
+#define INITIAL_TABLE_SIZE 64
+
+static void* resizeArray(void* array, size_t size, int old, int count, struct Allocator* alloc)
+{
+    array = Allocator_realloc(alloc, array, size * count);
+    if (count > old) {
+        Bits_memset((char*)array + size * old, 0, size * (count - old));
+    }
+    return array;
+}
+
+/**
+ * Add an address to the filter or take it away.
+ * A counter which fills up is never decremented again so the filter can give false positives
+ * but never false negatives, it is cleaned up when the table is next resized.
+ */
+static inline void filterUpdate(const uint8_t ip6[16], bool add, struct NodeStore_pvt* store)
+{
+    // The address is already a hash of the key and the first byte is always 0xfc.
+    uint64_t hash;
+    Bits_memcpyConst(&hash, &ip6[8], 8);
+    uint8_t* block =
+        &store->filter[((hash >> 32) & (store->filterBlocks - 1)) * FILTER_BLOCK_SIZE];
+    for (int i = 0; i < FILTER_HASHES; i++, hash >>= 6) {
+        uint8_t* counter = &block[hash & (FILTER_BLOCK_SIZE - 1)];
+        if (*counter != UINT8_MAX) {
+            *counter += (add) ? 1 : -1;
+        }
+    }
+}
+
+static inline bool filterCheck(const uint8_t ip6[16], struct NodeStore_pvt* store)
+{
+    if (!store->filterBlocks) {
+        return false;
+    }
+    uint64_t hash;
+    Bits_memcpyConst(&hash, &ip6[8], 8);
+    uint8_t* block =
+        &store->filter[((hash >> 32) & (store->filterBlocks - 1)) * FILTER_BLOCK_SIZE];
+    bool present = true;
+    for (int i = 0; i < FILTER_HASHES; i++, hash >>= 6) {
+        present &= block[hash & (FILTER_BLOCK_SIZE - 1)] != 0;
+    }
+    return present;
+}
+
+static void filterRebuild(int allocated, struct NodeStore_pvt* store)
+{
+    uint32_t blocks = 1;
+    while (blocks * FILTER_BLOCK_SIZE < (uint64_t) allocated * FILTER_COUNTERS_PER_NODE) {
+        blocks <<= 1;
+    }
+    if (blocks != store->filterBlocks) {
+        store->filter =
+            Allocator_realloc(store->tableAlloc, store->filter, blocks * FILTER_BLOCK_SIZE);
+        store->filterBlocks = blocks;
+    }
+    Bits_memset(store->filter, 0, blocks * FILTER_BLOCK_SIZE);
+    for (int i = 0; i < store->pub.size; i++) {
+        filterUpdate(store->nodes[i]->address.ip6.bytes, true, store);
+    }
+}
+
+static void resizeTable(int allocated, struct NodeStore_pvt* store)
+{
+    Assert_true(allocated >= store->pub.size);
+    int old = store->allocated;
+    struct Allocator* alloc = store->tableAlloc;
+    store->prefixes = resizeArray(store->prefixes, sizeof(uint32_t), old, allocated, alloc);
+    store->reaches = resizeArray(store->reaches, sizeof(uint32_t), old, allocated, alloc);
+    store->switchIndexes =
+        resizeArray(store->switchIndexes, sizeof(uint32_t), old, allocated, alloc);
+    store->versions = resizeArray(store->versions, sizeof(uint32_t), old, allocated, alloc);
+    store->nodes = resizeArray(store->nodes, sizeof(char*), old, allocated, alloc);
+    store->paths = resizeArray(store->paths, sizeof(uint64_t), old, allocated, alloc);
+    store->behind = resizeArray(store->behind, 1, old, allocated, alloc);
+    store->byPrefix = resizeArray(store->byPrefix, sizeof(uint32_t), old, allocated, alloc);
+    if (allocated > old) {
+        // The nodes themselves are never moved, room for the new ones is added alongside.
+        poolAddSlab(&store->tableNodePool, allocated - old);
+    }
+    store->allocated = allocated;
+    filterRebuild(allocated, store);
+}
+
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////
 
 
+/**
+ * @param count the number of entries in byPrefix to search.
+ * @return the position in byPrefix of the first node whose prefix is not less than prefix.
+ */
+static int firstWithPrefix(uint32_t prefix, int count, struct NodeStore_pvt* store)
+{
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (store->prefixes[store->byPrefix[mid]] < prefix) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/** @return the position in byPrefix which holds the node at index. */
+static int positionForIndex(uint32_t index, struct NodeStore_pvt* store)
+{
+    int pos = firstWithPrefix(store->prefixes[index], store->pub.size, store);
+    while (store->byPrefix[pos] != index) {
+        pos++;
+        Assert_true(pos < store->pub.size);
+    }
+    return pos;
+}
+
+/** Add the node at index to byPrefix, pub.size must already count it. */
+static void prefixIndexInsert(uint32_t index, struct NodeStore_pvt* store)
+{
+    int count = store->pub.size - 1;
+    int pos = firstWithPrefix(store->prefixes[index], count, store);
+    Bits_memmove(&store->byPrefix[pos + 1],
+                 &store->byPrefix[pos],
+                 (count - pos) * sizeof(uint32_t));
+    store->byPrefix[pos] = index;
+}
+
+/** Drop the node at index from byPrefix, pub.size must still count it. */
+static void prefixIndexRemove(uint32_t index, struct NodeStore_pvt* store)
+{
+    int pos = positionForIndex(index, store);
+    Bits_memmove(&store->byPrefix[pos],
+                 &store->byPrefix[pos + 1],
+                 (store->pub.size - pos - 1) * sizeof(uint32_t));
+}
+
+/** @return the index of a node which is in the table, not a copy of one. */
+static int indexOf(const struct Node* node, struct NodeStore_pvt* store)
+{
+    int index = ((const struct TableNode*) node)->index;
+    Assert_true(index >= 0 && index < store->pub.size && store->nodes[index] == node);
+    return index;
+}
+
 static struct Node* nodeForIndex(struct NodeStore_pvt* store, uint32_t index)
 {
-    struct Node* out = &store->nodes[index];
-    out->reach = store->headers[index].reach;
-    out->version = store->headers[index].version;
+    struct Node* out = store->nodes[index];
+    out->reach = store->reaches[index];
+    out->version = store->versions[index];
     return out;
 }
 
@@ -823,18 +1322,26 @@ static struct Node* nodeForIndex(struct NodeStore_pvt* store, uint32_t index)
 struct Node* NodeStore_getNode(struct NodeStore* nodeStore, struct Address* addr)
 {
     struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
+    if (!filterCheck(addr->ip6.bytes, store)) {
+        return NULL;
+    }
     uint32_t pfx = Address_getPrefix(addr);
 
     // If multiple nodes with the same address, get the one with the best reach.
+    // Ties go to the highest index, as they would in a scan of the whole table.
     int32_t bestIndex = -1;
     uint32_t bestReach = 0;
-    for (int32_t i = 0; i < (int32_t) store->pub.size; i++) {
-        if (pfx == store->headers[i].addressPrefix
-            && Bits_memcmp(addr->key, store->nodes[i].address.key, Address_KEY_SIZE) == 0
-            && store->headers[i].reach >= bestReach)
+    for (int pos = firstWithPrefix(pfx, store->pub.size, store); pos < store->pub.size; pos++) {
+        int32_t i = store->byPrefix[pos];
+        if (pfx != store->prefixes[i]) {
+            break;
+        }
+        if (Bits_memcmp(addr->key, store->nodes[i]->address.key, Address_KEY_SIZE) == 0
+            && (store->reaches[i] > bestReach
+                || (store->reaches[i] == bestReach && i > bestIndex)))
         {
             bestIndex = i;
-            bestReach = store->headers[i].reach;
+            bestReach = store->reaches[i];
         }
     }
 
@@ -846,6 +1353,13 @@ struct Node* NodeStore_getNode(struct NodeStore* nodeStore, struct Address* addr
     return nodeForIndex(store, bestIndex);
 }
 
+/** See: NodeStore.h */
+bool NodeStore_mightHaveNode(struct NodeStore* nodeStore, uint8_t ip6[16])
+{
+    struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
+    return filterCheck(ip6, store);
+}
+
 /**
  * Dump the table, one node at a time.
  */
@@ -864,21 +1378,28 @@ static inline uint32_t getSwitchIndex(struct Address* addr)
     return NumberCompress_getDecompressed(addr->path, bits);
 }
 
-static inline void replaceNode(struct Node* nodeToReplace,
-                               struct NodeHeader* headerToReplace,
-                               struct Address* addr,
-                               struct NodeStore_pvt* store)
+static inline void replaceNode(int index, struct Address* addr, struct NodeStore_pvt* store)
 {
-    headerToReplace->addressPrefix = Address_getPrefix(addr);
-    headerToReplace->reach = 0;
-    headerToReplace->version = 0;
-    headerToReplace->switchIndex = getSwitchIndex(addr);
+    struct Node* nodeToReplace = store->nodes[index];
+    if (nodeToReplace->address.path) {
+        // Evicting the node which was here.
+        filterUpdate(nodeToReplace->address.ip6.bytes, false, store);
+    }
+    filterUpdate(addr->ip6.bytes, true, store);
+    store->prefixes[index] = Address_getPrefix(addr);
+    store->reaches[index] = 0;
+    store->versions[index] = 0;
+    store->switchIndexes[index] = getSwitchIndex(addr);
     store->labelSum -= Bits_log2x64(nodeToReplace->address.path);
     store->labelSum += Bits_log2x64(addr->path);
     Assert_true(store->labelSum > 0);
     Bits_memcpyConst(&nodeToReplace->address, addr, sizeof(struct Address));
+    store->paths[index] = addr->path;
     nodeToReplace->timeOfNextPing  = 0;
+    nodeToReplace->smoothedRtt     = 0;
+    nodeToReplace->rttVariance     = 0;
     nodeToReplace->missedPings     = 0;
+    store->pub.generation++;
 }
 
 #ifdef Log_DEBUG
@@ -892,32 +1413,29 @@ static inline void replaceNode(struct Node* nodeToReplace,
     #define logNodeZeroed(x, y)
 #endif
 
-static struct Node* nodeForHeader(struct NodeHeader* header, struct NodeStore_pvt* store)
-{
-    return nodeForIndex(store, header - store->headers);
-}
-
-static inline void adjustReach(struct NodeHeader* header,
+static inline void adjustReach(int index,
                                const int64_t reachDiff,
                                struct NodeStore_pvt* store)
 {
     if (reachDiff == 0) {
         return;
     }
-    int64_t newReach = reachDiff + header->reach;
+    int64_t newReach = reachDiff + store->reaches[index];
     if (newReach <= 0) {
-        header->reach = 0;
-        logNodeZeroed(store->logger, nodeForHeader(header, store));
+        store->reaches[index] = 0;
+        logNodeZeroed(store->logger, nodeForIndex(store, index));
     } else if (newReach > INT32_MAX) {
-        header->reach = INT32_MAX;
+        store->reaches[index] = INT32_MAX;
     } else {
-        header->reach = (uint32_t) newReach;
+        store->reaches[index] = (uint32_t) newReach;
     }
 }
 
 static void removeNode(struct Node* node, struct NodeStore_pvt* store)
 {
-    Assert_true(node >= store->nodes && node < store->nodes + store->pub.size);
+    int index = indexOf(node, store);
+    prefixIndexRemove(index, store);
+    filterUpdate(node->address.ip6.bytes, false, store);
 
     #ifdef Log_DEBUG
         uint8_t addr[60];
@@ -925,16 +1443,63 @@ static void removeNode(struct Node* node, struct NodeStore_pvt* store)
         Log_debug(store->logger, "Removing route to %s\n", addr);
     #endif
 
+    Probe_fire3(nodeEvict,
+                node->address.ip6.bytes,
+                node->address.path,
+                store->reaches[index]);
+
     store->pub.size--;
+    store->pub.generation++;
+
+    if (index != store->pub.size) {
+        store->nodes[index] = store->nodes[store->pub.size];
+        ((struct TableNode*) store->nodes[index])->index = index;
+        store->prefixes[index] = store->prefixes[store->pub.size];
+        store->reaches[index] = store->reaches[store->pub.size];
+        store->switchIndexes[index] = store->switchIndexes[store->pub.size];
+        store->versions[index] = store->versions[store->pub.size];
+        store->paths[index] = store->paths[store->pub.size];
+        store->byPrefix[positionForIndex(store->pub.size, store)] = index;
+    }
 
-    if (node != &store->nodes[store->pub.size]) {
-        Bits_memcpyConst(node, &store->nodes[store->pub.size], sizeof(struct Node));
-        struct NodeHeader* header = &store->headers[node - store->nodes];
-        Bits_memcpyConst(header, &store->headers[store->pub.size], sizeof(struct NodeHeader));
+    store->nodes[store->pub.size] = NULL;
+    store->paths[store->pub.size] = 0;
+    poolPut(&store->tableNodePool, node);
+}
+
+/**
+ * @return the index of the node to replace when the table is full, the one with the least reach
+ *         or if they are equal, the one with the longest label.
+ */
+static int leastReachable(struct NodeStore_pvt* store)
+{
+    int worstNode = -1;
+    for (int i = 0; i < store->pub.size; i++) {
+        if (worstNode == -1
+            || store->reaches[i] < store->reaches[worstNode]
+            || (store->reaches[i] == store->reaches[worstNode]
+                && store->paths[i] > store->paths[worstNode]))
+        {
+            worstNode = i;
+        }
     }
+    Assert_true(worstNode != -1);
+    return worstNode;
+}
 
-    // This is needed because otherwise replaceNode will cause the labelSum to skew.
-    store->nodes[store->pub.size].address.path = 0;
+/** See: NodeStore.h */
+int NodeStore_setMemoryBudget(struct NodeStore* nodeStore, uint64_t bytes)
+{
+    struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
+    uint64_t capacity = bytes / BYTES_PER_NODE;
+    store->capacity = (capacity < 1) ? 1 : (capacity > INT32_MAX) ? INT32_MAX : (int) capacity;
+    while (store->pub.size > store->capacity) {
+        removeNode(store->nodes[leastReachable(store)], store);
+    }
+    if (store->allocated > store->capacity) {
+        resizeTable(store->capacity, store);
+    }
+    return store->capacity;
 }
 
 struct Node* NodeStore_addNode(struct NodeStore* nodeStore,
@@ -962,28 +1527,19 @@ struct Node* NodeStore_addNode(struct NodeStore* nodeStore,
         Assert_true(false);
     }
 
-    // Keep track of the node with the longest label so if the store is full, it can be replaced.
-    int worstNode = -1;
-    uint64_t worstPath = 0;
-
     // becomes true when the direct peer behind this path is found.
     int foundPeer = LabelSplicer_isOneHop(addr->path);
 
     for (int i = store->pub.size - 1; i >= 0; i--) {
 
-        if (LabelSplicer_isOneHop(store->nodes[i].address.path)
-            && LabelSplicer_routesThrough(addr->path, store->nodes[i].address.path))
+        if (LabelSplicer_isOneHop(store->nodes[i]->address.path)
+            && LabelSplicer_routesThrough(addr->path, store->nodes[i]->address.path))
         {
             foundPeer = 1;
         }
 
-        if (store->pub.size >= store->capacity && store->nodes[i].address.path > worstPath) {
-            worstPath = store->nodes[i].address.path;
-            worstNode = i;
-        }
-
-        if (store->headers[i].addressPrefix == pfx
-            && Address_isSameIp(&store->nodes[i].address, addr))
+        if (store->prefixes[i] == pfx
+            && Address_isSameIp(&store->nodes[i]->address, addr))
         {
             // same address
             #ifdef PARANOIA
@@ -992,13 +1548,13 @@ struct Node* NodeStore_addNode(struct NodeStore* nodeStore,
                 Assert_true(!Bits_memcmp(realAddr, addr->ip6.bytes, 16));
             #endif
 
-            if (store->nodes[i].address.path == addr->path) {
+            if (store->nodes[i]->address.path == addr->path) {
                 // same node
 
-            } else if (LabelSplicer_routesThrough(store->nodes[i].address.path, addr->path)) {
+            } else if (LabelSplicer_routesThrough(store->nodes[i]->address.path, addr->path)) {
                 #ifdef Log_DEBUG
                     uint8_t nodeAddr[60];
-                    Address_print(nodeAddr, &store->nodes[i].address);
+                    Address_print(nodeAddr, &store->nodes[i]->address);
                     uint8_t newAddr[20];
                     AddrTools_printPath(newAddr, addr->path);
                     Log_debug(store->logger,
@@ -1010,25 +1566,25 @@ struct Node* NodeStore_addNode(struct NodeStore* nodeStore,
                 // We can take the reach of the existing node with us because this path is a
                 // subpath of the one we were using so it's functionality implies this path's
                 // functionality.
-                reachDifference += store->headers[i].reach;
+                reachDifference += store->reaches[i];
 
                 // Remove the node and continue on to add this one.
                 // If we just change the path, we get duplicates.
-                removeNode(&store->nodes[i], store);
+                removeNode(store->nodes[i], store);
 
                 continue;
-            } else if (!LabelSplicer_routesThrough(addr->path, store->nodes[i].address.path)) {
+            } else if (!LabelSplicer_routesThrough(addr->path, store->nodes[i]->address.path)) {
                 // Completely different routes, store seperately.
                 continue;
             }
 
             // either same node or discovered a redundant route to the same node.
-            adjustReach(&store->headers[i], reachDifference, store);
-            store->headers[i].version = version;
+            adjustReach(i, reachDifference, store);
+            store->versions[i] = version;
             return nodeForIndex(store, i);
 
-        } else if (store->nodes[i].address.path == addr->path) {
-            Assert_true(&store->nodes[i].address != addr);
+        } else if (store->nodes[i]->address.path == addr->path) {
+            Assert_true(&store->nodes[i]->address != addr);
 
             // same path different addr.
 
@@ -1046,7 +1602,7 @@ struct Node* NodeStore_addNode(struct NodeStore* nodeStore,
             if (reachDifference > 0) {
                 // Removing and adding back because of the creepy above comment about duplicates.
                 Log_debug(store->logger, "Same path different node");
-                removeNode(&store->nodes[i], store);
+                removeNode(store->nodes[i], store);
                 continue;
             } else {
                 // TODO:
@@ -1074,19 +1630,40 @@ struct Node* NodeStore_addNode(struct NodeStore* nodeStore,
 
     #ifdef PARANOIA
         for (int i = 0; i < store->pub.size; i++) {
-           Assert_true(store->headers[i].addressPrefix ==
-                           Address_getPrefix(&store->nodes[i].address));
-           Assert_true(!(!Bits_memcmp(&store->nodes[i].address.ip6, &addr->ip6, 16)
-               && store->nodes[i].address.path == addr->path));
+           Assert_true(i == 0 || store->prefixes[store->byPrefix[i - 1]]
+                                     <= store->prefixes[store->byPrefix[i]]);
+           Assert_true(store->prefixes[i] ==
+                           Address_getPrefix(&store->nodes[i]->address));
+           Assert_true(!(!Bits_memcmp(&store->nodes[i]->address.ip6, &addr->ip6, 16)
+               && store->nodes[i]->address.path == addr->path));
         }
-        Assert_true(store->pub.size < store->capacity || worstNode != -1);
     #endif
 
-    int insertionIndex = (store->pub.size >= store->capacity) ? worstNode : store->pub.size++;
+    int insertionIndex;
+    if (store->pub.size >= store->capacity) {
+        insertionIndex = leastReachable(store);
+        Probe_fire3(nodeEvict,
+                    store->nodes[insertionIndex]->address.ip6.bytes,
+                    store->nodes[insertionIndex]->address.path,
+                    store->reaches[insertionIndex]);
+        // It goes back in below, under the new prefix.
+        prefixIndexRemove(insertionIndex, store);
+    } else {
+        if (store->pub.size == store->allocated) {
+            int allocated = (store->allocated) ? store->allocated * 2 : INITIAL_TABLE_SIZE;
+            resizeTable((allocated < store->capacity) ? allocated : store->capacity, store);
+        }
+        insertionIndex = store->pub.size++;
+        struct TableNode* node = poolGet(&store->tableNodePool);
+        node->index = insertionIndex;
+        store->nodes[insertionIndex] = &node->node;
+    }
 
-    replaceNode(&store->nodes[insertionIndex], &store->headers[insertionIndex], addr, store);
-    adjustReach(&store->headers[insertionIndex], reachDifference, store);
-    store->headers[insertionIndex].version = version;
+    replaceNode(insertionIndex, addr, store);
+    prefixIndexInsert(insertionIndex, store);
+    adjustReach(insertionIndex, reachDifference, store);
+    store->versions[insertionIndex] = version;
+    Probe_fire3(nodeAdd, addr->ip6.bytes, addr->path, store->reaches[insertionIndex]);
 
     return nodeForIndex(store, insertionIndex);
 }
@@ -1097,7 +1674,7 @@ struct Node* NodeStore_getBest(struct Address* targetAddress, struct NodeStore*
     struct NodeCollector_Element element = {
         .value = 0,
         .distance = UINT32_MAX,
-        .node = NULL
+        .body = NULL
     };
 
     struct NodeCollector collector = {
@@ -1111,13 +1688,33 @@ struct Node* NodeStore_getBest(struct Address* targetAddress, struct NodeStore*
     collector.thisNodeDistance =
         Address_getPrefix(store->pub.selfAddress) ^ collector.targetPrefix;
 
-    for (int i = 0; i < store->pub.size; i++) {
-        if (store->headers[i].reach != 0) {
-            LinkStateNodeCollector_addNode(store->headers + i, store->nodes + i, &collector);
+    // Only nodes closer to the target than we are will be collected. Each bit set in our
+    // distance marks a block of prefixes which agree with target ^ distance above that bit
+    // and with the target at it, every node in those blocks is closer.
+    uint32_t target = collector.targetPrefix;
+    uint32_t distance = collector.thisNodeDistance;
+    for (int bit = 31; bit >= 0; bit--) {
+        if (!((distance >> bit) & 1)) {
+            continue;
+        }
+        uint32_t low = (uint32_t) ((((uint64_t) (target ^ distance)) >> (bit + 1)) << (bit + 1));
+        low |= target & (1u << bit);
+        uint32_t high = low | ((1u << bit) - 1);
+        for (int pos = firstWithPrefix(low, store->pub.size, store); pos < store->pub.size; pos++) {
+            int i = store->byPrefix[pos];
+            if (store->prefixes[i] > high) {
+                break;
+            }
+            if (store->reaches[i] != 0) {
+                LinkStateNodeCollector_addNode(store->prefixes[i],
+                                               store->reaches[i],
+                                               store->nodes[i],
+                                               &collector);
+            }
         }
     }
 
-    return element.node ? nodeForHeader(element.node, store) : NULL;
+    return element.body ? nodeForIndex(store, indexOf(element.body, store)) : NULL;
 }
 
 struct NodeList* NodeStore_getNodesByAddr(struct Address* address,
@@ -1133,9 +1730,18 @@ struct NodeList* NodeStore_getNodesByAddr(struct Address* address,
                                                         store->logger,
                                                         allocator);
 
-    for (int i = 0; i < store->pub.size; i++) {
-        Assert_true(store->nodes[i].address.path != 0);
-        DistanceNodeCollector_addNode(store->headers + i, store->nodes + i, collector);
+    // Only exact matches are returned and they always win so nothing else need be collected.
+    uint32_t pfx = Address_getPrefix(address);
+    for (int pos = firstWithPrefix(pfx, store->pub.size, store); pos < store->pub.size; pos++) {
+        int i = store->byPrefix[pos];
+        if (store->prefixes[i] != pfx) {
+            break;
+        }
+        Assert_true(store->nodes[i]->address.path != 0);
+        DistanceNodeCollector_addNode(store->prefixes[i],
+                                      store->reaches[i],
+                                      store->nodes[i],
+                                      collector);
     }
 
     struct NodeList* out = Allocator_malloc(allocator, sizeof(struct NodeList));
@@ -1143,7 +1749,7 @@ struct NodeList* NodeStore_getNodesByAddr(struct Address* address,
 
     uint32_t outIndex = 0;
     for (uint32_t i = 0; i < max; i++) {
-        if (collector->nodes[i].node != NULL
+        if (collector->nodes[i].body != NULL
             && !Bits_memcmp(collector->nodes[i].body->address.ip6.bytes, address->ip6.bytes, 16))
         {
             out->nodes[outIndex] = Allocator_clone(allocator, collector->nodes[i].body);
@@ -1156,6 +1762,96 @@ struct NodeList* NodeStore_getNodesByAddr(struct Address* address,
     return out;
 }
 
+/**
+ * Whether two paths to the same node share their first hop, the switch label bits which
+ * our own switch uses are compared so this holds even if the peer has been evicted.
+ */
+static inline bool sameFirstHop(uint64_t pathA, uint64_t pathB)
+{
+    uint64_t firstA = pathA & Bits_maxBits64(NumberCompress_bitsUsedForLabel(pathA));
+    uint64_t firstB = pathB & Bits_maxBits64(NumberCompress_bitsUsedForLabel(pathB));
+    return firstA == firstB;
+}
+
+/** See: NodeStore.h */
+struct NodeList* NodeStore_getPaths(struct Address* address,
+                                    const uint32_t max,
+                                    struct Allocator* allocator,
+                                    struct NodeStore* nodeStore)
+{
+    struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
+    struct Allocator* tempAlloc = Allocator_child(allocator);
+
+    // Every entry with the address is a candidate, best reach first and shortest path on a tie.
+    int* candidates = Allocator_malloc(tempAlloc, store->pub.size * sizeof(int) + 1);
+    int candidateCount = 0;
+    uint32_t pfx = Address_getPrefix(address);
+    for (int pos = firstWithPrefix(pfx, store->pub.size, store); pos < store->pub.size; pos++) {
+        int i = store->byPrefix[pos];
+        if (store->prefixes[i] != pfx) {
+            break;
+        }
+        if (store->reaches[i] == 0
+            || Bits_memcmp(store->nodes[i]->address.ip6.bytes, address->ip6.bytes, 16))
+        {
+            continue;
+        }
+        int j = candidateCount++;
+        for (; j > 0; j--) {
+            int prev = candidates[j - 1];
+            if (store->reaches[prev] > store->reaches[i]
+                || (store->reaches[prev] == store->reaches[i]
+                    && store->paths[prev] < store->paths[i]))
+            {
+                break;
+            }
+            candidates[j] = prev;
+        }
+        candidates[j] = i;
+    }
+
+    struct NodeList* out = Allocator_malloc(allocator, sizeof(struct NodeList));
+    out->nodes = Allocator_malloc(allocator, max * sizeof(char*) + 1);
+    out->size = 0;
+
+    // The addresses of the nodes which the chosen paths pass through, a candidate which passes
+    // through any of them or leaves by the same interface as a chosen path may share a link with
+    // it and would break along with it so it is skipped.
+    struct Ip6* hops = Allocator_malloc(tempAlloc, store->pub.size * sizeof(struct Ip6) + 1);
+    int hopCount = 0;
+    for (int c = 0; c < candidateCount && out->size < max; c++) {
+        uint64_t path = store->paths[candidates[c]];
+        bool disjoint = true;
+        for (uint32_t j = 0; j < out->size && disjoint; j++) {
+            disjoint = !sameFirstHop(path, out->nodes[j]->address.path);
+        }
+        int firstNewHop = hopCount;
+        for (int i = 0; i < store->pub.size && disjoint; i++) {
+            if (i == candidates[c]
+                || store->paths[i] < 2
+                || !LabelSplicer_routesThrough(path, store->paths[i]))
+            {
+                continue;
+            }
+            struct Ip6* hop = (struct Ip6*) store->nodes[i]->address.ip6.bytes;
+            // Passing through the destination on the way to it is a loop, not a path.
+            disjoint = Bits_memcmp(hop->bytes, address->ip6.bytes, 16);
+            for (int j = 0; j < firstNewHop && disjoint; j++) {
+                disjoint = Bits_memcmp(hop->bytes, hops[j].bytes, 16);
+            }
+            Bits_memcpyConst(&hops[hopCount++], hop, sizeof(struct Ip6));
+        }
+        if (!disjoint) {
+            hopCount = firstNewHop;
+            continue;
+        }
+        out->nodes[out->size++] = Allocator_clone(allocator, nodeForIndex(store, candidates[c]));
+    }
+
+    Allocator_free(tempAlloc);
+    return out;
+}
+
 struct NodeList* NodeStore_getPeers(uint64_t label,
                                     const uint32_t max,
                                     struct Allocator* allocator,
@@ -1170,7 +1866,7 @@ struct NodeList* NodeStore_getPeers(uint64_t label,
     out->nodes = Allocator_calloc(allocator, sizeof(char*), max);
 
     for (int i = 0; i < store->pub.size; i++) {
-        uint64_t p = store->nodes[i].address.path;
+        uint64_t p = store->nodes[i]->address.path;
         if (LabelSplicer_isOneHop(p)) {
             int j;
             for (j = 0; j < (int)max; j++) {
@@ -1180,7 +1876,7 @@ struct NodeList* NodeStore_getPeers(uint64_t label,
             }
             switch (j) {
                 default: Bits_memmove(out->nodes, &out->nodes[1], (j - 1) * sizeof(char*));
-                case 1: out->nodes[j - 1] = &store->nodes[i];
+                case 1: out->nodes[j - 1] = store->nodes[i];
                 case 0:;
             }
         }
@@ -1223,17 +1919,21 @@ struct NodeList* NodeStore_getClosestNodes(struct NodeStore* nodeStore,
     // Don't send nodes which route back to the node which asked us.
     uint32_t index = (requestorsAddress) ? getSwitchIndex(requestorsAddress) : 0;
 
-    // naive implementation, todo make this faster
+    // This collector ranks by version and reach rather than by distance so unlike
+    // NodeStore_getBest(), the prefix index cannot narrow the search and every node is a candidate.
     for (int i = 0; i < store->pub.size; i++) {
-        if (requestorsAddress && store->headers[i].switchIndex == index) {
+        if (requestorsAddress && store->switchIndexes[i] == index) {
             // Nodes which are down the same interface as the node who asked.
             continue;
         }
-        if (!Version_isCompatible(store->headers[i].version, versionOfRequestingNode)) {
+        if (!Version_isCompatible(store->versions[i], versionOfRequestingNode)) {
             // Known not to be compatable.
             continue;
         }
-        LinkStateNodeCollector_addNode(store->headers + i, store->nodes + i, collector);
+        LinkStateNodeCollector_addNode(store->prefixes[i],
+                                       store->reaches[i],
+                                       store->nodes[i],
+                                       collector);
     }
 
     struct NodeList* out = Allocator_malloc(allocator, sizeof(struct NodeList));
@@ -1241,8 +1941,8 @@ struct NodeList* NodeStore_getClosestNodes(struct NodeStore* nodeStore,
 
     uint32_t outIndex = 0;
     for (uint32_t i = 0; i < count; i++) {
-        if (collector->nodes[i].node != NULL) {
-            out->nodes[outIndex] = nodeForHeader(collector->nodes[i].node, store);
+        if (collector->nodes[i].body != NULL) {
+            out->nodes[outIndex] = nodeForIndex(store, indexOf(collector->nodes[i].body, store));
             outIndex++;
         }
     }
@@ -1257,21 +1957,26 @@ void NodeStore_updateReach(const struct Node* const node,
 {
     struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
 
-    store->headers[node - store->nodes].reach = node->reach;
-    uint64_t path = node->address.path;
+    const uint32_t reach = node->reach;
+    const uint64_t path = node->address.path;
+    store->reaches[indexOf(node, store)] = reach;
+
+    // Nodes behind this one can be no better than it and nodes in front of it no worse.
+    // Almost every node already agrees so the reach is compared first and the path only
+    // for the few which do not, this is a read of the reaches and nothing is written unless
+    // a reach actually changes.
     for (int i = 0; i < store->pub.size; i++) {
-        uint64_t dest = store->nodes[i].address.path;
-        if (LabelSplicer_routesThrough(dest, path)
-            && store->headers[i].reach > node->reach)
-        {
-            store->headers[i].reach = node->reach;
-            if (node->reach == 0) {
-                logNodeZeroed(store->logger, &store->nodes[i]);
+        if (store->reaches[i] > reach) {
+            if (LabelSplicer_routesThrough(store->paths[i], path)) {
+                store->reaches[i] = reach;
+                if (reach == 0) {
+                    logNodeZeroed(store->logger, store->nodes[i]);
+                }
+            }
+        } else if (store->reaches[i] < reach) {
+            if (LabelSplicer_routesThrough(path, store->paths[i])) {
+                store->reaches[i] = reach;
             }
-        } else if (LabelSplicer_routesThrough(path, dest)
-            && store->headers[i].reach < node->reach)
-        {
-            store->headers[i].reach = node->reach;
         }
     }
 }
@@ -1281,7 +1986,23 @@ int NodeStore_nonZeroNodes(struct NodeStore* nodeStore)
     struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
     int nonZeroNodes = 0;
     for (int i = 0; i < store->pub.size; i++) {
-        nonZeroNodes += (store->headers[i].reach > 0);
+        nonZeroNodes += (store->reaches[i] > 0);
+    }
+    return nonZeroNodes;
+}
+
+/** see: NodeStore.h */
+int NodeStore_nonZeroNodesInRange(uint32_t firstPrefix,
+                                  uint32_t lastPrefix,
+                                  struct NodeStore* nodeStore)
+{
+    struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
+    int nonZeroNodes = 0;
+    for (int pos = firstWithPrefix(firstPrefix, store->pub.size, store);
+         pos < store->pub.size && store->prefixes[store->byPrefix[pos]] <= lastPrefix;
+         pos++)
+    {
+        nonZeroNodes += (store->reaches[store->byPrefix[pos]] > 0);
     }
     return nonZeroNodes;
 }
@@ -1292,11 +2013,11 @@ struct Node* NodeStore_getNodeByNetworkAddr(uint64_t path, struct NodeStore* nod
     struct NodeStore_pvt* store = Identity_cast((struct NodeStore_pvt*)nodeStore);
     if (path == 0) {
         return (store->pub.size > 0)
-            ? &store->nodes[Random_uint32(store->rand) % store->pub.size] : NULL;
+            ? store->nodes[Random_uint32(store->rand) % store->pub.size] : NULL;
     }
 
     for (int i = 0; i < store->pub.size; i++) {
-        if (path == store->nodes[i].address.path) {
+        if (path == store->nodes[i]->address.path) {
             return nodeForIndex(store, i);
         }
     }
@@ -1311,14 +2032,18 @@ int NodeStore_brokenPath(uint64_t path, struct NodeStore* nodeStore)
         AddrTools_printPath(pathStr, path);
         Log_debug(store->logger, "NodeStore_brokenPath(%s)", pathStr);
     #endif
-    int out = 0;
+    int out = LabelSplicer_whichRouteThrough(store->behind, store->paths, store->pub.size, path);
+    if (!out) {
+        return 0;
+    }
+    // Nodes are removed by moving the last one into their place, going backward means the
+    // moved node has always been checked already.
     for (int32_t i = (int32_t) store->pub.size - 1; i >= 0; i--) {
-        if (LabelSplicer_routesThrough(store->nodes[i].address.path, path)) {
-            if (LabelSplicer_isOneHop(store->nodes[i].address.path)) {
-                Assert_true(store->nodes[i].address.path == path);
+        if (store->behind[i]) {
+            if (LabelSplicer_isOneHop(store->nodes[i]->address.path)) {
+                Assert_true(store->nodes[i]->address.path == path);
             }
-            removeNode(&store->nodes[i], store);
-            out++;
+            removeNode(store->nodes[i], store);
         }
     }
     return out;
@@ -32,6 +32,12 @@ struct NodeStore
     /** The number of nodes in the list. */
     int size;
 
+    /**
+     * Changed each time a node is put in or taken out of the store,
+     * changes of reach or version do not count.
+     */
+    uint32_t generation;
+
     struct Address* selfAddress;
 
     struct Node_Two* selfNode;
@@ -41,7 +47,8 @@ struct NodeStore
  * Create a new NodeStore.
  *
  * @param myAddress the address for this DHT node.
- * @param capacity the number of nodes which this store can hold.
+ * @param capacity the number of nodes which this store can hold, the table grows up to this size
+ *                 as nodes are discovered.
  * @param allocator the allocator to allocate storage space for this NodeStore.
  * @param logger the means for this node store to log.
  */
@@ -51,6 +58,17 @@ struct NodeStore* NodeStore_new(struct Address* myAddress,
                                 struct Log* logger,
                                 struct Random* rand);
 
+/**
+ * Limit the memory used by the table of nodes, if it holds more nodes than fit in the budget,
+ * the ones with the least reach are removed. Once the table is full, newly discovered nodes
+ * replace the ones with the least reach.
+ *
+ * @param store the node store.
+ * @param bytes the budget in bytes.
+ * @return the number of nodes which the store can now hold.
+ */
+int NodeStore_setMemoryBudget(struct NodeStore* store, uint64_t bytes);
+
 /**
  * Discover a new node (or rediscover an existing one).
  *
@@ -69,6 +87,29 @@ struct Node_Two* NodeStore_discoverNode(struct NodeStore* nodeStore,
                                         struct EncodingScheme* scheme,
                                         int encodingFormNumber);
 
+/** A node to be discovered by NodeStore_discoverNodes(), see NodeStore_discoverNode(). */
+struct NodeStore_Discovery
+{
+    struct Address addr;
+    int64_t reachDiff;
+    uint32_t version;
+    struct EncodingScheme* scheme;
+    int encodingFormNumber;
+};
+
+/**
+ * Discover a batch of nodes, the same as NodeStore_discoverNode() for each of them but they
+ * are sorted by path first so that the walk along the path to a node is shared with the nodes
+ * which are behind it.
+ *
+ * @param nodeStore the store
+ * @param discoveries the nodes to discover, the array is reordered.
+ * @param count the number of discoveries.
+ */
+void NodeStore_discoverNodes(struct NodeStore* nodeStore,
+                             struct NodeStore_Discovery* discoveries,
+                             int count);
+
 struct Node_Two* NodeStore_getNode2(struct NodeStore* store, uint8_t addr[16]);
 struct Node_Link* NodeStore_getLink(struct NodeStore* nodeStore,
                                     uint8_t parent[16],
@@ -147,6 +188,34 @@ struct NodeList* NodeStore_getNodesByAddr(struct Address* address,
                                           struct Allocator* allocator,
                                           struct NodeStore* store);
 
+/**
+ * Check a Bloom filter of the addresses in the table, this takes one memory access and is for
+ * giving up early on a node which is not known.
+ *
+ * @param store the NodeStore to check.
+ * @param ip6 the address of the node.
+ * @return false if there is definitely no node with the address, true if there might be.
+ */
+bool NodeStore_mightHaveNode(struct NodeStore* store, uint8_t ip6[16]);
+
+/**
+ * Find paths to a node which do not share any link so that if one of them breaks the
+ * others can be used right away without waiting for a search.
+ * The paths are taken best first, by reach and then by the shortest label,
+ * and each further one must leave through a different interface and must not pass through any
+ * known node which an earlier one passes through. Paths with zero reach are not returned.
+ *
+ * @param address the Address of the node to find paths to.
+ * @param max the maximum number of paths to return.
+ * @param allocator the Allocator used to construct the NodeList.
+ * @param store the NodeStore to check.
+ * @return a NodeList* of up to max nodes, all with the given address, best path first.
+ */
+struct NodeList* NodeStore_getPaths(struct Address* address,
+                                    const uint32_t max,
+                                    struct Allocator* allocator,
+                                    struct NodeStore* store);
+
 /**
  * Get direct peers of this node.
  * Will get peers with switch labels XOR close to the provided label up to max number.
@@ -195,6 +264,18 @@ void NodeStore_updateReach(const struct Node* const node,
 
 int NodeStore_nonZeroNodes(struct NodeStore* nodeStore);
 
+/**
+ * Count the nodes with non-zero reach in part of the keyspace.
+ *
+ * @param firstPrefix the lowest address prefix (see Address_getPrefix()) to count.
+ * @param lastPrefix the highest address prefix to count.
+ * @param nodeStore the node store.
+ * @return the number of nodes with non-zero reach whose prefix is between the two, inclusive.
+ */
+int NodeStore_nonZeroNodesInRange(uint32_t firstPrefix,
+                                  uint32_t lastPrefix,
+                                  struct NodeStore* nodeStore);
+
 static inline uint32_t NodeStore_size(const struct NodeStore* const nodeStore)
 {
     return nodeStore->size;
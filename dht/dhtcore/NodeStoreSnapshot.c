@@ -0,0 +1,307 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/String.h"
+#include "crypto/AddressCalc.h"
+#include "dht/Address.h"
+#include "dht/dhtcore/Node.h"
+#include "dht/dhtcore/NodeStore.h"
+#include "dht/dhtcore/NodeStoreSnapshot.h"
+#include "dht/dhtcore/RouterModule.h"
+#include "memory/Allocator.h"
+#include "switch/LabelSplicer.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
+#include "util/Identity.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/log/Log.h"
+
+#include <stdio.h>
+
+#define MAGIC "cjdnsNS1"
+#define HEADER_SIZE 16
+#define ENTRY_SIZE (Address_SERIALIZED_SIZE + 8)
+
+/** Snapshots claiming more entries than this are considered corrupt. */
+#define MAX_ENTRIES (1 << 16)
+
+/** Loaded nodes are pinged this many at a time. */
+#define PINGS_PER_INTERVAL 8
+#define PING_INTERVAL_MILLISECONDS 250
+
+/** A node which was loaded and still needs to be pinged. */
+struct ToPing
+{
+    uint64_t path;
+    uint32_t reach;
+};
+
+/** Ping the nodes which had the best reach first. */
+static inline int compareToPing(const struct ToPing* a, const struct ToPing* b)
+{
+    return (a->reach < b->reach) ? 1 : (a->reach > b->reach) ? -1 : 0;
+}
+
+#define Order_NAME OfToPing
+#define Order_TYPE struct ToPing
+#define Order_COMPARE compareToPing
+#include "util/Order.h"
+
+struct NodeStoreSnapshot
+{
+    /** The snapshot and the file which each save is written to before it is renamed over it. */
+    String* path;
+    String* tempPath;
+
+    struct NodeStore* store;
+    struct RouterModule* router;
+    struct Log* logger;
+
+    /** Nodes from the snapshot waiting to be pinged, freed once they all have been. */
+    struct ToPing* toPing;
+    int toPingCount;
+    int nextToPing;
+    struct Allocator* pingAlloc;
+
+    int loaded;
+
+    Identity
+};
+
+static void pingLoaded(void* vsnapshot)
+{
+    struct NodeStoreSnapshot* snapshot =
+        Identity_cast((struct NodeStoreSnapshot*) vsnapshot);
+
+    for (int i = 0; i < PINGS_PER_INTERVAL && snapshot->nextToPing < snapshot->toPingCount; i++) {
+        uint64_t path = snapshot->toPing[snapshot->nextToPing++].path;
+        struct Node* node = RouterModule_getNode(path, snapshot->router);
+        // It may have been replaced or already answered something else.
+        if (node && node->reach == 0) {
+            RouterModule_pingNode(node, 0, snapshot->router, snapshot->pingAlloc);
+        }
+    }
+    if (snapshot->nextToPing >= snapshot->toPingCount) {
+        Allocator_free(snapshot->pingAlloc);
+        snapshot->pingAlloc = NULL;
+        snapshot->toPing = NULL;
+    }
+}
+
+static uint32_t readInt(uint8_t* bytes)
+{
+    uint32_t number_be;
+    Bits_memcpyConst(&number_be, bytes, 4);
+    return Endian_bigEndianToHost32(number_be);
+}
+
+static void writeInt(uint8_t* bytes, uint32_t number)
+{
+    uint32_t number_be = Endian_hostToBigEndian32(number);
+    Bits_memcpyConst(bytes, &number_be, 4);
+}
+
+static void load(struct NodeStoreSnapshot* snapshot,
+                 FILE* file,
+                 struct EventBase* base,
+                 struct Allocator* alloc)
+{
+    uint8_t header[HEADER_SIZE];
+    if (!file
+        || fread(header, HEADER_SIZE, 1, file) != 1
+        || Bits_memcmp(header, MAGIC, 8)
+        || readInt(&header[12]) != ENTRY_SIZE
+        || readInt(&header[8]) > MAX_ENTRIES)
+    {
+        Log_info(snapshot->logger, "No usable routing table snapshot, starting empty");
+        return;
+    }
+
+    uint32_t count = readInt(&header[8]);
+    snapshot->pingAlloc = Allocator_child(alloc);
+    snapshot->toPing = Allocator_malloc(snapshot->pingAlloc, sizeof(struct ToPing) * (count + 1));
+
+    // NodeStore drops nodes with no known peer behind them so the peers go in first.
+    for (int peers = 1; peers >= 0; peers--) {
+        if (fseek(file, HEADER_SIZE, SEEK_SET)) {
+            break;
+        }
+        uint8_t entry[ENTRY_SIZE];
+        for (uint32_t i = 0; i < count && fread(entry, ENTRY_SIZE, 1, file) == 1; i++) {
+            struct Address addr;
+            Address_parse(&addr, entry);
+            Address_getPrefix(&addr);
+            if (!addr.path
+                || LabelSplicer_isOneHop(addr.path) != peers
+                || !AddressCalc_validAddress(addr.ip6.bytes))
+            {
+                continue;
+            }
+            uint32_t version = readInt(&entry[Address_SERIALIZED_SIZE]);
+
+            // Not trusted until it answers a ping.
+            if (!NodeStore_addNode(snapshot->store, &addr, 0, version)) {
+                continue;
+            }
+            snapshot->toPing[snapshot->toPingCount++] = (struct ToPing) {
+                .path = addr.path,
+                .reach = readInt(&entry[Address_SERIALIZED_SIZE + 4])
+            };
+        }
+    }
+    snapshot->loaded = snapshot->toPingCount;
+    Log_info(snapshot->logger, "Loaded [%d] nodes from routing table snapshot", snapshot->loaded);
+
+    if (!snapshot->toPingCount) {
+        Allocator_free(snapshot->pingAlloc);
+        snapshot->pingAlloc = NULL;
+        snapshot->toPing = NULL;
+        return;
+    }
+    Order_OfToPing_qsort(snapshot->toPing, snapshot->toPingCount);
+    Timeout_setInterval(pingLoaded,
+                        snapshot,
+                        PING_INTERVAL_MILLISECONDS,
+                        base,
+                        snapshot->pingAlloc);
+}
+
+/** @return the number of nodes written or -1 if writing failed. */
+static int writeTable(struct NodeStoreSnapshot* snapshot, FILE* file)
+{
+    uint8_t header[HEADER_SIZE];
+    Bits_memcpyConst(header, MAGIC, 8);
+    writeInt(&header[12], ENTRY_SIZE);
+
+    // Write the entries and then go back and fill in the count.
+    if (fseek(file, HEADER_SIZE, SEEK_SET)) {
+        return -1;
+    }
+    uint32_t count = 0;
+    struct Node* node;
+    for (uint32_t i = 0; (node = NodeStore_dumpTable(snapshot->store, i)) != NULL; i++) {
+        // Nodes with zero reach are probably gone, they would only slow the next start.
+        if (node->reach == 0) {
+            continue;
+        }
+        uint8_t entry[ENTRY_SIZE];
+        Address_serialize(entry, &node->address);
+        writeInt(&entry[Address_SERIALIZED_SIZE], node->version);
+        writeInt(&entry[Address_SERIALIZED_SIZE + 4], node->reach);
+        if (fwrite(entry, ENTRY_SIZE, 1, file) != 1) {
+            return -1;
+        }
+        count++;
+    }
+    writeInt(&header[8], count);
+    if (fseek(file, 0, SEEK_SET)
+        || fwrite(header, HEADER_SIZE, 1, file) != 1
+        || fflush(file))
+    {
+        return -1;
+    }
+    return count;
+}
+
+/** See: NodeStoreSnapshot.h */
+int NodeStoreSnapshot_save(struct NodeStoreSnapshot* snapshot)
+{
+    // A new file is renamed over the old one so a crash while writing leaves the last snapshot
+    // whole and a smaller table leaves nothing of a bigger one at the end.
+    FILE* file = fopen(snapshot->tempPath->bytes, "wb");
+    if (!file) {
+        return -1;
+    }
+    int count = writeTable(snapshot, file);
+    if (fclose(file) || count < 0) {
+        remove(snapshot->tempPath->bytes);
+        return -1;
+    }
+    #ifdef win32
+        // Windows will not rename over a file which exists.
+        remove(snapshot->path->bytes);
+    #endif
+    if (rename(snapshot->tempPath->bytes, snapshot->path->bytes)) {
+        remove(snapshot->tempPath->bytes);
+        return -1;
+    }
+    return count;
+}
+
+static void saveCycle(void* vsnapshot)
+{
+    struct NodeStoreSnapshot* snapshot =
+        Identity_cast((struct NodeStoreSnapshot*) vsnapshot);
+    if (NodeStoreSnapshot_save(snapshot) < 0) {
+        Log_warn(snapshot->logger, "Failed to write routing table snapshot");
+    }
+}
+
+static int onFree(struct Allocator_OnFreeJob* job)
+{
+    struct NodeStoreSnapshot* snapshot =
+        Identity_cast((struct NodeStoreSnapshot*) job->userData);
+    saveCycle(snapshot);
+    return 0;
+}
+
+/** See: NodeStoreSnapshot.h */
+int NodeStoreSnapshot_loaded(struct NodeStoreSnapshot* snapshot)
+{
+    return snapshot->loaded;
+}
+
+/** See: NodeStoreSnapshot.h */
+struct NodeStoreSnapshot* NodeStoreSnapshot_new(char* path,
+                                                struct NodeStore* nodeStore,
+                                                struct RouterModule* router,
+                                                struct EventBase* base,
+                                                struct Log* logger,
+                                                struct Allocator* alloc)
+{
+    // Check that saving will work before any nodes are loaded.
+    String* tempPath = String_printf(alloc, "%s.tmp", path);
+    FILE* file = fopen(tempPath->bytes, "wb");
+    if (!file) {
+        Log_warn(logger, "Unable to write routing table snapshot [%s]", tempPath->bytes);
+        return NULL;
+    }
+    fclose(file);
+    remove(tempPath->bytes);
+
+    struct NodeStoreSnapshot* snapshot =
+        Allocator_clone(alloc, (&(struct NodeStoreSnapshot) {
+            .path = String_new(path, alloc),
+            .tempPath = tempPath,
+            .store = nodeStore,
+            .router = router,
+            .logger = logger
+        }));
+    Identity_set(snapshot);
+
+    file = fopen(path, "rb");
+    load(snapshot, file, base, alloc);
+    if (file) {
+        fclose(file);
+    }
+
+    Timeout_setInterval(saveCycle,
+                        snapshot,
+                        NodeStoreSnapshot_SAVE_INTERVAL_MILLISECONDS,
+                        base,
+                        alloc);
+    Allocator_onFree(alloc, onFree, snapshot);
+    return snapshot;
+}
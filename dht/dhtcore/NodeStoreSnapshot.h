@@ -0,0 +1,73 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NodeStoreSnapshot_H
+#define NodeStoreSnapshot_H
+
+#include "dht/dhtcore/NodeStore.h"
+#include "dht/dhtcore/RouterModule.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/log/Log.h"
+#include "util/Linker.h"
+Linker_require("dht/dhtcore/NodeStoreSnapshot.c")
+
+#include <stdint.h>
+
+/**
+ * A copy of the routing table on disk so that a restarted node does not have to rediscover
+ * the network from nothing.
+ *
+ * The file is a 16 byte header: the magic "cjdnsNS1", the number of entries and the size of
+ * each entry, followed by fixed size entries, the 40 byte serialized address (key and path),
+ * the protocol version and the reach, all numbers big endian.
+ */
+struct NodeStoreSnapshot;
+
+/** How often the table is written to the snapshot. */
+#define NodeStoreSnapshot_SAVE_INTERVAL_MILLISECONDS 60000
+
+/**
+ * Load the nodes in a snapshot into the store and begin saving the store to it periodically.
+ * The nodes are inserted with zero reach and pinged a few at a time so they are only routed
+ * through once they prove they are still there.
+ * Each save writes path.tmp and renames it over the snapshot, so the directory must stay
+ * writable after Security_dropPermissions().
+ *
+ * @param path the snapshot file, it will be created by the first save if it does not exist.
+ * @param nodeStore the store to load into and save.
+ * @param router used to ping the loaded nodes.
+ * @param base the event base.
+ * @param logger
+ * @param alloc freeing this saves the snapshot one last time.
+ * @return the snapshot or NULL if the snapshot could not be written.
+ */
+struct NodeStoreSnapshot* NodeStoreSnapshot_new(char* path,
+                                                struct NodeStore* nodeStore,
+                                                struct RouterModule* router,
+                                                struct EventBase* base,
+                                                struct Log* logger,
+                                                struct Allocator* alloc);
+
+/** @return the number of nodes which were loaded from the snapshot. */
+int NodeStoreSnapshot_loaded(struct NodeStoreSnapshot* snapshot);
+
+/**
+ * Write the table to the snapshot now.
+ *
+ * @return the number of nodes written or -1 if writing failed.
+ */
+int NodeStoreSnapshot_save(struct NodeStoreSnapshot* snapshot);
+
+#endif
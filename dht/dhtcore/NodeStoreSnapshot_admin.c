@@ -0,0 +1,99 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "dht/dhtcore/NodeStoreSnapshot.h"
+#include "dht/dhtcore/NodeStoreSnapshot_admin.h"
+#include "memory/Allocator.h"
+#include "util/Identity.h"
+
+struct Context {
+    struct Admin* admin;
+    struct Allocator* alloc;
+    struct NodeStore* store;
+    struct RouterModule* router;
+    struct EventBase* base;
+    struct Log* logger;
+    struct NodeStoreSnapshot* snapshot;
+    Identity
+};
+
+static void openSnapshot(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    String* path = Dict_getString(args, String_CONST("path"));
+    Dict* response = Dict_new(alloc);
+    char* err = "none";
+    if (ctx->snapshot) {
+        err = "a snapshot is already open";
+    } else if (!(ctx->snapshot = NodeStoreSnapshot_new(path->bytes,
+                                                       ctx->store,
+                                                       ctx->router,
+                                                       ctx->base,
+                                                       ctx->logger,
+                                                       ctx->alloc)))
+    {
+        err = "unable to open file";
+    } else {
+        Dict_putInt(response,
+                    String_new("loaded", alloc),
+                    NodeStoreSnapshot_loaded(ctx->snapshot),
+                    alloc);
+    }
+    Dict_putString(response, String_new("error", alloc), String_new(err, alloc), alloc);
+    Admin_sendMessage(response, txid, ctx->admin);
+}
+
+static void saveSnapshot(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    Dict* response = Dict_new(alloc);
+    char* err = "none";
+    int saved;
+    if (!ctx->snapshot) {
+        err = "no snapshot is open";
+    } else if ((saved = NodeStoreSnapshot_save(ctx->snapshot)) < 0) {
+        err = "failed to write snapshot";
+    } else {
+        Dict_putInt(response, String_new("saved", alloc), saved, alloc);
+    }
+    Dict_putString(response, String_new("error", alloc), String_new(err, alloc), alloc);
+    Admin_sendMessage(response, txid, ctx->admin);
+}
+
+void NodeStoreSnapshot_admin_register(struct NodeStore* nodeStore,
+                                      struct RouterModule* router,
+                                      struct EventBase* base,
+                                      struct Log* logger,
+                                      struct Admin* admin,
+                                      struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .admin = admin,
+        .alloc = alloc,
+        .store = nodeStore,
+        .router = router,
+        .base = base,
+        .logger = logger
+    }));
+    Identity_set(ctx);
+
+    Admin_registerFunction("NodeStoreSnapshot_open", openSnapshot, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "path", .required = 1, .type = "String" }
+        }), admin);
+    Admin_registerFunction("NodeStoreSnapshot_save", saveSnapshot, ctx, true, NULL, admin);
+}
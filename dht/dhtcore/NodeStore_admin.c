@@ -18,12 +18,15 @@
 #include "benc/Dict.h"
 #include "benc/String.h"
 #include "benc/Int.h"
+#include "benc/serialization/standard/BencWriter.h"
 #include "crypto/Key.h"
 #include "dht/dhtcore/Node.h"
 #include "dht/dhtcore/NodeStore.h"
 #include "dht/dhtcore/NodeStore_admin.h"
+#include "io/ArrayWriter.h"
 #include "memory/Allocator.h"
 #include "switch/EncodingScheme.h"
+#include "util/events/Timeout.h"
 #include "util/version/Version.h"
 #include "util/platform/libc/string.h"
 
@@ -31,6 +34,7 @@ struct Context {
     struct Admin* admin;
     struct Allocator* alloc;
     struct NodeStore* store;
+    struct EventBase* eventBase;
     Identity
 };
 
@@ -101,6 +105,113 @@ static void dumpTable(Dict* args, void* vcontext, String* txid, struct Allocator
     dumpTable_addEntries(ctx, i, 0, NULL, txid);
 }
 
+/** Entries in each frame of a streamed table and the time between frames. */
+#define STREAM_ENTRIES_PER_FRAME 32
+#define STREAM_INTERVAL_MILLISECONDS 5
+#define STREAM_FRAME_SIZE 8192
+
+struct Stream
+{
+    struct Context* ctx;
+
+    /** The txid of the request, the frames are asynchronous messages so it must be kept. */
+    String* txid;
+
+    /** Index of the next node to send, the self route comes after the last one. */
+    uint32_t next;
+    int page;
+
+    struct Timeout* timeout;
+    struct Allocator* alloc;
+    Identity
+};
+
+/**
+ * Send the next STREAM_ENTRIES_PER_FRAME entries of the table, serialized straight out of the
+ * store with a BencWriter rather than through a Dict.
+ */
+static void streamFrame(void* vStream)
+{
+    struct Stream* stream = Identity_cast((struct Stream*) vStream);
+    struct NodeStore* store = stream->ctx->store;
+
+    // the self route is synthetic so add 1 to the count.
+    int left = (stream->next < (uint32_t)store->size) ? store->size - stream->next + 1 : 1;
+    bool more = left > STREAM_ENTRIES_PER_FRAME;
+
+    uint8_t frame[STREAM_FRAME_SIZE];
+    struct Allocator* alloc = Allocator_child(stream->alloc);
+    struct Writer* w = ArrayWriter_new(frame, STREAM_FRAME_SIZE, alloc);
+    BencWriter_beginDict(w);
+    if (more) {
+        BencWriter_cstring(w, "more");
+        BencWriter_int(w, 1);
+    } else {
+        BencWriter_cstring(w, "count");
+        BencWriter_int(w, store->size + 1);
+    }
+    BencWriter_cstring(w, "page");
+    BencWriter_int(w, stream->page++);
+    BencWriter_cstring(w, "routingTable");
+    BencWriter_beginList(w);
+
+    uint8_t ip[40];
+    uint8_t path[20];
+    for (int i = 0; i < left && i < STREAM_ENTRIES_PER_FRAME; i++) {
+        uint32_t link = 0xFFFFFFFF;
+        int version = Version_CURRENT_PROTOCOL;
+        if (stream->next < (uint32_t)store->size) {
+            struct Node* n = NodeStore_dumpTable(store, stream->next++);
+            Address_printIp(ip, &n->address);
+            AddrTools_printPath(path, n->address.path);
+            link = n->reach;
+            version = n->version;
+        } else {
+            Address_printIp(ip, store->selfAddress);
+            strcpy((char*)path, "0000.0000.0000.0001");
+        }
+        BencWriter_beginDict(w);
+        BencWriter_cstring(w, "ip");
+        BencWriter_bytes(w, ip, 39);
+        BencWriter_cstring(w, "link");
+        BencWriter_int(w, link);
+        BencWriter_cstring(w, "path");
+        BencWriter_bytes(w, path, 19);
+        BencWriter_cstring(w, "version");
+        BencWriter_int(w, version);
+        BencWriter_end(w);
+    }
+    BencWriter_end(w);
+    // a full frame of entries fits with room to spare.
+    Assert_always(!BencWriter_end(w));
+
+    int ret = Admin_sendSerialized(frame, Writer_bytesWritten(w), stream->txid, stream->ctx->admin);
+    Allocator_free(alloc);
+    if (ret || !more) {
+        Allocator_free(stream->alloc);
+    }
+}
+
+static void streamTable(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    struct Allocator* alloc = Allocator_child(ctx->alloc);
+    struct Stream* stream = Allocator_clone(alloc, (&(struct Stream) {
+        .ctx = ctx,
+        .txid = String_clone(txid, alloc),
+        .alloc = alloc
+    }));
+    Identity_set(stream);
+    stream->timeout = Timeout_setInterval(streamFrame,
+                                          stream,
+                                          STREAM_INTERVAL_MILLISECONDS,
+                                          ctx->eventBase,
+                                          alloc);
+
+    // The first frame goes out right away as the answer to the request.
+    streamFrame(stream);
+}
+
 static bool isOneHop(struct Node_Link* link)
 {
     struct EncodingScheme* ps = link->parent->encodingScheme;
@@ -246,14 +357,34 @@ static void getRouteLabel(Dict* args, void* vcontext, String* txid, struct Alloc
     }
 }
 
+static void setMemoryBudget(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    int64_t* bytes = Dict_getInt(args, String_CONST("bytes"));
+    Dict* response = Dict_new(alloc);
+    if (*bytes < 0) {
+        Dict_putString(response,
+                       String_new("error", alloc),
+                       String_new("bytes must not be negative", alloc),
+                       alloc);
+    } else {
+        int capacity = NodeStore_setMemoryBudget(ctx->store, *bytes);
+        Dict_putInt(response, String_new("capacity", alloc), capacity, alloc);
+        Dict_putString(response, String_new("error", alloc), String_new("none", alloc), alloc);
+    }
+    Admin_sendMessage(response, txid, ctx->admin);
+}
+
 void NodeStore_admin_register(struct NodeStore* nodeStore,
                               struct Admin* admin,
+                              struct EventBase* eventBase,
                               struct Allocator* alloc)
 {
     struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
         .admin = admin,
         .alloc = alloc,
-        .store = nodeStore
+        .store = nodeStore,
+        .eventBase = eventBase
     }));
     Identity_set(ctx);
 
@@ -262,6 +393,8 @@ void NodeStore_admin_register(struct NodeStore* nodeStore,
             { .name = "page", .required = 1, .type = "Int" },
         }), admin);
 
+    Admin_registerFunction("NodeStore_streamTable", streamTable, ctx, true, NULL, admin);
+
     Admin_registerFunction("NodeStore_getLink", getLink, ctx, true,
         ((struct Admin_FunctionArg[]) {
             { .name = "parent", .required = 1, .type = "String" },
@@ -271,6 +404,10 @@ void NodeStore_admin_register(struct NodeStore* nodeStore,
         ((struct Admin_FunctionArg[]) {
             { .name = "ip", .required = 0, .type = "String" },
         }), admin);
+    Admin_registerFunction("NodeStore_setMemoryBudget", setMemoryBudget, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "bytes", .required = 1, .type = "Int" },
+        }), admin);
     Admin_registerFunction("NodeStore_getRouteLabel", getRouteLabel, ctx, true,
         ((struct Admin_FunctionArg[]) {
             { .name = "pathToParent", .required = 1, .type = "String" },
@@ -67,51 +67,56 @@ static void noPeers(void* vtrace)
     } while (0)
 // CHECKFILES_IGNORE expecting a ;
 
-static void traceStep(struct RouteTracer_Trace* trace, struct Node* next);
-
-static void responseCallback(struct RouterModule_Promise* promise,
-                             uint32_t lagMilliseconds,
-                             struct Node* fromNode,
-                             Dict* result)
+/**
+ * Add the nodes from a getPeers reply to the NodeStore.
+ *
+ * @param ctx the tracer.
+ * @param fromNode the node which sent the reply.
+ * @param result the reply.
+ * @param alloc the allocator to get the list from.
+ * @return a list of the nodes which were added or NULL if the reply was not understood.
+ */
+static struct NodeList* nodesFromReply(struct RouteTracer_pvt* ctx,
+                                       struct Node* fromNode,
+                                       Dict* result,
+                                       struct Allocator* alloc)
 {
-    struct RouteTracer_Trace* trace = Identity_cast((struct RouteTracer_Trace*)promise->userData);
-    struct RouteTracer_pvt* ctx = Identity_cast((struct RouteTracer_pvt*)trace->tracer);
-    if (!fromNode) {
-        // trace has stalled.
-        log(ctx->logger, trace, "STALLED request timed out");
-        noPeers(trace);
-        return;
-    }
-
-    if (trace->pub.callback) {
-        trace->pub.callback(&trace->pub, lagMilliseconds, fromNode, result);
-    }
-
     String* nodes = Dict_getString(result, CJDHTConstants_NODES);
 
     if (nodes && (nodes->len == 0 || nodes->len % Address_SERIALIZED_SIZE != 0)) {
-        log(ctx->logger, trace, "STALLED dropping unrecognized reply");
-        noPeers(trace);
-        return;
+        return NULL;
     }
 
-    struct VersionList* versions = NULL;
+    struct NodeList* out = Allocator_calloc(alloc, sizeof(struct NodeList), 1);
+    if (!nodes) {
+        return out;
+    }
+    out->nodes = Allocator_calloc(alloc, sizeof(char*), nodes->len / Address_SERIALIZED_SIZE);
+
+    struct VersionList_View versions = { .length = 0 };
     String* versionsStr = Dict_getString(result, CJDHTConstants_NODE_PROTOCOLS);
     if (versionsStr) {
-        versions = VersionList_parse(versionsStr, promise->alloc);
+        VersionList_view(&versions, versionsStr);
         #ifdef Version_1_COMPAT
             // Version 1 lies about the versions of other nodes, assume they're all v1.
             if (fromNode->version < 2) {
-                for (int i = 0; i < (int)versions->length; i++) {
-                    versions->versions[i] = 1;
-                }
+                versions.length = 0;
             }
         #endif
     }
 
-    struct Node* next = NULL;
+    // We need to splice the given addresses on to the end of the
+    // address of the node which gave them to us.
+    int count = nodes->len / Address_SERIALIZED_SIZE;
+    uint64_t* paths = Allocator_malloc(alloc, count * sizeof(uint64_t));
+    for (int i = 0; i < count; i++) {
+        uint8_t* path = (uint8_t*) &nodes->bytes[i * Address_SERIALIZED_SIZE + Address_KEY_SIZE];
+        Bits_memcpyConst(&paths[i], path, 8);
+        paths[i] = Endian_bigEndianToHost64(paths[i]);
+    }
+    LabelSplicer_spliceAll(paths, paths, count, fromNode->address.path);
 
-    for (uint32_t i = 0; nodes && i < nodes->len; i += Address_SERIALIZED_SIZE) {
+    for (uint32_t i = 0; i < nodes->len; i += Address_SERIALIZED_SIZE) {
 
         struct Address addr;
         Address_parse(&addr, (uint8_t*) &nodes->bytes[i]);
@@ -119,21 +124,13 @@ static void responseCallback(struct RouterModule_Promise* promise,
         // calculate the ipv6
         Address_getPrefix(&addr);
 
-        // We need to splice the given address on to the end of the
-        // address of the node which gave it to us.
-        addr.path = LabelSplicer_splice(addr.path, fromNode->address.path);
+        addr.path = paths[i / Address_SERIALIZED_SIZE];
 
         if (addr.path == UINT64_MAX) {
-            log(ctx->logger, trace, "dropping node because route could not be spliced");
+            Log_debug(ctx->logger, "dropping node because route could not be spliced");
             continue;
         }
 
-        /*#ifdef Log_DEBUG
-            uint8_t printedAddr[60];
-            Address_print(printedAddr, &addr);
-            Log_debug(ctx->logger, "discovered node [%s]", printedAddr);
-        #endif*/
-
         if (!Bits_memcmp(ctx->myAddress, addr.ip6.bytes, 16)) {
             // Any path which loops back through us is necessarily a dead route.
             uint8_t printedAddr[60];
@@ -144,18 +141,39 @@ static void responseCallback(struct RouterModule_Promise* promise,
         }
 
         if (!AddressCalc_validAddress(addr.ip6.bytes)) {
-            log(ctx->logger, trace, "was told garbage");
+            Log_debug(ctx->logger, "was told garbage");
             // This should never happen, badnode.
             break;
         }
 
         // Nodes we are told about are inserted with 0 reach and assumed version 1.
-        uint32_t version = (versions) ? versions->versions[i / Address_SERIALIZED_SIZE] : 1;
+        uint32_t version = VersionList_viewVersion(&versions, i / Address_SERIALIZED_SIZE);
+        version = (version) ? version : 1;
         struct Node* n = NodeStore_addNode(ctx->nodeStore, &addr, 0, version);
 
-        if (!n) {
-            // incompatible version, introduced to ourselves...
-        } else if (!LabelSplicer_routesThrough(trace->target, n->address.path)) {
+        if (n) {
+            out->nodes[out->size++] = n;
+        }
+        // else incompatible version, introduced to ourselves...
+    }
+
+    return out;
+}
+
+/**
+ * Choose the node from a reply which takes the trace the furthest ahead by the smallest step.
+ *
+ * @param target the route being traced.
+ * @param fromNode the node which sent the reply.
+ * @param nodes the nodes in the reply.
+ * @return the next node to ask or NULL if no node in the reply is further along the route.
+ */
+static struct Node* nextHop(uint64_t target, struct Node* fromNode, struct NodeList* nodes)
+{
+    struct Node* next = NULL;
+    for (uint32_t i = 0; i < nodes->size; i++) {
+        struct Node* n = nodes->nodes[i];
+        if (!LabelSplicer_routesThrough(target, n->address.path)) {
             // not on the way
         } else  if (n->address.path <= fromNode->address.path) {
             // losing ground
@@ -165,6 +183,105 @@ static void responseCallback(struct RouterModule_Promise* promise,
             next = n;
         }
     }
+    return next;
+}
+
+/** Ask a node on the way to a route for its peers which are on the rest of the way. */
+static void sendGetPeers(struct RouteTracer_pvt* ctx,
+                         struct Node* next,
+                         uint64_t target,
+                         void (* callback)(struct RouterModule_Promise* promise,
+                                           uint32_t lag,
+                                           struct Node* fromNode,
+                                           Dict* result),
+                         void* userData,
+                         struct Allocator* alloc)
+{
+    Assert_true(LabelSplicer_routesThrough(target, next->address.path));
+
+    struct RouterModule_Promise* rp = RouterModule_newMessage(next, 0, ctx->router, alloc);
+
+    Dict* message = Dict_new(rp->alloc);
+
+    #ifdef Version_4_COMPAT
+        if (next->version < 5) {
+            // The node doesn't support the new API so try running a search for
+            // the bitwise complement of their address to get some peers.
+            Dict_putString(message, CJDHTConstants_QUERY, CJDHTConstants_QUERY_FN, rp->alloc);
+            String* notAddr = String_newBinary((char*)next->address.ip6.bytes, 16, rp->alloc);
+            for (int i = 0; i < 16; i++) {
+                notAddr->bytes[i] ^= 0xff;
+            }
+            Dict_putString(message, CJDHTConstants_TARGET, notAddr, rp->alloc);
+            Log_debug(ctx->logger,
+                      "Sending legacy search method because getpeers is unavailable");
+        } else {
+    #endif
+
+    Dict_putString(message, CJDHTConstants_QUERY, CJDHTConstants_QUERY_GP, rp->alloc);
+    uint64_t labelForThem = LabelSplicer_unsplice(target, next->address.path);
+    labelForThem = Endian_hostToBigEndian64(labelForThem);
+    String* targetStr = String_newBinary((char*)&labelForThem, 8, rp->alloc);
+    Dict_putString(message, CJDHTConstants_TARGET, targetStr, rp->alloc);
+
+    #ifdef Version_4_COMPAT
+        }
+    #endif
+
+    rp->userData = userData;
+    rp->callback = callback;
+
+    RouterModule_sendMessage(rp, message);
+}
+
+/**
+ * Find the direct peer which is the first hop of a route.
+ *
+ * @return the peer or NULL if no peer is known to be on the route.
+ */
+static struct Node* firstHop(struct RouteTracer_pvt* ctx, uint64_t route, struct Allocator* alloc)
+{
+    struct NodeList* peers = NodeStore_getPeers(route, 1, alloc, ctx->nodeStore);
+
+    struct Node* n = (peers->size > 0) ? peers->nodes[0] : NULL;
+    if (n && !LabelSplicer_routesThrough(route, n->address.path)) {
+        n = NULL;
+    }
+
+    // Sanity check
+    Assert_always(!n || n->address.path != 0);
+    return n;
+}
+
+static void traceStep(struct RouteTracer_Trace* trace, struct Node* next);
+
+static void responseCallback(struct RouterModule_Promise* promise,
+                             uint32_t lagMilliseconds,
+                             struct Node* fromNode,
+                             Dict* result)
+{
+    struct RouteTracer_Trace* trace = Identity_cast((struct RouteTracer_Trace*)promise->userData);
+    struct RouteTracer_pvt* ctx = Identity_cast((struct RouteTracer_pvt*)trace->tracer);
+    if (!fromNode) {
+        // trace has stalled.
+        log(ctx->logger, trace, "STALLED request timed out");
+        noPeers(trace);
+        return;
+    }
+
+    if (trace->pub.callback) {
+        trace->pub.callback(&trace->pub, lagMilliseconds, fromNode, result);
+    }
+
+    struct NodeList* nodes = nodesFromReply(ctx, fromNode, result, promise->alloc);
+
+    if (!nodes) {
+        log(ctx->logger, trace, "STALLED dropping unrecognized reply");
+        noPeers(trace);
+        return;
+    }
+
+    struct Node* next = nextHop(trace->target, fromNode, nodes);
 
     if (fromNode->address.path == trace->target) {
         log(ctx->logger, trace, "Trace completed successfully");
@@ -172,7 +289,7 @@ static void responseCallback(struct RouterModule_Promise* promise,
         return;
     }
 
-    if (!nodes) {
+    if (!nodes->size) {
         log(ctx->logger, trace, "No nodes in trace response");
     }
 
@@ -201,44 +318,10 @@ static void traceStep(struct RouteTracer_Trace* trace, struct Node* next)
         return;
     }
 
-    Assert_true(LabelSplicer_routesThrough(trace->target, next->address.path));
-
     trace->lastNodeAsked = next->address.path;
-
-    struct RouterModule_Promise* rp =
-        RouterModule_newMessage(next, 0, ctx->router, trace->pub.alloc);
-
-    Dict* message = Dict_new(rp->alloc);
-
-    #ifdef Version_4_COMPAT
-        if (next->version < 5) {
-            // The node doesn't support the new API so try running a search for
-            // the bitwise complement of their address to get some peers.
-            Dict_putString(message, CJDHTConstants_QUERY, CJDHTConstants_QUERY_FN, rp->alloc);
-            String* notAddr = String_newBinary((char*)next->address.ip6.bytes, 16, rp->alloc);
-            for (int i = 0; i < 16; i++) {
-                notAddr->bytes[i] ^= 0xff;
-            }
-            Dict_putString(message, CJDHTConstants_TARGET, notAddr, rp->alloc);
-            log(ctx->logger, trace, "Sending legacy search method because getpeers is unavailable");
-        } else {
-    #endif
-
-    Dict_putString(message, CJDHTConstants_QUERY, CJDHTConstants_QUERY_GP, rp->alloc);
-    uint64_t labelForThem = LabelSplicer_unsplice(trace->target, next->address.path);
-    labelForThem = Endian_hostToBigEndian64(labelForThem);
-    String* target = String_newBinary((char*)&labelForThem, 8, rp->alloc);
-    Dict_putString(message, CJDHTConstants_TARGET, target, rp->alloc);
     log(ctx->logger, trace, "Sending getpeers request");
 
-    #ifdef Version_4_COMPAT
-        }
-    #endif
-
-    rp->userData = trace;
-    rp->callback = responseCallback;
-
-    RouterModule_sendMessage(rp, message);
+    sendGetPeers(ctx, next, trace->target, responseCallback, trace, trace->pub.alloc);
 }
 
 struct RouterModule_Promise* RouteTracer_trace(uint64_t route,
@@ -256,19 +339,204 @@ struct RouterModule_Promise* RouteTracer_trace(uint64_t route,
     }));
     Identity_set(trace);
 
-    struct NodeList* firstHop = NodeStore_getPeers(route, 1, alloc, tracer->nodeStore);
+    traceStep(trace, firstHop(tracer, route, alloc));
 
-    struct Node* n = (firstHop->size > 0) ? firstHop->nodes[0] : NULL;
-    if (n && !LabelSplicer_routesThrough(trace->target, n->address.path)) {
-        n = NULL;
+    return &trace->pub;
+}
+
+struct RouteTracer_BatchPvt
+{
+    struct RouteTracer_Batch pub;
+    struct RouteTracer_pvt* tracer;
+
+    /** For each route, the path to the node which was last sent that route's own label. */
+    uint64_t* lastAskedFor;
+
+    int requestsInFlight;
+    Identity
+};
+
+/** A getPeers request which is shared by all of the routes which go through the node asked. */
+struct RouteTracer_Request
+{
+    struct RouteTracer_BatchPvt* batch;
+
+    /** Indexes of the routes which the request is for, the label of the first one is sent. */
+    int* routes;
+    int routeCount;
+
+    struct Allocator* alloc;
+    Identity
+};
+
+static void batchFinished(void* vbatch)
+{
+    struct RouteTracer_BatchPvt* batch = Identity_cast((struct RouteTracer_BatchPvt*)vbatch);
+    if (batch->pub.callback) {
+        batch->pub.callback(&batch->pub);
     }
+    Allocator_free(batch->pub.alloc);
+}
 
-    // Sanity check
-    Assert_always(!n || n->address.path != 0);
+static void addHop(struct RouteTracer_Route* route,
+                   struct Node* node,
+                   uint32_t lagMilliseconds,
+                   struct Allocator* alloc)
+{
+    // A node which is asked again for a route which parts from the others there replies twice.
+    if (route->hopCount && route->hops[route->hopCount - 1].address.path == node->address.path) {
+        return;
+    }
+    if (!(route->hopCount & (route->hopCount - 1))) {
+        // hopCount is zero or a power of 2, time to grow.
+        int size = (route->hopCount) ? route->hopCount * 2 : 4;
+        route->hops =
+            Allocator_realloc(alloc, route->hops, size * sizeof(struct RouteTracer_Hop));
+    }
+    struct RouteTracer_Hop* hop = &route->hops[route->hopCount++];
+    Bits_memcpyConst(&hop->address, &node->address, sizeof(struct Address));
+    hop->lagMilliseconds = lagMilliseconds;
+}
 
-    traceStep(trace, n);
+static void batchResponse(struct RouterModule_Promise* promise,
+                          uint32_t lagMilliseconds,
+                          struct Node* fromNode,
+                          Dict* result);
 
-    return &trace->pub;
+/**
+ * Send one request to each of the next nodes for all of the routes which go through it.
+ *
+ * @param batch the batch.
+ * @param routes indexes of the routes to continue.
+ * @param nexts the next node to ask for each route, NULL if the route has stalled.
+ * @param count the number of routes.
+ * @param tempAlloc an allocator which may be freed once this returns.
+ */
+static void batchStep(struct RouteTracer_BatchPvt* batch,
+                      int* routes,
+                      struct Node** nexts,
+                      int count,
+                      struct Allocator* tempAlloc)
+{
+    uint8_t* grouped = Allocator_calloc(tempAlloc, count + 1, 1);
+    for (int i = 0; i < count; i++) {
+        if (!nexts[i] || grouped[i]) {
+            continue;
+        }
+        struct Allocator* alloc = Allocator_child(batch->pub.alloc);
+        struct RouteTracer_Request* req =
+            Allocator_calloc(alloc, sizeof(struct RouteTracer_Request), 1);
+        req->batch = batch;
+        req->alloc = alloc;
+        req->routes = Allocator_malloc(alloc, (count - i) * sizeof(int));
+        Identity_set(req);
+
+        uint64_t nextPath = nexts[i]->address.path;
+        for (int j = i; j < count; j++) {
+            if (nexts[j] && nexts[j]->address.path == nextPath) {
+                grouped[j] = 1;
+                req->routes[req->routeCount++] = routes[j];
+            }
+        }
+
+        uint64_t target = batch->pub.routes[routes[i]].target;
+        batch->lastAskedFor[routes[i]] = nextPath;
+        batch->requestsInFlight++;
+        batch->pub.requests++;
+
+        #ifdef Log_DEBUG
+            uint8_t printedTarget[20];
+            uint8_t printedNext[20];
+            AddrTools_printPath(printedTarget, target);
+            AddrTools_printPath(printedNext, nextPath);
+            Log_debug(batch->tracer->logger, "tracing [%s] and [%d] other routes, asking [%s]",
+                      printedTarget, req->routeCount - 1, printedNext);
+        #endif
+
+        sendGetPeers(batch->tracer, nexts[i], target, batchResponse, req, alloc);
+    }
+
+    if (!batch->requestsInFlight) {
+        Timeout_setTimeout(batchFinished, batch, 0, batch->tracer->eventBase, batch->pub.alloc);
+    }
+}
+
+static void batchResponse(struct RouterModule_Promise* promise,
+                          uint32_t lagMilliseconds,
+                          struct Node* fromNode,
+                          Dict* result)
+{
+    struct RouteTracer_Request* req =
+        Identity_cast((struct RouteTracer_Request*)promise->userData);
+    struct RouteTracer_BatchPvt* batch = Identity_cast(req->batch);
+    struct RouteTracer_pvt* ctx = Identity_cast(batch->tracer);
+    batch->requestsInFlight--;
+
+    struct NodeList* nodes =
+        (fromNode) ? nodesFromReply(ctx, fromNode, result, promise->alloc) : NULL;
+
+    struct Node** nexts = Allocator_calloc(promise->alloc, sizeof(char*), req->routeCount);
+    for (int i = 0; nodes && i < req->routeCount; i++) {
+        struct RouteTracer_Route* route = &batch->pub.routes[req->routes[i]];
+        addHop(route, fromNode, lagMilliseconds, batch->pub.alloc);
+        if (fromNode->address.path == route->target) {
+            route->complete = 1;
+            continue;
+        }
+        nexts[i] = nextHop(route->target, fromNode, nodes);
+        if (!nexts[i] && batch->lastAskedFor[req->routes[i]] != fromNode->address.path) {
+            // The reply was for another route which parts from this one here,
+            // ask again for this one.
+            nexts[i] = fromNode;
+        }
+    }
+
+    if (!fromNode) {
+        Log_debug(ctx->logger, "STALLED [%d] routes, request timed out", req->routeCount);
+    } else if (!nodes) {
+        Log_debug(ctx->logger, "STALLED [%d] routes, dropping unrecognized reply",
+                  req->routeCount);
+    }
+
+    batchStep(batch, req->routes, nexts, req->routeCount, promise->alloc);
+
+    // If the batch is done it is freed on the next cycle along with this request.
+    if (batch->requestsInFlight) {
+        Allocator_free(req->alloc);
+    }
+}
+
+struct RouteTracer_Batch* RouteTracer_traceBatch(uint64_t* routes,
+                                                 int count,
+                                                 struct RouteTracer* routeTracer,
+                                                 struct Allocator* allocator)
+{
+    struct RouteTracer_pvt* tracer = Identity_cast((struct RouteTracer_pvt*)routeTracer);
+    struct Allocator* alloc = Allocator_child(allocator);
+    struct RouteTracer_BatchPvt* batch = Allocator_clone(alloc, (&(struct RouteTracer_BatchPvt) {
+        .tracer = tracer,
+        .pub = {
+            .routeCount = count,
+            .alloc = alloc
+        }
+    }));
+    Identity_set(batch);
+    batch->pub.routes = Allocator_calloc(alloc, sizeof(struct RouteTracer_Route), count + 1);
+    batch->lastAskedFor = Allocator_calloc(alloc, sizeof(uint64_t), count + 1);
+
+    struct Allocator* tempAlloc = Allocator_child(alloc);
+    int* indexes = Allocator_malloc(tempAlloc, count * sizeof(int) + 1);
+    struct Node** firstHops = Allocator_calloc(tempAlloc, sizeof(char*), count + 1);
+    for (int i = 0; i < count; i++) {
+        batch->pub.routes[i].target = routes[i];
+        indexes[i] = i;
+        firstHops[i] = firstHop(tracer, routes[i], tempAlloc);
+    }
+
+    batchStep(batch, indexes, firstHops, count, tempAlloc);
+
+    Allocator_free(tempAlloc);
+    return &batch->pub;
 }
 
 struct RouteTracer* RouteTracer_new(struct NodeStore* store,
@@ -15,6 +15,7 @@
 #ifndef RouteTracer_H
 #define RouteTracer_H
 
+#include "dht/Address.h"
 #include "dht/dhtcore/RouterModule.h"
 #include "dht/dhtcore/NodeStore.h"
 #include "util/log/Log.h"
@@ -40,6 +41,68 @@ struct RouterModule_Promise* RouteTracer_trace(uint64_t route,
                                                struct RouteTracer* rt,
                                                struct Allocator* allocator);
 
+/** A reply from one node along a traced route. */
+struct RouteTracer_Hop
+{
+    /** The node which replied. */
+    struct Address address;
+
+    /** How long the reply took. */
+    uint32_t lagMilliseconds;
+};
+
+/** The outcome of tracing one route of a batch. */
+struct RouteTracer_Route
+{
+    /** The route which was traced. */
+    uint64_t target;
+
+    /** The nodes which replied along the route, nearest first. */
+    struct RouteTracer_Hop* hops;
+    int hopCount;
+
+    /** Non-zero if the node at the end of the route replied. */
+    int complete;
+};
+
+struct RouteTracer_Batch
+{
+    /**
+     * Called once when every route in the batch has either completed or stalled,
+     * the batch is freed when this returns.
+     */
+    void (* callback)(struct RouteTracer_Batch* batch);
+
+    /** Free for use by the caller. */
+    void* userData;
+
+    /** The routes in the same order as they were given. */
+    struct RouteTracer_Route* routes;
+    int routeCount;
+
+    /** The number of requests which were sent for the whole batch. */
+    int requests;
+
+    /** Free this to cancel the batch. */
+    struct Allocator* alloc;
+};
+
+/**
+ * Trace many routes at once.
+ * The routes are traced together as a tree so a node which is on the way to more than one of
+ * them is asked only once and then the trace continues separately where the routes part.
+ * Results are kept in the batch and reported together when the last trace ends.
+ *
+ * @param routes the routes to trace.
+ * @param count the number of routes.
+ * @param tr the tracer
+ * @param allocator an allocator for the batch, free this to cancel it.
+ */
+struct RouteTracer_Batch* RouteTracer_traceBatch(uint64_t* routes,
+                                                 int count,
+                                                 struct RouteTracer* tr,
+                                                 struct Allocator* allocator);
+
 struct RouteTracer* RouteTracer_new(struct NodeStore* store,
                                     struct RouterModule* router,
                                     const uint8_t myAddress[16],
@@ -0,0 +1,162 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "dht/Address.h"
+#include "dht/dhtcore/Node.h"
+#include "dht/dhtcore/NodeStore.h"
+#include "dht/dhtcore/RouteTracer_admin.h"
+#include "dht/dhtcore/RouteTracer.h"
+#include "memory/Allocator.h"
+#include "util/AddrTools.h"
+
+// a route with a few hops is around 400 benc chars, keep the reply well under the limit.
+#define ROUTES_PER_PAGE 64
+
+struct Context {
+    struct Admin* admin;
+    struct Allocator* allocator;
+    struct RouteTracer* tracer;
+    struct NodeStore* store;
+    Identity
+};
+
+struct TraceRoutes
+{
+    String* txid;
+    struct Context* ctx;
+
+    /** Non-zero if there are more nodes in the table after the ones traced. */
+    int more;
+    Identity
+};
+
+static void tracesDone(struct RouteTracer_Batch* batch)
+{
+    struct TraceRoutes* tr = Identity_cast((struct TraceRoutes*)batch->userData);
+    struct Allocator* alloc = batch->alloc;
+
+    String* addrKey = String_CONST("addr");
+    String* ms = String_CONST("ms");
+    String* targetKey = String_CONST("target");
+    String* complete = String_CONST("complete");
+    String* hopsKey = String_CONST("hops");
+    String* more = String_CONST("more");
+
+    // Items are added to the front of a list so everything is walked backward.
+    List* routes = Allocator_calloc(alloc, sizeof(List), 1);
+    for (int i = batch->routeCount - 1; i >= 0; i--) {
+        struct RouteTracer_Route* route = &batch->routes[i];
+        List* hops = Allocator_calloc(alloc, sizeof(List), 1);
+        for (int j = route->hopCount - 1; j >= 0; j--) {
+            uint8_t addr[60];
+            Address_print(addr, &route->hops[j].address);
+            Dict* hop = Dict_new(alloc);
+            Dict_putString(hop, addrKey, String_new((char*)addr, alloc), alloc);
+            Dict_putInt(hop, ms, route->hops[j].lagMilliseconds, alloc);
+            List_addDict(hops, hop, alloc);
+        }
+        uint8_t target[20];
+        AddrTools_printPath(target, route->target);
+        Dict* r = Dict_new(alloc);
+        Dict_putString(r, targetKey, String_new((char*)target, alloc), alloc);
+        Dict_putInt(r, complete, route->complete, alloc);
+        Dict_putList(r, hopsKey, hops, alloc);
+        List_addDict(routes, r, alloc);
+    }
+
+    Dict* response = Dict_new(alloc);
+    Dict_putString(response, String_CONST("error"), String_CONST("none"), alloc);
+    Dict_putList(response, String_CONST("routes"), routes, alloc);
+    Dict_putInt(response, String_CONST("requests"), batch->requests, alloc);
+    if (tr->more) {
+        Dict_putInt(response, more, 1, alloc);
+    }
+    Admin_sendMessage(response, tr->txid, tr->ctx->admin);
+}
+
+static void traceRoutes(Dict* args, void* vctx, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vctx);
+    List* routeList = Dict_getList(args, String_CONST("routes"));
+    int64_t* page = Dict_getInt(args, String_CONST("page"));
+
+    uint64_t routes[ROUTES_PER_PAGE];
+    int count = 0;
+    int more = 0;
+    char* err = NULL;
+
+    if (routeList) {
+        for (int i = 0; i < List_size(routeList) && !err; i++) {
+            String* pathStr = List_getString(routeList, i);
+            if (count == ROUTES_PER_PAGE) {
+                err = "too many routes";
+            } else if (!pathStr
+                || pathStr->len != 19
+                || AddrTools_parsePath(&routes[count], (uint8_t*) pathStr->bytes))
+            {
+                err = "routes must be a list of 19 char paths eg: '0123.4567.89ab.cdef'";
+            } else {
+                count++;
+            }
+        }
+    } else {
+        // Without a list, trace the routes to a page of the nodes in the routing table.
+        uint32_t i = (page && *page > 0) ? *page * ROUTES_PER_PAGE : 0;
+        struct Node* n;
+        for (; count < ROUTES_PER_PAGE && (n = NodeStore_dumpTable(ctx->store, i)); i++) {
+            routes[count++] = n->address.path;
+        }
+        more = (NodeStore_dumpTable(ctx->store, i) != NULL);
+    }
+
+    if (err) {
+        Dict errDict = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(err)), NULL);
+        Admin_sendMessage(&errDict, txid, ctx->admin);
+        return;
+    }
+
+    struct RouteTracer_Batch* batch =
+        RouteTracer_traceBatch(routes, count, ctx->tracer, ctx->allocator);
+    struct TraceRoutes* tr = Allocator_calloc(batch->alloc, sizeof(struct TraceRoutes), 1);
+    Identity_set(tr);
+    tr->txid = String_clone(txid, batch->alloc);
+    tr->ctx = ctx;
+    tr->more = more;
+    batch->userData = tr;
+    batch->callback = tracesDone;
+}
+
+void RouteTracer_admin_register(struct RouteTracer* tracer,
+                                struct NodeStore* store,
+                                struct Admin* admin,
+                                struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .admin = admin,
+        .allocator = alloc,
+        .tracer = tracer,
+        .store = store
+    }));
+    Identity_set(ctx);
+
+    Admin_registerFunction("RouteTracer_traceRoutes", traceRoutes, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "routes", .required = 0, .type = "List" },
+            { .name = "page", .required = 0, .type = "Int" }
+        }), admin);
+}
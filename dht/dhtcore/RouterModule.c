@@ -173,6 +173,9 @@
 /** The minimum amount of time before a ping should timeout. */
 #define PING_TIMEOUT_MINIMUM 3000
 
+/** The number of times a node's retransmission timeout before pings to it should be timed out. */
+#define PING_TIMEOUT_RTO_MULTIPLIER 4
+
 /** You are not expected to understand this. */
 #define LINK_STATE_MULTIPLIER 536870
 
@@ -191,6 +194,22 @@
 /** Allow this many missed pings before we start zeroing reach, reduces lag spikes. */
 #define PING_GRACE_COUNT 2
 
+/**
+ * Gains for the round trip time estimator, as in RFC 6298, each is the log2 of the divisor
+ * so the smoothed rtt moves 1/8 and the variance 1/4 of the way toward each new sample.
+ */
+#define RTT_ALPHA_SHIFT 3
+#define RTT_BETA_SHIFT 2
+
+/**
+ * How long a reply to a query is reused for other askers, reach changes do not invalidate
+ * replies so this bounds how far they can lag behind the NodeStore.
+ */
+#define REPLY_CACHE_TTL_MILLISECONDS 1000
+
+/** The number of seconds of unused query budget which can be saved up for a burst. */
+#define QUERY_BUDGET_BURST_SECONDS 2
+
 /*--------------------Prototypes--------------------*/
 static int handleIncoming(struct DHTMessage* message, void* vcontext);
 static int handleOutgoing(struct DHTMessage* message, void* vcontext);
@@ -242,15 +261,26 @@ struct RouterModule* RouterModule_register(struct DHTModuleRegistry* registry,
 }
 
 /**
- * The amount of time to wait before skipping over the first node and trying another in a search.
- * Any node which can't beat this time will have its reach set to 0.
+ * The retransmission timeout for a node, srtt + 4 * rttvar as in RFC 6298.
  *
- * @param module this module.
- * @return the timeout time.
+ * @param node the node, may be NULL.
+ * @return the timeout or 0 if the node has never answered.
  */
-uint64_t RouterModule_searchTimeoutMilliseconds(struct RouterModule* module)
+static inline uint64_t retransmissionTimeout(struct Node* node)
 {
-    uint64_t x = (((uint64_t) AverageRoller_getAverage(module->gmrtRoller)) * 4);
+    if (!node || !node->smoothedRtt) {
+        return 0;
+    }
+    return ((uint64_t) node->smoothedRtt) + (((uint64_t) node->rttVariance) * 4);
+}
+
+/** See: RouterModule.h */
+uint64_t RouterModule_searchTimeoutMilliseconds(struct Node* node, struct RouterModule* module)
+{
+    uint64_t x = retransmissionTimeout(node);
+    if (!x) {
+        x = (((uint64_t) AverageRoller_getAverage(module->gmrtRoller)) * 4);
+    }
     x = x + (Random_uint32(module->rand) % (x | 1)) / 2;
     return (x > MAX_TIMEOUT) ? MAX_TIMEOUT : (x < MIN_TIMEOUT) ? MIN_TIMEOUT : x;
 }
@@ -276,25 +306,82 @@ static inline void responseFromNode(struct Node* node,
         node->missedPings = 0;
         node->reach = reachAfterDecay(node->reach) +
             ((UINT32_MAX / REACH_WINDOW) / millisecondsSinceRequest);
+
+        if (!node->smoothedRtt) {
+            node->smoothedRtt = millisecondsSinceRequest;
+            node->rttVariance = millisecondsSinceRequest / 2;
+        } else {
+            uint32_t error = (node->smoothedRtt > millisecondsSinceRequest)
+                ? node->smoothedRtt - millisecondsSinceRequest
+                : millisecondsSinceRequest - node->smoothedRtt;
+            node->rttVariance -= node->rttVariance >> RTT_BETA_SHIFT;
+            node->rttVariance += error >> RTT_BETA_SHIFT;
+            node->smoothedRtt -= node->smoothedRtt >> RTT_ALPHA_SHIFT;
+            node->smoothedRtt += millisecondsSinceRequest >> RTT_ALPHA_SHIFT;
+            if (!node->smoothedRtt) {
+                node->smoothedRtt = 1;
+            }
+        }
         NodeStore_updateReach(node, module->nodeStore);
     }
 }
 
-static inline int sendNodes(struct NodeList* nodeList,
-                            struct DHTMessage* message,
-                            struct RouterModule* module,
-                            uint32_t askerVersion)
+/**
+ * Get the serialized version list for a reply.
+ * Almost every reply lists nodes which all have the same version, the lists for those are
+ * kept so that they need not be built again.
+ */
+static String* versionListFor(uint32_t* versions,
+                              uint32_t count,
+                              struct RouterModule* module,
+                              struct Allocator* alloc)
 {
-    struct DHTMessage* query = message->replyTo;
-    String* nodes = Allocator_malloc(message->allocator, sizeof(String));
-    nodes->len = nodeList->size * Address_SERIALIZED_SIZE;
-    nodes->bytes = Allocator_malloc(message->allocator, nodeList->size * Address_SERIALIZED_SIZE);
+    uint32_t i;
+    for (i = 1; i < count && versions[i] == versions[0]; i++) ;
+    const uint32_t cacheSize = sizeof(module->cachedVersionLists) / sizeof(String*);
+    if (i < count || count >= cacheSize) {
+        struct VersionList list = { .length = count, .versions = versions };
+        return VersionList_stringify(&list, alloc);
+    }
 
-    struct VersionList* versions = VersionList_new(nodeList->size, message->allocator);
+    if (module->cachedVersion != versions[0]) {
+        if (module->versionListAlloc) {
+            Allocator_free(module->versionListAlloc);
+        }
+        module->versionListAlloc = Allocator_child(module->allocator);
+        Bits_memset(module->cachedVersionLists, 0, sizeof(module->cachedVersionLists));
+        module->cachedVersion = versions[0];
+    }
+    if (!module->cachedVersionLists[count]) {
+        struct VersionList list = { .length = count, .versions = versions };
+        module->cachedVersionLists[count] =
+            VersionList_stringify(&list, module->versionListAlloc);
+    }
+    return module->cachedVersionLists[count];
+}
+
+/**
+ * Serialize the nodes for a reply.
+ *
+ * @param nodeList the nodes to send.
+ * @param query the query which is being answered.
+ * @param module the router module.
+ * @param reply the reply to fill in, the strings are allocated from reply->alloc.
+ * @param tempAlloc an allocator for things which are not needed once this returns.
+ */
+static inline void serializeNodes(struct NodeList* nodeList,
+                                  struct DHTMessage* query,
+                                  struct RouterModule* module,
+                                  struct RouterModule_CachedReply* reply,
+                                  struct Allocator* tempAlloc)
+{
+    String* nodes = Allocator_malloc(reply->alloc, sizeof(String));
+    nodes->bytes = Allocator_malloc(reply->alloc, nodeList->size * Address_SERIALIZED_SIZE);
+
+    uint32_t* versions = Allocator_malloc(tempAlloc, nodeList->size * 4 + 1);
 
-    uint32_t i = 0;
     uint32_t j = 0;
-    for (; i < nodeList->size; i++) {
+    for (uint32_t i = 0; i < nodeList->size; i++) {
 
         if (NumberCompress_decompress(nodeList->nodes[i]->address.path) ==
             NumberCompress_decompress(query->address->path))
@@ -312,24 +399,54 @@ static inline int sendNodes(struct NodeList* nodeList,
 
         Address_serialize(&nodes->bytes[j * Address_SERIALIZED_SIZE], &addr);
 
-        versions->versions[j] = nodeList->nodes[i]->version;
+        versions[j] = nodeList->nodes[i]->version;
         j++;
     }
-    if (i > 0) {
-        Dict_putString(message->asDict, CJDHTConstants_NODES, nodes, message->allocator);
-        String* versionsStr = VersionList_stringify(versions, message->allocator);
-        Dict_putString(message->asDict,
-                       CJDHTConstants_NODE_PROTOCOLS,
-                       versionsStr,
-                       message->allocator);
+    nodes->len = j * Address_SERIALIZED_SIZE;
+    if (j > 0) {
+        reply->nodes = nodes;
+        // The version list may belong to the version list cache which is freed separately.
+        String* versionList = versionListFor(versions, j, module, tempAlloc);
+        reply->versions = String_clone(versionList, reply->alloc);
     }
-    return 0;
+}
+
+/**
+ * Find the place in the reply cache for the reply to a query.
+ *
+ * @param key the query, only the fields which the reply depends on are used.
+ * @param module the router module.
+ * @param slotOut set to the entry where the reply is or should be put.
+ * @return true if the entry holds a reply to the same query which is still fresh.
+ */
+static bool replyCacheLookup(struct RouterModule_CachedReply* key,
+                             struct RouterModule* module,
+                             struct RouterModule_CachedReply** slotOut)
+{
+    uint32_t hash = key->askerVersion ^ (uint32_t)key->askerInterface ^ key->isGetPeers;
+    for (int i = 0; i < 16; i++) {
+        hash = hash * 31 + key->target[i];
+    }
+    struct RouterModule_CachedReply* slot =
+        &module->replyCache[hash % RouterModule_REPLY_CACHE_SIZE];
+    *slotOut = slot;
+
+    uint64_t now = Time_currentTimeMilliseconds(module->eventBase);
+    return slot->alloc
+        && slot->generation == module->nodeStore->generation
+        && now - slot->timeCreated < REPLY_CACHE_TTL_MILLISECONDS
+        && slot->isGetPeers == key->isGetPeers
+        && slot->askerInterface == key->askerInterface
+        && slot->askerVersion == key->askerVersion
+        && !Bits_memcmp(slot->target, key->target, 16);
 }
 
 /**
  * Handle an incoming search query.
  * This is setup to handle the outgoing *response* to the query, it should
  * be called from handleOutgoing() and populate the response with nodes.
+ * Popular nodes get the same queries over and over so replies are cached for a short time,
+ * a reply depends on the query, the version of the asker and the interface which it is behind.
  *
  * @param message the empty response message to populate.
  * @param replyArgs the arguments dictionary in the response (to be populated).
@@ -347,43 +464,70 @@ static inline int handleQuery(struct DHTMessage* message,
     // We got a query, the reach should be set to 1 in the new node.
     NodeStore_addNode(module->nodeStore, query->address, 1, version);
 
-    struct NodeList* nodeList = NULL;
-
     String* queryType = Dict_getString(query->asDict, CJDHTConstants_QUERY);
-    if (String_equals(queryType, CJDHTConstants_QUERY_FN)) {
-        // get the target
-        String* target = Dict_getString(query->asDict, CJDHTConstants_TARGET);
-        if (target == NULL || target->len != Address_SEARCH_TARGET_SIZE) {
-            return 0;
-        }
+    bool isGetPeers = String_equals(queryType, CJDHTConstants_QUERY_GP);
+    if (!isGetPeers && !String_equals(queryType, CJDHTConstants_QUERY_FN)) {
+        return 0;
+    }
 
-        struct Address targetAddr;
-        Bits_memcpyConst(targetAddr.ip6.bytes, target->bytes, Address_SEARCH_TARGET_SIZE);
-
-        // send the closest nodes
-        nodeList = NodeStore_getClosestNodes(module->nodeStore,
-                                             &targetAddr,
-                                             query->address,
-                                             RouterModule_K + 5,
-                                             version,
-                                             message->allocator);
-
-    } else if (String_equals(queryType, CJDHTConstants_QUERY_GP)) {
-        // get the target
-        String* target = Dict_getString(query->asDict, CJDHTConstants_TARGET);
-        if (target == NULL || target->len != 8) {
-            return 0;
-        }
-        uint64_t targetPath;
-        Bits_memcpyConst(&targetPath, target->bytes, 8);
-        targetPath = Endian_bigEndianToHost64(targetPath);
+    // get the target
+    String* target = Dict_getString(query->asDict, CJDHTConstants_TARGET);
+    if (target == NULL || target->len != ((isGetPeers) ? 8 : Address_SEARCH_TARGET_SIZE)) {
+        return 0;
+    }
 
-        nodeList =
-            NodeStore_getPeers(targetPath, RouterModule_K, message->allocator, module->nodeStore);
+    uint64_t askerPath = query->address->path;
+    struct RouterModule_CachedReply key = {
+        .askerInterface =
+            askerPath & Bits_maxBits64(NumberCompress_bitsUsedForLabel(askerPath)),
+        .askerVersion = version,
+        .isGetPeers = isGetPeers
+    };
+    Bits_memcpy(key.target, target->bytes, target->len);
 
+    struct RouterModule_CachedReply* reply;
+    if (!replyCacheLookup(&key, module, &reply)) {
+        if (reply->alloc) {
+            Allocator_free(reply->alloc);
+        }
+        Bits_memcpyConst(reply, &key, sizeof(struct RouterModule_CachedReply));
+        reply->alloc = Allocator_child(module->allocator);
+        reply->generation = module->nodeStore->generation;
+        reply->timeCreated = Time_currentTimeMilliseconds(module->eventBase);
+
+        struct NodeList* nodeList;
+        if (isGetPeers) {
+            uint64_t targetPath;
+            Bits_memcpyConst(&targetPath, target->bytes, 8);
+            targetPath = Endian_bigEndianToHost64(targetPath);
+
+            nodeList = NodeStore_getPeers(targetPath,
+                                          RouterModule_K,
+                                          message->allocator,
+                                          module->nodeStore);
+        } else {
+            struct Address targetAddr;
+            Bits_memcpyConst(targetAddr.ip6.bytes, target->bytes, Address_SEARCH_TARGET_SIZE);
+
+            // send the closest nodes
+            nodeList = NodeStore_getClosestNodes(module->nodeStore,
+                                                 &targetAddr,
+                                                 query->address,
+                                                 RouterModule_K + 5,
+                                                 version,
+                                                 message->allocator);
+        }
+        serializeNodes(nodeList, query, module, reply, message->allocator);
     }
 
-    return (nodeList) ? sendNodes(nodeList, message, module, version) : 0;
+    if (reply->nodes) {
+        Dict_putString(message->asDict, CJDHTConstants_NODES, reply->nodes, message->allocator);
+        Dict_putString(message->asDict,
+                       CJDHTConstants_NODE_PROTOCOLS,
+                       reply->versions,
+                       message->allocator);
+    }
+    return 0;
 }
 
 /**
@@ -442,7 +586,13 @@ static void sendMsg(String* txid, void* vpingContext)
         .allocator = pc->pp->pingAlloc
     };
 
-    DHTModuleRegistry_handleOutgoing(&message, pc->router->registry);
+    // The reply can come back and free the ping before handleOutgoing() returns.
+    struct RouterModule* router = pc->router;
+    DHTModuleRegistry_handleOutgoing(&message, router->registry);
+
+    // The SerializationModule has filled in the length.
+    router->budget.queries -= 1000;
+    router->budget.bytes -= ((int64_t) message.length) * 1000;
 }
 
 static void onTimeout(uint32_t milliseconds, struct PingContext* pctx)
@@ -492,9 +642,17 @@ static void onTimeout(uint32_t milliseconds, struct PingContext* pctx)
     }
 }
 
-static uint64_t pingTimeoutMilliseconds(struct RouterModule* module)
+/**
+ * The time to wait for a node to answer a ping, based on the node's own round trip time
+ * if it has answered before, never longer than the timeout from the global mean response time.
+ */
+static uint64_t pingTimeoutMilliseconds(struct Node* node, struct RouterModule* module)
 {
     uint64_t out = AverageRoller_getAverage(module->gmrtRoller) * PING_TIMEOUT_GMRT_MULTIPLIER;
+    uint64_t rto = retransmissionTimeout(node) * PING_TIMEOUT_RTO_MULTIPLIER;
+    if (rto && rto < out) {
+        out = rto;
+    }
     return (out < PING_TIMEOUT_MINIMUM) ? PING_TIMEOUT_MINIMUM : out;
 }
 
@@ -555,6 +713,7 @@ static void onResponseOrTimeout(String* data, uint32_t milliseconds, void* vping
 
     // update the GMRT
     AverageRoller_update(pctx->router->gmrtRoller, milliseconds);
+    Histogram_add(&pctx->router->responseTimes, milliseconds);
     Log_debug(pctx->router->logger,
                "Received response in %u milliseconds, gmrt now %u\n",
                milliseconds,
@@ -602,7 +761,7 @@ struct RouterModule_Promise* RouterModule_newMessage(struct Node* node,
                                                      struct Allocator* alloc)
 {
     if (timeoutMilliseconds == 0) {
-        timeoutMilliseconds = pingTimeoutMilliseconds(module);
+        timeoutMilliseconds = pingTimeoutMilliseconds(node, module);
     }
 
     struct Pinger_Ping* pp = Pinger_newPing(NULL,
@@ -678,9 +837,9 @@ static inline uint32_t getExpectedLatency(struct Node* node, struct RouterModule
                     : expectedLatency;
 
     expectedLatency = ( expectedLatency
-                      < pingTimeoutMilliseconds(module) )
+                      < pingTimeoutMilliseconds(node, module) )
                     ? expectedLatency
-                    : pingTimeoutMilliseconds(module);
+                    : pingTimeoutMilliseconds(node, module);
 
     return expectedLatency;
 }
@@ -729,6 +888,29 @@ struct Node* RouterModule_lookup(uint8_t targetAddr[Address_SEARCH_TARGET_SIZE],
     return NodeStore_getBest(&addr, module->nodeStore);
 }
 
+/** see RouterModule.h */
+struct NodeList* RouterModule_getPaths(uint8_t ip6[16],
+                                       uint32_t max,
+                                       struct Allocator* alloc,
+                                       struct RouterModule* module)
+{
+    struct Address addr;
+    Bits_memcpyConst(addr.ip6.bytes, ip6, 16);
+    return NodeStore_getPaths(&addr, max, alloc, module->nodeStore);
+}
+
+/** see RouterModule.h */
+bool RouterModule_mightHaveNode(uint8_t ip6[16], struct RouterModule* module)
+{
+    return NodeStore_mightHaveNode(module->nodeStore, ip6);
+}
+
+/** see RouterModule.h */
+uint32_t RouterModule_generation(struct RouterModule* module)
+{
+    return module->nodeStore->generation;
+}
+
 /** see RouterModule.h */
 struct Node* RouterModule_getNode(uint64_t path, struct RouterModule* module)
 {
@@ -749,3 +931,61 @@ uint32_t RouterModule_globalMeanResponseTime(struct RouterModule* module)
 {
     return (uint32_t) AverageRoller_getAverage(module->gmrtRoller);
 }
+
+/** See: RouterModule.h */
+struct Histogram* RouterModule_responseTimes(struct RouterModule* module)
+{
+    return &module->responseTimes;
+}
+
+/** See: RouterModule.h */
+void RouterModule_setQueryBudget(uint32_t queriesPerSecond,
+                                 uint32_t bytesPerSecond,
+                                 struct RouterModule* module)
+{
+    struct RouterModule_QueryBudget* budget = &module->budget;
+    budget->queriesPerSecond = queriesPerSecond;
+    budget->bytesPerSecond = bytesPerSecond;
+
+    // Start out with a full bucket.
+    budget->queries = ((int64_t) queriesPerSecond) * 1000 * QUERY_BUDGET_BURST_SECONDS;
+    budget->bytes = ((int64_t) bytesPerSecond) * 1000 * QUERY_BUDGET_BURST_SECONDS;
+    budget->timeOfLastRefill = Time_currentTimeMilliseconds(module->eventBase);
+}
+
+static void refillBudget(int64_t* tokens, uint32_t perSecond, uint64_t milliseconds)
+{
+    // Rate per second in thousandths is the rate per millisecond.
+    int64_t max = ((int64_t) perSecond) * 1000 * QUERY_BUDGET_BURST_SECONDS;
+    *tokens += (milliseconds > QUERY_BUDGET_BURST_SECONDS * 1000)
+        ? max : (int64_t) (perSecond * milliseconds);
+    if (*tokens > max) {
+        *tokens = max;
+    }
+}
+
+/** See: RouterModule.h */
+bool RouterModule_hasQueryBudget(struct RouterModule* module)
+{
+    struct RouterModule_QueryBudget* budget = &module->budget;
+    uint64_t now = Time_currentTimeMilliseconds(module->eventBase);
+    uint64_t milliseconds = now - budget->timeOfLastRefill;
+    budget->timeOfLastRefill = now;
+
+    refillBudget(&budget->queries, budget->queriesPerSecond, milliseconds);
+    refillBudget(&budget->bytes, budget->bytesPerSecond, milliseconds);
+
+    if ((budget->queriesPerSecond && budget->queries < 1000)
+        || (budget->bytesPerSecond && budget->bytes < 1000))
+    {
+        budget->exhausted++;
+        return false;
+    }
+    return true;
+}
+
+/** See: RouterModule.h */
+struct RouterModule_QueryBudget* RouterModule_queryBudget(struct RouterModule* module)
+{
+    return &module->budget;
+}
@@ -23,6 +23,7 @@
 #include "benc/Object.h"
 #include "util/log/Log.h"
 #include "util/events/EventBase.h"
+#include "util/Histogram.h"
 #include "util/Linker.h"
 Linker_require("dht/dhtcore/RouterModule.c")
 
@@ -71,13 +72,15 @@ struct RouterModule* RouterModule_register(struct DHTModuleRegistry* registry,
                                            struct NodeStore* nodeStore);
 
 /**
- * The amount of time to wait before skipping over the first node and trying another in a search.
+ * The amount of time to wait before skipping over a node and trying another in a search.
  * Any node which can't beat this time will have its reach set to 0.
  *
+ * @param node the node which was asked, if it has answered before then the timeout is based on
+ *             its own round trip time, otherwise on the global mean response time.
  * @param module this module.
  * @return the timeout time.
  */
-uint64_t RouterModule_searchTimeoutMilliseconds(struct RouterModule* module);
+uint64_t RouterModule_searchTimeoutMilliseconds(struct Node* node, struct RouterModule* module);
 
 /**
  * Manually add a node to the routing table.
@@ -120,13 +123,90 @@ int RouterModule_brokenPath(const uint64_t path, struct RouterModule* module);
  */
 struct Node* RouterModule_getNode(uint64_t path, struct RouterModule* module);
 
+/**
+ * A number which changes whenever a node is added to or removed from the NodeStore,
+ * anything computed from RouterModule_lookup() may be stale once it changes.
+ */
+uint32_t RouterModule_generation(struct RouterModule* module);
+
 struct Node* RouterModule_lookup(uint8_t targetAddr[Address_SEARCH_TARGET_SIZE],
                                  struct RouterModule* module);
 
+/**
+ * Get paths to a node which do not share a link, best first, see: NodeStore_getPaths().
+ *
+ * @param ip6 the address of the node.
+ * @param max the maximum number of paths to return.
+ * @param alloc the allocator for the list.
+ * @param module the router module.
+ */
+struct NodeList* RouterModule_getPaths(uint8_t ip6[16],
+                                       uint32_t max,
+                                       struct Allocator* alloc,
+                                       struct RouterModule* module);
+
+/**
+ * @return false if the node with the address is definitely not known,
+ *         see: NodeStore_mightHaveNode().
+ */
+bool RouterModule_mightHaveNode(uint8_t ip6[16], struct RouterModule* module);
+
 void RouterModule_updateReach(struct Node* node, struct RouterModule* module);
 
 uint32_t RouterModule_globalMeanResponseTime(struct RouterModule* module);
 
+/**
+ * Get the distribution of the response times of all queries since the module was started.
+ *
+ * @param module the router module.
+ * @return the histogram of response times in milliseconds.
+ */
+struct Histogram* RouterModule_responseTimes(struct RouterModule* module);
+
+/** A token bucket for the queries which this node sends, see: RouterModule_setQueryBudget(). */
+struct RouterModule_QueryBudget
+{
+    /** The limits, 0 for no limit. */
+    uint32_t queriesPerSecond;
+    uint32_t bytesPerSecond;
+
+    /**
+     * What is left to spend in thousandths of a query or byte so that it can be refilled
+     * every millisecond, this goes below 0 when queries which do not wait are sent.
+     */
+    int64_t queries;
+    int64_t bytes;
+    uint64_t timeOfLastRefill;
+
+    /** The number of times there was no budget for a query. */
+    uint64_t exhausted;
+};
+
+/**
+ * Limit the rate of the queries which this node sends, replies to other nodes are not limited.
+ * Every query is charged to the budget but only the ones which can wait check for it,
+ * see: RouterModule_hasQueryBudget().
+ *
+ * @param queriesPerSecond the number of queries to allow per second, 0 for no limit.
+ * @param bytesPerSecond the number of bytes of queries to allow per second, 0 for no limit.
+ * @param module the router module.
+ */
+void RouterModule_setQueryBudget(uint32_t queriesPerSecond,
+                                 uint32_t bytesPerSecond,
+                                 struct RouterModule* module);
+
+/**
+ * Check whether the budget allows another query to be sent now.
+ * Maintenance and other traffic which is not needed to forward packets should wait if not.
+ *
+ * @param module the router module.
+ * @return true if a query may be sent.
+ */
+bool RouterModule_hasQueryBudget(struct RouterModule* module);
+
+/** Get the query budget and how often it ran out, see: RouterModule_setQueryBudget(). */
+struct RouterModule_QueryBudget* RouterModule_queryBudget(struct RouterModule* module);
+
 /**
  * Look up several (currently 8) paths to the destination address.
  * For each path, if it has not been pinged recently, ping it.
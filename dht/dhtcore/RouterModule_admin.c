@@ -16,16 +16,19 @@
 #include "benc/Dict.h"
 #include "benc/String.h"
 #include "benc/Int.h"
+#include "benc/List.h"
 #include "dht/dhtcore/Node.h"
 #include "dht/dhtcore/RouterModule.h"
 #include "dht/Address.h"
 #include "dht/CJDHTConstants.h"
 #include "memory/Allocator.h"
+#include "util/Histogram.h"
 
 struct Context {
     struct Admin* admin;
     struct Allocator* allocator;
     struct RouterModule* router;
+    struct NodeStore* store;
     Identity
 };
 
@@ -66,13 +69,19 @@ struct Ping
     Identity
 };
 
-static void pingResponse(struct RouterModule_Promise* promise,
-                         uint32_t lag,
-                         struct Node* node,
-                         Dict* responseDict)
+/**
+ * Send the result of a ping.
+ *
+ * @param response entries to send along with the result, NULL if there are none.
+ * @return the result of Admin_sendMessage().
+ */
+static int sendPingResult(uint32_t lag,
+                          struct Node* node,
+                          Dict* responseDict,
+                          Dict response,
+                          String* txid,
+                          struct Context* ctx)
 {
-    struct Ping* ping = Identity_cast((struct Ping*)promise->userData);
-
     uint8_t versionStr[40] = "old";
     String* version = String_CONST((char*)versionStr);
     String* versionBin = Dict_getString(responseDict, CJDHTConstants_VERSION);
@@ -83,7 +92,6 @@ static void pingResponse(struct RouterModule_Promise* promise,
     int64_t* protocolVersion = Dict_getInt(responseDict, CJDHTConstants_PROTOCOL);
     int64_t pv = (protocolVersion) ? *protocolVersion : -1;
 
-    Dict response = NULL;
     Dict verResponse = Dict_CONST(String_CONST("version"), String_OBJ(version), response);
     if (versionBin) {
         response = verResponse;
@@ -108,9 +116,54 @@ static void pingResponse(struct RouterModule_Promise* promise,
         response = fromResponse;
     }
 
-    Admin_sendMessage(&response, ping->txid, ping->ctx->admin);
+    return Admin_sendMessage(&response, txid, ctx->admin);
 }
 
+static void pingResponse(struct RouterModule_Promise* promise,
+                         uint32_t lag,
+                         struct Node* node,
+                         Dict* responseDict)
+{
+    struct Ping* ping = Identity_cast((struct Ping*)promise->userData);
+    sendPingResult(lag, node, responseDict, NULL, ping->txid, ping->ctx);
+}
+
+/** A node to ping, given either by address or by path. */
+struct Target
+{
+    /** The address of the node, zero if it was given by path. */
+    uint8_t ip6[16];
+
+    /** The path to the node, zero if it was given by address. */
+    uint64_t path;
+};
+
+/**
+ * @return 0 if the string is a 19 char path or an ipv6 address, otherwise -1.
+ */
+static int parseTarget(String* str, struct Target* target)
+{
+    Bits_memset(target, 0, sizeof(struct Target));
+    if (str->len == 19 && !AddrTools_parsePath(&target->path, (uint8_t*) str->bytes)) {
+        return 0;
+    }
+    return (AddrTools_parseIp(target->ip6, (uint8_t*) str->bytes)) ? -1 : 0;
+}
+
+/** @return the node which was asked for or NULL if it is not in the table. */
+static struct Node* findTarget(struct Target* target, struct Context* ctx)
+{
+    if (target->path) {
+        return RouterModule_getNode(target->path, ctx->router);
+    }
+    struct Node* n = RouterModule_lookup(target->ip6, ctx->router);
+    return (n && !Bits_memcmp(target->ip6, n->address.ip6.bytes, 16)) ? n : NULL;
+}
+
+#define BAD_TARGET_ERROR \
+    "Unexpected address, must be either an ipv6 address " \
+    "eg: 'fc4f:d:e499:8f5b:c49f:6e6b:1ae:3120', 19 char path eg: '0123.4567.89ab.cdef'"
+
 static void pingNode(Dict* args, void* vctx, String* txid, struct Allocator* requestAlloc)
 {
     struct Context* ctx = Identity_cast((struct Context*) vctx);
@@ -120,19 +173,13 @@ static void pingNode(Dict* args, void* vctx, String* txid, struct Allocator* req
 
     char* err = NULL;
 
-    struct Address addr = {.path=0};
+    struct Target target;
     struct Node* n = NULL;
 
-    if (pathStr->len == 19 && !AddrTools_parsePath(&addr.path, (uint8_t*) pathStr->bytes)) {
-        n = RouterModule_getNode(addr.path, ctx->router);
-    } else if (!AddrTools_parseIp(addr.ip6.bytes, (uint8_t*) pathStr->bytes)) {
-        n = RouterModule_lookup(addr.ip6.bytes, ctx->router);
-        if (n && Bits_memcmp(addr.ip6.bytes, n->address.ip6.bytes, 16)) {
-            n = NULL;
-        }
+    if (!parseTarget(pathStr, &target)) {
+        n = findTarget(&target, ctx);
     } else {
-        err = "Unexpected address, must be either an ipv6 address "
-              "eg: 'fc4f:d:e499:8f5b:c49f:6e6b:1ae:3120', 19 char path eg: '0123.4567.89ab.cdef'";
+        err = BAD_TARGET_ERROR;
     }
 
     if (!err) {
@@ -157,7 +204,216 @@ static void pingNode(Dict* args, void* vctx, String* txid, struct Allocator* req
     }
 }
 
+/** Pings which RouterModule_pingMany() keeps in flight unless it is asked for another number. */
+#define PING_MANY_DEFAULT_CONCURRENCY 8
+#define PING_MANY_MAX_CONCURRENCY 64
+
+struct PingMany
+{
+    struct Context* ctx;
+
+    /** The txid of the request, the results are asynchronous messages so it must be kept. */
+    String* txid;
+
+    struct Target* targets;
+    uint32_t count;
+
+    /** Index of the next target to ping. */
+    uint32_t next;
+
+    /** Number of pings which have been sent and have not been answered or timed out. */
+    uint32_t outstanding;
+
+    uint32_t concurrency;
+    uint32_t timeout;
+
+    /** Set when the client stops listening, no more pings are sent. */
+    bool closed;
+
+    struct Allocator* alloc;
+    Identity
+};
+
+struct PingManyPing
+{
+    struct PingMany* pm;
+    uint32_t index;
+    Identity
+};
+
+/**
+ * Send the result for one target, every result but the last has more set to 1 and the last
+ * one has the count of targets.
+ *
+ * @param err the reason the target was not pinged or NULL if it was.
+ */
+static void pingManyResult(struct PingMany* pm,
+                           uint32_t index,
+                           uint32_t lag,
+                           struct Node* node,
+                           Dict* responseDict,
+                           char* err)
+{
+    uint8_t name[40];
+    struct Target* target = &pm->targets[index];
+    if (target->path) {
+        AddrTools_printPath(name, target->path);
+    } else {
+        AddrTools_printIp(name, target->ip6);
+    }
+
+    bool last = pm->next == pm->count && !pm->outstanding;
+    Dict countEntry = Dict_CONST(String_CONST("count"), Int_OBJ(pm->count), NULL);
+    Dict moreEntry = Dict_CONST(String_CONST("more"), Int_OBJ(1), NULL);
+    Dict response = (last) ? countEntry : moreEntry;
+    response = Dict_CONST(String_CONST("node"), String_OBJ(String_CONST((char*)name)), response);
+    Dict errResponse =
+        Dict_CONST(String_CONST("error"), String_OBJ(String_CONST((err) ? err : "")), response);
+
+    int ret = (err)
+        ? Admin_sendMessage(&errResponse, pm->txid, pm->ctx->admin)
+        : sendPingResult(lag, node, responseDict, response, pm->txid, pm->ctx);
+    if (ret) {
+        pm->closed = true;
+    }
+}
+
+/** Send pings until there are concurrency of them in flight, free pm once they are all done. */
+static void pingManyNext(struct PingMany* pm);
+
+static void pingManyResponse(struct RouterModule_Promise* promise,
+                             uint32_t lag,
+                             struct Node* node,
+                             Dict* responseDict)
+{
+    struct PingManyPing* ping = Identity_cast((struct PingManyPing*)promise->userData);
+    struct PingMany* pm = Identity_cast(ping->pm);
+    pm->outstanding--;
+    if (!pm->closed) {
+        pingManyResult(pm, ping->index, lag, node, responseDict, NULL);
+    }
+    pingManyNext(pm);
+}
+
+static void pingManyNext(struct PingMany* pm)
+{
+    while (!pm->closed && pm->next < pm->count && pm->outstanding < pm->concurrency) {
+        uint32_t index = pm->next++;
+        struct Node* n = findTarget(&pm->targets[index], pm->ctx);
+        if (!n) {
+            pingManyResult(pm, index, 0, NULL, NULL, "could not find node to ping");
+            continue;
+        }
+        // The pings are not in pm->alloc so that it can be freed from their callback.
+        struct RouterModule_Promise* rp =
+            RouterModule_pingNode(n, pm->timeout, pm->ctx->router, pm->ctx->allocator);
+        struct PingManyPing* ping = Allocator_calloc(rp->alloc, sizeof(struct PingManyPing), 1);
+        Identity_set(ping);
+        ping->pm = pm;
+        ping->index = index;
+        rp->userData = ping;
+        rp->callback = pingManyResponse;
+        pm->outstanding++;
+    }
+    if (!pm->outstanding && (pm->closed || pm->next == pm->count)) {
+        Allocator_free(pm->alloc);
+    }
+}
+
+static void pingMany(Dict* args, void* vctx, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vctx);
+    List* nodes = Dict_getList(args, String_CONST("nodes"));
+    int64_t* concurrencyPtr = Dict_getInt(args, String_CONST("concurrency"));
+    int64_t* timeoutPtr = Dict_getInt(args, String_CONST("timeout"));
+
+    int64_t concurrency = (concurrencyPtr) ? *concurrencyPtr : PING_MANY_DEFAULT_CONCURRENCY;
+    if (concurrency < 1 || concurrency > PING_MANY_MAX_CONCURRENCY) {
+        Dict errDict = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(
+            "concurrency must be between 1 and 64")), NULL);
+        Admin_sendMessage(&errDict, txid, ctx->admin);
+        return;
+    }
+
+    struct Allocator* alloc = Allocator_child(ctx->allocator);
+    struct PingMany* pm = Allocator_clone(alloc, (&(struct PingMany) {
+        .ctx = ctx,
+        .txid = String_clone(txid, alloc),
+        .concurrency = concurrency,
+        .timeout = (timeoutPtr && *timeoutPtr > 0) ? *timeoutPtr : 0,
+        .alloc = alloc
+    }));
+    Identity_set(pm);
+
+    if (nodes) {
+        pm->count = List_size(nodes);
+        pm->targets = Allocator_calloc(alloc, sizeof(struct Target), pm->count + 1);
+        for (uint32_t i = 0; i < pm->count; i++) {
+            String* str = List_getString(nodes, i);
+            if (!str || parseTarget(str, &pm->targets[i])) {
+                Dict errDict = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(
+                    "nodes must be a list of ipv6 addresses and 19 char paths")), NULL);
+                Admin_sendMessage(&errDict, txid, ctx->admin);
+                Allocator_free(alloc);
+                return;
+            }
+        }
+    } else {
+        // Every node in the table, by path so that each route is pinged.
+        pm->count = ctx->store->size;
+        pm->targets = Allocator_calloc(alloc, sizeof(struct Target), pm->count + 1);
+        for (uint32_t i = 0; i < pm->count; i++) {
+            pm->targets[i].path = NodeStore_dumpTable(ctx->store, i)->address.path;
+        }
+    }
+
+    if (!pm->count) {
+        Dict countDict = Dict_CONST(String_CONST("count"), Int_OBJ(0), NULL);
+        Admin_sendMessage(&countDict, txid, ctx->admin);
+        Allocator_free(alloc);
+        return;
+    }
+
+    pingManyNext(pm);
+}
+
+static void responseTimes(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    struct Histogram* times = RouterModule_responseTimes(ctx->router);
+    Dict* out = Histogram_toDict(times, requestAlloc);
+    Admin_sendMessage(out, txid, ctx->admin);
+}
+
+static void queryBudget(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    struct RouterModule_QueryBudget* budget = RouterModule_queryBudget(ctx->router);
+    int64_t* queriesPerSecond = Dict_getInt(args, String_CONST("queriesPerSecond"));
+    int64_t* bytesPerSecond = Dict_getInt(args, String_CONST("bytesPerSecond"));
+
+    char* err = "none";
+    if ((queriesPerSecond && (*queriesPerSecond < 0 || *queriesPerSecond > UINT16_MAX))
+        || (bytesPerSecond && (*bytesPerSecond < 0 || *bytesPerSecond > INT32_MAX)))
+    {
+        err = "queriesPerSecond and bytesPerSecond must be 0 for no limit or a positive number";
+    } else if (queriesPerSecond || bytesPerSecond) {
+        RouterModule_setQueryBudget(
+            (queriesPerSecond) ? *queriesPerSecond : budget->queriesPerSecond,
+            (bytesPerSecond) ? *bytesPerSecond : budget->bytesPerSecond,
+            ctx->router);
+    }
+
+    Dict* out = Dict_new(requestAlloc);
+    Dict_putString(out, String_CONST("error"), String_CONST(err), requestAlloc);
+    Dict_putInt(out, String_CONST("queriesPerSecond"), budget->queriesPerSecond, requestAlloc);
+    Dict_putInt(out, String_CONST("bytesPerSecond"), budget->bytesPerSecond, requestAlloc);
+    Dict_putInt(out, String_CONST("exhausted"), budget->exhausted, requestAlloc);
+    Admin_sendMessage(out, txid, ctx->admin);
+}
+
 void RouterModule_admin_register(struct RouterModule* module,
+                                 struct NodeStore* store,
                                  struct Admin* admin,
                                  struct Allocator* alloc)
 {
@@ -166,7 +422,8 @@ void RouterModule_admin_register(struct RouterModule* module,
     struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
         .admin = admin,
         .allocator = alloc,
-        .router = module
+        .router = module,
+        .store = store
     }));
     Identity_set(ctx);
 
@@ -180,4 +437,19 @@ void RouterModule_admin_register(struct RouterModule* module,
             { .name = "path", .required = 1, .type = "String" },
             { .name = "timeout", .required = 0, .type = "Int" },
         }), admin);
+
+    Admin_registerFunction("RouterModule_pingMany", pingMany, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "nodes", .required = 0, .type = "List" },
+            { .name = "concurrency", .required = 0, .type = "Int" },
+            { .name = "timeout", .required = 0, .type = "Int" }
+        }), admin);
+
+    Admin_registerFunction("RouterModule_responseTimes", responseTimes, ctx, true, NULL, admin);
+
+    Admin_registerFunction("RouterModule_queryBudget", queryBudget, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "queriesPerSecond", .required = 0, .type = "Int" },
+            { .name = "bytesPerSecond", .required = 0, .type = "Int" }
+        }), admin);
 }
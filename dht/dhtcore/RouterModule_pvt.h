@@ -15,12 +15,37 @@
 #ifndef RouterModule_pvt_H
 #define RouterModule_pvt_H
 
+#include "util/Histogram.h"
+
 /**
  * Internal structures which are needed for testing but should not be exposed to the outside world.
  */
 
 struct RouterModule_Ping;
 
+/** A reply to a search or getPeers query which can be sent again to other askers. */
+struct RouterModule_CachedReply
+{
+    /** What the reply depends on, the query and the interface and version of the asker. */
+    uint8_t target[16];
+    uint64_t askerInterface;
+    uint32_t askerVersion;
+    bool isGetPeers;
+
+    /** The reply is stale once the NodeStore generation moves on or it gets too old. */
+    uint32_t generation;
+    uint64_t timeCreated;
+
+    /** The nodes and their versions, NULL if there are no nodes to send. */
+    String* nodes;
+    String* versions;
+
+    /** NULL if the entry has never been used. */
+    struct Allocator* alloc;
+};
+
+#define RouterModule_REPLY_CACHE_SIZE 64
+
 /** The context for this module. */
 struct RouterModule
 {
@@ -30,6 +55,9 @@ struct RouterModule
     /** An AverageRoller for calculating the global mean response time. */
     struct AverageRoller* gmrtRoller;
 
+    /** Every response time since startup, for reporting, the gmrtRoller is used for timeouts. */
+    struct Histogram responseTimes;
+
     /** The storage for the nodes. */
     struct NodeStore* nodeStore;
 
@@ -53,6 +81,19 @@ struct RouterModule
     struct Random* rand;
 
 
+    /**
+     * Serialized version lists for replies in which every node has the version cachedVersion,
+     * indexed by the number of nodes in the reply. They are freed when cachedVersion changes.
+     */
+    String* cachedVersionLists[RouterModule_K + 6];
+    uint32_t cachedVersion;
+    struct Allocator* versionListAlloc;
+
+    /** Recent replies to queries, looked up by a hash of what the reply depends on. */
+    struct RouterModule_CachedReply replyCache[RouterModule_REPLY_CACHE_SIZE];
+
+    struct RouterModule_QueryBudget budget;
+
     /**
      * Used by handleIncoming() to pass a message to onResponse()
      * while the execution goes through pinger.
@@ -23,6 +23,7 @@
 #include "switch/LabelSplicer.h"
 #include "util/Identity.h"
 #include "util/Bits.h"
+#include "util/Probe.h"
 #include "util/log/Log.h"
 #include "util/events/EventBase.h"
 #include "util/events/Timeout.h"
@@ -32,6 +33,18 @@
 /** The maximum number of requests to make before calling a search failed. */
 #define MAX_REQUESTS_PER_SEARCH 8
 
+/**
+ * Maintenance searches are a steady trickle, a burst of them would only take query slots from
+ * the user searches so they are refused beyond this many searches.
+ */
+#define MAX_MAINTENANCE_SEARCHES 22
+
+/** Maintenance searches must leave this many queries in flight free for user searches. */
+#define USER_RESERVED_QUERIES 8
+
+/** The most searches which can share the response to a single query. */
+#define MAX_QUERY_WAITERS 8
+
 
 struct SearchRunner_pvt
 {
@@ -41,6 +54,7 @@ struct SearchRunner_pvt
     struct Log* logger;
     struct EventBase* eventBase;
     struct RouterModule* router;
+    struct Allocator* alloc;
     uint8_t myAddress[16];
 
     /** Number of concurrent searches in operation. */
@@ -49,9 +63,21 @@ struct SearchRunner_pvt
     /** Maximum number of concurrent searches allowed. */
     int maxConcurrentSearches;
 
+    /** Number of queries which have been sent and not yet answered or timed out. */
+    int queriesInFlight;
+
+    /** Maximum number of queries in flight, searches wait when this is reached. */
+    int maxQueriesInFlight;
+
     /** Beginning of a linked list of searches. */
     struct SearchRunner_Search* firstSearch;
 
+    /** Beginning of a linked list of the queries in flight. */
+    struct SearchRunner_Query* firstQuery;
+
+    /** The search whose callback is being called, cleared if the callback frees it. */
+    struct SearchRunner_Search* inCallback;
+
     Identity
 };
 
@@ -70,12 +96,15 @@ struct SearchRunner_Search
     /** The number of requests which have been sent out so far for this search. */
     uint32_t totalRequests;
 
+    /** User searches are given query slots before maintenance searches. */
+    enum SearchRunner_Priority priority;
+
+    /** True if the last step was put off because too many queries were in flight. */
+    bool deferred;
+
     /** The address which we are searching for. */
     struct Address target;
 
-    /** String form of the 16 byte ipv6 address. */
-    String* targetStr;
-
     /**
      * The SearchStore_Search structure for this search,
      * used to keep track of which nodes are participating.
@@ -100,6 +129,38 @@ struct SearchRunner_Search
     Identity
 };
 
+/**
+ * A query which has been sent to a node and not yet answered or timed out.
+ * Other searches for the same target which would ask the same node wait for this response
+ * rather than sending their own.
+ */
+struct SearchRunner_Query;
+struct SearchRunner_Query
+{
+    /** The label of the node which was asked. */
+    uint64_t path;
+
+    /** What the node was asked for. */
+    uint8_t target[16];
+
+    /** The searches waiting for the response. */
+    struct SearchRunner_Search* waiters[MAX_QUERY_WAITERS];
+    int waiterCount;
+
+    /** True once the response is being handed out, nobody else may wait on it. */
+    bool answered;
+
+    struct SearchRunner_pvt* runner;
+
+    /** Next query in the linked list. */
+    struct SearchRunner_Query* next;
+
+    /** Self pointer for this query so that the query can be removed from the linked list. */
+    struct SearchRunner_Query** thisQuery;
+
+    Identity
+};
+
 static inline int xorcmp(uint32_t target, uint32_t negativeIfCloser, uint32_t positiveIfCloser)
 {
     if (negativeIfCloser == positiveIfCloser) {
@@ -147,37 +208,95 @@ static inline int xorCompare(struct Address* target,
     #undef COMPARE
 }
 
+/** The most entries which will be taken from a single search response. */
+#define MAX_RESPONSE_ENTRIES 64
+
+/** A node from a search response, decoded in bulk before it is processed. */
+struct ResponseEntry
+{
+    struct Address addr;
+
+    /** The position of the entry in the response. */
+    uint32_t index;
+
+    /** True if a later entry in the response has the same key. */
+    bool duplicate;
+};
+
+/** Order by key, entries with the same key stay in the order they were sent. */
+static inline int compareEntries(const struct ResponseEntry** a, const struct ResponseEntry** b)
+{
+    int cmp = Bits_memcmp((*a)->addr.key, (*b)->addr.key, Address_KEY_SIZE);
+    return (cmp) ? cmp : (int)(*a)->index - (int)(*b)->index;
+}
+
+#define Order_NAME OfResponseEntries
+#define Order_TYPE struct ResponseEntry*
+#define Order_COMPARE compareEntries
+#include "util/Order.h"
+
 /**
- * Spot a duplicate entry in a node list.
+ * Decode the nodes in a search response and mark the duplicates.
  * If a router sends a response containing duplicate entries,
  * only the last (best) entry should be accepted.
  *
- * @param nodes the list of nodes.
- * @param index the index of the entry to check for being a duplicate.
- * @return true if duplicate, otherwise false.
+ * @param entries an array of at least MAX_RESPONSE_ENTRIES to fill.
+ * @param nodes the list of nodes from the response.
+ * @return the number of entries decoded.
  */
-static inline bool isDuplicateEntry(String* nodes, uint32_t index)
+static int decodeEntries(struct ResponseEntry* entries, String* nodes)
 {
-    for (uint32_t i = index; i < nodes->len; i += Address_SERIALIZED_SIZE) {
-        if (i == index) {
-            continue;
-        }
-        if (Bits_memcmp(&nodes->bytes[index], &nodes->bytes[i], Address_KEY_SIZE) == 0) {
-            return true;
+    struct ResponseEntry* sorted[MAX_RESPONSE_ENTRIES];
+    int count = 0;
+    for (uint32_t i = 0; nodes && i < nodes->len && count < MAX_RESPONSE_ENTRIES;
+         i += Address_SERIALIZED_SIZE)
+    {
+        struct ResponseEntry* entry = &entries[count];
+        Address_parse(&entry->addr, (uint8_t*) &nodes->bytes[i]);
+        entry->index = count;
+        entry->duplicate = false;
+        sorted[count++] = entry;
+    }
+
+    Order_OfResponseEntries_qsort(sorted, count);
+    for (int i = 0; i + 1 < count; i++) {
+        if (!Bits_memcmp(sorted[i]->addr.key, sorted[i + 1]->addr.key, Address_KEY_SIZE)) {
+            sorted[i]->duplicate = true;
         }
     }
-    return false;
+    return count;
 }
 
 static void searchStep(struct SearchRunner_Search* search);
 
-static void searchCallback(struct RouterModule_Promise* promise,
+/**
+ * Call the callback of a search, whoever started the search may free it from the callback.
+ *
+ * @return false if the search was freed and must not be touched.
+ */
+static bool callSearchCallback(struct SearchRunner_Search* search,
+                               uint32_t lagMilliseconds,
+                               struct Node* fromNode,
+                               Dict* result)
+{
+    if (!search->pub.callback) {
+        return true;
+    }
+    struct SearchRunner_pvt* runner = search->runner;
+    struct SearchRunner_Search* outer = runner->inCallback;
+    runner->inCallback = search;
+    search->pub.callback(&search->pub, lagMilliseconds, fromNode, result);
+    bool alive = (runner->inCallback == search);
+    runner->inCallback = outer;
+    return alive;
+}
+
+static void searchCallback(struct SearchRunner_Search* search,
                            uint32_t lagMilliseconds,
                            struct Node* fromNode,
-                           Dict* result)
+                           Dict* result,
+                           struct Allocator* alloc)
 {
-    struct SearchRunner_Search* search =
-        Identity_cast((struct SearchRunner_Search*)promise->userData);
     String* nodes = Dict_getString(result, CJDHTConstants_NODES);
 
     if (nodes && (nodes->len == 0 || nodes->len % Address_SERIALIZED_SIZE != 0)) {
@@ -185,16 +304,14 @@ static void searchCallback(struct RouterModule_Promise* promise,
         return;
     }
 
-    struct VersionList* versions = NULL;
+    struct VersionList_View versions = { .length = 0 };
     String* versionsStr = Dict_getString(result, CJDHTConstants_NODE_PROTOCOLS);
     if (versionsStr) {
-        versions = VersionList_parse(versionsStr, promise->alloc);
+        VersionList_view(&versions, versionsStr);
         #ifdef Version_1_COMPAT
             // Version 1 lies about the versions of other nodes, assume they're all v1.
             if (fromNode->version < 2) {
-                for (int i = 0; i < (int)versions->length; i++) {
-                    versions->versions[i] = 1;
-                }
+                versions.length = 0;
             }
         #endif
     }
@@ -202,19 +319,27 @@ static void searchCallback(struct RouterModule_Promise* promise,
     const uint32_t targetPrefix = Address_getPrefix(&search->target);
     const uint32_t parentDistance = Address_getPrefix(&fromNode->address) ^ targetPrefix;
 
-    for (uint32_t i = 0; nodes && i < nodes->len; i += Address_SERIALIZED_SIZE) {
-        if (isDuplicateEntry(nodes, i)) {
+    struct ResponseEntry entries[MAX_RESPONSE_ENTRIES];
+    int count = decodeEntries(entries, nodes);
+
+    // We need to splice the given addresses on to the end of the
+    // address of the node which gave them to us.
+    uint64_t paths[MAX_RESPONSE_ENTRIES];
+    for (int i = 0; i < count; i++) {
+        paths[i] = entries[i].addr.path;
+    }
+    LabelSplicer_spliceAll(paths, paths, count, fromNode->address.path);
+
+    for (int i = 0; i < count; i++) {
+        if (entries[i].duplicate) {
             continue;
         }
-        struct Address addr;
-        Address_parse(&addr, (uint8_t*) &nodes->bytes[i]);
+        struct Address addr = entries[i].addr;
 
         // calculate the ipv6
         Address_getPrefix(&addr);
 
-        // We need to splice the given address on to the end of the
-        // address of the node which gave it to us.
-        addr.path = LabelSplicer_splice(addr.path, fromNode->address.path);
+        addr.path = paths[i];
 
         /*#ifdef Log_DEBUG
             uint8_t splicedAddr[60];
@@ -248,7 +373,8 @@ static void searchCallback(struct RouterModule_Promise* promise,
         }
 
         // Nodes we are told about are inserted with 0 reach and assumed version 1.
-        uint32_t version = (versions) ? versions->versions[i / Address_SERIALIZED_SIZE] : 1;
+        uint32_t version = VersionList_viewVersion(&versions, i);
+        version = (version) ? version : 1;
         NodeStore_addNode(search->runner->nodeStore, &addr, 0, version);
 
         if ((newNodePrefix ^ targetPrefix) >= parentDistance
@@ -272,20 +398,103 @@ static void searchCallback(struct RouterModule_Promise* promise,
         return;
     }
 
-    if (search->pub.callback) {
-        search->pub.callback(&search->pub, lagMilliseconds, fromNode, result);
+    if (callSearchCallback(search, lagMilliseconds, fromNode, result)) {
+        searchStep(search);
     }
-    searchStep(search);
+}
+
+static void queryCallback(struct RouterModule_Promise* promise,
+                          uint32_t lagMilliseconds,
+                          struct Node* fromNode,
+                          Dict* result)
+{
+    struct SearchRunner_Query* query = Identity_cast((struct SearchRunner_Query*)promise->userData);
+    if (!fromNode) {
+        // Timeout, the searches have already moved on by way of their continueSearchTimeout.
+        return;
+    }
+
+    // Handling the reply adds nodes to the NodeStore which can evict fromNode to make room.
+    struct Node from;
+    Bits_memcpyConst(&from, fromNode, sizeof(struct Node));
+
+    // Any waiter which is freed in the process is removed from the list by searchOnFree().
+    query->answered = true;
+    while (query->waiterCount > 0) {
+        struct SearchRunner_Search* search = query->waiters[--query->waiterCount];
+        searchCallback(search, lagMilliseconds, &from, result, promise->alloc);
+    }
+}
+
+/** Let the most urgent of the searches which were put off take the free query slot. */
+static void wakeDeferredSearch(struct SearchRunner_pvt* runner)
+{
+    struct SearchRunner_Search* best = NULL;
+    for (struct SearchRunner_Search* s = runner->firstSearch; s; s = s->nextSearch) {
+        // The list is newest first so this picks the oldest of the most urgent.
+        if (s->deferred && (!best || s->priority <= best->priority)) {
+            best = s;
+        }
+    }
+    if (best) {
+        best->deferred = false;
+        Timeout_resetTimeout(best->continueSearchTimeout, 0);
+    }
+}
+
+static int queryOnFree(struct Allocator_OnFreeJob* job)
+{
+    struct SearchRunner_Query* query = Identity_cast((struct SearchRunner_Query*)job->userData);
+    struct SearchRunner_pvt* runner = query->runner;
+
+    *query->thisQuery = query->next;
+    if (query->next) {
+        query->next->thisQuery = query->thisQuery;
+    }
+    Assert_true(runner->queriesInFlight > 0);
+    runner->queriesInFlight--;
+    wakeDeferredSearch(runner);
+    return 0;
+}
+
+static struct SearchRunner_Query* queryInFlight(uint64_t path,
+                                                 uint8_t target[16],
+                                                 struct SearchRunner_pvt* runner)
+{
+    for (struct SearchRunner_Query* q = runner->firstQuery; q; q = q->next) {
+        if (q->path == path && !q->answered && !Bits_memcmp(q->target, target, 16)) {
+            return q;
+        }
+    }
+    return NULL;
 }
 
 /**
  * Send a search request to the next node in this search.
- * This is called whenever a response comes in or after the global mean response time passes.
+ * This is called whenever a response comes in or when the node last asked takes too long.
  */
 static void searchStep(struct SearchRunner_Search* search)
 {
     struct SearchRunner_pvt* ctx = Identity_cast((struct SearchRunner_pvt*)search->runner);
 
+    int maxQueries = ctx->maxQueriesInFlight;
+    if (search->priority == SearchRunner_Priority_MAINTENANCE) {
+        maxQueries -= USER_RESERVED_QUERIES;
+    }
+    // Searches which are only for maintenance also wait for the query budget,
+    // searches for traffic which is waiting to be forwarded go ahead anyway.
+    bool outOfBudget = search->priority == SearchRunner_Priority_MAINTENANCE
+        && !RouterModule_hasQueryBudget(ctx->router);
+    if (search->totalRequests < MAX_REQUESTS_PER_SEARCH
+        && (ctx->queriesInFlight >= maxQueries || outOfBudget))
+    {
+        // Try again when a query is answered or times out.
+        search->deferred = true;
+        Timeout_resetTimeout(search->continueSearchTimeout,
+                             RouterModule_searchTimeoutMilliseconds(NULL, ctx->router));
+        return;
+    }
+
     struct Node* node;
     struct SearchStore_Node* nextSearchNode;
     do {
@@ -293,10 +502,9 @@ static void searchStep(struct SearchRunner_Search* search)
 
         // If the number of requests sent has exceeded the max search requests, let's stop there.
         if (search->totalRequests >= MAX_REQUESTS_PER_SEARCH || nextSearchNode == NULL) {
-            if (search->pub.callback) {
-                search->pub.callback(&search->pub, 0, NULL, NULL);
+            if (callSearchCallback(search, 0, NULL, NULL)) {
+                Allocator_free(search->pub.alloc);
             }
-            Allocator_free(search->pub.alloc);
             return;
         }
 
@@ -305,20 +513,52 @@ static void searchStep(struct SearchRunner_Search* search)
     } while (!node || Bits_memcmp(node->address.ip6.bytes, nextSearchNode->address.ip6.bytes, 16));
 
     Bits_memcpyConst(&search->lastNodeAsked, &node->address, sizeof(struct Address));
+    search->totalRequests++;
+
+    // Move on to the next node if this one doesn't answer in about its usual time.
+    Timeout_resetTimeout(search->continueSearchTimeout,
+                         RouterModule_searchTimeoutMilliseconds(node, ctx->router));
+
+    struct SearchRunner_Query* query =
+        queryInFlight(node->address.path, search->target.ip6.bytes, ctx);
+    if (query && query->waiterCount < MAX_QUERY_WAITERS) {
+        // Another search already asked this node the same thing, share the answer.
+        query->waiters[query->waiterCount++] = search;
+        return;
+    }
 
-    struct RouterModule_Promise* rp =
-        RouterModule_newMessage(node, 0, ctx->router, search->pub.alloc);
+    // The query belongs to the runner so that it is still answered if the search which sent
+    // it is cancelled while others are waiting on it.
+    struct RouterModule_Promise* rp = RouterModule_newMessage(node, 0, ctx->router, ctx->alloc);
+
+    query = Allocator_clone(rp->alloc, (&(struct SearchRunner_Query) {
+        .path = node->address.path,
+        .waiters = { search },
+        .waiterCount = 1,
+        .runner = ctx,
+        .next = ctx->firstQuery,
+        .thisQuery = &ctx->firstQuery
+    }));
+    Identity_set(query);
+    Bits_memcpyConst(query->target, search->target.ip6.bytes, 16);
+    if (ctx->firstQuery) {
+        ctx->firstQuery->thisQuery = &query->next;
+    }
+    ctx->firstQuery = query;
+    ctx->queriesInFlight++;
+    Allocator_onFree(rp->alloc, queryOnFree, query);
 
     Dict* message = Dict_new(rp->alloc);
     Dict_putString(message, CJDHTConstants_QUERY, CJDHTConstants_QUERY_FN, rp->alloc);
-    Dict_putString(message, CJDHTConstants_TARGET, search->targetStr, rp->alloc);
+    Dict_putString(message,
+                   CJDHTConstants_TARGET,
+                   String_newBinary((char*)query->target, 16, rp->alloc),
+                   rp->alloc);
 
-    rp->userData = search;
-    rp->callback = searchCallback;
+    rp->userData = query;
+    rp->callback = queryCallback;
 
     RouterModule_sendMessage(rp, message);
-
-    search->totalRequests++;
 }
 
 // Triggered by a search timeout (the message may still come back and will be treated as a ping)
@@ -326,10 +566,7 @@ static void searchNextNode(void* vsearch)
 {
     struct SearchRunner_Search* search = Identity_cast((struct SearchRunner_Search*) vsearch);
 
-    // Timeout for trying the next node.
-    Timeout_resetTimeout(search->continueSearchTimeout,
-                         RouterModule_searchTimeoutMilliseconds(search->runner->router));
-
+    // searchStep() sets the timeout for trying the next node.
     searchStep(search);
 }
 
@@ -344,6 +581,19 @@ static int searchOnFree(struct Allocator_OnFreeJob* job)
     }
     Assert_true(search->runner->searches > 0);
     search->runner->searches--;
+    Probe_fire2(searchEnd, search->target.ip6.bytes, search->totalRequests);
+    if (search->runner->inCallback == search) {
+        search->runner->inCallback = NULL;
+    }
+
+    for (struct SearchRunner_Query* q = search->runner->firstQuery; q; q = q->next) {
+        for (int i = 0; i < q->waiterCount; i++) {
+            if (q->waiters[i] == search) {
+                q->waiters[i] = q->waiters[--q->waiterCount];
+                break;
+            }
+        }
+    }
     return 0;
 }
 
@@ -372,12 +622,15 @@ struct SearchRunner_SearchData* SearchRunner_showActiveSearch(struct SearchRunne
 }
 
 struct RouterModule_Promise* SearchRunner_search(uint8_t target[16],
+                                                 enum SearchRunner_Priority priority,
                                                  struct SearchRunner* searchRunner,
                                                  struct Allocator* allocator)
 {
     struct SearchRunner_pvt* runner = Identity_cast((struct SearchRunner_pvt*)searchRunner);
 
-    if (runner->searches > runner->maxConcurrentSearches) {
+    int maxSearches = (priority == SearchRunner_Priority_MAINTENANCE)
+        ? MAX_MAINTENANCE_SEARCHES : runner->maxConcurrentSearches;
+    if (runner->searches > maxSearches) {
         Log_debug(runner->logger, "Skipping search because there are already [%d] searches active",
                   runner->searches);
         return NULL;
@@ -406,10 +659,12 @@ struct RouterModule_Promise* SearchRunner_search(uint8_t target[16],
             .alloc = alloc
         },
         .runner = runner,
+        .priority = priority,
         .search = sss
     }));
     Identity_set(search);
     runner->searches++;
+    Probe_fire2(searchBegin, target, priority);
     Allocator_onFree(alloc, searchOnFree, search);
     Bits_memcpyConst(&search->target, &targetAddr, sizeof(struct Address));
 
@@ -420,8 +675,6 @@ struct RouterModule_Promise* SearchRunner_search(uint8_t target[16],
     runner->firstSearch = search;
     search->thisSearch = &runner->firstSearch;
 
-    search->targetStr = String_newBinary((char*)targetAddr.ip6.bytes, 16, alloc);
-
     // Trigger the searchNextNode() immedietly but asynchronously.
     search->continueSearchTimeout =
         Timeout_setTimeout(searchNextNode, search, 0, runner->eventBase, alloc);
@@ -441,7 +694,9 @@ struct SearchRunner* SearchRunner_new(struct NodeStore* nodeStore,
         .logger = logger,
         .eventBase = base,
         .router = module,
-        .maxConcurrentSearches = SearchRunner_DEFAULT_MAX_CONCURRENT_SEARCHES
+        .alloc = alloc,
+        .maxConcurrentSearches = SearchRunner_DEFAULT_MAX_CONCURRENT_SEARCHES,
+        .maxQueriesInFlight = SearchRunner_DEFAULT_MAX_QUERIES_IN_FLIGHT
     }));
     out->searchStore = SearchStore_new(alloc, logger);
     Bits_memcpyConst(out->myAddress, myAddress, 16);
@@ -44,18 +44,40 @@ struct SearchRunner
     int unused;
 };
 
-#define SearchRunner_DEFAULT_MAX_CONCURRENT_SEARCHES 30
+/**
+ * The most searches which may run at once. A search only holds the few nodes which it has
+ * learned of and searches beyond what the queries in flight allow simply wait their turn,
+ * so this is only a bound on memory.
+ */
+#define SearchRunner_DEFAULT_MAX_CONCURRENT_SEARCHES 1024
+
+/** Total number of search queries which may be awaiting a response, across all searches. */
+#define SearchRunner_DEFAULT_MAX_QUERIES_IN_FLIGHT 32
+
+enum SearchRunner_Priority
+{
+    /** Searches for a node which we are trying to send traffic to. */
+    SearchRunner_Priority_USER,
+
+    /** Routing table maintenance, these wait for user searches and never take the last slots. */
+    SearchRunner_Priority_MAINTENANCE
+};
 
 /**
  * Start a search.
  * The returned promise will have it's callback called for each result of the search and
  * then it will be called with 0 milliseconds lag and NULL response indicating the search is over.
  *
+ * Queries from different searches which would ask the same node about the same target are sent
+ * only once and the response is given to each of them.
+ *
  * @param searchTarget the address to search for.
+ * @param priority whether the search is holding up traffic or is routing table maintenance.
  * @param runner the search runner
  * @param alloc an allocator for the search, free this to cancel the search
  */
 struct RouterModule_Promise* SearchRunner_search(uint8_t searchTarget[16],
+                                                 enum SearchRunner_Priority priority,
                                                  struct SearchRunner* runner,
                                                  struct Allocator* alloc);
 
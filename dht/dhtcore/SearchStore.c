@@ -14,37 +14,135 @@
  */
 #include "dht/Address.h"
 #include "dht/dhtcore/SearchStore.h"
+#include "memory/Allocator.h"
 #include "util/Bits.h"
-#include "util/log/Log.h"
-#include "util/AverageRoller.h"
 #include "util/Endian.h"
-#include "util/events/Time.h"
+#include "util/Identity.h"
 
 /*--------------------Structures--------------------*/
 
+/** A node which has been added to a search, whether or not it has been asked yet. */
+struct SearchStore_Node_pvt
+{
+    struct SearchStore_Node pub;
+
+    /** XOR of the node's address and the target, most significant word first, host order. */
+    uint32_t distance[4];
+};
+
 /** An outstanding search for a target. */
 struct SearchStore_Search_pvt
 {
     struct SearchStore_Search pub;
 
-    /** Numbert of Address's in searchStack. */
-    uint16_t searchStackSize;
-
-    /** The index to insert the next node in nodesAsked, this will wrap. */
-    uint16_t nodesAskedIndex;
-
     /** The ID of what we are looking for. */
     uint8_t searchTarget[16];
 
-    /** The nodes to ask when performing the search. */
-    struct Address searchStack[SearchStore_SEARCH_NODES];
+    /** Nodes which have not been asked yet, a binary min-heap ordered by distance. */
+    struct SearchStore_Node_pvt** heap;
+    uint32_t heapSize;
+    uint32_t heapCapacity;
+
+    /**
+     * Every node which has been added to the search, hashed by key with open addressing.
+     * The size is a power of 2 and it is never more than half full.
+     */
+    struct SearchStore_Node_pvt** nodes;
+    uint32_t nodeCount;
+    uint32_t nodesSize;
 
-    /** The nodes which have already been queried in this search. */
-    struct SearchStore_Node nodesAsked[SearchStore_SEARCH_NODES];
+    Identity
 };
 
 /*--------------------Functions--------------------*/
 
+static inline int compareDistance(struct SearchStore_Node_pvt* a, struct SearchStore_Node_pvt* b)
+{
+    for (int i = 0; i < 4; i++) {
+        if (a->distance[i] != b->distance[i]) {
+            return (a->distance[i] < b->distance[i]) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static inline uint32_t hashKey(uint8_t key[32])
+{
+    // Keys are uniformly random so any part of one is as good as a hash.
+    uint32_t word;
+    Bits_memcpyConst(&word, key, 4);
+    return word;
+}
+
+/** @return the slot where the key is, or else the empty slot where it would go. */
+static uint32_t findSlot(uint8_t key[32], struct SearchStore_Search_pvt* search)
+{
+    const uint32_t mask = search->nodesSize - 1;
+    uint32_t i = hashKey(key) & mask;
+    while (search->nodes[i] && Bits_memcmp(search->nodes[i]->pub.address.key, key, 32)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void growNodes(struct SearchStore_Search_pvt* search)
+{
+    struct SearchStore_Node_pvt** old = search->nodes;
+    uint32_t oldSize = search->nodesSize;
+    search->nodesSize = oldSize * 2;
+    search->nodes = Allocator_calloc(search->pub.alloc, sizeof(char*), search->nodesSize);
+    for (uint32_t i = 0; i < oldSize; i++) {
+        if (old[i]) {
+            search->nodes[findSlot(old[i]->pub.address.key, search)] = old[i];
+        }
+    }
+}
+
+static void heapPush(struct SearchStore_Node_pvt* node, struct SearchStore_Search_pvt* search)
+{
+    if (search->heapSize == search->heapCapacity) {
+        search->heapCapacity *= 2;
+        search->heap = Allocator_realloc(search->pub.alloc,
+                                         search->heap,
+                                         search->heapCapacity * sizeof(char*));
+    }
+    uint32_t i = search->heapSize++;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (compareDistance(search->heap[parent], node) <= 0) {
+            break;
+        }
+        search->heap[i] = search->heap[parent];
+        i = parent;
+    }
+    search->heap[i] = node;
+}
+
+static struct SearchStore_Node_pvt* heapPop(struct SearchStore_Search_pvt* search)
+{
+    struct SearchStore_Node_pvt* out = search->heap[0];
+    struct SearchStore_Node_pvt* last = search->heap[--search->heapSize];
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t child = i * 2 + 1;
+        if (child >= search->heapSize) {
+            break;
+        }
+        if (child + 1 < search->heapSize
+            && compareDistance(search->heap[child + 1], search->heap[child]) < 0)
+        {
+            child++;
+        }
+        if (compareDistance(last, search->heap[child]) <= 0) {
+            break;
+        }
+        search->heap[i] = search->heap[child];
+        i = child;
+    }
+    search->heap[i] = last;
+    return out;
+}
+
 /** See: SearchStore.h */
 struct SearchStore* SearchStore_new(struct Allocator* allocator, struct Log* logger)
 {
@@ -65,9 +163,14 @@ struct SearchStore_Search* SearchStore_newSearch(uint8_t searchTarget[16],
                 .callbackContext = NULL,
                 .store = store,
                 .alloc = alloc
-            }
+            },
+            .heapCapacity = SearchStore_INITIAL_NODES,
+            .nodesSize = SearchStore_INITIAL_NODES * 2
         }));
     Bits_memcpyConst(search->searchTarget, searchTarget, Address_SEARCH_TARGET_SIZE);
+    search->heap = Allocator_malloc(alloc, search->heapCapacity * sizeof(char*));
+    search->nodes = Allocator_calloc(alloc, sizeof(char*), search->nodesSize);
+    Identity_set(search);
 
     return &search->pub;
 }
@@ -75,28 +178,33 @@ struct SearchStore_Search* SearchStore_newSearch(uint8_t searchTarget[16],
 /** See: SearchStore.h */
 int SearchStore_addNodeToSearch(struct Address* addr, struct SearchStore_Search* search)
 {
-    struct SearchStore_Search_pvt* pvtSearch = (struct SearchStore_Search_pvt*) search;
-    for (int i = 0; i < SearchStore_SEARCH_NODES; i++) {
-        if (!Bits_memcmp(addr->key, pvtSearch->nodesAsked[i].address.key, 32)) {
-            // Already bugged this node, skip.
-            return -1;
-        } else if (i == pvtSearch->nodesAskedIndex
-            && Bits_isZero(pvtSearch->nodesAsked[i].address.key, 32))
-        {
-            // short circuit a common case where the nodesAskedIndex has not yet wrapped.
-            break;
-        }
-    }
+    struct SearchStore_Search_pvt* pvtSearch =
+        Identity_cast((struct SearchStore_Search_pvt*) search);
 
-    const uint16_t index =
-        (pvtSearch->searchStackSize < SearchStore_SEARCH_NODES)
-            // add it to the end...
-            ? pvtSearch->searchStackSize++
+    uint32_t slot = findSlot(addr->key, pvtSearch);
+    if (pvtSearch->nodes[slot]) {
+        // Already bugged this node or about to, skip.
+        return -1;
+    }
 
-            // nodes are added worst-to-best so replace the last entry.
-            : pvtSearch->searchStackSize - 1;
+    struct SearchStore_Node_pvt* node =
+        Allocator_calloc(search->alloc, sizeof(struct SearchStore_Node_pvt), 1);
+    Bits_memcpyConst(&node->pub.address, addr, Address_SIZE);
+    node->pub.search = search;
+    Address_getPrefix(&node->pub.address);
+    for (int i = 0; i < 4; i++) {
+        uint32_t target_be;
+        uint32_t node_be;
+        Bits_memcpyConst(&target_be, &pvtSearch->searchTarget[i * 4], 4);
+        Bits_memcpyConst(&node_be, &node->pub.address.ip6.bytes[i * 4], 4);
+        node->distance[i] = Endian_bigEndianToHost32(target_be ^ node_be);
+    }
 
-    Bits_memcpyConst(&pvtSearch->searchStack[index], addr, Address_SIZE);
+    pvtSearch->nodes[slot] = node;
+    if (++pvtSearch->nodeCount * 2 > pvtSearch->nodesSize) {
+        growNodes(pvtSearch);
+    }
+    heapPush(node, pvtSearch);
 
     return 0;
 }
@@ -104,17 +212,10 @@ int SearchStore_addNodeToSearch(struct Address* addr, struct SearchStore_Search*
 /** See: SearchStore.h */
 struct SearchStore_Node* SearchStore_getNextNode(struct SearchStore_Search* search)
 {
-    struct SearchStore_Search_pvt* pvtSearch = (struct SearchStore_Search_pvt*) search;
-    if (!pvtSearch->searchStackSize) {
+    struct SearchStore_Search_pvt* pvtSearch =
+        Identity_cast((struct SearchStore_Search_pvt*) search);
+    if (!pvtSearch->heapSize) {
         return NULL;
     }
-
-    struct SearchStore_Node* nn = &pvtSearch->nodesAsked[pvtSearch->nodesAskedIndex];
-    Bits_memcpyConst(&nn->address,
-                     &pvtSearch->searchStack[--pvtSearch->searchStackSize],
-                     sizeof(struct Address));
-    nn->search = search;
-
-    pvtSearch->nodesAskedIndex = (pvtSearch->nodesAskedIndex + 1) % SearchStore_SEARCH_NODES;
-    return nn;
+    return &heapPop(pvtSearch)->pub;
 }
@@ -26,12 +26,11 @@ Linker_require("dht/dhtcore/SearchStore.c")
 
 
 /**
- * The number of nodes which will be held in a buffer when performing a search.
- * It is important that this number is large enough because when a search yields results, the
- * nodes which helped in get to those results have their reach number recalculated and if
- * they are prematurely evicted, they will not have their number recalculated.
+ * The number of nodes which a search has room for when it begins, the room grows as the search
+ * learns of more nodes. Nodes are not evicted while the search runs because when a search yields
+ * results, the nodes which helped in get to those results have their reach number recalculated.
  */
-#define SearchStore_SEARCH_NODES 256
+#define SearchStore_INITIAL_NODES 16
 
 /*--------------------Structures--------------------*/
 
@@ -81,7 +80,7 @@ struct SearchStore* SearchStore_new(struct Allocator* allocator, struct Log* log
  * @param searchTarget the ID of the thing which we are searching for.
  * @param store the SearchStore to allocate the search in.
  * @param alloc the allocator to use for allocating this search.
- * @return the new search or NULL if MAX_SEARCHES are already running.
+ * @return the new search.
  */
 struct SearchStore_Search* SearchStore_newSearch(uint8_t searchTarget[16],
                                                  struct SearchStore* store,
@@ -92,17 +91,17 @@ struct SearchStore_Search* SearchStore_newSearch(uint8_t searchTarget[16],
  *
  * @param address the address of the node to add.
  * @param search the search to add the node to.
- * @return -1 if this node has already been asked as part of this search, 0 otherwise.
+ * @return -1 if this node has already been added to this search, 0 otherwise.
  */
 int SearchStore_addNodeToSearch(struct Address* addr, struct SearchStore_Search* search);
 
 /**
  * Get the next node to ask in this search.
- * This will get the last node to be added to the search which has not been sent a request yet.
+ * This is the node nearest to the target by XOR distance which has not been asked yet.
  *
  * @param search the search to get the node for.
- * @param allocator the allocator to use for allocating the memory to store the output.
- * @return the node which is copied from the storage to the allocated space.
+ * @return the node, it remains valid for as long as the search does or NULL if there are no
+ *         nodes left to ask.
  */
 struct SearchStore_Node* SearchStore_getNextNode(struct SearchStore_Search* search);
 
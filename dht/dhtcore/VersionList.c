@@ -14,33 +14,39 @@
  */
 #include "dht/dhtcore/VersionList.h"
 #include "memory/Allocator.h"
-#include "io/Reader.h"
-#include "io/Writer.h"
-#include "io/ArrayWriter.h"
-#include "io/ArrayReader.h"
-#include "util/Endian.h"
-#include <stdio.h>
 
-struct VersionList* VersionList_parse(String* str, struct Allocator* alloc)
+int VersionList_view(struct VersionList_View* view, const String* str)
 {
-    const uint8_t numberSize = str->bytes[0];
-    if (str->len < 1 || numberSize == 0 || numberSize > 4) {
-        return NULL;
+    view->length = 0;
+    if (str->len < 1) {
+        return -1;
+    }
+    const uint8_t numberSize = (uint8_t) str->bytes[0];
+    if (numberSize == 0 || numberSize > 4) {
+        return -1;
     }
-
     uint32_t length = (str->len - 1) / numberSize;
 
     if ((length * numberSize) != (str->len - 1)) {
+        return -1;
+    }
+
+    view->bytes = (uint8_t*) &str->bytes[1];
+    view->numberSize = numberSize;
+    view->length = length;
+    return 0;
+}
+
+struct VersionList* VersionList_parse(String* str, struct Allocator* alloc)
+{
+    struct VersionList_View view;
+    if (VersionList_view(&view, str)) {
         return NULL;
     }
 
-    struct VersionList* list = VersionList_new(length, alloc);
-    struct Reader* r = ArrayReader_new(str->bytes + 1, str->len - 1, alloc);
+    struct VersionList* list = VersionList_new(view.length, alloc);
     for (int i = 0; i < (int)list->length; i++) {
-        uint32_t ver = 0;
-        Reader_read(r, (uint8_t*) &ver, numberSize);
-        ver = Endian_bigEndianToHost32(ver);
-        list->versions[i] = ver >> ((4-numberSize) * 8);
+        list->versions[i] = VersionList_viewVersion(&view, i);
     }
     return list;
 }
@@ -57,16 +63,17 @@ String* VersionList_stringify(struct VersionList* list, struct Allocator* alloc)
     }
 
     String* out = String_newBinary(NULL, (numberSize * list->length + 1), alloc);
+    out->bytes[0] = numberSize;
 
-    struct Writer* w = ArrayWriter_new(out->bytes, out->len, alloc);
-    Writer_write(w, &numberSize, 1);
-
+    uint8_t* bytes = (uint8_t*) &out->bytes[1];
     for (int i = 0; i < (int)list->length; i++) {
-        uint32_t ver = list->versions[i] << ((4-numberSize) * 8);
-        ver = Endian_hostToBigEndian32(ver);
-        Writer_write(w, (uint8_t*) &ver, numberSize);
+        uint32_t ver = list->versions[i];
+        for (int j = numberSize - 1; j >= 0; j--) {
+            bytes[j] = ver & 0xff;
+            ver >>= 8;
+        }
+        bytes += numberSize;
     }
-    Writer_write(w, &numberSize, 1);
 
     return out;
 }
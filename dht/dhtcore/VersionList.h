@@ -29,6 +29,46 @@ struct VersionList
     uint32_t* versions;
 };
 
+/**
+ * A version list read in place from its serialized form, nothing is copied or allocated.
+ * The view is only valid as long as the string which it was made from.
+ */
+struct VersionList_View
+{
+    const uint8_t* bytes;
+    uint32_t length;
+    uint8_t numberSize;
+};
+
+/**
+ * Make a view of a serialized version list.
+ *
+ * @param view the view to fill in, if the string is not a valid list it will have 0 length.
+ * @param str the serialized list.
+ * @return 0 if the string is a valid version list, -1 otherwise.
+ */
+int VersionList_view(struct VersionList_View* view, const String* str);
+
+/**
+ * Get a version from a view.
+ *
+ * @param view the view made by VersionList_view().
+ * @param index the number of the entry.
+ * @return the version or 0 if index is past the end of the list.
+ */
+static inline uint32_t VersionList_viewVersion(const struct VersionList_View* view, uint32_t index)
+{
+    if (index >= view->length) {
+        return 0;
+    }
+    const uint8_t* bytes = &view->bytes[index * view->numberSize];
+    uint32_t ver = 0;
+    for (int i = 0; i < view->numberSize; i++) {
+        ver = (ver << 8) | bytes[i];
+    }
+    return ver;
+}
+
 struct VersionList* VersionList_parse(String* str, struct Allocator* alloc);
 
 String* VersionList_stringify(struct VersionList* list, struct Allocator* alloc);
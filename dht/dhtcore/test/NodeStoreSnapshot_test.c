@@ -0,0 +1,145 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/String.h"
+#include "crypto/AddressCalc.h"
+#include "crypto/random/Random.h"
+#include "dht/Address.h"
+#include "dht/dhtcore/Node.h"
+#include "dht/dhtcore/NodeStore.h"
+#include "dht/dhtcore/NodeStoreSnapshot.h"
+#include "io/FileWriter.h"
+#include "memory/MallocAllocator.h"
+#include "switch/NumberCompress.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/events/EventBase.h"
+#include "util/log/WriterLog.h"
+#include "util/version/Version.h"
+
+#include <stdio.h>
+
+#define NODES 5
+
+static uint64_t getPath(int* hops)
+{
+    int i;
+    uint64_t out = 0;
+    for (i = 0; hops[i] != 1; i++) ;
+    for (; i >= 0; i--) {
+        int bits = NumberCompress_bitsUsedForNumber(hops[i]);
+        out <<= bits;
+        out |= NumberCompress_getCompressed(hops[i], bits);
+    }
+    return out;
+}
+
+/** @return the size of the file or -1 if it does not exist. */
+static long fileSize(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+static void randomAddress(struct Address* addr, uint64_t path, struct Random* rand)
+{
+    do {
+        Random_bytes(rand, addr->key, 32);
+    } while (!AddressCalc_addressForPublicKey(addr->ip6.bytes, addr->key));
+    addr->path = path;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Log* logger = WriterLog_new(FileWriter_new(stdout, alloc), alloc);
+    struct Random* rand = Random_new(alloc, logger, NULL);
+    struct EventBase* base = EventBase_new(alloc);
+    String* path =
+        String_printf(alloc, "/tmp/NodeStoreSnapshot_test.%u", Random_uint32(rand));
+
+    struct Address myAddr;
+    randomAddress(&myAddr, 1, rand);
+    struct NodeStore* store = NodeStore_new(&myAddr, 8, alloc, logger, rand);
+
+    // Three peers, a node behind the first and a node with zero reach which will be left out.
+    uint64_t paths[NODES] = {
+        getPath((int[]){2,1}),
+        getPath((int[]){3,1}),
+        getPath((int[]){4,1}),
+        getPath((int[]){2,2,1}),
+        getPath((int[]){5,1})
+    };
+    struct Address addrs[NODES];
+    for (int i = 0; i < NODES; i++) {
+        randomAddress(&addrs[i], paths[i], rand);
+        int reach = (i < NODES - 1) ? 100 + i : 0;
+        Assert_always(NodeStore_addNode(store, &addrs[i], reach, Version_CURRENT_PROTOCOL));
+    }
+
+    // A new file, nothing to load.
+    struct Allocator* snapAlloc = Allocator_child(alloc);
+    struct NodeStoreSnapshot* snapshot =
+        NodeStoreSnapshot_new(path->bytes, store, NULL, base, logger, snapAlloc);
+    Assert_always(snapshot);
+    Assert_always(NodeStoreSnapshot_loaded(snapshot) == 0);
+    Assert_always(NodeStoreSnapshot_save(snapshot) == NODES - 1);
+    Allocator_free(snapAlloc);
+
+    struct NodeStore* store2 = NodeStore_new(&myAddr, 8, alloc, logger, rand);
+    snapAlloc = Allocator_child(alloc);
+    snapshot = NodeStoreSnapshot_new(path->bytes, store2, NULL, base, logger, snapAlloc);
+    Assert_always(NodeStoreSnapshot_loaded(snapshot) == NODES - 1);
+    Assert_always(NodeStore_size(store2) == NODES - 1);
+    for (int i = 0; i < NODES; i++) {
+        struct Node* n = NodeStore_getNodeByNetworkAddr(addrs[i].path, store2);
+        if (i < NODES - 1) {
+            // Loaded nodes are not trusted until they answer a ping.
+            Assert_always(n && Address_isSame(&n->address, &addrs[i]) && n->reach == 0);
+        } else {
+            Assert_always(!n);
+        }
+    }
+
+    // The loaded nodes have no reach yet so none are saved and nothing of the old table is left.
+    Assert_always(NodeStoreSnapshot_save(snapshot) == 0);
+    Assert_always(fileSize(path->bytes) == 16);
+    String* tempPath = String_printf(alloc, "%s.tmp", path->bytes);
+    Assert_always(fileSize(tempPath->bytes) < 0);
+    Allocator_free(snapAlloc);
+
+    // Garbage is ignored.
+    FILE* file = fopen(path->bytes, "wb");
+    fwrite("cjdnsNS0", 8, 1, file);
+    fclose(file);
+    struct NodeStore* store3 = NodeStore_new(&myAddr, 8, alloc, logger, rand);
+    struct NodeStoreSnapshot* snapshot3 =
+        NodeStoreSnapshot_new(path->bytes, store3, NULL, base, logger, alloc);
+    Assert_always(NodeStoreSnapshot_loaded(snapshot3) == 0);
+    Assert_always(NodeStore_size(store3) == 0);
+
+    // Freeing the snapshot saves it once more.
+    char pathCopy[64];
+    Assert_always(path->len < sizeof(pathCopy));
+    Bits_memcpy(pathCopy, path->bytes, path->len + 1);
+    Allocator_free(alloc);
+    remove(pathCopy);
+    return 0;
+}
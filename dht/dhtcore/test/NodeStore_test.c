@@ -312,7 +312,8 @@ static void test_nonZeroNodes()
     struct NodeStore* store = setUp(randomAddress(), 8);
     struct Node* node =
        NodeStore_addNode(store, randomIp((int[]){0,1}), 1, Version_CURRENT_PROTOCOL);
-    NodeStore_addNode(store, randomIp((int[]){2,1}), 1, Version_CURRENT_PROTOCOL);
+    struct Node* other =
+       NodeStore_addNode(store, randomIp((int[]){2,1}), 1, Version_CURRENT_PROTOCOL);
     NodeStore_addNode(store, randomIp((int[]){3,1}), 1, Version_CURRENT_PROTOCOL);
     NodeStore_addNode(store, randomIp((int[]){4,1}), 1, Version_CURRENT_PROTOCOL);
     Assert_always(store->size == 4);
@@ -322,6 +323,12 @@ static void test_nonZeroNodes()
     node->reach = 0;
     NodeStore_updateReach(node, store);
     Assert_always(NodeStore_nonZeroNodes(store)==3);
+
+    Assert_always(NodeStore_nonZeroNodesInRange(0, UINT32_MAX, store) == 3);
+    uint32_t prefix = Address_getPrefix(&node->address);
+    Assert_always(NodeStore_nonZeroNodesInRange(prefix, prefix, store) == 0);
+    prefix = Address_getPrefix(&other->address);
+    Assert_always(NodeStore_nonZeroNodesInRange(prefix, prefix, store) == 1);
 }
 
 static void test_size()
@@ -332,6 +339,76 @@ static void test_size()
     Assert_always(NodeStore_size(store) == 1);
 }
 
+static void test_memoryBudget()
+{
+    struct NodeStore* store = setUp(randomAddress(), 8);
+    struct Address* addr = randomIp((int[]){0,1}/*0x13*/);
+    NodeStore_addNode(store, addr, 1, Version_CURRENT_PROTOCOL);
+    addr->path = getPath((int[]){2,1}) /*0x15*/;
+    NodeStore_addNode(store, addr, 3, Version_CURRENT_PROTOCOL);
+    addr->path = getPath((int[]){3,1}) /*0x17*/;
+    NodeStore_addNode(store, addr, 2, Version_CURRENT_PROTOCOL);
+    Assert_always(NodeStore_size(store) == 3);
+
+    // shrinking keeps the most reachable nodes
+    Assert_always(NodeStore_setMemoryBudget(store, 0) == 1);
+    Assert_always(NodeStore_size(store) == 1);
+    Assert_always(NodeStore_dumpTable(store, 0)->address.path == getPath((int[]){2,1}));
+
+    // once full, a new node replaces the least reachable one
+    addr->path = getPath((int[]){0,1});
+    struct Node* node = NodeStore_addNode(store, addr, 5, Version_CURRENT_PROTOCOL);
+    Assert_always(node && node->address.path == getPath((int[]){0,1}));
+    Assert_always(NodeStore_size(store) == 1);
+
+    // and the table grows again when the budget allows
+    Assert_always(NodeStore_setMemoryBudget(store, UINT32_MAX) > 2);
+    addr->path = getPath((int[]){2,1});
+    NodeStore_addNode(store, addr, 1, Version_CURRENT_PROTOCOL);
+    Assert_always(NodeStore_size(store) == 2);
+}
+
+static void test_nodesStayPut()
+{
+    struct NodeStore* store = setUp(randomAddress(), 256);
+    struct Address* addr = randomIp((int[]){0,1}/*0x13*/);
+    struct Node* node = NodeStore_addNode(store, addr, 1, Version_CURRENT_PROTOCOL);
+    Assert_always(node);
+
+    // Enough paths to the same node that the table has to grow a couple of times.
+    for (int i = 2; NodeStore_size(store) < 200; i++) {
+        addr->path = getPath((int[]){i,1});
+        Assert_always(NodeStore_addNode(store, addr, 1, Version_CURRENT_PROTOCOL));
+    }
+    Assert_always(node->address.path == getPath((int[]){0,1}));
+    Assert_always(NodeStore_getNodeByNetworkAddr(getPath((int[]){0,1}), store) == node);
+}
+
+static void test_mightHaveNode()
+{
+    struct NodeStore* store = setUp(randomAddress(), 8);
+    struct Address* a = randomIp((int[]){0,1}/*0x13*/);
+    struct Address* b = randomIp((int[]){2,1}/*0x15*/);
+    uint8_t unknown[16] = { 0xfc, [8] = 0x5a, [11] = 0xa5, [15] = 0x01 };
+    Assert_always(!NodeStore_mightHaveNode(store, a->ip6.bytes));
+
+    NodeStore_addNode(store, a, 1, Version_CURRENT_PROTOCOL);
+    a->path = getPath((int[]){3,1}) /*0x17*/;
+    NodeStore_addNode(store, a, 2, Version_CURRENT_PROTOCOL);
+    Assert_always(NodeStore_size(store) == 2);
+    Assert_always(NodeStore_mightHaveNode(store, a->ip6.bytes));
+    Assert_always(!NodeStore_mightHaveNode(store, b->ip6.bytes));
+    Assert_always(!NodeStore_mightHaveNode(store, unknown));
+
+    // Dropping one of the two paths keeps the node, evicting the other one forgets it.
+    Assert_always(NodeStore_setMemoryBudget(store, 0) == 1);
+    Assert_always(NodeStore_mightHaveNode(store, a->ip6.bytes));
+    NodeStore_addNode(store, b, 5, Version_CURRENT_PROTOCOL);
+    Assert_always(NodeStore_size(store) == 1);
+    Assert_always(NodeStore_mightHaveNode(store, b->ip6.bytes));
+    Assert_always(!NodeStore_mightHaveNode(store, a->ip6.bytes));
+}
+
 static void test_getNodeByNetworkAddr()
 {
     struct NodeStore* store = setUp(randomAddress(), 8);
@@ -364,12 +441,64 @@ static void test_brokenPath()
     NodeStore_addNode(store, c, 1, Version_CURRENT_PROTOCOL);
 
     // calling brokenPath on B directly should remove it
+    uint32_t generation = store->generation;
     Assert_always(NodeStore_brokenPath(b->path, store)==2);
+    Assert_always(store->generation != generation);
 
     // should only have 1 valid route now...
     Assert_always(NodeStore_nonZeroNodes(store)==1);
 }
 
+static struct Address* withPath(struct Address* addr, int* hops)
+{
+    struct Address* out = Allocator_clone(alloc, addr);
+    out->path = getPath(hops);
+    return out;
+}
+
+static void test_getPaths()
+{
+    struct Address* myAddr = randomIp((int[]){1});
+    struct NodeStore* store = setUp(myAddr, 16);
+    NodeStore_addNode(store, randomIp((int[]){2,1}), 1, Version_CURRENT_PROTOCOL);
+    NodeStore_addNode(store, randomIp((int[]){3,1}), 1, Version_CURRENT_PROTOCOL);
+    NodeStore_addNode(store, randomIp((int[]){4,1}), 1, Version_CURRENT_PROTOCOL);
+    struct Address* relay = randomIp((int[]){3,2,1});
+    NodeStore_addNode(store, relay, 1, Version_CURRENT_PROTOCOL);
+    NodeStore_addNode(store, withPath(relay, (int[]){4,2,1}), 1, Version_CURRENT_PROTOCOL);
+
+    struct Address* target = randomIp((int[]){2,2,1});
+    NodeStore_addNode(store, target, 100, Version_CURRENT_PROTOCOL);
+    // same first hop as the best path
+    NodeStore_addNode(store, withPath(target, (int[]){2,3,1}), 50, Version_CURRENT_PROTOCOL);
+    // through the relay
+    NodeStore_addNode(store, withPath(target, (int[]){3,2,2,1}), 40, Version_CURRENT_PROTOCOL);
+    // through the relay again by another way
+    NodeStore_addNode(store, withPath(target, (int[]){4,2,2,1}), 30, Version_CURRENT_PROTOCOL);
+
+    Assert_always(NodeStore_getNodesByAddr(target, 4, alloc, store)->size == 4);
+
+    struct NodeList* list = NodeStore_getPaths(target, 4, alloc, store);
+    Assert_always(list->size == 2);
+    Assert_always(list->nodes[0]->address.path == getPath((int[]){2,2,1}));
+    Assert_always(list->nodes[1]->address.path == getPath((int[]){3,2,2,1}));
+    Assert_always(Address_isSameIp(&list->nodes[1]->address, target));
+
+    Assert_always(NodeStore_getPaths(target, 1, alloc, store)->size == 1);
+
+    // when the first path breaks the alternate is still there
+    NodeStore_brokenPath(getPath((int[]){2,1}), store);
+    list = NodeStore_getPaths(target, 4, alloc, store);
+    Assert_always(list->size == 1);
+    Assert_always(list->nodes[0]->address.path == getPath((int[]){3,2,2,1}));
+
+    // and the other way to the relay once the first one is gone
+    NodeStore_brokenPath(getPath((int[]){3,1}), store);
+    list = NodeStore_getPaths(target, 4, alloc, store);
+    Assert_always(list->size == 1);
+    Assert_always(list->nodes[0]->address.path == getPath((int[]){4,2,2,1}));
+}
+
 static void test_dumpTable()
 {
     struct NodeStore* store = setUp(randomAddress(), 8);
@@ -417,6 +546,12 @@ static void test_pathfinderTwo_splitLink()
     struct Node_Two* node39ee = linkEfEf39ee->child;
     Assert_always(NodeStore_linkCount(linkEfEf39ee->child) == 0);
 
+    // A route which is asked for twice comes from the cache the second time.
+    uint64_t pathToEfef = linkSelfEfef->cannonicalLabel;
+    uint64_t label = NodeStore_getRouteLabel(store, pathToEfef, node39ee->address.ip6.bytes);
+    Assert_always(!NodeStore_getRouteLabel_strerror(label));
+    Assert_always(label == NodeStore_getRouteLabel(store, pathToEfef, node39ee->address.ip6.bytes));
+
     // fc1e:7c83:c316:11e3:2b3b:0b25:e667:2765  0000.0000.0000.0029 --> 0000.0000.0000.0531
     NodeStore_discoverNode(store, randomIp((int[]){8,4,1}), 0,
                            Version_CURRENT_PROTOCOL, scheme, 0);
@@ -431,6 +566,55 @@ static void test_pathfinderTwo_splitLink()
         NodeStore_getLink(store, linkEfef2765->child->address.ip6.bytes, 0);
     Assert_always(link276539ee->child == node39ee);
     Assert_always(NodeStore_linkCount(node39ee) == 0);
+
+    // Splitting the link must invalidate the cached route.
+    Assert_always(NodeStore_getRouteLabel(store, pathToEfef, node39ee->address.ip6.bytes)
+        == NodeStore_getRouteLabel_PARENT_NOT_LINKED_TO_CHILD);
+}
+
+static void test_pathfinderTwo_discoverNodes()
+{
+    #ifndef EXPERIMENTAL_PATHFINDER
+        return;
+    #endif
+    struct NodeStore* store = setUp(randomAddress(), 8);
+    struct EncodingScheme* scheme = NumberCompress_defineScheme(alloc);
+
+    // Out of order, the node behind the others comes first and one is heard from twice.
+    struct Address* addrs[] = {
+        randomIp((int[]){8,4,8,4,1}),
+        randomIp((int[]){8,4,1}),
+        randomIp((int[]){3,1}),
+        randomIp((int[]){8,1})
+    };
+    struct NodeStore_Discovery discoveries[5];
+    for (int i = 0; i < 5; i++) {
+        discoveries[i] = (struct NodeStore_Discovery) {
+            .addr = *addrs[i % 4],
+            .version = Version_CURRENT_PROTOCOL,
+            .scheme = scheme
+        };
+    }
+    NodeStore_discoverNodes(store, discoveries, 5);
+
+    // Placed just as one at a time from the nearest: self->{3,1} and self->{8,1}->{8,4,1}->...
+    Assert_always(NodeStore_linkCount(store->selfNode) == 3);
+    struct Node_Two* nodes[4];
+    for (int i = 0; i < 4; i++) {
+        nodes[i] = NodeStore_getNode2(store, addrs[i]->ip6.bytes);
+        Assert_always(nodes[i]);
+    }
+    Assert_always(NodeStore_linkCount(nodes[3]) == 1);
+    Assert_always(NodeStore_getLink(store, nodes[3]->address.ip6.bytes, 0)->child == nodes[1]);
+    Assert_always(NodeStore_linkCount(nodes[1]) == 1);
+    Assert_always(NodeStore_getLink(store, nodes[1]->address.ip6.bytes, 0)->child == nodes[0]);
+    Assert_always(NodeStore_linkCount(nodes[0]) == 0);
+    Assert_always(NodeStore_linkCount(nodes[2]) == 0);
+
+    // Nodes with the same encoding scheme share one copy of it.
+    for (int i = 0; i < 4; i++) {
+        Assert_always(nodes[i]->encodingScheme == store->selfNode->encodingScheme);
+    }
 }
 
 int main(int argc, char** argv)
@@ -456,6 +640,11 @@ int main(int argc, char** argv)
     test_brokenPath();
     test_dumpTable();
     test_pathfinderTwo_splitLink();
+    test_memoryBudget();
+    test_nodesStayPut();
+    test_getPaths();
+    test_mightHaveNode();
+    test_pathfinderTwo_discoverNodes();
 
     Allocator_free(alloc);
     return 0;
@@ -0,0 +1,76 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/MallocAllocator.h"
+#include "crypto/random/Random.h"
+#include "dht/Address.h"
+#include "dht/dhtcore/SearchStore.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#define COUNT (SearchStore_INITIAL_NODES * 8)
+
+/** @return true if a is nearer to the target than b or as near. */
+static bool nearer(uint8_t target[16], struct Address* a, struct Address* b)
+{
+    for (int i = 0; i < 16; i++) {
+        uint8_t da = a->ip6.bytes[i] ^ target[i];
+        uint8_t db = b->ip6.bytes[i] ^ target[i];
+        if (da != db) {
+            return da < db;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+    struct SearchStore* store = SearchStore_new(alloc, NULL);
+
+    uint8_t target[16];
+    Random_bytes(rand, target, 16);
+    struct SearchStore_Search* search = SearchStore_newSearch(target, store, alloc);
+
+    // More nodes than the search has room for to begin with.
+    struct Address addrs[COUNT];
+    for (int i = 0; i < COUNT; i++) {
+        Bits_memset(&addrs[i], 0, sizeof(struct Address));
+        Random_bytes(rand, addrs[i].key, 32);
+        Random_bytes(rand, addrs[i].ip6.bytes, 16);
+        addrs[i].ip6.bytes[0] = 0xfc;
+        addrs[i].path = i;
+        Assert_always(!SearchStore_addNodeToSearch(&addrs[i], search));
+    }
+
+    // A node which has been added is not added again, asked or not.
+    Assert_always(SearchStore_addNodeToSearch(&addrs[3], search) == -1);
+
+    struct SearchStore_Node* last = NULL;
+    for (int i = 0; i < COUNT; i++) {
+        struct SearchStore_Node* node = SearchStore_getNextNode(search);
+        Assert_always(node && node->search == search);
+        Assert_always(node->address.path < COUNT);
+        if (last) {
+            Assert_always(nearer(target, &last->address, &node->address));
+        }
+        last = node;
+    }
+    Assert_always(!SearchStore_getNextNode(search));
+    Assert_always(SearchStore_addNodeToSearch(&addrs[COUNT - 1], search) == -1);
+
+    Allocator_free(alloc);
+    return 0;
+}
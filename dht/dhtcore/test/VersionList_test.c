@@ -51,9 +51,24 @@ int main()
                 printf("[%d] [%d]\n", vl2->versions[i], vl->versions[i]);
                 Assert_always(vl2->versions[i] == vl->versions[i]);
             }
+
+            struct VersionList_View view;
+            Assert_always(!VersionList_view(&view, str) && view.length == count);
+            for (uint32_t i = 0; i < count; i++) {
+                Assert_always(VersionList_viewVersion(&view, i) == vl->versions[i]);
+            }
+            Assert_always(VersionList_viewVersion(&view, count) == 0);
         }
     }
 
+    // Lists which do not decode have no entries.
+    struct VersionList_View view;
+    Assert_always(VersionList_view(&view, String_CONST("")) && view.length == 0);
+    Assert_always(VersionList_view(&view, String_CONST("\x05\x01\x02\x03\x04\x05")));
+    Assert_always(VersionList_view(&view, String_CONST("\x02\x01\x01\x01")));
+    Assert_always(view.length == 0 && VersionList_viewVersion(&view, 0) == 0);
+    Assert_always(!VersionList_parse(String_CONST("\x80\x01"), alloc));
+
     Allocator_free(alloc);
     return 0;
 }
@@ -0,0 +1,127 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "benc/serialization/standard/StandardBencSerializer.h"
+#include "dht/DHTMessage.h"
+#include "dht/DHTModule.h"
+#include "dht/DHTModuleRegistry.h"
+#include "dht/SerializationModule.h"
+#include "io/ArrayReader.h"
+#include "io/ArrayWriter.h"
+#include "io/FileWriter.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/log/WriterLog.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#include <stdio.h>
+#define string_strlen
+#include "util/platform/libc/string.h"
+
+struct Context
+{
+    Dict* received;
+    int calls;
+};
+
+static int handleIncoming(struct DHTMessage* message, void* vcontext)
+{
+    struct Context* ctx = vcontext;
+    ctx->received = message->asDict;
+    ctx->calls++;
+    return 0;
+}
+
+static int serialize(char* out, Dict* dict, struct Allocator* alloc)
+{
+    struct Writer* w = ArrayWriter_new(out, DHTMessage_MAX_SIZE, alloc);
+    Assert_always(!StandardBencSerializer_get()->serializeDictionary(w, dict));
+    return w->bytesWritten;
+}
+
+/** Run the message through the module and check it parses the same as StandardBencSerializer. */
+static Dict* parse(char* benc, struct DHTModuleRegistry* reg, struct Context* ctx,
+                   struct Allocator* alloc)
+{
+    struct DHTMessage message;
+    Bits_memset(&message, 0, sizeof(struct DHTMessage));
+    message.length = strlen(benc);
+    Bits_memcpy(message.bytes, benc, message.length);
+    message.allocator = alloc;
+
+    int calls = ctx->calls;
+    DHTModuleRegistry_handleIncoming(&message, reg);
+    if (ctx->calls == calls) {
+        return NULL;
+    }
+
+    Dict expected;
+    struct Reader* r = ArrayReader_new(benc, message.length, alloc);
+    Assert_always(!StandardBencSerializer_get()->parseDictionary(r, alloc, &expected));
+
+    char expectedBytes[DHTMessage_MAX_SIZE];
+    char gotBytes[DHTMessage_MAX_SIZE];
+    int expectedLength = serialize(expectedBytes, &expected, alloc);
+    Assert_always(expectedLength == serialize(gotBytes, ctx->received, alloc));
+    Assert_always(!Bits_memcmp(expectedBytes, gotBytes, expectedLength));
+    return ctx->received;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Writer* logWriter = FileWriter_new(stdout, alloc);
+    struct Log* logger = WriterLog_new(logWriter, alloc);
+
+    struct Context ctx = { .calls = 0 };
+    struct DHTModule module = {
+        .name = "TestModule",
+        .context = &ctx,
+        .handleIncoming = handleIncoming
+    };
+    struct DHTModuleRegistry* reg = DHTModuleRegistry_new(alloc);
+    DHTModuleRegistry_register(&module, reg);
+    SerializationModule_register(reg, logger, alloc);
+
+    // Query and reply with only strings and integers.
+    Dict* d = parse("d1:q2:fn3:tar16:abcdefghijklmnop4:txid4:12341:pi6ee", reg, &ctx, alloc);
+    Assert_always(d);
+    Assert_always(*Dict_getInt(d, String_CONST("p")) == 6);
+    String* target = Dict_getString(d, String_CONST("tar"));
+    Assert_always(target && target->len == 16 && target->bytes[16] == '\0');
+
+    d = parse("d1:n0:2:npi-12e2:es3:\x01\x02\x03" "4:txid0:e", reg, &ctx, alloc);
+    Assert_always(d && *Dict_getInt(d, String_CONST("np")) == -12);
+    Assert_always(Dict_getString(d, String_CONST("es"))->len == 3);
+
+    d = parse("de", reg, &ctx, alloc);
+    Assert_always(ctx.calls == 3 && d && *d == NULL);
+
+    // Nested values go to the full parser.
+    d = parse("d4:listl1:a1:be4:txid2:xxe", reg, &ctx, alloc);
+    Assert_always(d && List_size(Dict_getList(d, String_CONST("list"))) == 2);
+
+    // Neither parser will have these.
+    Assert_always(!parse("d4:txid", reg, &ctx, alloc));
+    Assert_always(!parse("d9:txid2:xxe", reg, &ctx, alloc));
+    Assert_always(!parse("d4:txidi12", reg, &ctx, alloc));
+    Assert_always(ctx.calls == 4);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,192 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/Coalescer.h"
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
+#include "util/Identity.h"
+#include "util/events/Timeout.h"
+#include "wire/Error.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+/** Each packet in a bundle has a 2 byte length and 2 zero bytes before it. */
+#define ENTRY_HEADER_SIZE 4
+
+/** Room for the bundled packets, the switch header is added when the bundle is sent. */
+#define BUFFER_SIZE (Coalescer_MAX_BUNDLE - Headers_SwitchHeader_SIZE)
+
+struct Coalescer_pvt
+{
+    struct Coalescer pub;
+
+    struct Interface* wrapped;
+
+    struct EventBase* base;
+
+    struct Allocator* alloc;
+
+    /** Fires at the end of the turn of the event loop, created the first time it is needed. */
+    struct Timeout* flushTimeout;
+    bool flushPending;
+
+    /** The packets being held, each as it will be in the bundle. */
+    uint8_t buffer[BUFFER_SIZE];
+    uint32_t length;
+    uint32_t count;
+
+    /** The last bundle was lost because the link was full. */
+    bool linkFull;
+
+    Identity
+};
+
+static inline uint32_t entrySize(uint32_t length)
+{
+    return ENTRY_HEADER_SIZE + ((length + 3) & ~3u);
+}
+
+static void flush(struct Coalescer_pvt* ctx)
+{
+    if (!ctx->count) {
+        return;
+    }
+    struct Allocator* alloc = Allocator_child(ctx->alloc);
+    struct Message* msg;
+    if (ctx->count == 1) {
+        // Nothing to share the packet with, send it as it was.
+        uint16_t length_be;
+        Bits_memcpyConst(&length_be, ctx->buffer, 2);
+        uint32_t length = Endian_bigEndianToHost16(length_be);
+        msg = Message_new(length, Interface_PADDING, alloc);
+        Bits_memcpy(msg->bytes, &ctx->buffer[ENTRY_HEADER_SIZE], length);
+    } else {
+        msg = Message_new(Headers_SwitchHeader_SIZE + ctx->length, Interface_PADDING, alloc);
+        struct Headers_SwitchHeader* header = (struct Headers_SwitchHeader*) msg->bytes;
+        header->label_be = 0;
+        Headers_setPriorityAndMessageType(header, 0, Headers_SwitchHeader_TYPE_BUNDLE);
+        Bits_memcpy(&msg->bytes[Headers_SwitchHeader_SIZE], ctx->buffer, ctx->length);
+        ctx->pub.bundlesOut++;
+        ctx->pub.packetsCoalesced += ctx->count;
+    }
+    uint8_t ret = Interface_sendMessage(ctx->wrapped, msg);
+    if (ret != Error_NONE) {
+        ctx->pub.dropped += ctx->count;
+        ctx->linkFull |= (ret == Error_LINK_LIMIT_EXCEEDED);
+    }
+    Allocator_free(alloc);
+    ctx->length = 0;
+    ctx->count = 0;
+}
+
+static void flushTimeout(void* vctx)
+{
+    struct Coalescer_pvt* ctx = Identity_cast((struct Coalescer_pvt*) vctx);
+    ctx->flushPending = false;
+    flush(ctx);
+}
+
+static uint8_t sendMessage(struct Message* msg, struct Interface* iface)
+{
+    struct Coalescer_pvt* ctx = Identity_cast((struct Coalescer_pvt*) iface->senderContext);
+
+    if (!ctx->pub.enabled || msg->length > Coalescer_MAX_PACKET) {
+        flush(ctx);
+        return Interface_sendMessage(ctx->wrapped, msg);
+    }
+
+    if (ctx->linkFull) {
+        // A bundle was lost to a full link, tell the sender so that it starts queueing.
+        ctx->linkFull = false;
+        return Error_LINK_LIMIT_EXCEEDED;
+    }
+
+    uint32_t size = entrySize(msg->length);
+    if (ctx->length + size > BUFFER_SIZE) {
+        flush(ctx);
+    }
+    uint16_t header[2] = { Endian_hostToBigEndian16(msg->length), 0 };
+    Bits_memcpyConst(&ctx->buffer[ctx->length], header, ENTRY_HEADER_SIZE);
+    Bits_memset(&ctx->buffer[ctx->length + size - 4], 0, 4);
+    Bits_memcpy(&ctx->buffer[ctx->length + ENTRY_HEADER_SIZE], msg->bytes, msg->length);
+    ctx->length += size;
+    ctx->count++;
+
+    if (!ctx->flushPending) {
+        ctx->flushPending = true;
+        if (ctx->flushTimeout) {
+            Timeout_resetTimeout(ctx->flushTimeout, 0);
+        } else {
+            ctx->flushTimeout = Timeout_setTimeout(flushTimeout, ctx, 0, ctx->base, ctx->alloc);
+        }
+    }
+    return Error_NONE;
+}
+
+/** Send each packet of a bundle up on its own. */
+static void split(struct Coalescer_pvt* ctx, struct Message* msg)
+{
+    ctx->pub.bundlesIn++;
+    uint32_t offset = Headers_SwitchHeader_SIZE;
+    while (offset + ENTRY_HEADER_SIZE <= (uint32_t) msg->length) {
+        uint16_t length_be;
+        Bits_memcpyConst(&length_be, &msg->bytes[offset], 2);
+        uint32_t length = Endian_bigEndianToHost16(length_be);
+        if (!length || offset + ENTRY_HEADER_SIZE + length > (uint32_t) msg->length) {
+            return;
+        }
+        struct Allocator* alloc = Allocator_child(ctx->alloc);
+        struct Message* out = Message_new(length, Interface_PADDING, alloc);
+        Bits_memcpy(out->bytes, &msg->bytes[offset + ENTRY_HEADER_SIZE], length);
+        Interface_receiveMessage(&ctx->pub.generic, out);
+        Allocator_free(alloc);
+        offset += entrySize(length);
+    }
+}
+
+static uint8_t receiveMessage(struct Message* msg, struct Interface* wrapped)
+{
+    struct Coalescer_pvt* ctx = Identity_cast((struct Coalescer_pvt*) wrapped->receiverContext);
+    if (msg->length >= Headers_SwitchHeader_SIZE) {
+        struct Headers_SwitchHeader* header = (struct Headers_SwitchHeader*) msg->bytes;
+        if (!header->label_be
+            && Headers_getMessageType(header) == Headers_SwitchHeader_TYPE_BUNDLE)
+        {
+            split(ctx, msg);
+            return Error_NONE;
+        }
+    }
+    return Interface_receiveMessage(&ctx->pub.generic, msg);
+}
+
+struct Coalescer* Coalescer_new(struct Interface* wrapped,
+                                struct EventBase* base,
+                                struct Allocator* alloc)
+{
+    struct Coalescer_pvt* ctx = Allocator_calloc(alloc, sizeof(struct Coalescer_pvt), 1);
+    ctx->wrapped = wrapped;
+    ctx->base = base;
+    ctx->alloc = alloc;
+    Bits_memcpyConst(&ctx->pub.generic, (&(struct Interface) {
+        .sendMessage = sendMessage,
+        .senderContext = ctx,
+        .allocator = alloc
+    }), sizeof(struct Interface));
+    wrapped->receiveMessage = receiveMessage;
+    wrapped->receiverContext = ctx;
+    Identity_set(ctx);
+    return &ctx->pub;
+}
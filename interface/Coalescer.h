@@ -0,0 +1,74 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef Coalescer_H
+#define Coalescer_H
+
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/Linker.h"
+Linker_require("interface/Coalescer.c")
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Bundles small switch packets for one peer so they share a packet of the peer's CryptoAuth
+ * session and a single datagram on the link, this goes above the CryptoAuth session of a peer.
+ * Small packets are held until the end of the current turn of the event loop, a packet which
+ * is too big to hold or a bundle which would grow too big sends what is held first so the order
+ * of packets is kept. A bundle carries a switch header with label 0 and message type
+ * Headers_SwitchHeader_TYPE_BUNDLE, see Version 9 in Version.h for the layout.
+ *
+ * Bundles from the other end are always split, only sending them must wait until the other end
+ * is known to understand them.
+ *
+ * When a bundle is lost to a full link, the next packet is refused with
+ * Error_LINK_LIMIT_EXCEEDED so that the queue in front of this one sees the congestion.
+ */
+
+/** Largest packet which is held for a bundle. */
+#define Coalescer_MAX_PACKET 256
+
+/** Largest bundle, with the CryptoAuth and link overhead it still fits 1500 byte links. */
+#define Coalescer_MAX_BUNDLE 1280
+
+struct Coalescer
+{
+    /** Packets from the switch are sent to this, it wraps the CryptoAuth interface. */
+    struct Interface generic;
+
+    /** If false then every packet is sent as it comes. */
+    bool enabled;
+
+    /** Bundles sent and the packets which went in them. */
+    uint64_t bundlesOut;
+    uint64_t packetsCoalesced;
+
+    /** Bundles received, and bundled packets which were lost because sending the bundle failed. */
+    uint64_t bundlesIn;
+    uint64_t dropped;
+};
+
+/**
+ * @param wrapped the CryptoAuth interface of the peer.
+ * @param base the event base to wait for the end of the loop turn with.
+ * @param alloc the allocator to create the interface with.
+ */
+struct Coalescer* Coalescer_new(struct Interface* wrapped,
+                                struct EventBase* base,
+                                struct Allocator* alloc);
+
+#endif
@@ -18,6 +18,7 @@
 #include "crypto/AddressCalc.h"
 #include "util/Base32.h"
 #include "util/Identity.h"
+#include "util/events/Time.h"
 #include "wire/Message.h"
 #include "wire/Error.h"
 
@@ -81,8 +82,40 @@ struct DNSServer_Message
     struct DNSServer_RR** answers;
     struct DNSServer_RR** authorities;
     struct DNSServer_RR** additionals;
+
+    /** Answers which were serialized before and came from the cache, they follow the others. */
+    uint8_t* cachedAnswers;
+    uint16_t cachedAnswersLength;
+    uint16_t cachedAnswerCount;
+};
+
+/**
+ * Answers to questions about .k and .h names which were sent before, direct mapped by the
+ * question. Negative answers are kept too so that nonexistant names are not looked up again
+ * each time, all answers are kept no longer than DNSServer_CACHE_MAX_SECONDS.
+ */
+#define DNSServer_CACHE_SIZE 64
+#define DNSServer_CACHE_KEY_MAX 260
+#define DNSServer_CACHE_ANSWERS_MAX 512
+#define DNSServer_CACHE_MAX_SECONDS 600
+#define DNSServer_CACHE_NEGATIVE_SECONDS 60
+struct DNSServer_CacheEntry
+{
+    /** The question name as it is on the wire, followed by the type and class, 0 if empty. */
+    uint8_t key[DNSServer_CACHE_KEY_MAX];
+    uint16_t keyLength;
+
+    uint8_t answers[DNSServer_CACHE_ANSWERS_MAX];
+    uint16_t answersLength;
+    uint16_t answerCount;
+
+    int responseCode;
+
+    uint64_t timeExpires;
 };
 
+struct DNSServer_RainflyRequest;
+
 struct DNSServer_pvt
 {
     struct DNSServer pub;
@@ -97,6 +130,13 @@ struct DNSServer_pvt
 
     struct Allocator* alloc;
 
+    struct EventBase* eventBase;
+
+    struct DNSServer_CacheEntry* cache;
+
+    /** Rainfly lookups which have not yet been answered, others for the same domain wait. */
+    struct DNSServer_RainflyRequest* inFlight;
+
     Identity
 };
 
@@ -257,6 +297,10 @@ static void serializeMessage(struct Message* msg,
         serializeRR(msg, dmesg->authorities[i], eh);
         totalAuthorityRRs++;
     }
+    if (dmesg->cachedAnswers) {
+        Message_push(msg, dmesg->cachedAnswers, dmesg->cachedAnswersLength, eh);
+        totalAnswerRRs += dmesg->cachedAnswerCount;
+    }
     for (int i = 0; dmesg->answers && dmesg->answers[i]; i++) {
         serializeRR(msg, dmesg->answers[i], eh);
         totalAnswerRRs++;
@@ -311,15 +355,107 @@ static int cannonicalizeDomain(String* str)
     return 0;
 }
 
-static uint8_t sendResponse(struct Message* msg,
-                            struct DNSServer_Message* dmesg,
-                            struct Sockaddr* sourceAddr,
-                            struct DNSServer_pvt* ctx,
-                            struct Except* eh)
+/** @return the length of the key or 0 if the question is too big to cache. */
+static int cacheKey(struct DNSServer_Question* q, uint8_t key[DNSServer_CACHE_KEY_MAX])
+{
+    int length = 0;
+    for (int i = 0; q->name[i]; i++) {
+        if (length + 1 + (int)q->name[i]->len + 5 > DNSServer_CACHE_KEY_MAX) {
+            return 0;
+        }
+        key[length++] = q->name[i]->len;
+        Bits_memcpy(&key[length], q->name[i]->bytes, q->name[i]->len);
+        length += q->name[i]->len;
+    }
+    key[length++] = 0;
+    key[length++] = q->type >> 8;
+    key[length++] = q->type;
+    key[length++] = q->class >> 8;
+    key[length++] = q->class;
+    return length;
+}
+
+static inline struct DNSServer_CacheEntry* cacheSlot(uint8_t* key,
+                                                     int length,
+                                                     struct DNSServer_pvt* ctx)
+{
+    uint32_t hash = 0x811c9dc5;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ key[i]) * 0x01000193;
+    }
+    return &ctx->cache[(hash ^ (hash >> 16)) % DNSServer_CACHE_SIZE];
+}
+
+/**
+ * Keep the answer to the question, only authoritative answers are, not errors.
+ * The answers are serialized into the entry by themselves so they can be sent with any query id.
+ */
+static void cacheResponse(struct DNSServer_Message* dmesg, struct DNSServer_pvt* ctx)
+{
+    int code = dmesg->flags.responseCode;
+    if ((code != ResponseCode_NO_ERROR && code != ResponseCode_NXDOMAIN)
+        || dmesg->cachedAnswers
+        || !dmesg->questions
+        || !dmesg->questions[0])
+    {
+        return;
+    }
+    uint8_t key[DNSServer_CACHE_KEY_MAX];
+    int keyLength = cacheKey(dmesg->questions[0], key);
+    if (!keyLength) {
+        return;
+    }
+
+    uint32_t ttl = DNSServer_CACHE_MAX_SECONDS;
+    int count = 0;
+    struct Message* answers;
+    Message_STACK(answers, 0, DNSServer_CACHE_ANSWERS_MAX);
+    struct Jmp j = { .message = NULL };
+    Jmp_try(j) {
+        for (int i = 0; dmesg->answers && dmesg->answers[i]; i++) {
+            serializeRR(answers, dmesg->answers[i], &j.handler);
+            ttl = (dmesg->answers[i]->ttl < ttl) ? dmesg->answers[i]->ttl : ttl;
+            count++;
+        }
+    } Jmp_catch {
+        // Too big to cache.
+        return;
+    }
+    if (!count) {
+        ttl = DNSServer_CACHE_NEGATIVE_SECONDS;
+    }
+
+    struct DNSServer_CacheEntry* entry = cacheSlot(key, keyLength, ctx);
+    Bits_memcpy(entry->key, key, keyLength);
+    entry->keyLength = keyLength;
+    Bits_memcpy(entry->answers, answers->bytes, answers->length);
+    entry->answersLength = answers->length;
+    entry->answerCount = count;
+    entry->responseCode = code;
+    entry->timeExpires = Time_currentTimeMilliseconds(ctx->eventBase) + ttl * 1000ull;
+}
+
+static struct DNSServer_CacheEntry* cachedResponse(struct DNSServer_Question* q,
+                                                   struct DNSServer_pvt* ctx)
+{
+    uint8_t key[DNSServer_CACHE_KEY_MAX];
+    int keyLength = cacheKey(q, key);
+    if (!keyLength) {
+        return NULL;
+    }
+    struct DNSServer_CacheEntry* entry = cacheSlot(key, keyLength, ctx);
+    if (entry->keyLength != keyLength
+        || Bits_memcmp(entry->key, key, keyLength)
+        || entry->timeExpires <= Time_currentTimeMilliseconds(ctx->eventBase))
+    {
+        return NULL;
+    }
+    return entry;
+}
+
+/** Send a message which begins with the address so that the address is 8 byte aligned. */
+static uint8_t sendAligned(struct Message* msg, struct DNSServer_pvt* ctx, struct Except* eh)
 {
-    dmesg->flags.isResponse = 1;
-    serializeMessage(msg, dmesg, eh);
-    Message_push(msg, sourceAddr, ctx->addr->addrLen, eh);
     // lazy man's alignment
     if ((uintptr_t)(msg->bytes) % 8) {
         int len = (((uintptr_t)(msg->bytes)) % 8);
@@ -330,6 +466,19 @@ static uint8_t sendResponse(struct Message* msg,
     return Interface_sendMessage(ctx->iface, msg);
 }
 
+static uint8_t sendResponse(struct Message* msg,
+                            struct DNSServer_Message* dmesg,
+                            struct Sockaddr* sourceAddr,
+                            struct DNSServer_pvt* ctx,
+                            struct Except* eh)
+{
+    dmesg->flags.isResponse = 1;
+    cacheResponse(dmesg, ctx);
+    serializeMessage(msg, dmesg, eh);
+    Message_push(msg, sourceAddr, ctx->addr->addrLen, eh);
+    return sendAligned(msg, ctx, eh);
+}
+
 /** @return non-zero on failure. */
 static int trySendResponse(struct Message* msg,
                            struct DNSServer_Message* dmesg,
@@ -405,15 +554,20 @@ struct DNSServer_RainflyRequest
     struct Message* msg;
     struct DNSServer_Message* dmesg;
     struct DNSServer_pvt* ctx;
+
+    /** The next lookup in DNSServer_pvt.inFlight. */
+    struct DNSServer_RainflyRequest* next;
+
+    /** Requests for the same domain which came in while the lookup was running. */
+    struct DNSServer_RainflyRequest* waiting;
+
     Identity
 };
 
-static void onRainflyReply(struct RainflyClient_Lookup* promise,
-                           Dict* value,
-                           enum RainflyClient_ResponseCode code)
+static void answerRainflyRequest(struct DNSServer_RainflyRequest* lookup,
+                                 Dict* value,
+                                 enum RainflyClient_ResponseCode code)
 {
-    struct DNSServer_RainflyRequest* lookup =
-        Identity_cast((struct DNSServer_RainflyRequest*)promise->userData);
     struct DNSServer_pvt* ctx =
         Identity_cast((struct DNSServer_pvt*)lookup->ctx);
 
@@ -465,6 +619,26 @@ static void onRainflyReply(struct RainflyClient_Lookup* promise,
     return;
 }
 
+static void onRainflyReply(struct RainflyClient_Lookup* promise,
+                           Dict* value,
+                           enum RainflyClient_ResponseCode code)
+{
+    struct DNSServer_RainflyRequest* lookup =
+        Identity_cast((struct DNSServer_RainflyRequest*)promise->userData);
+    struct DNSServer_pvt* ctx =
+        Identity_cast((struct DNSServer_pvt*)lookup->ctx);
+
+    struct DNSServer_RainflyRequest** pp = &ctx->inFlight;
+    while (*pp != lookup) {
+        pp = &(*pp)->next;
+    }
+    *pp = lookup->next;
+
+    for (struct DNSServer_RainflyRequest* req = lookup; req; req = req->waiting) {
+        answerRainflyRequest(req, value, code);
+    }
+}
+
 static uint8_t handleDotH(struct Message* msg,
                           struct DNSServer_Message* dmesg,
                           struct DNSServer_Question* q,
@@ -494,7 +668,14 @@ static uint8_t handleDotH(struct Message* msg,
         return Error_NONE;
     }
 
-    struct RainflyClient_Lookup* lookup = RainflyClient_lookup(ctx->rainfly, domain);
+    // If the same domain is already being looked up then wait for that answer.
+    struct DNSServer_RainflyRequest* inFlight = ctx->inFlight;
+    while (inFlight && !String_equals(inFlight->lookup->domain, domain)) {
+        inFlight = inFlight->next;
+    }
+
+    struct RainflyClient_Lookup* lookup =
+        (inFlight) ? inFlight->lookup : RainflyClient_lookup(ctx->rainfly, domain);
     Allocator_adopt(lookup->alloc, msg->alloc);
     struct DNSServer_RainflyRequest* req =
         Allocator_calloc(lookup->alloc, sizeof(struct DNSServer_RainflyRequest), 1);
@@ -504,14 +685,143 @@ static uint8_t handleDotH(struct Message* msg,
     req->dmesg = dmesg;
     req->ctx = ctx;
     Identity_set(req);
+    if (inFlight) {
+        req->waiting = inFlight->waiting;
+        inFlight->waiting = req;
+        return Error_NONE;
+    }
     lookup->onReply = onRainflyReply;
     lookup->userData = req;
+    req->next = ctx->inFlight;
+    ctx->inFlight = req;
 
     return Error_NONE;
 }
 
+/** Most names are only a few labels, longer ones are left to parseMessage(). */
+#define DNSServer_QuestionView_MAX_LABELS 8
+
+/** A question which points into the bytes of a message rather than being copied out of it. */
+struct DNSServer_QuestionView
+{
+    const uint8_t* labels[DNSServer_QuestionView_MAX_LABELS];
+    uint8_t labelLengths[DNSServer_QuestionView_MAX_LABELS];
+    int labelCount;
+    uint16_t type;
+    uint16_t class;
+
+    /** The number of bytes which the name, type and class take up. */
+    int length;
+};
+
+/** @return 0 if the question was parsed, -1 if it is malformed or has too many labels. */
+static int parseQuestionView(const uint8_t* bytes, int length, struct DNSServer_QuestionView* q)
+{
+    int i = 0;
+    q->labelCount = 0;
+    while (i < length && bytes[i]) {
+        // A compression pointer or a label running off the end.
+        if (bytes[i] > 63
+            || i + 1 + bytes[i] > length
+            || q->labelCount == DNSServer_QuestionView_MAX_LABELS)
+        {
+            return -1;
+        }
+        q->labelLengths[q->labelCount] = bytes[i];
+        q->labels[q->labelCount++] = &bytes[i + 1];
+        i += 1 + bytes[i];
+    }
+    if (i + 5 > length) {
+        return -1;
+    }
+    q->type = (bytes[i + 1] << 8) | bytes[i + 2];
+    q->class = (bytes[i + 3] << 8) | bytes[i + 4];
+    q->length = i + 5;
+    return 0;
+}
+
+/**
+ * Answer a query with one question, type AAAA for a .k name, without parsing the message onto
+ * the heap. The address comes from the key in the name so there is nothing to look up and the
+ * answer is written over the query in the same message.
+ *
+ * @return true if the query was answered, false if it needs to go through receiveB().
+ */
+static bool answerDotK(struct Message* msg, struct DNSServer_pvt* ctx)
+{
+    int addrLen = ctx->addr->addrLen;
+    if (msg->length < addrLen + 12) {
+        return false;
+    }
+    const uint8_t* query = &msg->bytes[addrLen];
+    // Not a response, standard query, exactly one question.
+    if ((query[2] & 0xf8) || query[4] || query[5] != 1) {
+        return false;
+    }
+    struct DNSServer_QuestionView q;
+    if (parseQuestionView(&query[12], msg->length - addrLen - 12, &q)
+        || q.labelCount != 2
+        || q.labelLengths[1] != 1
+        || (q.labels[1][0] != 'k' && q.labels[1][0] != 'K')
+        || q.type != Type_AAAA
+        || q.class != Class_IN)
+    {
+        return false;
+    }
+
+    uint8_t key[63];
+    String keyString = { .bytes = (char*) key, .len = q.labelLengths[0] };
+    Bits_memcpy(key, q.labels[0], q.labelLengths[0]);
+    uint8_t publicKey[32];
+    uint8_t ipv6[16];
+    if (cannonicalizeDomain(&keyString)
+        || Base32_decode(publicKey, 32, key, keyString.len) != 32
+        || !AddressCalc_addressForPublicKey(ipv6, publicKey))
+    {
+        // Let the slow path log it and answer NXDOMAIN.
+        return false;
+    }
+
+    // Address, header, question, answer with the same name, always fits in 512 bytes.
+    uint8_t response[512];
+    int length = 0;
+    Bits_memcpy(response, msg->bytes, addrLen);
+    length += addrLen;
+    uint8_t header[12] = { query[0], query[1], 0x80, ResponseCode_NO_ERROR, 0, 1, 0, 1 };
+    Bits_memcpyConst(&response[length], header, 12);
+    length += 12;
+    int nameAt = length;
+    response[length++] = keyString.len;
+    Bits_memcpy(&response[length], key, keyString.len);
+    length += keyString.len;
+    uint8_t tld[3] = { 1, 'k', 0 };
+    Bits_memcpyConst(&response[length], tld, 3);
+    length += 3;
+    int nameLength = length - nameAt;
+    uint8_t typeAndClass[4] = { 0, Type_AAAA, 0, Class_IN };
+    Bits_memcpyConst(&response[length], typeAndClass, 4);
+    length += 4;
+
+    Bits_memmove(&response[length], &response[nameAt], nameLength + 4);
+    length += nameLength + 4;
+    uint8_t ttlAndLength[6] = { 0xff, 0xff, 0xff, 0xff, 0, 16 };
+    Bits_memcpyConst(&response[length], ttlAndLength, 6);
+    length += 6;
+    Bits_memcpyConst(&response[length], ipv6, 16);
+    length += 16;
+
+    Message_shift(msg, -msg->length, NULL);
+    Message_push(msg, response, length, NULL);
+    sendAligned(msg, ctx, NULL);
+    return true;
+}
+
 static void receiveB(struct Message* msg, struct DNSServer_pvt* ctx, struct Except* eh)
 {
+    if (answerDotK(msg, ctx)) {
+        return;
+    }
+
     struct Sockaddr* sourceAddr = Allocator_malloc(msg->alloc, ctx->addr->addrLen);
     Message_pop(msg, sourceAddr, ctx->addr->addrLen, eh);
 
@@ -546,7 +856,23 @@ static void receiveB(struct Message* msg, struct DNSServer_pvt* ctx, struct Exce
         }
     }
 
-    if (String_equals(tld, String_CONST("h"))) {
+    struct DNSServer_CacheEntry* entry = NULL;
+    if (String_equals(tld, String_CONST("h")) || String_equals(tld, String_CONST("k"))) {
+        entry = cachedResponse(q, ctx);
+    }
+    if (entry) {
+        Bits_memset(&dmesg->flags, 0, sizeof(struct DNSServer_Flags));
+        dmesg->flags.responseCode = entry->responseCode;
+        dmesg->answers = NULL;
+        dmesg->authorities = NULL;
+        dmesg->additionals = NULL;
+        dmesg->cachedAnswers = entry->answers;
+        dmesg->cachedAnswersLength = entry->answersLength;
+        dmesg->cachedAnswerCount = entry->answerCount;
+        sendResponse(msg, dmesg, sourceAddr, ctx, NULL);
+        return;
+
+    } else if (String_equals(tld, String_CONST("h"))) {
         handleDotH(msg, dmesg, q, domain, sourceAddr, ctx);
         return;
 
@@ -602,17 +928,20 @@ int DNSServer_addServer(struct DNSServer* dns, struct Sockaddr* addr)
 }
 
 struct DNSServer* DNSServer_new(struct AddrInterface* iface,
+                                struct EventBase* eventBase,
                                 struct Log* logger,
                                 struct RainflyClient* rainfly)
 {
-    struct DNSServer_pvt* context =
-        Allocator_clone(iface->generic.allocator, (&(struct DNSServer_pvt) {
-            .iface = &iface->generic,
-            .logger = logger,
-            .rainfly = rainfly,
-            .addr = iface->addr,
-            .alloc = iface->generic.allocator
-        }));
+    struct Allocator* alloc = iface->generic.allocator;
+    struct DNSServer_pvt* context = Allocator_clone(alloc, (&(struct DNSServer_pvt) {
+        .iface = &iface->generic,
+        .logger = logger,
+        .rainfly = rainfly,
+        .addr = iface->addr,
+        .alloc = alloc,
+        .eventBase = eventBase,
+        .cache = Allocator_calloc(alloc, sizeof(struct DNSServer_CacheEntry), DNSServer_CACHE_SIZE)
+    }));
     Identity_set(context);
 
     iface->generic.receiveMessage = receiveMessage;
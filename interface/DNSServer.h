@@ -19,6 +19,7 @@
 #include "util/log/Log.h"
 #include "interface/RainflyClient.h"
 #include "util/platform/Sockaddr.h"
+#include "util/events/EventBase.h"
 #include "util/Linker.h"
 Linker_require("interface/DNSServer.c")
 
@@ -31,6 +32,7 @@ struct DNSServer
 int DNSServer_addServer(struct DNSServer* dns, struct Sockaddr* server);
 
 struct DNSServer* DNSServer_new(struct AddrInterface* iface,
+                                struct EventBase* eventBase,
                                 struct Log* logger,
                                 struct RainflyClient* rainfly);
 
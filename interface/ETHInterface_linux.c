@@ -39,20 +39,66 @@
 #include <linux/if_arp.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 
 #define MAX_PACKET_SIZE 1496
 #define MIN_PACKET_SIZE 46
 
-#define PADDING 512
+#define PADDING Interface_PADDING
 
 // 2 last 0x00 of .sll_addr are removed from original size (20)
 #define SOCKADDR_LL_LEN 18
 
+/** Maximum number of frames to read from the socket each time it becomes readable. */
+#define READ_BATCH 32
+
+/** Enough scratch space for the message which is allocated from it in handleEvent2(). */
+#define MESSAGE_ALLOC_SIZE (PADDING + MAX_PACKET_SIZE + sizeof(struct Message) + 64)
+
+/**
+ * Geometry of the TPACKET_V3 receive ring, 16 blocks of 128KiB.
+ * A block which is not full is handed over after RX_RING_TIMEOUT_MS so quiet links don't stall.
+ */
+#define RX_RING_BLOCK_SIZE (1 << 17)
+#define RX_RING_BLOCK_COUNT 16
+#define RX_RING_FRAME_SIZE 2048
+#define RX_RING_TIMEOUT_MS 1
+
 /** Wait 16 seconds between sending beacon messages. */
 #define BEACON_INTERVAL 32768
 
+/** A beacon sender, the MAC it came from and the key it announced. */
+struct ETHInterface_BeaconKey
+{
+    uint8_t mac[8];
+    uint8_t publicKey[32];
+};
+
+#define Map_USE_HASH
+#define Map_NAME OfSeenBeacons
+#define Map_KEY_TYPE struct ETHInterface_BeaconKey
+#define Map_VALUE_TYPE struct Interface*
+#include "util/Map.h"
+
+static inline uint32_t Map_OfSeenBeacons_hash(struct ETHInterface_BeaconKey* key)
+{
+    uint32_t* k = (uint32_t*) key;
+    uint32_t hash = 0;
+    for (int i = 0; i < (int) (sizeof(struct ETHInterface_BeaconKey) / 4); i++) {
+        hash = (hash ^ k[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+/** The beacon frame, built once because nothing in it changes while the router runs. */
+struct ETHInterface_BeaconFrame
+{
+    struct sockaddr_ll addr;
+    struct Headers_Beacon beacon;
+};
+
 struct ETHInterface
 {
     struct Interface generic;
@@ -74,12 +120,26 @@ struct ETHInterface
 
     int beaconState;
 
+    /**
+     * Beacons which have already registered a peer, each entry lives until the peer's interface
+     * is freed so the same beacon coming around every BEACON_INTERVAL is dropped after a lookup.
+     */
+    struct Map_OfSeenBeacons seenBeacons;
+
+    struct ETHInterface_BeaconFrame beaconFrame;
+
     /**
      * A unique(ish) id which will be different every time the router starts.
      * This will prevent new eth frames from being confused with old frames from an expired session.
      */
     uint16_t id;
 
+    /** The mmap()'d PACKET_RX_RING or NULL if frames are read with recvfrom(). */
+    uint8_t* rxRing;
+
+    /** The next block of rxRing which the kernel will hand over. */
+    int rxBlock;
+
     Identity
 };
 
@@ -134,6 +194,24 @@ static uint8_t sendMessage(struct Message* message, struct Interface* ethIf)
     return 0;
 }
 
+/** Entry in seenBeacons which is removed when the peer's interface goes away. */
+struct SeenBeacon
+{
+    struct ETHInterface* context;
+    struct ETHInterface_BeaconKey key;
+    Identity
+};
+
+static int forgetBeacon(struct Allocator_OnFreeJob* job)
+{
+    struct SeenBeacon* seen = Identity_cast((struct SeenBeacon*) job->userData);
+    int index = Map_OfSeenBeacons_indexForKey(&seen->key, &seen->context->seenBeacons);
+    if (index > -1) {
+        Map_OfSeenBeacons_remove(index, &seen->context->seenBeacons);
+    }
+    return 0;
+}
+
 static void handleBeacon(struct Message* msg, struct ETHInterface* context)
 {
     if (!context->beaconState) {
@@ -165,6 +243,14 @@ static void handleBeacon(struct Message* msg, struct ETHInterface* context)
         return;
     }
 
+    struct ETHInterface_BeaconKey key;
+    Bits_memcpyConst(key.mac, addr.sll_addr, 8);
+    Bits_memcpyConst(key.publicKey, beacon->publicKey, 32);
+    if (Map_OfSeenBeacons_indexForKey(&key, &context->seenBeacons) > -1) {
+        // Already peered with this node over this link.
+        return;
+    }
+
     #ifdef Log_DEBUG
         uint8_t mac[18];
         AddrTools_printMac(mac, addr.sll_addr);
@@ -183,7 +269,16 @@ static void handleBeacon(struct Message* msg, struct ETHInterface* context)
         uint8_t mac[18];
         AddrTools_printMac(mac, addr.sll_addr);
         Log_info(context->logger, "Got beacon from [%s] and registerPeer returned [%d]", mac, ret);
+        return;
     }
+
+    struct SeenBeacon* seen = Allocator_clone(iface->allocator, (&(struct SeenBeacon) {
+        .context = context,
+        .key = key
+    }));
+    Identity_set(seen);
+    Map_OfSeenBeacons_put(&key, &iface, &context->seenBeacons);
+    Allocator_onFree(iface->allocator, forgetBeacon, seen);
 }
 
 static void sendBeacon(void* vcontext)
@@ -194,14 +289,9 @@ static void sendBeacon(void* vcontext)
         return;
     }
 
-    struct {
-        struct sockaddr_ll addr;
-        struct Headers_Beacon beacon;
-    } content;
-
-    Bits_memcpyConst(&content.addr, &context->addrBase, sizeof(struct sockaddr_ll));
-    Bits_memset(content.addr.sll_addr, 0xff, 6);
-    InterfaceController_populateBeacon(context->ic, &content.beacon);
+    // sendMessage() writes the frame header in place so send a copy.
+    struct ETHInterface_BeaconFrame content;
+    Bits_memcpyConst(&content, &context->beaconFrame, sizeof(struct ETHInterface_BeaconFrame));
 
     struct Message m = {
         .bytes=(uint8_t*)content.addr.sll_addr,
@@ -215,7 +305,53 @@ static void sendBeacon(void* vcontext)
     }
 }
 
-static void handleEvent2(struct ETHInterface* context, struct Allocator* messageAlloc)
+/**
+ * Handle a frame which was just read into msg.
+ *
+ * @param msg the message, the frame begins 2 bytes into it.
+ * @param length the number of bytes in the frame.
+ * @param addr the sender.
+ */
+static void handleFrame(struct ETHInterface* context,
+                        struct Message* msg,
+                        int length,
+                        struct sockaddr_ll* addr)
+{
+    // Pop the first 2 bytes of the message containing the node id and amount of padding.
+    msg->length = length;
+    uint16_t idAndPadding_be;
+    if (Message_tryPop(msg, &idAndPadding_be, 2)) {
+        Log_debug(context->logger, "DROP runt frame");
+        return;
+    }
+
+    const uint16_t idAndPadding = Endian_bigEndianToHost16(idAndPadding_be);
+    const int padding = (idAndPadding & 7) * 8;
+    if (msg->length < padding) {
+        Log_debug(context->logger, "DROP frame shorter than its padding");
+        return;
+    }
+    msg->length -= padding;
+    const uint16_t id = idAndPadding >> 3;
+    Message_push(msg, &id, 2, NULL);
+    Message_push(msg, addr->sll_addr, 6, NULL);
+
+    if (addr->sll_pkttype == PACKET_BROADCAST) {
+        handleBeacon(msg, context);
+        return;
+    }
+
+    /* Cut down on the noise
+    uint8_t buff[sizeof(*addr) * 2 + 1] = {0};
+    Hex_encode(buff, sizeof(buff), (uint8_t*)addr, sizeof(*addr));
+    Log_debug(context->logger, "Got ethernet frame from [%s]", buff);
+    */
+
+    Interface_receiveMessage(&context->generic, msg);
+}
+
+/** @return the result of recvfrom(), less than zero if there was nothing to read. */
+static int handleEvent2(struct ETHInterface* context, struct Allocator* messageAlloc)
 {
     struct Message* msg = Message_new(MAX_PACKET_SIZE, PADDING, messageAlloc);
 
@@ -234,42 +370,120 @@ static void handleEvent2(struct ETHInterface* context, struct Allocator* message
                       &addrLen);
 
     if (rc < 0) {
-        Log_debug(context->logger, "Failed to receive eth frame");
-        return;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            Log_debug(context->logger, "Failed to receive eth frame");
+        }
+        return rc;
     }
 
     //Assert_true(addrLen == SOCKADDR_LL_LEN);
 
-    // Pop the first 2 bytes of the message containing the node id and amount of padding.
-    uint16_t idAndPadding_be;
-    Message_pop(msg, &idAndPadding_be, 2, NULL);
+    handleFrame(context, msg, rc, &addr);
+    return rc;
+}
 
-    const uint16_t idAndPadding = Endian_bigEndianToHost16(idAndPadding_be);
-    msg->length = rc - 2 - ((idAndPadding & 7) * 8);
-    const uint16_t id = idAndPadding >> 3;
-    Message_push(msg, &id, 2, NULL);
-    Message_push(msg, addr.sll_addr, 6, NULL);
+/**
+ * Hand every frame in the blocks which the kernel has retired to handleFrame() and give the
+ * blocks back. Frames are still copied into their own message because the receiver may keep
+ * them after the block is returned.
+ */
+static void handleRxRing(struct ETHInterface* context)
+{
+    for (int i = 0; i < RX_RING_BLOCK_COUNT; i++) {
+        struct tpacket_block_desc* block = (struct tpacket_block_desc*)
+            &context->rxRing[context->rxBlock * RX_RING_BLOCK_SIZE];
+        if (!(block->hdr.bh1.block_status & TP_STATUS_USER)) {
+            return;
+        }
+        __sync_synchronize();
+
+        struct tpacket3_hdr* frame = (struct tpacket3_hdr*)
+            (((uint8_t*) block) + block->hdr.bh1.offset_to_first_pkt);
+        for (uint32_t j = 0; j < block->hdr.bh1.num_pkts; j++) {
+            struct sockaddr_ll* addr = (struct sockaddr_ll*)
+                (((uint8_t*) frame) + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+            struct Allocator* messageAlloc =
+                Allocator_scratch(context->generic.allocator, MESSAGE_ALLOC_SIZE);
+            struct Message* msg = Message_new(MAX_PACKET_SIZE, PADDING, messageAlloc);
+            // Same 2 byte misalignment as handleEvent2().
+            Message_shift(msg, 2, NULL);
+            uint32_t capacity = msg->length;
+            int length = (frame->tp_snaplen < capacity) ? frame->tp_snaplen : capacity;
+            Bits_memcpy(msg->bytes, ((uint8_t*) frame) + frame->tp_mac, length);
+            handleFrame(context, msg, length, addr);
+            Allocator_free(messageAlloc);
+
+            frame = (struct tpacket3_hdr*) (((uint8_t*) frame) + frame->tp_next_offset);
+        }
 
-    if (addr.sll_pkttype == PACKET_BROADCAST) {
-        handleBeacon(msg, context);
-        return;
+        __sync_synchronize();
+        block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        context->rxBlock = (context->rxBlock + 1) % RX_RING_BLOCK_COUNT;
     }
-
-    /* Cut down on the noise
-    uint8_t buff[sizeof(addr) * 2 + 1] = {0};
-    Hex_encode(buff, sizeof(buff), (uint8_t*)&addr, sizeof(addr));
-    Log_debug(context->logger, "Got ethernet frame from [%s]", buff);
-    */
-
-    Interface_receiveMessage(&context->generic, msg);
 }
 
 static void handleEvent(void* vcontext)
 {
     struct ETHInterface* context = Identity_cast((struct ETHInterface*) vcontext);
-    struct Allocator* messageAlloc = Allocator_child(context->generic.allocator);
-    handleEvent2(context, messageAlloc);
-    Allocator_free(messageAlloc);
+
+    // Everything which is drained in one go is switched together, see beginBurst().
+    InterfaceController_beginBurst(context->ic);
+    if (context->rxRing) {
+        handleRxRing(context);
+    } else {
+        // Drain whatever has queued up rather than going back to the event loop for every frame.
+        for (int i = 0; i < READ_BATCH; i++) {
+            struct Allocator* messageAlloc =
+                Allocator_scratch(context->generic.allocator, MESSAGE_ALLOC_SIZE);
+            int rc = handleEvent2(context, messageAlloc);
+            Allocator_free(messageAlloc);
+            if (rc < 0) {
+                break;
+            }
+        }
+    }
+    InterfaceController_endBurst(context->ic);
+}
+
+static int unmapRxRing(struct Allocator_OnFreeJob* job)
+{
+    struct ETHInterface* context = Identity_cast((struct ETHInterface*) job->userData);
+    munmap(context->rxRing, RX_RING_BLOCK_SIZE * RX_RING_BLOCK_COUNT);
+    context->rxRing = NULL;
+    return 0;
+}
+
+/** Switch the socket to a TPACKET_V3 receive ring, leaves rxRing NULL if the kernel refuses. */
+static void setupRxRing(struct ETHInterface* context)
+{
+    int version = TPACKET_V3;
+    struct tpacket_req3 req = {
+        .tp_block_size = RX_RING_BLOCK_SIZE,
+        .tp_block_nr = RX_RING_BLOCK_COUNT,
+        .tp_frame_size = RX_RING_FRAME_SIZE,
+        .tp_frame_nr = (RX_RING_BLOCK_SIZE / RX_RING_FRAME_SIZE) * RX_RING_BLOCK_COUNT,
+        .tp_retire_blk_tov = RX_RING_TIMEOUT_MS
+    };
+    if (setsockopt(context->socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(int))
+        || setsockopt(context->socket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)))
+    {
+        Log_info(context->logger, "No PACKET_RX_RING, reading frames one by one [%s]",
+                 strerror(errno));
+        return;
+    }
+    void* ring = mmap(NULL,
+                      RX_RING_BLOCK_SIZE * RX_RING_BLOCK_COUNT,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED,
+                      context->socket,
+                      0);
+    if (ring == MAP_FAILED) {
+        Log_info(context->logger, "Failed to mmap() PACKET_RX_RING [%s]", strerror(errno));
+        return;
+    }
+    context->rxRing = ring;
+    Allocator_onFree(context->generic.allocator, unmapRxRing, context);
 }
 
 int ETHInterface_beginConnection(const char* macAddress,
@@ -342,6 +556,15 @@ struct ETHInterface* ETHInterface_new(struct EventBase* base,
     }
     strncpy(ifr.ifr_name, bindDevice, IFNAMSIZ - 1);
 
+    #ifdef SO_BUSY_POLL
+        int busyPoll = EventBase_busyPoll(base);
+        if (busyPoll
+            && setsockopt(context->socket, SOL_SOCKET, SO_BUSY_POLL, &busyPoll, sizeof(int)))
+        {
+            Log_info(context->logger, "Failed to set SO_BUSY_POLL [%s]", strerror(errno));
+        }
+    #endif
+
     if (ioctl(context->socket, SIOCGIFINDEX, &ifr) == -1) {
         Except_throw(exHandler, "failed to find interface index [%s]", strerror(errno));
     }
@@ -374,10 +597,17 @@ struct ETHInterface* ETHInterface_new(struct EventBase* base,
 
     Socket_makeNonBlocking(context->socket);
 
+    setupRxRing(context);
+
     Event_socketRead(handleEvent, context, context->socket, base, allocator, exHandler);
 
     context->multiIface = MultiInterface_new(sizeof(struct sockaddr_ll), &context->generic, ic);
 
+    context->seenBeacons.allocator = allocator;
+    Bits_memcpyConst(&context->beaconFrame.addr, &context->addrBase, sizeof(struct sockaddr_ll));
+    Bits_memset(context->beaconFrame.addr.sll_addr, 0xff, 6);
+    InterfaceController_populateBeacon(ic, &context->beaconFrame.beacon);
+
     Timeout_setInterval(sendBeacon, context, BEACON_INTERVAL, base, allocator);
 
     return context;
@@ -0,0 +1,395 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/FairQueue.h"
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
+#include "util/Hash.h"
+#include "util/Identity.h"
+#include "util/events/Time.h"
+#include "util/events/Timeout.h"
+#include "wire/Error.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+#include <stdbool.h>
+
+/**
+ * Flows which packets are hashed into, one more is used for switch control messages and
+ * CryptoAuth handshakes which keep the links and sessions alive, it goes ahead of the rest.
+ */
+#define FLOWS 64
+#define PRIORITY_FLOW FLOWS
+
+/** Beyond this, the oldest packets in the priority flow are dropped to bound what it takes. */
+#define PRIORITY_MAX_PACKETS 32
+
+/** Bytes which a flow may send each time it gets a turn. */
+#define QUANTUM 1536
+
+/** How long to wait before trying the external interface again after it was full. */
+#define RETRY_MILLISECONDS 1
+
+struct Packet
+{
+    struct Message* message;
+    struct Allocator* alloc;
+    uint64_t timeQueued;
+    struct Packet* next;
+};
+
+struct Flow
+{
+    struct Packet* head;
+    struct Packet* tail;
+    uint32_t bytes;
+    uint32_t packets;
+
+    /** Bytes which this flow may still send in its turn. */
+    int32_t deficit;
+
+    /** The next flow in the list of new or old flows, the flow is in a list if listed is set. */
+    struct Flow* next;
+    bool listed;
+
+    /** CoDel state. */
+    uint64_t firstAboveTime;
+    uint64_t dropNext;
+    uint32_t dropCount;
+    bool dropping;
+};
+
+struct FlowList
+{
+    struct Flow* head;
+    struct Flow* tail;
+};
+
+struct FairQueue_pvt
+{
+    struct FairQueue pub;
+
+    struct Interface* external;
+
+    struct EventBase* base;
+
+    struct Allocator* alloc;
+
+    /** Created the first time the external interface is full. */
+    struct Timeout* retry;
+
+    /** No packets go straight to the external interface before this time. */
+    uint64_t blockedUntil;
+
+    struct Flow flows[FLOWS + 1];
+
+    /** Flows which started since they were last served and flows which have had a turn. */
+    struct FlowList newFlows;
+    struct FlowList oldFlows;
+
+    Identity
+};
+
+static inline uint32_t flowForMessage(struct Message* message)
+{
+    if (message->length < Headers_SwitchHeader_SIZE + 4) {
+        return 0;
+    }
+    struct Headers_SwitchHeader* header = (struct Headers_SwitchHeader*) message->bytes;
+    uint32_t* words = (uint32_t*) message->bytes;
+    if (Headers_getMessageType(header) == Headers_SwitchHeader_TYPE_CONTROL
+        || Endian_bigEndianToHost32(words[3]) < 4)
+    {
+        // After the switch header is the session handle, or the nonce 0 to 3 of a handshake.
+        return PRIORITY_FLOW;
+    }
+    // The inner packet is encrypted, the flow is told by the label, the handle of the session
+    // and the flow tag which the sender put in the switch header.
+    uint32_t hash = 0;
+    hash = Hash_add32(hash, words[0]);
+    hash = Hash_add32(hash, words[1]);
+    hash = Hash_add32(hash, Headers_getFlowTag(header));
+    hash = Hash_add32(hash, words[3]);
+    // The label bytes land in the top of each word, mix them down before taking the modulus.
+    return Hash_mix32(hash) % FLOWS;
+}
+
+static void pushFlow(struct Flow* flow, struct FlowList* list)
+{
+    flow->next = NULL;
+    if (list->tail) {
+        list->tail->next = flow;
+    } else {
+        list->head = flow;
+    }
+    list->tail = flow;
+}
+
+static struct Flow* popFlow(struct FlowList* list)
+{
+    struct Flow* flow = list->head;
+    list->head = flow->next;
+    if (!list->head) {
+        list->tail = NULL;
+    }
+    return flow;
+}
+
+static struct Packet* popPacket(struct Flow* flow, struct FairQueue_pvt* fq)
+{
+    struct Packet* packet = flow->head;
+    if (packet) {
+        flow->head = packet->next;
+        if (!flow->head) {
+            flow->tail = NULL;
+        }
+        flow->bytes -= packet->message->length;
+        flow->packets--;
+        fq->pub.queued--;
+    }
+    return packet;
+}
+
+static void dropPacket(struct Packet* packet, struct FairQueue_pvt* fq)
+{
+    fq->pub.drops++;
+    Allocator_free(packet->alloc);
+}
+
+static inline uint32_t intSqrt(uint32_t x)
+{
+    uint32_t root = 0;
+    for (uint32_t bit = 1u << 30; bit; bit >>= 2) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return root;
+}
+
+/** When to drop next, the more packets have been dropped the sooner. */
+static inline uint64_t controlLaw(uint64_t time, uint32_t count)
+{
+    return time + FairQueue_INTERVAL_MILLISECONDS / intSqrt(count);
+}
+
+static bool shouldDrop(struct Flow* flow, struct Packet* packet, uint64_t now)
+{
+    if (now - packet->timeQueued < FairQueue_TARGET_MILLISECONDS || flow->bytes <= QUANTUM) {
+        flow->firstAboveTime = 0;
+        return false;
+    }
+    if (!flow->firstAboveTime) {
+        flow->firstAboveTime = now + FairQueue_INTERVAL_MILLISECONDS;
+        return false;
+    }
+    return now >= flow->firstAboveTime;
+}
+
+/** Take the next packet from a flow, dropping those which have waited too long. */
+static struct Packet* codelDequeue(struct Flow* flow, uint64_t now, struct FairQueue_pvt* fq)
+{
+    struct Packet* packet = popPacket(flow, fq);
+    if (!packet) {
+        flow->dropping = false;
+        return NULL;
+    }
+    bool drop = shouldDrop(flow, packet, now);
+    if (flow->dropping) {
+        if (!drop) {
+            flow->dropping = false;
+        }
+        while (flow->dropping && now >= flow->dropNext) {
+            dropPacket(packet, fq);
+            flow->dropCount++;
+            if (!(packet = popPacket(flow, fq))) {
+                flow->dropping = false;
+                return NULL;
+            }
+            if (!shouldDrop(flow, packet, now)) {
+                flow->dropping = false;
+            } else {
+                flow->dropNext = controlLaw(flow->dropNext, flow->dropCount);
+            }
+        }
+    } else if (drop) {
+        dropPacket(packet, fq);
+        if (!(packet = popPacket(flow, fq))) {
+            return NULL;
+        }
+        flow->dropping = true;
+        // Pick up where the last dropping state left off if it was recent.
+        flow->dropCount =
+            (flow->dropCount > 2 && now - flow->dropNext < 16 * FairQueue_INTERVAL_MILLISECONDS)
+                ? flow->dropCount - 2 : 1;
+        flow->dropNext = controlLaw(now, flow->dropCount);
+    }
+    if (now - packet->timeQueued >= FairQueue_TARGET_MILLISECONDS
+        && packet->message->length >= Headers_SwitchHeader_SIZE)
+    {
+        Headers_setCongested((struct Headers_SwitchHeader*) packet->message->bytes);
+        fq->pub.marks++;
+    }
+    return packet;
+}
+
+static struct Packet* dequeue(uint64_t now, struct FairQueue_pvt* fq)
+{
+    struct Packet* packet = popPacket(&fq->flows[PRIORITY_FLOW], fq);
+    if (packet) {
+        return packet;
+    }
+    for (;;) {
+        struct FlowList* list = (fq->newFlows.head) ? &fq->newFlows : &fq->oldFlows;
+        if (!list->head) {
+            return NULL;
+        }
+        struct Flow* flow = list->head;
+        if (flow->deficit <= 0) {
+            flow->deficit += QUANTUM;
+            pushFlow(popFlow(list), &fq->oldFlows);
+            continue;
+        }
+        packet = codelDequeue(flow, now, fq);
+        if (!packet) {
+            popFlow(list);
+            // A new flow which empties goes to the back of the old ones to keep its turn fair.
+            if (list == &fq->newFlows && fq->oldFlows.head) {
+                pushFlow(flow, &fq->oldFlows);
+            } else {
+                flow->listed = false;
+            }
+            continue;
+        }
+        flow->deficit -= packet->message->length;
+        return packet;
+    }
+}
+
+/** Make space by dropping from the head of the longest flow, the priority flow goes last. */
+static void dropFromLongest(struct FairQueue_pvt* fq)
+{
+    struct Flow* longest = &fq->flows[0];
+    for (int i = 1; i < FLOWS; i++) {
+        if (fq->flows[i].bytes > longest->bytes) {
+            longest = &fq->flows[i];
+        }
+    }
+    if (!longest->head) {
+        longest = &fq->flows[PRIORITY_FLOW];
+    }
+    struct Packet* packet = popPacket(longest, fq);
+    if (packet) {
+        dropPacket(packet, fq);
+    }
+}
+
+static void enqueue(struct Message* message, uint64_t now, struct FairQueue_pvt* fq)
+{
+    uint32_t index = flowForMessage(message);
+    struct Flow* flow = &fq->flows[index];
+    if (index == PRIORITY_FLOW && flow->packets >= PRIORITY_MAX_PACKETS) {
+        dropPacket(popPacket(flow, fq), fq);
+    } else if (fq->pub.queued >= FairQueue_MAX_PACKETS) {
+        dropFromLongest(fq);
+    }
+    struct Allocator* alloc = Allocator_child(fq->alloc);
+    struct Packet* packet = Allocator_clone(alloc, (&(struct Packet) {
+        .message = Message_clone(message, alloc),
+        .alloc = alloc,
+        .timeQueued = now
+    }));
+
+    if (flow->tail) {
+        flow->tail->next = packet;
+    } else {
+        flow->head = packet;
+    }
+    flow->tail = packet;
+    flow->bytes += message->length;
+    flow->packets++;
+    fq->pub.queued++;
+
+    if (index != PRIORITY_FLOW && !flow->listed) {
+        flow->listed = true;
+        flow->deficit = QUANTUM;
+        pushFlow(flow, &fq->newFlows);
+    }
+}
+
+static void drain(void* vfq);
+
+static void block(uint64_t now, struct FairQueue_pvt* fq)
+{
+    fq->blockedUntil = now + RETRY_MILLISECONDS;
+    if (fq->retry) {
+        Timeout_resetTimeout(fq->retry, RETRY_MILLISECONDS);
+    } else {
+        fq->retry = Timeout_setTimeout(drain, fq, RETRY_MILLISECONDS, fq->base, fq->alloc);
+    }
+}
+
+/** Send queued packets until the queue is empty or the external interface is full again. */
+static void drain(void* vfq)
+{
+    struct FairQueue_pvt* fq = Identity_cast((struct FairQueue_pvt*) vfq);
+    uint64_t now = Time_currentTimeMilliseconds(fq->base);
+    struct Packet* packet;
+    while ((packet = dequeue(now, fq))) {
+        uint8_t ret = Interface_sendMessage(fq->external, packet->message);
+        Allocator_free(packet->alloc);
+        if (ret == Error_LINK_LIMIT_EXCEEDED) {
+            fq->pub.drops++;
+            block(now, fq);
+            return;
+        }
+    }
+}
+
+static uint8_t sendMessage(struct Message* message, struct Interface* iface)
+{
+    struct FairQueue_pvt* fq = Identity_cast((struct FairQueue_pvt*) iface->senderContext);
+    uint64_t now = Time_currentTimeMilliseconds(fq->base);
+    if (fq->pub.queued || now < fq->blockedUntil) {
+        enqueue(message, now, fq);
+        return Error_NONE;
+    }
+    uint8_t ret = Interface_sendMessage(fq->external, message);
+    if (ret == Error_LINK_LIMIT_EXCEEDED) {
+        block(now, fq);
+    }
+    return ret;
+}
+
+struct FairQueue* FairQueue_new(struct Interface* external,
+                                struct EventBase* base,
+                                struct Allocator* alloc)
+{
+    struct FairQueue_pvt* fq = Allocator_calloc(alloc, sizeof(struct FairQueue_pvt), 1);
+    fq->external = external;
+    fq->base = base;
+    fq->alloc = alloc;
+    Bits_memcpyConst(&fq->pub.iface, (&(struct Interface) {
+        .sendMessage = sendMessage,
+        .senderContext = fq,
+        .allocator = alloc
+    }), sizeof(struct Interface));
+    Identity_set(fq);
+    return &fq->pub;
+}
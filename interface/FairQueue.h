@@ -0,0 +1,71 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FairQueue_H
+#define FairQueue_H
+
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/Linker.h"
+Linker_require("interface/FairQueue.c")
+
+/*
+ * A queue in front of an interface which is only used while the interface is congested.
+ * Packets normally go straight through, once the interface returns Error_LINK_LIMIT_EXCEEDED
+ * the packets which follow are queued and sent as it lets them through.
+ *
+ * Queued packets are sorted into flows by switch label, session handle and the flow tag which
+ * the sender put in the switch header for each of its connections, see Headers_getFlowTag().
+ * Switch control messages and CryptoAuth handshakes go ahead of everything so that pings and
+ * session setup are not lost to congestion, the rest is served in the style of fq_codel:
+ * flows take turns by byte quantum, a flow which just started goes ahead of the busy ones so
+ * sparse traffic such as interactive sessions and DHT queries is not stuck behind bulk
+ * transfers, and each flow drops packets as CoDel when they wait longer than the target.
+ */
+
+/** A flow is dropping while its packets wait over this long, for at least one interval. */
+#define FairQueue_TARGET_MILLISECONDS 5
+#define FairQueue_INTERVAL_MILLISECONDS 100
+
+/** Number of packets which may be queued, beyond this the longest flow loses packets. */
+#define FairQueue_MAX_PACKETS 256
+
+struct FairQueue
+{
+    /** Messages sent to this interface, beginning with a switch header, go to the external. */
+    struct Interface iface;
+
+    /** Packets dropped because they waited too long or the queue was full. */
+    uint64_t drops;
+
+    /** Packets which were flagged as congested, see Headers_setCongested(). */
+    uint64_t marks;
+
+    /** Number of packets queued right now. */
+    uint32_t queued;
+};
+
+/**
+ * @param external the interface to send to, Error_LINK_LIMIT_EXCEEDED from it means the
+ *                 link is full. The message which causes this is lost since the external
+ *                 interface may have already changed it.
+ * @param base the event base for retrying the queued packets.
+ * @param alloc freeing this drops the queued packets.
+ */
+struct FairQueue* FairQueue_new(struct Interface* external,
+                                struct EventBase* base,
+                                struct Allocator* alloc);
+
+#endif
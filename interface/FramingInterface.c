@@ -16,15 +16,10 @@
 #include "interface/FramingInterface.h"
 #include "interface/InterfaceWrapper.h"
 #include "memory/Allocator.h"
+#include "util/Bits.h"
 #include "util/Identity.h"
 #include "wire/Error.h"
 
-struct MessageList;
-struct MessageList {
-    struct Message* msg;
-    struct MessageList* next;
-};
-
 struct FramingInterface_pvt {
     struct Interface generic;
     struct Interface* const wrapped;
@@ -34,7 +29,12 @@ struct FramingInterface_pvt {
     // fields specific to this frame.
     uint32_t bytesRemaining;
     struct Allocator* frameAlloc;
-    struct MessageList* frameParts;
+
+    /**
+     * The frame which is being reassembled, it is allocated with the full size from
+     * the header so each part is copied straight to the end of it.
+     */
+    struct Message* frame;
 
     union {
         uint32_t length_be;
@@ -45,34 +45,15 @@ struct FramingInterface_pvt {
     Identity
 };
 
-static struct Message* mergeMessage(struct FramingInterface_pvt* fi, struct Message* last)
+/** Copy as much of msg as belongs to the current frame into it, return the number of bytes. */
+static uint32_t appendToFrame(struct FramingInterface_pvt* fi, struct Message* msg)
 {
-    int length = last->length;
-
-    // The only accurate way to get the full length because this last might contain
-    // the beginning of the next frame.
-    struct MessageList* part = fi->frameParts;
-    for (part = fi->frameParts; part; part = part->next) {
-        length += part->msg->length;
-    }
-
-    int fullLength = length + fi->generic.requiredPadding;
-    uint8_t* msgBuff = Allocator_malloc(fi->frameAlloc, fullLength);
-    struct Message* out = Allocator_calloc(fi->frameAlloc, sizeof(struct Message), 1);
-    out->bytes = msgBuff + fullLength;
-    out->length = 0;
-    out->padding = fullLength;
-    out->capacity = 0;
-    out->alloc = fi->frameAlloc;
-
-    Message_push(out, last->bytes, last->length, NULL);
-
-    for (part = fi->frameParts; part; part = part->next) {
-        Message_push(out, part->msg->bytes, part->msg->length, NULL);
-    }
-
-    Assert_true(fullLength <= out->length);
-    return out;
+    uint32_t length = (fi->bytesRemaining < (uint32_t)msg->length)
+        ? fi->bytesRemaining : (uint32_t)msg->length;
+    Bits_memcpy(&fi->frame->bytes[fi->frame->length], msg->bytes, length);
+    fi->frame->length += length;
+    fi->bytesRemaining -= length;
+    return length;
 }
 
 static uint8_t receiveMessage(struct Message* msg, struct Interface* iface)
@@ -84,29 +65,28 @@ static uint8_t receiveMessage(struct Message* msg, struct Interface* iface)
         return Error_OVERSIZE_MESSAGE;
     }
 
-    if (fi->frameParts) {
-        if (fi->bytesRemaining <= (uint32_t)msg->length) {
-            struct Message* wholeMessage = mergeMessage(fi, msg);
-            fi->bytesRemaining = 0;
-            fi->frameParts = NULL;
-            Assert_true(fi->headerIndex == 0);
-            struct Allocator* frameAlloc = fi->frameAlloc;
-            fi->frameAlloc = NULL;
-            // Run the message through again since it's almost certainly not perfect size.
-            uint8_t ret = receiveMessage(wholeMessage, iface);
-            Allocator_free(frameAlloc);
-            return ret;
+    if (fi->frame) {
+        uint32_t length = appendToFrame(fi, msg);
+        if (fi->bytesRemaining) {
+            return Error_NONE;
         }
-        fi->bytesRemaining -= msg->length;
-        Allocator_adopt(fi->frameAlloc, msg->alloc);
-        struct MessageList* parts = Allocator_malloc(fi->frameAlloc, sizeof(struct MessageList));
-        parts->msg = msg;
-        parts->next = fi->frameParts;
-        fi->frameParts = parts;
-        return Error_NONE;
+        Assert_true(fi->headerIndex == 0);
+        struct Message* frame = fi->frame;
+        struct Allocator* frameAlloc = fi->frameAlloc;
+        fi->frame = NULL;
+        fi->frameAlloc = NULL;
+        Interface_receiveMessage(&fi->generic, frame);
+        Allocator_free(frameAlloc);
+
+        // Whatever is left over is the beginning of the next frame.
+        Message_shift(msg, -length, NULL);
     }
 
     for (;;) {
+        // Common case, the whole header is in this read so take it in one go.
+        if (fi->headerIndex == 0 && !Message_tryPop(msg, fi->header.bytes, 4)) {
+            fi->headerIndex = 4;
+        }
         while (fi->headerIndex < 4) {
             if (!msg->length) {
                 return Error_NONE;
@@ -128,8 +108,9 @@ static uint8_t receiveMessage(struct Message* msg, struct Interface* iface)
             return Error_NONE;
 
         } else if (fi->bytesRemaining <= (uint32_t)msg->length) {
+            // A view of the frame inside of msg, it must not reach into the next frame.
             struct Message* m = Allocator_clone(msg->alloc, msg);
-            m->length = fi->bytesRemaining;
+            m->length = m->capacity = fi->bytesRemaining;
             Interface_receiveMessage(&fi->generic, m);
             Message_shift(msg, -fi->bytesRemaining, NULL);
             fi->bytesRemaining = 0;
@@ -137,18 +118,10 @@ static uint8_t receiveMessage(struct Message* msg, struct Interface* iface)
 
         } else {
             fi->frameAlloc = Allocator_child(fi->alloc);
-            struct Message* m = Allocator_calloc(fi->frameAlloc, sizeof(struct Message), 1);
-            m->capacity = m->length = msg->length + 4;
-            m->bytes = Allocator_malloc(fi->frameAlloc, m->length);
-            m->alloc = fi->frameAlloc;
-            Message_shift(m, -m->length, NULL);
-            Message_push(m, msg->bytes, msg->length, NULL);
-            Message_push(m, fi->header.bytes, 4, NULL);
-
-            fi->bytesRemaining -= msg->length;
-            fi->frameParts = Allocator_malloc(fi->frameAlloc, sizeof(struct MessageList));
-            fi->frameParts->msg = m;
-            fi->frameParts->next = NULL;
+            fi->frame = Message_new(fi->bytesRemaining, fi->generic.requiredPadding,
+                                    fi->frameAlloc);
+            fi->frame->length = 0;
+            appendToFrame(fi, msg);
         }
         return Error_NONE;
     }
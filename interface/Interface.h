@@ -33,6 +33,13 @@
  * If you have multiple direct connections (eg nodes in an ethernet),
  * you must register an interface for each.
  */
+/**
+ * The amount of free space which interfaces reading from the wire leave before each message.
+ * This must cover the requiredPadding of the deepest stack of interfaces so that every header
+ * which is added on the way back out can be written in place without copying the message.
+ */
+#define Interface_PADDING 512
+
 struct Interface
 {
     /** Arbitarary data which belongs to the wire side of this interface. */
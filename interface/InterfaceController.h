@@ -17,6 +17,8 @@
 
 #include "benc/String.h"
 #include "interface/Interface.h"
+#include "util/PacketCapture.h"
+#include "util/PacketTrace.h"
 #include "wire/Headers.h"
 
 #include <stdint.h>
@@ -66,6 +68,26 @@ struct InterfaceController_peerStats
     uint32_t duplicates;
     uint32_t lostPackets;
     uint32_t receivedOutOfRange;
+
+    /** Smoothed round trip time of switch pings and its mean deviation, 0 if never measured. */
+    uint32_t rttMilliseconds;
+    uint32_t rttVarianceMilliseconds;
+
+    /** Switch pings sent to the peer and how many of them timed out. */
+    uint32_t pingsSent;
+    uint32_t pingsLost;
+
+    /** Traffic rates and the lostPackets count over the last few seconds. */
+    uint32_t bytesInPerSecond;
+    uint32_t bytesOutPerSecond;
+    uint32_t recentLostPackets;
+
+    /** Packets per parity packet sent to the peer, 0 if none are, and packets rebuilt. */
+    uint32_t parityGroupSize;
+    uint64_t parityRecovered;
+
+    /** Packets which were sent to the peer in bundles with others, see Coalescer. */
+    uint64_t packetsCoalesced;
 };
 
 struct InterfaceController
@@ -123,6 +145,34 @@ struct InterfaceController
     int (* const disconnectPeer)(struct InterfaceController* ic,
                              uint8_t herPublicKey[32]);
 
+    /**
+     * Turn forward error correction on or off for the link to a peer, see ParityInterface.
+     * Parity which the peer sends is used either way.
+     *
+     * @param ic the if controller
+     * @param herPublicKey the public key of the foreign node
+     * @param enabled true if parity should be sent to the peer.
+     * @return 0 if all goes well.
+     *         InterfaceController_disconnectPeer_NOTFOUND if no peer with herPublicKey is found.
+     */
+    int (* const setParity)(struct InterfaceController* ic,
+                            uint8_t herPublicKey[32],
+                            bool enabled);
+
+    /**
+     * Turn bundling of small packets on or off for the link to a peer, see Coalescer.
+     * Packets are only bundled once the peer has answered a ping with version 9 or higher.
+     *
+     * @param ic the if controller
+     * @param herPublicKey the public key of the foreign node
+     * @param enabled true if small packets to the peer should be bundled.
+     * @return 0 if all goes well.
+     *         InterfaceController_disconnectPeer_NOTFOUND if no peer with herPublicKey is found.
+     */
+    int (* const setCoalescing)(struct InterfaceController* ic,
+                                uint8_t herPublicKey[32],
+                                bool enabled);
+
     /**
      * Populate an empty beacon with password, public key, and version.
      * Each startup, a password is generated consisting of Headers_Beacon_PASSWORD_LEN bytes.
@@ -151,6 +201,34 @@ struct InterfaceController
                                struct Allocator* alloc,
                                struct InterfaceController_peerStats** statsOut);
 
+    /**
+     * Get the key of the peer at the end of a switch label, only if the link to it is established
+     * so everything which comes over the link is known to be from the holder of the key.
+     *
+     * @param ic the if controller
+     * @param label the switch label of the peer.
+     * @return the peer's public key or NULL if there is no established peer at that label.
+     */
+    uint8_t* (* const getPeerKeyForLabel)(struct InterfaceController* ic, uint64_t label);
+
+    /**
+     * Called by a network interface around a burst of messages which it takes in at once.
+     * While a burst is open, what comes in from established peers is held and each peer's
+     * messages are decrypted and then switched together when the burst ends, see
+     * CryptoAuth_receiveBatch() and SwitchCore_receiveBatch().
+     * Bursts may be nested, the messages are held until the outermost one ends.
+     * Either may be NULL if the controller does not hold messages.
+     *
+     * @param ic the if controller
+     */
+    void (* const beginBurst)(struct InterfaceController* ic);
+    void (* const endBurst)(struct InterfaceController* ic);
+
+    /** Where packets to and from peers are traced, NULL if they are not. */
+    struct PacketTrace* packetTrace;
+
+    /** Where packets to and from peers are captured, NULL if they are not. */
+    struct PacketCapture* packetCapture;
 };
 
 #define InterfaceController_getPeerState(ic, iface) \
@@ -162,4 +240,13 @@ struct InterfaceController
 #define InterfaceController_populateBeacon(ic, beacon) \
     ((ic)->populateBeacon((ic), (beacon)))
 
+#define InterfaceController_beginBurst(ic) \
+    ((ic)->beginBurst ? (ic)->beginBurst(ic) : (void) 0)
+
+#define InterfaceController_endBurst(ic) \
+    ((ic)->endBurst ? (ic)->endBurst(ic) : (void) 0)
+
+#define InterfaceController_getPeerKeyForLabel(ic, label) \
+    ((ic)->getPeerKeyForLabel((ic), (label)))
+
 #endif
@@ -29,8 +29,8 @@ struct Context
     struct Admin* admin;
 };
 
-// typical peer record is around 140 benc chars, so can't have very many in 1023
-#define ENTRIES_PER_PAGE 6
+// typical peer record is around 250 benc chars, so can't have very many in 1023
+#define ENTRIES_PER_PAGE 4
 static void adminPeerStats(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
 {
     struct Context* context = vcontext;
@@ -55,6 +55,17 @@ static void adminPeerStats(Dict* args, void* vcontext, String* txid, struct Allo
     String* lostPackets = String_CONST("lostPackets");
     String* receivedOutOfRange = String_CONST("receivedOutOfRange");
 
+    String* rtt = String_CONST("rtt");
+    String* rttVariance = String_CONST("rttVariance");
+    String* pingsSent = String_CONST("pingsSent");
+    String* pingsLost = String_CONST("pingsLost");
+    String* bytesInPerSecond = String_CONST("bytesInPerSecond");
+    String* bytesOutPerSecond = String_CONST("bytesOutPerSecond");
+    String* recentLostPackets = String_CONST("recentLostPackets");
+    String* parityGroupSize = String_CONST("parityGroupSize");
+    String* parityRecovered = String_CONST("parityRecovered");
+    String* packetsCoalesced = String_CONST("packetsCoalesced");
+
     List* list = NULL;
     for (int counter=0; i < count && counter++ < ENTRIES_PER_PAGE; i++) {
         Dict* d = Dict_new(alloc);
@@ -76,6 +87,17 @@ static void adminPeerStats(Dict* args, void* vcontext, String* txid, struct Allo
         Dict_putInt(d, lostPackets, stats[i].lostPackets, alloc);
         Dict_putInt(d, receivedOutOfRange, stats[i].receivedOutOfRange, alloc);
 
+        Dict_putInt(d, rtt, stats[i].rttMilliseconds, alloc);
+        Dict_putInt(d, rttVariance, stats[i].rttVarianceMilliseconds, alloc);
+        Dict_putInt(d, pingsSent, stats[i].pingsSent, alloc);
+        Dict_putInt(d, pingsLost, stats[i].pingsLost, alloc);
+        Dict_putInt(d, bytesInPerSecond, stats[i].bytesInPerSecond, alloc);
+        Dict_putInt(d, bytesOutPerSecond, stats[i].bytesOutPerSecond, alloc);
+        Dict_putInt(d, recentLostPackets, stats[i].recentLostPackets, alloc);
+        Dict_putInt(d, parityGroupSize, stats[i].parityGroupSize, alloc);
+        Dict_putInt(d, parityRecovered, stats[i].parityRecovered, alloc);
+        Dict_putInt(d, packetsCoalesced, stats[i].packetsCoalesced, alloc);
+
         if (stats[i].isIncomingConnection) {
             Dict_putString(d, user, stats[i].user, alloc);
         }
@@ -133,6 +155,50 @@ static void adminDisconnectPeer(Dict* args,
     Admin_sendMessage(response, txid, context->admin);
 }
 
+static void adminSetParity(Dict* args,
+                           void* vcontext,
+                           String* txid,
+                           struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    String* pubkeyString = Dict_getString(args, String_CONST("pubkey"));
+    int64_t* enable = Dict_getInt(args, String_CONST("enable"));
+
+    uint8_t pubkey[32];
+    uint8_t addr[16];
+    char* errorMsg = "none";
+    if (Key_parse(pubkeyString, pubkey, addr)) {
+        errorMsg = "bad key";
+    } else if (context->ic->setParity(context->ic, pubkey, *enable != 0)) {
+        errorMsg = "no peer found for that key";
+    }
+
+    Dict response = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(errorMsg)), NULL);
+    Admin_sendMessage(&response, txid, context->admin);
+}
+
+static void adminSetCoalescing(Dict* args,
+                               void* vcontext,
+                               String* txid,
+                               struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    String* pubkeyString = Dict_getString(args, String_CONST("pubkey"));
+    int64_t* enable = Dict_getInt(args, String_CONST("enable"));
+
+    uint8_t pubkey[32];
+    uint8_t addr[16];
+    char* errorMsg = "none";
+    if (Key_parse(pubkeyString, pubkey, addr)) {
+        errorMsg = "bad key";
+    } else if (context->ic->setCoalescing(context->ic, pubkey, *enable != 0)) {
+        errorMsg = "no peer found for that key";
+    }
+
+    Dict response = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(errorMsg)), NULL);
+    Admin_sendMessage(&response, txid, context->admin);
+}
+
 void InterfaceController_admin_register(struct InterfaceController* ic,
                                         struct Admin* admin,
                                         struct Allocator* alloc)
@@ -152,4 +218,16 @@ void InterfaceController_admin_register(struct InterfaceController* ic,
         ((struct Admin_FunctionArg[]) {
             { .name = "pubkey", .required = 1, .type = "String" }
         }), admin);
+
+    Admin_registerFunction("InterfaceController_setParity", adminSetParity, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "pubkey", .required = 1, .type = "String" },
+            { .name = "enable", .required = 1, .type = "Int" }
+        }), admin);
+
+    Admin_registerFunction("InterfaceController_setCoalescing", adminSetCoalescing, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "pubkey", .required = 1, .type = "String" },
+            { .name = "enable", .required = 1, .type = "Int" }
+        }), admin);
 }
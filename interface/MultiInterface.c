@@ -48,6 +48,17 @@ struct Peer
     /** The InterfaceController's structure which is used to detect unresponsive peers. */
     struct InterfaceController_Peer* ifcPeer;
 
+    /**
+     * The network interface, from multiIface, so sending does not have to go through it.
+     */
+    struct Interface* external;
+
+    /**
+     * True once the peer has sent a valid packet, a peer never goes back to
+     * InterfaceController_PeerState_UNAUTHENTICATED so it need not be asked again.
+     */
+    bool authenticated;
+
     Identity
 
     /** Variable size. */
@@ -61,10 +72,18 @@ struct Peer
 #define Map_VALUE_TYPE struct Peer*
 #include "util/Map.h"
 
+/**
+ * Fold in every word of the key, the last word of a sockaddr_in is the zero padding so
+ * hashing only that would give every IPv4 peer the same hash code.
+ */
 static inline uint32_t Map_OfPeersByKey_hash(struct MapKey** key)
 {
     uint32_t* k = (uint32_t*) ((*key)->bytes);
-    return k[ ((*key)->keySize / 4)-1 ];
+    uint32_t hash = 0;
+    for (int i = 0; i < (*key)->keySize / 4; i++) {
+        hash = (hash ^ k[i]) * 0x01000193;
+    }
+    return hash;
 }
 
 static inline int Map_OfPeersByKey_compare(struct MapKey** keyA, struct MapKey** keyB)
@@ -79,6 +98,9 @@ struct MultiInterface_pvt
     /** Endpoints by their key. */
     struct Map_OfPeersByKey peerMap;
 
+    /** The peer which was found last, packets tend to come in bursts from the same peer. */
+    struct Peer* lastPeer;
+
     struct InterfaceController* ic;
 
     struct Allocator* allocator;
@@ -92,18 +114,20 @@ static uint8_t sendMessage(struct Message* msg, struct Interface* peerIface)
 {
     struct Peer* p = Identity_cast((struct Peer*) peerIface);
     Message_push(msg, p->key.bytes, p->key.keySize, NULL);
-    return p->multiIface->iface->sendMessage(msg, p->multiIface->iface);
+    return p->external->sendMessage(msg, p->external);
 }
 
 static int removePeer(struct Allocator_OnFreeJob* job)
 {
     struct Peer* p = Identity_cast((struct Peer*) job->userData);
     struct MultiInterface_pvt* mif = Identity_cast((struct MultiInterface_pvt*) p->multiIface);
-    struct Map_OfPeersByKey* peerMap = &mif->peerMap;
-    for (int i = 0; i < (int)peerMap->count; i++) {
-        if (peerMap->values[i] == p) {
-            Map_OfPeersByKey_remove(i, peerMap);
-        }
+    if (mif->lastPeer == p) {
+        mif->lastPeer = NULL;
+    }
+    struct MapKey* kptr = &p->key;
+    int index = Map_OfPeersByKey_indexForKey(&kptr, &mif->peerMap);
+    if (index >= 0 && mif->peerMap.values[index] == p) {
+        Map_OfPeersByKey_remove(index, &mif->peerMap);
     }
     return 0;
 }
@@ -112,9 +136,14 @@ static inline struct Peer* peerForKey(struct MultiInterface_pvt* mif,
                                       struct MapKey* key,
                                       bool regIfNew)
 {
+    struct Peer* last = mif->lastPeer;
+    if (last && !Bits_memcmp(key, &last->key, key->keySize + 4)) {
+        return last;
+    }
     int index = Map_OfPeersByKey_indexForKey(&key, &mif->peerMap);
     if (index >= 0) {
-        return mif->peerMap.values[index];
+        mif->lastPeer = mif->peerMap.values[index];
+        return mif->lastPeer;
     }
 
     // Per peer allocator.
@@ -129,6 +158,7 @@ static inline struct Peer* peerForKey(struct MultiInterface_pvt* mif,
             .allocator = alloc
         },
         .multiIface = &mif->pub,
+        .external = mif->pub.iface,
         .key = { .keySize = mif->pub.keySize }
     }), sizeof(struct Peer));
     Bits_memcpy(peer->key.bytes, key->bytes, mif->pub.keySize);
@@ -153,23 +183,31 @@ static uint8_t receiveMessage(struct Message* msg, struct Interface* external)
     struct MultiInterface_pvt* mif =
         Identity_cast((struct MultiInterface_pvt*) external->receiverContext);
 
-    // push the key size to the message.
-    Message_push(msg, &mif->pub.keySize, 4, NULL);
-
-    struct Peer* p = peerForKey(mif, (struct MapKey*) msg->bytes, true);
+    // Most packets are from the same peer as the last one, compare the key where it is.
+    struct Peer* p = mif->lastPeer;
+    if (!p || Bits_memcmp(msg->bytes, p->key.bytes, mif->pub.keySize)) {
+        // push the key size to the message to make a MapKey.
+        Message_push(msg, &mif->pub.keySize, 4, NULL);
+        p = peerForKey(mif, (struct MapKey*) msg->bytes, true);
+        Message_shift(msg, -4, NULL);
+    }
 
-    // pop the key size and key
-    Message_shift(msg, -(mif->pub.keySize + 4), NULL);
+    // pop the key
+    Message_shift(msg, -mif->pub.keySize, NULL);
 
     // into the core.
     uint8_t ret = p->internalIf.receiveMessage(msg, &p->internalIf);
 
-    enum InterfaceController_PeerState state =
-        InterfaceController_getPeerState(mif->ic, &p->internalIf);
-    if (state == InterfaceController_PeerState_UNAUTHENTICATED) {
-        // some random stray packet wandered in to the interface....
-        // This removes all of the state associated with the endpoint.
-        Allocator_free(p->internalIf.allocator);
+    if (!p->authenticated) {
+        enum InterfaceController_PeerState state =
+            InterfaceController_getPeerState(mif->ic, &p->internalIf);
+        if (state == InterfaceController_PeerState_UNAUTHENTICATED) {
+            // some random stray packet wandered in to the interface....
+            // This removes all of the state associated with the endpoint.
+            Allocator_free(p->internalIf.allocator);
+        } else {
+            p->authenticated = true;
+        }
     }
 
     return ret;
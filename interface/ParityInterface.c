@@ -0,0 +1,305 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/Interface.h"
+#include "interface/ParityInterface.h"
+#include "memory/Allocator.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
+#include "util/Identity.h"
+#include "wire/Error.h"
+#include "wire/Message.h"
+
+/** The nonce of a parity packet, CryptoAuth takes everything from 4 to UINT32_MAX - 1 as data. */
+#define MARKER 0xfffffffe
+
+/**
+ * Nonce, group size, zero byte and the XOR of the lengths, followed by the nonces.
+ * A group size of 0 makes a loss report and the zero byte is the loss per mille.
+ */
+#define HEADER_SIZE 8
+
+/** Received packets which are kept for rebuilding a lost one, by nonce modulo this. */
+#define WINDOW 32
+
+/** Loss is measured over this many packets. */
+#define LOSS_WINDOW_PACKETS 1024
+
+/** Below this many lost packets per thousand, no parity is sent. */
+#define MIN_LOSS_PER_MILLE 2
+
+/** Most loss which can be reported, anything above it gets the smallest group anyway. */
+#define MAX_REPORTED_LOSS 255
+
+struct Received
+{
+    uint32_t nonce;
+    uint32_t length;
+    uint8_t bytes[ParityInterface_MAX_LENGTH];
+};
+
+struct ParityInterface_pvt
+{
+    struct ParityInterface pub;
+
+    struct Interface* wrapped;
+
+    struct Allocator* alloc;
+
+    /** The group being sent, the XOR of everything after the nonce of each packet. */
+    uint8_t parity[ParityInterface_MAX_LENGTH];
+    uint32_t nonces[ParityInterface_MAX_GROUP];
+    uint32_t count;
+    uint32_t maxLength;
+    uint32_t lengthXor;
+
+    /** The last packets received, NULL until the other end is seen to send parity. */
+    struct Received* received;
+
+    /** For measuring the loss. */
+    uint32_t highestNonce;
+    uint32_t packetsIn;
+    uint32_t packetsLost;
+
+    Identity
+};
+
+static inline bool isData(uint32_t nonce)
+{
+    return nonce > 3 && nonce < MARKER;
+}
+
+static inline uint32_t nonceOf(struct Message* msg)
+{
+    uint32_t nonce_be;
+    Bits_memcpyConst(&nonce_be, msg->bytes, 4);
+    return Endian_bigEndianToHost32(nonce_be);
+}
+
+static inline void xorInto(uint8_t* restrict out, const uint8_t* restrict in, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++) {
+        out[i] ^= in[i];
+    }
+}
+
+static void sendParity(struct ParityInterface_pvt* ctx)
+{
+    struct Allocator* alloc = Allocator_child(ctx->alloc);
+    uint32_t headerSize = HEADER_SIZE + ctx->count * 4;
+    struct Message* msg = Message_new(headerSize + ctx->maxLength, Interface_PADDING, alloc);
+    uint32_t header[2] = {
+        Endian_hostToBigEndian32(MARKER),
+        Endian_hostToBigEndian32(ctx->count << 24 | ctx->lengthXor)
+    };
+    Bits_memcpyConst(msg->bytes, header, HEADER_SIZE);
+    for (uint32_t i = 0; i < ctx->count; i++) {
+        uint32_t nonce_be = Endian_hostToBigEndian32(ctx->nonces[i]);
+        Bits_memcpyConst(&msg->bytes[HEADER_SIZE + i * 4], &nonce_be, 4);
+    }
+    Bits_memcpy(&msg->bytes[headerSize], ctx->parity, ctx->maxLength);
+    Interface_sendMessage(ctx->wrapped, msg);
+    Allocator_free(alloc);
+
+    ctx->pub.parityOut++;
+    Bits_memset(ctx->parity, 0, ctx->maxLength);
+    ctx->count = 0;
+    ctx->maxLength = 0;
+    ctx->lengthXor = 0;
+}
+
+static uint8_t sendMessage(struct Message* msg, struct Interface* iface)
+{
+    struct ParityInterface_pvt* ctx =
+        Identity_cast((struct ParityInterface_pvt*) iface->senderContext);
+
+    if (!ctx->pub.enabled || !ctx->pub.groupSize || msg->length < 4
+        || msg->length - 4 > ParityInterface_MAX_LENGTH || !isData(nonceOf(msg)))
+    {
+        return Interface_sendMessage(ctx->wrapped, msg);
+    }
+
+    // The link may change the message so it goes into the group first.
+    uint32_t length = msg->length - 4;
+    xorInto(ctx->parity, &msg->bytes[4], length);
+    ctx->lengthXor ^= length;
+    ctx->maxLength = (length > ctx->maxLength) ? length : ctx->maxLength;
+    ctx->nonces[ctx->count++] = nonceOf(msg);
+
+    uint8_t ret = Interface_sendMessage(ctx->wrapped, msg);
+    if (ctx->count >= ctx->pub.groupSize || ctx->count == ParityInterface_MAX_GROUP) {
+        sendParity(ctx);
+    }
+    return ret;
+}
+
+/** Tell the other end how much of what it sends is lost so it can choose its group size. */
+static void sendLossReport(struct ParityInterface_pvt* ctx)
+{
+    struct Allocator* alloc = Allocator_child(ctx->alloc);
+    struct Message* msg = Message_new(HEADER_SIZE, Interface_PADDING, alloc);
+    uint32_t loss = (ctx->pub.lossPerMille < MAX_REPORTED_LOSS)
+        ? ctx->pub.lossPerMille : MAX_REPORTED_LOSS;
+    uint32_t header[2] = {
+        Endian_hostToBigEndian32(MARKER),
+        Endian_hostToBigEndian32(loss << 16)
+    };
+    Bits_memcpyConst(msg->bytes, header, HEADER_SIZE);
+    Interface_sendMessage(ctx->wrapped, msg);
+    Allocator_free(alloc);
+}
+
+/** Choose the group size from the loss of our packets which the other end reports. */
+static void setGroupSize(struct ParityInterface_pvt* ctx, uint32_t perMille)
+{
+    if (perMille < MIN_LOSS_PER_MILLE) {
+        ctx->pub.groupSize = 0;
+    } else {
+        // Aim to lose about one packet in ten groups, one parity packet can only fix one.
+        uint32_t groupSize = 100 / perMille;
+        ctx->pub.groupSize = (groupSize < ParityInterface_MIN_GROUP) ? ParityInterface_MIN_GROUP
+            : (groupSize > ParityInterface_MAX_GROUP) ? ParityInterface_MAX_GROUP : groupSize;
+    }
+}
+
+/** Measure the loss of the packets which come in over the link and report it. */
+static void countLoss(struct ParityInterface_pvt* ctx, uint32_t nonce)
+{
+    if (nonce > ctx->highestNonce) {
+        // The first packet or a jump too far to be loss counts as nothing.
+        uint32_t gap = nonce - ctx->highestNonce - 1;
+        ctx->packetsLost += (ctx->highestNonce && gap < LOSS_WINDOW_PACKETS) ? gap : 0;
+        ctx->highestNonce = nonce;
+    } else if (ctx->highestNonce - nonce > LOSS_WINDOW_PACKETS) {
+        // The session was restarted.
+        ctx->highestNonce = nonce;
+    }
+    if (++ctx->packetsIn + ctx->packetsLost < LOSS_WINDOW_PACKETS) {
+        return;
+    }
+    ctx->pub.lossPerMille = ctx->packetsLost * 1000 / (ctx->packetsIn + ctx->packetsLost);
+    ctx->packetsIn = 0;
+    ctx->packetsLost = 0;
+    sendLossReport(ctx);
+}
+
+/** If exactly one packet of the group is missing, rebuild it from the others. */
+static void receiveParity(struct ParityInterface_pvt* ctx, struct Message* msg)
+{
+    if (msg->length < HEADER_SIZE) {
+        return;
+    }
+    uint32_t word_be;
+    Bits_memcpyConst(&word_be, &msg->bytes[4], 4);
+    uint32_t count = Endian_bigEndianToHost32(word_be) >> 24;
+    uint32_t lengthXor = Endian_bigEndianToHost32(word_be) & 0xffff;
+    if (!count) {
+        setGroupSize(ctx, (Endian_bigEndianToHost32(word_be) >> 16) & 0xff);
+        return;
+    }
+    uint32_t headerSize = HEADER_SIZE + count * 4;
+    uint32_t length = msg->length;
+    if (count > ParityInterface_MAX_GROUP || length < headerSize
+        || length - headerSize > ParityInterface_MAX_LENGTH)
+    {
+        return;
+    }
+    ctx->pub.parityIn++;
+    if (!ctx->received) {
+        // The other end sends parity, from now on keep what comes in so it can be used.
+        ctx->received = Allocator_calloc(ctx->alloc, sizeof(struct Received), WINDOW);
+        return;
+    }
+
+    uint32_t missingNonce = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        Bits_memcpyConst(&word_be, &msg->bytes[HEADER_SIZE + i * 4], 4);
+        uint32_t nonce = Endian_bigEndianToHost32(word_be);
+        if (ctx->received[nonce % WINDOW].nonce == nonce) {
+            continue;
+        }
+        if (missingNonce || !isData(nonce)) {
+            return;
+        }
+        missingNonce = nonce;
+    }
+    if (!missingNonce) {
+        return;
+    }
+
+    uint32_t parityLength = length - headerSize;
+    struct Allocator* alloc = Allocator_child(ctx->alloc);
+    struct Message* out = Message_new(parityLength + 4, Interface_PADDING, alloc);
+    Bits_memcpy(&out->bytes[4], &msg->bytes[headerSize], parityLength);
+    for (uint32_t i = 0; i < count; i++) {
+        // The slot of the missing packet may still hold one from before the window wrapped.
+        Bits_memcpyConst(&word_be, &msg->bytes[HEADER_SIZE + i * 4], 4);
+        uint32_t nonce = Endian_bigEndianToHost32(word_be);
+        if (nonce == missingNonce) {
+            continue;
+        }
+        struct Received* r = &ctx->received[nonce % WINDOW];
+        xorInto(&out->bytes[4], r->bytes, (r->length < parityLength) ? r->length : parityLength);
+        lengthXor ^= r->length;
+    }
+    if (lengthXor <= parityLength) {
+        out->length = lengthXor + 4;
+        word_be = Endian_hostToBigEndian32(missingNonce);
+        Bits_memcpyConst(out->bytes, &word_be, 4);
+        ctx->pub.recovered++;
+        Interface_receiveMessage(&ctx->pub.generic, out);
+    }
+    Allocator_free(alloc);
+}
+
+static uint8_t receiveMessage(struct Message* msg, struct Interface* wrapped)
+{
+    struct ParityInterface_pvt* ctx =
+        Identity_cast((struct ParityInterface_pvt*) wrapped->receiverContext);
+    if (msg->length < 4) {
+        return Interface_receiveMessage(&ctx->pub.generic, msg);
+    }
+    uint32_t nonce = nonceOf(msg);
+    if (nonce == MARKER) {
+        receiveParity(ctx, msg);
+        return Error_NONE;
+    }
+    if (isData(nonce)) {
+        countLoss(ctx, nonce);
+        if (ctx->received && msg->length - 4 <= ParityInterface_MAX_LENGTH) {
+            struct Received* r = &ctx->received[nonce % WINDOW];
+            r->nonce = nonce;
+            r->length = msg->length - 4;
+            Bits_memcpy(r->bytes, &msg->bytes[4], r->length);
+        }
+    }
+    return Interface_receiveMessage(&ctx->pub.generic, msg);
+}
+
+struct ParityInterface* ParityInterface_new(struct Interface* wrapped, struct Allocator* alloc)
+{
+    struct ParityInterface_pvt* ctx =
+        Allocator_calloc(alloc, sizeof(struct ParityInterface_pvt), 1);
+    ctx->wrapped = wrapped;
+    ctx->alloc = alloc;
+    Bits_memcpyConst(&ctx->pub.generic, (&(struct Interface) {
+        .sendMessage = sendMessage,
+        .senderContext = ctx,
+        .allocator = alloc
+    }), sizeof(struct Interface));
+    wrapped->receiveMessage = receiveMessage;
+    wrapped->receiverContext = ctx;
+    Identity_set(ctx);
+    return &ctx->pub;
+}
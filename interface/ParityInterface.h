@@ -0,0 +1,72 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ParityInterface_H
+#define ParityInterface_H
+
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "util/Linker.h"
+Linker_require("interface/ParityInterface.c")
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Forward error correction for lossy links, this goes below the CryptoAuth session of a peer.
+ * After every group of data packets an XOR parity packet is sent so the other end can rebuild
+ * any one packet of the group which is lost without waiting for an end to end retransmit.
+ * Packets are told apart by their CryptoAuth nonces so data packets go out unchanged and the
+ * parity packets carry a nonce which CryptoAuth does not use, a node without this layer drops
+ * them as packets which fail to decrypt.
+ *
+ * Each end measures the loss of the packets which it receives and reports it back now and then,
+ * the number of packets in a group follows the loss which the other end reports so a link which
+ * loses nothing gets no parity at all.
+ */
+
+/** Largest packet which can be protected, bigger ones are sent but are not in any group. */
+#define ParityInterface_MAX_LENGTH 2048
+
+/** Fewest and most packets covered by one parity packet. */
+#define ParityInterface_MIN_GROUP 2
+#define ParityInterface_MAX_GROUP 16
+
+struct ParityInterface
+{
+    /** Wrap this with CryptoAuth, packets sent to it go to the wrapped interface. */
+    struct Interface generic;
+
+    /** If false then no parity is sent, parity from the other end is always used. */
+    bool enabled;
+
+    /** Packets per parity packet, 0 while the other end reports too little loss to need any. */
+    uint32_t groupSize;
+
+    /** Lost packets from the other end per thousand over the last measurement. */
+    uint32_t lossPerMille;
+
+    /** Parity packets sent and received, and packets which were rebuilt from parity. */
+    uint64_t parityOut;
+    uint64_t parityIn;
+    uint64_t recovered;
+};
+
+/**
+ * @param wrapped the interface to the link.
+ * @param alloc the allocator to create the interface with.
+ */
+struct ParityInterface* ParityInterface_new(struct Interface* wrapped, struct Allocator* alloc);
+
+#endif
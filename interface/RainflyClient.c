@@ -18,12 +18,15 @@
 #include "benc/serialization/json/JsonBencSerializer.h"
 #include "crypto/random/Random.h"
 #include "io/ArrayReader.h"
+#include "util/events/Time.h"
 #include "util/events/Timeout.h"
 #include "util/Assert.h"
 #include "wire/Message.h"
 #include "wire/Error.h"
 
+#include <crypto_hash_sha256.h>
 #include <crypto_sign_ed25519.h>
+#include <stdbool.h>
 
 struct RainflyClient_Key
 {
@@ -37,14 +40,53 @@ struct RainflyClient_Sig
 };
 Assert_compileTime(sizeof(struct RainflyClient_Sig) == 64);
 
+/** Milliseconds to wait for an answer before asking the next servers. */
+#define TRY_NEXT_TIMEOUT 3000
+
+struct RainflyClient_Server
+{
+    struct Sockaddr* addr;
+
+    /** Moving average of the time taken to answer a lookup, milliseconds. */
+    uint32_t latency;
+
+    /** Number of times which the latency has been measured, zero means never asked. */
+    uint32_t samples;
+};
+
+/** Number of signatures which are remembered as valid and how long they are remembered. */
+#define VERIFIED_CACHE_SIZE 64
+#define VERIFIED_CACHE_MS (10 * 60 * 1000)
+
+/** A signature which has already been checked, so the same signed record need not be again. */
+struct RainflyClient_Verified
+{
+    /** Hash of the signature and the signed content. */
+    uint8_t hash[32];
+
+    /** The hot key which signed it. */
+    struct RainflyClient_Key key;
+
+    /** Zero if the entry is empty. */
+    uint64_t timeVerified;
+};
+
 struct RainflyClient_Lookup_pvt;
 struct RainflyClient_Lookup_pvt
 {
     struct RainflyClient_Lookup pub;
     uint32_t cookie;
-    int server;
     int triedServers;
 
+    /** Indexes of the servers, fastest first, and how far down the list the lookup has gone. */
+    int* order;
+    int nextServer;
+
+    /** The servers which were asked in the current round and have not yet answered. */
+    int asked[RainflyClient_MAX_PARALLEL_REQUESTS];
+    int askedCount;
+    uint64_t timeOfLastRound;
+
     /** The index in hotKeys of the first key pushed to the request. */
     int firstKey;
 
@@ -68,7 +110,7 @@ struct RainflyClient_pvt
     struct Sockaddr* addr;
 
     int serverCount;
-    struct Sockaddr** servers;
+    struct RainflyClient_Server* servers;
 
     int keyCount;
     struct RainflyClient_Key* keys;
@@ -82,6 +124,9 @@ struct RainflyClient_pvt
 
     struct RainflyClient_Lookup_pvt* lookups;
 
+    /** Direct mapped by the first byte of the hash. */
+    struct RainflyClient_Verified verified[VERIFIED_CACHE_SIZE];
+
     Identity
 };
 
@@ -143,7 +188,92 @@ static int compare(String* a, String* b)
     return 0;
 }
 
-static void handleLookupReply(struct Message* msg, struct RainflyClient_pvt* ctx)
+static void updateLatency(struct RainflyClient_pvt* ctx, int server, uint32_t sample)
+{
+    struct RainflyClient_Server* s = &ctx->servers[server];
+    if (!s->samples++) {
+        s->latency = sample;
+    } else {
+        s->latency = (s->latency * 7 + sample) / 8;
+    }
+}
+
+/**
+ * Credit the servers which were asked in the latest round with the time it took to answer.
+ * The server which answered gets the elapsed time, the stragglers are at least that slow.
+ */
+static void finishRound(struct RainflyClient_Lookup_pvt* lookup, int answeredBy)
+{
+    struct RainflyClient_pvt* ctx = lookup->ctx;
+    uint32_t elapsed = Time_currentTimeMilliseconds(ctx->eventBase) - lookup->timeOfLastRound;
+    for (int i = 0; i < lookup->askedCount; i++) {
+        int server = lookup->asked[i];
+        struct RainflyClient_Server* s = &ctx->servers[server];
+        if (server == answeredBy || !s->samples || s->latency < elapsed) {
+            updateLatency(ctx, server, elapsed);
+        }
+    }
+    lookup->askedCount = 0;
+}
+
+static int serverIndex(struct Sockaddr* addr, struct RainflyClient_pvt* ctx)
+{
+    uint8_t* ip;
+    int len = Sockaddr_getAddress(addr, &ip);
+    for (int i = 0; i < ctx->serverCount; i++) {
+        struct Sockaddr* s = ctx->servers[i].addr;
+        uint8_t* sip;
+        if (Sockaddr_getAddress(s, &sip) == len
+            && Sockaddr_getPort(s) == Sockaddr_getPort(addr)
+            && !Bits_memcmp(ip, sip, len))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Check a signature on a server reply, the same record is usually served to many lookups and
+ * by many servers so signatures which have been seen lately are not checked again.
+ *
+ * @param signedMsg the signature followed by the content which was signed.
+ * @param key the hot key which should have signed it.
+ * @param scratch space of at least signedMsg->length bytes.
+ * @return true if the signature is valid.
+ */
+static bool verify(struct Message* signedMsg,
+                   uint8_t key[32],
+                   uint8_t* scratch,
+                   struct RainflyClient_pvt* ctx)
+{
+    uint8_t hash[32];
+    crypto_hash_sha256(hash, signedMsg->bytes, signedMsg->length);
+    struct RainflyClient_Verified* v = &ctx->verified[hash[0] % VERIFIED_CACHE_SIZE];
+    uint64_t now = Time_currentTimeMilliseconds(ctx->eventBase);
+    if (v->timeVerified
+        && now - v->timeVerified < VERIFIED_CACHE_MS
+        && !Bits_memcmp(v->hash, hash, 32)
+        && !Bits_memcmp(v->key.bytes, key, 32))
+    {
+        return true;
+    }
+
+    unsigned long long x = 32;
+    if (crypto_sign_ed25519_open(scratch, &x, signedMsg->bytes, signedMsg->length, key)
+        || (int)x != signedMsg->length - 64)
+    {
+        return false;
+    }
+    Bits_memcpyConst(v->hash, hash, 32);
+    Bits_memcpyConst(v->key.bytes, key, 32);
+    v->timeVerified = now;
+    return true;
+}
+
+static void handleLookupReply(struct Message* msg,
+                              struct Sockaddr* from,
+                              struct RainflyClient_pvt* ctx)
 {
     Log_debug(ctx->logger, "lookup reply!");
 
@@ -215,13 +345,11 @@ static void handleLookupReply(struct Message* msg, struct RainflyClient_pvt* ctx
 
     int validSigs = 0;
     uint8_t* scratch = Allocator_malloc(msg->alloc, msg->length + 64);
-    for (int i = 0; i < count; i++) {
-        unsigned long long x = 32;
+    // Once there are enough valid signatures the rest need not be checked.
+    for (int i = 0; i < count && validSigs < ctx->pub.minSignatures; i++) {
         Message_push(msg, sigs[i].bytes, 64, NULL);
         uint8_t* key = ctx->hotKeys[(lookup->firstKey + i) % ctx->keyCount].bytes;
-        if (!crypto_sign_ed25519_open(scratch, &x, msg->bytes, msg->length, key)
-            && (int)x == msg->length - 64)
-        {
+        if (verify(msg, key, scratch, ctx)) {
             Log_debug(ctx->logger, "valid signature [%d] on [%s]", i, namesAndValue[0]->bytes);
             validSigs++;
         } else if (Bits_isZero(sigs[i].bytes, 64)) {
@@ -237,6 +365,9 @@ static void handleLookupReply(struct Message* msg, struct RainflyClient_pvt* ctx
         return;
     }
 
+    // Any other servers which were asked will be ignored when they answer.
+    finishRound(lookup, serverIndex(from, ctx));
+
     struct Reader* r = ArrayReader_new(namesAndValue[2]->bytes, namesAndValue[2]->len, msg->alloc);
     Dict d;
     if (JsonBencSerializer_get()->parseDictionary(r, msg->alloc, &d)) {
@@ -316,6 +447,8 @@ static uint8_t receiveMessage(struct Message* msg, struct Interface* iface)
         return Error_NONE;
     }
 
+    struct Sockaddr_storage from;
+    Bits_memcpy(&from, msg->bytes, ctx->addr->addrLen);
     Message_shift(msg, -ctx->addr->addrLen, NULL);
 
     uint8_t operation = Message_pop8(msg, NULL);
@@ -330,7 +463,7 @@ static uint8_t receiveMessage(struct Message* msg, struct Interface* iface)
     switch (operation) {
         case RequestType_PING: return Error_NONE;
         case RequestType_HOT_KEYS: handleHotKeysReply(msg, ctx); return Error_NONE;
-        case RequestType_LOOKUP: handleLookupReply(msg, ctx); return Error_NONE;
+        case RequestType_LOOKUP: handleLookupReply(msg, &from.addr, ctx); return Error_NONE;
         default: Log_debug(ctx->logger, "Got a message with unrecognized type [%d]", operation);
     }
 
@@ -375,10 +508,10 @@ static void sendHotKeysRequest(void* vRainflyClient)
     Message_push8(msg, RequestType_HOT_KEYS, NULL);
 
     int server = Random_uint32(ctx->rand) % ctx->serverCount;
-    Message_push(msg, ctx->servers[server], ctx->addr->addrLen, NULL);
+    Message_push(msg, ctx->servers[server].addr, ctx->addr->addrLen, NULL);
 
     Log_debug(ctx->logger, "Sending hotkeys request to [%s]",
-              Sockaddr_print(ctx->servers[server], alloc));
+              Sockaddr_print(ctx->servers[server].addr, alloc));
 
     Interface_sendMessage(ctx->iface, msg);
     Allocator_free(alloc);
@@ -403,12 +536,18 @@ static int lookupOnFree(struct Allocator_OnFreeJob* onFree)
     return 0;
 }
 
-static void tryNextServer(void* vLookup)
+static void tryNextServers(void* vLookup)
 {
     struct RainflyClient_Lookup_pvt* lookup =
         Identity_cast((struct RainflyClient_Lookup_pvt*)vLookup);
     struct RainflyClient_pvt* ctx = Identity_cast((struct RainflyClient_pvt*)lookup->ctx);
 
+    // Nobody who was asked in the last round gave a usable answer in time.
+    for (int i = 0; i < lookup->askedCount; i++) {
+        updateLatency(ctx, lookup->asked[i], TRY_NEXT_TIMEOUT);
+    }
+    lookup->askedCount = 0;
+
     if (lookup->triedServers++ > ctx->pub.maxTries) {
         if (lookup->pub.onReply) {
             lookup->pub.onReply(&lookup->pub, NULL, RainflyClient_ResponseCode_SERVER_ERROR);
@@ -433,14 +572,58 @@ static void tryNextServer(void* vLookup)
     uint32_t typeAndIdent = lookup->cookie | (RequestType_LOOKUP << 24);
     Message_push32(msg, typeAndIdent, NULL);
 
-    int server = lookup->server++ % ctx->serverCount;
-    Message_push(msg, ctx->servers[server], ctx->addr->addrLen, NULL);
+    int parallel = ctx->pub.parallelRequests;
+    if (parallel > RainflyClient_MAX_PARALLEL_REQUESTS) {
+        parallel = RainflyClient_MAX_PARALLEL_REQUESTS;
+    }
+    if (parallel > ctx->serverCount) {
+        parallel = ctx->serverCount;
+    }
+    if (parallel < 1) {
+        parallel = 1;
+    }
+
+    lookup->timeOfLastRound = Time_currentTimeMilliseconds(ctx->eventBase);
+    for (i = 0; i < parallel; i++) {
+        int server = lookup->order[lookup->nextServer++ % ctx->serverCount];
+        lookup->asked[lookup->askedCount++] = server;
 
-    Log_debug(ctx->logger, "Sending lookup request to [%s]",
-              Sockaddr_print(ctx->servers[server], alloc));
+        struct Message* toSend = Message_clone(msg, alloc);
+        Message_push(toSend, ctx->servers[server].addr, ctx->addr->addrLen, NULL);
 
-    Interface_sendMessage(ctx->iface, msg);
+        Log_debug(ctx->logger, "Sending lookup request to [%s]",
+                  Sockaddr_print(ctx->servers[server].addr, alloc));
+
+        Interface_sendMessage(ctx->iface, toSend);
+    }
     Allocator_free(alloc);
+
+    Timeout_resetTimeout(lookup->tryNextTimeout, TRY_NEXT_TIMEOUT);
+}
+
+/**
+ * Order the servers by how quickly they have answered in the past, servers which have never been
+ * asked go first so that they get measured. Ties are broken from a random starting point so the
+ * load is spread.
+ */
+static int* sortServers(struct RainflyClient_pvt* ctx, struct Allocator* alloc)
+{
+    int* order = Allocator_malloc(alloc, sizeof(int) * ctx->serverCount);
+    int start = Random_uint32(ctx->rand) % ctx->serverCount;
+    for (int i = 0; i < ctx->serverCount; i++) {
+        int server = (start + i) % ctx->serverCount;
+        uint32_t latency = ctx->servers[server].samples ? ctx->servers[server].latency : 0;
+        int j = i;
+        for (; j > 0; j--) {
+            struct RainflyClient_Server* prev = &ctx->servers[order[j - 1]];
+            if ((prev->samples ? prev->latency : 0) <= latency) {
+                break;
+            }
+            order[j] = order[j - 1];
+        }
+        order[j] = server;
+    }
+    return order;
 }
 
 ////////////////////
@@ -476,13 +659,14 @@ struct RainflyClient_Lookup* RainflyClient_lookup(struct RainflyClient* client,
     out->pub.domain->bytes[0] = 'h';
     out->pub.domain->bytes[1] = '/';
 
-    out->server = Random_uint32(ctx->rand) % ctx->serverCount;
+    out->order = sortServers(ctx, alloc);
 
-    out->tryNextTimeout = Timeout_setTimeout(tryNextServer, out, 3000, ctx->eventBase, alloc);
+    out->tryNextTimeout =
+        Timeout_setTimeout(tryNextServers, out, TRY_NEXT_TIMEOUT, ctx->eventBase, alloc);
 
     Allocator_onFree(alloc, lookupOnFree, out);
 
-    tryNextServer(out);
+    tryNextServers(out);
 
     return &out->pub;
 }
@@ -509,9 +693,12 @@ int RainflyClient_addServer(struct RainflyClient* client, struct Sockaddr* addr)
         return RainflyClient_addServer_WRONG_ADDRESS_TYPE;
     }
     ctx->serverCount++;
-    ctx->servers =
-        Allocator_realloc(ctx->alloc, ctx->servers, ctx->serverCount * sizeof(uintptr_t));
-    ctx->servers[ctx->serverCount-1] = Sockaddr_clone(addr, ctx->alloc);
+    ctx->servers = Allocator_realloc(ctx->alloc,
+                                     ctx->servers,
+                                     ctx->serverCount * sizeof(struct RainflyClient_Server));
+    ctx->servers[ctx->serverCount-1] = (struct RainflyClient_Server) {
+        .addr = Sockaddr_clone(addr, ctx->alloc)
+    };
     return 0;
 }
 
@@ -525,6 +712,7 @@ struct RainflyClient* RainflyClient_new(struct AddrInterface* iface,
             .pub = {
                 .minSignatures = RainflyClient_DEFAULT_MIN_SIGNATURES,
                 .maxTries = RainflyClient_DEFAULT_MAX_TRIES,
+                .parallelRequests = RainflyClient_DEFAULT_PARALLEL_REQUESTS,
             },
             .iface = &iface->generic,
             .logger = logger,
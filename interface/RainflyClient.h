@@ -27,11 +27,19 @@ Linker_require("interface/RainflyClient.c")
 
 #define RainflyClient_DEFAULT_MIN_SIGNATURES 2
 #define RainflyClient_DEFAULT_MAX_TRIES 3
+#define RainflyClient_DEFAULT_PARALLEL_REQUESTS 1
+#define RainflyClient_MAX_PARALLEL_REQUESTS 8
 
 struct RainflyClient
 {
     int minSignatures;
     int maxTries;
+
+    /**
+     * How many servers to ask at once, the fastest ones are asked first and the first answer
+     * which carries minSignatures valid signatures wins, the others are ignored.
+     */
+    int parallelRequests;
 };
 
 enum RainflyClient_ResponseCode {
@@ -82,6 +82,29 @@ static void minSinatures(Dict* args, void* vcontext, String* txid, struct Alloca
     Allocator_free(alloc);
 }
 
+static void parallelRequests(Dict* args,
+                             void* vcontext,
+                             String* txid,
+                             struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    struct Allocator* alloc = Allocator_child(context->alloc);
+    int64_t* count = Dict_getInt(args, String_CONST("count"));
+    char* err = "none";
+    if (*count < 1 || *count > RainflyClient_MAX_PARALLEL_REQUESTS) {
+        err = "count must be at least one and no more than RainflyClient_MAX_PARALLEL_REQUESTS";
+    } else {
+        context->rainfly->parallelRequests = *count;
+    }
+
+    Dict* response = Dict_new(alloc);
+    Dict_putString(response, String_CONST("error"), String_CONST(err), alloc);
+
+    Admin_sendMessage(response, txid, context->admin);
+
+    Allocator_free(alloc);
+}
+
 static void addServer(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
 {
     struct Context* context = vcontext;
@@ -134,4 +157,9 @@ void RainflyClient_admin_register(struct RainflyClient* rainfly,
         ((struct Admin_FunctionArg[]) {
             { .name = "count", .required = 1, .type = "Int" }
         }), admin);
+
+    Admin_registerFunction("RainflyClient_parallelRequests", parallelRequests, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "count", .required = 1, .type = "Int" }
+        }), admin);
 }
@@ -18,6 +18,7 @@
 #include "interface/Interface.h"
 #include "memory/Allocator.h"
 #include "util/Bits.h"
+#include "util/Probe.h"
 #include "util/events/Time.h"
 #include "util/events/Timeout.h"
 #include "util/version/Version.h"
@@ -38,14 +39,37 @@
 
 #define MAX_FIRST_HANDLE 100000
 
+/**
+ * When the session table is full this many of the least recently used sessions are looked at
+ * for one which never finished the handshake, otherwise the least recently used one goes.
+ */
+#define EVICTION_SCAN 32
+
+/** Marks the end of the expiry list. */
+#define NO_SESSION UINT32_MAX
+
 
 struct Ip6
 {
     uint8_t bytes[16];
 };
+
+/**
+ * A session and its place in the expiry list, which is ordered by lastMessageTime.
+ * Sessions move around in the map so they are linked by their map handles.
+ */
+struct Session
+{
+    struct SessionManager_Session pub;
+
+    /** The handles of the sessions used just before and just after this one or NO_SESSION. */
+    uint32_t older;
+    uint32_t newer;
+};
+
 #define Map_NAME OfSessionsByIp6
 #define Map_KEY_TYPE struct Ip6
-#define Map_VALUE_TYPE struct SessionManager_Session
+#define Map_VALUE_TYPE struct Session
 #define Map_ENABLE_HANDLES
 #include "util/Map.h"
 
@@ -73,29 +97,104 @@ struct SessionManager
 
     /** The first handle number to start with, randomized at startup to reduce collisions. */
     uint32_t first;
+
+    /** The map handles of the most and least recently used sessions or NO_SESSION. */
+    uint32_t newest;
+    uint32_t oldest;
+
+    /** When there are this many sessions, one is evicted to make space for each new one. */
+    uint32_t maxSessions;
 };
 
+static inline struct Session* sessionForMapHandle(uint32_t handle, struct SessionManager* sm)
+{
+    return &sm->ifaceMap.values[Map_OfSessionsByIp6_indexForHandle(handle, &sm->ifaceMap)];
+}
+
+static void unlinkSession(struct Session* session, struct SessionManager* sm)
+{
+    if (session->older != NO_SESSION) {
+        sessionForMapHandle(session->older, sm)->newer = session->newer;
+    } else {
+        sm->oldest = session->newer;
+    }
+    if (session->newer != NO_SESSION) {
+        sessionForMapHandle(session->newer, sm)->older = session->older;
+    } else {
+        sm->newest = session->older;
+    }
+}
+
+static void linkNewest(uint32_t handle, struct Session* session, struct SessionManager* sm)
+{
+    session->older = sm->newest;
+    session->newer = NO_SESSION;
+    if (sm->newest != NO_SESSION) {
+        sessionForMapHandle(sm->newest, sm)->newer = handle;
+    } else {
+        sm->oldest = handle;
+    }
+    sm->newest = handle;
+}
+
+/** Set the time of last message to "now" and move the session to the front of the list. */
+static void touch(int index, struct SessionManager* sm)
+{
+    struct Session* session = &sm->ifaceMap.values[index];
+    session->pub.lastMessageTime = Time_currentTimeSeconds(sm->eventBase);
+    uint32_t handle = sm->ifaceMap.handles[index];
+    if (sm->newest != handle) {
+        unlinkSession(session, sm);
+        linkNewest(handle, session, sm);
+    }
+}
+
+static void removeSession(int index, struct SessionManager* sm)
+{
+    struct Session* session = &sm->ifaceMap.values[index];
+    unlinkSession(session, sm);
+    Allocator_free(session->pub.iface.allocator);
+    Map_OfSessionsByIp6_remove(index, &sm->ifaceMap);
+}
+
+/** Make space for a new session by removing one, preferably one whose handshake never finished. */
+static void evict(struct SessionManager* sm)
+{
+    uint32_t victim = sm->oldest;
+    uint32_t handle = sm->oldest;
+    for (int i = 0; i < EVICTION_SCAN && handle != NO_SESSION; i++) {
+        struct Session* session = sessionForMapHandle(handle, sm);
+        if (CryptoAuth_getState(&session->pub.iface) < CryptoAuth_ESTABLISHED) {
+            victim = handle;
+            break;
+        }
+        handle = session->newer;
+    }
+    removeSession(Map_OfSessionsByIp6_indexForHandle(victim, &sm->ifaceMap), sm);
+}
+
+/** Expire sessions from the back of the list, the rest are newer so the scan stops there. */
 static void cleanup(void* vsm)
 {
     struct SessionManager* sm = (struct SessionManager*) vsm;
     uint64_t nowSecs = Time_currentTimeSeconds(sm->eventBase);
-    for (uint32_t i = 0; i < sm->ifaceMap.count; i++) {
-        if (sm->ifaceMap.values[i].lastMessageTime < (nowSecs - SESSION_TIMEOUT_SECONDS)) {
-            struct Allocator* ifAllocator = sm->ifaceMap.values[i].iface.allocator;
-            Allocator_free(ifAllocator);
-            Map_OfSessionsByIp6_remove(i, &sm->ifaceMap);
-            i--;
+    while (sm->oldest != NO_SESSION) {
+        int index = Map_OfSessionsByIp6_indexForHandle(sm->oldest, &sm->ifaceMap);
+        struct Session* session = &sm->ifaceMap.values[index];
+        if (session->pub.lastMessageTime >= (nowSecs - SESSION_TIMEOUT_SECONDS)) {
+            break;
         }
+        removeSession(index, sm);
     }
 }
 
 static void check(struct SessionManager* sm, int mapIndex)
 {
     Assert_always(sm->ifaceMap.keys[mapIndex].bytes[0] == 0xfc);
-    uint8_t* herPubKey = CryptoAuth_getHerPublicKey(&sm->ifaceMap.values[mapIndex].iface);
+    uint8_t* herPubKey = CryptoAuth_getHerPublicKey(&sm->ifaceMap.values[mapIndex].pub.iface);
     if (!Bits_isZero(herPubKey, 32)) {
         uint8_t ip6[16];
-        AddressCalc_addressForPublicKey(ip6, herPubKey);
+        AddressCalc_cachedAddressForPublicKey(ip6, herPubKey, sm->cryptoAuth->addressCache);
         Assert_always(!Bits_memcmp(&sm->ifaceMap.keys[mapIndex], ip6, 16));
     }
 }
@@ -108,6 +207,9 @@ struct SessionManager_Session* SessionManager_getSession(uint8_t* lookupKey,
     if (ifaceIndex == -1) {
         // Make sure cleanup() doesn't get behind.
         cleanup(sm);
+        while (sm->ifaceMap.count >= sm->maxSessions) {
+            evict(sm);
+        }
 
         struct Allocator* ifAllocator = Allocator_child(sm->allocator);
         struct Interface* outsideIf = Allocator_clone(ifAllocator, (&(struct Interface) {
@@ -124,30 +226,36 @@ struct SessionManager_Session* SessionManager_getSession(uint8_t* lookupKey,
         insideIf->receiveMessage = sm->decryptedIncoming;
         insideIf->receiverContext = sm->interfaceContext;
 
-        struct SessionManager_Session s = {
-            .lastMessageTime = Time_currentTimeSeconds(sm->eventBase),
+        struct Session s = {
+            .pub = {
+                .lastMessageTime = Time_currentTimeSeconds(sm->eventBase),
 
-            .version = Version_DEFAULT_ASSUMPTION,
+                .version = Version_DEFAULT_ASSUMPTION,
 
-            // Create a trick interface which pretends to be on both sides of the crypto.
-            .iface = {
-                .sendMessage = insideIf->sendMessage,
-                .senderContext = insideIf->senderContext,
-                .receiveMessage = outsideIf->receiveMessage,
-                .receiverContext = outsideIf->receiverContext,
-                .allocator = ifAllocator
+                // Create a trick interface which pretends to be on both sides of the crypto.
+                .iface = {
+                    .sendMessage = insideIf->sendMessage,
+                    .senderContext = insideIf->senderContext,
+                    .receiveMessage = outsideIf->receiveMessage,
+                    .receiverContext = outsideIf->receiverContext,
+                    .allocator = ifAllocator
+                }
             }
         };
 
         int index = Map_OfSessionsByIp6_put((struct Ip6*)lookupKey, &s, &sm->ifaceMap);
-        struct SessionManager_Session* sp = &sm->ifaceMap.values[index];
-        sp->receiveHandle_be = Endian_hostToBigEndian32(sm->ifaceMap.handles[index] + sm->first);
-        Bits_memcpyConst(sp->ip6, lookupKey, 16);
-        return sp;
+        struct Session* sp = &sm->ifaceMap.values[index];
+        linkNewest(sm->ifaceMap.handles[index], sp, sm);
+        sp->pub.receiveHandle_be =
+            Endian_hostToBigEndian32(sm->ifaceMap.handles[index] + sm->first);
+        Bits_memcpyConst(sp->pub.ip6, lookupKey, 16);
+        Probe_fire2(sessionNew, sp->pub.ip6, Endian_bigEndianToHost32(sp->pub.receiveHandle_be));
+        return &sp->pub;
     } else {
         // Interface already exists, set the time of last message to "now".
-        sm->ifaceMap.values[ifaceIndex].lastMessageTime = Time_currentTimeSeconds(sm->eventBase);
-        uint8_t* herPubKey = CryptoAuth_getHerPublicKey(&sm->ifaceMap.values[ifaceIndex].iface);
+        touch(ifaceIndex, sm);
+        uint8_t* herPubKey =
+            CryptoAuth_getHerPublicKey(&sm->ifaceMap.values[ifaceIndex].pub.iface);
         if (Bits_isZero(herPubKey, 32) && cryptoKey) {
             Bits_memcpyConst(herPubKey, cryptoKey, 32);
         }
@@ -155,7 +263,7 @@ struct SessionManager_Session* SessionManager_getSession(uint8_t* lookupKey,
 
     check(sm, ifaceIndex);
 
-    return &sm->ifaceMap.values[ifaceIndex];
+    return &sm->ifaceMap.values[ifaceIndex].pub;
 }
 
 struct SessionManager_Session* SessionManager_sessionForHandle(uint32_t handle,
@@ -164,7 +272,31 @@ struct SessionManager_Session* SessionManager_sessionForHandle(uint32_t handle,
     int index = Map_OfSessionsByIp6_indexForHandle(handle - sm->first, &sm->ifaceMap);
     if (index < 0) { return NULL; }
     check(sm, index);
-    return &sm->ifaceMap.values[index];
+    return &sm->ifaceMap.values[index].pub;
+}
+
+void SessionManager_setMaxSessions(uint32_t maxSessions, struct SessionManager* sm)
+{
+    sm->maxSessions = (maxSessions < SessionManager_MIN_MAX_SESSIONS)
+        ? SessionManager_MIN_MAX_SESSIONS : maxSessions;
+}
+
+uint32_t SessionManager_getMaxSessions(struct SessionManager* sm)
+{
+    return sm->maxSessions;
+}
+
+uint32_t SessionManager_getSessionCount(struct SessionManager* sm)
+{
+    return sm->ifaceMap.count;
+}
+
+void SessionManager_touch(struct SessionManager_Session* session, struct SessionManager* sm)
+{
+    uint32_t handle = Endian_bigEndianToHost32(session->receiveHandle_be) - sm->first;
+    int index = Map_OfSessionsByIp6_indexForHandle(handle, &sm->ifaceMap);
+    Assert_true(index > -1 && &sm->ifaceMap.values[index].pub == session);
+    touch(index, sm);
 }
 
 uint8_t* SessionManager_getIp6(uint32_t handle, struct SessionManager* sm)
@@ -210,6 +342,9 @@ struct SessionManager* SessionManager_new(Interface_CALLBACK(decryptedIncoming),
         .cryptoAuth = cryptoAuth,
         .allocator = allocator,
         .first = (Random_uint32(rand) % (MAX_FIRST_HANDLE - MIN_FIRST_HANDLE)) + MIN_FIRST_HANDLE,
+        .newest = NO_SESSION,
+        .oldest = NO_SESSION,
+        .maxSessions = SessionManager_DEFAULT_MAX_SESSIONS,
         .cleanupInterval =
             Timeout_setInterval(cleanup, sm, 1000 * CLEANUP_CYCLE_SECONDS, eventBase, allocator)
     }), sizeof(struct SessionManager));
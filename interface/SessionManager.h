@@ -27,6 +27,15 @@ Linker_require("interface/SessionManager.c")
 
 struct SessionManager;
 
+/** The most sessions which are kept at once unless SessionManager_setMaxSessions() is called. */
+#define SessionManager_DEFAULT_MAX_SESSIONS 4096
+
+/**
+ * SessionManager_setMaxSessions() will not go below this, a session which was just created
+ * must not be evicted by the creation of another one.
+ */
+#define SessionManager_MIN_MAX_SESSIONS 64
+
 struct SessionManager_Session
 {
     struct Interface iface;
@@ -45,6 +54,15 @@ struct SessionManager_Session
 
     /** The IPv6 address of the other node. */
     uint8_t ip6[16];
+
+    /**
+     * The largest IPv6 packet which is known to fit along the switch path to this node,
+     * 0 if it is not known yet.
+     */
+    uint32_t pathMtu;
+
+    /** The switch label which pathMtu was measured along, 0 if it has never been probed. */
+    uint64_t pathMtuLabel;
 };
 
 struct SessionManager_HandleList
@@ -99,6 +117,31 @@ struct SessionManager_Session* SessionManager_getSession(uint8_t* lookupKey,
 struct SessionManager_Session* SessionManager_sessionForHandle(uint32_t handle,
                                                                struct SessionManager* sm);
 
+/**
+ * Set the maximum number of sessions, when a new session would go over it then one of the least
+ * recently used sessions is evicted, preferably one whose handshake never finished.
+ * Sessions which are already over the new maximum are evicted as new sessions are created.
+ *
+ * @param maxSessions the maximum, raised to SessionManager_MIN_MAX_SESSIONS if it is lower.
+ * @param sm the session manager.
+ */
+void SessionManager_setMaxSessions(uint32_t maxSessions, struct SessionManager* sm);
+
+/** Get the maximum number of sessions, see SessionManager_setMaxSessions(). */
+uint32_t SessionManager_getMaxSessions(struct SessionManager* sm);
+
+/** Get the number of sessions which currently exist. */
+uint32_t SessionManager_getSessionCount(struct SessionManager* sm);
+
+/**
+ * Keep a session from expiring as SessionManager_getSession() does, for callers which found
+ * the session by its handle.
+ *
+ * @param session a session which was returned by this session manager.
+ * @param sm the session manager.
+ */
+void SessionManager_touch(struct SessionManager_Session* session, struct SessionManager* sm);
+
 /**
  * Get the IPv6 address for a session.
  *
@@ -48,6 +48,7 @@ static void getHandles(Dict* args, void* vcontext, String* txid, struct Allocato
     Dict* r = Dict_new(alloc);
     Dict_putList(r, String_CONST("handles"), list, alloc);
     Dict_putInt(r, String_CONST("total"), hList->count, alloc);
+    Dict_putInt(r, String_CONST("maxSessions"), SessionManager_getMaxSessions(context->sm), alloc);
 
     String* more = String_CONST("more");
     if (i < hList->count) {
@@ -103,10 +104,92 @@ static void sessionStats(Dict* args,
                 Endian_bigEndianToHost32(session->receiveHandle_be), alloc);
     Dict_putInt(r, String_CONST("sendHandle"),
                 Endian_bigEndianToHost32(session->sendHandle_be), alloc);
+    Dict_putInt(r, String_CONST("bytesAllocated"),
+                Allocator_bytesAllocated(session->iface.allocator), alloc);
     Admin_sendMessage(r, txid, context->admin);
     return;
 }
 
+#define STATS_PER_PAGE 8
+static void trafficStats(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    struct Allocator* alloc = Allocator_child(context->alloc);
+
+    int64_t* page = Dict_getInt(args, String_CONST("page"));
+    uint32_t i = (page) ? *page * STATS_PER_PAGE : 0;
+    struct SessionManager_HandleList* hList = SessionManager_getHandleList(context->sm, alloc);
+
+    String* handle = String_CONST("handle");
+    String* ip6 = String_CONST("ip6");
+    String* packetsIn = String_CONST("packetsIn");
+    String* bytesIn = String_CONST("bytesIn");
+    String* packetsOut = String_CONST("packetsOut");
+    String* bytesOut = String_CONST("bytesOut");
+    String* decryptFailures = String_CONST("decryptFailures");
+    String* duplicates = String_CONST("duplicates");
+    String* receivedOutOfRange = String_CONST("receivedOutOfRange");
+    String* rtt = String_CONST("rtt");
+
+    List* list = NULL;
+    for (int counter=0; i < hList->count && counter++ < STATS_PER_PAGE; i++) {
+        struct SessionManager_Session* session =
+            SessionManager_sessionForHandle(hList->handles[i], context->sm);
+        struct CryptoAuth_Stats* stats = CryptoAuth_getStats(&session->iface);
+        struct ReplayProtector* rp = CryptoAuth_getReplayProtector(&session->iface);
+
+        Dict* d = Dict_new(alloc);
+        Dict_putInt(d, handle, hList->handles[i], alloc);
+
+        uint8_t printedAddr[40];
+        AddrTools_printIp(printedAddr, session->ip6);
+        Dict_putString(d, ip6, String_new(printedAddr, alloc), alloc);
+
+        Dict_putInt(d, packetsIn, stats->packetsIn, alloc);
+        Dict_putInt(d, bytesIn, stats->bytesIn, alloc);
+        Dict_putInt(d, packetsOut, stats->packetsOut, alloc);
+        Dict_putInt(d, bytesOut, stats->bytesOut, alloc);
+        Dict_putInt(d, decryptFailures, stats->decryptFailures, alloc);
+        Dict_putInt(d, duplicates, rp->duplicates, alloc);
+        Dict_putInt(d, receivedOutOfRange, rp->receivedOutOfRange, alloc);
+        Dict_putInt(d, rtt, stats->rttMilliseconds, alloc);
+
+        list = List_addDict(list, d, alloc);
+    }
+
+    Dict* r = Dict_new(alloc);
+    Dict_putList(r, String_CONST("sessions"), list, alloc);
+    Dict_putInt(r, String_CONST("total"), hList->count, alloc);
+    String* more = String_CONST("more");
+    if (i < hList->count) {
+        Dict_putInt(r, more, 1, alloc);
+    }
+
+    Admin_sendMessage(r, txid, context->admin);
+
+    Allocator_free(alloc);
+}
+
+static void setMaxSessions(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* context = vcontext;
+    String* maxSessionsKey = String_CONST("maxSessions");
+    String* error = String_CONST("error");
+    String* outOfRange = String_CONST("maxSessions out of range");
+    String* none = String_CONST("none");
+    int64_t* maxSessions = Dict_getInt(args, maxSessionsKey);
+
+    Dict* r = Dict_new(alloc);
+    if (*maxSessions < 0 || *maxSessions > UINT32_MAX) {
+        Dict_putString(r, error, outOfRange, alloc);
+    } else {
+        SessionManager_setMaxSessions(*maxSessions, context->sm);
+        Dict_putString(r, error, none, alloc);
+        Dict_putInt(r, maxSessionsKey, SessionManager_getMaxSessions(context->sm), alloc);
+    }
+    Admin_sendMessage(r, txid, context->admin);
+}
+
 void SessionManager_admin_register(struct SessionManager* sm,
                                    struct Admin* admin,
                                    struct Allocator* alloc)
@@ -126,4 +209,14 @@ void SessionManager_admin_register(struct SessionManager* sm,
         ((struct Admin_FunctionArg[]) {
             { .name = "handle", .required = 1, .type = "Int" }
         }), admin);
+
+    Admin_registerFunction("SessionManager_trafficStats", trafficStats, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "page", .required = 0, .type = "Int" }
+        }), admin);
+
+    Admin_registerFunction("SessionManager_setMaxSessions", setMaxSessions, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "maxSessions", .required = 1, .type = "Int" }
+        }), admin);
 }
@@ -0,0 +1,94 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "exception/Except.h"
+#include "interface/Interface.h"
+#include "interface/MultiInterface.h"
+#include "interface/TCPInterface.h"
+#include "interface/addressable/TCPAddrInterface.h"
+#include "interface/InterfaceController.h"
+#include "memory/Allocator.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+
+struct TCPInterface_pvt
+{
+    struct TCPInterface pub;
+    struct AddrInterface* tcpBase;
+    struct Log* logger;
+    struct InterfaceController* ic;
+    struct MultiInterface* multiIface;
+    struct Allocator* alloc;
+    Identity
+};
+
+int TCPInterface_beginConnection(const char* address,
+                                 uint8_t cryptoKey[32],
+                                 String* password,
+                                 struct TCPInterface* tcp)
+{
+    struct TCPInterface_pvt* tcpif = Identity_cast((struct TCPInterface_pvt*) tcp);
+    struct Sockaddr_storage ss;
+    if (Sockaddr_parse(address, &ss)) {
+        return TCPInterface_beginConnection_BAD_ADDRESS;
+    }
+    if (Sockaddr_getFamily(&ss.addr) != Sockaddr_getFamily(tcp->addr)) {
+        return TCPInterface_beginConnection_ADDRESS_MISMATCH;
+    }
+
+    struct Interface* iface = MultiInterface_ifaceForKey(tcpif->multiIface, &ss.addr);
+    int ret = InterfaceController_registerPeer(tcpif->ic, cryptoKey, password, false, false, iface);
+    if (ret) {
+        Allocator_free(iface->allocator);
+        switch(ret) {
+            case InterfaceController_registerPeer_BAD_KEY:
+                return TCPInterface_beginConnection_BAD_KEY;
+
+            case InterfaceController_registerPeer_OUT_OF_SPACE:
+                return TCPInterface_beginConnection_OUT_OF_SPACE;
+
+            default:
+                return TCPInterface_beginConnection_UNKNOWN_ERROR;
+        }
+    }
+    return 0;
+}
+
+struct TCPInterface* TCPInterface_new(struct EventBase* base,
+                                      struct Sockaddr* bindAddr,
+                                      struct Allocator* allocator,
+                                      struct Except* exHandler,
+                                      struct Log* logger,
+                                      struct InterfaceController* ic)
+{
+    struct AddrInterface* tcpBase =
+        TCPAddrInterface_new(base, bindAddr, allocator, exHandler, logger);
+
+    struct TCPInterface_pvt* context =
+        Allocator_clone(allocator, (&(struct TCPInterface_pvt) {
+            .pub = {
+                .addr = tcpBase->addr
+            },
+            .tcpBase = tcpBase,
+            .logger = logger,
+            .ic = ic,
+            .alloc = allocator
+        }));
+    Identity_set(context);
+
+    context->multiIface = MultiInterface_new(context->pub.addr->addrLen, &tcpBase->generic, ic);
+
+    return &context->pub;
+}
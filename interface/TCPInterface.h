@@ -0,0 +1,77 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TCPInterface_H
+#define TCPInterface_H
+
+#include "interface/Interface.h"
+#include "interface/InterfaceController.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/platform/Sockaddr.h"
+#include "util/log/Log.h"
+#include "util/Linker.h"
+Linker_require("interface/TCPInterface.c")
+
+/**
+ * Peering over TCP for nodes which can't reach each other with UDP.
+ * It behaves like UDPInterface, peers are keyed by the address of their connection.
+ */
+struct TCPInterface
+{
+    struct Sockaddr* addr;
+};
+
+/**
+ * @param base the event loop.
+ * @param bindAddr the address and port to listen on.
+ * @param allocator freeing this closes the listening socket and all connections.
+ * @param exHandler raises if the socket can't be bound.
+ * @param logger
+ * @param ic the controller which this interface should register with
+ *           and use when starting connections.
+ * @return a new TCPInterface.
+ */
+struct TCPInterface* TCPInterface_new(struct EventBase* base,
+                                      struct Sockaddr* bindAddr,
+                                      struct Allocator* allocator,
+                                      struct Except* exHandler,
+                                      struct Log* logger,
+                                      struct InterfaceController* ic);
+
+/**
+ * Begin an outgoing connection.
+ *
+ * @param address the ip address and tcp port to connect to, expressed as address:port.
+ * @param cryptoKey the node's public key, this is required to send it traffic.
+ * @param password if specified, the password for authenticating with the other node.
+ * @param tcpif the TCP interface.
+ * @return 0 on success
+ *     TCPInterface_beginConnection_OUT_OF_SPACE if there is no space to store the entry.
+ *     TCPInterface_beginConnection_BAD_KEY invalid (non-cjdns) cryptoKey
+ *     TCPInterface_beginConnection_BAD_ADDRESS failed to parse ip address and port.
+ *     TCPInterface_beginConnection_ADDRESS_MISMATCH address not same protocol as the socket.
+ *     TCPInterface_beginConnection_UNKNOWN_ERROR something failed in InterfaceController.
+ */
+#define TCPInterface_beginConnection_OUT_OF_SPACE -1
+#define TCPInterface_beginConnection_BAD_KEY -2
+#define TCPInterface_beginConnection_BAD_ADDRESS -3
+#define TCPInterface_beginConnection_ADDRESS_MISMATCH -4
+#define TCPInterface_beginConnection_UNKNOWN_ERROR -5
+int TCPInterface_beginConnection(const char* address,
+                                 uint8_t cryptoKey[32],
+                                 String* password,
+                                 struct TCPInterface* tcpif);
+
+#endif
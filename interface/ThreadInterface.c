@@ -0,0 +1,109 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/ThreadInterface.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/Mailbox.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+#include "wire/Error.h"
+#include "wire/Message.h"
+
+/** A message on its way to the other thread, it and its content are in their own allocator. */
+struct Transfer
+{
+    struct Mailbox_Message mbMsg;
+    struct Message* msg;
+    struct Allocator* alloc;
+    Identity
+};
+
+struct ThreadInterface_pvt
+{
+    struct Interface pub;
+
+    /** Receives the messages which the other end sends. */
+    struct Mailbox* mailbox;
+
+    /** The other end, only its mailbox is touched from this thread. */
+    struct ThreadInterface_pvt* peer;
+
+    struct Allocator* alloc;
+
+    Identity
+};
+
+static uint8_t sendMessage(struct Message* msg, struct Interface* iface)
+{
+    struct ThreadInterface_pvt* ti = Identity_cast((struct ThreadInterface_pvt*) iface);
+
+    // Not a child of this thread's allocator so the other thread may free it.
+    struct Allocator* alloc = MallocAllocator_new(msg->length + 1024);
+    struct Transfer* t = Allocator_calloc(alloc, sizeof(struct Transfer), 1);
+    t->msg = Message_new(msg->length, 0, alloc);
+    Bits_memcpy(t->msg->bytes, msg->bytes, msg->length);
+    t->alloc = alloc;
+    Identity_set(t);
+
+    Mailbox_post(ti->peer->mailbox, &t->mbMsg);
+    return Error_NONE;
+}
+
+static void onMessage(struct Mailbox_Message* mbMsg, void* vThreadInterface)
+{
+    struct ThreadInterface_pvt* ti = Identity_cast((struct ThreadInterface_pvt*) vThreadInterface);
+    struct Transfer* t = Identity_cast((struct Transfer*) mbMsg);
+
+    // Copy it again into this thread's allocator, the receiver is free to adopt it.
+    struct Allocator* alloc = Allocator_child(ti->alloc);
+    struct Message* msg = Message_new(t->msg->length, Interface_PADDING, alloc);
+    Bits_memcpy(msg->bytes, t->msg->bytes, t->msg->length);
+    Allocator_free(t->alloc);
+
+    Interface_receiveMessage(&ti->pub, msg);
+    Allocator_free(alloc);
+}
+
+static struct ThreadInterface_pvt* newEnd(struct EventBase* base, struct Allocator* alloc)
+{
+    struct ThreadInterface_pvt* ti = Allocator_clone(alloc, (&(struct ThreadInterface_pvt) {
+        .pub = {
+            .sendMessage = sendMessage,
+            .allocator = alloc,
+            .requiredPadding = 0,
+            .maxMessageLength = UINT16_MAX
+        },
+        .alloc = alloc
+    }));
+    Identity_set(ti);
+    ti->mailbox = Mailbox_new(onMessage, ti, base, alloc);
+    return ti;
+}
+
+/** See: ThreadInterface.h */
+void ThreadInterface_newPair(struct Interface** aOut,
+                             struct EventBase* aBase,
+                             struct Allocator* aAlloc,
+                             struct Interface** bOut,
+                             struct EventBase* bBase,
+                             struct Allocator* bAlloc)
+{
+    struct ThreadInterface_pvt* a = newEnd(aBase, aAlloc);
+    struct ThreadInterface_pvt* b = newEnd(bBase, bAlloc);
+    a->peer = b;
+    b->peer = a;
+    *aOut = &a->pub;
+    *bOut = &b->pub;
+}
@@ -0,0 +1,47 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ThreadInterface_H
+#define ThreadInterface_H
+
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/Linker.h"
+Linker_require("interface/ThreadInterface.c")
+
+/**
+ * Create a pair of interfaces which connect two threads of one process, each running its own
+ * event loop. A message sent on one end is received on the other end on that end's loop.
+ * Each end must only be used from the thread which runs its event base.
+ *
+ * The message is copied into memory of its own while it is passed between the threads, so
+ * neither thread ever touches the other's allocators. Both ends are made at once, before
+ * the second thread starts, after that the allocator and event base of b belong to it.
+ *
+ * @param aOut set to the end which is used with aBase.
+ * @param aBase the event loop which aOut's messages are received on.
+ * @param aAlloc freeing this closes aOut, nothing may be sent to it afterwards.
+ * @param bOut set to the end which is used with bBase.
+ * @param bBase the event loop which bOut's messages are received on.
+ * @param bAlloc freeing this closes bOut, nothing may be sent to it afterwards.
+ */
+void ThreadInterface_newPair(struct Interface** aOut,
+                             struct EventBase* aBase,
+                             struct Allocator* aAlloc,
+                             struct Interface** bOut,
+                             struct EventBase* bBase,
+                             struct Allocator* bAlloc);
+
+#endif
@@ -74,6 +74,17 @@ int UDPInterface_beginConnection(const char* address,
     return 0;
 }
 
+/** Let the interface controller switch what comes in from one recvmmsg() together. */
+static void onBurst(void* vcontext, bool begin)
+{
+    struct UDPInterface_pvt* context = (struct UDPInterface_pvt*) vcontext;
+    if (begin) {
+        InterfaceController_beginBurst(context->ic);
+    } else {
+        InterfaceController_endBurst(context->ic);
+    }
+}
+
 struct UDPInterface* UDPInterface_new(struct EventBase* base,
                                       struct Sockaddr* bindAddr,
                                       struct Allocator* allocator,
@@ -96,6 +107,19 @@ struct UDPInterface* UDPInterface_new(struct EventBase* base,
     }), sizeof(struct UDPInterface_pvt));
 
     context->multiIface = MultiInterface_new(context->pub.addr->addrLen, &udpBase->generic, ic);
+    UDPAddrInterface_setBurstHandler(udpBase, onBurst, context);
 
     return &context->pub;
 }
+
+void UDPInterface_getStats(struct UDPInterface* udpif, struct UDPAddrInterface_Stats* out)
+{
+    struct UDPInterface_pvt* context = (struct UDPInterface_pvt*) udpif;
+    UDPAddrInterface_getStats(context->udpBase, out);
+}
+
+void UDPInterface_setMaxBufferSize(struct UDPInterface* udpif, int32_t maxBytes)
+{
+    struct UDPInterface_pvt* context = (struct UDPInterface_pvt*) udpif;
+    UDPAddrInterface_setMaxBufferSize(context->udpBase, maxBytes);
+}
@@ -16,6 +16,7 @@
 #define UDPInterface_H
 
 #include "interface/Interface.h"
+#include "interface/addressable/UDPAddrInterface.h"
 #include "interface/InterfaceController.h"
 #include "memory/Allocator.h"
 #include "util/events/EventBase.h"
@@ -83,4 +84,10 @@ int UDPInterface_beginConnection(const char* address,
                                  String* password,
                                  struct UDPInterface* udpif);
 
+/** @see UDPAddrInterface_getStats() */
+void UDPInterface_getStats(struct UDPInterface* udpif, struct UDPAddrInterface_Stats* out);
+
+/** @see UDPAddrInterface_setMaxBufferSize() */
+void UDPInterface_setMaxBufferSize(struct UDPInterface* udpif, int32_t maxBytes);
+
 #endif
@@ -12,7 +12,9 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define string_strcmp
 #include "benc/Int.h"
+#include "benc/List.h"
 #include "admin/Admin.h"
 #include "exception/Jmp.h"
 #include "interface/UDPInterface.h"
@@ -21,6 +23,7 @@
 #include "util/events/EventBase.h"
 #include "util/platform/Sockaddr.h"
 #include "crypto/Key.h"
+#include "util/platform/libc/string.h"
 
 struct Context
 {
@@ -34,62 +37,95 @@ struct Context
     struct UDPInterface** ifaces;
 };
 
-static void beginConnection(Dict* args,
-                            void* vcontext,
-                            String* txid,
-                            struct Allocator* requestAlloc)
+/** @return an error string, "none" if the connection was begun. */
+static char* connectPeer(Dict* args, struct Context* ctx)
 {
-    struct Context* ctx = vcontext;
-
     String* password = Dict_getString(args, String_CONST("password"));
     String* publicKey = Dict_getString(args, String_CONST("publicKey"));
     String* address = Dict_getString(args, String_CONST("address"));
     int64_t* interfaceNumber = Dict_getInt(args, String_CONST("interfaceNumber"));
     uint32_t ifNum = (interfaceNumber) ? ((uint32_t) *interfaceNumber) : 0;
-    String* error = NULL;
+
+    if (!publicKey || !address) {
+        return "publicKey and address are required";
+    }
 
     Log_debug(ctx->logger, "Peering with [%s]", publicKey->bytes);
 
     uint8_t pkBytes[32];
     int ret;
     if (ctx->ifCount == 0) {
-        error = String_CONST("no interfaces are setup, call UDPInterface_new() first");
+        return "no interfaces are setup, call UDPInterface_new() first";
 
     } else if (interfaceNumber && (*interfaceNumber >= ctx->ifCount || *interfaceNumber < 0)) {
-        error = String_CONST("invalid interfaceNumber");
+        return "invalid interfaceNumber";
 
     } else if ((ret = Key_parse(publicKey, pkBytes, NULL))) {
-        error = String_CONST(Key_parse_strerror(ret));
-
-    } else {
-        struct UDPInterface* udpif = ctx->ifaces[ifNum];
-        switch (UDPInterface_beginConnection(address->bytes, pkBytes, password, udpif)) {
-            case UDPInterface_beginConnection_OUT_OF_SPACE:
-                error = String_CONST("no more space to register with the switch.");
-                break;
-            case UDPInterface_beginConnection_BAD_KEY:
-                error = String_CONST("invalid cjdns public key.");
-                break;
-            case UDPInterface_beginConnection_BAD_ADDRESS:
-                error = String_CONST("unable to parse ip address and port.");
-                break;
-            case UDPInterface_beginConnection_ADDRESS_MISMATCH:
-                error = String_CONST("different address type than this socket is bound to.");
-                break;
-            case 0:
-                error = String_CONST("none");
-                break;
-            default:
-                error = String_CONST("unknown error");
-        }
+        return Key_parse_strerror(ret);
     }
 
-    Dict out = Dict_CONST(String_CONST("error"), String_OBJ(error), NULL);
+    struct UDPInterface* udpif = ctx->ifaces[ifNum];
+    switch (UDPInterface_beginConnection(address->bytes, pkBytes, password, udpif)) {
+        case UDPInterface_beginConnection_OUT_OF_SPACE:
+            return "no more space to register with the switch.";
+        case UDPInterface_beginConnection_BAD_KEY:
+            return "invalid cjdns public key.";
+        case UDPInterface_beginConnection_BAD_ADDRESS:
+            return "unable to parse ip address and port.";
+        case UDPInterface_beginConnection_ADDRESS_MISMATCH:
+            return "different address type than this socket is bound to.";
+        case 0:
+            return "none";
+        default:
+            return "unknown error";
+    }
+}
+
+static void beginConnection(Dict* args,
+                            void* vcontext,
+                            String* txid,
+                            struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    char* error = connectPeer(args, ctx);
+    Dict out = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(error)), NULL);
     Admin_sendMessage(&out, txid, ctx->admin);
 }
 
+/**
+ * Begin a list of connections in one call, each entry takes the same arguments as
+ * UDPInterface_beginConnection(). It stops at the first which fails and reports its index.
+ */
+static void beginConnections(Dict* args,
+                             void* vcontext,
+                             String* txid,
+                             struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    List* connections = Dict_getList(args, String_CONST("connections"));
+    int32_t count = List_size(connections);
+    char* error = "none";
+    int32_t i;
+    for (i = 0; i < count; i++) {
+        Dict* connection = List_getDict(connections, i);
+        error = (connection) ? connectPeer(connection, ctx) : "entry is not a dictionary";
+        if (strcmp(error, "none")) {
+            break;
+        }
+    }
+
+    Dict* out = Dict_new(requestAlloc);
+    Dict_putString(out, String_CONST("error"), String_new(error, requestAlloc), requestAlloc);
+    String* indexKey = String_CONST("index");
+    if (i < count) {
+        Dict_putInt(out, indexKey, i, requestAlloc);
+    }
+    Admin_sendMessage(out, txid, ctx->admin);
+}
+
 static void newInterface2(struct Context* ctx,
                           struct Sockaddr* addr,
+                          int64_t* maxBufferSize,
                           String* txid,
                           struct Allocator* requestAlloc)
 {
@@ -106,6 +142,10 @@ static void newInterface2(struct Context* ctx,
         return;
     }
 
+    if (maxBufferSize) {
+        UDPInterface_setMaxBufferSize(udpIf, *maxBufferSize);
+    }
+
     // sizeof(struct UDPInterface*) the size of a pointer.
     ctx->ifaces = Allocator_realloc(ctx->allocator,
                                     ctx->ifaces,
@@ -129,6 +169,7 @@ static void newInterface(Dict* args, void* vcontext, String* txid, struct Alloca
 {
     struct Context* ctx = vcontext;
     String* bindAddress = Dict_getString(args, String_CONST("bindAddress"));
+    int64_t* maxBufferSize = Dict_getInt(args, String_CONST("maxBufferSize"));
     struct Sockaddr_storage addr;
     if (Sockaddr_parse((bindAddress) ? bindAddress->bytes : "0.0.0.0", &addr)) {
         Dict out = Dict_CONST(
@@ -137,7 +178,42 @@ static void newInterface(Dict* args, void* vcontext, String* txid, struct Alloca
         Admin_sendMessage(&out, txid, ctx->admin);
         return;
     }
-    newInterface2(ctx, &addr.addr, txid, requestAlloc);
+    if (maxBufferSize && (*maxBufferSize < 0 || *maxBufferSize > INT32_MAX)) {
+        Dict out = Dict_CONST(
+            String_CONST("error"), String_OBJ(String_CONST("Invalid maxBufferSize")), NULL
+        );
+        Admin_sendMessage(&out, txid, ctx->admin);
+        return;
+    }
+    newInterface2(ctx, &addr.addr, maxBufferSize, txid, requestAlloc);
+}
+
+static void getStats(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    int64_t* interfaceNumber = Dict_getInt(args, String_CONST("interfaceNumber"));
+    uint32_t ifNum = (interfaceNumber) ? ((uint32_t) *interfaceNumber) : 0;
+    if (ifNum >= ctx->ifCount || (interfaceNumber && *interfaceNumber < 0)) {
+        Dict out = Dict_CONST(
+            String_CONST("error"), String_OBJ(String_CONST("invalid interfaceNumber")), NULL
+        );
+        Admin_sendMessage(&out, txid, ctx->admin);
+        return;
+    }
+
+    struct UDPAddrInterface_Stats stats;
+    UDPInterface_getStats(ctx->ifaces[ifNum], &stats);
+
+    Dict out = Dict_CONST(
+        String_CONST("error"), String_OBJ(String_CONST("none")), Dict_CONST(
+        String_CONST("recvBufferGrowths"), Int_OBJ(stats.recvBufferGrowths), Dict_CONST(
+        String_CONST("recvBufferSize"), Int_OBJ(stats.recvBufferSize), Dict_CONST(
+        String_CONST("recvDrops"), Int_OBJ(stats.recvDrops), Dict_CONST(
+        String_CONST("sendBufferGrowths"), Int_OBJ(stats.sendBufferGrowths), Dict_CONST(
+        String_CONST("sendBufferSize"), Int_OBJ(stats.sendBufferSize), Dict_CONST(
+        String_CONST("sendDrops"), Int_OBJ(stats.sendDrops), NULL
+    )))))));
+    Admin_sendMessage(&out, txid, ctx->admin);
 }
 
 void UDPInterface_admin_register(struct EventBase* base,
@@ -154,8 +230,9 @@ void UDPInterface_admin_register(struct EventBase* base,
         .ic = ic
     }));
 
-    struct Admin_FunctionArg adma[1] = {
-        { .name = "bindAddress", .required = 0, .type = "String" }
+    struct Admin_FunctionArg adma[2] = {
+        { .name = "bindAddress", .required = 0, .type = "String" },
+        { .name = "maxBufferSize", .required = 0, .type = "Int" }
     };
     Admin_registerFunction("UDPInterface_new", newInterface, ctx, true, adma, admin);
 
@@ -167,4 +244,15 @@ void UDPInterface_admin_register(struct EventBase* base,
     };
     Admin_registerFunction("UDPInterface_beginConnection",
         beginConnection, ctx, true, adma2, admin);
+
+    struct Admin_FunctionArg adma3[1] = {
+        { .name = "connections", .required = 1, .type = "List" }
+    };
+    Admin_registerFunction("UDPInterface_beginConnections",
+        beginConnections, ctx, true, adma3, admin);
+
+    struct Admin_FunctionArg adma4[1] = {
+        { .name = "interfaceNumber", .required = 0, .type = "Int" }
+    };
+    Admin_registerFunction("UDPInterface_getStats", getStats, ctx, true, adma4, admin);
 }
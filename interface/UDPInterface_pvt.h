@@ -28,7 +28,7 @@
 
 #define UDPInterface_MAX_PACKET_SIZE 8192
 
-#define UDPInterface_PADDING 512
+#define UDPInterface_PADDING Interface_PADDING
 
 
 struct UDPInterface_pvt
@@ -0,0 +1,55 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TCPAddrInterface_H
+#define TCPAddrInterface_H
+
+#include "exception/Except.h"
+#include "interface/Interface.h"
+#include "interface/addressable/AddrInterface.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/log/Log.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/TCPAddrInterface.c")
+
+#define TCPAddrInterface_PADDING_AMOUNT Interface_PADDING
+
+/** Size of each read from a connection, one read may hold many frames. */
+#define TCPAddrInterface_BUFFER_CAP 16384
+
+/** Largest frame which will be accepted from a peer. */
+#define TCPAddrInterface_MAX_FRAME 8192
+
+/** Maximum number of bytes to hold in queue for one connection before dropping packets. */
+#define TCPAddrInterface_MAX_QUEUE 65536
+
+/**
+ * An AddrInterface over TCP, it listens on bindAddr and each message is framed with a length
+ * header on the stream to its peer. Sending to an address with no connection opens one, the
+ * messages sent to a connection in one event loop cycle are written with a single uv_write().
+ *
+ * @param base the event loop context.
+ * @param bindAddr the address/port to listen on.
+ * @param allocator the memory allocator for this interface.
+ * @param exHandler the handler to deal with whatever exception arises.
+ * @param logger
+ * @return a new TCPAddrInterface.
+ */
+struct AddrInterface* TCPAddrInterface_new(struct EventBase* base,
+                                           struct Sockaddr* bindAddr,
+                                           struct Allocator* allocator,
+                                           struct Except* exHandler,
+                                           struct Log* logger);
+#endif
@@ -25,12 +25,35 @@
 // TODO: Move this into util/events
 Linker_require("util/events/libuv/UDPAddrInterface.c")
 
-#define UDPAddrInterface_PADDING_AMOUNT 512
+#include <stdint.h>
+#include <stdbool.h>
+
+#define UDPAddrInterface_PADDING_AMOUNT Interface_PADDING
 #define UDPAddrInterface_BUFFER_CAP 3496
 
 /** Maximum number of bytes to hold in queue before dropping packets. */
 #define UDPAddrInterface_MAX_QUEUE 16384
 
+/** Default limit on how big the socket buffers are grown when packets are dropped. */
+#define UDPAddrInterface_MAX_BUFFER_SIZE (4<<20)
+
+struct UDPAddrInterface_Stats
+{
+    /** Datagrams which the kernel dropped because the receive buffer was full. */
+    uint64_t recvDrops;
+
+    /** Datagrams which were dropped because the send buffer was full. */
+    uint64_t sendDrops;
+
+    /** Size of the socket buffers as the kernel reports them, zero if not known. */
+    int32_t recvBufferSize;
+    int32_t sendBufferSize;
+
+    /** Number of times each buffer was grown because of drops. */
+    uint32_t recvBufferGrowths;
+    uint32_t sendBufferGrowths;
+};
+
 /**
  * @param base the event loop context.
  * @param bindAddr the address/port to bind to.
@@ -44,4 +67,28 @@ struct AddrInterface* UDPAddrInterface_new(struct EventBase* base,
                                            struct Allocator* allocator,
                                            struct Except* exHandler,
                                            struct Log* logger);
+
+/** Get the drop counters and buffer sizes of an interface made by UDPAddrInterface_new(). */
+void UDPAddrInterface_getStats(struct AddrInterface* iface, struct UDPAddrInterface_Stats* out);
+
+/**
+ * Set how big the socket buffers may be grown when the kernel drops packets for want of space,
+ * the default is UDPAddrInterface_MAX_BUFFER_SIZE. This is the size asked of SO_RCVBUF and
+ * SO_SNDBUF, Linux reports twice that. The kernel may hold them to a lower limit
+ * (net.core.rmem_max and wmem_max) unless the process has CAP_NET_ADMIN.
+ */
+void UDPAddrInterface_setMaxBufferSize(struct AddrInterface* iface, int32_t maxBytes);
+
+/**
+ * Called before the first and after the last message of each burst which one recvmmsg() brings
+ * in, the messages may be held until the burst is over. A burst is only ever made on Linux,
+ * elsewhere each datagram comes in by itself and the handler is never called.
+ *
+ * @param context the context which was given to UDPAddrInterface_setBurstHandler().
+ * @param begin true before the first message, false after the last.
+ */
+typedef void (* UDPAddrInterface_BurstHandler)(void* context, bool begin);
+void UDPAddrInterface_setBurstHandler(struct AddrInterface* iface,
+                                      UDPAddrInterface_BurstHandler handler,
+                                      void* context);
 #endif
@@ -0,0 +1,151 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/Coalescer.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "wire/Error.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+struct Context
+{
+    /** The link between the two ends. */
+    struct Interface linkA;
+    struct Interface linkB;
+
+    struct EventBase* base;
+
+    /** Packets which went over the link. */
+    int linkPackets;
+    uint32_t lastLinkType;
+
+    /** What came out of the far end, the first byte and the length of each packet. */
+    uint8_t firstBytes[64];
+    int lengths[64];
+    int count;
+};
+
+static uint8_t sendOverLink(struct Message* msg, struct Interface* iface)
+{
+    struct Context* ctx = iface->senderContext;
+    ctx->linkPackets++;
+    Assert_always(msg->length >= Headers_SwitchHeader_SIZE);
+    ctx->lastLinkType = Headers_getMessageType((struct Headers_SwitchHeader*) msg->bytes);
+    return Interface_receiveMessage(&ctx->linkB, msg);
+}
+
+static uint8_t receiveAtB(struct Message* msg, struct Interface* iface)
+{
+    struct Context* ctx = iface->receiverContext;
+    Assert_always(ctx->count < 64);
+    for (int i = 1; i < msg->length; i++) {
+        Assert_always(msg->bytes[i] == (uint8_t) (msg->bytes[0] + i));
+    }
+    ctx->firstBytes[ctx->count] = msg->bytes[0];
+    ctx->lengths[ctx->count] = msg->length;
+    ctx->count++;
+    return Error_NONE;
+}
+
+/** A switch packet with a nonzero label whose bytes count up from first. */
+static void send(uint8_t first, int length, struct Interface* iface, struct Allocator* alloc)
+{
+    struct Message* msg = Message_new(length, 512, alloc);
+    for (int i = 0; i < length; i++) {
+        msg->bytes[i] = first + i;
+    }
+    Interface_sendMessage(iface, msg);
+}
+
+static void endLoop(void* vcontext)
+{
+    struct Context* ctx = vcontext;
+    EventBase_endLoop(ctx->base);
+}
+
+static void runLoop(struct Context* ctx, struct Allocator* alloc)
+{
+    Timeout_setTimeout(endLoop, ctx, 10, ctx->base, alloc);
+    EventBase_beginLoop(ctx->base);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    ctx->base = EventBase_new(alloc);
+    Bits_memcpyConst(&ctx->linkA, (&(struct Interface) {
+        .sendMessage = sendOverLink,
+        .senderContext = ctx,
+        .allocator = alloc
+    }), sizeof(struct Interface));
+    Bits_memcpyConst(&ctx->linkB, (&(struct Interface) {
+        .allocator = alloc
+    }), sizeof(struct Interface));
+
+    struct Coalescer* a = Coalescer_new(&ctx->linkA, ctx->base, alloc);
+    struct Coalescer* b = Coalescer_new(&ctx->linkB, ctx->base, alloc);
+    b->generic.receiveMessage = receiveAtB;
+    b->generic.receiverContext = ctx;
+
+    // Switched off, every packet goes as it comes.
+    send(1, 20, &a->generic, alloc);
+    Assert_always(ctx->linkPackets == 1 && ctx->count == 1);
+
+    // Small packets wait for the end of the loop turn and go in one bundle.
+    a->enabled = true;
+    ctx->linkPackets = ctx->count = 0;
+    send(10, 20, &a->generic, alloc);
+    send(20, 33, &a->generic, alloc);
+    send(30, 1, &a->generic, alloc);
+    Assert_always(ctx->linkPackets == 0);
+    runLoop(ctx, alloc);
+    Assert_always(ctx->linkPackets == 1 && ctx->lastLinkType == Headers_SwitchHeader_TYPE_BUNDLE);
+    Assert_always(ctx->count == 3 && a->bundlesOut == 1 && b->bundlesIn == 1);
+    Assert_always(ctx->firstBytes[0] == 10 && ctx->lengths[0] == 20);
+    Assert_always(ctx->firstBytes[1] == 20 && ctx->lengths[1] == 33);
+    Assert_always(ctx->firstBytes[2] == 30 && ctx->lengths[2] == 1);
+
+    // A big packet sends what is held first so the order is kept.
+    ctx->linkPackets = ctx->count = 0;
+    send(40, 20, &a->generic, alloc);
+    send(50, 20, &a->generic, alloc);
+    send(60, Coalescer_MAX_PACKET + 1, &a->generic, alloc);
+    Assert_always(ctx->linkPackets == 2 && ctx->count == 3);
+    Assert_always(ctx->firstBytes[0] == 40 && ctx->firstBytes[1] == 50);
+    Assert_always(ctx->firstBytes[2] == 60 && ctx->lengths[2] == Coalescer_MAX_PACKET + 1);
+
+    // A packet with nothing to share a bundle with goes as it was.
+    ctx->linkPackets = ctx->count = 0;
+    send(70, 20, &a->generic, alloc);
+    runLoop(ctx, alloc);
+    Assert_always(ctx->linkPackets == 1 && ctx->count == 1 && a->bundlesOut == 2);
+
+    // A bundle never grows past the limit.
+    ctx->linkPackets = ctx->count = 0;
+    for (int i = 0; i < 10; i++) {
+        send(i, Coalescer_MAX_PACKET, &a->generic, alloc);
+    }
+    runLoop(ctx, alloc);
+    Assert_always(ctx->count == 10 && ctx->linkPackets == 3);
+    Assert_always(a->packetsCoalesced == 15 && !a->dropped);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,134 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/DNSServer.h"
+#include "interface/addressable/AddrInterface.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/CString.h"
+#include "util/events/EventBase.h"
+#include "util/log/WriterLog.h"
+#include "io/FileWriter.h"
+#include "wire/Error.h"
+#include "wire/Message.h"
+
+#define KEY "kmzm4w0kj9bswd5qmx74nu7kusv5pj40vcsmp781j6xxgpd59z00"
+
+static uint8_t response[512];
+static int responseLength;
+static int addrLength;
+
+static uint8_t captureResponse(struct Message* msg, struct Interface* iface)
+{
+    Assert_always(msg->length - addrLength <= (int)sizeof(response));
+    responseLength = msg->length - addrLength;
+    Bits_memcpy(response, &msg->bytes[addrLength], responseLength);
+    return Error_NONE;
+}
+
+/** Ask a question with one name label before the tld and return the response code. */
+static int query(struct AddrInterface* iface,
+                 uint16_t id,
+                 const char* label,
+                 const char* tld,
+                 uint16_t type,
+                 struct Allocator* alloc)
+{
+    uint8_t buff[300] = { id >> 8, id, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0 };
+    int length = 12;
+    const char* labels[2] = { label, tld };
+    for (int i = 0; i < 2; i++) {
+        buff[length++] = CString_strlen(labels[i]);
+        Bits_memcpy(&buff[length], labels[i], CString_strlen(labels[i]));
+        length += CString_strlen(labels[i]);
+    }
+    uint8_t tail[5] = { 0, type >> 8, type, 0, 1 };
+    Bits_memcpyConst(&buff[length], tail, 5);
+    length += 5;
+
+    struct Message* msg = Message_new(length + addrLength, 512, alloc);
+    Bits_memcpy(msg->bytes, iface->addr, addrLength);
+    Bits_memcpy(&msg->bytes[addrLength], buff, length);
+    responseLength = 0;
+    iface->generic.receiveMessage(msg, &iface->generic);
+    Assert_always(responseLength >= 12);
+    Assert_always(response[0] == (uint8_t)(id >> 8) && response[1] == (uint8_t)id);
+    return response[3] & 0x0f;
+}
+
+/** Ask the same question twice, the second answer comes from the cache and must be the same. */
+static void same(struct AddrInterface* iface,
+                 const char* label,
+                 const char* tld,
+                 uint16_t type,
+                 int expectedCode,
+                 int expectedAnswers,
+                 struct Allocator* alloc)
+{
+    Assert_always(query(iface, 1, label, tld, type, alloc) == expectedCode);
+    Assert_always(((response[6] << 8) | response[7]) == expectedAnswers);
+    uint8_t first[512];
+    int firstLength = responseLength;
+    Bits_memcpy(first, response, responseLength);
+
+    Assert_always(query(iface, 2, label, tld, type, alloc) == expectedCode);
+    Assert_always(responseLength == firstLength);
+    Assert_always(!Bits_memcmp(&first[2], &response[2], firstLength - 2));
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct EventBase* base = EventBase_new(alloc);
+    struct Log* logger = WriterLog_new(FileWriter_new(stdout, alloc), alloc);
+
+    struct Sockaddr_storage ss;
+    Assert_always(!Sockaddr_parse("[fc00::1]:53", &ss));
+    struct AddrInterface* iface = Allocator_clone(alloc, (&(struct AddrInterface) {
+        .generic = {
+            .sendMessage = captureResponse,
+            .allocator = alloc
+        },
+        .addr = Sockaddr_clone(&ss.addr, alloc)
+    }));
+    addrLength = iface->addr->addrLen;
+
+    DNSServer_new(iface, base, logger, NULL);
+
+    same(iface, KEY, "k", 28, 0, 1, alloc);
+    // The answer has the question's name, the longest TTL and the address.
+    int nameLength = 1 + 52 + 3;
+    int answerAt = 12 + nameLength + 4;
+    Assert_always(responseLength == answerAt + nameLength + 4 + 6 + 16);
+    uint8_t header[12] = { 0, 2, 0x80, 0, 0, 1, 0, 1, 0, 0, 0, 0 };
+    Assert_always(!Bits_memcmp(response, header, 12));
+    Assert_always(!Bits_memcmp(&response[12], &response[answerAt], nameLength + 4));
+    uint8_t ttlAndLength[6] = { 0xff, 0xff, 0xff, 0xff, 0, 16 };
+    Assert_always(!Bits_memcmp(&response[answerAt + nameLength + 4], ttlAndLength, 6));
+    Assert_always(response[responseLength - 16] == 0xfc);
+
+    // Names are case insensitive so this is the same entry.
+    char upper[] = KEY;
+    upper[0] = 'K';
+    Assert_always(query(iface, 3, upper, "K", 28, alloc) == 0);
+    Assert_always(response[responseLength - 16] == 0xfc);
+
+    // No TXT record and no such key are negative answers which are kept too.
+    same(iface, KEY, "k", 16, 0, 0, alloc);
+    same(iface, "notavalidkey", "k", 28, 3, 0, alloc);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,185 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/FairQueue.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
+#include "util/events/EventBase.h"
+#include "util/events/Time.h"
+#include "wire/Error.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+#include <stdbool.h>
+
+#define CONTROL_HANDLE 0xffff
+
+/** The nonce of a CryptoAuth hello packet, it is where the handle is in a data packet. */
+#define HELLO_NONCE 0
+
+struct Context
+{
+    struct EventBase* base;
+    bool full;
+    int count;
+    int expected;
+    int congested;
+    uint32_t order[512];
+    uint32_t tags[512];
+};
+
+static uint8_t sendExternal(struct Message* message, struct Interface* iface)
+{
+    struct Context* ctx = iface->senderContext;
+    if (ctx->full) {
+        return Error_LINK_LIMIT_EXCEEDED;
+    }
+    uint32_t handle_be;
+    Bits_memcpyConst(&handle_be, &message->bytes[Headers_SwitchHeader_SIZE], 4);
+    if (Headers_isCongested((struct Headers_SwitchHeader*) message->bytes)) {
+        ctx->congested++;
+    }
+    Assert_always(ctx->count < 512);
+    ctx->tags[ctx->count] = Headers_getFlowTag((struct Headers_SwitchHeader*) message->bytes);
+    ctx->order[ctx->count++] = Endian_bigEndianToHost32(handle_be);
+    if (ctx->count == ctx->expected) {
+        EventBase_endLoop(ctx->base);
+    }
+    return Error_NONE;
+}
+
+static uint8_t sendTagged(uint64_t label,
+                          uint32_t handle,
+                          uint32_t tag,
+                          uint32_t length,
+                          struct FairQueue* fq,
+                          struct Allocator* alloc)
+{
+    struct Message* message = Message_new(length, 512, alloc);
+    Bits_memset(message->bytes, 0, length);
+    struct Headers_SwitchHeader* header = (struct Headers_SwitchHeader*) message->bytes;
+    header->label_be = Endian_hostToBigEndian64(label);
+    Headers_setPriorityAndMessageType(header, 0, (handle == CONTROL_HANDLE)
+        ? Headers_SwitchHeader_TYPE_CONTROL : Headers_SwitchHeader_TYPE_DATA);
+    Headers_setFlowTag(header, tag);
+    uint32_t handle_be = Endian_hostToBigEndian32(handle);
+    Bits_memcpyConst(&message->bytes[Headers_SwitchHeader_SIZE], &handle_be, 4);
+    return Interface_sendMessage(&fq->iface, message);
+}
+
+static uint8_t send(uint64_t label,
+                    uint32_t handle,
+                    uint32_t length,
+                    struct FairQueue* fq,
+                    struct Allocator* alloc)
+{
+    return sendTagged(label, handle, 0, length, fq, alloc);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Context ctx = { .base = EventBase_new(alloc) };
+    struct Interface external = {
+        .sendMessage = sendExternal,
+        .senderContext = &ctx
+    };
+    struct FairQueue* fq = FairQueue_new(&external, ctx.base, alloc);
+
+    // Nothing is queued while the link takes everything.
+    Assert_always(!send(0x13, 15, 100, fq, alloc));
+    Assert_always(ctx.count == 1 && ctx.order[0] == 15 && !fq->queued);
+
+    // The packet which finds the link full is lost, the ones after it wait.
+    ctx.full = true;
+    Assert_always(send(0x13, 15, 100, fq, alloc) == Error_LINK_LIMIT_EXCEEDED);
+    for (int i = 0; i < 8; i++) {
+        Assert_always(!send(0x13, 11, 1000, fq, alloc));
+    }
+    Assert_always(!send(0x15, 12, 100, fq, alloc));
+    Assert_always(!send(0x17, CONTROL_HANDLE, 100, fq, alloc));
+    Assert_always(!send(0x19, HELLO_NONCE, 100, fq, alloc));
+    Assert_always(fq->queued == 11);
+
+    ctx.full = false;
+    ctx.count = 0;
+    ctx.expected = 11;
+    EventBase_beginLoop(ctx.base);
+
+    // Control and handshakes go first then the bulk flow has one quantum before the sparse
+    // flow's turn.
+    Assert_always(ctx.order[0] == CONTROL_HANDLE);
+    Assert_always(ctx.order[1] == HELLO_NONCE);
+    Assert_always(ctx.order[2] == 11 && ctx.order[3] == 11);
+    Assert_always(ctx.order[4] == 12);
+    for (int i = 5; i < 11; i++) {
+        Assert_always(ctx.order[i] == 11);
+    }
+    Assert_always(!fq->queued && !fq->drops);
+
+    // When the queue overflows it is the bulk flow which loses packets, not the priority one.
+    ctx.full = true;
+    Assert_always(send(0x13, 11, 100, fq, alloc) == Error_LINK_LIMIT_EXCEEDED);
+    Assert_always(!send(0x17, CONTROL_HANDLE, 100, fq, alloc));
+    for (int i = 0; i < FairQueue_MAX_PACKETS; i++) {
+        Assert_always(!send(0x13, 11, 100, fq, alloc));
+    }
+    Assert_always(fq->queued == FairQueue_MAX_PACKETS && fq->drops == 1);
+
+    ctx.full = false;
+    ctx.count = 0;
+    ctx.expected = FairQueue_MAX_PACKETS;
+    EventBase_beginLoop(ctx.base);
+    Assert_always(ctx.order[0] == CONTROL_HANDLE);
+    Assert_always(!fq->queued);
+    Assert_always(!ctx.congested && !fq->marks);
+
+    // Data packets which wait beyond the target are flagged rather than dropped at first,
+    // control packets never are.
+    ctx.full = true;
+    Assert_always(send(0x13, 11, 100, fq, alloc) == Error_LINK_LIMIT_EXCEEDED);
+    Assert_always(!send(0x17, CONTROL_HANDLE, 100, fq, alloc));
+    for (int i = 0; i < 4; i++) {
+        Assert_always(!send(0x13, 11, 100, fq, alloc));
+    }
+    // Retries while the link is full would lose packets so the wait happens before the loop.
+    ctx.full = false;
+    uint64_t until = Time_hrtime() + FairQueue_TARGET_MILLISECONDS * 2 * 1000000ull;
+    while (Time_hrtime() < until);
+    ctx.count = 0;
+    ctx.expected = 5;
+    uint64_t drops = fq->drops;
+    EventBase_beginLoop(ctx.base);
+    Assert_always(ctx.congested == 4 && fq->marks == 4);
+    Assert_always(fq->drops == drops);
+
+    // The flows inside one session are told apart by the tag which their sender gave them.
+    ctx.full = true;
+    Assert_always(sendTagged(0x13, 11, 1, 100, fq, alloc) == Error_LINK_LIMIT_EXCEEDED);
+    for (int i = 0; i < 8; i++) {
+        Assert_always(!sendTagged(0x13, 11, 1, 1000, fq, alloc));
+    }
+    Assert_always(!sendTagged(0x13, 11, 2, 100, fq, alloc));
+    ctx.full = false;
+    ctx.count = 0;
+    ctx.expected = 9;
+    EventBase_beginLoop(ctx.base);
+    Assert_always(ctx.tags[0] == 1 && ctx.tags[1] == 1 && ctx.tags[2] == 2);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -103,6 +103,27 @@ int main()
     Assert_always(output && output->length == (int)strlen(text));
     Assert_always(!Bits_memcmp(output->bytes, text, strlen(text)));
 
+    Allocator_free(child);
+    child = Allocator_child(alloc);
+    output = &(struct Message) { .alloc = child };
+
+    // Length and message split across three parts.
+    for (int i = 0; i < 3; i++) {
+        Message_STACK(msg, 0, 8);
+        if (i == 0) {
+            Message_push(msg, text, 4, NULL);
+            Message_push(msg, ml.bytes, 4, NULL);
+        } else {
+            Message_push(msg, &text[4 * i], 4, NULL);
+        }
+        Assert_always(i == 0 || output->length == 0);
+        send(&dummy, msg, alloc);
+    }
+
+    Assert_always(output && output->length == (int)strlen(text));
+    Assert_always(!Bits_memcmp(output->bytes, text, strlen(text)));
+    Allocator_free(child);
+
     Allocator_free(alloc);
 
     return 0;
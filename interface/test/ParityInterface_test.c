@@ -0,0 +1,185 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/ParityInterface.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
+#include "wire/Error.h"
+#include "wire/Message.h"
+
+#include <stdbool.h>
+
+struct Context
+{
+    /** The link between the two ends. */
+    struct Interface linkA;
+    struct Interface linkB;
+
+    /** Nonce of the packet which the link loses, 0 for none. */
+    uint32_t drop[2];
+
+    /** What came out of the far end. */
+    uint32_t nonces[64];
+    uint32_t lengths[64];
+    uint8_t bytes[64][64];
+    int count;
+};
+
+static uint8_t sendOverLink(struct Message* msg, struct Interface* iface)
+{
+    struct Context* ctx = iface->senderContext;
+    uint32_t nonce = Endian_bigEndianToHost32(((uint32_t*) msg->bytes)[0]);
+    if (nonce == ctx->drop[0] || nonce == ctx->drop[1]) {
+        return Error_NONE;
+    }
+    return Interface_receiveMessage(&ctx->linkB, msg);
+}
+
+/** Loss reports from b go back to a over a link which loses nothing. */
+static uint8_t sendBack(struct Message* msg, struct Interface* iface)
+{
+    struct Context* ctx = iface->senderContext;
+    return Interface_receiveMessage(&ctx->linkA, msg);
+}
+
+static uint8_t receiveAtB(struct Message* msg, struct Interface* iface)
+{
+    struct Context* ctx = iface->receiverContext;
+    Assert_always(ctx->count < 64 && msg->length <= 68);
+    ctx->nonces[ctx->count] = Endian_bigEndianToHost32(((uint32_t*) msg->bytes)[0]);
+    ctx->lengths[ctx->count] = msg->length - 4;
+    Bits_memcpy(ctx->bytes[ctx->count], &msg->bytes[4], msg->length - 4);
+    ctx->count++;
+    return Error_NONE;
+}
+
+/** A packet whose content and length follow from its nonce. */
+static void send(uint32_t nonce, struct Interface* iface, struct Allocator* alloc)
+{
+    struct Allocator* child = Allocator_child(alloc);
+    uint32_t length = 16 + nonce % 7 * 5;
+    struct Message* msg = Message_new(length + 4, 512, child);
+    ((uint32_t*) msg->bytes)[0] = Endian_hostToBigEndian32(nonce);
+    for (uint32_t i = 0; i < length; i++) {
+        msg->bytes[4 + i] = nonce * 31 + i;
+    }
+    Interface_sendMessage(iface, msg);
+    Allocator_free(child);
+}
+
+static void checkReceived(struct Context* ctx, int index, uint32_t nonce)
+{
+    Assert_always(ctx->nonces[index] == nonce);
+    Assert_always(ctx->lengths[index] == 16 + nonce % 7 * 5);
+    for (uint32_t i = 0; i < ctx->lengths[index]; i++) {
+        Assert_always(ctx->bytes[index][i] == (uint8_t) (nonce * 31 + i));
+    }
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    Bits_memcpyConst(&ctx->linkA, (&(struct Interface) {
+        .sendMessage = sendOverLink,
+        .senderContext = ctx,
+        .allocator = alloc
+    }), sizeof(struct Interface));
+    Bits_memcpyConst(&ctx->linkB, (&(struct Interface) {
+        .sendMessage = sendBack,
+        .senderContext = ctx,
+        .allocator = alloc
+    }), sizeof(struct Interface));
+
+    struct ParityInterface* a = ParityInterface_new(&ctx->linkA, alloc);
+    struct ParityInterface* b = ParityInterface_new(&ctx->linkB, alloc);
+    b->generic.receiveMessage = receiveAtB;
+    b->generic.receiverContext = ctx;
+    a->enabled = true;
+    a->groupSize = 4;
+
+    // Handshakes are not in any group, the first parity only tells b to keep packets.
+    send(1, &a->generic, alloc);
+    for (uint32_t nonce = 4; nonce < 8; nonce++) {
+        send(nonce, &a->generic, alloc);
+    }
+    Assert_always(ctx->count == 5 && a->parityOut == 1 && b->parityIn == 1 && !b->recovered);
+
+    // One lost packet of a group is rebuilt when the parity comes.
+    ctx->count = 0;
+    ctx->drop[0] = 9;
+    for (uint32_t nonce = 8; nonce < 12; nonce++) {
+        send(nonce, &a->generic, alloc);
+    }
+    Assert_always(ctx->count == 4 && b->recovered == 1);
+    checkReceived(ctx, 0, 8);
+    checkReceived(ctx, 1, 10);
+    checkReceived(ctx, 2, 11);
+    checkReceived(ctx, 3, 9);
+
+    // Two lost packets cannot be.
+    ctx->count = 0;
+    ctx->drop[0] = 12;
+    ctx->drop[1] = 13;
+    for (uint32_t nonce = 12; nonce < 16; nonce++) {
+        send(nonce, &a->generic, alloc);
+    }
+    Assert_always(ctx->count == 2 && b->recovered == 1 && b->parityIn == 3);
+
+    // Once more than a window of packets went through, the slot of a lost one holds an old one.
+    ctx->drop[0] = ctx->drop[1] = 0;
+    ctx->count = 0;
+    for (uint32_t nonce = 16; nonce < 48; nonce++) {
+        send(nonce, &a->generic, alloc);
+    }
+    Assert_always(ctx->count == 32 && b->recovered == 1);
+    ctx->count = 0;
+    ctx->drop[0] = 49;
+    for (uint32_t nonce = 48; nonce < 52; nonce++) {
+        send(nonce, &a->generic, alloc);
+    }
+    Assert_always(ctx->count == 4 && b->recovered == 2);
+    checkReceived(ctx, 3, 49);
+
+    // Without parity a lossless link costs nothing more.
+    ctx->drop[0] = 0;
+    a->enabled = false;
+    ctx->count = 0;
+    send(52, &a->generic, alloc);
+    Assert_always(ctx->count == 1 && a->parityOut == 12);
+
+    // b measures losing one packet in fifty, along with the ones lost above, and a adapts.
+    uint32_t nonce = 53;
+    for (; b->lossPerMille == 0; nonce++) {
+        ctx->count = 0;
+        if (nonce % 50) {
+            send(nonce, &a->generic, alloc);
+        }
+    }
+    Assert_always(b->lossPerMille >= 20 && b->lossPerMille <= 25);
+    Assert_always(a->groupSize == 100 / b->lossPerMille && !b->groupSize);
+
+    // When the loss goes away, so does the parity.
+    for (; b->lossPerMille; nonce++) {
+        ctx->count = 0;
+        send(nonce, &a->generic, alloc);
+    }
+    Assert_always(!a->groupSize);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,224 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/RainflyClient.h"
+#include "interface/addressable/AddrInterface.h"
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/CString.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/log/WriterLog.h"
+#include "io/FileWriter.h"
+#include "wire/Error.h"
+#include "wire/Message.h"
+
+#include <crypto_sign_ed25519.h>
+#include <stdbool.h>
+
+#define SERVERS 3
+
+static struct Sockaddr_storage servers[SERVERS];
+static int asked[8];
+static int askedCount;
+static uint32_t cookie;
+static int replies;
+
+static uint8_t captureRequest(struct Message* msg, struct Interface* iface)
+{
+    struct Sockaddr* to = (struct Sockaddr*) msg->bytes;
+    uint8_t op = msg->bytes[to->addrLen];
+    if (op != 0x02) {
+        return Error_NONE;
+    }
+    for (int i = 0; i < SERVERS; i++) {
+        if (!Bits_memcmp(to, &servers[i], to->addrLen)) {
+            Assert_always(askedCount < 8);
+            asked[askedCount++] = i;
+        }
+    }
+    uint8_t* c = &msg->bytes[to->addrLen + 1];
+    cookie = (c[0] << 16) | (c[1] << 8) | c[2];
+    return Error_NONE;
+}
+
+static void onReply(struct RainflyClient_Lookup* promise,
+                    Dict* value,
+                    enum RainflyClient_ResponseCode code)
+{
+    Assert_always(code == RainflyClient_ResponseCode_NO_ERROR);
+    Assert_always(value);
+    replies++;
+}
+
+static void receive(struct AddrInterface* iface,
+                    int server,
+                    uint8_t* content,
+                    int length,
+                    struct Allocator* alloc)
+{
+    int addrLen = iface->addr->addrLen;
+    struct Message* msg = Message_new(addrLen + length, 512, alloc);
+    Bits_memcpy(msg->bytes, &servers[server], addrLen);
+    Bits_memcpy(&msg->bytes[addrLen], content, length);
+    iface->generic.receiveMessage(msg, &iface->generic);
+}
+
+static void giveHotKey(struct AddrInterface* iface,
+                       uint8_t* secretKey,
+                       uint8_t* hotKey,
+                       struct Allocator* alloc)
+{
+    uint8_t content[7 + 96] = { 0x81, 1, 0, 0, 0, 0, 0, 1 };
+    unsigned long long length;
+    crypto_sign_ed25519(&content[8], &length, hotKey, 32, secretKey);
+    Assert_always(length == 96);
+    receive(iface, 0, content, 8 + 96, alloc);
+}
+
+static void answerWith(struct AddrInterface* iface,
+                       int server,
+                       uint8_t* hotSecretKey,
+                       const char* value,
+                       bool corrupt,
+                       struct Allocator* alloc)
+{
+    const char* names[3] = { "h/test", "h/zzzz", value };
+    uint8_t signedPart[64] = { 0, 0, 0, 1 };
+    int length = 4;
+    for (int i = 0; i < 3; i++) {
+        signedPart[length++] = CString_strlen(names[i]);
+        Bits_memcpy(&signedPart[length], names[i], CString_strlen(names[i]));
+        length += CString_strlen(names[i]);
+    }
+    while ((length - 4) % 8) {
+        signedPart[length++] = 0;
+    }
+
+    uint8_t signature[64 + sizeof(signedPart)];
+    unsigned long long sigLength;
+    crypto_sign_ed25519(signature, &sigLength, signedPart, length, hotSecretKey);
+
+    uint8_t content[4 + sizeof(signedPart) + 64] = { 0x82, cookie >> 16, cookie >> 8, cookie };
+    Bits_memcpy(&content[4], signedPart, length);
+    Bits_memcpy(&content[4 + length], signature, 64);
+    if (corrupt) {
+        content[4 + length] ^= 1;
+    }
+    receive(iface, server, content, 4 + length + 64, alloc);
+}
+
+static void answer(struct AddrInterface* iface,
+                   int server,
+                   uint8_t* hotSecretKey,
+                   struct Allocator* alloc)
+{
+    answerWith(iface, server, hotSecretKey, "{\"k\":\"v\"}", false, alloc);
+}
+
+static void lookup(struct RainflyClient* client, int parallel)
+{
+    client->parallelRequests = parallel;
+    askedCount = 0;
+    struct RainflyClient_Lookup* l = RainflyClient_lookup(client, String_CONST("test"));
+    Assert_always(l);
+    l->onReply = onReply;
+    Assert_always(askedCount == parallel);
+    for (int i = 0; i < askedCount; i++) {
+        for (int j = 0; j < i; j++) {
+            Assert_always(asked[i] != asked[j]);
+        }
+    }
+}
+
+static void stopLoop(void* vEventBase)
+{
+    EventBase_endLoop((struct EventBase*) vEventBase);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct EventBase* base = EventBase_new(alloc);
+    struct Log* logger = WriterLog_new(FileWriter_new(stdout, alloc), alloc);
+    struct Random* rand = Random_new(alloc, logger, NULL);
+
+    struct Sockaddr_storage ss;
+    Assert_always(!Sockaddr_parse("[::]:9001", &ss));
+    struct AddrInterface* iface = Allocator_clone(alloc, (&(struct AddrInterface) {
+        .generic = {
+            .sendMessage = captureRequest,
+            .allocator = alloc
+        },
+        .addr = Sockaddr_clone(&ss.addr, alloc)
+    }));
+
+    struct RainflyClient* client = RainflyClient_new(iface, base, rand, logger);
+    client->minSignatures = 1;
+
+    uint8_t publicKey[32];
+    uint8_t secretKey[64];
+    uint8_t hotKey[32];
+    uint8_t hotSecretKey[64];
+    crypto_sign_ed25519_keypair(publicKey, secretKey);
+    crypto_sign_ed25519_keypair(hotKey, hotSecretKey);
+    Assert_always(!RainflyClient_addKey(client, publicKey));
+
+    const char* addrs[SERVERS] = { "[fc00::a]:9001", "[fc00::b]:9001", "[fc00::c]:9001" };
+    for (int i = 0; i < SERVERS; i++) {
+        Assert_always(!Sockaddr_parse(addrs[i], &servers[i]));
+        Assert_always(!RainflyClient_addServer(client, &servers[i].addr));
+    }
+
+    giveHotKey(iface, secretKey, hotKey, alloc);
+
+    // Ask all of them, the first good answer wins and the stragglers are ignored.
+    lookup(client, 3);
+    Timeout_setTimeout(stopLoop, base, 50, base, alloc);
+    EventBase_beginLoop(base);
+    answer(iface, asked[0], hotSecretKey, alloc);
+    Assert_always(replies == 1);
+    answer(iface, asked[1], hotSecretKey, alloc);
+    answer(iface, asked[2], hotSecretKey, alloc);
+    Assert_always(replies == 1);
+
+    // Everybody took about 50ms, this time one of them answers right away.
+    lookup(client, 3);
+    int fastest = asked[2];
+    answer(iface, fastest, hotSecretKey, alloc);
+    Assert_always(replies == 2);
+
+    // Now only the fastest one is asked.
+    lookup(client, 1);
+    Assert_always(asked[0] == fastest);
+    answer(iface, fastest, hotSecretKey, alloc);
+    Assert_always(replies == 3);
+
+    // A remembered signature must not vouch for a different record or a damaged signature.
+    lookup(client, 1);
+    answerWith(iface, asked[0], hotSecretKey, "{\"k\":\"v\"}", true, alloc);
+    Assert_always(replies == 3);
+    uint8_t otherHotKey[32];
+    uint8_t otherSecretKey[64];
+    crypto_sign_ed25519_keypair(otherHotKey, otherSecretKey);
+    answerWith(iface, asked[0], otherSecretKey, "{\"k\":\"v\"}", false, alloc);
+    Assert_always(replies == 3);
+    answerWith(iface, asked[0], hotSecretKey, "{\"k\":\"w\"}", false, alloc);
+    Assert_always(replies == 4);
+
+    Allocator_free(alloc);
+    return 0;
+}
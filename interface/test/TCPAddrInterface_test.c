@@ -0,0 +1,98 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/addressable/TCPAddrInterface.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "io/FileWriter.h"
+#include "io/Writer.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/log/Log.h"
+#include "util/log/WriterLog.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "wire/Message.h"
+
+/*
+ * Setup 2 TCPAddrInterface's, B connects to A by sending to it, A answers each message with
+ * several so that they are batched into one write and framed apart again on the other side.
+ */
+
+#define REPLIES 3
+
+static int receivedByA = 0;
+static uint8_t receiveMessageA(struct Message* msg, struct Interface* iface)
+{
+    receivedByA++;
+    Assert_always(!Bits_memcmp(&msg->bytes[msg->length - 12], "Hello World", 12));
+
+    // Echo to whatever address it came from, which is B's side of the connection.
+    for (int i = 0; i < REPLIES; i++) {
+        struct Allocator* child = Allocator_child(iface->allocator);
+        struct Message* reply = Message_clone(msg, child);
+        reply->bytes[reply->length - 1] = '0' + i;
+        iface->sendMessage(reply, iface);
+        Allocator_free(child);
+    }
+    return 0;
+}
+
+static int receivedByB = 0;
+static uint8_t receiveMessageB(struct Message* msg, struct Interface* iface)
+{
+    Assert_always(receivedByA == 1);
+    Assert_always(msg->bytes[msg->length - 1] == '0' + receivedByB);
+    if (++receivedByB == REPLIES) {
+        // Got all of the replies in order, test successful.
+        struct Allocator* alloc = iface->receiverContext;
+        Allocator_free(alloc);
+    }
+    return 0;
+}
+
+static void fail(void* ignored)
+{
+    Assert_always(!"timeout");
+}
+
+int main(int argc, char** argv)
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct EventBase* base = EventBase_new(alloc);
+    struct Writer* logWriter = FileWriter_new(stdout, alloc);
+    struct Log* logger = WriterLog_new(logWriter, alloc);
+
+    struct Sockaddr_storage addr;
+    Assert_always(!Sockaddr_parse("127.0.0.1", &addr));
+
+    struct AddrInterface* tcpA = TCPAddrInterface_new(base, &addr.addr, alloc, NULL, logger);
+    struct AddrInterface* tcpB = TCPAddrInterface_new(base, &addr.addr, alloc, NULL, logger);
+
+    tcpA->generic.receiveMessage = receiveMessageA;
+    tcpB->generic.receiveMessage = receiveMessageB;
+    tcpB->generic.receiverContext = alloc;
+
+    struct Allocator* child = Allocator_child(alloc);
+    struct Message* msg = Message_new(0, 512, child);
+    Message_push(msg, "Hello World", 12, NULL);
+    Message_push(msg, tcpA->addr, tcpA->addr->addrLen, NULL);
+    tcpB->generic.sendMessage(msg, &tcpB->generic);
+    Allocator_free(child);
+
+    Timeout_setTimeout(fail, NULL, 1000, base, alloc);
+
+    EventBase_beginLoop(base);
+    return 0;
+}
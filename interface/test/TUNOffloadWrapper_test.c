@@ -0,0 +1,190 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/tuntap/TUNOffloadWrapper.h"
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Checksum.h"
+#include "util/Endian.h"
+#include "util/log/FileWriterLog.h"
+#include "wire/Ethernet.h"
+#include "wire/Message.h"
+
+#include <stdio.h>
+
+#define MAX_SEGMENTS 8
+#define PAYLOAD_LEN 250
+#define MSS 100
+
+struct Context
+{
+    struct Message* received[MAX_SEGMENTS];
+    int receivedCount;
+    struct Message* sent;
+    struct Allocator* alloc;
+};
+
+static uint8_t receiveMessage(struct Message* msg, struct Interface* iface)
+{
+    struct Context* ctx = iface->receiverContext;
+    Assert_always(ctx->receivedCount < MAX_SEGMENTS);
+    ctx->received[ctx->receivedCount++] = Message_clone(msg, ctx->alloc);
+    return 0;
+}
+
+static uint8_t sendMessage(struct Message* msg, struct Interface* iface)
+{
+    struct Context* ctx = iface->senderContext;
+    ctx->sent = Message_clone(msg, ctx->alloc);
+    return 0;
+}
+
+static uint16_t get16(const uint8_t* bytes)
+{
+    return (bytes[0] << 8) | bytes[1];
+}
+
+static uint32_t get32(const uint8_t* bytes)
+{
+    return (get16(bytes) << 16) | get16(&bytes[2]);
+}
+
+/** IPv6 with a 20 byte TCP header and PAYLOAD_LEN bytes of counting payload behind it. */
+static struct Message* tcp6Packet(uint8_t flags, uint8_t gsoType, struct Allocator* alloc)
+{
+    struct Message* msg = Message_new(40 + 20 + PAYLOAD_LEN, 512, alloc);
+    uint8_t* p = msg->bytes;
+    Bits_memset(p, 0, msg->length);
+    p[0] = 0x60;
+    p[4] = (20 + PAYLOAD_LEN) >> 8;
+    p[5] = (20 + PAYLOAD_LEN) & 0xff;
+    p[6] = 6;
+    p[7] = 64;
+    p[8] = 0xfc;
+    p[23] = 1;
+    p[24] = 0xfc;
+    p[39] = 2;
+    uint8_t* tcp = &p[40];
+    tcp[1] = 80;
+    tcp[3] = 81;
+    tcp[7] = 0x10;
+    tcp[12] = 5 << 4;
+    tcp[13] = 0x19; // FIN PSH ACK
+    for (int i = 0; i < PAYLOAD_LEN; i++) {
+        tcp[20 + i] = i;
+    }
+
+    struct TUNOffloadWrapper_Header hdr = {
+        .flags = flags,
+        .gsoType = gsoType,
+        .hdrLen = 60,
+        .gsoSize = MSS,
+        .csumStart = 40,
+        .csumOffset = 16
+    };
+    Message_push(msg, &hdr, TUNOffloadWrapper_Header_SIZE, NULL);
+    uint16_t pi[2] = { 0, Ethernet_TYPE_IP6 };
+    Message_push(msg, pi, 4, NULL);
+    return msg;
+}
+
+static void assertTcp6ChecksumValid(struct Message* msg)
+{
+    uint8_t* ip = &msg->bytes[4];
+    Assert_always(!Checksum_Ip6(&ip[8], &ip[40], msg->length - 44, Endian_hostToBigEndian32(6)));
+}
+
+static void segmentation(struct Context* ctx, struct Interface* wrapped)
+{
+    ctx->receivedCount = 0;
+    struct Message* msg = tcp6Packet(TUNOffloadWrapper_Header_NEEDS_CSUM,
+                                     TUNOffloadWrapper_Header_GSO_TCPV6,
+                                     ctx->alloc);
+    Interface_receiveMessage(wrapped, msg);
+
+    Assert_always(ctx->receivedCount == 3);
+    for (int i = 0; i < 3; i++) {
+        struct Message* seg = ctx->received[i];
+        int segLen = (i < 2) ? MSS : PAYLOAD_LEN - 2 * MSS;
+        uint8_t* ip = &seg->bytes[4];
+        uint8_t* tcp = &ip[40];
+        Assert_always(seg->length == 4 + 40 + 20 + segLen);
+        Assert_always(((uint16_t*) seg->bytes)[1] == Ethernet_TYPE_IP6);
+        Assert_always(get16(&ip[4]) == 20 + segLen);
+        Assert_always(get32(&tcp[4]) == (uint32_t) (0x10 + i * MSS));
+        Assert_always(tcp[13] == ((i < 2) ? 0x10 : 0x19));
+        Assert_always(tcp[20] == (uint8_t) (i * MSS));
+        assertTcp6ChecksumValid(seg);
+    }
+}
+
+static void checksumOnly(struct Context* ctx, struct Interface* wrapped)
+{
+    ctx->receivedCount = 0;
+    struct Message* msg = tcp6Packet(TUNOffloadWrapper_Header_NEEDS_CSUM,
+                                     TUNOffloadWrapper_Header_GSO_NONE,
+                                     ctx->alloc);
+
+    // The kernel leaves the folded (not inverted) pseudo-header sum in the checksum field.
+    uint8_t* ip = &msg->bytes[4 + TUNOffloadWrapper_Header_SIZE];
+    uint32_t sum = Checksum_step(&ip[8], 32, 0);
+    sum = Checksum_step32(Endian_hostToBigEndian32(20 + PAYLOAD_LEN), sum);
+    sum = Checksum_step32(Endian_hostToBigEndian32(6), sum);
+    uint16_t seed = ~Checksum_complete(sum);
+    Bits_memcpyConst(&ip[40 + 16], &seed, 2);
+
+    Interface_receiveMessage(wrapped, msg);
+    Assert_always(ctx->receivedCount == 1);
+    Assert_always(ctx->received[0]->length == 4 + 40 + 20 + PAYLOAD_LEN);
+    assertTcp6ChecksumValid(ctx->received[0]);
+}
+
+static void sending(struct Context* ctx, struct Interface* iface)
+{
+    struct Message* msg = Message_new(8, 512, ctx->alloc);
+    Bits_memcpyConst(msg->bytes, "\0\0\x86\xdd" "abcd", 8);
+    Interface_sendMessage(iface, msg);
+
+    Assert_always(ctx->sent->length == 8 + TUNOffloadWrapper_Header_SIZE);
+    Assert_always(!Bits_memcmp(ctx->sent->bytes, "\0\0\x86\xdd", 4));
+    uint8_t zeros[TUNOffloadWrapper_Header_SIZE] = {0};
+    Assert_always(!Bits_memcmp(&ctx->sent->bytes[4], zeros, TUNOffloadWrapper_Header_SIZE));
+    Assert_always(!Bits_memcmp(&ctx->sent->bytes[4 + TUNOffloadWrapper_Header_SIZE], "abcd", 4));
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Log* logger = FileWriterLog_new(stdout, alloc);
+    struct Context ctx = { .alloc = alloc };
+
+    struct Interface wrapped = {
+        .sendMessage = sendMessage,
+        .senderContext = &ctx,
+        .allocator = alloc
+    };
+    struct Interface* iface = TUNOffloadWrapper_new(&wrapped, logger);
+    iface->receiveMessage = receiveMessage;
+    iface->receiverContext = &ctx;
+
+    segmentation(&ctx, &wrapped);
+    checksumOnly(&ctx, &wrapped);
+    sending(&ctx, iface);
+
+    Allocator_free(alloc);
+    return 0;
+}
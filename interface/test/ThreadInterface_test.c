@@ -0,0 +1,106 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "interface/ThreadInterface.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "wire/Message.h"
+
+#define MESSAGES 1000
+
+struct Echo
+{
+    struct Interface* iface;
+    struct EventBase* base;
+    struct Allocator* alloc;
+};
+
+/** Send back every message, an empty one means stop. */
+static uint8_t echo(struct Message* msg, struct Interface* iface)
+{
+    struct Echo* e = iface->receiverContext;
+    if (!msg->length) {
+        EventBase_endLoop(e->base);
+        return 0;
+    }
+    Interface_sendMessage(e->iface, msg);
+    return 0;
+}
+
+static void echoThread(void* vEcho)
+{
+    struct Echo* e = vEcho;
+    EventBase_beginLoop(e->base);
+    Allocator_free(e->alloc);
+}
+
+struct Context
+{
+    struct Interface* iface;
+    struct EventBase* base;
+    uint32_t received;
+};
+
+static uint8_t receive(struct Message* msg, struct Interface* iface)
+{
+    struct Context* ctx = iface->receiverContext;
+    // Messages arrive in the order which they were sent.
+    Assert_always(msg->length == 4);
+    uint32_t number;
+    Bits_memcpyConst(&number, msg->bytes, 4);
+    Assert_always(number == ctx->received);
+    if (++ctx->received == MESSAGES) {
+        EventBase_endLoop(ctx->base);
+    }
+    return 0;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct EventBase* base = EventBase_new(alloc);
+
+    struct Echo e = { .alloc = MallocAllocator_new(1<<20) };
+    e.base = EventBase_new(e.alloc);
+
+    struct Context ctx = { .base = base };
+    ThreadInterface_newPair(&ctx.iface, base, alloc, &e.iface, e.base, e.alloc);
+    ctx.iface->receiveMessage = receive;
+    ctx.iface->receiverContext = &ctx;
+    e.iface->receiveMessage = echo;
+    e.iface->receiverContext = &e;
+
+    uv_thread_t thread;
+    Assert_always(!uv_thread_create(&thread, echoThread, &e));
+
+    for (uint32_t i = 0; i < MESSAGES; i++) {
+        struct Allocator* msgAlloc = Allocator_child(alloc);
+        struct Message* msg = Message_new(4, Interface_PADDING, msgAlloc);
+        Bits_memcpyConst(msg->bytes, &i, 4);
+        Interface_sendMessage(ctx.iface, msg);
+        Allocator_free(msgAlloc);
+    }
+    EventBase_beginLoop(base);
+    Assert_always(ctx.received == MESSAGES);
+
+    struct Message* stop = Message_new(0, Interface_PADDING, alloc);
+    Interface_sendMessage(ctx.iface, stop);
+    uv_thread_join(&thread);
+
+    Allocator_free(alloc);
+    return 0;
+}
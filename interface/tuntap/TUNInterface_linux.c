@@ -17,7 +17,8 @@
 #include "util/events/EventBase.h"
 #include "interface/Interface.h"
 #include "interface/tuntap/TUNInterface.h"
-#include "util/events/Pipe.h"
+#include "interface/tuntap/TUNOffloadWrapper.h"
+#include "util/events/PacketDevice.h"
 #define string_strncpy
 #define string_strlen
 #define string_strerror
@@ -39,6 +40,9 @@
 #include <linux/if_tun.h>
 #include <linux/if_ether.h>
 
+/** Room for a 64KiB TSO packet behind the tun_pi and virtio headers. */
+#define OFFLOAD_BUFFER_SIZE (65536 + 4 + TUNOffloadWrapper_Header_SIZE)
+
 struct Interface* TUNInterface_new(const char* interfaceName,
                                    char assignedInterfaceName[TUNInterface_IFNAMSIZ],
                                    struct EventBase* base,
@@ -62,6 +66,15 @@ struct Interface* TUNInterface_new(const char* interfaceName,
         Except_throw(eh, "open(\"/dev/net/tun\") [%s]", strerror(errno));
     }
 
+    // With a virtio header on each packet the kernel can leave checksums to us and hand over
+    // whole TSO packets, which costs one read() per 64KiB rather than one per segment.
+    unsigned int features = 0;
+    int offload = 0;
+    if (!ioctl(fileno, TUNGETFEATURES, &features) && (features & IFF_VNET_HDR)) {
+        ifRequest.ifr_flags |= IFF_VNET_HDR;
+        offload = 1;
+    }
+
     if (ioctl(fileno, TUNSETIFF, &ifRequest) < 0) {
         int err = errno;
         close(fileno);
@@ -69,7 +82,21 @@ struct Interface* TUNInterface_new(const char* interfaceName,
     }
     strncpy(assignedInterfaceName, ifRequest.ifr_name, maxNameSize);
 
-    struct Pipe* p = Pipe_forFiles(fileno, fileno, base, eh, alloc);
+    if (offload) {
+        unsigned int flags = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6;
+        if (ioctl(fileno, TUNSETOFFLOAD, flags) < 0) {
+            // The virtio header is still there, packets just won't be offloaded.
+            Log_info(logger, "ioctl(TUNSETOFFLOAD) [%s]", strerror(errno));
+        }
+    }
+
+    struct PacketDevice* dev = PacketDevice_forFd(fileno,
+                                                  offload ? OFFLOAD_BUFFER_SIZE
+                                                          : PacketDevice_BUFFER_CAP,
+                                                  base, logger, eh, alloc);
 
-    return &p->iface;
+    if (offload) {
+        return TUNOffloadWrapper_new(&dev->iface, logger);
+    }
+    return &dev->iface;
 }
@@ -0,0 +1,227 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "interface/tuntap/TUNOffloadWrapper.h"
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "util/Bits.h"
+#include "util/Checksum.h"
+#include "util/Endian.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+#include "wire/Error.h"
+
+/** The tun_pi header which precedes the virtio header. */
+#define TUN_PI_SIZE 4
+
+#define IP4_HEADER_MIN 20
+#define IP6_HEADER_SIZE 40
+#define TCP_HEADER_MIN 20
+
+/** Offsets within the TCP header. */
+#define TCP_SEQUENCE 4
+#define TCP_FLAGS 13
+#define TCP_CHECKSUM 16
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_PSH 0x08
+#define TCP_FLAG_CWR 0x80
+
+struct TUNOffloadWrapper_pvt
+{
+    struct Interface generic;
+    struct Interface* const wrapped;
+    struct Log* const logger;
+    Identity
+};
+
+static inline uint16_t get16(const uint8_t* bytes)
+{
+    uint16_t out_be;
+    Bits_memcpyConst(&out_be, bytes, 2);
+    return Endian_bigEndianToHost16(out_be);
+}
+
+static inline void put16(uint8_t* bytes, uint16_t value)
+{
+    uint16_t value_be = Endian_hostToBigEndian16(value);
+    Bits_memcpyConst(bytes, &value_be, 2);
+}
+
+/** Fill in the checksum of a packet which the kernel only seeded with the pseudo-header. */
+static void finishChecksum(uint8_t* packet, uint32_t length, struct TUNOffloadWrapper_Header* hdr)
+{
+    uint32_t csumAt = hdr->csumStart + hdr->csumOffset;
+    if (csumAt + 2 > length) {
+        return;
+    }
+    uint16_t csum = Checksum_complete(
+        Checksum_step(&packet[hdr->csumStart], length - hdr->csumStart, 0));
+    if (csum == 0 && hdr->csumOffset == 6) {
+        // A zero UDP checksum means "no checksum".
+        csum = 0xffff;
+    }
+    Bits_memcpyConst(&packet[csumAt], &csum, 2);
+}
+
+/** The TCP checksum of a whole segment, including the pseudo-header. */
+static uint16_t tcpChecksum(const uint8_t* packet, uint32_t ipHeaderLen, uint32_t length, int ip6)
+{
+    uint32_t tcpLen = length - ipHeaderLen;
+    uint32_t sum;
+    if (ip6) {
+        sum = Checksum_step(&packet[8], 32, 0);
+    } else {
+        sum = Checksum_step(&packet[12], 8, 0);
+    }
+    sum = Checksum_step32(Endian_hostToBigEndian32(tcpLen), sum);
+    sum = Checksum_step32(Endian_hostToBigEndian32(6), sum);
+    sum = Checksum_step(&packet[ipHeaderLen], tcpLen, sum);
+    return Checksum_complete(sum);
+}
+
+/**
+ * Cut a TSO packet into gsoSize pieces of payload, each behind a copy of the IP and TCP headers
+ * with the lengths, sequence number, flags and checksums made right for that piece.
+ */
+static void segment(struct TUNOffloadWrapper_pvt* ctx,
+                    struct Message* msg,
+                    struct TUNOffloadWrapper_Header* hdr,
+                    uint8_t tunPi[TUN_PI_SIZE])
+{
+    int ip6 = (hdr->gsoType & ~TUNOffloadWrapper_Header_GSO_ECN)
+        == TUNOffloadWrapper_Header_GSO_TCPV6;
+    uint32_t ipHeaderLen = hdr->csumStart;
+    if (ipHeaderLen < (ip6 ? IP6_HEADER_SIZE : IP4_HEADER_MIN)
+        || ipHeaderLen + TCP_HEADER_MIN > (uint32_t) msg->length
+        || hdr->gsoSize == 0)
+    {
+        Log_debug(ctx->logger, "DROP malformed TSO packet");
+        return;
+    }
+    // Don't trust hdrLen, take the length of the TCP header from the packet itself.
+    uint32_t headersLen = ipHeaderLen + (msg->bytes[ipHeaderLen + 12] >> 4) * 4;
+    if (headersLen < ipHeaderLen + TCP_HEADER_MIN || headersLen > (uint32_t) msg->length) {
+        Log_debug(ctx->logger, "DROP malformed TSO packet");
+        return;
+    }
+
+    uint32_t sequence;
+    Bits_memcpyConst(&sequence, &msg->bytes[ipHeaderLen + TCP_SEQUENCE], 4);
+    sequence = Endian_bigEndianToHost32(sequence);
+    uint8_t tcpFlags = msg->bytes[ipHeaderLen + TCP_FLAGS];
+    uint16_t ip4Id = get16(&msg->bytes[4]);
+
+    uint32_t payloadLen = msg->length - headersLen;
+    for (uint32_t offset = 0, i = 0; offset < payloadLen; offset += hdr->gsoSize, i++) {
+        uint32_t segLen = payloadLen - offset;
+        if (segLen > hdr->gsoSize) {
+            segLen = hdr->gsoSize;
+        }
+        uint32_t length = headersLen + segLen;
+
+        struct Allocator* alloc = Allocator_scratch(ctx->generic.allocator,
+            Interface_PADDING + TUN_PI_SIZE + length + sizeof(struct Message) + 64);
+        struct Message* seg = Message_new(length, Interface_PADDING + TUN_PI_SIZE, alloc);
+        Bits_memcpy(seg->bytes, msg->bytes, headersLen);
+        Bits_memcpy(&seg->bytes[headersLen], &msg->bytes[headersLen + offset], segLen);
+
+        if (ip6) {
+            put16(&seg->bytes[4], length - IP6_HEADER_SIZE);
+        } else {
+            put16(&seg->bytes[2], length);
+            put16(&seg->bytes[4], ip4Id + i);
+            Bits_memset(&seg->bytes[10], 0, 2);
+            uint16_t ipCsum = Checksum_engine(seg->bytes, ipHeaderLen);
+            Bits_memcpyConst(&seg->bytes[10], &ipCsum, 2);
+        }
+
+        uint8_t* tcp = &seg->bytes[ipHeaderLen];
+        uint32_t seq_be = Endian_hostToBigEndian32(sequence + offset);
+        Bits_memcpyConst(&tcp[TCP_SEQUENCE], &seq_be, 4);
+        uint8_t flags = tcpFlags;
+        if (offset + segLen < payloadLen) {
+            // FIN and PSH belong to the last segment only.
+            flags &= ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+        }
+        if (i > 0) {
+            flags &= ~TCP_FLAG_CWR;
+        }
+        tcp[TCP_FLAGS] = flags;
+        Bits_memset(&tcp[TCP_CHECKSUM], 0, 2);
+        uint16_t tcpCsum = tcpChecksum(seg->bytes, ipHeaderLen, length, ip6);
+        Bits_memcpyConst(&tcp[TCP_CHECKSUM], &tcpCsum, 2);
+
+        Message_push(seg, tunPi, TUN_PI_SIZE, NULL);
+        Interface_receiveMessage(&ctx->generic, seg);
+        Allocator_free(alloc);
+    }
+}
+
+static uint8_t receiveMessage(struct Message* msg, struct Interface* iface)
+{
+    struct TUNOffloadWrapper_pvt* ctx =
+        Identity_cast((struct TUNOffloadWrapper_pvt*)iface->receiverContext);
+
+    uint8_t tunPi[TUN_PI_SIZE];
+    struct TUNOffloadWrapper_Header hdr;
+    if (Message_tryPop(msg, tunPi, TUN_PI_SIZE)
+        || Message_tryPop(msg, &hdr, TUNOffloadWrapper_Header_SIZE))
+    {
+        return Error_NONE;
+    }
+
+    if ((hdr.gsoType & ~TUNOffloadWrapper_Header_GSO_ECN) != TUNOffloadWrapper_Header_GSO_NONE) {
+        segment(ctx, msg, &hdr, tunPi);
+        return Error_NONE;
+    }
+
+    if (hdr.flags & TUNOffloadWrapper_Header_NEEDS_CSUM) {
+        finishChecksum(msg->bytes, msg->length, &hdr);
+    }
+    Message_push(msg, tunPi, TUN_PI_SIZE, NULL);
+    return Interface_receiveMessage(&ctx->generic, msg);
+}
+
+static uint8_t sendMessage(struct Message* msg, struct Interface* iface)
+{
+    struct TUNOffloadWrapper_pvt* ctx = Identity_cast((struct TUNOffloadWrapper_pvt*)iface);
+
+    Assert_true(msg->length >= TUN_PI_SIZE);
+    uint8_t tunPi[TUN_PI_SIZE];
+    Message_pop(msg, tunPi, TUN_PI_SIZE, NULL);
+    Message_push(msg, (&(struct TUNOffloadWrapper_Header) { .flags = 0 }),
+                 TUNOffloadWrapper_Header_SIZE, NULL);
+    Message_push(msg, tunPi, TUN_PI_SIZE, NULL);
+
+    return Interface_sendMessage(ctx->wrapped, msg);
+}
+
+struct Interface* TUNOffloadWrapper_new(struct Interface* wrapped, struct Log* logger)
+{
+    struct TUNOffloadWrapper_pvt* context =
+        Allocator_clone(wrapped->allocator, (&(struct TUNOffloadWrapper_pvt) {
+            .generic = {
+                .sendMessage = sendMessage,
+                .allocator = wrapped->allocator
+            },
+            .wrapped = wrapped,
+            .logger = logger
+        }));
+    Identity_set(context);
+
+    wrapped->receiveMessage = receiveMessage;
+    wrapped->receiverContext = context;
+
+    return &context->generic;
+}
@@ -0,0 +1,63 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TUNOffloadWrapper_H
+#define TUNOffloadWrapper_H
+
+#include "interface/Interface.h"
+#include "util/log/Log.h"
+#include "util/Assert.h"
+#include "util/Linker.h"
+Linker_require("interface/tuntap/TUNOffloadWrapper.c")
+
+#include <stdint.h>
+
+/**
+ * The struct virtio_net_hdr which a tun device in IFF_VNET_HDR mode places between the
+ * tun_pi header and the packet. Fields are in host byte order.
+ */
+struct TUNOffloadWrapper_Header
+{
+    uint8_t flags;
+    uint8_t gsoType;
+    uint16_t hdrLen;
+    uint16_t gsoSize;
+    uint16_t csumStart;
+    uint16_t csumOffset;
+};
+#define TUNOffloadWrapper_Header_SIZE 10
+Assert_compileTime(sizeof(struct TUNOffloadWrapper_Header) == TUNOffloadWrapper_Header_SIZE);
+
+/** flags: the checksum at csumStart + csumOffset only covers the pseudo-header. */
+#define TUNOffloadWrapper_Header_NEEDS_CSUM 1
+
+/** gsoType values, ECN may be or'd in and is ignored. */
+#define TUNOffloadWrapper_Header_GSO_NONE 0
+#define TUNOffloadWrapper_Header_GSO_TCPV4 1
+#define TUNOffloadWrapper_Header_GSO_TCPV6 4
+#define TUNOffloadWrapper_Header_GSO_ECN 0x80
+
+/**
+ * Wrap a tun device which was opened with IFF_VNET_HDR and had checksum and TCP segmentation
+ * offload enabled. Packets which arrive are split back into MTU sized TCP segments and have
+ * their checksums finished so what comes out looks like a normal tun device, packets which are
+ * sent get an empty virtio header.
+ *
+ * @param wrapped the tun device, messages begin with the 4 byte tun_pi header.
+ * @param logger
+ * @return an Interface which carries ordinary tun_pi prefixed packets.
+ */
+struct Interface* TUNOffloadWrapper_new(struct Interface* wrapped, struct Log* logger);
+
+#endif
@@ -147,17 +147,45 @@ struct TAPInterface_FdAndOl
     char* name;
 };
 
+/**
+ * Number of reads which are kept waiting on the TAP device, the driver can fill them all
+ * while the thread is busy writing the first one to the pipe.
+ */
+#define TAPInterface_READS 8
+
+/** One read from the TAP device, it is written to the pipe and then read into again. */
+struct TAPInterface_Read
+{
+    OVERLAPPED ol;
+    union TAPInterface_buffer buff;
+    int state;
+
+    /** The length of the packet with its framing and how much of it was written to the pipe. */
+    DWORD bytes;
+    DWORD offset;
+};
+
 struct TAPInterface_ThreadContext
 {
     struct TAPInterface_FdAndOl tap;
     struct TAPInterface_FdAndOl pipe;
+
+    struct TAPInterface_Read reads[TAPInterface_READS];
+
+    /** The oldest read, they are written to the pipe in the order they were started. */
+    int nextRead;
 };
 
-#include "util/Hex.h"
+/** @return non-zero if the last overlapped operation is still going. */
+static int isPending()
+{
+    DWORD err = GetLastError();
+    return err == ERROR_IO_PENDING || err == ERROR_IO_INCOMPLETE;
+}
 
 /**
  * Copy data from one file handle to another.
- * @return the handle which has blocked.
+ * @return the event of the operation which has blocked.
  */
 #define thread_copy_ADD_FRAMING    1
 #define thread_copy_REMOVE_FRAMING 2
@@ -183,23 +211,20 @@ static HANDLE thread_copy(struct TAPInterface_FdAndOl* from,
         DWORD bytesRead = 0;
         if (from->state == TAPInterface_FdAndOl_state_AWAITING_READ) {
             if (!GetOverlappedResult(from->fd, &from->ol, &bytesRead, FALSE)) {
-                switch (GetLastError()) {
-                    case ERROR_IO_PENDING: return from->fd;
-                    default:;
+                if (isPending()) {
+                    return from->ol.hEvent;
                 }
                 printf("GetOverlappedResult(read, %s): %s\n",
                        from->name, WinFail_strerror(GetLastError()));
                 Assert_true(0);
             }
-            printf("read completed from %s with %d bytes\n", from->name, (int)bytesRead);
             from->state = 0;
 
         } else if (from->state == TAPInterface_FdAndOl_state_AWAITING_WRITE) {
             DWORD bytesWritten;
             if (!GetOverlappedResult(to->fd, &from->ol, &bytesWritten, FALSE)) {
-                switch (GetLastError()) {
-                    case ERROR_IO_PENDING: return to->fd;
-                    default:;
+                if (isPending()) {
+                    return from->ol.hEvent;
                 }
                 printf("GetOverlappedResult(write, %s): %s\n",
                        to->name, WinFail_strerror(GetLastError()));
@@ -214,28 +239,17 @@ static HANDLE thread_copy(struct TAPInterface_FdAndOl* from,
                 Assert_true(bytesWritten == from->bytes);
                 from->bytes = 0;
                 from->offset = 0;
-                printf("write to %s with %d bytes completed\n", to->name, (int)bytesWritten);
                 // successfully finished a write, loop back and try again.
                 continue;
             }
 
         } else if (!ReadFile(from->fd, &readTo[from->offset], bytesToRead, &bytesRead, &from->ol)) {
-            switch (GetLastError()) {
-                case ERROR_IO_PENDING: {
-                    from->state = TAPInterface_FdAndOl_state_AWAITING_READ;
-                    printf("read pending from %s\n", from->name);
-                    return from->fd;
-                }
-
-                default: {
-                    printf("ReadFile(%s): %s\n", from->name, WinFail_strerror(GetLastError()));
-                    Assert_true(0);
-                }
+            if (isPending()) {
+                from->state = TAPInterface_FdAndOl_state_AWAITING_READ;
+                return from->ol.hEvent;
             }
-
-        } else {
-            printf("read completed immedietly from %s with %d bytes\n",
-                   from->name, (int)bytesRead);
+            printf("ReadFile(%s): %s\n", from->name, WinFail_strerror(GetLastError()));
+            Assert_true(0);
         }
 
         if (framing == thread_copy_REMOVE_FRAMING) {
@@ -271,12 +285,9 @@ static HANDLE thread_copy(struct TAPInterface_FdAndOl* from,
                            &bytes,
                            &from->ol))
             {
-                switch (GetLastError()) {
-                    case ERROR_IO_PENDING: {
-                        from->state = TAPInterface_FdAndOl_state_AWAITING_WRITE;
-                        return to->fd;
-                    }
-                    default:;
+                if (isPending()) {
+                    from->state = TAPInterface_FdAndOl_state_AWAITING_WRITE;
+                    return from->ol.hEvent;
                 }
                 printf("WriteFile(%s): %s\n", to->name, WinFail_strerror(GetLastError()));
                 Assert_true(0);
@@ -287,7 +298,6 @@ static HANDLE thread_copy(struct TAPInterface_FdAndOl* from,
                     continue;
                 }
                 Assert_true(bytes == from->bytes);
-                printf("write to %s with %d bytes completed immedietly\n", to->name, (int)bytes);
                 from->bytes = 0;
                 from->offset = 0;
                 break;
@@ -296,13 +306,88 @@ static HANDLE thread_copy(struct TAPInterface_FdAndOl* from,
     }
 }
 
+/**
+ * Begin reading a packet from the TAP device into a read slot.
+ * The result is collected with GetOverlappedResult() even if the read completes right away.
+ */
+static void startRead(struct TAPInterface_ThreadContext* tc, struct TAPInterface_Read* r)
+{
+    r->state = TAPInterface_FdAndOl_state_AWAITING_READ;
+    if (!ReadFile(tc->tap.fd, r->buff.components.data, 2042, NULL, &r->ol) && !isPending()) {
+        printf("ReadFile(%s): %s\n", tc->tap.name, WinFail_strerror(GetLastError()));
+        Assert_true(0);
+    }
+}
+
+/** Begin writing whatever is left of the packet in a read slot to the pipe. */
+static void startWrite(struct TAPInterface_ThreadContext* tc, struct TAPInterface_Read* r)
+{
+    r->state = TAPInterface_FdAndOl_state_AWAITING_WRITE;
+    if (!WriteFile(tc->pipe.fd, &r->buff.bytes[r->offset], r->bytes - r->offset, NULL, &r->ol)
+        && !isPending())
+    {
+        printf("WriteFile(%s): %s\n", tc->pipe.name, WinFail_strerror(GetLastError()));
+        Assert_true(0);
+    }
+}
+
+/**
+ * Move packets from the TAP device to the pipe, every read slot is kept waiting on the device
+ * except for the one which is being written.
+ * @return the event of the oldest read or write which has not completed.
+ */
+static HANDLE tapToPipe(struct TAPInterface_ThreadContext* tc)
+{
+    for (;;) {
+        struct TAPInterface_Read* r = &tc->reads[tc->nextRead];
+        DWORD bytes = 0;
+        if (r->state == TAPInterface_FdAndOl_state_AWAITING_READ) {
+            if (!GetOverlappedResult(tc->tap.fd, &r->ol, &bytes, FALSE)) {
+                if (isPending()) {
+                    return r->ol.hEvent;
+                }
+                printf("GetOverlappedResult(read, %s): %s\n",
+                       tc->tap.name, WinFail_strerror(GetLastError()));
+                Assert_true(0);
+            }
+            r->bytes = bytes + 2;
+            r->buff.components.length_be = Endian_hostToBigEndian32(((uint32_t)r->bytes));
+            r->bytes += 4;
+            r->offset = 0;
+            startWrite(tc, r);
+
+        } else {
+            Assert_true(r->state == TAPInterface_FdAndOl_state_AWAITING_WRITE);
+            if (!GetOverlappedResult(tc->pipe.fd, &r->ol, &bytes, FALSE)) {
+                if (isPending()) {
+                    return r->ol.hEvent;
+                }
+                printf("GetOverlappedResult(write, %s): %s\n",
+                       tc->pipe.name, WinFail_strerror(GetLastError()));
+                Assert_true(0);
+            }
+            r->offset += bytes;
+            if (r->offset < r->bytes) {
+                startWrite(tc, r);
+                continue;
+            }
+            startRead(tc, r);
+            tc->nextRead = (tc->nextRead + 1) % TAPInterface_READS;
+        }
+    }
+}
+
 static DWORD WINAPI thread_main(LPVOID param)
 {
     struct TAPInterface_ThreadContext* tc = (struct TAPInterface_ThreadContext*)param;
 
+    for (int i = 0; i < TAPInterface_READS; i++) {
+        startRead(tc, &tc->reads[i]);
+    }
+
     for (;;) {
         HANDLE handles[2];
-        handles[0] = thread_copy(&tc->tap, &tc->pipe, thread_copy_ADD_FRAMING);
+        handles[0] = tapToPipe(tc);
         handles[1] = thread_copy(&tc->pipe, &tc->tap, thread_copy_REMOVE_FRAMING);
         if (WaitForMultipleObjects(2, handles, FALSE, 3000) == WAIT_FAILED) {
             printf("WaitForMultipleObjects(): %s\n", WinFail_strerror(GetLastError()));
@@ -330,8 +415,11 @@ struct Interface* TAPInterface_new(const char* preferredName,
     struct TAPInterface_ThreadContext* tc =
         Allocator_calloc(alloc, sizeof(struct TAPInterface_ThreadContext), 1);
 
-    WinFail_assert(eh, (tc->tap.ol.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) != NULL);
     WinFail_assert(eh, (tc->pipe.ol.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) != NULL);
+    for (int i = 0; i < TAPInterface_READS; i++) {
+        WinFail_assert(eh,
+            (tc->reads[i].ol.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)) != NULL);
+    }
 
     tc->tap.name = "tap";
     tc->pipe.name = "pipe";
@@ -56,6 +56,16 @@ static void skip(struct Reader* reader, unsigned long byteCount)
     reader->bytesRead += byteCount;
 }
 
+/** @see Reader->buffer() */
+static const uint8_t* buffer(struct Reader* reader, unsigned long* lengthOut)
+{
+    struct ArrayReader_context* context = Identity_cast((struct ArrayReader_context*) reader);
+    // Skipping off the end is allowed.
+    *lengthOut = (context->pointer < context->endPointer)
+        ? (unsigned long) (context->endPointer - context->pointer) : 0;
+    return (const uint8_t*) context->pointer;
+}
+
 /** @see ArrayReader.h */
 struct Reader* ArrayReader_new(const void* bufferToRead,
                                unsigned long length,
@@ -64,7 +74,8 @@ struct Reader* ArrayReader_new(const void* bufferToRead,
     struct ArrayReader_context* context = Allocator_clone(alloc, (&(struct ArrayReader_context) {
         .generic = {
             .read = read,
-            .skip = skip
+            .skip = skip,
+            .buffer = buffer
         },
         .pointer = bufferToRead,
         .endPointer = (char*) bufferToRead + length
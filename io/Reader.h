@@ -41,6 +41,16 @@ struct Reader {
      */
     void (* const skip)(struct Reader* thisReader, unsigned long byteCount);
 
+    /**
+     * Get the content which has not been read yet without copying it, if the reader has it in
+     * memory. This is optional, if it is NULL then the content can only be read.
+     *
+     * @param thisReader the Reader which is being called.
+     * @param lengthOut set to the number of bytes which remain.
+     * @return a pointer to the next byte which would be read.
+     */
+    const uint8_t* (* const buffer)(struct Reader* thisReader, unsigned long* lengthOut);
+
     /** The total number of bytes which have been read OR SKIPPED by this reader. */
     uint64_t bytesRead;
 };
@@ -66,6 +76,10 @@ Reader_readGeneric(64)
 #define Reader_skip(reader, bytes) \
     (reader)->skip((reader), (bytes))
 
+/** The unread content or NULL if the reader cannot provide it, see Reader->buffer(). */
+#define Reader_buffer(reader, lengthOut) \
+    (((reader)->buffer) ? (reader)->buffer((reader), (lengthOut)) : NULL)
+
 #define Reader_bytesRead(reader) \
     ((reader)->bytesRead + 0)
 
@@ -13,6 +13,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #define string_strrchr
+#define string_strcmp
 #include "util/platform/libc/string.h"
 
 #include "memory/Allocator.h"
@@ -115,6 +116,86 @@ static inline void checkCanaries(struct Allocator_Allocation_pvt* alloc,
     #endif
 }
 
+/**
+ * Find the statistics for a call site, creating them if needed.
+ * @return the site or NULL if the table is full.
+ */
+static struct Allocator_Site* getSite(struct Allocator_SiteTable* table,
+                                      const char* fileName,
+                                      int lineNum)
+{
+    uint32_t i = ((uint32_t) lineNum * 2654435761u) % (Allocator_SITES * 2);
+    for (;;) {
+        if (!table->index[i]) {
+            break;
+        }
+        struct Allocator_Site* site = &table->sites[table->index[i] - 1];
+        // The same inline function in a header will come with a different pointer in each file.
+        if (site->lineNum == lineNum
+            && (site->fileName == fileName || !strcmp(site->fileName, fileName)))
+        {
+            return site;
+        }
+        i = (i + 1) % (Allocator_SITES * 2);
+    }
+    if (table->count >= Allocator_SITES) {
+        return NULL;
+    }
+    struct Allocator_Site* site = &table->sites[table->count++];
+    site->fileName = fileName;
+    site->lineNum = lineNum;
+    table->index[i] = table->count;
+    return site;
+}
+
+static inline void siteAllocated(struct Allocator_pvt* context,
+                                 struct Allocator_Allocation* alloc,
+                                 unsigned long size)
+{
+    struct Allocator_SiteTable* table = context->rootAlloc->siteTable;
+    if (!table) {
+        return;
+    }
+    struct Allocator_Site* site = getSite(table, alloc->fileName, alloc->lineNum);
+    if (site) {
+        site->liveCount++;
+        site->liveBytes += size;
+        site->totalAllocations++;
+    }
+}
+
+static inline void siteReleased(struct Allocator_pvt* context,
+                                struct Allocator_Allocation* alloc,
+                                unsigned long size)
+{
+    struct Allocator_SiteTable* table = context->rootAlloc->siteTable;
+    if (!table || context->rootAlloc->context.pub.isFreeing) {
+        // When the root is being freed, the table itself may already be gone.
+        return;
+    }
+    struct Allocator_Site* site = getSite(table, alloc->fileName, alloc->lineNum);
+    // Allocations made before tracking began were never counted.
+    if (site && site->liveCount && site->liveBytes >= size) {
+        site->liveCount--;
+        site->liveBytes -= size;
+    }
+}
+
+static inline void siteResized(struct Allocator_pvt* context,
+                               struct Allocator_Allocation* alloc,
+                               unsigned long oldSize,
+                               unsigned long newSize)
+{
+    struct Allocator_SiteTable* table = context->rootAlloc->siteTable;
+    if (!table) {
+        return;
+    }
+    struct Allocator_Site* site = getSite(table, alloc->fileName, alloc->lineNum);
+    if (site && site->liveCount && site->liveBytes >= oldSize) {
+        site->liveBytes += newSize - oldSize;
+    }
+}
+
 static inline void* newAllocation(struct Allocator_pvt* context,
                                   unsigned long size,
                                   const char* fileName,
@@ -142,10 +223,66 @@ static inline void* newAllocation(struct Allocator_pvt* context,
     alloc->pub.lineNum = lineNum;
     context->allocations = alloc;
     setCanaries(alloc, context);
+    siteAllocated(context, &alloc->pub, realSize);
 
     return (void*) (alloc + 1);
 }
 
+/**
+ * Allocations made by a scratch allocator are preceeded only by their size,
+ * they are not linked anywhere and are released when the chunk holding them is.
+ */
+#define SCRATCH_HEADER sizeof(unsigned long)
+
+static inline unsigned long getScratchSize(unsigned long requestedSize)
+{
+    return ((requestedSize + (sizeof(char*) - 1)) & ~(sizeof(char*) - 1)) + SCRATCH_HEADER;
+}
+
+static void* scratchAllocation(struct Allocator_pvt* context,
+                               unsigned long size,
+                               const char* fileName,
+                               int lineNum)
+{
+    unsigned long realSize = getScratchSize(size);
+    if ((unsigned long) (context->scratchEnd - context->scratchPointer) < realSize) {
+        // Start a new chunk, whatever is left of the current one is wasted.
+        unsigned long chunkSize =
+            (realSize > Allocator_SCRATCH_CHUNK) ? realSize : Allocator_SCRATCH_CHUNK;
+        context->scratchPointer = newAllocation(context, chunkSize, fileName, lineNum);
+        context->scratchEnd = context->scratchPointer + chunkSize;
+    }
+    unsigned long* out = (unsigned long*) context->scratchPointer;
+    context->scratchPointer += realSize;
+    out[0] = size;
+    return &out[1];
+}
+
+static void* scratchReallocation(struct Allocator_pvt* context,
+                                 void* original,
+                                 unsigned long size,
+                                 const char* fileName,
+                                 int lineNum)
+{
+    if (size == 0) {
+        // The memory is reclaimed when the allocator is freed.
+        return NULL;
+    }
+    unsigned long* header = ((unsigned long*) original) - 1;
+    char* end = ((char*) header) + getScratchSize(header[0]);
+    if (end == context->scratchPointer
+        && ((char*) header) + getScratchSize(size) <= context->scratchEnd)
+    {
+        // This is the last allocation in the chunk so it can be resized in place.
+        context->scratchPointer = ((char*) header) + getScratchSize(size);
+        header[0] = size;
+        return original;
+    }
+    void* out = scratchAllocation(context, size, fileName, lineNum);
+    Bits_memcpy(out, original, (header[0] < size) ? header[0] : size);
+    return out;
+}
+
 struct Allocator_Allocation* Allocator_getAllocation(struct Allocator* alloc, int allocNum)
 {
     struct Allocator_pvt* ctx = Identity_cast((struct Allocator_pvt*)alloc);
@@ -196,6 +333,7 @@ static void releaseAllocation(struct Allocator_pvt* context,
                               Allocator_Provider_CONTEXT_TYPE* providerCtx)
 {
     checkCanaries(allocation, context);
+    siteReleased(context, &allocation->pub, allocation->pub.size);
 
     // TODO: make this optional.
     Bits_memset(&(&allocation->pub)[1],
@@ -291,17 +429,6 @@ static struct Allocator_pvt* getParent(struct Allocator_pvt* child)
 
 static void freeAllocator(struct Allocator_pvt* context, const char* file, int line);
 
-static void childFreed(struct Allocator_pvt* child)
-{
-    struct Allocator_pvt* parent = getParent(child);
-    // disconnect the child and if there are no children left then call freeAllocator()
-    // on the parent a second time.
-    disconnect(child);
-    if (parent && !parent->firstChild && parent->pub.isFreeing) {
-        freeAllocator(parent, child->pub.fileName, child->pub.lineNum);
-    }
-}
-
 void Allocator_onFreeComplete(struct Allocator_OnFreeJob* onFreeJob)
 {
     struct Allocator_OnFreeJob_pvt* job = (struct Allocator_OnFreeJob_pvt*) onFreeJob;
@@ -362,12 +489,12 @@ static void freeAllocator(struct Allocator_pvt* context, const char* file, int l
         return;
     }
 
-    // When the last child calls us back via childFreed() we will be called the last time and
+    // When the last child calls us back we will be called the last time and
     // if this is not set, the child will be disconnected from us and we will be left.
     context->pub.isFreeing = 1;
 
     // from now on, fileName/line will point to the place of freeing.
-    // this allows childFreed() to tell the truth when calling us back.
+    // this allows the children to tell the truth when calling us back.
     context->pub.fileName = file;
     context->pub.lineNum = line;
 
@@ -410,7 +537,7 @@ static void freeAllocator(struct Allocator_pvt* context, const char* file, int l
             freeAllocator(child, file, line);
             child = nextChild;
         }
-        // childFreed() will call us back.
+        // The last child to finish will call us back.
         return;
     }
 
@@ -418,8 +545,17 @@ static void freeAllocator(struct Allocator_pvt* context, const char* file, int l
     Allocator_Provider provider = context->rootAlloc->provider;
     Allocator_Provider_CONTEXT_TYPE* providerCtx = context->rootAlloc->providerContext;
 
-    childFreed(context);
+    // Disconnect and release this allocator before calling back the parent because freeing the
+    // parent may free the root which this allocator's memory is accounted against.
+    struct Allocator_pvt* parent = getParent(context);
+    disconnect(context);
     releaseMemory(context, provider, providerCtx);
+
+    // If the parent is freeing and this was the last child then call freeAllocator()
+    // on the parent a second time.
+    if (parent && !parent->firstChild && parent->pub.isFreeing) {
+        freeAllocator(parent, file, line);
+    }
 }
 
 void Allocator__free(struct Allocator* alloc, const char* file, int line)
@@ -428,12 +564,59 @@ void Allocator__free(struct Allocator* alloc, const char* file, int line)
     freeAllocator(context, file, line);
 }
 
+/**
+ * Find the next allocator to free under top, an allocator with no children or one whose
+ * children are all waiting for asynchronous onFree jobs.
+ * Allocators which are already freeing are skipped because they will complete by themselves.
+ */
+static struct Allocator_pvt* nextToFree(struct Allocator_pvt* top)
+{
+    struct Allocator_pvt* candidate = NULL;
+    struct Allocator_pvt* node = top->firstChild;
+    while (node) {
+        if (node->pub.isFreeing) {
+            node = node->nextSibling;
+        } else if (node->firstChild) {
+            candidate = node;
+            node = node->firstChild;
+        } else {
+            return node;
+        }
+    }
+    return candidate;
+}
+
+int Allocator__freeSome(struct Allocator* alloc, int maxAllocators, const char* file, int line)
+{
+    struct Allocator_pvt* context = Identity_cast((struct Allocator_pvt*) alloc);
+    if (context->adoptions && context->adoptions->parents) {
+        freeAllocator(context, file, line);
+        return 0;
+    }
+    for (int i = 0; i < maxAllocators; i++) {
+        struct Allocator_pvt* next = nextToFree(context);
+        if (!next) {
+            if (context->firstChild) {
+                // Everything which remains is waiting on an asynchronous onFree job.
+                return 1;
+            }
+            freeAllocator(context, file, line);
+            return 0;
+        }
+        freeAllocator(next, file, line);
+    }
+    return 1;
+}
+
 void* Allocator__malloc(struct Allocator* allocator,
                         unsigned long length,
                         const char* fileName,
                         int lineNum)
 {
     struct Allocator_pvt* ctx = Identity_cast((struct Allocator_pvt*) allocator);
+    if (ctx->scratchEnd) {
+        return scratchAllocation(ctx, length, fileName, lineNum);
+    }
     return newAllocation(ctx, length, fileName, lineNum);
 }
 
@@ -459,6 +642,9 @@ void* Allocator__realloc(struct Allocator* allocator,
     }
 
     struct Allocator_pvt* context = Identity_cast((struct Allocator_pvt*) allocator);
+    if (context->scratchEnd) {
+        return scratchReallocation(context, (void*) original, size, fileName, lineNum);
+    }
     struct Allocator_Allocation_pvt** locPtr = &context->allocations;
     struct Allocator_Allocation_pvt* origLoc =
         ((struct Allocator_Allocation_pvt*) original) - 1;
@@ -511,6 +697,7 @@ void* Allocator__realloc(struct Allocator* allocator,
         failure(context, "Out of memory, realloc() returned NULL.", fileName, lineNum);
     }
     alloc->next = nextLoc;
+    siteResized(context, &alloc->pub, alloc->pub.size, realSize);
     alloc->pub.size = realSize;
     *locPtr = alloc;
 
@@ -530,7 +717,11 @@ void* Allocator__clone(struct Allocator* allocator,
     return pointer;
 }
 
-struct Allocator* Allocator__child(struct Allocator* allocator, const char* file, int line)
+/** Create a child allocator with extraSize bytes of space directly after it. */
+static struct Allocator_pvt* newChild(struct Allocator* allocator,
+                                      unsigned long extraSize,
+                                      const char* file,
+                                      int line)
 {
     struct Allocator_pvt* parent = Identity_cast((struct Allocator_pvt*) allocator);
 
@@ -547,7 +738,7 @@ struct Allocator* Allocator__child(struct Allocator* allocator, const char* file
     #endif
 
     struct Allocator_pvt* child =
-        newAllocation(&stackChild, sizeof(struct Allocator_pvt), file, line);
+        newAllocation(&stackChild, sizeof(struct Allocator_pvt) + extraSize, file, line);
     Bits_memcpyConst(child, &stackChild, sizeof(struct Allocator_pvt));
 
     // Link the child into the parent's allocator list
@@ -558,6 +749,23 @@ struct Allocator* Allocator__child(struct Allocator* allocator, const char* file
     }
     parent->firstChild = child;
 
+    return child;
+}
+
+struct Allocator* Allocator__child(struct Allocator* allocator, const char* file, int line)
+{
+    return &newChild(allocator, 0, file, line)->pub;
+}
+
+struct Allocator* Allocator__scratch(struct Allocator* allocator,
+                                     unsigned long size,
+                                     const char* file,
+                                     int line)
+{
+    size = (size + (sizeof(char*) - 1)) & ~(sizeof(char*) - 1);
+    struct Allocator_pvt* child = newChild(allocator, size, file, line);
+    child->scratchPointer = (char*) &child[1];
+    child->scratchEnd = child->scratchPointer + size;
     return &child->pub;
 }
 
@@ -643,6 +851,9 @@ struct Allocator_OnFreeJob* Allocator__onFree(struct Allocator* alloc,
                                               int line)
 {
     struct Allocator_pvt* context = Identity_cast((struct Allocator_pvt*) alloc);
+    if (context->scratchEnd) {
+        failure(context, "Allocator_onFree() called on a scratch allocator.", file, line);
+    }
 
     struct Allocator_OnFreeJob_pvt* newJob =
         Allocator_clone(alloc, (&(struct Allocator_OnFreeJob_pvt) {
@@ -729,6 +940,30 @@ unsigned long Allocator_bytesAllocated(struct Allocator* allocator)
     return bytesAllocated(context);
 }
 
+void Allocator__trackSites(struct Allocator* alloc, const char* fileName, int lineNum)
+{
+    struct Allocator_pvt* context = Identity_cast((struct Allocator_pvt*) alloc);
+    struct Allocator_FirstCtx* root = context->rootAlloc;
+    if (root->siteTable) {
+        return;
+    }
+    // Allocated from the root so that it lives as long as the tree does.
+    struct Allocator_SiteTable* table =
+        newAllocation(&root->context, sizeof(struct Allocator_SiteTable), fileName, lineNum);
+    Bits_memset(table, 0, sizeof(struct Allocator_SiteTable));
+    root->siteTable = table;
+}
+
+struct Allocator_Site* Allocator_getSite(struct Allocator* alloc, int siteNum)
+{
+    struct Allocator_pvt* context = Identity_cast((struct Allocator_pvt*) alloc);
+    struct Allocator_SiteTable* table = context->rootAlloc->siteTable;
+    if (!table || siteNum < 0 || siteNum >= table->count) {
+        return NULL;
+    }
+    return &table->sites[siteNum];
+}
+
 void Allocator_setCanary(struct Allocator* alloc, unsigned long value)
 {
     #ifdef Allocator_USE_CANARIES
@@ -20,6 +20,8 @@
 #include "util/Linker.h"
 Linker_require("memory/Allocator.c")
 
+#include <stdint.h>
+
 /**
  * A handle which is provided in response to calls to Allocator_onFree().
  * This handle is sutable for use with Allocator_notOnFree() to cancel a job.
@@ -220,6 +222,33 @@ void* Allocator__clone(struct Allocator* allocator,
 struct Allocator* Allocator__child(struct Allocator* alloc, const char* fileName, int lineNum);
 #define Allocator_child(a) Allocator__child((a),Gcc_SHORT_FILE,Gcc_LINE)
 
+/**
+ * When a scratch allocator runs out of space, it takes a new chunk of at least this many bytes.
+ */
+#ifndef Allocator_SCRATCH_CHUNK
+    #define Allocator_SCRATCH_CHUNK 1024
+#endif
+
+/**
+ * Spawn a child allocator for short lived memory such as the processing of a single packet.
+ * The allocator and the first size bytes of space are taken in a single allocation
+ * then each allocation is cut from that space by bumping a pointer, if it is exhausted then
+ * another chunk is taken from the parent. Nothing is released until the allocator is freed and
+ * then it is all released at once, Allocator_realloc() only resizes in place if the allocation
+ * is the last one made. Each allocation takes its length rounded up to a multiple of the pointer
+ * size plus one word.
+ * A scratch allocator may have children and may be adopted but Allocator_onFree() cannot be used.
+ *
+ * @param alloc the parent allocator.
+ * @param size the amount of space to reserve up front.
+ * @return a scratch allocator.
+ */
+struct Allocator* Allocator__scratch(struct Allocator* alloc,
+                                     unsigned long size,
+                                     const char* fileName,
+                                     int lineNum);
+#define Allocator_scratch(a, s) Allocator__scratch((a),(s),Gcc_SHORT_FILE,Gcc_LINE)
+
 /**
  * Sever the link between an allocator and it's original parent.
  * If it has been adopted using Allocator_adopt() then the freeing of the allocator will be deferred
@@ -231,6 +260,20 @@ struct Allocator* Allocator__child(struct Allocator* alloc, const char* fileName
 void Allocator__free(struct Allocator* alloc, const char* file, int line);
 #define Allocator_free(a) Allocator__free((a),Gcc_SHORT_FILE,Gcc_LINE)
 
+/**
+ * Free part of an allocator's tree, this allows a large tree to be freed a little at a time.
+ * Each call frees at most maxAllocators of the allocators below alloc beginning with those
+ * with no children, once nothing is left, alloc itself is freed.
+ * NOTE: Unlike with Allocator_free(), the onFree jobs of alloc run after all of its children
+ *       have been freed. If alloc has been adopted, it is passed to Allocator_free() immediately.
+ *
+ * @param alloc the allocator to free, it must not be used for anything else once this is called.
+ * @param maxAllocators the greatest number of allocators to free in this call.
+ * @return 0 if alloc has been freed, otherwise this must be called again to finish.
+ */
+int Allocator__freeSome(struct Allocator* alloc, int maxAllocators, const char* file, int line);
+#define Allocator_freeSome(a, m) Allocator__freeSome((a),(m),Gcc_SHORT_FILE,Gcc_LINE)
+
 /**
  * Add a function to be called when the allocator is freed.
  *
@@ -307,6 +350,47 @@ void Allocator_setCanary(struct Allocator* alloc, unsigned long value);
  */
 unsigned long Allocator_bytesAllocated(struct Allocator* allocator);
 
+/** The maximum number of call sites which Allocator_trackSites() will keep statistics for. */
+#ifndef Allocator_SITES
+    #define Allocator_SITES 1024
+#endif
+
+/** Allocation statistics for one place in the code which calls the allocator. */
+struct Allocator_Site
+{
+    const char* fileName;
+
+    int lineNum;
+
+    /** The number of allocations from this site which have not yet been freed. */
+    unsigned long liveCount;
+
+    /** The number of bytes held by those allocations, including the allocator's overhead. */
+    unsigned long liveBytes;
+
+    /** The number of allocations which have ever been made from this site. */
+    uint64_t totalAllocations;
+};
+
+/**
+ * Begin keeping statistics per call site for every allocator which shares the same root as this
+ * one. Allocations which were made before this call are not counted and once Allocator_SITES
+ * different sites have been seen, new ones are ignored.
+ *
+ * @param alloc any allocator in the tree.
+ */
+void Allocator__trackSites(struct Allocator* alloc, const char* fileName, int lineNum);
+#define Allocator_trackSites(a) Allocator__trackSites((a),Gcc_SHORT_FILE,Gcc_LINE)
+
+/**
+ * Get the statistics for one of the call sites seen since Allocator_trackSites() was called.
+ *
+ * @param alloc any allocator in the tree.
+ * @param siteNum the number of the site.
+ * @return the site or NULL if siteNum is out of range or sites are not being tracked.
+ */
+struct Allocator_Site* Allocator_getSite(struct Allocator* alloc, int siteNum);
+
 
 /**
  * The underlying memory provider function which backs the allocator.
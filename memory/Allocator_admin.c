@@ -0,0 +1,119 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/String.h"
+#include "benc/Dict.h"
+#include "benc/Int.h"
+#include "benc/List.h"
+#include "memory/Allocator.h"
+#include "memory/Allocator_admin.h"
+
+struct Context
+{
+    struct Allocator* alloc;
+    struct Admin* admin;
+};
+
+static void trackSites(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    Allocator_trackSites(context->alloc);
+    Dict d = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST("none")), NULL);
+    Admin_sendMessage(&d, txid, context->admin);
+}
+
+#define Order_TYPE struct Allocator_Site
+#define Order_NAME byLiveBytes
+#define Order_COMPARE compareLiveBytes
+#include "util/Order.h"
+static inline int compareLiveBytes(const struct Allocator_Site* a, const struct Allocator_Site* b)
+{
+    // Largest first, then most frequently allocated.
+    if (a->liveBytes != b->liveBytes) {
+        return (a->liveBytes < b->liveBytes) ? 1 : -1;
+    }
+    if (a->totalAllocations != b->totalAllocations) {
+        return (a->totalAllocations < b->totalAllocations) ? 1 : -1;
+    }
+    return 0;
+}
+
+#define ENTRIES_PER_PAGE 64
+static void snapshot(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    int64_t* page = Dict_getInt(args, String_CONST("page"));
+    int skip = (page && *page > 0) ? *page * ENTRIES_PER_PAGE : 0;
+
+    if (!Allocator_getSite(context->alloc, 0)) {
+        Dict d = Dict_CONST(String_CONST("error"),
+            String_OBJ(String_CONST("not tracking, call Allocator_trackSites() first")), NULL);
+        Admin_sendMessage(&d, txid, context->admin);
+        return;
+    }
+
+    // Copy the sites out so they do not change under us as the response is built.
+    int count = 0;
+    while (Allocator_getSite(context->alloc, count)) {
+        count++;
+    }
+    struct Allocator_Site* sites =
+        Allocator_malloc(requestAlloc, count * sizeof(struct Allocator_Site));
+    for (int i = 0; i < count; i++) {
+        sites[i] = *Allocator_getSite(context->alloc, i);
+    }
+    Order_byLiveBytes_qsort(sites, count);
+
+    String* file = String_CONST("file");
+    String* line = String_CONST("line");
+    String* liveBytes = String_CONST("liveBytes");
+    String* liveCount = String_CONST("liveCount");
+    String* totalAllocations = String_CONST("totalAllocations");
+
+    List* list = NULL;
+    int end = (skip + ENTRIES_PER_PAGE < count) ? skip + ENTRIES_PER_PAGE : count;
+    // List_addDict() prepends so go backward to keep the order.
+    for (int i = end - 1; i >= skip; i--) {
+        Dict* d = Dict_new(requestAlloc);
+        Dict_putString(d, file, String_new(sites[i].fileName, requestAlloc), requestAlloc);
+        Dict_putInt(d, line, sites[i].lineNum, requestAlloc);
+        Dict_putInt(d, liveBytes, sites[i].liveBytes, requestAlloc);
+        Dict_putInt(d, liveCount, sites[i].liveCount, requestAlloc);
+        Dict_putInt(d, totalAllocations, sites[i].totalAllocations, requestAlloc);
+        list = List_addDict(list, d, requestAlloc);
+    }
+
+    Dict response = Dict_CONST(
+        String_CONST("bytes"), Int_OBJ(Allocator_bytesAllocated(context->alloc)), Dict_CONST(
+        String_CONST("sites"), List_OBJ(list), NULL
+    ));
+    Dict withMore = Dict_CONST(String_CONST("more"), Int_OBJ(1), response);
+    Admin_sendMessage((end < count) ? &withMore : &response, txid, context->admin);
+}
+
+void Allocator_admin_register(struct Allocator* alloc, struct Admin* admin)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .alloc = alloc,
+        .admin = admin
+    }));
+
+    Admin_registerFunction("Allocator_trackSites", trackSites, ctx, true, NULL, admin);
+
+    Admin_registerFunction("Allocator_snapshot", snapshot, ctx, false,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "page", .required = 0, .type = "Int" }
+        }), admin);
+}
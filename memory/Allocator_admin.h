@@ -12,32 +12,20 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-#ifndef NodeHeader_H
-#define NodeHeader_H
+#ifndef Allocator_admin_H
+#define Allocator_admin_H
 
-#include "util/Assert.h"
-
-#include <stdint.h>
+#include "admin/Admin.h"
+#include "memory/Allocator.h"
+#include "util/Linker.h"
+Linker_require("memory/Allocator_admin.c")
 
 /**
- * Information about a given node.
+ * Register Allocator_trackSites and Allocator_snapshot.
+ *
+ * @param alloc the allocator whose tree will be reported on, also used for the admin context.
+ * @param admin the admin interface.
  */
-struct NodeHeader
-{
-    /** The first 4 bytes of the node's address, swapped into host order for easy sorting. */
-    uint32_t addressPrefix;
-
-    /**
-     * Reach value for the node.
-     * See: Node.h
-     */
-    uint32_t reach;
-
-    /** The number interface of the next hop to get to this node. */
-    uint32_t switchIndex;
-
-    /** The protocol version of the node. */
-    uint32_t version;
-};
+void Allocator_admin_register(struct Allocator* alloc, struct Admin* admin);
 
 #endif
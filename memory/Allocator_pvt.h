@@ -101,6 +101,13 @@ struct Allocator_pvt
      */
     struct Allocator_Adoptions* adoptions;
 
+    /**
+     * If this allocator was created by Allocator_scratch(), the place where the next allocation
+     * will be made and the end of the chunk which it is being taken from, otherwise NULL.
+     */
+    char* scratchPointer;
+    char* scratchEnd;
+
     #ifdef Allocator_USE_CANARIES
         /** The canary for allocations made with this allocator constant to allow varification. */
         unsigned long canary;
@@ -113,6 +120,19 @@ struct Allocator_pvt
     Identity
 };
 
+/** Statistics collected by Allocator_trackSites(). */
+struct Allocator_SiteTable
+{
+    /** The sites in the order which they were first seen. */
+    struct Allocator_Site sites[Allocator_SITES];
+
+    /** The number of entries in sites which are used. */
+    int count;
+
+    /** Open addressed by line number, each entry is an index in sites plus one, 0 if empty. */
+    uint16_t index[Allocator_SITES * 2];
+};
+
 /** The first ("genesis") allocator, not a child of any other allocator. */
 struct Allocator_FirstCtx
 {
@@ -128,6 +148,9 @@ struct Allocator_FirstCtx
 
     /** The number of bytes which can be allocated total. */
     int64_t maxSpace;
+
+    /** Non-NULL if Allocator_trackSites() has been called. */
+    struct Allocator_SiteTable* siteTable;
 };
 
 #endif
@@ -0,0 +1,344 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+struct PoolAllocator_pvt;
+#define Allocator_Provider_CONTEXT_TYPE struct PoolAllocator_pvt
+#include "memory/PoolAllocator.h"
+#include "memory/Allocator_pvt.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+
+#include <stdlib.h>
+
+#ifndef win32
+    #include <sys/mman.h>
+#endif
+
+#if defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE)
+    #define HAS_HUGE_PAGES
+#endif
+
+/** Block sizes are rounded up to a multiple of this, it is also the alignment of each block. */
+#define GRANULE 64
+
+/** Number of different block sizes, one freelist is kept for each. */
+#define CLASSES ((PoolAllocator_MAX_BLOCK + GRANULE - 1) / GRANULE)
+
+/** Memory is requested from malloc() in slabs of this size which are then cut into blocks. */
+#define SLAB_SIZE (1<<16)
+
+#if PoolAllocator_MAX_BLOCK > SLAB_SIZE - GRANULE
+    #error PoolAllocator_MAX_BLOCK must fit in a slab
+#endif
+
+#if PoolAllocator_HUGE_PAGE_SIZE < 2 * SLAB_SIZE
+    #error PoolAllocator_HUGE_PAGE_SIZE must hold more than one slab
+#endif
+
+/** A free block, the link is stored in the block itself. */
+struct PoolAllocator_Block;
+struct PoolAllocator_Block {
+    struct PoolAllocator_Block* next;
+};
+
+/** The head of a slab, the blocks begin GRANULE bytes after it. */
+struct PoolAllocator_Slab;
+struct PoolAllocator_Slab {
+    struct PoolAllocator_Slab* next;
+};
+
+/**
+ * The head of a region of huge pages, slabs are cut from the rest of it.
+ * GRANULE bytes are kept for this so the slabs stay aligned.
+ */
+struct PoolAllocator_Region;
+struct PoolAllocator_Region {
+    struct PoolAllocator_Region* next;
+
+    /** True if the region was mapped with MAP_HUGETLB, otherwise it came from malloc. */
+    int hugeTlb;
+};
+
+struct PoolAllocator_pvt
+{
+    /** Free blocks of size (index + 1) * GRANULE. */
+    struct PoolAllocator_Block* freeLists[CLASSES];
+
+    /** Every slab which has been allocated, they are released only when the pool is. */
+    struct PoolAllocator_Slab* slabs;
+
+    /**
+     * Number of allocations which have been handed out and not yet released.
+     * The allocator itself lives in one of these so when this reaches zero, nothing
+     * can reference the pool anymore.
+     */
+    unsigned long outstanding;
+
+    /** Calls to malloc() and realloc(), see PoolAllocator_getStats(). */
+    uint64_t systemAllocations;
+
+    /** Non-zero after PoolAllocator_useHugePages(). */
+    int hugePages;
+
+    /** Every region of huge pages, they are released only when the pool is. */
+    struct PoolAllocator_Region* regions;
+
+    /** The part of the newest region which has not been cut into slabs yet. */
+    char* regionNext;
+    char* regionEnd;
+
+    uint64_t hugePageRegions;
+    uint64_t hugeTlbRegions;
+
+    Identity
+};
+
+static inline int sizeClass(unsigned long size)
+{
+    return (size - 1) / GRANULE;
+}
+
+static void destroy(struct PoolAllocator_pvt* ctx)
+{
+    struct PoolAllocator_Slab* slab = ctx->slabs;
+    while (slab) {
+        struct PoolAllocator_Slab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    struct PoolAllocator_Region* region = ctx->regions;
+    while (region) {
+        struct PoolAllocator_Region* next = region->next;
+        #ifdef MAP_HUGETLB
+            if (region->hugeTlb) {
+                munmap(region, PoolAllocator_HUGE_PAGE_SIZE);
+                region = next;
+                continue;
+            }
+        #endif
+        free(region);
+        region = next;
+    }
+    free(ctx);
+}
+
+/**
+ * Get memory aligned to a huge page and advise the kernel to back it with huge pages.
+ * The memory can be given to free() or realloc() like any other.
+ */
+static void* hugeMalloc(unsigned long size)
+{
+    #ifdef HAS_HUGE_PAGES
+        void* out = NULL;
+        if (posix_memalign(&out, PoolAllocator_HUGE_PAGE_SIZE, size)) {
+            return NULL;
+        }
+        #ifdef MADV_HUGEPAGE
+            // Only a hint, the memory is good either way.
+            madvise(out, size, MADV_HUGEPAGE);
+        #endif
+        return out;
+    #else
+        return malloc(size);
+    #endif
+}
+
+/** Map a new region of huge pages, return non-zero if there is no memory for one. */
+static int newRegion(struct PoolAllocator_pvt* ctx)
+{
+    struct PoolAllocator_Region* region = NULL;
+    ctx->systemAllocations++;
+    #ifdef MAP_HUGETLB
+        void* mapped = mmap(NULL, PoolAllocator_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapped != MAP_FAILED) {
+            region = mapped;
+            region->hugeTlb = 1;
+            ctx->hugeTlbRegions++;
+        }
+    #endif
+    if (!region) {
+        // No huge pages were reserved, transparent ones are the next best thing.
+        region = hugeMalloc(PoolAllocator_HUGE_PAGE_SIZE);
+        if (!region) {
+            return -1;
+        }
+        region->hugeTlb = 0;
+    }
+    region->next = ctx->regions;
+    ctx->regions = region;
+    ctx->hugePageRegions++;
+    ctx->regionNext = ((char*) region) + GRANULE;
+    ctx->regionEnd = ((char*) region) + PoolAllocator_HUGE_PAGE_SIZE;
+    return 0;
+}
+
+/** Get the memory for a slab, return NULL if there is none. */
+static char* newSlab(struct PoolAllocator_pvt* ctx)
+{
+    if (ctx->hugePages) {
+        if (ctx->regionEnd - ctx->regionNext < SLAB_SIZE && newRegion(ctx)) {
+            return NULL;
+        }
+        char* out = ctx->regionNext;
+        ctx->regionNext += SLAB_SIZE;
+        return out;
+    }
+    struct PoolAllocator_Slab* slab = malloc(SLAB_SIZE);
+    ctx->systemAllocations++;
+    if (!slab) {
+        return NULL;
+    }
+    slab->next = ctx->slabs;
+    ctx->slabs = slab;
+    return (char*) slab;
+}
+
+/** Get memory for an allocation which is too big for the pool. */
+static void* bigMalloc(struct PoolAllocator_pvt* ctx, unsigned long size)
+{
+    ctx->systemAllocations++;
+    if (ctx->hugePages && size >= PoolAllocator_HUGE_PAGE_SIZE) {
+        return hugeMalloc(size);
+    }
+    return malloc(size);
+}
+
+/** Cut a new slab into blocks for the given size class, return non-zero if there is no memory. */
+static int refill(struct PoolAllocator_pvt* ctx, int sc)
+{
+    char* slab = newSlab(ctx);
+    if (!slab) {
+        return -1;
+    }
+
+    unsigned long blockSize = (sc + 1) * GRANULE;
+    // Slabs from malloc() keep their list link in the first GRANULE, the others keep it clear.
+    char* block = slab + GRANULE;
+    char* end = slab + SLAB_SIZE;
+    for (; block + blockSize <= end; block += blockSize) {
+        struct PoolAllocator_Block* b = (struct PoolAllocator_Block*) block;
+        b->next = ctx->freeLists[sc];
+        ctx->freeLists[sc] = b;
+    }
+    return 0;
+}
+
+static void* getBlock(struct PoolAllocator_pvt* ctx, unsigned long size)
+{
+    if (size > PoolAllocator_MAX_BLOCK) {
+        return bigMalloc(ctx, size);
+    }
+    int sc = sizeClass(size);
+    if (!ctx->freeLists[sc] && refill(ctx, sc)) {
+        return NULL;
+    }
+    struct PoolAllocator_Block* block = ctx->freeLists[sc];
+    ctx->freeLists[sc] = block->next;
+    return block;
+}
+
+static void putBlock(struct PoolAllocator_pvt* ctx, void* memory, unsigned long size)
+{
+    if (size > PoolAllocator_MAX_BLOCK) {
+        free(memory);
+        return;
+    }
+    int sc = sizeClass(size);
+    struct PoolAllocator_Block* block = memory;
+    block->next = ctx->freeLists[sc];
+    ctx->freeLists[sc] = block;
+}
+
+static void* provideMemory(struct PoolAllocator_pvt* ctx,
+                           struct Allocator_Allocation* original,
+                           unsigned long size,
+                           struct Allocator* group)
+{
+    Identity_check(ctx);
+
+    if (original == NULL) {
+        if (size == 0) {
+            return NULL;
+        }
+        void* out = getBlock(ctx, size);
+        if (out) {
+            ctx->outstanding++;
+        }
+        return out;
+    }
+
+    if (size == 0) {
+        putBlock(ctx, original, original->size);
+        if (!--ctx->outstanding) {
+            destroy(ctx);
+        }
+        return NULL;
+    }
+
+    // Allocator sets original->size to the real size of the allocation so it tells us
+    // which freelist the block came from.
+    unsigned long oldSize = original->size;
+    if (oldSize > PoolAllocator_MAX_BLOCK && size > PoolAllocator_MAX_BLOCK
+        && (!ctx->hugePages || size < PoolAllocator_HUGE_PAGE_SIZE))
+    {
+        ctx->systemAllocations++;
+        return realloc(original, size);
+    }
+    if (oldSize <= PoolAllocator_MAX_BLOCK && size <= PoolAllocator_MAX_BLOCK
+        && sizeClass(oldSize) == sizeClass(size))
+    {
+        return original;
+    }
+    void* out = getBlock(ctx, size);
+    if (out) {
+        Bits_memcpy(out, original, (oldSize < size) ? oldSize : size);
+        putBlock(ctx, original, oldSize);
+    }
+    return out;
+}
+
+struct Allocator* PoolAllocator__new(unsigned long sizeLimit, const char* file, int line)
+{
+    struct PoolAllocator_pvt* ctx = calloc(sizeof(struct PoolAllocator_pvt), 1);
+    Identity_set(ctx);
+    return Allocator_new(sizeLimit, provideMemory, ctx, file, line);
+}
+
+void PoolAllocator_getStats(struct Allocator* alloc, struct PoolAllocator_Stats* out)
+{
+    // The identity of an Allocator_pvt can only be checked in Allocator.c.
+    struct Allocator_pvt* context = (struct Allocator_pvt*) alloc;
+    Assert_true(context->rootAlloc->provider == provideMemory);
+    struct PoolAllocator_pvt* ctx = Identity_cast(context->rootAlloc->providerContext);
+    out->systemAllocations = ctx->systemAllocations;
+    out->outstanding = ctx->outstanding;
+    out->hugePageRegions = ctx->hugePageRegions;
+    out->hugeTlbRegions = ctx->hugeTlbRegions;
+}
+
+int PoolAllocator_useHugePages(struct Allocator* alloc)
+{
+    struct Allocator_pvt* context = (struct Allocator_pvt*) alloc;
+    if (context->rootAlloc->provider != provideMemory) {
+        return -1;
+    }
+    struct PoolAllocator_pvt* ctx = Identity_cast(context->rootAlloc->providerContext);
+    #ifndef HAS_HUGE_PAGES
+        return -1;
+    #endif
+    ctx->hugePages = 1;
+    return 0;
+}
@@ -0,0 +1,99 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PoolAllocator_H
+#define PoolAllocator_H
+
+#include "memory/Allocator.h"
+#include "util/Gcc.h"
+#include "util/Linker.h"
+Linker_require("memory/PoolAllocator.c")
+
+#include <stdint.h>
+
+/**
+ * Allocations up to this size are served from fixed size blocks which are carved out of
+ * larger slabs and kept on a freelist when they are released, larger allocations go to malloc().
+ * The default is large enough to cover a full packet buffer with its padding.
+ */
+#ifndef PoolAllocator_MAX_BLOCK
+    #define PoolAllocator_MAX_BLOCK 8192
+#endif
+
+/**
+ * Create a new Allocator which recycles memory rather than returning it to malloc().
+ * This is intended for trees which create and free a child for every packet, once the pool
+ * has warmed up, creating a child, allocating a message and freeing it all again will not
+ * touch malloc() at all.
+ * Memory taken from the system is kept by the pool until the allocator and every allocator
+ * which was created from it has been freed.
+ *
+ * @param sizeLimit the number of bytes which are allowed to be allocated by
+ *                  this allocator or any of its children before the program
+ *                  will be halted with an error.
+ */
+struct Allocator* PoolAllocator__new(unsigned long sizeLimit, const char* file, int line);
+#define PoolAllocator_new(sl) PoolAllocator__new((sl),Gcc_SHORT_FILE,Gcc_LINE)
+
+/**
+ * The size of a huge page and of each region which PoolAllocator_useHugePages() maps,
+ * slabs are cut from these regions and allocations of at least this size are aligned to it.
+ */
+#ifndef PoolAllocator_HUGE_PAGE_SIZE
+    #define PoolAllocator_HUGE_PAGE_SIZE (1<<21)
+#endif
+
+/** What a pool has taken from the system, see PoolAllocator_getStats(). */
+struct PoolAllocator_Stats
+{
+    /** Calls to malloc() and realloc(), one for each new slab and each oversized allocation. */
+    uint64_t systemAllocations;
+
+    /** Allocations which have been handed out by the pool and not yet released. */
+    uint64_t outstanding;
+
+    /** Regions which were mapped for slabs since PoolAllocator_useHugePages(). */
+    uint64_t hugePageRegions;
+
+    /** How many of those regions are backed by reserved huge pages rather than advised ones. */
+    uint64_t hugeTlbRegions;
+};
+
+/**
+ * Get the statistics of the pool behind an allocator.
+ * Comparing them before and after a packet tells whether handling the packet went to malloc()
+ * or kept memory which it did not give back.
+ *
+ * @param alloc any allocator in a tree which was created by PoolAllocator_new().
+ * @param out filled in with the statistics.
+ */
+void PoolAllocator_getStats(struct Allocator* alloc, struct PoolAllocator_Stats* out);
+
+/**
+ * Back the memory which the pool takes from the system from now on with huge pages so that
+ * long lived tables and packet buffers need fewer TLB entries.
+ * Slabs are cut from regions of PoolAllocator_HUGE_PAGE_SIZE which are mapped from the
+ * reserved huge pages if there are any (MAP_HUGETLB) or else advised for transparent huge
+ * pages (MADV_HUGEPAGE). Allocations too big for the pool are aligned to a huge page and
+ * advised the same way if they are at least one huge page in size.
+ * Each region is only released with the pool so this is meant for the long lived pool of a
+ * router rather than for small devices.
+ *
+ * @param alloc any allocator.
+ * @return 0 if huge pages may be used, -1 if neither kind is supported here or if the tree
+ *         of alloc was not created by PoolAllocator_new().
+ */
+int PoolAllocator_useHugePages(struct Allocator* alloc);
+
+#endif
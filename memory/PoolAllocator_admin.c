@@ -0,0 +1,52 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "memory/Allocator.h"
+#include "memory/PoolAllocator.h"
+#include "memory/PoolAllocator_admin.h"
+#include "util/log/Log.h"
+
+struct Context
+{
+    struct Allocator* alloc;
+    struct Log* logger;
+    struct Admin* admin;
+};
+
+static void useHugePages(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    char* err = "none";
+    if (PoolAllocator_useHugePages(ctx->alloc)) {
+        err = "huge pages are not supported here";
+    } else {
+        Log_info(ctx->logger, "Using huge pages for memory taken from now on");
+    }
+    Dict out = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(err)), NULL);
+    Admin_sendMessage(&out, txid, ctx->admin);
+}
+
+void PoolAllocator_admin_register(struct Allocator* alloc, struct Log* logger, struct Admin* admin)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .alloc = alloc,
+        .logger = logger,
+        .admin = admin
+    }));
+
+    Admin_registerFunction("PoolAllocator_useHugePages", useHugePages, ctx, true, NULL, admin);
+}
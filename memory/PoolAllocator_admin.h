@@ -0,0 +1,33 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PoolAllocator_admin_H
+#define PoolAllocator_admin_H
+
+#include "admin/Admin.h"
+#include "memory/Allocator.h"
+#include "util/log/Log.h"
+#include "util/Linker.h"
+Linker_require("memory/PoolAllocator_admin.c")
+
+/**
+ * Register PoolAllocator_useHugePages.
+ *
+ * @param alloc the allocator whose pool will use huge pages, also used for the admin context.
+ * @param logger the logger.
+ * @param admin the admin interface.
+ */
+void PoolAllocator_admin_register(struct Allocator* alloc, struct Log* logger, struct Admin* admin);
+
+#endif
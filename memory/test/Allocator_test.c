@@ -12,6 +12,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define string_strcmp
 #include "util/Assert.h"
 #include "util/platform/libc/string.h"
 #include <stdint.h>
@@ -20,6 +21,7 @@
 #include "memory/Allocator.h"
 #include "memory/Allocator_pvt.h"
 #include "memory/MallocAllocator.h"
+#include "util/Bits.h"
 
 #ifdef Allocator_USE_CANARIES
     #define ALLOCATION_SIZE sizeof(struct Allocator_Allocation_pvt) + sizeof(long)
@@ -28,8 +30,126 @@
 #endif
 #define ALLOCATOR_SIZE sizeof(struct Allocator_pvt)
 
+static void scratch()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Allocator* sa = Allocator_scratch(alloc, 256);
+
+    // The first allocations come out of the inline space, one after another.
+    uint8_t* a = Allocator_malloc(sa, 16);
+    uint8_t* b = Allocator_malloc(sa, 16);
+    Assert_always(b == a + 16 + sizeof(unsigned long));
+    Assert_always(Allocator_getAllocation(sa, 1) == NULL);
+
+    // The last allocation grows in place, others are copied.
+    for (int i = 0; i < 16; i++) {
+        a[i] = b[i] = i;
+    }
+    Assert_always(Allocator_realloc(sa, b, 64) == b);
+    a = Allocator_realloc(sa, a, 32);
+    Assert_always(a != b);
+    for (int i = 0; i < 16; i++) {
+        Assert_always(a[i] == i && b[i] == i);
+    }
+
+    // Going beyond the inline space takes a new chunk.
+    uint8_t* big = Allocator_malloc(sa, 4000);
+    Bits_memset(big, 0, 4000);
+    Assert_always(Allocator_getAllocation(sa, 1) != NULL);
+
+    // Children and adoption work as normal.
+    struct Allocator* child = Allocator_child(sa);
+    Allocator_malloc(child, 100);
+    struct Allocator* adopter = Allocator_child(alloc);
+    Allocator_adopt(adopter, sa);
+    Allocator_free(sa);
+    Allocator_free(adopter);
+
+    Allocator_free(alloc);
+}
+
+static void sites()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    Assert_always(Allocator_getSite(alloc, 0) == NULL);
+    Allocator_trackSites(alloc);
+
+    struct Allocator* child = Allocator_child(alloc);
+    for (int i = 0; i < 3; i++) {
+        Allocator_malloc(child, 100);
+    }
+    void* big = Allocator_malloc(child, 1000);
+
+    struct Allocator_Site* loop = NULL;
+    struct Allocator_Site* bigSite = NULL;
+    for (int i = 0; Allocator_getSite(alloc, i); i++) {
+        struct Allocator_Site* site = Allocator_getSite(alloc, i);
+        Assert_always(!strcmp(site->fileName, Gcc_SHORT_FILE));
+        if (site->totalAllocations == 3) {
+            loop = site;
+        } else if (site->liveBytes > 1000 && site->liveBytes < 1000 + ALLOCATION_SIZE + 8) {
+            bigSite = site;
+        }
+    }
+    Assert_always(loop && loop->liveCount == 3);
+    Assert_always(bigSite && bigSite->liveCount == 1);
+
+    unsigned long before = bigSite->liveBytes;
+    big = Allocator_realloc(child, big, 2000);
+    Assert_always(bigSite->liveBytes == before + 1000);
+    Assert_always(bigSite->liveCount == 1 && bigSite->totalAllocations == 1);
+
+    Allocator_free(child);
+    Assert_always(loop->liveCount == 0 && loop->liveBytes == 0 && loop->totalAllocations == 3);
+    Assert_always(bigSite->liveCount == 0 && bigSite->liveBytes == 0);
+
+    Allocator_free(alloc);
+}
+
+static int onFreeCalled(struct Allocator_OnFreeJob* job)
+{
+    int* called = job->userData;
+    (*called)++;
+    return 0;
+}
+
+static void freeSome()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    unsigned long before = Allocator_bytesAllocated(alloc);
+
+    struct Allocator* big = Allocator_child(alloc);
+    int called = 0;
+    Allocator_onFree(big, onFreeCalled, &called);
+    for (int i = 0; i < 50; i++) {
+        struct Allocator* child = Allocator_child(big);
+        for (int j = 0; j < 3; j++) {
+            Allocator_malloc(Allocator_child(child), 8);
+        }
+    }
+
+    // 50 children with 3 children each and then the allocator itself.
+    int calls = 0;
+    unsigned long last = Allocator_bytesAllocated(alloc);
+    while (Allocator_freeSome(big, 10)) {
+        calls++;
+        Assert_always(!called);
+        Assert_always(Allocator_bytesAllocated(alloc) < last);
+        last = Allocator_bytesAllocated(alloc);
+    }
+    Assert_always(calls == 20);
+    Assert_always(called == 1);
+    Assert_always(Allocator_bytesAllocated(alloc) == before);
+
+    Allocator_free(alloc);
+}
+
 int main()
 {
+    scratch();
+    sites();
+    freeSome();
+
     struct Allocator* alloc = MallocAllocator_new(2048);
     size_t bytesUsed;
 
@@ -0,0 +1,117 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/PoolAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#include <stdint.h>
+
+/** Freeing a child and creating another should hand back the same memory. */
+static void reuse(struct Allocator* alloc)
+{
+    struct Allocator* child = Allocator_child(alloc);
+    uint8_t* buff = Allocator_malloc(child, 2000);
+    Allocator_free(child);
+
+    child = Allocator_child(alloc);
+    uint8_t* buff2 = Allocator_malloc(child, 2000);
+    Assert_always(buff == buff2);
+    Allocator_free(child);
+}
+
+/** Growing and shrinking an allocation must keep its content. */
+static void resize(struct Allocator* alloc)
+{
+    struct Allocator* child = Allocator_child(alloc);
+    uint8_t* buff = Allocator_malloc(child, 16);
+    for (int i = 0; i < 16; i++) {
+        buff[i] = i;
+    }
+    buff = Allocator_realloc(child, buff, 30);
+    buff = Allocator_realloc(child, buff, 5000);
+    buff = Allocator_realloc(child, buff, PoolAllocator_MAX_BLOCK * 2);
+    buff = Allocator_realloc(child, buff, PoolAllocator_MAX_BLOCK * 3);
+    buff = Allocator_realloc(child, buff, 100);
+    for (int i = 0; i < 16; i++) {
+        Assert_always(buff[i] == i);
+    }
+    Allocator_free(child);
+}
+
+/** Many allocations of mixed sizes must not overlap. */
+static void noOverlap(struct Allocator* alloc)
+{
+    #define COUNT 512
+    struct Allocator* child = Allocator_child(alloc);
+    uint8_t* buffs[COUNT];
+    for (int i = 0; i < COUNT; i++) {
+        uint32_t size = 1 + (i * 37) % (PoolAllocator_MAX_BLOCK + 2000);
+        buffs[i] = Allocator_malloc(child, size);
+        Bits_memset(buffs[i], i & 0xff, size);
+    }
+    for (int i = 0; i < COUNT; i++) {
+        uint32_t size = 1 + (i * 37) % (PoolAllocator_MAX_BLOCK + 2000);
+        for (uint32_t j = 0; j < size; j++) {
+            Assert_always(buffs[i][j] == (i & 0xff));
+        }
+    }
+    Allocator_free(child);
+    #undef COUNT
+}
+
+/** A pool on huge pages must behave the same and big allocations must keep their content. */
+static void hugePages()
+{
+    struct Allocator* alloc = PoolAllocator_new(1<<26);
+    if (PoolAllocator_useHugePages(alloc)) {
+        Allocator_free(alloc);
+        return;
+    }
+    reuse(alloc);
+    resize(alloc);
+    noOverlap(alloc);
+
+    struct Allocator* child = Allocator_child(alloc);
+    uint8_t* big = Allocator_malloc(child, PoolAllocator_HUGE_PAGE_SIZE);
+    Bits_memset(big, 0xaa, PoolAllocator_HUGE_PAGE_SIZE);
+    big = Allocator_realloc(child, big, PoolAllocator_HUGE_PAGE_SIZE * 2);
+    big = Allocator_realloc(child, big, PoolAllocator_MAX_BLOCK * 2);
+    for (int i = 0; i < PoolAllocator_MAX_BLOCK * 2; i++) {
+        Assert_always(big[i] == 0xaa);
+    }
+
+    struct PoolAllocator_Stats stats;
+    PoolAllocator_getStats(alloc, &stats);
+    Assert_always(stats.hugePageRegions > 0);
+    Assert_always(stats.hugeTlbRegions <= stats.hugePageRegions);
+
+    Allocator_free(alloc);
+}
+
+int main()
+{
+    struct Allocator* alloc = PoolAllocator_new(1<<24);
+
+    reuse(alloc);
+    resize(alloc);
+    noOverlap(alloc);
+
+    Allocator_free(alloc);
+
+    hugePages();
+
+    return 0;
+}
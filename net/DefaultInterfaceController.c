@@ -14,9 +14,13 @@
  */
 #include "crypto/AddressCalc.h"
 #include "crypto/CryptoAuth_pvt.h"
+#include "interface/Coalescer.h"
+#include "interface/FairQueue.h"
+#include "interface/ParityInterface.h"
 #include "net/DefaultInterfaceController.h"
 #include "memory/Allocator.h"
 #include "net/SwitchPinger.h"
+#include "switch/SwitchCore.h"
 #include "util/Base32.h"
 #include "util/Bits.h"
 #include "util/events/Time.h"
@@ -40,6 +44,9 @@
 /** How often to ping "lazy" peers, "unresponsive" peers are only pinged 20% of the time. */
 #define PING_INTERVAL_MILLISECONDS 1024
 
+/** The number of milliseconds over which the rate of traffic and lost packets is measured. */
+#define RATE_WINDOW_MILLISECONDS (4*1024)
+
 /** The number of milliseconds to wait for a ping response. */
 #define TIMEOUT_MILLISECONDS (2*1024)
 
@@ -49,8 +56,40 @@
  */
 #define FORGET_AFTER_MILLISECONDS (256*1024)
 
+/** The largest number of network interfaces which one peer can be reached through. */
+#define MAX_LINKS 4
+
+/** How often each link to a peer which has more than one is pinged. */
+#define LINK_PING_INTERVAL_MILLISECONDS (8*1024)
+
+/** A link is not used after this many of the pings sent over it in a row are lost. */
+#define LINK_MAX_LOST 2
+
+/** The largest number of peers whose messages are held for the end of a burst. */
+#define MAX_BURST_PEERS 16
+
 /*--------------------Structs--------------------*/
 
+/** One of the network interfaces through which a peer can be reached. */
+struct IFCLink
+{
+    /** The network side interface, this structure is allocated with it. */
+    struct Interface* external;
+
+    struct IFCPeer* peer;
+
+    /** Milliseconds since the epoch when anything was last received, only kept if multi-homed. */
+    uint64_t timeOfLastMessage;
+
+    /** Smoothed round trip time of the pings sent over this link, 0 if never measured. */
+    uint32_t rttMilliseconds;
+
+    /** The number of pings sent over this link in a row which were lost. */
+    uint32_t lostInARow;
+
+    Identity
+};
+
 struct IFCPeer
 {
     /** The interface which is registered with the switch. */
@@ -59,9 +98,43 @@ struct IFCPeer
     /** The internal (wrapped by CryptoAuth) interface. */
     struct Interface* cryptoAuthIf;
 
-    /** The external (network side) interface. */
+    /** Packets from the switch go through this to coalescer, queued while the link is full. */
+    struct FairQueue* queue;
+
+    /** Bundles small packets for cryptoAuthIf once the peer is known to be version 9 or higher. */
+    struct Coalescer* coalescer;
+
+    /** True if coalescing was switched on for this peer. */
+    bool coalesce;
+
+    /** The protocol version from the last switch pong, 0 until the peer has answered a ping. */
+    uint32_t version;
+
+    /** The external (network side) interface, this peer is allocated with it. */
     struct Interface* external;
 
+    /** The interface which is wrapped by ParityInterface, it sends over the current link. */
+    struct Interface linkIf;
+
+    /** Forward error correction between CryptoAuth and the links. */
+    struct ParityInterface* parity;
+
+    /**
+     * The network interfaces through which the peer can be reached, the first is for external,
+     * the others are added when the same key is registered on another interface.
+     */
+    struct IFCLink* links[MAX_LINKS];
+    uint32_t linkCount;
+
+    /** The index of the link which messages are sent over. */
+    uint32_t currentLink;
+
+    /** If nonzero, one more than the index of the link which the next message must go over. */
+    uint32_t forcedLink;
+
+    /** Fires when the links should be pinged, NULL until there is more than one. */
+    struct Timeout* linkTimer;
+
     /** The label for this endpoint, needed to ping the endpoint. */
     uint64_t switchLabel;
 
@@ -71,6 +144,12 @@ struct IFCPeer
     /** The handle which can be used to look up this endpoint in the endpoint set. */
     uint32_t handle;
 
+    /** Fires when this peer should next be checked, NULL if there is no pinger. */
+    struct Timeout* checkTimer;
+
+    /** A counter to allow for 7/8 of all pings to be skipped when a node is definitely down. */
+    uint32_t pingCount;
+
     /** True if we should forget about the peer if they do not respond. */
     bool isIncomingConnection : 1;
 
@@ -86,15 +165,57 @@ struct IFCPeer
     uint64_t bytesOut;
     uint64_t bytesIn;
 
+    /** Smoothed round trip time and its mean deviation from switch pings, see RFC-6298. */
+    uint32_t rttMilliseconds;
+    uint32_t rttVarianceMilliseconds;
+
+    /** The number of switch pings sent and the number of those which timed out. */
+    uint32_t pingsSent;
+    uint32_t pingsLost;
+
+    /** When the current rate window began and the counters as of then. */
+    uint64_t rateWindowStart;
+    uint64_t bytesInAtWindowStart;
+    uint64_t bytesOutAtWindowStart;
+    uint32_t lostPacketsAtWindowStart;
+
+    /** Measured over the last complete RATE_WINDOW_MILLISECONDS. */
+    uint32_t bytesInPerSecond;
+    uint32_t bytesOutPerSecond;
+    uint32_t recentLostPackets;
+
+    /** Between parity and CryptoAuth so that the messages of a burst can be held. */
+    struct Interface burstIf;
+
+    /** Messages which are held until the end of the burst, see beginBurst(). */
+    struct Message* cryptoBurst[CryptoAuth_BATCH_MAX];
+    int cryptoBurstCount;
+    struct Message* switchBurst[SwitchCore_BATCH_MAX];
+    int switchBurstCount;
+
+    /** True if the peer is in the list of those with messages held for the burst. */
+    bool inBurst;
+
     Identity
 };
 
+#define Map_USE_HASH
 #define Map_NAME OfIFCPeerByExernalIf
 #define Map_ENABLE_HANDLES
 #define Map_KEY_TYPE struct Interface*
 #define Map_VALUE_TYPE struct IFCPeer*
 #include "util/Map.h"
 
+/**
+ * The default hash is the last 4 bytes of the key which for a pointer on a 64 bit machine
+ * is the high half, the same for nearly every interface.
+ */
+static inline uint32_t Map_OfIFCPeerByExernalIf_hash(struct Interface** key)
+{
+    uint64_t ptr = (uintptr_t) *key;
+    return (uint32_t) (ptr >> 4) ^ (uint32_t) (ptr >> 32);
+}
+
 struct Context
 {
     /** Public functions and fields for this ifcontroller. */
@@ -129,18 +250,25 @@ struct Context
     /** After this number of milliseconds, an incoming connection is forgotten entirely. */
     uint32_t forgetAfterMilliseconds;
 
-    /** A counter to allow for 3/4 of all pings to be skipped when a node is definitely down. */
+    /** A counter to limit the number of pings sent to peers which are in handshake. */
     uint32_t pingCount;
 
-    /** The timeout event to use for pinging potentially unresponsive neighbors. */
-    struct Timeout* const pingInterval;
-
     /** For pinging lazy/unresponsive nodes. */
     struct SwitchPinger* const switchPinger;
 
     /** A password which is generated per-startup and sent out in beacon messages. */
     uint8_t beaconPassword[Headers_Beacon_PASSWORD_LEN];
 
+    /** Greater than zero while a network interface is handing over a burst of messages. */
+    int burstDepth;
+
+    /** Adopts the allocators of the messages which are held for the burst, NULL if none are. */
+    struct Allocator* burstAlloc;
+
+    /** Handles of the peers which have messages held for the burst. */
+    uint32_t burstPeers[MAX_BURST_PEERS];
+    int burstPeerCount;
+
     Identity
 };
 
@@ -151,6 +279,38 @@ static inline struct Context* ifcontrollerForPeer(struct IFCPeer* ep)
     return Identity_cast((struct Context*) ep->switchIf.senderContext);
 }
 
+/** Close the rate window if it has run its course and start a new one. */
+static inline void updateRates(struct IFCPeer* ep, uint64_t now)
+{
+    uint64_t elapsed = now - ep->rateWindowStart;
+    if (elapsed < RATE_WINDOW_MILLISECONDS) {
+        return;
+    }
+    uint32_t lostPackets = CryptoAuth_getReplayProtector(ep->cryptoAuthIf)->lostPackets;
+    ep->bytesInPerSecond = (ep->bytesIn - ep->bytesInAtWindowStart) * 1000 / elapsed;
+    ep->bytesOutPerSecond = (ep->bytesOut - ep->bytesOutAtWindowStart) * 1000 / elapsed;
+    ep->recentLostPackets = lostPackets - ep->lostPacketsAtWindowStart;
+
+    ep->rateWindowStart = now;
+    ep->bytesInAtWindowStart = ep->bytesIn;
+    ep->bytesOutAtWindowStart = ep->bytesOut;
+    ep->lostPacketsAtWindowStart = lostPackets;
+}
+
+static void updateRtt(struct IFCPeer* ep, uint32_t millisecondsLag)
+{
+    if (!ep->rttMilliseconds) {
+        ep->rttMilliseconds = millisecondsLag;
+        ep->rttVarianceMilliseconds = millisecondsLag / 2;
+        return;
+    }
+    uint32_t diff = (ep->rttMilliseconds > millisecondsLag)
+        ? ep->rttMilliseconds - millisecondsLag
+        : millisecondsLag - ep->rttMilliseconds;
+    ep->rttVarianceMilliseconds = (ep->rttVarianceMilliseconds * 3 + diff) / 4;
+    ep->rttMilliseconds = (ep->rttMilliseconds * 7 + millisecondsLag) / 8;
+}
+
 static void onPingResponse(enum SwitchPinger_Result result,
                            uint64_t label,
                            String* data,
@@ -158,17 +318,24 @@ static void onPingResponse(enum SwitchPinger_Result result,
                            uint32_t version,
                            void* onResponseContext)
 {
+    struct IFCPeer* ep = Identity_cast((struct IFCPeer*) onResponseContext);
+    if (SwitchPinger_Result_TIMEOUT == result) {
+        ep->pingsLost++;
+    }
     if (SwitchPinger_Result_OK != result) {
         return;
     }
-    struct IFCPeer* ep = Identity_cast((struct IFCPeer*) onResponseContext);
     struct Context* ic = ifcontrollerForPeer(ep);
+    // Never zero so that updateRtt() can tell a first sample.
+    updateRtt(ep, (millisecondsLag) ? millisecondsLag : 1);
 
     struct Address addr;
     Bits_memset(&addr, 0, sizeof(struct Address));
     Bits_memcpyConst(addr.key, CryptoAuth_getHerPublicKey(ep->cryptoAuthIf), 32);
     addr.path = ep->switchLabel;
     Log_debug(ic->logger, "got switch pong from node with version [%d]", version);
+    ep->version = version;
+    ep->coalescer->enabled = ep->coalesce && version >= 9;
     RouterModule_addNode(ic->routerModule, &addr, version);
 
     #ifdef Log_DEBUG
@@ -183,79 +350,94 @@ static void onPingResponse(enum SwitchPinger_Result result,
     #endif
 }
 
-// Called from the pingInteral timeout.
-static void pingCallback(void* vic)
+static void scheduleCheck(struct IFCPeer* ep, uint64_t milliseconds)
 {
-    struct Context* ic = Identity_cast((struct Context*) vic);
-    uint64_t now = Time_currentTimeMilliseconds(ic->eventBase);
-    ic->pingCount++;
-
-    // scan for endpoints have not sent anything recently.
-    for (uint32_t i = 0; i < ic->peerMap.count; i++) {
-        struct IFCPeer* ep = ic->peerMap.values[i];
+    if (ep->checkTimer) {
+        Timeout_resetTimeout(ep->checkTimer, milliseconds);
+    }
+}
 
-        // This is here because of a pathological state where the connection is in ESTABLISHED
-        // state but the *direct peer* has somehow been dropped from the routing table.
-        // TODO: understand the cause of this issue rather than checking for it once per second.
-        struct Node* peerNode = RouterModule_getNode(ep->switchLabel, ic->routerModule);
+static void pingPeer(struct IFCPeer* ep, struct Context* ic, uint64_t now, bool unresponsive)
+{
+    #ifdef Log_DEBUG
+          uint8_t key[56];
+          Base32_encode(key, 56, CryptoAuth_getHerPublicKey(ep->cryptoAuthIf), 32);
+    #endif
+    uint32_t lag = ((now - ep->timeOfLastMessage) / 1024);
+
+    struct SwitchPinger_Ping* ping =
+        SwitchPinger_newPing(ep->switchLabel,
+                             String_CONST(""),
+                             ic->timeoutMilliseconds,
+                             onPingResponse,
+                             ic->allocator,
+                             ic->switchPinger);
+
+    if (!ping) {
+        Log_debug(ic->logger,
+                  "Failed to ping %s peer [%s.k] lag [%u], out of ping slots.",
+                  (unresponsive ? "unresponsive" : "lazy"), key, lag);
+        return;
+    }
 
-        if (now > ep->timeOfLastMessage + ic->pingAfterMilliseconds || !peerNode) {
-            #ifdef Log_DEBUG
-                  uint8_t key[56];
-                  Base32_encode(key, 56, CryptoAuth_getHerPublicKey(ep->cryptoAuthIf), 32);
-            #endif
+    ping->onResponseContext = ep;
 
-            if (ep->isIncomingConnection
-                && now > ep->timeOfLastMessage + ic->forgetAfterMilliseconds)
-            {
-                Log_debug(ic->logger, "Unresponsive peer [%s.k] has not responded in [%u] "
-                                      "seconds, dropping connection",
-                                      key, ic->forgetAfterMilliseconds / 1024);
-                Allocator_free(ep->external->allocator);
-                return;
-            }
+    SwitchPinger_sendPing(ping);
+    ep->pingsSent++;
 
-            bool unresponsive = (now > ep->timeOfLastMessage + ic->unresponsiveAfterMilliseconds);
-            uint32_t lag = ~0u;
-            if (unresponsive) {
-                // flush the peer from the table...
-                RouterModule_brokenPath(ep->switchLabel, ic->routerModule);
+    Log_debug(ic->logger,
+              "Pinging %s peer [%s.k] lag [%u]",
+              (unresponsive ? "unresponsive" : "lazy"), key, lag);
+}
 
-                // Lets skip 87% of pings when they're really down.
-                if (ic->pingCount % 8) {
-                    continue;
-                }
+/**
+ * Called from the peer's check timer, a peer which has sent something recently is not
+ * looked at again until it would become lazy, otherwise it is checked every PING_INTERVAL.
+ */
+static void checkPeer(void* vep)
+{
+    struct IFCPeer* ep = Identity_cast((struct IFCPeer*) vep);
+    struct Context* ic = ifcontrollerForPeer(ep);
+    uint64_t now = Time_currentTimeMilliseconds(ic->eventBase);
 
-                ep->state = InterfaceController_PeerState_UNRESPONSIVE;
-                lag = ((now - ep->timeOfLastMessage) / 1024);
-            } else {
-                lag = ((now - ep->timeOfLastMessage) / 1024);
-            }
+    // This is here because of a pathological state where the connection is in ESTABLISHED
+    // state but the *direct peer* has somehow been dropped from the routing table.
+    // TODO: understand the cause of this issue rather than checking for it on every check.
+    struct Node* peerNode = RouterModule_getNode(ep->switchLabel, ic->routerModule);
 
-            struct SwitchPinger_Ping* ping =
-                SwitchPinger_newPing(ep->switchLabel,
-                                     String_CONST(""),
-                                     ic->timeoutMilliseconds,
-                                     onPingResponse,
-                                     ic->allocator,
-                                     ic->switchPinger);
-
-            if (!ping) {
-                Log_debug(ic->logger,
-                          "Failed to ping %s peer [%s.k] lag [%u], out of ping slots.",
-                          (unresponsive ? "unresponsive" : "lazy"), key, lag);
-                return;
-            }
+    uint64_t lazyAfter = ep->timeOfLastMessage + ic->pingAfterMilliseconds;
+    if (now <= lazyAfter && peerNode) {
+        scheduleCheck(ep, lazyAfter - now + 1);
+        return;
+    }
+    scheduleCheck(ep, PING_INTERVAL_MILLISECONDS);
 
-            ping->onResponseContext = ep;
+    if (ep->isIncomingConnection && now > ep->timeOfLastMessage + ic->forgetAfterMilliseconds) {
+        #ifdef Log_DEBUG
+              uint8_t key[56];
+              Base32_encode(key, 56, CryptoAuth_getHerPublicKey(ep->cryptoAuthIf), 32);
+        #endif
+        Log_debug(ic->logger, "Unresponsive peer [%s.k] has not responded in [%u] "
+                              "seconds, dropping connection",
+                              key, ic->forgetAfterMilliseconds / 1024);
+        Allocator_free(ep->external->allocator);
+        return;
+    }
 
-            SwitchPinger_sendPing(ping);
+    bool unresponsive = (now > ep->timeOfLastMessage + ic->unresponsiveAfterMilliseconds);
+    if (unresponsive) {
+        // flush the peer from the table...
+        RouterModule_brokenPath(ep->switchLabel, ic->routerModule);
 
-            Log_debug(ic->logger,
-                      "Pinging %s peer [%s.k] lag [%u]",
-                      (unresponsive ? "unresponsive" : "lazy"), key, lag);
+        // Lets skip 87% of pings when they're really down.
+        if (ep->pingCount++ % 8) {
+            return;
         }
+
+        ep->state = InterfaceController_PeerState_UNRESPONSIVE;
     }
+
+    pingPeer(ep, ic, now, unresponsive);
 }
 
 /** If there's already an endpoint with the same public key, merge the new one with the old one. */
@@ -278,11 +460,102 @@ static void moveEndpointIfNeeded(struct IFCPeer* ep, struct Context* ic)
     }
 }
 
+/**
+ * Keep a message and list its peer until the end of the burst.
+ *
+ * @return false if there is no burst or no room and the message must be handled right away.
+ */
+static bool holdForBurst(struct IFCPeer* ep, struct Message* msg, struct Context* ic)
+{
+    if (!ic->burstDepth || !msg->alloc) {
+        return false;
+    }
+    if (!ep->inBurst) {
+        if (ic->burstPeerCount == MAX_BURST_PEERS) {
+            return false;
+        }
+        ic->burstPeers[ic->burstPeerCount++] = ep->handle;
+        ep->inBurst = true;
+    }
+    if (!ic->burstAlloc) {
+        ic->burstAlloc = Allocator_child(ic->allocator);
+    }
+    // Whoever handed the message in may free it as soon as this returns.
+    Allocator_adopt(ic->burstAlloc, msg->alloc);
+    return true;
+}
+
+static void flushSwitchBurst(struct IFCPeer* ep)
+{
+    // Switching may bring in more from the same peer so the held ones are taken out first.
+    struct Message* msgs[SwitchCore_BATCH_MAX];
+    int count = ep->switchBurstCount;
+    Bits_memcpy(msgs, ep->switchBurst, count * sizeof(struct Message*));
+    ep->switchBurstCount = 0;
+    SwitchCore_receiveBatch(msgs, count, &ep->switchIf);
+}
+
+/** Hold a message so that it is switched together with the others from the same peer. */
+static bool holdForSwitch(struct IFCPeer* ep, struct Message* msg, struct Context* ic)
+{
+    if (!holdForBurst(ep, msg, ic)) {
+        // Everything before it goes first.
+        flushSwitchBurst(ep);
+        return false;
+    }
+    ep->switchBurst[ep->switchBurstCount++] = msg;
+    if (ep->switchBurstCount == SwitchCore_BATCH_MAX) {
+        flushSwitchBurst(ep);
+    }
+    return true;
+}
+
+static void flushCryptoBurst(struct IFCPeer* ep)
+{
+    int count = ep->cryptoBurstCount;
+    if (!count) {
+        return;
+    }
+    // Like flushSwitchBurst(), decrypting may bring in more from the same peer.
+    struct Message* msgs[CryptoAuth_BATCH_MAX];
+    Bits_memcpy(msgs, ep->cryptoBurst, count * sizeof(struct Message*));
+    ep->cryptoBurstCount = 0;
+    CryptoAuth_receiveBatch(msgs, count, &ep->burstIf);
+}
+
+/**
+ * Incoming message from the parity interface, once the session is established the messages of
+ * a burst are held so that they are decrypted together.
+ */
+static uint8_t receivedFromParity(struct Message* msg, struct Interface* parityIf)
+{
+    struct IFCPeer* ep = Identity_cast((struct IFCPeer*) parityIf->receiverContext);
+    struct Context* ic = ifcontrollerForPeer(ep);
+    if (CryptoAuth_getState(ep->cryptoAuthIf) != CryptoAuth_ESTABLISHED
+        || !holdForBurst(ep, msg, ic))
+    {
+        flushCryptoBurst(ep);
+        return Interface_receiveMessage(&ep->burstIf, msg);
+    }
+    ep->cryptoBurst[ep->cryptoBurstCount++] = msg;
+    if (ep->cryptoBurstCount == CryptoAuth_BATCH_MAX) {
+        flushCryptoBurst(ep);
+    }
+    return Error_NONE;
+}
+
+static uint8_t sendToParity(struct Message* msg, struct Interface* burstIf)
+{
+    struct IFCPeer* ep = Identity_cast((struct IFCPeer*) burstIf->senderContext);
+    return Interface_sendMessage(&ep->parity->generic, msg);
+}
+
 // Incoming message which has passed through the cryptoauth and needs to be forwarded to the switch.
-static uint8_t receivedAfterCryptoAuth(struct Message* msg, struct Interface* cryptoAuthIf)
+static uint8_t receivedAfterCryptoAuth(struct Message* msg, struct Interface* coalescerIf)
 {
-    struct IFCPeer* ep = Identity_cast((struct IFCPeer*) cryptoAuthIf->receiverContext);
+    struct IFCPeer* ep = Identity_cast((struct IFCPeer*) coalescerIf->receiverContext);
     struct Context* ic = ifcontrollerForPeer(ep);
+    struct Interface* cryptoAuthIf = ep->cryptoAuthIf;
 
     ep->bytesIn += msg->length;
 
@@ -309,8 +582,8 @@ static uint8_t receivedAfterCryptoAuth(struct Message* msg, struct Interface* cr
                 // prevent DoS by limiting the number of times this can be called per second
                 // limit it to 7, this will affect innocent packets but it doesn't matter much
                 // since this is mostly just an optimization and for keeping the tests happy.
-                if ((ic->pingCount + 1) % 7) {
-                    pingCallback(ic);
+                if (++ic->pingCount % 7) {
+                    pingPeer(ep, ic, Time_currentTimeMilliseconds(ic->eventBase), false);
                 }
             }
         }
@@ -320,8 +593,14 @@ static uint8_t receivedAfterCryptoAuth(struct Message* msg, struct Interface* cr
         ep->state = InterfaceController_PeerState_ESTABLISHED;
     } else {
         ep->timeOfLastMessage = Time_currentTimeMilliseconds(ic->eventBase);
+        updateRates(ep, ep->timeOfLastMessage);
     }
 
+    PacketTrace_stamp(ic->pub.packetTrace, PacketTrace_Stage_LINK_DECRYPT);
+    PacketCapture_tap(ic->pub.packetCapture, PacketCapture_Point_SWITCH_IN, msg);
+    if (holdForSwitch(ep, msg, ic)) {
+        return Error_NONE;
+    }
     return ep->switchIf.receiveMessage(msg, &ep->switchIf);
 }
 
@@ -333,18 +612,22 @@ static uint8_t sendFromSwitch(struct Message* msg, struct Interface* switchIf)
     ep->bytesOut += msg->length;
 
     struct Context* ic = ifcontrollerForPeer(ep);
+    PacketTrace_stamp(ic->pub.packetTrace, PacketTrace_Stage_SWITCH);
+    PacketCapture_tap(ic->pub.packetCapture, PacketCapture_Point_SWITCH_OUT, msg);
     uint8_t ret;
     uint64_t now = Time_currentTimeMilliseconds(ic->eventBase);
+    updateRates(ep, now);
     if (now - ep->timeOfLastMessage > ic->unresponsiveAfterMilliseconds) {
         // XXX: This is a hack because if the time of last message exceeds the
         //      unresponsive time, we need to send back an error and that means
         //      mangling the message which would otherwise be in the queue.
-        struct Allocator* tempAlloc = Allocator_child(ic->allocator);
+        struct Allocator* tempAlloc =
+            Allocator_scratch(ic->allocator, msg->capacity + msg->padding + 256);
         struct Message* toSend = Message_clone(msg, tempAlloc);
-        ret = Interface_sendMessage(ep->cryptoAuthIf, toSend);
+        ret = Interface_sendMessage(&ep->queue->iface, toSend);
         Allocator_free(tempAlloc);
     } else {
-        ret = Interface_sendMessage(ep->cryptoAuthIf, msg);
+        ret = Interface_sendMessage(&ep->queue->iface, msg);
     }
 
     // If this node is unresponsive then return an error.
@@ -360,18 +643,198 @@ static uint8_t sendFromSwitch(struct Message* msg, struct Interface* switchIf)
     return Error_NONE;
 }
 
+/** Called by CryptoAuth to send a message over the current or forced link. */
+static uint8_t sendOverLink(struct Message* msg, struct Interface* linkIf)
+{
+    struct IFCPeer* ep = Identity_cast((struct IFCPeer*) linkIf->senderContext);
+    uint32_t i = (ep->forcedLink) ? ep->forcedLink - 1 : ep->currentLink;
+    struct Context* ic = ifcontrollerForPeer(ep);
+    PacketTrace_end(ic->pub.packetTrace, PacketTrace_Stage_LINK_ENCRYPT);
+    PacketCapture_tap(ic->pub.packetCapture, PacketCapture_Point_LINK_OUT, msg);
+    return Interface_sendMessage(ep->links[i]->external, msg);
+}
+
+/** Incoming message from any of the peer's network interfaces, it goes to CryptoAuth. */
+static uint8_t receiveFromLink(struct Message* msg, struct Interface* external)
+{
+    struct IFCLink* link = Identity_cast((struct IFCLink*) external->receiverContext);
+    struct IFCPeer* ep = link->peer;
+    struct Context* ic = ifcontrollerForPeer(ep);
+    PacketTrace_begin(ic->pub.packetTrace);
+    PacketCapture_tap(ic->pub.packetCapture, PacketCapture_Point_LINK_IN, msg);
+    if (ep->linkCount > 1) {
+        uint64_t now = Time_currentTimeMilliseconds(ic->eventBase);
+        link->timeOfLastMessage = now;
+        struct IFCLink* current = ep->links[ep->currentLink];
+        if (current != link && now - current->timeOfLastMessage > ic->pingAfterMilliseconds) {
+            // Nothing has come in over the current link for a while, fail over now rather than
+            // waiting for its pings to be lost.
+            for (uint32_t i = 0; i < ep->linkCount; i++) {
+                if (ep->links[i] == link) {
+                    Log_debug(ic->logger, "Peer's current link went quiet, switching to [%u]", i);
+                    ep->currentLink = i;
+                }
+            }
+        }
+    }
+    return Interface_receiveMessage(&ep->linkIf, msg);
+}
+
+/** Use the working link with the lowest round trip time, switch only for a clear gain. */
+static void selectLink(struct IFCPeer* ep, struct Context* ic)
+{
+    uint32_t best = ep->currentLink;
+    for (uint32_t i = 0; i < ep->linkCount; i++) {
+        struct IFCLink* link = ep->links[i];
+        struct IFCLink* bestLink = ep->links[best];
+        if (link->lostInARow >= LINK_MAX_LOST) {
+            continue;
+        }
+        if (bestLink->lostInARow >= LINK_MAX_LOST
+            || (link->rttMilliseconds
+                && (!bestLink->rttMilliseconds
+                    || link->rttMilliseconds * 4 < bestLink->rttMilliseconds * 3)))
+        {
+            best = i;
+        }
+    }
+    if (best != ep->currentLink) {
+        Log_debug(ic->logger, "Switching peer from link [%u] to [%u]", ep->currentLink, best);
+        ep->currentLink = best;
+    }
+}
+
+static void onLinkPingResponse(enum SwitchPinger_Result result,
+                               uint64_t label,
+                               String* data,
+                               uint32_t millisecondsLag,
+                               uint32_t version,
+                               void* onResponseContext)
+{
+    struct IFCLink* link = Identity_cast((struct IFCLink*) onResponseContext);
+    if (SwitchPinger_Result_OK == result) {
+        link->lostInARow = 0;
+        link->rttMilliseconds = (link->rttMilliseconds)
+            ? (link->rttMilliseconds * 7 + millisecondsLag) / 8
+            : ((millisecondsLag) ? millisecondsLag : 1);
+    } else if (SwitchPinger_Result_TIMEOUT == result) {
+        link->lostInARow++;
+    }
+    selectLink(link->peer, ifcontrollerForPeer(link->peer));
+}
+
+/** Send a ping over each of the links, the pong comes back over whichever link she chooses. */
+static void pingLinks(void* vep)
+{
+    struct IFCPeer* ep = Identity_cast((struct IFCPeer*) vep);
+    struct Context* ic = ifcontrollerForPeer(ep);
+    if (ep->linkCount < 2 || ep->state < InterfaceController_PeerState_ESTABLISHED) {
+        return;
+    }
+    for (uint32_t i = 0; i < ep->linkCount; i++) {
+        struct IFCLink* link = ep->links[i];
+        // The link's allocator is used so that the ping is cancelled if the link goes away.
+        struct SwitchPinger_Ping* ping =
+            SwitchPinger_newPing(ep->switchLabel,
+                                 String_CONST(""),
+                                 ic->timeoutMilliseconds,
+                                 onLinkPingResponse,
+                                 link->external->allocator,
+                                 ic->switchPinger);
+        if (!ping) {
+            return;
+        }
+        ping->onResponseContext = link;
+        ep->forcedLink = i + 1;
+        SwitchPinger_sendPing(ping);
+        ep->forcedLink = 0;
+    }
+}
+
+static int removeLink(struct Allocator_OnFreeJob* job)
+{
+    struct IFCLink* link = Identity_cast((struct IFCLink*) job->userData);
+    struct IFCPeer* ep = link->peer;
+    for (uint32_t i = 1; i < ep->linkCount; i++) {
+        if (ep->links[i] != link) {
+            continue;
+        }
+        ep->linkCount--;
+        Bits_memmove(&ep->links[i], &ep->links[i + 1], (ep->linkCount - i) * sizeof(void*));
+        struct Context* ic = ifcontrollerForPeer(ep);
+        if (ic->switchPinger) {
+            SwitchPinger_reservePings(-1, ic->switchPinger);
+        }
+        if (ep->currentLink == i) {
+            ep->currentLink = 0;
+        } else if (ep->currentLink > i) {
+            ep->currentLink--;
+        }
+        break;
+    }
+    return 0;
+}
+
+static struct IFCLink* addLink(struct IFCPeer* ep, struct Interface* external)
+{
+    struct IFCLink* link = Allocator_clone(external->allocator, (&(struct IFCLink) {
+        .external = external,
+        .peer = ep
+    }));
+    Identity_set(link);
+    external->receiveMessage = receiveFromLink;
+    external->receiverContext = link;
+    ep->links[ep->linkCount++] = link;
+    return link;
+}
+
+/**
+ * Add another network interface to a peer which has the same key so that the peer can be
+ * reached over either one without starting a new CryptoAuth session.
+ */
+static void addAlternateLink(struct IFCPeer* ep, struct Interface* external, struct Context* ic)
+{
+    for (uint32_t i = 0; i < ep->linkCount; i++) {
+        if (ep->links[i]->external == external) {
+            return;
+        }
+    }
+    struct IFCLink* link = addLink(ep, external);
+    link->timeOfLastMessage = Time_currentTimeMilliseconds(ic->eventBase);
+    ep->links[0]->timeOfLastMessage = ep->timeOfLastMessage;
+    Allocator_onFree(external->allocator, removeLink, link);
+    Log_debug(ic->logger, "Adding link [%u] to peer", ep->linkCount - 1);
+    if (ic->switchPinger) {
+        // Each link is pinged on its own.
+        SwitchPinger_reservePings(1, ic->switchPinger);
+    }
+
+    if (!ep->linkTimer && ic->switchPinger) {
+        ep->linkTimer = Timeout_setInterval(pingLinks, ep, LINK_PING_INTERVAL_MILLISECONDS,
+                                            ic->eventBase, ep->external->allocator);
+    }
+}
+
 static int closeInterface(struct Allocator_OnFreeJob* job)
 {
     struct IFCPeer* toClose = Identity_cast((struct IFCPeer*) job->userData);
 
     struct Context* ic = ifcontrollerForPeer(toClose);
 
+    // The other links cannot be used without the session.
+    while (toClose->linkCount > 1) {
+        Allocator_free(toClose->links[toClose->linkCount - 1]->external->allocator);
+    }
+
     // flush the peer from the table...
     RouterModule_brokenPath(toClose->switchLabel, ic->routerModule);
 
     int index = Map_OfIFCPeerByExernalIf_indexForHandle(toClose->handle, &ic->peerMap);
     Assert_true(index >= 0);
     Map_OfIFCPeerByExernalIf_remove(index, &ic->peerMap);
+    if (ic->switchPinger) {
+        SwitchPinger_reservePings(-1, ic->switchPinger);
+    }
     return 0;
 }
 
@@ -394,7 +857,7 @@ static int registerPeer(struct InterfaceController* ifController,
 
     uint8_t ip6[16];
     if (herPublicKey) {
-        AddressCalc_addressForPublicKey(ip6, herPublicKey);
+        AddressCalc_cachedAddressForPublicKey(ip6, herPublicKey, ic->ca->addressCache);
         if (!AddressCalc_validAddress(ip6)) {
             return InterfaceController_registerPeer_BAD_KEY;
         }
@@ -403,6 +866,15 @@ static int registerPeer(struct InterfaceController* ifController,
             // can't link with yourself, wiseguy
             return InterfaceController_registerPeer_BAD_KEY;
         }
+        for (uint32_t i = 0; i < ic->peerMap.count; i++) {
+            struct IFCPeer* ep = ic->peerMap.values[i];
+            if (ep->linkCount < MAX_LINKS
+                && !Bits_memcmp(CryptoAuth_getHerPublicKey(ep->cryptoAuthIf), herPublicKey, 32))
+            {
+                addAlternateLink(ep, externalInterface, ic);
+                return 0;
+            }
+        }
     } else {
         Assert_always(requireAuth);
     }
@@ -416,6 +888,12 @@ static int registerPeer(struct InterfaceController* ifController,
     ep->handle = ic->peerMap.handles[setIndex];
     Identity_set(ep);
     Allocator_onFree(epAllocator, closeInterface, ep);
+    if (ic->switchPinger) {
+        ep->checkTimer = Timeout_setTimeout(checkPeer, ep, PING_INTERVAL_MILLISECONDS,
+                                            ic->eventBase, epAllocator);
+        // Every peer is pinged regularly so each one needs room for a ping.
+        SwitchPinger_reservePings(1, ic->switchPinger);
+    }
 
     // If the other end need not supply a valid password to connect
     // we will set the connection state to HANDSHAKE because we don't
@@ -424,15 +902,33 @@ static int registerPeer(struct InterfaceController* ifController,
         ep->state = InterfaceController_PeerState_HANDSHAKE;
     }
 
-    ep->cryptoAuthIf = CryptoAuth_wrapInterface(externalInterface,
+    addLink(ep, externalInterface);
+    Bits_memcpyConst(&ep->linkIf, (&(struct Interface) {
+        .sendMessage = sendOverLink,
+        .senderContext = ep,
+        .allocator = epAllocator
+    }), sizeof(struct Interface));
+
+    ep->parity = ParityInterface_new(&ep->linkIf, epAllocator);
+    ep->parity->generic.receiveMessage = receivedFromParity;
+    ep->parity->generic.receiverContext = ep;
+    Bits_memcpyConst(&ep->burstIf, (&(struct Interface) {
+        .sendMessage = sendToParity,
+        .senderContext = ep,
+        .allocator = epAllocator
+    }), sizeof(struct Interface));
+    ep->cryptoAuthIf = CryptoAuth_wrapInterface(&ep->burstIf,
                                                 herPublicKey,
                                                 NULL,
                                                 requireAuth,
                                                 "outer",
                                                 ic->ca);
 
-    ep->cryptoAuthIf->receiveMessage = receivedAfterCryptoAuth;
-    ep->cryptoAuthIf->receiverContext = ep;
+    ep->coalescer = Coalescer_new(ep->cryptoAuthIf, ic->eventBase, epAllocator);
+    ep->coalescer->generic.receiveMessage = receivedAfterCryptoAuth;
+    ep->coalescer->generic.receiverContext = ep;
+
+    ep->queue = FairQueue_new(&ep->coalescer->generic, ic->eventBase, epAllocator);
 
     // Always use authType 1 until something else comes along, then we'll have to refactor.
     if (password) {
@@ -462,8 +958,8 @@ static int registerPeer(struct InterfaceController* ifController,
     // We want the node to immedietly be pinged but we don't want it to appear unresponsive because
     // the pinger will only ping every (PING_INTERVAL * 8) so we set timeOfLastMessage to
     // (now - pingAfterMilliseconds - 1) so it will be considered a "lazy node".
-    ep->timeOfLastMessage =
-        Time_currentTimeMilliseconds(ic->eventBase) - ic->pingAfterMilliseconds - 1;
+    ep->rateWindowStart = Time_currentTimeMilliseconds(ic->eventBase);
+    ep->timeOfLastMessage = ep->rateWindowStart - ic->pingAfterMilliseconds - 1;
 
     if (herPublicKey) {
         #ifdef Log_INFO
@@ -471,8 +967,10 @@ static int registerPeer(struct InterfaceController* ifController,
             AddrTools_printIp(printAddr, ip6);
             Log_info(ic->logger, "Adding peer [%s]", printAddr);
         #endif
-        // Kick the ping callback so that the node will be pinged ASAP.
-        pingCallback(ic);
+        // Check the peer right now so that the node will be pinged ASAP.
+        checkPeer(ep);
+    } else {
+        scheduleCheck(ep, PING_INTERVAL_MILLISECONDS);
     }
 
     return 0;
@@ -480,9 +978,8 @@ static int registerPeer(struct InterfaceController* ifController,
 
 static enum InterfaceController_PeerState getPeerState(struct Interface* iface)
 {
-    struct Interface* cryptoAuthIf = CryptoAuth_getConnectedInterface(iface);
-    struct IFCPeer* p = Identity_cast((struct IFCPeer*) cryptoAuthIf->receiverContext);
-    return p->state;
+    struct IFCLink* link = Identity_cast((struct IFCLink*) iface->receiverContext);
+    return link->peer->state;
 }
 
 static void populateBeacon(struct InterfaceController* ifc, struct Headers_Beacon* beacon)
@@ -493,11 +990,26 @@ static void populateBeacon(struct InterfaceController* ifc, struct Headers_Beaco
     Bits_memcpyConst(beacon->publicKey, ic->ca->publicKey, 32);
 }
 
+static uint8_t* getPeerKeyForLabel(struct InterfaceController* ifController, uint64_t label)
+{
+    struct Context* ic = Identity_cast((struct Context*) ifController);
+    for (uint32_t i = 0; i < ic->peerMap.count; i++) {
+        struct IFCPeer* peer = ic->peerMap.values[i];
+        if (peer->switchLabel == label) {
+            return (peer->state == InterfaceController_PeerState_ESTABLISHED
+                    && CryptoAuth_getState(peer->cryptoAuthIf) == CryptoAuth_ESTABLISHED)
+                ? CryptoAuth_getHerPublicKey(peer->cryptoAuthIf) : NULL;
+        }
+    }
+    return NULL;
+}
+
 static int getPeerStats(struct InterfaceController* ifController,
                         struct Allocator* alloc,
                         struct InterfaceController_peerStats** statsOut)
 {
     struct Context* ic = Identity_cast((struct Context*) ifController);
+    uint64_t now = Time_currentTimeMilliseconds(ic->eventBase);
     int count = ic->peerMap.count;
     struct InterfaceController_peerStats* stats =
         Allocator_malloc(alloc, sizeof(struct InterfaceController_peerStats)*count);
@@ -520,6 +1032,18 @@ static int getPeerStats(struct InterfaceController* ifController,
         s->duplicates = rp->duplicates;
         s->lostPackets = rp->lostPackets;
         s->receivedOutOfRange = rp->receivedOutOfRange;
+
+        updateRates(peer, now);
+        s->rttMilliseconds = peer->rttMilliseconds;
+        s->rttVarianceMilliseconds = peer->rttVarianceMilliseconds;
+        s->pingsSent = peer->pingsSent;
+        s->pingsLost = peer->pingsLost;
+        s->bytesInPerSecond = peer->bytesInPerSecond;
+        s->bytesOutPerSecond = peer->bytesOutPerSecond;
+        s->recentLostPackets = peer->recentLostPackets;
+        s->parityGroupSize = (peer->parity->enabled) ? peer->parity->groupSize : 0;
+        s->parityRecovered = peer->parity->recovered;
+        s->packetsCoalesced = peer->coalescer->packetsCoalesced;
     }
 
     *statsOut = stats;
@@ -540,6 +1064,76 @@ static int disconnectPeer(struct InterfaceController* ifController, uint8_t herP
     return InterfaceController_disconnectPeer_NOTFOUND;
 }
 
+static int setParity(struct InterfaceController* ifController,
+                     uint8_t herPublicKey[32],
+                     bool enabled)
+{
+    struct Context* ic = Identity_cast((struct Context*) ifController);
+
+    for (uint32_t i = 0; i < ic->peerMap.count; i++) {
+        struct IFCPeer* peer = ic->peerMap.values[i];
+        if (!Bits_memcmp(herPublicKey, CryptoAuth_getHerPublicKey(peer->cryptoAuthIf), 32)) {
+            peer->parity->enabled = enabled;
+            return 0;
+        }
+    }
+    return InterfaceController_disconnectPeer_NOTFOUND;
+}
+
+static int setCoalescing(struct InterfaceController* ifController,
+                         uint8_t herPublicKey[32],
+                         bool enabled)
+{
+    struct Context* ic = Identity_cast((struct Context*) ifController);
+
+    for (uint32_t i = 0; i < ic->peerMap.count; i++) {
+        struct IFCPeer* peer = ic->peerMap.values[i];
+        if (!Bits_memcmp(herPublicKey, CryptoAuth_getHerPublicKey(peer->cryptoAuthIf), 32)) {
+            peer->coalesce = enabled;
+            peer->coalescer->enabled = enabled && peer->version >= 9;
+            return 0;
+        }
+    }
+    return InterfaceController_disconnectPeer_NOTFOUND;
+}
+
+static void beginBurst(struct InterfaceController* ifController)
+{
+    struct Context* ic = Identity_cast((struct Context*) ifController);
+    ic->burstDepth++;
+}
+
+static void endBurst(struct InterfaceController* ifController)
+{
+    struct Context* ic = Identity_cast((struct Context*) ifController);
+    Assert_true(ic->burstDepth > 0);
+    if (ic->burstDepth > 1) {
+        ic->burstDepth--;
+        return;
+    }
+    // Peers may have gone away during the burst so they are looked up again by handle.
+    // What is decrypted while the burst is still open is held again for the switch.
+    for (int i = 0; i < ic->burstPeerCount; i++) {
+        int index = Map_OfIFCPeerByExernalIf_indexForHandle(ic->burstPeers[i], &ic->peerMap);
+        if (index > -1) {
+            flushCryptoBurst(ic->peerMap.values[index]);
+        }
+    }
+    ic->burstDepth = 0;
+    for (int i = 0; i < ic->burstPeerCount; i++) {
+        int index = Map_OfIFCPeerByExernalIf_indexForHandle(ic->burstPeers[i], &ic->peerMap);
+        if (index > -1) {
+            ic->peerMap.values[index]->inBurst = false;
+            flushSwitchBurst(ic->peerMap.values[index]);
+        }
+    }
+    ic->burstPeerCount = 0;
+    if (ic->burstAlloc) {
+        Allocator_free(ic->burstAlloc);
+        ic->burstAlloc = NULL;
+    }
+}
+
 struct InterfaceController* DefaultInterfaceController_new(struct CryptoAuth* ca,
                                                            struct SwitchCore* switchCore,
                                                            struct RouterModule* routerModule,
@@ -554,9 +1148,14 @@ struct InterfaceController* DefaultInterfaceController_new(struct CryptoAuth* ca
         .pub = {
             .registerPeer = registerPeer,
             .disconnectPeer = disconnectPeer,
+            .setParity = setParity,
+            .setCoalescing = setCoalescing,
             .getPeerState = getPeerState,
             .populateBeacon = populateBeacon,
             .getPeerStats = getPeerStats,
+            .getPeerKeyForLabel = getPeerKeyForLabel,
+            .beginBurst = beginBurst,
+            .endBurst = endBurst
         },
         .peerMap = {
             .allocator = allocator
@@ -571,16 +1170,7 @@ struct InterfaceController* DefaultInterfaceController_new(struct CryptoAuth* ca
         .unresponsiveAfterMilliseconds = UNRESPONSIVE_AFTER_MILLISECONDS,
         .pingAfterMilliseconds = PING_AFTER_MILLISECONDS,
         .timeoutMilliseconds = TIMEOUT_MILLISECONDS,
-        .forgetAfterMilliseconds = FORGET_AFTER_MILLISECONDS,
-
-        .pingInterval = (switchPinger)
-            ? Timeout_setInterval(pingCallback,
-                                  out,
-                                  PING_INTERVAL_MILLISECONDS,
-                                  eventBase,
-                                  allocator)
-            : NULL
-
+        .forgetAfterMilliseconds = FORGET_AFTER_MILLISECONDS
     }), sizeof(struct Context));
     Identity_set(out);
 
@@ -14,14 +14,17 @@
  */
 #include "crypto/AddressCalc.h"
 #include "crypto/CryptoAuth.h"
+#include "crypto/random/Random.h"
 #include "util/log/Log.h"
 #include "dht/Address.h"
 #include "dht/DHTMessage.h"
 #include "dht/DHTModule.h"
 #include "dht/DHTModuleRegistry.h"
 #include "dht/dhtcore/Node.h"
+#include "dht/dhtcore/NodeList.h"
 #include "dht/dhtcore/RouterModule.h"
 #include "dht/dhtcore/SearchRunner.h"
+#include "interface/ICMP6Generator.h"
 #include "interface/tuntap/TUNMessageType.h"
 #include "interface/Interface.h"
 #include "interface/SessionManager.h"
@@ -32,6 +35,7 @@
 #include "switch/LabelSplicer.h"
 #include "util/Bits.h"
 #include "util/Checksum.h"
+#include "util/Hash.h"
 #include "util/version/Version.h"
 #include "util/Assert.h"
 #include "tunnel/IpTunnel.h"
@@ -42,6 +46,7 @@
 #include "wire/Ethernet.h"
 
 #include <stdint.h>
+#include <inttypes.h>
 
 /** Size of the per-message workspace. */
 #define PER_MESSAGE_BUF_SZ 8192
@@ -57,10 +62,65 @@
 #define HANDLE_FLAG_BIT (0x80000000)
 #define HANDLE_FLAG_BIT_be Endian_hostToBigEndian32(HANDLE_FLAG_BIT)
 
+/**
+ * Sent in place of the CryptoAuth nonce when the router to router session is skipped because
+ * the destination is a direct peer, see Version 7 in Version.h.
+ */
+#define ONE_HOP_NONCE 0xfffffffe
+#define ONE_HOP_NONCE_be Endian_hostToBigEndian32(ONE_HOP_NONCE)
+
+/**
+ * The first byte of an IPv6 header which is sent compressed to the node at the other end of a
+ * session, an IPv4 or IPv6 packet never begins with it, see Version 8 in Version.h.
+ * With COMPRESSED_IP6_FLOW the traffic class and flow label follow the 4 byte header.
+ */
+#define COMPRESSED_IP6 0x80
+#define COMPRESSED_IP6_FLOW 0x01
+#define COMPRESSED_IP6_SIZE 4
+
+/** The largest path MTU which will be probed for, the TUN device's MTU is never more. */
+#define PATH_MTU_MAX 1500
+
+/** The path MTU search stops when the largest size which fits is known within this much. */
+#define PATH_MTU_PRECISION 8
+
+#define PATH_MTU_PROBE_TIMEOUT_MILLISECONDS 2048
+
+/**
+ * Bytes added to a packet from the TUN by the time it reaches the switch, with both sessions
+ * established: the switch header, the handle and 2 CryptoAuth nonce and authenticators.
+ */
+#define PATH_MTU_OVERHEAD (Headers_SwitchHeader_SIZE + 4 + 20 + 20)
+
+/** Bytes before the ping data in a switch ping, the last 12 are the Pinger's handle and cookie. */
+#define PATH_MTU_PING_OVERHEAD \
+    (Headers_SwitchHeader_SIZE + Control_HEADER_SIZE + Control_Ping_HEADER_SIZE + 12)
+
+/**
+ * A cached route is used for at most this long, changes of reach don't move the NodeStore
+ * generation but they can change which node is the best next hop.
+ */
+#define ROUTE_CACHE_TTL_MILLISECONDS 1024
+
+/**
+ * Packets which follow one that was too big are likely to be in flight before the TUN's host took
+ * the error into account, within this long they are dropped without sending another.
+ */
+#define TOO_BIG_INTERVAL_MILLISECONDS 128
+
+/** Most bytes of packets which are held for any one destination while a route is searched for. */
+#define PENDING_MAX_BYTES 16384
+
+/** Drops of packets from the TUN are logged as a summary no more often than this. */
+#define TUN_DROP_LOG_INTERVAL_MILLISECONDS 10000
+
 /*--------------------Prototypes--------------------*/
 static int handleOutgoing(struct DHTMessage* message,
                           void* vcontext);
 
+static inline uint8_t incomingFromTun(struct Message* message,
+                                      struct Interface* iface);
+
 static inline uint8_t incomingDHT(struct Message* message,
                                   struct Address* addr,
                                   struct Ducttape_pvt* context)
@@ -73,6 +133,7 @@ static inline uint8_t incomingDHT(struct Message* message,
         ? message->length
         : DHTMessage_MAX_SIZE;
     Bits_memcpy(dht.bytes, message->bytes, length);
+    dht.length = length;
 
     dht.address = addr;
     dht.allocator = message->alloc;
@@ -84,11 +145,142 @@ static inline uint8_t incomingDHT(struct Message* message,
 }
 
 /** Header must not be encrypted and must be aligned on the beginning of the ipv6 header. */
+/**
+ * Check whether the other end of a session is a direct peer which is reached with label and
+ * whose link uses the same key as the session, if so the link's encryption is enough.
+ */
+static inline bool isOneHopSession(struct SessionManager_Session* session,
+                                   uint64_t label,
+                                   struct Ducttape_pvt* context)
+{
+    if (!context->ic || !LabelSplicer_isOneHop(label)) {
+        return false;
+    }
+    uint8_t* peerKey = InterfaceController_getPeerKeyForLabel(context->ic, label);
+    return peerKey && !Bits_memcmp(peerKey, CryptoAuth_getHerPublicKey(&session->iface), 32);
+}
+
+/**
+ * Send a message to a direct peer without the router to router layer of encryption.
+ * The send handle and ONE_HOP_NONCE go where the CryptoAuth header would be.
+ */
+static inline uint8_t sendOneHop(struct Message* message,
+                                 struct Ducttape_MessageHeader* dtHeader,
+                                 struct SessionManager_Session* session,
+                                 struct Ducttape_pvt* context)
+{
+    uint32_t nonce_be = ONE_HOP_NONCE_be;
+    Message_push(message, &nonce_be, 4, NULL);
+    Message_push(message, &session->sendHandle_be, 4, NULL);
+
+    Message_shift(message, Headers_SwitchHeader_SIZE, NULL);
+    if (dtHeader->switchHeader) {
+        if (message->bytes != (uint8_t*)dtHeader->switchHeader) {
+            Bits_memmoveConst(message->bytes, dtHeader->switchHeader, Headers_SwitchHeader_SIZE);
+        }
+    } else {
+        Bits_memset(message->bytes, 0, Headers_SwitchHeader_SIZE);
+    }
+    dtHeader->switchHeader = (struct Headers_SwitchHeader*) message->bytes;
+    dtHeader->switchHeader->label_be = Endian_hostToBigEndian64(dtHeader->switchLabel);
+    if (dtHeader->flowTag) {
+        Headers_setFlowTag(dtHeader->switchHeader, dtHeader->flowTag);
+    }
+
+    return context->switchInterface.receiveMessage(message, &context->switchInterface);
+}
+
+/**
+ * Replace the IPv6 header of a packet from us to the node at the other end of the session with
+ * the few fields which the other node can not work out from the keys of the session.
+ */
+static inline void compressIp6(struct Message* message,
+                               struct SessionManager_Session* session,
+                               struct Ducttape_pvt* context)
+{
+    struct Headers_IP6Header* ip6 = (struct Headers_IP6Header*) message->bytes;
+    if (session->version < 8
+        || message->length < Headers_IP6Header_SIZE
+        || Headers_getIpVersion(message->bytes) != 6
+        || Bits_memcmp(ip6->sourceAddr, context->myAddr.ip6.bytes, 16)
+        || Bits_memcmp(ip6->destinationAddr, session->ip6, 16))
+    {
+        return;
+    }
+    uint8_t flow[4];
+    Bits_memcpyConst(flow, ip6, 4);
+    flow[0] &= 0x0f;
+    bool hasFlow = !Bits_isZero(flow, 4);
+    uint8_t header[COMPRESSED_IP6_SIZE] = {
+        COMPRESSED_IP6 | ((hasFlow) ? COMPRESSED_IP6_FLOW : 0),
+        ip6->nextHeader,
+        ip6->hopLimit,
+        0
+    };
+    Message_shift(message, -Headers_IP6Header_SIZE, NULL);
+    if (hasFlow) {
+        Message_push(message, flow, 4, NULL);
+    }
+    Message_push(message, header, COMPRESSED_IP6_SIZE, NULL);
+}
+
+/**
+ * Rebuild the IPv6 header of a packet which was compressed by the node at the other end of the
+ * session.
+ *
+ * @return false if the packet is compressed but invalid.
+ */
+static inline bool expandIp6(struct Message* message,
+                             struct Ducttape_MessageHeader* dtHeader,
+                             struct SessionManager_Session* session,
+                             struct Ducttape_pvt* context)
+{
+    if (message->length < COMPRESSED_IP6_SIZE
+        || (message->bytes[0] & ~COMPRESSED_IP6_FLOW) != COMPRESSED_IP6)
+    {
+        return true;
+    }
+    uint8_t header[COMPRESSED_IP6_SIZE];
+    Message_pop(message, header, COMPRESSED_IP6_SIZE, NULL);
+    uint8_t flow[4] = { 0 };
+    if ((header[0] & COMPRESSED_IP6_FLOW) && Message_tryPop(message, flow, 4)) {
+        return false;
+    }
+    flow[0] = (flow[0] & 0x0f) | 0x60;
+
+    // The header grows over where the switch header is so that is moved in front of it.
+    struct Headers_SwitchHeader switchHeader;
+    Bits_memcpyConst(&switchHeader, dtHeader->switchHeader, Headers_SwitchHeader_SIZE);
+    Message_shift(message, Headers_IP6Header_SIZE + Headers_SwitchHeader_SIZE, NULL);
+    Bits_memcpyConst(message->bytes, &switchHeader, Headers_SwitchHeader_SIZE);
+    dtHeader->switchHeader = (struct Headers_SwitchHeader*) message->bytes;
+    Message_shift(message, -Headers_SwitchHeader_SIZE, NULL);
+
+    struct Headers_IP6Header* ip6 = (struct Headers_IP6Header*) message->bytes;
+    Bits_memcpyConst(ip6, flow, 4);
+    ip6->payloadLength_be = Endian_hostToBigEndian16(message->length - Headers_IP6Header_SIZE);
+    ip6->nextHeader = header[1];
+    ip6->hopLimit = header[2];
+    Bits_memcpyConst(ip6->sourceAddr, session->ip6, 16);
+    Bits_memcpyConst(ip6->destinationAddr, context->myAddr.ip6.bytes, 16);
+    return true;
+}
+
 static inline uint8_t sendToRouter(struct Message* message,
                                    struct Ducttape_MessageHeader* dtHeader,
                                    struct SessionManager_Session* session,
                                    struct Ducttape_pvt* context)
 {
+    compressIp6(message, session, context);
+
+    // The handles are only known once the session is established.
+    if (session->version >= 7
+        && CryptoAuth_getState(&session->iface) == CryptoAuth_ESTABLISHED
+        && isOneHopSession(session, dtHeader->switchLabel, context))
+    {
+        return sendOneHop(message, dtHeader, session, context);
+    }
+
     int safeDistance = Headers_SwitchHeader_SIZE;
 
     if (CryptoAuth_getState(&session->iface) < CryptoAuth_HANDSHAKE3) {
@@ -126,7 +318,9 @@ static inline uint8_t sendToRouter(struct Message* message,
     Message_shift(message, -safeDistance, NULL);
 
     dtHeader->switchHeader->label_be = Endian_hostToBigEndian64(dtHeader->switchLabel);
-
+    if (dtHeader->flowTag) {
+        Headers_setFlowTag(dtHeader->switchHeader, dtHeader->flowTag);
+    }
 
     // This comes out in outgoingFromCryptoAuth() then sendToSwitch()
     dtHeader->receiveHandle = Endian_bigEndianToHost32(session->receiveHandle_be);
@@ -136,11 +330,9 @@ static inline uint8_t sendToRouter(struct Message* message,
 
 static struct Ducttape_MessageHeader* getDtHeader(struct Message* message, bool init)
 {
-    int padding = message->padding;
-    Assert_true(padding > Ducttape_MessageHeader_SIZE);
-    Message_shift(message, padding, NULL);
-    struct Ducttape_MessageHeader* dtHeader = (struct Ducttape_MessageHeader*) message->bytes;
-    Message_shift(message, -padding, NULL);
+    Assert_true(message->padding > Ducttape_MessageHeader_SIZE);
+    struct Ducttape_MessageHeader* dtHeader =
+        (struct Ducttape_MessageHeader*) (message->bytes - message->padding);
     if (init) {
         Bits_memset(dtHeader, 0, Ducttape_MessageHeader_SIZE);
         Identity_set(dtHeader);
@@ -275,7 +467,7 @@ static inline uint8_t incomingForMe(struct Message* message,
     struct Address addr;
     //Bits_memcpyConst(addr.ip6.bytes, session->ip6, 16);
     Bits_memcpyConst(addr.key, herPublicKey, 32);
-    AddressCalc_addressForPublicKey(addr.ip6.bytes, herPublicKey);
+    AddressCalc_cachedAddressForPublicKey(addr.ip6.bytes, herPublicKey, context->addressCache);
     Assert_always(!Bits_memcmp(session->ip6, addr.ip6.bytes, 16));
 
     if (Bits_memcmp(addr.ip6.bytes, dtHeader->ip6Header->sourceAddr, 16)) {
@@ -326,6 +518,11 @@ static inline uint8_t incomingForMe(struct Message* message,
         dtHeader->ip6Header->hopLimit--;
     }
 
+    // A queue along the path was building up, tell the transport if it can take the hint.
+    if (dtHeader->switchHeader && Headers_isCongested(dtHeader->switchHeader)) {
+        Headers_IP6Header_markCongested(dtHeader->ip6Header);
+    }
+
     // Now write a message to the TUN device.
     // Need to move the ipv6 header forward up to the content because there's a crypto header
     // between the ipv6 header and the content which just got eaten.
@@ -340,6 +537,7 @@ static inline uint8_t incomingForMe(struct Message* message,
 
     TUNMessageType_push(message, Ethernet_TYPE_IP6, NULL);
 
+    PacketTrace_end(context->pub.packetTrace, PacketTrace_Stage_TO_TUN);
     context->userIf->sendMessage(message, context->userIf);
     return Error_NONE;
 }
@@ -361,7 +559,7 @@ uint8_t Ducttape_injectIncomingForMe(struct Message* message,
     Message_shift(message, -Headers_IP6Header_SIZE, NULL);
 
     struct SessionManager_Session s;
-    AddressCalc_addressForPublicKey(s.ip6, herPublicKey);
+    AddressCalc_cachedAddressForPublicKey(s.ip6, herPublicKey, context->addressCache);
     s.version = Version_CURRENT_PROTOCOL;
 
     return incomingForMe(message, dtHeader, &s, context, herPublicKey);
@@ -441,12 +639,425 @@ static uint8_t magicInterfaceSendMessage(struct Message* msg, struct Interface*
 }
 
 // Called by the TUN device.
+/** The state of a path MTU search, a copy goes with each probe. */
+struct PathMtuProbe
+{
+    struct Ducttape_pvt* context;
+
+    /** The receive handle of the session, in host order since the session may be gone. */
+    uint32_t sessionHandle;
+
+    uint64_t label;
+
+    /** The largest packet size which is known to fit and the smallest which is known not to. */
+    uint32_t fits;
+    uint32_t tooBig;
+
+    /** The packet size which is being probed. */
+    uint32_t probing;
+
+    Identity
+};
+
+static void sendProbe(struct PathMtuProbe* probe);
+
+static void onProbeResponse(enum SwitchPinger_Result result,
+                            uint64_t label,
+                            String* data,
+                            uint32_t millisecondsLag,
+                            uint32_t version,
+                            void* onResponseContext)
+{
+    struct PathMtuProbe* probe = Identity_cast((struct PathMtuProbe*) onResponseContext);
+    struct Ducttape_pvt* context = probe->context;
+    struct SessionManager_Session* session =
+        SessionManager_sessionForHandle(probe->sessionHandle, context->sm);
+    if (!session || session->pathMtuLabel != probe->label) {
+        // The session is gone or the path changed and a new search has been started.
+        return;
+    }
+
+    if (result == SwitchPinger_Result_OK) {
+        probe->fits = probe->probing;
+    } else {
+        probe->tooBig = probe->probing;
+    }
+
+    if (probe->tooBig - probe->fits > PATH_MTU_PRECISION) {
+        // This probe is freed with the ping, the next one gets a copy.
+        struct PathMtuProbe next;
+        Bits_memcpyConst(&next, probe, sizeof(struct PathMtuProbe));
+        next.probing = (next.fits + next.tooBig) / 2;
+        sendProbe(&next);
+        return;
+    }
+
+    session->pathMtu = probe->fits;
+    #ifdef Log_DEBUG
+        uint8_t addr[40];
+        AddrTools_printIp(addr, session->ip6);
+        Log_debug(context->logger, "Path MTU to [%s] is [%u]", addr, session->pathMtu);
+    #endif
+}
+
+static void sendProbe(struct PathMtuProbe* probe)
+{
+    struct Ducttape_pvt* context = probe->context;
+    struct Allocator* tempAlloc = Allocator_child(context->alloc);
+    uint32_t dataLen = probe->probing + PATH_MTU_OVERHEAD - PATH_MTU_PING_OVERHEAD;
+    String* data = String_newBinary(NULL, dataLen, tempAlloc);
+    Bits_memset(data->bytes, 0, dataLen);
+
+    struct SwitchPinger_Ping* ping =
+        SwitchPinger_newPing(probe->label,
+                             data,
+                             PATH_MTU_PROBE_TIMEOUT_MILLISECONDS,
+                             onProbeResponse,
+                             context->alloc,
+                             context->switchPinger);
+    Allocator_free(tempAlloc);
+
+    if (!ping) {
+        // Out of ping slots, the next packet which needs it will start over.
+        struct SessionManager_Session* session =
+            SessionManager_sessionForHandle(probe->sessionHandle, context->sm);
+        if (session) {
+            session->pathMtuLabel = 0;
+        }
+        return;
+    }
+    ping->onResponseContext = Allocator_clone(ping->pingAlloc, probe);
+    SwitchPinger_sendPing(ping);
+}
+
+/**
+ * Get the path MTU to a node, starting a search if the path has not been probed.
+ *
+ * @return the largest packet which will fit along the path or 0 if it is not known.
+ */
+static inline uint32_t pathMtu(struct SessionManager_Session* session,
+                               uint64_t label,
+                               struct Ducttape_pvt* context)
+{
+    if (session->pathMtuLabel == label || !context->switchPinger) {
+        return session->pathMtu;
+    }
+    session->pathMtuLabel = label;
+    session->pathMtu = 0;
+
+    struct PathMtuProbe probe = {
+        .context = context,
+        .sessionHandle = Endian_bigEndianToHost32(session->receiveHandle_be),
+        .label = label,
+        .fits = ICMP6Generator_MIN_IPV6_MTU,
+        .tooBig = PATH_MTU_MAX + 1,
+        // Try the largest size first since most paths are not restricted.
+        .probing = PATH_MTU_MAX
+    };
+    Identity_set(&probe);
+    sendProbe(&probe);
+    return 0;
+}
+
+static inline uint32_t addressHash(uint8_t addr[16])
+{
+    uint32_t hash = 0;
+    for (int i = 0; i < 16; i++) {
+        hash = hash * 31 + addr[i];
+    }
+    return hash;
+}
+
+/**
+ * Answer a packet from the TUN which is too big for the path with an ICMPv6 error unless one was
+ * sent for the same destination and MTU moments ago, generating it checksums the whole packet.
+ */
+static inline uint8_t packetTooBig(struct Message* message,
+                                   uint32_t mtu,
+                                   uint64_t now,
+                                   struct Ducttape_pvt* context)
+{
+    struct Headers_IP6Header* header = (struct Headers_IP6Header*) message->bytes;
+    struct Ducttape_TooBig* sent =
+        &context->tooBig[addressHash(header->destinationAddr) % Ducttape_TOO_BIG_CACHE_SIZE];
+    if (sent->mtu == mtu
+        && now - sent->timeSent < TOO_BIG_INTERVAL_MILLISECONDS
+        && !Bits_memcmp(sent->ip6, header->destinationAddr, 16))
+    {
+        return Error_NONE;
+    }
+    Bits_memcpyConst(sent->ip6, header->destinationAddr, 16);
+    sent->mtu = mtu;
+    sent->timeSent = now;
+
+    uint8_t destAddr[16];
+    Bits_memcpyConst(destAddr, header->sourceAddr, 16);
+    ICMP6Generator_generate(message,
+                            (uint8_t*) FC_ONE,
+                            destAddr,
+                            ICMP6Generator_Type_PACKET_TOO_BIG,
+                            mtu);
+    TUNMessageType_push(message, Ethernet_TYPE_IP6, NULL);
+    Interface_sendMessage(context->userIf, message);
+    return Error_NONE;
+}
+
+/**
+ * Called with each result of a search for a destination which has pending packets,
+ * as soon as there is a route they are sent, if the search ends without one they are dropped.
+ */
+static void pendingSearchCallback(struct RouterModule_Promise* promise,
+                                  uint32_t lag,
+                                  struct Node* fromNode,
+                                  Dict* result)
+{
+    struct Ducttape_pvt* context = Identity_cast((struct Ducttape_pvt*) promise->userData);
+    struct Ducttape_PendingPackets* pending = NULL;
+    for (int i = 0; i < Ducttape_PENDING_MAX_DESTINATIONS; i++) {
+        if (context->pending[i].search == promise) {
+            pending = &context->pending[i];
+            break;
+        }
+    }
+    if (!pending) {
+        return;
+    }
+
+    bool found = RouterModule_lookup(pending->ip6, context->routerModule) != NULL;
+    if (!found && fromNode) {
+        // The search goes on.
+        return;
+    }
+
+    // Free the entry first, the packets might need to be held again.
+    struct Ducttape_PendingPackets packets;
+    Bits_memcpyConst(&packets, pending, sizeof(struct Ducttape_PendingPackets));
+    Bits_memset(pending, 0, sizeof(struct Ducttape_PendingPackets));
+
+    if (found && context->userIf) {
+        for (int i = 0; i < packets.count; i++) {
+            incomingFromTun(packets.messages[i], context->userIf);
+        }
+    } else {
+        #ifdef Log_DEBUG
+            uint8_t destAddr[40];
+            AddrTools_printIp(destAddr, packets.ip6);
+            Log_debug(context->logger, "DROP [%d] pending packets to [%s], no route was found",
+                      packets.count, destAddr);
+        #endif
+    }
+    Allocator_free(packets.alloc);
+}
+
+/**
+ * Hold a packet from the TUN until a search finds a route to its destination.
+ *
+ * @param message the packet, beginning with the IPv6 header.
+ * @param ethertype the type which was popped from the packet.
+ * @param destAddr the destination IPv6 address.
+ * @param context the ducttape.
+ * @return true if the packet is held, false if the queue for the destination is full or
+ *         there are too many destinations being searched for.
+ */
+static inline bool holdPending(struct Message* message,
+                               uint16_t ethertype,
+                               uint8_t destAddr[16],
+                               struct Ducttape_pvt* context)
+{
+    struct Ducttape_PendingPackets* pending = NULL;
+    struct Ducttape_PendingPackets* freeEntry = NULL;
+    for (int i = 0; i < Ducttape_PENDING_MAX_DESTINATIONS; i++) {
+        if (!context->pending[i].search) {
+            freeEntry = (freeEntry) ? freeEntry : &context->pending[i];
+        } else if (!Bits_memcmp(context->pending[i].ip6, destAddr, 16)) {
+            pending = &context->pending[i];
+            break;
+        }
+    }
+
+    if (!pending) {
+        if (!freeEntry) {
+            return false;
+        }
+        struct RouterModule_Promise* search =
+            SearchRunner_search(destAddr, SearchRunner_Priority_USER,
+                                context->searchRunner, context->alloc);
+        if (!search) {
+            return false;
+        }
+        search->callback = pendingSearchCallback;
+        search->userData = context;
+
+        pending = freeEntry;
+        Bits_memcpyConst(pending->ip6, destAddr, 16);
+        pending->search = search;
+        pending->alloc = Allocator_child(context->alloc);
+    }
+
+    if (pending->count >= Ducttape_PENDING_MAX_PACKETS
+        || pending->bytes + message->length > PENDING_MAX_BYTES)
+    {
+        return false;
+    }
+
+    TUNMessageType_push(message, ethertype, NULL);
+    pending->messages[pending->count++] = Message_clone(message, pending->alloc);
+    pending->bytes += message->length;
+    return true;
+}
+
+/**
+ * Find the sessions which packets from the TUN to a destination were last sent with.
+ *
+ * @param destAddr the IPv6 address of the destination.
+ * @param now the current time in milliseconds.
+ * @param context the ducttape.
+ * @param slotOut set to the entry where the route is or should be put.
+ * @param sessionOut set to the session with the destination if the route is found.
+ * @return the session with the next hop or NULL if the route is stale or either session expired.
+ */
+static inline struct SessionManager_Session* cachedRoute(uint8_t destAddr[16],
+                                                         uint64_t now,
+                                                         struct Ducttape_pvt* context,
+                                                         struct Ducttape_CachedRoute** slotOut,
+                                                         struct SessionManager_Session** sessionOut)
+{
+    struct Ducttape_CachedRoute* route =
+        &context->routeCache[addressHash(destAddr) % Ducttape_ROUTE_CACHE_SIZE];
+    *slotOut = route;
+
+    if (route->generation != RouterModule_generation(context->routerModule)
+        || now - route->timeCreated >= ROUTE_CACHE_TTL_MILLISECONDS
+        || Bits_memcmp(route->ip6, destAddr, 16))
+    {
+        return NULL;
+    }
+    struct SessionManager_Session* nextHopSession =
+        SessionManager_sessionForHandle(route->nextHopHandle, context->sm);
+    struct SessionManager_Session* session = (route->direct)
+        ? nextHopSession : SessionManager_sessionForHandle(route->sessionHandle, context->sm);
+    if (!nextHopSession || !session) {
+        return NULL;
+    }
+    // Keep the sessions from expiring as SessionManager_getSession() would have.
+    SessionManager_touch(session, context->sm);
+    if (session != nextHopSession) {
+        SessionManager_touch(nextHopSession, context->sm);
+    }
+    *sessionOut = session;
+    return nextHopSession;
+}
+
+/** Weight of a path for spreading flows, its reach scaled down if it is slower than the best. */
+static inline uint32_t pathWeight(struct Node* node, uint32_t bestRtt)
+{
+    // Quartered so the weights of Ducttape_MAX_PATHS paths can be summed without overflow.
+    uint64_t weight = node->reach >> 2;
+    if (bestRtt && node->smoothedRtt > bestRtt) {
+        weight = weight * bestRtt / node->smoothedRtt;
+    }
+    return (weight) ? weight : 1;
+}
+
+/**
+ * Find the paths to a direct destination which its flows can be spread across, paths with less
+ * than half the reach of the best are not worth the reordering which they would cause.
+ */
+static void findPaths(struct Ducttape_CachedRoute* route,
+                      struct Node* best,
+                      struct Ducttape_pvt* context)
+{
+    uint32_t max = context->pub.maxPaths;
+    if (max > Ducttape_MAX_PATHS) {
+        max = Ducttape_MAX_PATHS;
+    }
+    route->labels[0] = best->address.path;
+    route->weights[0] = pathWeight(best, best->smoothedRtt);
+
+    struct Allocator* alloc = Allocator_child(context->alloc);
+    struct NodeList* paths =
+        RouterModule_getPaths(best->address.ip6.bytes, max, alloc, context->routerModule);
+    for (uint32_t i = 0; paths && i < paths->size && route->pathCount < max; i++) {
+        struct Node* node = paths->nodes[i];
+        if (node->address.path == best->address.path || node->reach < (best->reach >> 1)) {
+            continue;
+        }
+        route->labels[route->pathCount] = node->address.path;
+        route->weights[route->pathCount] =
+            route->weights[route->pathCount - 1] + pathWeight(node, best->smoothedRtt);
+        route->pathCount++;
+    }
+    Allocator_free(alloc);
+}
+
+/**
+ * A hash of the addresses, protocol and ports of a packet from the TUN. It goes in the switch
+ * header so that the queues on the way can keep the flows of one session apart, it is keyed
+ * with a secret so it tells the nodes on the way nothing but which packets belong together.
+ */
+static inline uint32_t flowTag(struct Message* message, struct Ducttape_pvt* context)
+{
+    struct Headers_IP6Header* header = (struct Headers_IP6Header*) message->bytes;
+    uint32_t addrs[8];
+    Bits_memcpyConst(addrs, header->sourceAddr, 16);
+    Bits_memcpyConst(&addrs[4], header->destinationAddr, 16);
+    uint32_t hash = context->flowKey;
+    for (int i = 0; i < 8; i++) {
+        hash = Hash_add32(hash, addrs[i]);
+    }
+    hash = Hash_add32(hash, header->nextHeader);
+    if ((header->nextHeader == 6 || header->nextHeader == 17)
+        && message->length >= Headers_IP6Header_SIZE + 4)
+    {
+        // Source and destination ports, the same offset for TCP and UDP.
+        uint32_t ports;
+        Bits_memcpyConst(&ports, &message->bytes[Headers_IP6Header_SIZE], 4);
+        hash = Hash_add32(hash, ports);
+    }
+    uint32_t tag = Hash_mix32(hash) & Headers_SwitchHeader_FLOW_TAG_MASK;
+    return (tag) ? tag : 1;
+}
+
+/**
+ * Pick one of the paths of a route by the flow tag of the packet so that all of the packets
+ * of a flow take the same path and are not reordered.
+ */
+static inline uint64_t pathForFlow(struct Ducttape_CachedRoute* route, uint32_t tag)
+{
+    uint32_t point = tag % route->weights[route->pathCount - 1];
+    uint32_t i = 0;
+    while (point >= route->weights[i]) {
+        i++;
+    }
+    return route->labels[i];
+}
+
+/**
+ * A misconfigured host can send a flood of bad packets so they are counted rather than each one
+ * being logged, the counts are logged every TUN_DROP_LOG_INTERVAL_MILLISECONDS at most.
+ */
+static uint8_t dropFromTun(struct Ducttape_pvt* context)
+{
+    uint64_t now = Time_currentTimeMilliseconds(context->eventBase);
+    struct Ducttape_TunDrops* drops = &context->tunDrops;
+    if (now - drops->timeOfLastLog >= TUN_DROP_LOG_INTERVAL_MILLISECONDS) {
+        drops->timeOfLastLog = now;
+        Log_warn(context->logger, "Dropped packets from the TUN, ip version doesn't match "
+                 "ethertype [%" PRIu64 "], destination not in fc00::/8 [%" PRIu64 "], "
+                 "source not my address [%" PRIu64 "]",
+                 drops->badVersion, drops->badDestination, drops->badSource);
+    }
+    return Error_INVALID;
+}
+
 static inline uint8_t incomingFromTun(struct Message* message,
                                       struct Interface* iface)
 {
     struct Ducttape_pvt* context = Identity_cast((struct Ducttape_pvt*) iface->receiverContext);
+    PacketTrace_begin(context->pub.packetTrace);
 
     uint16_t ethertype = TUNMessageType_pop(message, NULL);
+    PacketCapture_tap(context->pub.packetCapture, PacketCapture_Point_TUN_IN, message);
 
     struct Headers_IP6Header* header = (struct Headers_IP6Header*) message->bytes;
 
@@ -454,32 +1065,21 @@ static inline uint8_t incomingFromTun(struct Message* message,
     if ((ethertype == Ethernet_TYPE_IP4 && version != 4)
         || (ethertype == Ethernet_TYPE_IP6 && version != 6))
     {
-        Log_warn(context->logger, "DROP packet because ip version [%d] "
-                 "doesn't match ethertype [%u].", version, Endian_bigEndianToHost16(ethertype));
-        return Error_INVALID;
+        context->tunDrops.badVersion++;
+        return dropFromTun(context);
     }
 
     if (ethertype != Ethernet_TYPE_IP6 || !AddressCalc_validAddress(header->sourceAddr)) {
         return context->ipTunnel->tunInterface.sendMessage(message,
                                                            &context->ipTunnel->tunInterface);
     } else if (!AddressCalc_validAddress(header->destinationAddr)) {
-        #ifdef Log_INFO
-            uint8_t dst[40];
-            AddrTools_printIp(dst, header->destinationAddr);
-            Log_warn(context->logger, "DROP packet to [%s] because it must begin with fc", dst);
-        #endif
-        return Error_INVALID;
+        context->tunDrops.badDestination++;
+        return dropFromTun(context);
     }
 
     if (Bits_memcmp(header->sourceAddr, context->myAddr.ip6.bytes, 16)) {
-        uint8_t expectedSource[40];
-        AddrTools_printIp(expectedSource, context->myAddr.ip6.bytes);
-        uint8_t packetSource[40];
-        AddrTools_printIp(packetSource, header->sourceAddr);
-        Log_warn(context->logger,
-                 "DROP packet from [%s] because all messages must have source address [%s]",
-                 (char*) packetSource, (char*) expectedSource);
-        return Error_INVALID;
+        context->tunDrops.badSource++;
+        return dropFromTun(context);
     }
     if (!Bits_memcmp(header->destinationAddr, context->myAddr.ip6.bytes, 16)) {
         // I'm Gonna Sit Right Down and Write Myself a Letter
@@ -504,58 +1104,79 @@ static inline uint8_t incomingFromTun(struct Message* message,
     uint64_t now = Time_currentTimeMilliseconds(context->eventBase);
     if (context->timeOfLastSearch + 8192 < now) {
         context->timeOfLastSearch = now;
-        SearchRunner_search(header->destinationAddr, context->searchRunner, context->alloc);
+        SearchRunner_search(header->destinationAddr, SearchRunner_Priority_USER,
+                            context->searchRunner, context->alloc);
     }
     RouterModule_refreshReach(header->destinationAddr, context->routerModule);
 //End of TODO block
-    struct Node* bestNext = RouterModule_lookup(header->destinationAddr, context->routerModule);
-    struct SessionManager_Session* nextHopSession;
-    if (bestNext) {
+    struct Ducttape_CachedRoute* route;
+    struct SessionManager_Session* session = NULL;
+    struct SessionManager_Session* nextHopSession =
+        cachedRoute(header->destinationAddr, now, context, &route, &session);
+    if (!nextHopSession) {
+        struct Node* bestNext =
+            RouterModule_lookup(header->destinationAddr, context->routerModule);
+        if (!bestNext) {
+            if (holdPending(message, ethertype, header->destinationAddr, context)) {
+                return Error_NONE;
+            }
+            #ifdef Log_WARN
+                uint8_t thisAddr[40];
+                uint8_t destAddr[40];
+                AddrTools_printIp(thisAddr, context->myAddr.ip6.bytes);
+                AddrTools_printIp(destAddr, header->destinationAddr);
+                Log_warn(context->logger,
+                         "DROP message from TUN because this node [%s] is closest to dest [%s]",
+                         thisAddr, destAddr);
+            #endif
+            return Error_UNDELIVERABLE;
+        }
+        bool direct = !Bits_memcmp(header->destinationAddr, bestNext->address.ip6.bytes, 16);
+        if (!direct) {
+            // Create this first, adding a session may move the others in memory.
+            uint32_t handle_be =
+                SessionManager_getSession(header->destinationAddr, NULL, context->sm)
+                    ->receiveHandle_be;
+            route->sessionHandle = Endian_bigEndianToHost32(handle_be);
+        }
         nextHopSession = SessionManager_getSession(bestNext->address.ip6.bytes,
                                                    bestNext->address.key,
                                                    context->sm);
+        session = (direct) ? nextHopSession
+            : SessionManager_sessionForHandle(route->sessionHandle, context->sm);
 
         bestNext->version = nextHopSession->version = (bestNext->version > nextHopSession->version)
             ? bestNext->version : nextHopSession->version;
 
-        dtHeader->switchLabel = bestNext->address.path;
-        dtHeader->nextHopReceiveHandle = Endian_bigEndianToHost32(nextHopSession->receiveHandle_be);
+        Bits_memcpyConst(route->ip6, header->destinationAddr, 16);
+        route->switchLabel = bestNext->address.path;
+        route->pathCount = 1;
+        if (direct && context->pub.maxPaths > 1) {
+            findPaths(route, bestNext, context);
+        }
+        route->nextHopHandle = Endian_bigEndianToHost32(nextHopSession->receiveHandle_be);
+        route->direct = direct;
+        route->generation = RouterModule_generation(context->routerModule);
+        route->timeCreated = now;
+    }
 
-        if (!Bits_memcmp(header->destinationAddr, bestNext->address.ip6.bytes, 16)) {
-            // Direct send, skip the innermost layer of encryption.
-            /*#ifdef Log_DEBUG
-                uint8_t nhAddr[60];
-                Address_print(nhAddr, &bestNext->address);
-                Log_debug(context->logger, "Forwarding data to %s (last hop)\n", nhAddr);
-            #endif*/
-            return sendToRouter(message, dtHeader, nextHopSession, context);
+    dtHeader->flowTag = flowTag(message, context);
+    dtHeader->switchLabel =
+        (route->pathCount > 1) ? pathForFlow(route, dtHeader->flowTag) : route->switchLabel;
+    dtHeader->nextHopReceiveHandle = route->nextHopHandle;
+
+    if (message->length > ICMP6Generator_MIN_IPV6_MTU) {
+        // A session probes one path so only the best one is probed when flows are spread.
+        uint32_t mtu = pathMtu(nextHopSession, route->switchLabel, context);
+        if (mtu && message->length > (int32_t) mtu) {
+            return packetTooBig(message, mtu, now, context);
         }
-        // else { the message will need to be 3 layer encrypted but since we already did a lookup
-        // of the best node to forward to, we can skip doing another lookup by storing a pointer
-        // to that node in the context (bestNext).
-    } else {
-        #ifdef Log_WARN
-            uint8_t thisAddr[40];
-            uint8_t destAddr[40];
-            AddrTools_printIp(thisAddr, context->myAddr.ip6.bytes);
-            AddrTools_printIp(destAddr, header->destinationAddr);
-            Log_warn(context->logger,
-                     "DROP message from TUN because this node [%s] is closest to dest [%s]",
-                     thisAddr, destAddr);
-        #endif
-        return Error_UNDELIVERABLE;
     }
-/*
-    #ifdef Log_DEBUG
-        uint8_t destAddr[40];
-        AddrTools_printIp(destAddr, header->destinationAddr);
-        uint8_t nhAddr[60];
-        Address_print(nhAddr, &bestNext->address);
-        Log_debug(context->logger, "Sending to [%s] via [%s]", destAddr, nhAddr);
-    #endif
-*/
-    struct SessionManager_Session* session =
-        SessionManager_getSession(header->destinationAddr, NULL, context->sm);
+
+    if (route->direct) {
+        // Direct send, skip the innermost layer of encryption.
+        return sendToRouter(message, dtHeader, nextHopSession, context);
+    }
 
     // Copy the IP6 header back from where the CA header will be placed.
     // this is a mess.
@@ -601,7 +1222,10 @@ static uint8_t sendToNode(struct Message* message, struct Interface* iface)
     struct Ducttape_MessageHeader* dtHeader = getDtHeader(message, true);
     struct IpTunnel_PacketInfoHeader* header = (struct IpTunnel_PacketInfoHeader*) message->bytes;
     Message_shift(message, -IpTunnel_PacketInfoHeader_SIZE, NULL);
-    struct Node* n = RouterModule_lookup(header->nodeIp6Addr, context->routerModule);
+    // Only the node itself will do, most often one which is not known is asked for.
+    struct Node* n = (RouterModule_mightHaveNode(header->nodeIp6Addr, context->routerModule))
+        ? RouterModule_lookup(header->nodeIp6Addr, context->routerModule)
+        : NULL;
     if (n) {
         if (!Bits_memcmp(header->nodeKey, n->address.key, 32)) {
             // Found the node.
@@ -633,7 +1257,8 @@ static uint8_t sendToNode(struct Message* message, struct Interface* iface)
     uint64_t now = Time_currentTimeMilliseconds(context->eventBase);
     if (context->timeOfLastSearch + context->timeBetweenSearches < now) {
         context->timeOfLastSearch = now;
-        SearchRunner_search(header->nodeIp6Addr, context->searchRunner, context->alloc);
+        SearchRunner_search(header->nodeIp6Addr, SearchRunner_Priority_USER,
+                            context->searchRunner, context->alloc);
     }
     return 0;
 }
@@ -657,6 +1282,7 @@ static uint8_t sendToTun(struct Message* message, struct Interface* iface)
     }
     TUNMessageType_push(message, msgType, NULL);
     if (context->userIf) {
+        PacketTrace_end(context->pub.packetTrace, PacketTrace_Stage_TO_TUN);
         return context->userIf->sendMessage(message, context->userIf);
     }
     return 0;
@@ -801,6 +1427,10 @@ static inline int incomingFromRouter(struct Message* message,
                                      struct Ducttape_pvt* context)
 {
     uint8_t* pubKey = CryptoAuth_getHerPublicKey(&session->iface);
+    if (!expandIp6(message, dtHeader, session, context)) {
+        Log_debug(context->logger, "DROP runt compressed IPv6 header");
+        return Error_INVALID;
+    }
     if (!validEncryptedIP6(message)) {
         // Not valid cjdns IPv6, we'll try it as an IPv4 or ICANN-IPv6 packet
         // and check if we have an agreement with the node who sent it.
@@ -821,13 +1451,16 @@ static inline int incomingFromRouter(struct Message* message,
     };
     Bits_memcpyConst(srcAddr.key, pubKey, 32);
 
+    // core() may create sessions which can move or evict this one.
+    uint32_t version = session->version;
+
     //Log_debug(context->logger, "Got message from router.\n");
     int ret = core(message, dtHeader, session, context);
 
     struct Node* n = RouterModule_getNode(srcAddr.path, context->routerModule);
     if (!n) {
         Address_getPrefix(&srcAddr);
-        RouterModule_addNode(context->routerModule, &srcAddr, session->version);
+        RouterModule_addNode(context->routerModule, &srcAddr, version);
     } else {
         n->reach += 1;
         RouterModule_updateReach(n, context->routerModule);
@@ -840,6 +1473,7 @@ static inline int incomingFromRouter(struct Message* message,
 static uint8_t incomingFromCryptoAuth(struct Message* message, struct Interface* iface)
 {
     struct Ducttape_pvt* context = Identity_cast((struct Ducttape_pvt*) iface->receiverContext);
+    PacketTrace_stamp(context->pub.packetTrace, PacketTrace_Stage_DUCTTAPE_DECRYPT);
     struct Ducttape_MessageHeader* dtHeader = getDtHeader(message, false);
     enum Ducttape_SessionLayer layer = dtHeader->layer;
     dtHeader->layer = Ducttape_SessionLayer_INVALID;
@@ -893,6 +1527,7 @@ static uint8_t incomingFromCryptoAuth(struct Message* message, struct Interface*
 static uint8_t outgoingFromCryptoAuth(struct Message* message, struct Interface* iface)
 {
     struct Ducttape_pvt* context = Identity_cast((struct Ducttape_pvt*) iface->senderContext);
+    PacketTrace_stamp(context->pub.packetTrace, PacketTrace_Stage_DUCTTAPE_ENCRYPT);
     struct Ducttape_MessageHeader* dtHeader = getDtHeader(message, false);
     struct SessionManager_Session* session =
         SessionManager_sessionForHandle(dtHeader->receiveHandle, context->sm);
@@ -1063,14 +1698,76 @@ static inline void translateVersion2(struct Message* message,
  * There is only one switch interface which sends all traffic.
  * message is aligned on the beginning of the switch header.
  */
+/**
+ * Run messages in an established session, the bulk of the traffic, skip the handshake checks
+ * and only the fields of the header which are read further along are written.
+ *
+ * @return true if the message was handled, false if it must take the full path.
+ */
+static inline bool incomingRunMessage(struct Message* message,
+                                      struct Ducttape_pvt* context,
+                                      uint8_t* errOut)
+{
+    if (message->length < Headers_SwitchHeader_SIZE + 8) {
+        return false;
+    }
+    struct Headers_SwitchHeader* switchHeader = (struct Headers_SwitchHeader*) message->bytes;
+    if (Headers_getMessageType(switchHeader) == Headers_SwitchHeader_TYPE_CONTROL) {
+        return false;
+    }
+    uint32_t* words = (uint32_t*) &switchHeader[1];
+    uint32_t handle = Endian_bigEndianToHost32(words[0]);
+    uint32_t nonce = Endian_bigEndianToHost32(words[1]);
+    if (handle < 4 || nonce < 4 || nonce >= ONE_HOP_NONCE) {
+        return false;
+    }
+    struct SessionManager_Session* session = SessionManager_sessionForHandle(handle, context->sm);
+    if (!session || CryptoAuth_getState(&session->iface) != CryptoAuth_ESTABLISHED) {
+        return false;
+    }
+
+    switchHeader->label_be = Bits_bitReverse64(switchHeader->label_be);
+    Message_shift(message, -(Headers_SwitchHeader_SIZE + 4), NULL);
+
+    Assert_true(message->padding > Ducttape_MessageHeader_SIZE);
+    struct Ducttape_MessageHeader* dtHeader =
+        (struct Ducttape_MessageHeader*) (message->bytes - message->padding);
+    dtHeader->layer = Ducttape_SessionLayer_OUTER;
+    dtHeader->switchHeader = switchHeader;
+    dtHeader->ip6Header = NULL;
+    dtHeader->nextHopReceiveHandle = 0;
+    dtHeader->receiveHandle = handle;
+    dtHeader->switchLabel = 0;
+    Identity_set(dtHeader);
+
+    *errOut = 0;
+    if (session->iface.receiveMessage(message, &session->iface) == Error_AUTHENTICATION) {
+        debugHandlesAndLabel(context->logger, session,
+                             Endian_bigEndianToHost64(switchHeader->label_be),
+                             "DROP Failed decrypting message NoH[%d] state[%d]",
+                             handle, CryptoAuth_getState(&session->iface));
+        *errOut = Error_AUTHENTICATION;
+    }
+    return true;
+}
+
 static uint8_t incomingFromSwitch(struct Message* message, struct Interface* switchIf)
 {
     struct Ducttape_pvt* context = Identity_cast((struct Ducttape_pvt*)switchIf->senderContext);
+    PacketTrace_stamp(context->pub.packetTrace, PacketTrace_Stage_SWITCH);
+
+    uint8_t err;
+    if (incomingRunMessage(message, context, &err)) {
+        return err;
+    }
 
     struct Ducttape_MessageHeader* dtHeader = getDtHeader(message, true);
 
     struct Headers_SwitchHeader* switchHeader = (struct Headers_SwitchHeader*) message->bytes;
-    Message_shift(message, -Headers_SwitchHeader_SIZE, NULL);
+    if (Message_tryShift(message, -Headers_SwitchHeader_SIZE)) {
+        Log_info(context->logger, "DROP runt switch header");
+        return Error_INVALID;
+    }
 
     // The label comes in reversed from the switch because the switch doesn't know that we aren't
     // another switch ready to parse more bits, bit reversing the label yields the source address.
@@ -1105,6 +1802,18 @@ static uint8_t incomingFromSwitch(struct Message* message, struct Interface* swi
                 Log_debug(context->logger, "DROP connectToMe packet at switch layer");
                 return 0;
             }
+            if (nonce == ONE_HOP_NONCE) {
+                uint64_t label = Endian_bigEndianToHost64(switchHeader->label_be);
+                if (!isOneHopSession(session, label, context)) {
+                    debugHandlesAndLabel0(context->logger, session, label,
+                                          "DROP one hop packet from a peer without the key");
+                    return Error_AUTHENTICATION;
+                }
+                Message_shift(message, -4, NULL);
+                dtHeader->switchHeader = switchHeader;
+                dtHeader->receiveHandle = nonceOrHandle;
+                return incomingFromRouter(message, dtHeader, session, context);
+            }
             /*
             debugHandlesAndLabel(context->logger, session,
                                  Endian_bigEndianToHost64(switchHeader->label_be),
@@ -1119,7 +1828,7 @@ static uint8_t incomingFromSwitch(struct Message* message, struct Interface* swi
         union Headers_CryptoAuth* caHeader = (union Headers_CryptoAuth*) message->bytes;
         uint8_t ip6[16];
         uint8_t* herKey = caHeader->handshake.publicKey;
-        AddressCalc_addressForPublicKey(ip6, herKey);
+        AddressCalc_cachedAddressForPublicKey(ip6, herKey, context->addressCache);
         // a packet which claims to be "from us" causes problems
         if (AddressCalc_validAddress(ip6) && Bits_memcmp(ip6, &context->myAddr, 16)) {
             session = SessionManager_getSession(ip6, herKey, context->sm);
@@ -1184,6 +1893,8 @@ struct Ducttape* Ducttape_register(uint8_t privateKey[32],
     context->eventBase = eventBase;
     context->alloc = allocator;
     context->searchRunner = searchRunner;
+    context->pub.maxPaths = 1;
+    context->flowKey = Random_uint32(rand);
     Bits_memcpyConst(&context->pub.magicInterface, (&(struct Interface) {
         .sendMessage = magicInterfaceSendMessage,
         .allocator = allocator
@@ -1201,6 +1912,7 @@ struct Ducttape* Ducttape_register(uint8_t privateKey[32],
         CryptoAuth_new(allocator, privateKey, eventBase, logger, rand);
     Bits_memcpyConst(context->myAddr.key, cryptoAuth->publicKey, 32);
     Address_getPrefix(&context->myAddr);
+    context->addressCache = cryptoAuth->addressCache;
 
     context->sm = SessionManager_new(incomingFromCryptoAuth,
                                      outgoingFromCryptoAuth,
@@ -1238,6 +1950,18 @@ struct Ducttape* Ducttape_register(uint8_t privateKey[32],
     return &context->pub;
 }
 
+void Ducttape_setSwitchPinger(struct Ducttape* dt, struct SwitchPinger* switchPinger)
+{
+    struct Ducttape_pvt* context = Identity_cast((struct Ducttape_pvt*) dt);
+    context->switchPinger = switchPinger;
+}
+
+void Ducttape_setInterfaceController(struct Ducttape* dt, struct InterfaceController* ic)
+{
+    struct Ducttape_pvt* context = Identity_cast((struct Ducttape_pvt*) dt);
+    context->ic = ic;
+}
+
 void Ducttape_setUserInterface(struct Ducttape* dt, struct Interface* userIf)
 {
     struct Ducttape_pvt* context = Identity_cast((struct Ducttape_pvt*) dt);
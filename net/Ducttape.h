@@ -23,6 +23,10 @@
 #include "tunnel/IpTunnel.h"
 #include "wire/Headers.h"
 #include "util/events/EventBase.h"
+#include "net/SwitchPinger.h"
+#include "interface/InterfaceController.h"
+#include "util/PacketCapture.h"
+#include "util/PacketTrace.h"
 #include "util/Linker.h"
 Linker_require("net/Ducttape.c")
 
@@ -31,8 +35,24 @@ struct Ducttape
     struct Interface switchPingerIf;
     struct Interface magicInterface;
     struct SessionManager* sessionManager;
+
+    /** Where packets to and from the TUN are traced, NULL if they are not. */
+    struct PacketTrace* packetTrace;
+
+    /** Where packets from the TUN are captured, NULL if they are not. */
+    struct PacketCapture* packetCapture;
+
+    /**
+     * The number of paths which the flows to a node are spread across, each flow stays on one.
+     * Only paths which do not share a link and have at least half the reach of the best are
+     * used, weighted by reach and round trip time. The default of 1 takes the best path only.
+     */
+    uint32_t maxPaths;
 };
 
+/** The most paths which one destination's flows can be spread across. */
+#define Ducttape_MAX_PATHS 4
+
 struct Ducttape* Ducttape_register(uint8_t privateKey[32],
                                    struct DHTModuleRegistry* registry,
                                    struct RouterModule* routerModule,
@@ -52,6 +72,26 @@ struct Ducttape* Ducttape_register(uint8_t privateKey[32],
  */
 void Ducttape_setUserInterface(struct Ducttape* dt, struct Interface* userIf);
 
+/**
+ * Set the switch pinger which will be used to probe the MTU of the path to each node,
+ * packets from the TUN which are too big for the path will be answered with an
+ * ICMPv6 packet too big message.
+ *
+ * @param dt the ducttape struct.
+ * @param switchPinger a switch pinger which is using dt's switchPingerIf.
+ */
+void Ducttape_setSwitchPinger(struct Ducttape* dt, struct SwitchPinger* switchPinger);
+
+/**
+ * Set the interface controller which is asked for the key of the peer at the end of a one hop
+ * label, packets to and from a peer whose key is the key of the session then skip the router
+ * to router layer of encryption, see Version 7 in Version.h.
+ *
+ * @param dt the ducttape struct.
+ * @param ic the interface controller which is connected to the same switch as dt.
+ */
+void Ducttape_setInterfaceController(struct Ducttape* dt, struct InterfaceController* ic);
+
 /**
  * The structure of data which should be the beginning
  * of the content in the message sent to injectIncomingForMe.
@@ -0,0 +1,57 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "memory/Allocator.h"
+#include "net/Ducttape.h"
+#include "net/Ducttape_admin.h"
+#include "util/Identity.h"
+
+struct Context {
+    struct Admin* admin;
+    struct Ducttape* dt;
+    Identity
+};
+
+static void setMaxPaths(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    int64_t* maxPaths = Dict_getInt(args, String_CONST("maxPaths"));
+    char* err = "none";
+    if (*maxPaths < 1 || *maxPaths > Ducttape_MAX_PATHS) {
+        err = "maxPaths out of range";
+    } else {
+        // Cached routes pick up the change as they expire.
+        ctx->dt->maxPaths = *maxPaths;
+    }
+    Dict* response = Dict_new(alloc);
+    Dict_putString(response, String_CONST("error"), String_new(err, alloc), alloc);
+    Admin_sendMessage(response, txid, ctx->admin);
+}
+
+void Ducttape_admin_register(struct Ducttape* dt, struct Admin* admin, struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .admin = admin,
+        .dt = dt
+    }));
+    Identity_set(ctx);
+
+    Admin_registerFunction("Ducttape_setMaxPaths", setMaxPaths, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "maxPaths", .required = 1, .type = "Int" }
+        }), admin);
+}
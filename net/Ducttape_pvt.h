@@ -15,6 +15,7 @@
 #ifndef Ducttape_pvt_H
 #define Ducttape_pvt_H
 
+#include "crypto/AddressCalc.h"
 #include "dht/Address.h"
 #include "util/version/Version.h"
 #include "dht/DHTModule.h"
@@ -27,6 +28,7 @@
 #include "util/Identity.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 
 enum Ducttape_SessionLayer {
     Ducttape_SessionLayer_INVALID = 0,
@@ -42,6 +44,80 @@ enum Ducttape_SessionLayer {
  * and send the message toward the DHT core.
  */
 
+/** The route which packets from the TUN to one destination were last sent along. */
+struct Ducttape_CachedRoute
+{
+    uint8_t ip6[16];
+
+    uint64_t switchLabel;
+
+    /**
+     * Paths to a direct destination which flows are spread across when Ducttape.maxPaths is
+     * more than 1, labels[0] is switchLabel. Each weight has the ones before it added in.
+     */
+    uint64_t labels[Ducttape_MAX_PATHS];
+    uint32_t weights[Ducttape_MAX_PATHS];
+    uint32_t pathCount;
+
+    /** Handles of the session with the next hop and the one with the destination, host order. */
+    uint32_t nextHopHandle;
+    uint32_t sessionHandle;
+
+    /** True if the next hop is the destination so there is no inner layer of encryption. */
+    bool direct;
+
+    /** The route is stale once the RouterModule generation moves on or it gets too old. */
+    uint32_t generation;
+    uint64_t timeCreated;
+};
+
+#define Ducttape_ROUTE_CACHE_SIZE 64
+
+/** The last packet too big error which was sent to the TUN for packets to one destination. */
+struct Ducttape_TooBig
+{
+    uint8_t ip6[16];
+    uint32_t mtu;
+    uint64_t timeSent;
+};
+
+#define Ducttape_TOO_BIG_CACHE_SIZE 16
+
+#define Ducttape_PENDING_MAX_DESTINATIONS 8
+#define Ducttape_PENDING_MAX_PACKETS 8
+
+/** Packets from the TUN which are held while a search looks for a route to their destination. */
+struct Ducttape_PendingPackets
+{
+    uint8_t ip6[16];
+
+    /** The search which will flush the packets, NULL if the entry is free. */
+    struct RouterModule_Promise* search;
+
+    struct Message* messages[Ducttape_PENDING_MAX_PACKETS];
+    int count;
+    int bytes;
+
+    /** Holds the messages, freed once they are sent or dropped. */
+    struct Allocator* alloc;
+};
+
+/** Counts of packets from the TUN which were dropped, logged as a summary now and then. */
+struct Ducttape_TunDrops
+{
+    /** The IP version did not match the ethertype. */
+    uint64_t badVersion;
+
+    /** The destination was not an fc00::/8 address. */
+    uint64_t badDestination;
+
+    /** The source was not our own address. */
+    uint64_t badSource;
+
+    /** The time when the counts were last logged. */
+    uint64_t timeOfLastLog;
+};
+
 struct Ducttape_pvt
 {
     /** the public fields. */
@@ -75,6 +151,15 @@ struct Ducttape_pvt
 
     struct Log* logger;
 
+    /** Addresses of the keys seen by the inner CryptoAuth, owned by the CryptoAuth. */
+    struct AddressCalc_Cache* addressCache;
+
+    /** For probing the path MTU to other nodes, NULL until Ducttape_setSwitchPinger(). */
+    struct SwitchPinger* switchPinger;
+
+    /** For finding the peer behind a one hop label, NULL until setInterfaceController(). */
+    struct InterfaceController* ic;
+
     /** For tunneling IPv4 and ICANN IPv6 packets. */
     struct IpTunnel* ipTunnel;
 
@@ -86,6 +171,19 @@ struct Ducttape_pvt
     /** Absolute time of last search for node to send arbitrary data to. */
     uint64_t timeOfLastSearch;
 
+    /** Direct mapped by destination address so established flows skip the route lookup. */
+    struct Ducttape_CachedRoute routeCache[Ducttape_ROUTE_CACHE_SIZE];
+
+    /** Direct mapped by destination address like the routeCache. */
+    struct Ducttape_TooBig tooBig[Ducttape_TOO_BIG_CACHE_SIZE];
+
+    struct Ducttape_PendingPackets pending[Ducttape_PENDING_MAX_DESTINATIONS];
+
+    struct Ducttape_TunDrops tunDrops;
+
+    /** Secret which the flow tags are keyed with. */
+    uint32_t flowKey;
+
     Identity
 };
 
@@ -106,6 +204,9 @@ struct Ducttape_MessageHeader
 
     uint64_t switchLabel;
 
+    /** Put in the switch header of the packet, 0 for none, see Headers_getFlowTag(). */
+    uint32_t flowTag;
+
 #ifdef Version_2_COMPAT
     /**
      * Cache the session handle and version so that if an incoming (stray) packet fails to
@@ -0,0 +1,373 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crypto/AddressCalc.h"
+#include "crypto/CryptoAuth.h"
+#include "dht/dhtcore/Node.h"
+#include "dht/dhtcore/RouterModule.h"
+#include "dht/dhtcore/SearchRunner.h"
+#include "interface/SessionManager.h"
+#include "memory/Allocator.h"
+#include "net/SessionWarmup.h"
+#include "util/AddrTools.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
+#include "util/Identity.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/log/Log.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#define MAGIC "cjdnsSW1"
+#define HEADER_SIZE 16
+#define ENTRY_SIZE 16
+
+/** Destinations which can't be found are searched for again this often. */
+#define RETRY_MILLISECONDS 10000
+
+/** A destination is given up on after this many searches. */
+#define MAX_ATTEMPTS 6
+
+/** A destination and how much it was used, for picking the ones to save. */
+struct Usage
+{
+    uint8_t ip6[16];
+    uint64_t packets;
+};
+
+/** The most used destinations first. */
+static inline int compareUsage(const struct Usage* a, const struct Usage* b)
+{
+    return (a->packets < b->packets) ? 1 : (a->packets > b->packets) ? -1 : 0;
+}
+
+#define Order_NAME OfUsage
+#define Order_TYPE struct Usage
+#define Order_COMPARE compareUsage
+#include "util/Order.h"
+
+/** A destination which is waiting for its node to be found. */
+struct Wanted
+{
+    uint8_t ip6[16];
+
+    /** The number of searches which have been started for it. */
+    int attempts;
+
+    /** True while a search for it is running. */
+    bool searching;
+};
+
+struct SessionWarmup
+{
+    struct SearchRunner* searchRunner;
+    struct RouterModule* router;
+    struct SessionManager* sm;
+    struct EventBase* base;
+    struct Log* logger;
+    struct Allocator* alloc;
+
+    /**
+     * Destinations whose node has not been found yet, at startup there are no peers to search
+     * through so each is searched for again every RETRY_MILLISECONDS until it is found.
+     */
+    struct Wanted wanted[SessionWarmup_MAX_DESTINATIONS];
+    int wantedCount;
+
+    /** The file of most used destinations or NULL if none is open. */
+    FILE* file;
+    uint32_t count;
+
+    Identity
+};
+
+/** A search for a node whose session is being warmed, lives in the allocator of the search. */
+struct Warming
+{
+    uint8_t ip6[16];
+    struct SessionWarmup* warmup;
+    Identity
+};
+
+static inline struct Wanted* wantedFor(uint8_t ip6[16], struct SessionWarmup* warmup)
+{
+    for (int i = 0; i < warmup->wantedCount; i++) {
+        if (!Bits_memcmp(warmup->wanted[i].ip6, ip6, 16)) {
+            return &warmup->wanted[i];
+        }
+    }
+    return NULL;
+}
+
+static inline void forget(struct Wanted* wanted, struct SessionWarmup* warmup)
+{
+    struct Wanted* last = &warmup->wanted[--warmup->wantedCount];
+    if (wanted != last) {
+        Bits_memcpyConst(wanted, last, sizeof(struct Wanted));
+    }
+}
+
+/** Exact match only, RouterModule_lookup() gives the closest node if the node is not known. */
+static inline struct Node* knownNode(uint8_t ip6[16], struct SessionWarmup* warmup)
+{
+    struct Node* node = RouterModule_lookup(ip6, warmup->router);
+    return (node && !Bits_memcmp(node->address.ip6.bytes, ip6, 16)) ? node : NULL;
+}
+
+/** The ping goes over the session with the node so it does the key exchange. */
+static bool pingIfKnown(uint8_t ip6[16], struct SessionWarmup* warmup)
+{
+    struct Node* node = knownNode(ip6, warmup);
+    if (!node) {
+        return false;
+    }
+    RouterModule_pingNode(node, 0, warmup->router, warmup->alloc);
+    struct Wanted* wanted = wantedFor(ip6, warmup);
+    if (wanted) {
+        forget(wanted, warmup);
+    }
+    return true;
+}
+
+static void searchCallback(struct RouterModule_Promise* promise,
+                           uint32_t lag,
+                           struct Node* fromNode,
+                           Dict* result)
+{
+    struct Warming* warming = Identity_cast((struct Warming*) promise->userData);
+    if (pingIfKnown(warming->ip6, warming->warmup) || !fromNode) {
+        // The search runs out by itself, the answers are no longer needed.
+        promise->callback = NULL;
+    }
+}
+
+static int searchOnFree(struct Allocator_OnFreeJob* job)
+{
+    struct Warming* warming = Identity_cast((struct Warming*) job->userData);
+    struct Wanted* wanted = wantedFor(warming->ip6, warming->warmup);
+    if (wanted) {
+        wanted->searching = false;
+    }
+    return 0;
+}
+
+static void search(struct Wanted* wanted, struct SessionWarmup* warmup)
+{
+    struct RouterModule_Promise* promise =
+        SearchRunner_search(wanted->ip6, SearchRunner_Priority_MAINTENANCE,
+                            warmup->searchRunner, warmup->alloc);
+    if (!promise) {
+        return;
+    }
+    struct Warming* warming = Allocator_clone(promise->alloc, (&(struct Warming) {
+        .warmup = warmup
+    }));
+    Bits_memcpyConst(warming->ip6, wanted->ip6, 16);
+    Identity_set(warming);
+    promise->callback = searchCallback;
+    promise->userData = warming;
+    Allocator_onFree(promise->alloc, searchOnFree, warming);
+    wanted->searching = true;
+    wanted->attempts++;
+}
+
+static void retry(void* vwarmup)
+{
+    struct SessionWarmup* warmup = Identity_cast((struct SessionWarmup*) vwarmup);
+    for (int i = warmup->wantedCount - 1; i >= 0; i--) {
+        struct Wanted* wanted = &warmup->wanted[i];
+        if (wanted->searching || pingIfKnown(wanted->ip6, warmup)) {
+            continue;
+        }
+        if (wanted->attempts >= MAX_ATTEMPTS) {
+            #ifdef Log_DEBUG
+                uint8_t addr[40];
+                AddrTools_printIp(addr, wanted->ip6);
+                Log_debug(warmup->logger, "Unable to find [%s] to warm the session", addr);
+            #endif
+            forget(wanted, warmup);
+            continue;
+        }
+        search(wanted, warmup);
+    }
+}
+
+/** See: SessionWarmup.h */
+int SessionWarmup_warm(uint8_t ip6[16], struct SessionWarmup* warmup)
+{
+    if (pingIfKnown(ip6, warmup) || wantedFor(ip6, warmup)) {
+        return 0;
+    }
+    if (warmup->wantedCount >= SessionWarmup_MAX_DESTINATIONS) {
+        return -1;
+    }
+    struct Wanted* wanted = &warmup->wanted[warmup->wantedCount++];
+    Bits_memset(wanted, 0, sizeof(struct Wanted));
+    Bits_memcpyConst(wanted->ip6, ip6, 16);
+    search(wanted, warmup);
+    return 0;
+}
+
+static uint32_t readInt(uint8_t* bytes)
+{
+    uint32_t number_be;
+    Bits_memcpyConst(&number_be, bytes, 4);
+    return Endian_bigEndianToHost32(number_be);
+}
+
+static void writeInt(uint8_t* bytes, uint32_t number)
+{
+    uint32_t number_be = Endian_hostToBigEndian32(number);
+    Bits_memcpyConst(bytes, &number_be, 4);
+}
+
+static int load(struct SessionWarmup* warmup)
+{
+    uint8_t header[HEADER_SIZE];
+    if (fread(header, HEADER_SIZE, 1, warmup->file) != 1
+        || Bits_memcmp(header, MAGIC, 8)
+        || readInt(&header[12]) != ENTRY_SIZE)
+    {
+        return 0;
+    }
+    uint32_t count = readInt(&header[8]);
+    int loaded = 0;
+    uint8_t ip6[ENTRY_SIZE];
+    for (uint32_t i = 0; i < count && i < SessionWarmup_MAX_DESTINATIONS; i++) {
+        if (fread(ip6, ENTRY_SIZE, 1, warmup->file) != 1) {
+            break;
+        }
+        if (AddressCalc_validAddress(ip6) && !SessionWarmup_warm(ip6, warmup)) {
+            loaded++;
+        }
+    }
+    return loaded;
+}
+
+/** See: SessionWarmup.h */
+int SessionWarmup_save(struct SessionWarmup* warmup)
+{
+    if (!warmup->file) {
+        return -1;
+    }
+    struct Allocator* tempAlloc = Allocator_child(warmup->alloc);
+    struct SessionManager_HandleList* handles = SessionManager_getHandleList(warmup->sm, tempAlloc);
+    struct Usage* usage = Allocator_malloc(tempAlloc, sizeof(struct Usage) * (handles->count + 1));
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < handles->count; i++) {
+        struct SessionManager_Session* session =
+            SessionManager_sessionForHandle(handles->handles[i], warmup->sm);
+        struct CryptoAuth_Stats* stats = CryptoAuth_getStats(&session->iface);
+        // Sessions which only carried a ping or two are not worth warming.
+        if (stats->packetsIn + stats->packetsOut < 4) {
+            continue;
+        }
+        Bits_memcpyConst(usage[used].ip6, session->ip6, 16);
+        usage[used++].packets = stats->packetsIn + stats->packetsOut;
+    }
+    Order_OfUsage_qsort(usage, used);
+
+    uint32_t count = (used < warmup->count) ? used : warmup->count;
+    uint8_t header[HEADER_SIZE];
+    Bits_memcpyConst(header, MAGIC, 8);
+    writeInt(&header[8], count);
+    writeInt(&header[12], ENTRY_SIZE);
+    int ret = count;
+    if (fseek(warmup->file, 0, SEEK_SET)
+        || fwrite(header, HEADER_SIZE, 1, warmup->file) != 1)
+    {
+        ret = -1;
+    }
+    for (uint32_t i = 0; ret >= 0 && i < count; i++) {
+        if (fwrite(usage[i].ip6, ENTRY_SIZE, 1, warmup->file) != 1) {
+            ret = -1;
+        }
+    }
+    if (ret >= 0 && fflush(warmup->file)) {
+        ret = -1;
+    }
+    Allocator_free(tempAlloc);
+    return ret;
+}
+
+static void saveCycle(void* vwarmup)
+{
+    struct SessionWarmup* warmup = Identity_cast((struct SessionWarmup*) vwarmup);
+    if (SessionWarmup_save(warmup) < 0) {
+        Log_warn(warmup->logger, "Failed to write the most used destinations");
+    }
+}
+
+static int onFree(struct Allocator_OnFreeJob* job)
+{
+    struct SessionWarmup* warmup = Identity_cast((struct SessionWarmup*) job->userData);
+    if (warmup->file) {
+        saveCycle(warmup);
+        fclose(warmup->file);
+    }
+    return 0;
+}
+
+/** See: SessionWarmup.h */
+int SessionWarmup_open(char* path, uint32_t count, struct SessionWarmup* warmup)
+{
+    if (warmup->file) {
+        return -1;
+    }
+    FILE* file = fopen(path, "r+b");
+    if (!file) {
+        file = fopen(path, "w+b");
+    }
+    if (!file) {
+        Log_warn(warmup->logger, "Unable to open the file of most used destinations [%s]", path);
+        return -1;
+    }
+    warmup->file = file;
+    warmup->count =
+        (count < SessionWarmup_MAX_DESTINATIONS) ? count : SessionWarmup_MAX_DESTINATIONS;
+
+    int loaded = load(warmup);
+    Log_info(warmup->logger, "Warming sessions to [%d] destinations from the last run", loaded);
+
+    Timeout_setInterval(saveCycle,
+                        warmup,
+                        SessionWarmup_SAVE_INTERVAL_MILLISECONDS,
+                        warmup->base,
+                        warmup->alloc);
+    return loaded;
+}
+
+/** See: SessionWarmup.h */
+struct SessionWarmup* SessionWarmup_new(struct SearchRunner* searchRunner,
+                                        struct RouterModule* router,
+                                        struct SessionManager* sm,
+                                        struct EventBase* base,
+                                        struct Log* logger,
+                                        struct Allocator* alloc)
+{
+    struct SessionWarmup* warmup = Allocator_clone(alloc, (&(struct SessionWarmup) {
+        .searchRunner = searchRunner,
+        .router = router,
+        .sm = sm,
+        .base = base,
+        .logger = logger,
+        .alloc = alloc
+    }));
+    Identity_set(warmup);
+    Timeout_setInterval(retry, warmup, RETRY_MILLISECONDS, base, alloc);
+    Allocator_onFree(alloc, onFree, warmup);
+    return warmup;
+}
@@ -0,0 +1,87 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SessionWarmup_H
+#define SessionWarmup_H
+
+#include "dht/dhtcore/RouterModule.h"
+#include "dht/dhtcore/SearchRunner.h"
+#include "interface/SessionManager.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/log/Log.h"
+#include "util/Linker.h"
+Linker_require("net/SessionWarmup.c")
+
+#include <stdint.h>
+
+/**
+ * Sets up sessions before there is any traffic for them so that the first packet to a
+ * destination which is used all the time does not wait for a search and a handshake.
+ * A session is warmed by searching for the node and then pinging it, the ping goes over
+ * the same session as traffic from the TUN so the key exchange is done by the time the
+ * first packet arrives.
+ *
+ * The most used destinations can be saved to a file and warmed again at the next start.
+ * The file is a 16 byte header: the magic "cjdnsSW1", the number of entries and the size
+ * of each entry, followed by the 16 byte addresses, most used first, numbers big endian.
+ */
+struct SessionWarmup;
+
+/** How often the most used destinations are written to the file. */
+#define SessionWarmup_SAVE_INTERVAL_MILLISECONDS 60000
+
+/** No more than this many destinations are saved or warmed at once. */
+#define SessionWarmup_MAX_DESTINATIONS 64
+
+struct SessionWarmup* SessionWarmup_new(struct SearchRunner* searchRunner,
+                                        struct RouterModule* router,
+                                        struct SessionManager* sm,
+                                        struct EventBase* base,
+                                        struct Log* logger,
+                                        struct Allocator* alloc);
+
+/**
+ * Begin setting up a session with a node.
+ *
+ * If the node is not known it is searched for, again every few seconds for a while if it
+ * can't be found, so destinations can be given before there are any peers.
+ *
+ * @param ip6 the address of the node.
+ * @param warmup
+ * @return 0 if the session is being set up, -1 if too many destinations are waiting to be found.
+ */
+int SessionWarmup_warm(uint8_t ip6[16], struct SessionWarmup* warmup);
+
+/**
+ * Warm the destinations which are saved in a file and begin saving the most used
+ * destinations to it periodically.
+ * The file is held open so that saving continues after Security_dropPermissions().
+ *
+ * @param path the file, it will be created if it does not exist.
+ * @param count the number of destinations to save, at most SessionWarmup_MAX_DESTINATIONS.
+ * @param warmup
+ * @return the number of destinations which were loaded or -1 if the file could not be opened
+ *         or one is already open.
+ */
+int SessionWarmup_open(char* path, uint32_t count, struct SessionWarmup* warmup);
+
+/**
+ * Write the most used destinations to the file now.
+ *
+ * @return the number of destinations written or -1 if no file is open or writing failed.
+ */
+int SessionWarmup_save(struct SessionWarmup* warmup);
+
+#endif
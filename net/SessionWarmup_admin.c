@@ -0,0 +1,107 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "crypto/AddressCalc.h"
+#include "memory/Allocator.h"
+#include "net/SessionWarmup.h"
+#include "net/SessionWarmup_admin.h"
+#include "util/AddrTools.h"
+#include "util/Identity.h"
+
+/** The number of destinations which are saved unless the caller says otherwise. */
+#define DEFAULT_COUNT 16
+
+struct Context {
+    struct Admin* admin;
+    struct SessionWarmup* warmup;
+    Identity
+};
+
+static void warm(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    String* ip6Str = Dict_getString(args, String_CONST("ip6"));
+    uint8_t ip6[16];
+    char* err = "none";
+    if (AddrTools_parseIp(ip6, (uint8_t*) ip6Str->bytes) || !AddressCalc_validAddress(ip6)) {
+        err = "parse_ip";
+    } else if (SessionWarmup_warm(ip6, ctx->warmup)) {
+        err = "too many sessions are being warmed";
+    }
+    Dict* response = Dict_new(alloc);
+    Dict_putString(response, String_CONST("error"), String_new(err, alloc), alloc);
+    Admin_sendMessage(response, txid, ctx->admin);
+}
+
+static void openFile(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    String* path = Dict_getString(args, String_CONST("path"));
+    int64_t* countP = Dict_getInt(args, String_CONST("count"));
+    int64_t count = (countP) ? *countP : DEFAULT_COUNT;
+    Dict* response = Dict_new(alloc);
+    String* loadedKey = String_CONST("loaded");
+    char* err = "none";
+    int loaded;
+    if (count < 0 || count > SessionWarmup_MAX_DESTINATIONS) {
+        err = "count out of range";
+    } else if ((loaded = SessionWarmup_open(path->bytes, count, ctx->warmup)) < 0) {
+        err = "unable to open file";
+    } else {
+        Dict_putInt(response, loadedKey, loaded, alloc);
+    }
+    Dict_putString(response, String_CONST("error"), String_new(err, alloc), alloc);
+    Admin_sendMessage(response, txid, ctx->admin);
+}
+
+static void save(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    Dict* response = Dict_new(alloc);
+    String* savedKey = String_CONST("saved");
+    char* err = "none";
+    int saved = SessionWarmup_save(ctx->warmup);
+    if (saved < 0) {
+        err = "no file is open or writing failed";
+    } else {
+        Dict_putInt(response, savedKey, saved, alloc);
+    }
+    Dict_putString(response, String_CONST("error"), String_new(err, alloc), alloc);
+    Admin_sendMessage(response, txid, ctx->admin);
+}
+
+void SessionWarmup_admin_register(struct SessionWarmup* warmup,
+                                  struct Admin* admin,
+                                  struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .admin = admin,
+        .warmup = warmup
+    }));
+    Identity_set(ctx);
+
+    Admin_registerFunction("SessionWarmup_warm", warm, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "ip6", .required = 1, .type = "String" }
+        }), admin);
+    Admin_registerFunction("SessionWarmup_open", openFile, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "path", .required = 1, .type = "String" },
+            { .name = "count", .required = 0, .type = "Int" }
+        }), admin);
+    Admin_registerFunction("SessionWarmup_save", save, ctx, true, NULL, admin);
+}
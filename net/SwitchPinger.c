@@ -55,6 +55,9 @@ struct SwitchPinger
     /** Maximum number of pings which can be outstanding at one time. */
     int maxConcurrentPings;
 
+    /** Round trip times of the pings which were answered correctly. */
+    struct Histogram rtts;
+
     Identity
 };
 
@@ -134,6 +137,10 @@ static void onPingResponse(String* data, uint32_t milliseconds, void* vping)
         err = SwitchPinger_Result_TIMEOUT;
     }
 
+    if (err == SwitchPinger_Result_OK) {
+        Histogram_add(&p->context->rtts, milliseconds);
+    }
+
     uint32_t version = p->context->incomingVersion;
     p->onResponse(err, label, data, milliseconds, version, p->public.onResponseContext);
 }
@@ -218,7 +225,7 @@ struct SwitchPinger_Ping* SwitchPinger_newPing(uint64_t label,
                                                struct Allocator* alloc,
                                                struct SwitchPinger* ctx)
 {
-    if (data && data->len > Control_Ping_MAX_SIZE) {
+    if (data && data->len > SwitchPinger_MAX_DATA_SIZE) {
         return NULL;
     }
 
@@ -249,6 +256,17 @@ struct SwitchPinger_Ping* SwitchPinger_newPing(uint64_t label,
     return &ping->public;
 }
 
+void SwitchPinger_reservePings(int count, struct SwitchPinger* ctx)
+{
+    ctx->maxConcurrentPings += count;
+    Assert_true(ctx->maxConcurrentPings >= SwitchPinger_DEFAULT_MAX_CONCURRENT_PINGS);
+}
+
+struct Histogram* SwitchPinger_rtts(struct SwitchPinger* ctx)
+{
+    return &ctx->rtts;
+}
+
 void SwitchPinger_sendPing(struct SwitchPinger_Ping* ping)
 {
     struct Ping* p = Identity_cast((struct Ping*) ping);
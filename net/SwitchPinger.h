@@ -20,13 +20,21 @@
 #include "interface/Interface.h"
 #include "util/events/EventBase.h"
 #include "util/log/Log.h"
+#include "util/Histogram.h"
 #include "util/Linker.h"
 Linker_require("net/SwitchPinger.c")
 
 #include <stdint.h>
 
+/** The number of pings which can be outstanding before any are reserved. */
 #define SwitchPinger_DEFAULT_MAX_CONCURRENT_PINGS 50
 
+/**
+ * The largest amount of data which can be sent in a ping, pings larger than
+ * Control_Ping_MAX_SIZE are only useful as path MTU probes.
+ */
+#define SwitchPinger_MAX_DATA_SIZE 1536
+
 enum SwitchPinger_Result
 {
     /** Ping responded to ok. */
@@ -88,7 +96,7 @@ String* SwitchPinger_resultString(enum SwitchPinger_Result result);
  *
  * @param label the HOST ORDER label of the node to send the ping message to.
  * @param data the content of the ping to send, if NULL, an empty string will be
- *             returned in the response.
+ *             returned in the response. At most SwitchPinger_MAX_DATA_SIZE bytes.
  * @param timeoutMilliseconds how long to wait before failing the ping.
  * @param onResponse the callback after the on pong or timeout.
  * @param alloc free this to cancel the ping.
@@ -108,6 +116,23 @@ struct SwitchPinger_Ping* SwitchPinger_newPing(uint64_t label,
  */
 void SwitchPinger_sendPing(struct SwitchPinger_Ping* ping);
 
+/**
+ * Raise or lower the number of pings which can be outstanding at one time, this lets the limit
+ * grow with the number of peers which need to be pinged so that a large number of peers does
+ * not run out of pings.
+ *
+ * @param count the number of pings to add, negative to give back pings which were added before.
+ * @param ctx the pinger
+ */
+void SwitchPinger_reservePings(int count, struct SwitchPinger* ctx);
+
+/**
+ * Get the round trip times of every ping which was answered correctly, in milliseconds.
+ *
+ * @param ctx the pinger
+ */
+struct Histogram* SwitchPinger_rtts(struct SwitchPinger* ctx);
+
 struct SwitchPinger* SwitchPinger_new(struct Interface* iface,
                                       struct EventBase* eventBase,
                                       struct Random* rand,
@@ -19,6 +19,7 @@
 #include "dht/Address.h"
 #include "net/SwitchPinger.h"
 #include "util/Endian.h"
+#include "util/Histogram.h"
 
 #define DEFAULT_TIMEOUT 2000
 
@@ -108,6 +109,13 @@ static void adminPing(Dict* args, void* vcontext, String* txid, struct Allocator
     }
 }
 
+static void adminRtts(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    Dict* out = Histogram_toDict(SwitchPinger_rtts(context->switchPinger), requestAlloc);
+    Admin_sendMessage(out, txid, context->admin);
+}
+
 void SwitchPinger_admin_register(struct SwitchPinger* sp,
                                  struct Admin* admin,
                                  struct Allocator* alloc)
@@ -124,4 +132,6 @@ void SwitchPinger_admin_register(struct SwitchPinger* sp,
             { .name = "timeout", .required = 0, .type = "Int" },
             { .name = "data", .required = 0, .type = "String" }
         }), admin);
+
+    Admin_registerFunction("SwitchPinger_rtts", adminRtts, ctx, true, NULL, admin);
 }
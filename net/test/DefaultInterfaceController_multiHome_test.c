@@ -0,0 +1,85 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crypto/random/Random.h"
+#include "interface/InterfaceController.h"
+#include "memory/MallocAllocator.h"
+#include "memory/Allocator.h"
+#include "test/TestFramework.h"
+#include "util/Assert.h"
+
+static int allocatorsFreed;
+static int allocatorFreed(struct Allocator_OnFreeJob* job)
+{
+    allocatorsFreed++;
+    return 0;
+}
+
+static uint8_t sendMessage(struct Message* msg, struct Interface* iface)
+{
+    (*((int*) iface->senderContext))++;
+    return 0;
+}
+
+// Registering the same key over a second interface adds a link to the peer, not another peer.
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct TestFramework* tf = TestFramework_setUp(NULL, alloc, NULL);
+    struct TestFramework* other =
+        TestFramework_setUp("\xad\x7e\xa3\x26\xaa\x01\x94\x0a\x25\xbc\x9e\x01\x26\x22\xdb\x69"
+                            "\x4f\xd9\xb4\x17\x7c\xf3\xf8\x91\x16\xf3\xcf\xe8\x5c\x80\xe1\x4a",
+                            alloc, NULL);
+
+    int sentOverFirst = 0;
+    struct Allocator* firstAlloc = Allocator_child(alloc);
+    struct Interface* first = Allocator_clone(firstAlloc, (&(struct Interface) {
+        .sendMessage = sendMessage,
+        .senderContext = &sentOverFirst,
+        .allocator = firstAlloc
+    }));
+
+    int sentOverSecond = 0;
+    struct Allocator* secondAlloc = Allocator_child(alloc);
+    struct Interface* second = Allocator_clone(secondAlloc, (&(struct Interface) {
+        .sendMessage = sendMessage,
+        .senderContext = &sentOverSecond,
+        .allocator = secondAlloc
+    }));
+    Allocator_onFree(secondAlloc, allocatorFreed, NULL);
+
+    Assert_always(!InterfaceController_registerPeer(tf->ifController,
+                                                    other->publicKey,
+                                                    NULL, false, false, first));
+    // The new peer is pinged right away.
+    Assert_always(sentOverFirst == 1);
+
+    Assert_always(!InterfaceController_registerPeer(tf->ifController,
+                                                    other->publicKey,
+                                                    NULL, false, false, second));
+    Assert_always(sentOverSecond == 0);
+
+    struct InterfaceController_peerStats* stats;
+    Assert_always(tf->ifController->getPeerStats(tf->ifController, alloc, &stats) == 1);
+    Assert_always(InterfaceController_getPeerState(tf->ifController, second)
+        == InterfaceController_getPeerState(tf->ifController, first));
+
+    // Without the session the second link is useless so it goes with the first.
+    Allocator_free(firstAlloc);
+    Assert_always(allocatorsFreed == 1);
+    Assert_always(tf->ifController->getPeerStats(tf->ifController, alloc, &stats) == 0);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -121,6 +121,29 @@ static int reconnectionNewEndpointTest(struct InterfaceController* ifController,
         }
     }
 
+    // Messages which come in during a burst are held until it ends and then decrypted and
+    // switched together, even though the sender frees them as soon as they are handed over.
+    InterfaceController_beginBurst(ifController);
+    for (int i = 0; i < 3; i++) {
+        struct Allocator* msgAlloc = Allocator_child(alloc);
+        struct Message* msg = Message_new(12, 512, msgAlloc);
+        Bits_memcpyConst(msg->bytes, "hello world", 12);
+        Message_shift(msg, Headers_SwitchHeader_SIZE, NULL);
+        Bits_memcpyConst(msg->bytes, (&(struct Headers_SwitchHeader) {
+            .label_be = Endian_hostToBigEndian64(1),
+            .lowBits_be = 0
+        }), Headers_SwitchHeader_SIZE);
+        wrapped->sendMessage(msg, wrapped);
+
+        *fromSwitchPtr = NULL;
+        icIface.receiveMessage(msg, &icIface);
+        Allocator_free(msgAlloc);
+        Assert_always(!*fromSwitchPtr);
+    }
+    InterfaceController_endBurst(ifController);
+    // The messages are gone again once the burst is over so only check that they came out.
+    Assert_always(*fromSwitchPtr);
+
     // check everything except the label
     Assert_always(!strcmp((char*)hexBuffer+16, "0000000068656c6c6f20776f726c6400"));
     // check label: make sure the interface has been switched back into position 0.
@@ -93,6 +93,19 @@ Builder.configure({
             '-D','EXPERIMENTAL_PATHFINDER=1'
         );
     }
+    if (process.env['USDT_PROBES']) {
+        // Static tracepoints for bpftrace, see util/Probe.h, needs <sys/sdt.h>.
+        console.log("Building with USDT probes");
+        builder.config.cflags.push(
+            '-D','Probe_USDT=1'
+        );
+    }
+    if (process.env['FRAME_POINTERS']) {
+        // So that perf can walk the stack without DWARF unwinding.
+        builder.config.cflags.push(
+            '-fno-omit-frame-pointer'
+        );
+    }
     if (SYSTEM === 'win32') {
         builder.config.cflags.push(
             '!-fPIE',
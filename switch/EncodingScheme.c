@@ -25,10 +25,9 @@ int EncodingScheme_getFormNum(struct EncodingScheme* scheme, uint64_t routeLabel
         return 0;
     }
 
+    // The forms were checked by EncodingScheme_isSane() so prefixLen is between 1 and 31.
     for (int i = 0; i < scheme->count; i++) {
         struct EncodingScheme_Form* form = &scheme->forms[i];
-        Assert_true(form->prefixLen > 0 && form->prefixLen < 32);
-        Assert_true(form->bitCount > 0 && form->bitCount < 32);
         if (0 == ((form->prefix ^ (uint32_t)routeLabel) << (32 - form->prefixLen))) {
             return i;
         }
@@ -388,6 +387,10 @@ struct EncodingScheme* EncodingScheme_defineDynWidthScheme(struct EncodingScheme
 
 int EncodingScheme_compare(struct EncodingScheme* a, struct EncodingScheme* b)
 {
+    if (a == b) {
+        // Interned schemes, see EncodingSchemeModule.
+        return 0;
+    }
     if (a->count == b->count) {
         return Bits_memcmp(a->forms, b->forms, sizeof(struct EncodingScheme_Form) * a->count);
     }
@@ -108,4 +108,109 @@ static inline bool LabelSplicer_routesThrough(uint64_t destination, uint64_t mid
     return (destination & mask) == (midPath & mask);
 }
 
+/**
+ * Bulk form of LabelSplicer_routesThrough() for checking a path against a whole table.
+ * Determine which of a list of destinations are reached through midPath.
+ * The loop is branch free so the compiler is able to vectorize it.
+ *
+ * @param out an array of at least count bytes, each will be set to 1 if the destination at
+ *            the same index routes through midPath and 0 otherwise.
+ * @param destinations the labels of the nodes to test.
+ * @param count the number of labels in destinations.
+ * @param midPath the node which might be in the middle of the routes.
+ * @return the number of destinations which route through midPath.
+ */
+static inline int LabelSplicer_whichRouteThrough(uint8_t* out,
+                                                 const uint64_t* destinations,
+                                                 int count,
+                                                 uint64_t midPath)
+{
+    // Same as LabelSplicer_routesThrough() but with everything depending only on midPath
+    // taken out of the loop, no destination below midPath matches and if midPath < 2 the
+    // mask covers nothing so every other one does.
+    const uint64_t mask = (midPath < 2) ? 0 : UINT64_MAX >> (64 - Bits_log2x64(midPath));
+    const uint64_t masked = midPath & mask;
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        out[i] = (destinations[i] >= midPath) & ((destinations[i] & mask) == masked);
+        total += out[i];
+    }
+    return total;
+}
+
+/**
+ * Bulk form of LabelSplicer_routesThrough() with the destination fixed.
+ * Determine which of a list of nodes are in the middle of the route to destination.
+ *
+ * @param out an array of at least count bytes, each will be set to 1 if the route to
+ *            destination passes through the midPath at the same index and 0 otherwise.
+ * @param destination the node to route to.
+ * @param midPaths the labels of the nodes to test.
+ * @param count the number of labels in midPaths.
+ * @return the number of midPaths which destination routes through.
+ */
+static inline int LabelSplicer_whichAreRoutedThrough(uint8_t* out,
+                                                     uint64_t destination,
+                                                     const uint64_t* midPaths,
+                                                     int count)
+{
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        out[i] = LabelSplicer_routesThrough(destination, midPaths[i]);
+        total += out[i];
+    }
+    return total;
+}
+
+/**
+ * Bulk form of LabelSplicer_isOneHop().
+ *
+ * @param out an array of at least count bytes, each will be set to 1 if the label at the
+ *            same index is one hop and 0 otherwise.
+ * @param labels the labels to test in host byte order.
+ * @param count the number of labels.
+ * @return the number of labels which are one hop.
+ */
+static inline int LabelSplicer_whichAreOneHop(uint8_t* out, const uint64_t* labels, int count)
+{
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        out[i] = LabelSplicer_isOneHop(labels[i]);
+        total += out[i];
+    }
+    return total;
+}
+
+/**
+ * Bulk form of LabelSplicer_splice() for splicing all of the labels in a reply from a node
+ * on to the label of that node.
+ *
+ * @param out an array of at least count labels, each will be set to the spliced label or
+ *            UINT64_MAX if the label at the same index is too long to be spliced.
+ *            This may be the same array as goHere.
+ * @param goHere the labels to splice in host byte order.
+ * @param count the number of labels.
+ * @param viaHere the label which all of the labels in goHere are relative to.
+ */
+static inline void LabelSplicer_spliceAll(uint64_t* out,
+                                          const uint64_t* goHere,
+                                          int count,
+                                          uint64_t viaHere)
+{
+    // Same as LabelSplicer_splice() but a label fits if it is less than 2^(61 - log2(viaHere))
+    // so the only thing left in the loop is a shift.
+    const int log2ViaHere = Bits_log2x64(viaHere);
+    if (log2ViaHere > 60) {
+        for (int i = 0; i < count; i++) {
+            out[i] = UINT64_MAX;
+        }
+        return;
+    }
+    const int tooBig = 61 - log2ViaHere;
+    for (int i = 0; i < count; i++) {
+        uint64_t spliced = ((goHere[i] ^ 1) << log2ViaHere) ^ viaHere;
+        out[i] = (goHere[i] >> tooBig) ? UINT64_MAX : spliced;
+    }
+}
+
 #endif
@@ -17,6 +17,7 @@
 
 #include "switch/EncodingScheme.h"
 #include "util/Bits.h"
+#include "util/CString.h"
 #include <stdint.h>
 
 /* right now 4 implementations:
@@ -35,6 +36,7 @@
  * Fixed 4 bit scheme: 15 peers + 1 router
  **********************/
 # define NumberCompress_f4_INTERFACES 16
+# define NumberCompress_f4_MAX_BITS 4
 
 static inline struct EncodingScheme* NumberCompress_f4_defineScheme(struct Allocator* alloc)
 {
@@ -71,6 +73,7 @@ static inline uint32_t NumberCompress_f4_getDecompressed(const uint64_t label,
 // that way XXXX is never 1
 // so map numbers 16-239 -> 32-255, and 240 <-> 1, then swap nibbles
 # define NumberCompress_f8_INTERFACES 241
+# define NumberCompress_f8_MAX_BITS 8
 
 static inline struct EncodingScheme* NumberCompress_f8_defineScheme(struct Allocator* alloc)
 {
@@ -142,6 +145,7 @@ static inline uint32_t NumberCompress_f8_getDecompressed(const uint64_t label,
  *   2   00000000-11111111      00          0-256        10 (skip the number 1)
  */
 # define NumberCompress_v3x5x8_INTERFACES 257
+# define NumberCompress_v3x5x8_MAX_BITS 10
 static inline struct EncodingScheme* NumberCompress_v3x5x8_defineScheme(struct Allocator* alloc)
 {
     return EncodingScheme_defineDynWidthScheme(
@@ -246,6 +250,7 @@ static inline uint32_t NumberCompress_v3x5x8_getDecompressed(const uint64_t labe
  *   1   00000000-11111111       0          0-255        9
  */
 # define NumberCompress_v4x8_INTERFACES 257
+# define NumberCompress_v4x8_MAX_BITS 9
 static inline struct EncodingScheme* NumberCompress_v4x8_defineScheme(struct Allocator* alloc)
 {
     return EncodingScheme_defineDynWidthScheme(
@@ -313,11 +318,81 @@ static inline uint32_t NumberCompress_v4x8_bitsUsedForNumber(const uint32_t numb
     return (number < 15) ? 5 : 9;
 }
 
+/** The largest number of interfaces and largest label width of any of the schemes above. */
+#define NumberCompress_INTERFACES_MAX 257
+#define NumberCompress_BITS_MAX 10
+
+/**
+ * A description of one of the schemes above so that a scheme can be chosen at runtime.
+ * Calling through these pointers is fine for setup but hot paths should be specialized
+ * for each scheme using the NumberCompress_<type>_* functions directly and the specialized
+ * function chosen once when the scheme is, see SwitchCore.c.
+ */
+struct NumberCompress_Scheme
+{
+    /** The name of the scheme, eg: "v4x8". */
+    const char* name;
+
+    /** The number of interfaces which can be represented. */
+    uint32_t interfaces;
+
+    /** The widest label which will be used. */
+    uint32_t maxBits;
+
+    uint32_t (* bitsUsedForLabel)(const uint64_t label);
+    uint32_t (* bitsUsedForNumber)(const uint32_t number);
+    uint64_t (* getCompressed)(const uint32_t number, const uint32_t bitsUsed);
+    uint32_t (* getDecompressed)(const uint64_t label, const uint32_t bitsUsed);
+    struct EncodingScheme* (* defineScheme)(struct Allocator* alloc);
+};
+
+#define NumberCompress_SCHEME(type) {                           \
+    .name = #type,                                              \
+    .interfaces = NumberCompress_ ## type ## _INTERFACES,       \
+    .maxBits = NumberCompress_ ## type ## _MAX_BITS,            \
+    .bitsUsedForLabel = NumberCompress_ ## type ## _bitsUsedForLabel,   \
+    .bitsUsedForNumber = NumberCompress_ ## type ## _bitsUsedForNumber, \
+    .getCompressed = NumberCompress_ ## type ## _getCompressed,         \
+    .getDecompressed = NumberCompress_ ## type ## _getDecompressed,     \
+    .defineScheme = NumberCompress_ ## type ## _defineScheme            \
+}
+
+#define NumberCompress_STRINGIFY(x) NumberCompress__STRINGIFY(x)
+#define NumberCompress__STRINGIFY(x) #x
+#define NumberCompress_DEFAULT_NAME NumberCompress_STRINGIFY(NumberCompress_TYPE)
+
+/**
+ * Get a scheme by name.
+ *
+ * @param name the name of the scheme, eg: "v4x8" or NULL for the scheme which is compiled in
+ *             as NumberCompress_TYPE.
+ * @return the scheme or NULL if there is no scheme by that name.
+ */
+static inline const struct NumberCompress_Scheme* NumberCompress_schemeForName(const char* name)
+{
+    static const struct NumberCompress_Scheme schemes[] = {
+        NumberCompress_SCHEME(f4),
+        NumberCompress_SCHEME(f8),
+        NumberCompress_SCHEME(v3x5x8),
+        NumberCompress_SCHEME(v4x8)
+    };
+    if (!name) {
+        name = NumberCompress_DEFAULT_NAME;
+    }
+    for (int i = 0; i < (int)(sizeof(schemes) / sizeof(*schemes)); i++) {
+        if (!CString_strcmp(name, schemes[i].name)) {
+            return &schemes[i];
+        }
+    }
+    return NULL;
+}
+
 #define NumberCompress_MKNAME(x) NumberCompress__MKNAME(NumberCompress_TYPE, x)
 #define NumberCompress__MKNAME(y, x) NumberCompress___MKNAME(y, x)
 #define NumberCompress___MKNAME(y, x) NumberCompress_ ## y ## _ ## x
 
 #define NumberCompress_INTERFACES NumberCompress_MKNAME(INTERFACES)
+#define NumberCompress_MAX_BITS NumberCompress_MKNAME(MAX_BITS)
 #define NumberCompress_defineScheme(a) NumberCompress_MKNAME(defineScheme)(a)
 #define NumberCompress_bitsUsedForLabel(label) NumberCompress_MKNAME(bitsUsedForLabel)(label)
 #define NumberCompress_bitsUsedForNumber(number) NumberCompress_MKNAME(bitsUsedForNumber)(number)
@@ -19,7 +19,11 @@
 #include "switch/NumberCompress.h"
 #include "util/Bits.h"
 #include "util/Checksum.h"
+#include "util/CString.h"
 #include "util/Endian.h"
+#include "util/Gcc.h"
+#include "util/Probe.h"
+#include "util/events/Time.h"
 #include "wire/Control.h"
 #include "wire/Error.h"
 #include "wire/Headers.h"
@@ -28,6 +32,17 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
+/**
+ * Errors of each type which may be sent to an interface per interval, once an interface has
+ * had this many, more are suppressed until the interval is over. This way a dead link costs
+ * a few errors per interval rather than one for every packet which is sent toward it.
+ */
+#define ERRORS_PER_INTERVAL 8
+#define ERROR_INTERVAL_MILLISECONDS 1000
+
+/** Each error type has its own count, unknown error types share the last slot. */
+#define ERROR_SLOTS (Error_UNDELIVERABLE + 2)
+
 struct SwitchInterface
 {
     struct Interface* iface;
@@ -37,60 +52,182 @@ struct SwitchInterface
     struct Allocator_OnFreeJob* onFree;
 
     /**
-     * How much traffic has flowed down an interface as the sum of all packet priority.
-     * If this number reaches bufferMax, further incoming traffic is dropped to prevent flooding.
-     * Users should periodically adjust the buffer toward zero to fairly meter out priority in
-     * congestion situations.
+     * Token bucket limiting how much traffic the connected node may send into the switch.
+     * Each packet which comes in on this interface costs its length in tokens, tokens are added
+     * back at rateLimit bytes per second up to burstSize. If there are not enough tokens the
+     * packet is dropped so a node which floods is throttled down to its rate without affecting
+     * traffic from anyone else. A rateLimit of 0 means the interface is not limited.
      */
-    int64_t buffer;
+    uint32_t rateLimit;
+    uint32_t burstSize;
+    uint32_t tokens;
 
     /**
-     * How high the buffer is allowed to get before beginning to drop packets.
-     * For nodes in the core, this number should be large because a buffer
-     * limit of a core link will cause route flapping.
-     * For edge nodes it is a measure of how much the ISP trusts the end user not to flood.
+     * Thousandths of a token which were earned since lastRefill but not yet added, without them
+     * a rate under 1000 bytes per second would never refill when packets come every millisecond.
      */
-    int64_t bufferMax;
+    uint32_t tokenRemainder;
+
+    /** When tokens were last added, in milliseconds. */
+    uint64_t lastRefill;
+
+    /** Number of errors of each type sent in the current interval, see ERRORS_PER_INTERVAL. */
+    uint8_t errorCounts[ERROR_SLOTS];
+
+    /** When the current error interval began, in milliseconds. */
+    uint64_t errorIntervalStart;
 
     /**
      * How congested an interface is.
      * this number is subtraced from packet priority when the packet is sent down this interface.
      */
     uint32_t congestion;
+
+    /** The number of bits needed to represent the number of this interface. */
+    uint32_t bitsUsed;
+
+    /**
+     * The bit reversed compressed form of this interface's number, indexed by the width of the
+     * label which it will be spliced onto. Everything about an interface's number is fixed when
+     * it is added so the return path is precomputed rather than encoded for every packet.
+     * Widths which are not possible in the encoding scheme are left as zero.
+     */
+    uint64_t reversedLabels[NumberCompress_BITS_MAX + 1];
 };
 
 struct SwitchCore
 {
-    struct SwitchInterface interfaces[NumberCompress_INTERFACES];
+    struct SwitchInterface interfaces[NumberCompress_INTERFACES_MAX];
     uint32_t interfaceCount;
     bool routerAdded;
     struct Log* logger;
+    struct EventBase* eventBase;
+
+    /** The scheme which labels are compressed with. */
+    const struct NumberCompress_Scheme* scheme;
+
+    /** decodeLabel() and receiveMessage() specialized for the scheme. */
+    int32_t (* decodeLabel)(struct Message* message,
+                            struct SwitchInterface* sourceIf,
+                            uint64_t* labelOut);
+    Interface_CALLBACK(receiveMessage);
+
+    /**
+     * Counters for the interface in the same slot of interfaces.
+     * These are kept apart from the interfaces because they are written for every packet while
+     * the interfaces are only read, each is padded to a multiple of the cache line size.
+     */
+    union {
+        struct SwitchCore_Stats stats;
+        uint8_t padding[(sizeof(struct SwitchCore_Stats) + 63) & ~63];
+    } stats[NumberCompress_INTERFACES_MAX];
 
     struct Allocator* allocator;
 };
 
-struct SwitchCore* SwitchCore_new(struct Log* logger, struct Allocator* allocator)
+static inline struct SwitchCore_Stats* statsFor(struct SwitchInterface* si)
 {
-    struct SwitchCore* core = Allocator_calloc(allocator, sizeof(struct SwitchCore), 1);
-    core->allocator = allocator;
-    core->interfaceCount = 0;
-    core->logger = logger;
-    return core;
+    return &si->core->stats[si - si->core->interfaces].stats;
+}
+
+static inline void countDrop(struct SwitchInterface* si,
+                             enum SwitchCore_DropReason reason,
+                             uint32_t length)
+{
+    struct SwitchCore_Stats* stats = statsFor(si);
+    stats->droppedPackets[reason]++;
+    stats->droppedBytes[reason] += length;
+}
+
+/** Fill in the precomputed label fields, must be called any time an interface changes slots. */
+static void computeLabels(struct SwitchInterface* si)
+{
+    const struct NumberCompress_Scheme* scheme = si->core->scheme;
+    const uint32_t index = si - si->core->interfaces;
+    si->bitsUsed = scheme->bitsUsedForNumber(index);
+    Bits_memset(si->reversedLabels, 0, sizeof(si->reversedLabels));
+    for (uint32_t i = 0; i < scheme->interfaces; i++) {
+        const uint32_t bits = scheme->bitsUsedForNumber(i);
+        if (bits < si->bitsUsed || si->reversedLabels[bits]) {
+            continue;
+        }
+        si->reversedLabels[bits] = Bits_bitReverse64(scheme->getCompressed(index, bits));
+    }
+}
+
+/**
+ * Take tokens for a packet from the interface's bucket.
+ *
+ * @return true if the packet is within the rate limit, false if it should be dropped.
+ */
+static inline bool takeTokens(struct SwitchInterface* si, uint32_t length)
+{
+    if (!si->rateLimit) {
+        return true;
+    }
+    uint64_t now = Time_currentTimeMilliseconds(si->core->eventBase);
+    if (now > si->lastRefill) {
+        // Cap the elapsed time so the multiplication can't overflow, more than a few seconds
+        // is going to fill any sane bucket anyway.
+        uint64_t elapsed = now - si->lastRefill;
+        elapsed = (elapsed > UINT32_MAX) ? UINT32_MAX : elapsed;
+        uint64_t earned = elapsed * si->rateLimit + si->tokenRemainder;
+        uint64_t tokens = si->tokens + (earned / 1000);
+        if (tokens >= si->burstSize) {
+            si->tokens = si->burstSize;
+            si->tokenRemainder = 0;
+        } else {
+            si->tokens = tokens;
+            si->tokenRemainder = earned % 1000;
+        }
+        si->lastRefill = now;
+    }
+    if (si->tokens < length) {
+        return false;
+    }
+    si->tokens -= length;
+    return true;
+}
+
+/** @return the label for the interface at index as given out by SwitchCore_addInterface(). */
+static uint64_t labelForIndex(const struct NumberCompress_Scheme* scheme, uint32_t index)
+{
+    if (index == 1) {
+        return 1;
+    }
+    uint32_t bits = scheme->bitsUsedForNumber(index);
+    return scheme->getCompressed(index, bits) | (((uint64_t)1) << bits);
 }
 
 static inline uint16_t sendMessage(const struct SwitchInterface* switchIf,
                                    struct Message* toSend,
                                    struct Log* logger)
 {
-    struct Headers_SwitchHeader* switchHeader = (struct Headers_SwitchHeader*) toSend->bytes;
+    return Interface_sendMessage(switchIf->iface, toSend);
+}
 
-    uint32_t priority = Headers_getPriority(switchHeader);
-    if (switchIf->buffer + priority > switchIf->bufferMax) {
-        uint32_t messageType = Headers_getMessageType(switchHeader);
-        Headers_setPriorityAndMessageType(switchHeader, 0, messageType);
+/**
+ * Count an error of the given type against the interface it is to be sent to.
+ *
+ * @return true if the error should be sent, false if the interface has had too many.
+ */
+static inline bool allowError(struct SwitchInterface* si, uint32_t code)
+{
+    if (si == &si->core->interfaces[1]) {
+        // Errors to the router don't go over the wire.
+        return true;
     }
-
-    return Interface_sendMessage(switchIf->iface, toSend);
+    uint64_t now = Time_currentTimeMilliseconds(si->core->eventBase);
+    if (now - si->errorIntervalStart >= ERROR_INTERVAL_MILLISECONDS) {
+        Bits_memset(si->errorCounts, 0, sizeof(si->errorCounts));
+        si->errorIntervalStart = now;
+    }
+    uint32_t slot = (code < ERROR_SLOTS) ? code : ERROR_SLOTS - 1;
+    if (si->errorCounts[slot] >= ERRORS_PER_INTERVAL) {
+        return false;
+    }
+    si->errorCounts[slot]++;
+    return true;
 }
 
 struct ErrorPacket {
@@ -114,6 +251,11 @@ static inline void sendError(struct SwitchInterface* iface,
         return;
     }
 
+    if (!allowError(iface, code)) {
+        statsFor(iface)->suppressedErrors++;
+        return;
+    }
+
     // limit of 256 bytes
     cause->length =
         (cause->length < Control_Error_MAX_SIZE) ? cause->length : Control_Error_MAX_SIZE;
@@ -135,36 +277,61 @@ static inline void sendError(struct SwitchInterface* iface,
     err->ctrl.checksum_be =
         Checksum_engine((uint8_t*) &err->ctrl, cause->length - Headers_SwitchHeader_SIZE);
 
+    struct SwitchCore_Stats* stats = statsFor(iface);
+    stats->errorPackets++;
+    stats->errorBytes += cause->length;
+
     sendMessage(iface, cause, logger);
 }
 
 #define DEBUG_SRC_DST(logger, message) \
     Log_debug(logger, message " ([%u] to [%u])", sourceIndex, destIndex)
 
-/** This never returns an error, it sends an error packet instead. */
-static uint8_t receiveMessage(struct Message* message, struct Interface* iface)
+/**
+ * Check the rate limit, decode the label and rewrite it for the next hop.
+ * This is always inlined into a version specialized for each scheme (see SWITCH_SCHEME) so that
+ * the scheme functions will be called directly rather than through pointers.
+ *
+ * @param message the packet which came in on sourceIf.
+ * @param sourceIf the interface which the packet came in on.
+ * @param labelOut will be set to the label before it was rewritten, in host order.
+ * @param bitsUsedForLabel NumberCompress_<type>_bitsUsedForLabel() for the scheme.
+ * @param getDecompressed NumberCompress_<type>_getDecompressed() for the scheme.
+ * @param interfaces NumberCompress_<type>_INTERFACES for the scheme.
+ * @return the index of the interface to forward to or -1 if the packet has been dropped
+ *         (an error packet will have been sent if appropriate).
+ */
+static inline Gcc_ALWAYS_INLINE int32_t decodeLabel(
+    struct Message* message,
+    struct SwitchInterface* sourceIf,
+    uint64_t* labelOut,
+    uint32_t (* const bitsUsedForLabel)(const uint64_t label),
+    uint32_t (* const getDecompressed)(const uint64_t label, const uint32_t bitsUsed),
+    const uint32_t interfaces)
 {
-    struct SwitchInterface* sourceIf = (struct SwitchInterface*) iface->receiverContext;
-    if (sourceIf->buffer > sourceIf->bufferMax) {
-        Log_warn(sourceIf->core->logger, "DROP because node seems to be flooding.");
-        return Error_NONE;
+    if (!takeTokens(sourceIf, message->length)) {
+        Log_debug(sourceIf->core->logger, "DROP because node is over its rate limit.");
+        countDrop(sourceIf, SwitchCore_DropReason_RATE_LIMIT, message->length);
+        return -1;
     }
 
     if (message->length < Headers_SwitchHeader_SIZE) {
         Log_debug(sourceIf->core->logger, "DROP runt packet.");
-        return Error_NONE;
+        countDrop(sourceIf, SwitchCore_DropReason_RUNT, message->length);
+        return -1;
     }
 
     struct SwitchCore* core = sourceIf->core;
     struct Headers_SwitchHeader* header = (struct Headers_SwitchHeader*) message->bytes;
     const uint64_t label = Endian_bigEndianToHost64(header->label_be);
-    uint32_t bits = NumberCompress_bitsUsedForLabel(label);
+    uint32_t bits = bitsUsedForLabel(label);
     const uint32_t sourceIndex = sourceIf - core->interfaces;
-    const uint32_t destIndex = NumberCompress_getDecompressed(label, bits);
-    const uint32_t sourceBits = NumberCompress_bitsUsedForNumber(sourceIndex);
+    const uint32_t destIndex = getDecompressed(label, bits);
+    const uint32_t sourceBits = sourceIf->bitsUsed;
 
-    Assert_true(destIndex < NumberCompress_INTERFACES);
-    Assert_true(sourceIndex < NumberCompress_INTERFACES);
+    Assert_true(destIndex < interfaces);
+    Assert_true(sourceIndex < interfaces);
+    Assert_true(bits <= NumberCompress_BITS_MAX);
 
     if (1 == destIndex) {
         if (1 != (label & 0xf)) {
@@ -172,8 +339,9 @@ static uint8_t receiveMessage(struct Message* message, struct Interface* iface)
             DEBUG_SRC_DST(sourceIf->core->logger,
                             "DROP packet for this router because the destination "
                             "discriminator was wrong");
+            countDrop(sourceIf, SwitchCore_DropReason_MALFORMED_LABEL, message->length);
             sendError(sourceIf, message, Error_MALFORMED_ADDRESS, sourceIf->core->logger);
-            return Error_NONE;
+            return -1;
         }
         //Assert_true(bits == 4);
     }
@@ -199,8 +367,9 @@ static uint8_t receiveMessage(struct Message* message, struct Interface* iface)
                 DEBUG_SRC_DST(sourceIf->core->logger,
                               "DROP packet for this router because there is no way to "
                               "represent the return path.");
+                countDrop(sourceIf, SwitchCore_DropReason_MALFORMED_LABEL, message->length);
                 sendError(sourceIf, message, Error_MALFORMED_ADDRESS, sourceIf->core->logger);
-                return Error_NONE;
+                return -1;
             }
             bits = sourceBits;
         } else if (1 == sourceIndex) {
@@ -213,32 +382,35 @@ static uint8_t receiveMessage(struct Message* message, struct Interface* iface)
                 // not enough zeroes
                 DEBUG_SRC_DST(sourceIf->core->logger, "DROP packet because source address is "
                                                       "larger than destination address.");
+                countDrop(sourceIf, SwitchCore_DropReason_MALFORMED_LABEL, message->length);
                 sendError(sourceIf, message, Error_MALFORMED_ADDRESS, sourceIf->core->logger);
-                return Error_NONE;
+                return -1;
             }
         } else {
             DEBUG_SRC_DST(sourceIf->core->logger, "DROP packet because source address is "
                                                   "larger than destination address.");
+            countDrop(sourceIf, SwitchCore_DropReason_MALFORMED_LABEL, message->length);
             sendError(sourceIf, message, Error_MALFORMED_ADDRESS, sourceIf->core->logger);
-            return Error_NONE;
+            return -1;
         }
     }
 
     if (core->interfaces[destIndex].iface == NULL) {
         DEBUG_SRC_DST(sourceIf->core->logger, "DROP packet because there is no interface "
                                               "where the bits specify.");
+        countDrop(sourceIf, SwitchCore_DropReason_NO_INTERFACE, message->length);
         sendError(sourceIf, message, Error_MALFORMED_ADDRESS, sourceIf->core->logger);
-        return Error_NONE;
+        return -1;
     }
 
     if (sourceIndex == destIndex && sourceIndex != 1) {
         DEBUG_SRC_DST(sourceIf->core->logger, "DROP Packet with redundant route.");
+        countDrop(sourceIf, SwitchCore_DropReason_MALFORMED_LABEL, message->length);
         sendError(sourceIf, message, Error_MALFORMED_ADDRESS, sourceIf->core->logger);
-        return Error_NONE;
+        return -1;
     }
 
-    uint64_t sourceLabel = Bits_bitReverse64(NumberCompress_getCompressed(sourceIndex, bits));
-    uint64_t targetLabel = (label >> bits) | sourceLabel;
+    uint64_t targetLabel = (label >> bits) | sourceIf->reversedLabels[bits];
 
     header->label_be = Endian_hostToBigEndian64(targetLabel);
 
@@ -248,13 +420,50 @@ static uint8_t receiveMessage(struct Message* message, struct Interface* iface)
                sourceIndex, destIndex, label, targetLabel);
     */
 
-    int cloneLength = (message->length < Control_Error_MAX_SIZE) ?
-        message->length : Control_Error_MAX_SIZE;
+    *labelOut = label;
+    return destIndex;
+}
+
+/**
+ * Send a packet which has already been through decodeLabel() to the interface at destIndex.
+ * If the destination interface fails to take it, an error is sent back to the source.
+ */
+static inline void forwardMessage(struct Message* message,
+                                  struct SwitchInterface* sourceIf,
+                                  uint32_t destIndex,
+                                  uint64_t label)
+{
+    struct SwitchCore* core = sourceIf->core;
+
+    // If sending fails, the content is gone (it might have been encrypted or decrypted in place)
+    // so whatever is to be echoed back in the error must be saved first.
+    // Only control packets (eg: pings) need their content echoed back, for data packets the
+    // originator only uses the switch header so we skip copying the head of every packet which
+    // is forwarded at line rate.
+    int cloneLength = Headers_SwitchHeader_SIZE;
     uint8_t messageClone[Control_Error_MAX_SIZE];
-    Bits_memcpy(messageClone, message->bytes, cloneLength);
+    if (Headers_getMessageType((struct Headers_SwitchHeader*) message->bytes)
+        == Headers_SwitchHeader_TYPE_CONTROL)
+    {
+        cloneLength = (message->length < Control_Error_MAX_SIZE) ?
+            message->length : Control_Error_MAX_SIZE;
+        Bits_memcpy(messageClone, message->bytes, cloneLength);
+    } else {
+        Bits_memcpyConst(messageClone, message->bytes, Headers_SwitchHeader_SIZE);
+    }
 
+    const uint32_t length = message->length;
     const uint16_t err = sendMessage(&core->interfaces[destIndex], message, sourceIf->core->logger);
-    if (err) {
+    if (!err) {
+        Probe_fire3(switchForward, sourceIf - core->interfaces, destIndex, length);
+        struct SwitchCore_Stats* stats = statsFor(sourceIf);
+        stats->forwardedPackets++;
+        stats->forwardedBytes += length;
+        stats = &core->stats[destIndex].stats;
+        stats->sentPackets++;
+        stats->sentBytes += length;
+    } else {
+        countDrop(sourceIf, SwitchCore_DropReason_SEND_FAILED, length);
         Log_debug(sourceIf->core->logger, "Sending packet caused an error [%s]",
                   Error_strerror(err));
 
@@ -265,18 +474,125 @@ static uint8_t receiveMessage(struct Message* message, struct Interface* iface)
         Message_shift(message, Control_Error_MAX_SIZE, NULL);
         Bits_memcpy(message->bytes, messageClone, cloneLength);
         message->length = cloneLength;
-        header = (struct Headers_SwitchHeader*) message->bytes;
+        struct Headers_SwitchHeader* header = (struct Headers_SwitchHeader*) message->bytes;
         header->label_be = Endian_bigEndianToHost64(label);
         sendError(sourceIf, message, err, sourceIf->core->logger);
-        return Error_NONE;
     }
+}
+
+/**
+ * Define decodeLabel_<type>() and receiveMessage_<type>() for a NumberCompress scheme.
+ * receiveMessage never returns an error, it sends an error packet instead.
+ */
+#define SWITCH_SCHEME(type)                                                                 \
+    static int32_t decodeLabel_ ## type(struct Message* message,                            \
+                                        struct SwitchInterface* sourceIf,                    \
+                                        uint64_t* labelOut)                                  \
+    {                                                                                        \
+        return decodeLabel(message,                                                          \
+                           sourceIf,                                                         \
+                           labelOut,                                                         \
+                           NumberCompress_ ## type ## _bitsUsedForLabel,                     \
+                           NumberCompress_ ## type ## _getDecompressed,                      \
+                           NumberCompress_ ## type ## _INTERFACES);                          \
+    }                                                                                        \
+    static uint8_t receiveMessage_ ## type(struct Message* message, struct Interface* iface) \
+    {                                                                                        \
+        struct SwitchInterface* sourceIf = (struct SwitchInterface*) iface->receiverContext; \
+        uint64_t label;                                                                      \
+        int32_t destIndex = decodeLabel_ ## type(message, sourceIf, &label);                 \
+        if (destIndex > -1) {                                                                \
+            forwardMessage(message, sourceIf, destIndex, label);                             \
+        }                                                                                    \
+        return Error_NONE;                                                                   \
+    }
+
+SWITCH_SCHEME(f4)
+SWITCH_SCHEME(f8)
+SWITCH_SCHEME(v3x5x8)
+SWITCH_SCHEME(v4x8)
+
+struct SwitchCore* SwitchCore_newWithScheme(const char* schemeName,
+                                            struct Log* logger,
+                                            struct EventBase* eventBase,
+                                            struct Allocator* allocator)
+{
+    const struct NumberCompress_Scheme* scheme = NumberCompress_schemeForName(schemeName);
+    if (!scheme) {
+        return NULL;
+    }
+    struct SwitchCore* core = Allocator_calloc(allocator, sizeof(struct SwitchCore), 1);
+    core->allocator = allocator;
+    core->interfaceCount = 0;
+    core->logger = logger;
+    core->eventBase = eventBase;
+    core->scheme = scheme;
+
+    #define SWITCH_SELECT(type)                                          \
+        if (!CString_strcmp(scheme->name, #type)) {                      \
+            core->decodeLabel = decodeLabel_ ## type;                    \
+            core->receiveMessage = receiveMessage_ ## type;              \
+        }
+    SWITCH_SELECT(f4)
+    SWITCH_SELECT(f8)
+    SWITCH_SELECT(v3x5x8)
+    SWITCH_SELECT(v4x8)
+    #undef SWITCH_SELECT
+
+    Assert_true(core->decodeLabel);
+    return core;
+}
+
+struct SwitchCore* SwitchCore_new(struct Log* logger,
+                                  struct EventBase* eventBase,
+                                  struct Allocator* allocator)
+{
+    return SwitchCore_newWithScheme(NULL, logger, eventBase, allocator);
+}
+
+const char* SwitchCore_getSchemeName(struct SwitchCore* core)
+{
+    return core->scheme->name;
+}
+
+void SwitchCore_receiveBatch(struct Message** msgs, int count, struct Interface* iface)
+{
+    struct SwitchInterface* sourceIf = (struct SwitchInterface*) iface->receiverContext;
+    int32_t destIndexes[SwitchCore_BATCH_MAX];
+    uint64_t labels[SwitchCore_BATCH_MAX];
+
+    while (count > 0) {
+        int n = (count < SwitchCore_BATCH_MAX) ? count : SwitchCore_BATCH_MAX;
+
+        for (int i = 0; i < n; i++) {
+            destIndexes[i] = sourceIf->core->decodeLabel(msgs[i], sourceIf, &labels[i]);
+        }
+
+        // Send each group back to back, in the order which their first packet arrived,
+        // packets within a group keep their order.
+        for (int i = 0; i < n; i++) {
+            int32_t destIndex = destIndexes[i];
+            if (destIndex < 0) {
+                continue;
+            }
+            for (int j = i; j < n; j++) {
+                if (destIndexes[j] != destIndex) {
+                    continue;
+                }
+                destIndexes[j] = -1;
+                forwardMessage(msgs[j], sourceIf, destIndex, labels[j]);
+            }
+        }
 
-    return Error_NONE;
+        msgs += n;
+        count -= n;
+    }
 }
 
 static int removeInterface(struct Allocator_OnFreeJob* job)
 {
     struct SwitchInterface* si = (struct SwitchInterface*) job->userData;
+    Bits_memset(statsFor(si), 0, sizeof(struct SwitchCore_Stats));
     Bits_memset(si, 0, sizeof(struct SwitchInterface));
     return 0;
 }
@@ -298,19 +614,37 @@ void SwitchCore_swapInterfaces(struct Interface* if1, struct Interface* if2)
     si1->onFree = Allocator_onFree(if2->allocator, removeInterface, si1);
     si2->onFree = Allocator_onFree(if1->allocator, removeInterface, si2);
 
+    // The counters go with the interface.
+    struct SwitchCore_Stats stats3;
+    Bits_memcpyConst(&stats3, statsFor(si1), sizeof(struct SwitchCore_Stats));
+    Bits_memcpyConst(statsFor(si1), statsFor(si2), sizeof(struct SwitchCore_Stats));
+    Bits_memcpyConst(statsFor(si2), &stats3, sizeof(struct SwitchCore_Stats));
+
+    // The labels belong to the slot, not the interface.
+    computeLabels(si1);
+    computeLabels(si2);
+
     if1->receiverContext = si2;
     if2->receiverContext = si1;
 }
 
+static void setRateLimit(struct SwitchInterface* si, uint32_t rateLimit, uint32_t burstSize)
+{
+    si->rateLimit = rateLimit;
+    si->burstSize = burstSize;
+    si->tokens = burstSize;
+    si->tokenRemainder = 0;
+    si->lastRefill = (rateLimit) ? Time_currentTimeMilliseconds(si->core->eventBase) : 0;
+}
+
 /**
- * @param trust a positive integer representing how much you trust the
- *              connected node not to send a flood.
+ * @param rateLimit how many bytes per second the connected node may send, 0 for no limit.
  * @param labelOut an integer pointer which will be set to the path to the newly added node
  *                 in host endian order.
  * @return 0 if all goes well, -1 if the list is full.
  */
 int SwitchCore_addInterface(struct Interface* iface,
-                            const uint64_t trust,
+                            const uint32_t rateLimit,
                             uint64_t* labelOut,
                             struct SwitchCore* core)
 {
@@ -330,7 +664,7 @@ int SwitchCore_addInterface(struct Interface* iface,
         }
     }
 
-    if (ifIndex == NumberCompress_INTERFACES) {
+    if (ifIndex == core->scheme->interfaces) {
         return SwitchCore_addInterface_OUT_OF_SPACE;
     }
 
@@ -339,18 +673,18 @@ int SwitchCore_addInterface(struct Interface* iface,
     Bits_memcpyConst(newIf, (&(struct SwitchInterface) {
         .iface = iface,
         .core = core,
-        .buffer = 0,
-        .bufferMax = trust,
         .congestion = 0
     }), sizeof(struct SwitchInterface));
+    setRateLimit(newIf, rateLimit, rateLimit);
 
+    Bits_memset(statsFor(newIf), 0, sizeof(struct SwitchCore_Stats));
     newIf->onFree = Allocator_onFree(iface->allocator, removeInterface, newIf);
+    computeLabels(newIf);
 
     iface->receiverContext = &core->interfaces[ifIndex];
-    iface->receiveMessage = receiveMessage;
+    iface->receiveMessage = core->receiveMessage;
 
-    uint32_t bits = NumberCompress_bitsUsedForNumber(ifIndex);
-    *labelOut = NumberCompress_getCompressed(ifIndex, bits) | (1 << bits);
+    *labelOut = labelForIndex(core->scheme, ifIndex);
 
     core->interfaceCount++;
 
@@ -362,15 +696,51 @@ int SwitchCore_setRouterInterface(struct Interface* iface, struct SwitchCore* co
     Bits_memcpyConst(&core->interfaces[1], (&(struct SwitchInterface) {
         .iface = iface,
         .core = core,
-        .buffer = 0,
-        .bufferMax = INT64_MAX,
         .congestion = 0
     }), sizeof(struct SwitchInterface));
 
+    Bits_memset(&core->stats[1].stats, 0, sizeof(struct SwitchCore_Stats));
+    computeLabels(&core->interfaces[1]);
+
     iface->receiverContext = &core->interfaces[1];
-    iface->receiveMessage = receiveMessage;
+    iface->receiveMessage = core->receiveMessage;
     core->interfaceCount++;
     core->routerAdded = true;
 
     return 0;
 }
+
+int SwitchCore_setRateLimit(uint64_t label,
+                            uint32_t rateLimit,
+                            uint32_t burstSize,
+                            struct SwitchCore* core)
+{
+    const struct NumberCompress_Scheme* scheme = core->scheme;
+    uint32_t bits = scheme->bitsUsedForLabel(label);
+    uint32_t index = scheme->getDecompressed(label, bits);
+    if (index == 1
+        || index >= scheme->interfaces
+        || !core->interfaces[index].iface
+        || label != labelForIndex(scheme, index))
+    {
+        return SwitchCore_setRateLimit_NO_SUCH_INTERFACE;
+    }
+    setRateLimit(&core->interfaces[index], rateLimit, (burstSize) ? burstSize : rateLimit);
+    return 0;
+}
+
+int SwitchCore_getStats(uint32_t index,
+                        struct SwitchCore_Stats* statsOut,
+                        uint64_t* labelOut,
+                        struct SwitchCore* core)
+{
+    if (index >= core->scheme->interfaces) {
+        return SwitchCore_getStats_END;
+    }
+    if (!core->interfaces[index].iface) {
+        return SwitchCore_getStats_NO_INTERFACE;
+    }
+    Bits_memcpyConst(statsOut, &core->stats[index].stats, sizeof(struct SwitchCore_Stats));
+    *labelOut = labelForIndex(core->scheme, index);
+    return 0;
+}
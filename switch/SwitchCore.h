@@ -16,6 +16,7 @@
 #define SwitchCore_H
 
 #include "interface/Interface.h"
+#include "util/events/EventBase.h"
 #include "util/log/Log.h"
 #include "wire/Message.h"
 #include "util/Linker.h"
@@ -30,16 +31,40 @@ struct SwitchCore;
  * Create a new router core.
  *
  * @param logger what to log output to.
+ * @param eventBase the event base, used as the clock for rate limiting.
  * @param allocator the memory allocator to use for allocating the core context and interfaces.
  */
-struct SwitchCore* SwitchCore_new(struct Log* logger, struct Allocator* allocator);
+struct SwitchCore* SwitchCore_new(struct Log* logger,
+                                  struct EventBase* eventBase,
+                                  struct Allocator* allocator);
+
+/**
+ * Create a new router core which uses a specific label compression scheme.
+ * The label decoder is specialized for each scheme and chosen once here so the forwarding path
+ * is just as fast as with the scheme which is compiled in as NumberCompress_TYPE.
+ *
+ * @param schemeName the name of a scheme from NumberCompress.h, eg: "v4x8",
+ *                   NULL for the one which is compiled in.
+ * @param logger what to log output to.
+ * @param eventBase the event base, used as the clock for rate limiting.
+ * @param allocator the memory allocator to use for allocating the core context and interfaces.
+ * @return a new switch core or NULL if there is no scheme by the given name.
+ */
+struct SwitchCore* SwitchCore_newWithScheme(const char* schemeName,
+                                            struct Log* logger,
+                                            struct EventBase* eventBase,
+                                            struct Allocator* allocator);
+
+/** @return the name of the label compression scheme used by this switch, eg: "v4x8". */
+const char* SwitchCore_getSchemeName(struct SwitchCore* core);
 
 /**
  * Register a new interface.
  * All interfaces are point to point so messages sent down an interface.
  *
  * @param iface the interface to add.
- * @param trust the amount that you trust the connected node.
+ * @param rateLimit how many bytes per second the connected node may send into the switch,
+ *                  0 for no limit. See SwitchCore_setRateLimit().
  * @param labelOut_be a buffer which will be filled with the label part for getting
  *                    to the newly added node. It will be set to the big endian value.
  * @param core the switchcore.
@@ -47,7 +72,7 @@ struct SwitchCore* SwitchCore_new(struct Log* logger, struct Allocator* allocato
  */
 #define SwitchCore_addInterface_OUT_OF_SPACE -1
 int SwitchCore_addInterface(struct Interface* iface,
-                            const uint64_t trust,
+                            const uint32_t rateLimit,
                             uint64_t* labelOut_be,
                             struct SwitchCore* core);
 
@@ -62,6 +87,105 @@ int SwitchCore_addInterface(struct Interface* iface,
  */
 int SwitchCore_setRouterInterface(struct Interface* iface, struct SwitchCore* core);
 
+/**
+ * Limit the rate at which traffic is accepted from an interface.
+ * Traffic is metered with a token bucket so a node may burst up to burstSize bytes and then
+ * sustain rateLimit bytes per second, packets beyond that are dropped. Because each interface
+ * has its own bucket, a node which floods only loses its own packets.
+ *
+ * @param label the label for the interface as given by SwitchCore_addInterface().
+ * @param rateLimit the sustained rate in bytes per second, 0 to remove the limit.
+ * @param burstSize the size of the bucket in bytes, 0 to make it rateLimit (one second's worth).
+ * @param core the switchcore.
+ * @return 0 on success, SwitchCore_setRateLimit_NO_SUCH_INTERFACE if the label is not one of
+ *         the interfaces of this switch, the router interface cannot be limited.
+ */
+#define SwitchCore_setRateLimit_NO_SUCH_INTERFACE -1
+int SwitchCore_setRateLimit(uint64_t label,
+                            uint32_t rateLimit,
+                            uint32_t burstSize,
+                            struct SwitchCore* core);
+
+/** Reasons for which the switch drops packets, see SwitchCore_Stats. */
+enum SwitchCore_DropReason
+{
+    /** The source interface was over its rate limit, see SwitchCore_setRateLimit(). */
+    SwitchCore_DropReason_RATE_LIMIT,
+
+    /** The packet was too short to contain a switch header. */
+    SwitchCore_DropReason_RUNT,
+
+    /** The label could not be switched, an error was sent back. */
+    SwitchCore_DropReason_MALFORMED_LABEL,
+
+    /** There is no interface where the label points, an error was sent back. */
+    SwitchCore_DropReason_NO_INTERFACE,
+
+    /** The destination interface failed to send the packet, an error was sent back. */
+    SwitchCore_DropReason_SEND_FAILED,
+
+    SwitchCore_DropReason_COUNT
+};
+
+/** Traffic counters for one interface, since it was added to the switch. */
+struct SwitchCore_Stats
+{
+    /** Packets which came in on this interface and were forwarded. */
+    uint64_t forwardedPackets;
+    uint64_t forwardedBytes;
+
+    /** Packets from other interfaces which were sent out this interface. */
+    uint64_t sentPackets;
+    uint64_t sentBytes;
+
+    /** Errors which the switch generated and sent out this interface. */
+    uint64_t errorPackets;
+    uint64_t errorBytes;
+
+    /** Errors which were not sent because too many of the same type were sent recently. */
+    uint64_t suppressedErrors;
+
+    /** Packets which came in on this interface and were dropped, indexed by reason. */
+    uint64_t droppedPackets[SwitchCore_DropReason_COUNT];
+    uint64_t droppedBytes[SwitchCore_DropReason_COUNT];
+};
+
+/**
+ * Get the traffic counters for an interface.
+ * The counters are plain integers which are updated by the switch as it forwards, reading
+ * them costs the forwarding path nothing.
+ *
+ * @param index the number of the interface, to dump all counters, start at 0 and count up
+ *              until SwitchCore_getStats_END is returned.
+ * @param statsOut will be filled with the counters.
+ * @param labelOut will be set to the label for the interface.
+ * @param core the switchcore.
+ * @return 0 on success, SwitchCore_getStats_NO_INTERFACE if the slot is empty or
+ *         SwitchCore_getStats_END if index is beyond the last slot.
+ */
+#define SwitchCore_getStats_NO_INTERFACE -1
+#define SwitchCore_getStats_END -2
+int SwitchCore_getStats(uint32_t index,
+                        struct SwitchCore_Stats* statsOut,
+                        uint64_t* labelOut,
+                        struct SwitchCore* core);
+
 void SwitchCore_swapInterfaces(struct Interface* if1, struct Interface* if2);
 
+/**
+ * Switch a burst of packets which all came in on the same interface.
+ * Labels for the whole burst are decoded first and then the packets are handed to their
+ * destination interfaces grouped by destination, so each destination gets its packets back
+ * to back rather than interleaved with everybody else's. Packets for the same destination are
+ * sent in the order they appear in msgs. Bursts larger than SwitchCore_BATCH_MAX are processed
+ * in chunks of SwitchCore_BATCH_MAX.
+ *
+ * @param msgs the packets, each message must be valid until the call returns.
+ * @param count the number of packets in msgs.
+ * @param iface the interface which the packets came in on, this must be an interface which
+ *              was registered with SwitchCore_addInterface() or SwitchCore_setRouterInterface().
+ */
+#define SwitchCore_BATCH_MAX 32
+void SwitchCore_receiveBatch(struct Message** msgs, int count, struct Interface* iface);
+
 #endif
@@ -0,0 +1,149 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/String.h"
+#include "benc/Dict.h"
+#include "benc/Int.h"
+#include "benc/List.h"
+#include "switch/SwitchCore.h"
+#include "switch/SwitchCore_admin.h"
+#include "util/AddrTools.h"
+
+struct Context
+{
+    struct SwitchCore* core;
+    struct Admin* admin;
+};
+
+static void setRateLimit(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    String* labelStr = Dict_getString(args, String_CONST("label"));
+    int64_t* rateLimit = Dict_getInt(args, String_CONST("bytesPerSecond"));
+    int64_t* burstSize = Dict_getInt(args, String_CONST("burstBytes"));
+    uint64_t label;
+    char* err = "none";
+    if (labelStr->len != 19 || AddrTools_parsePath(&label, (uint8_t*) labelStr->bytes)) {
+        err = "label was not parsable.";
+    } else if (*rateLimit < 0 || *rateLimit > UINT32_MAX
+        || (burstSize && (*burstSize < 0 || *burstSize > UINT32_MAX)))
+    {
+        err = "bytesPerSecond and burstBytes must be between 0 and 2^32-1.";
+    } else if (SwitchCore_setRateLimit(label, *rateLimit, (burstSize) ? *burstSize : 0,
+                                       context->core))
+    {
+        err = "no such interface.";
+    }
+
+    Dict d = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(err)), NULL);
+    Admin_sendMessage(&d, txid, context->admin);
+}
+
+/** Names of the drop reasons as they appear in the output of SwitchCore_stats(). */
+static const char* const DROP_REASONS[SwitchCore_DropReason_COUNT] = {
+    [SwitchCore_DropReason_RATE_LIMIT] = "rateLimit",
+    [SwitchCore_DropReason_RUNT] = "runt",
+    [SwitchCore_DropReason_MALFORMED_LABEL] = "malformedLabel",
+    [SwitchCore_DropReason_NO_INTERFACE] = "noInterface",
+    [SwitchCore_DropReason_SEND_FAILED] = "sendFailed"
+};
+
+// an interface record is around 400 benc chars.
+#define ENTRIES_PER_PAGE 16
+static void stats(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    int64_t* page = Dict_getInt(args, String_CONST("page"));
+    int skip = (page) ? *page * ENTRIES_PER_PAGE : 0;
+
+    String* labelKey = String_CONST("label");
+    String* forwardedPackets = String_CONST("forwardedPackets");
+    String* forwardedBytes = String_CONST("forwardedBytes");
+    String* sentPackets = String_CONST("sentPackets");
+    String* sentBytes = String_CONST("sentBytes");
+    String* errorPackets = String_CONST("errorPackets");
+    String* errorBytes = String_CONST("errorBytes");
+    String* suppressedErrors = String_CONST("suppressedErrors");
+    String* droppedPacketsKey = String_CONST("droppedPackets");
+    String* droppedBytesKey = String_CONST("droppedBytes");
+
+    List* list = NULL;
+    int count = 0;
+    int more = 0;
+    struct SwitchCore_Stats stats;
+    uint64_t label;
+    int ret;
+    for (uint32_t i = 0; (ret = SwitchCore_getStats(i, &stats, &label, context->core))
+                         != SwitchCore_getStats_END; i++)
+    {
+        if (ret || skip-- > 0) {
+            continue;
+        }
+        if (count++ >= ENTRIES_PER_PAGE) {
+            more = 1;
+            break;
+        }
+
+        Dict* d = Dict_new(requestAlloc);
+        uint8_t labelStr[20];
+        AddrTools_printPath(labelStr, label);
+        Dict_putString(d, labelKey, String_new((char*)labelStr, requestAlloc), requestAlloc);
+        Dict_putInt(d, forwardedPackets, stats.forwardedPackets, requestAlloc);
+        Dict_putInt(d, forwardedBytes, stats.forwardedBytes, requestAlloc);
+        Dict_putInt(d, sentPackets, stats.sentPackets, requestAlloc);
+        Dict_putInt(d, sentBytes, stats.sentBytes, requestAlloc);
+        Dict_putInt(d, errorPackets, stats.errorPackets, requestAlloc);
+        Dict_putInt(d, errorBytes, stats.errorBytes, requestAlloc);
+        Dict_putInt(d, suppressedErrors, stats.suppressedErrors, requestAlloc);
+
+        Dict* droppedPackets = Dict_new(requestAlloc);
+        Dict* droppedBytes = Dict_new(requestAlloc);
+        for (int r = 0; r < SwitchCore_DropReason_COUNT; r++) {
+            String* reason = String_new(DROP_REASONS[r], requestAlloc);
+            Dict_putInt(droppedPackets, reason, stats.droppedPackets[r], requestAlloc);
+            Dict_putInt(droppedBytes, reason, stats.droppedBytes[r], requestAlloc);
+        }
+        Dict_putDict(d, droppedPacketsKey, droppedPackets, requestAlloc);
+        Dict_putDict(d, droppedBytesKey, droppedBytes, requestAlloc);
+
+        list = List_addDict(list, d, requestAlloc);
+    }
+
+    Dict response = Dict_CONST(String_CONST("interfaces"), List_OBJ(list), NULL);
+    Dict withMore = Dict_CONST(String_CONST("more"), Int_OBJ(1), response);
+    Admin_sendMessage((more) ? &withMore : &response, txid, context->admin);
+}
+
+void SwitchCore_admin_register(struct SwitchCore* core,
+                               struct Admin* admin,
+                               struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .core = core,
+        .admin = admin
+    }));
+
+    Admin_registerFunction("SwitchCore_setRateLimit", setRateLimit, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "label", .required = 1, .type = "String" },
+            { .name = "bytesPerSecond", .required = 1, .type = "Int" },
+            { .name = "burstBytes", .required = 0, .type = "Int" }
+        }), admin);
+
+    Admin_registerFunction("SwitchCore_stats", stats, ctx, false,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "page", .required = 0, .type = "Int" }
+        }), admin);
+}
@@ -0,0 +1,121 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crypto/random/Random.h"
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "switch/NumberCompress.h"
+#include "switch/SwitchCore.h"
+#include "switch/SwitchCore_benchmark.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
+#include "util/events/Time.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+#include <stdio.h>
+
+/** Number of interfaces to switch between, limited by the number which the scheme can address. */
+#define INTERFACES 32
+
+/** Number of distinct pre-built packets, they are sent over and over. */
+#define PACKETS 1024
+
+#define PACKET_SIZE 64
+
+#define ITERATIONS 2000000
+
+static uint8_t sendMessage(struct Message* message, struct Interface* iface)
+{
+    uint64_t* count = (uint64_t*) iface->senderContext;
+    (*count)++;
+    return 0;
+}
+
+static void benchmarkScheme(const struct NumberCompress_Scheme* scheme,
+                            struct EventBase* base,
+                            struct Random* rand,
+                            struct Allocator* parentAlloc)
+{
+    struct Allocator* alloc = Allocator_child(parentAlloc);
+    struct SwitchCore* core = SwitchCore_newWithScheme(scheme->name, NULL, base, alloc);
+    Assert_true(core);
+
+    // Slot 0 is the interface which all of the traffic comes in on, slot 1 is the router.
+    uint64_t received = 0;
+    int count = (scheme->interfaces - 1 < INTERFACES) ? scheme->interfaces - 1 : INTERFACES;
+    struct Interface* ifaces = Allocator_calloc(alloc, sizeof(struct Interface), count);
+    uint64_t* labels = Allocator_calloc(alloc, sizeof(uint64_t), count);
+    for (int i = 0; i < count; i++) {
+        Bits_memcpyConst(&ifaces[i], (&(struct Interface) {
+            .sendMessage = sendMessage,
+            .senderContext = &received,
+            .allocator = alloc
+        }), sizeof(struct Interface));
+        if (i == 1) {
+            SwitchCore_setRouterInterface(&ifaces[i], core);
+            labels[i] = 1;
+        } else {
+            Assert_true(!SwitchCore_addInterface(&ifaces[i], 0, &labels[i], core));
+        }
+    }
+
+    // Every destination other than the source, picked at random.
+    struct Message* msgs[PACKETS];
+    uint64_t labels_be[PACKETS];
+    for (int i = 0; i < PACKETS; i++) {
+        uint64_t label = labels[1 + Random_uint32(rand) % (count - 1)];
+        labels_be[i] = Endian_hostToBigEndian64(label);
+        msgs[i] = Message_new(PACKET_SIZE, 0, alloc);
+        Bits_memset(msgs[i]->bytes, 0, PACKET_SIZE);
+        struct Headers_SwitchHeader* hdr = (struct Headers_SwitchHeader*) msgs[i]->bytes;
+        Headers_setPriorityAndMessageType(hdr, 0, Headers_SwitchHeader_TYPE_DATA);
+    }
+
+    uint64_t startTime = Time_hrtime();
+    for (int i = 0; i < ITERATIONS; i++) {
+        // The label is rewritten as the packet is switched so it must be put back every time.
+        struct Message* msg = msgs[i % PACKETS];
+        ((struct Headers_SwitchHeader*) msg->bytes)->label_be = labels_be[i % PACKETS];
+        Interface_receiveMessage(&ifaces[0], msg);
+    }
+    uint64_t nanoseconds = Time_hrtime() - startTime;
+    Assert_true(received == ITERATIONS);
+
+    printf("\t%s:\t%d interfaces %d packets in %dms. %d packets/s, %d ns/packet\n",
+           scheme->name,
+           count,
+           ITERATIONS,
+           (int) (nanoseconds / 1000000),
+           (int) (((uint64_t) ITERATIONS * 1000000000) / nanoseconds),
+           (int) (nanoseconds / ITERATIONS));
+
+    Allocator_free(alloc);
+}
+
+void SwitchCore_benchmark(struct EventBase* base,
+                          struct Log* logger,
+                          struct Allocator* alloc)
+{
+    struct Random* rand = Random_new(alloc, logger, NULL);
+    printf("These metrics are the speed of switching %d byte packets to random destinations,\n"
+           "CryptoAuth is not involved so this is the upper bound on forwarding rate.\n",
+           PACKET_SIZE);
+
+    const char* schemes[] = { "f4", "f8", "v3x5x8", "v4x8" };
+    for (int i = 0; i < (int) (sizeof(schemes) / sizeof(*schemes)); i++) {
+        benchmarkScheme(NumberCompress_schemeForName(schemes[i]), base, rand, alloc);
+    }
+}
@@ -65,11 +65,68 @@ static void routesThrough()
     Assert_always(LabelSplicer_routesThrough(dest, 1));
 }
 
+static void bulk()
+{
+    uint64_t labels[] = {
+        0x0000900aea95ca55llu,
+        0x000001652639c655llu,
+        routeToInterface(3),
+        LabelSplicer_splice(routeToInterface(5), routeToInterface(3)),
+        LabelSplicer_splice(routeToInterface(3), routeToInterface(5)),
+        1,
+        // The edges where the bulk form takes a midPath under 2 apart from the rest.
+        0,
+        UINT64_MAX
+    };
+    int count = sizeof(labels) / sizeof(*labels);
+    uint64_t mids[] = {
+        1, 0x000001652639c655llu, routeToInterface(3), routeToInterface(5), 0, UINT64_MAX
+    };
+    uint8_t out[8];
+
+    for (int m = 0; m < (int) (sizeof(mids) / sizeof(*mids)); m++) {
+        int total = LabelSplicer_whichRouteThrough(out, labels, count, mids[m]);
+        int expected = 0;
+        for (int i = 0; i < count; i++) {
+            Assert_always(out[i] == LabelSplicer_routesThrough(labels[i], mids[m]));
+            expected += out[i];
+        }
+        Assert_always(total == expected);
+
+        total = LabelSplicer_whichAreRoutedThrough(out, mids[m], labels, count);
+        expected = 0;
+        for (int i = 0; i < count; i++) {
+            Assert_always(out[i] == LabelSplicer_routesThrough(mids[m], labels[i]));
+            expected += out[i];
+        }
+        Assert_always(total == expected);
+    }
+
+    int total = LabelSplicer_whichAreOneHop(out, labels, count);
+    int expected = 0;
+    for (int i = 0; i < count; i++) {
+        Assert_always(out[i] == LabelSplicer_isOneHop(labels[i]));
+        expected += out[i];
+    }
+    Assert_always(total == expected);
+    Assert_always(out[2] && !out[3] && !out[4]);
+
+    uint64_t vias[] = { 1, routeToInterface(3), 0x000001652639c655llu, 1ull << 60, 1ull << 61 };
+    uint64_t spliced[8];
+    for (int v = 0; v < (int) (sizeof(vias) / sizeof(*vias)); v++) {
+        LabelSplicer_spliceAll(spliced, labels, count, vias[v]);
+        for (int i = 0; i < count; i++) {
+            Assert_always(spliced[i] == LabelSplicer_splice(labels[i], vias[v]));
+        }
+    }
+}
+
 int main()
 {
     splice();
     isOneHop();
     routesThrough();
+    bulk();
     unsplice();
     return 0;
 }
@@ -22,6 +22,7 @@
 
 static void numberCompressions_generic(
     uint32_t nInterfaces,
+    uint32_t maxBits,
     uint32_t (*bitsUsedForLabel)(const uint64_t label),
     uint32_t (*bitsUsedForNumber)(const uint32_t number),
     uint64_t (*getCompressed)(const uint32_t number, const uint32_t bitsUsed),
@@ -32,6 +33,7 @@ static void numberCompressions_generic(
     uint8_t bitWidths[64] = { 0 };
 
     for (uint32_t i = 0; i < nInterfaces; ++i) {
+        Assert_always(bitsUsedForNumber(i) <= maxBits);
         bitWidths[bitsUsedForNumber(i)] = 1;
     }
 
@@ -60,6 +62,7 @@ static void numberCompressions_generic(
 
     for (uint64_t label = 0; label < 0x10000u; ++label) {
         uint32_t bits = bitsUsedForLabel(label);
+        Assert_always(bits <= maxBits);
         Assert_always(1 == bitWidths[bits]);
         if (1 == (label & Bits_maxBits64(bits))) {
             //Assert_always(4 == bits);
@@ -100,6 +103,7 @@ static void numberCompressions_generic(
 #define TEST(impl) \
     numberCompressions_generic(            \
         GLUE(impl, INTERFACES),            \
+        GLUE(impl, MAX_BITS),              \
         GLUE(impl, bitsUsedForLabel),      \
         GLUE(impl, bitsUsedForNumber),     \
         GLUE(impl, getCompressed),         \
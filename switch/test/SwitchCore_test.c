@@ -0,0 +1,324 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/MallocAllocator.h"
+#include "interface/Interface.h"
+#include "switch/NumberCompress.h"
+#include "switch/SwitchCore.h"
+#include "util/Assert.h"
+#include "util/CString.h"
+#include "util/Endian.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "wire/Control.h"
+#include "wire/Error.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+#define PADDING 512
+#define PAYLOAD_SIZE 64
+
+struct Context
+{
+    /** Sequence of interface ids and payload ids, in the order in which they were sent. */
+    int sentOn[16];
+    int sentPayload[16];
+    int sentCount;
+
+    /** Length and content of the last message which was sent. */
+    int lastLength;
+    uint8_t lastBytes[128];
+};
+
+struct TestIface
+{
+    struct Interface iface;
+    int id;
+    struct Context* ctx;
+    uint64_t label;
+
+    /** If non-zero, sendMessage() will mangle the message and return this error. */
+    uint8_t failWith;
+};
+
+static uint8_t sendMessage(struct Message* msg, struct Interface* iface)
+{
+    struct TestIface* tif = (struct TestIface*) iface->senderContext;
+    struct Context* ctx = tif->ctx;
+    Assert_always(ctx->sentCount < 16);
+    ctx->sentOn[ctx->sentCount] = tif->id;
+    ctx->sentPayload[ctx->sentCount] = msg->bytes[Headers_SwitchHeader_SIZE];
+    ctx->sentCount++;
+    ctx->lastLength = msg->length;
+    Bits_memcpy(ctx->lastBytes, msg->bytes, (msg->length < 128) ? msg->length : 128);
+    if (tif->failWith) {
+        Bits_memset(msg->bytes, 0xff, msg->length);
+        return tif->failWith;
+    }
+    return 0;
+}
+
+static struct TestIface* newIface(int id, struct Context* ctx, struct Allocator* alloc)
+{
+    struct TestIface* tif = Allocator_calloc(alloc, sizeof(struct TestIface), 1);
+    Bits_memcpyConst(&tif->iface, (&(struct Interface) {
+        .sendMessage = sendMessage,
+        .senderContext = tif,
+        .allocator = alloc
+    }), sizeof(struct Interface));
+    tif->id = id;
+    tif->ctx = ctx;
+    return tif;
+}
+
+static struct Message* newPacketOfType(uint64_t label,
+                                       int payloadId,
+                                       uint32_t type,
+                                       struct Allocator* alloc);
+
+static struct Message* newPacket(uint64_t label, int payloadId, struct Allocator* alloc)
+{
+    return newPacketOfType(label, payloadId, Headers_SwitchHeader_TYPE_DATA, alloc);
+}
+
+static struct Message* newPacketOfType(uint64_t label,
+                                       int payloadId,
+                                       uint32_t type,
+                                       struct Allocator* alloc)
+{
+    struct Message* msg = Message_new(PAYLOAD_SIZE, PADDING, alloc);
+    Bits_memset(msg->bytes, 0, PAYLOAD_SIZE);
+    struct Headers_SwitchHeader* hdr = (struct Headers_SwitchHeader*) msg->bytes;
+    hdr->label_be = Endian_hostToBigEndian64(label);
+    Headers_setPriorityAndMessageType(hdr, 0, type);
+    msg->bytes[Headers_SwitchHeader_SIZE] = payloadId;
+    return msg;
+}
+
+static struct SwitchCore_Stats getStats(uint64_t label, struct SwitchCore* core)
+{
+    struct SwitchCore_Stats stats;
+    uint64_t statsLabel;
+    int ret;
+    for (uint32_t i = 0; (ret = SwitchCore_getStats(i, &stats, &statsLabel, core))
+                         != SwitchCore_getStats_END; i++)
+    {
+        if (!ret && statsLabel == label) {
+            return stats;
+        }
+    }
+    Assert_always(!"no such interface");
+    return stats;
+}
+
+static void testScheme(const char* schemeName)
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Context ctx = { .sentCount = 0 };
+    struct EventBase* base = EventBase_new(alloc);
+    struct SwitchCore* core = SwitchCore_newWithScheme(schemeName, NULL, base, alloc);
+    const struct NumberCompress_Scheme* scheme = NumberCompress_schemeForName(schemeName);
+    Assert_always(!CString_strcmp(SwitchCore_getSchemeName(core), scheme->name));
+
+    struct TestIface* a = newIface(0, &ctx, alloc);
+    struct TestIface* router = newIface(1, &ctx, alloc);
+    struct TestIface* b = newIface(2, &ctx, alloc);
+    struct TestIface* c = newIface(3, &ctx, alloc);
+
+    Assert_always(!SwitchCore_addInterface(&a->iface, 0, &a->label, core));
+    SwitchCore_setRouterInterface(&router->iface, core);
+    Assert_always(!SwitchCore_addInterface(&b->iface, 0, &b->label, core));
+    Assert_always(!SwitchCore_addInterface(&c->iface, 0, &c->label, core));
+
+    struct Message* msgs[6] = {
+        newPacket(b->label, 0, alloc),
+        newPacket(c->label, 1, alloc),
+        newPacket(b->label, 2, alloc),
+        // Runt packet, dropped without affecting the rest of the batch.
+        newPacket(b->label, 3, alloc),
+        newPacket(c->label, 4, alloc),
+        newPacket(1, 5, alloc)
+    };
+    msgs[3]->length = Headers_SwitchHeader_SIZE - 1;
+
+    SwitchCore_receiveBatch(msgs, 6, &a->iface);
+
+    int expectedOn[] =      { 2, 2, 3, 3, 1 };
+    int expectedPayload[] = { 0, 2, 1, 4, 5 };
+    Assert_always(ctx.sentCount == 5);
+    for (int i = 0; i < 5; i++) {
+        Assert_always(ctx.sentOn[i] == expectedOn[i]);
+        Assert_always(ctx.sentPayload[i] == expectedPayload[i]);
+    }
+
+    // A batch must rewrite labels exactly the way the single packet path does.
+    struct Message* single = newPacket(b->label, 6, alloc);
+    Interface_receiveMessage(&a->iface, single);
+    struct Headers_SwitchHeader* singleHdr = (struct Headers_SwitchHeader*) single->bytes;
+    struct Headers_SwitchHeader* batchHdr = (struct Headers_SwitchHeader*) msgs[0]->bytes;
+    Assert_always(singleHdr->label_be == batchHdr->label_be);
+
+    // The return path is the number of the source interface (0), bit reversed.
+    uint32_t bits = scheme->bitsUsedForLabel(b->label);
+    uint64_t expected = (b->label >> bits) | Bits_bitReverse64(scheme->getCompressed(0, bits));
+    Assert_always(Endian_bigEndianToHost64(singleHdr->label_be) == expected);
+
+    // When forwarding fails, an error goes back to the source containing the cause.
+    // Data packets only have their switch header echoed, control packets get the content too.
+    c->failWith = Error_LINK_LIMIT_EXCEEDED;
+    int errorSize = Headers_SwitchHeader_SIZE + Control_HEADER_SIZE + Control_Error_HEADER_SIZE;
+
+    ctx.sentCount = 0;
+    Interface_receiveMessage(&a->iface, newPacket(c->label, 7, alloc));
+    Assert_always(ctx.sentCount == 2);
+    Assert_always(ctx.sentOn[1] == 0);
+    Assert_always(ctx.lastLength == errorSize + Headers_SwitchHeader_SIZE);
+    struct Headers_SwitchHeader* cause = (struct Headers_SwitchHeader*) &ctx.lastBytes[errorSize];
+    Assert_always(Endian_bigEndianToHost64(cause->label_be) == c->label);
+
+    ctx.sentCount = 0;
+    Interface_receiveMessage(&a->iface,
+        newPacketOfType(c->label, 8, Headers_SwitchHeader_TYPE_CONTROL, alloc));
+    Assert_always(ctx.sentCount == 2);
+    Assert_always(ctx.sentOn[1] == 0);
+    Assert_always(ctx.lastLength == errorSize + PAYLOAD_SIZE);
+    Assert_always(Endian_bigEndianToHost64(cause->label_be) == c->label);
+    Assert_always(ctx.lastBytes[errorSize + Headers_SwitchHeader_SIZE] == 8);
+    c->failWith = 0;
+
+    // Over its rate limit, a node's packets are dropped silently and nobody else is affected.
+    // The event loop is not running so the clock stands still and the bucket never refills.
+    Assert_always(!SwitchCore_setRateLimit(a->label, 1000, 3 * PAYLOAD_SIZE, core));
+    Assert_always(SwitchCore_setRateLimit(1, 1000, 0, core)
+        == SwitchCore_setRateLimit_NO_SUCH_INTERFACE);
+    Assert_always(SwitchCore_setRateLimit(a->label | (1 << 20), 1000, 0, core)
+        == SwitchCore_setRateLimit_NO_SUCH_INTERFACE);
+
+    ctx.sentCount = 0;
+    for (int i = 0; i < 4; i++) {
+        Interface_receiveMessage(&a->iface, newPacket(c->label, i, alloc));
+    }
+    Interface_receiveMessage(&b->iface, newPacket(c->label, 4, alloc));
+    int expectedLimitedPayload[] = { 0, 1, 2, 4 };
+    Assert_always(ctx.sentCount == 4);
+    for (int i = 0; i < 4; i++) {
+        Assert_always(ctx.sentOn[i] == 3);
+        Assert_always(ctx.sentPayload[i] == expectedLimitedPayload[i]);
+    }
+
+    Assert_always(!SwitchCore_setRateLimit(a->label, 0, 0, core));
+    ctx.sentCount = 0;
+    Interface_receiveMessage(&a->iface, newPacket(c->label, 5, alloc));
+    Assert_always(ctx.sentCount == 1);
+
+    // Everything which went on above shows up in the counters.
+    struct SwitchCore_Stats as = getStats(a->label, core);
+    Assert_always(as.droppedPackets[SwitchCore_DropReason_RUNT] == 1);
+    Assert_always(as.droppedPackets[SwitchCore_DropReason_RATE_LIMIT] == 1);
+    Assert_always(as.droppedBytes[SwitchCore_DropReason_RATE_LIMIT] == PAYLOAD_SIZE);
+    Assert_always(as.droppedPackets[SwitchCore_DropReason_SEND_FAILED] == 2);
+    Assert_always(as.errorPackets == 2);
+    Assert_always(as.forwardedPackets == 10);
+    Assert_always(as.forwardedBytes == 10 * PAYLOAD_SIZE);
+    struct SwitchCore_Stats cs = getStats(c->label, core);
+    Assert_always(cs.sentPackets == 7);
+    Assert_always(cs.forwardedPackets == 0);
+    Assert_always(getStats(1, core).sentPackets == 1);
+
+    // A dead link only causes a limited number of errors of each type.
+    c->failWith = Error_LINK_LIMIT_EXCEEDED;
+    ctx.sentCount = 0;
+    for (int i = 0; i < 8; i++) {
+        Interface_receiveMessage(&a->iface, newPacket(c->label, i, alloc));
+    }
+    Assert_always(ctx.sentCount == 8 + 6);
+    Assert_always(getStats(a->label, core).suppressedErrors == 2);
+    // Other error types are counted separately, a packet routed back where it came from is
+    // malformed.
+    ctx.sentCount = 0;
+    Interface_receiveMessage(&a->iface, newPacket(a->label, 0, alloc));
+    Interface_receiveMessage(&a->iface, newPacket(c->label, 0, alloc));
+    Assert_always(ctx.sentCount == 2);
+    Assert_always(ctx.sentOn[0] == 0);
+    Assert_always(getStats(a->label, core).suppressedErrors == 3);
+    c->failWith = 0;
+
+    Allocator_free(alloc);
+}
+
+struct Refill
+{
+    struct TestIface* from;
+    uint64_t to;
+    int ticks;
+    struct EventBase* base;
+    struct Allocator* alloc;
+};
+
+static void sendEveryTick(void* vrefill)
+{
+    struct Refill* refill = vrefill;
+    Interface_receiveMessage(&refill->from->iface, newPacket(refill->to, 0, refill->alloc));
+    if (!--refill->ticks) {
+        EventBase_endLoop(refill->base);
+    }
+}
+
+/** A slow rate must still refill the bucket when packets come every millisecond. */
+static void testSlowRefill()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct Context ctx = { .sentCount = 0 };
+    struct EventBase* base = EventBase_newVirtual(alloc);
+    struct SwitchCore* core = SwitchCore_new(NULL, base, alloc);
+    struct TestIface* a = newIface(0, &ctx, alloc);
+    struct TestIface* b = newIface(2, &ctx, alloc);
+    Assert_always(!SwitchCore_addInterface(&a->iface, 0, &a->label, core));
+    Assert_always(!SwitchCore_addInterface(&b->iface, 0, &b->label, core));
+
+    // 100 bytes per second for 2 seconds after the bucket of one packet is spent is 3 packets.
+    Assert_always(!SwitchCore_setRateLimit(a->label, 100, PAYLOAD_SIZE, core));
+    Interface_receiveMessage(&a->iface, newPacket(b->label, 0, alloc));
+    Assert_always(ctx.sentCount == 1);
+    ctx.sentCount = 0;
+
+    struct Refill refill = {
+        .from = a,
+        .to = b->label,
+        .ticks = 2000,
+        .base = base,
+        .alloc = alloc
+    };
+    Timeout_setInterval(sendEveryTick, &refill, 1, base, alloc);
+    EventBase_beginLoop(base);
+    Assert_always(ctx.sentCount == 3);
+
+    Allocator_free(alloc);
+}
+
+int main()
+{
+    testSlowRefill();
+
+    testScheme(NULL);
+    testScheme("f4");
+    testScheme("f8");
+    testScheme("v3x5x8");
+    testScheme("v4x8");
+
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    Assert_always(!SwitchCore_newWithScheme("nonexistant", NULL, NULL, alloc));
+    Allocator_free(alloc);
+    return 0;
+}
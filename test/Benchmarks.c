@@ -0,0 +1,560 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "benc/serialization/standard/StandardBencSerializer.h"
+#include "crypto/AddressCalc.h"
+#include "crypto/random/Random.h"
+#include "crypto/random/test/DeterminentRandomSeed.h"
+#include "dht/Address.h"
+#include "dht/dhtcore/NodeStore.h"
+#include "interface/Interface.h"
+#include "io/ArrayReader.h"
+#include "io/ArrayWriter.h"
+#include "memory/Allocator.h"
+#include "switch/EncodingScheme.h"
+#include "switch/NumberCompress.h"
+#include "switch/SwitchCore.h"
+#include "test/Benchmarks.h"
+#include "util/AddrTools.h"
+#include "util/Assert.h"
+#include "util/Base32.h"
+#include "util/Benchmark.h"
+#include "util/Bits.h"
+#include "util/Checksum.h"
+#include "util/Endian.h"
+#include "util/Hex.h"
+#include "util/events/EventBase.h"
+#include "util/version/Version.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+#include "crypto_box_curve25519xsalsa20poly1305.h"
+
+#define Map_NAME OfBenchmarkValues
+#define Map_KEY_TYPE uint32_t
+#define Map_VALUE_TYPE uint32_t
+#include "util/Map.h"
+
+#include <stdbool.h>
+
+/** Size of the packets in the cases which handle packets. */
+#define PACKET_SIZE 1280
+
+// crypto
+
+struct Crypto
+{
+    uint8_t secret[32];
+    uint8_t nonce[24];
+
+    /** The crypto_box functions need 32 bytes of zeros ahead of the content. */
+    uint8_t buffer[32 + PACKET_SIZE];
+    uint8_t sealed[32 + PACKET_SIZE];
+
+    uint8_t keys[64][32];
+};
+
+static void* cryptoSetUp(struct Random* rand, struct Allocator* alloc)
+{
+    struct Crypto* ctx = Allocator_calloc(alloc, sizeof(struct Crypto), 1);
+    Random_bytes(rand, ctx->secret, 32);
+    Random_bytes(rand, ctx->nonce, 24);
+    Random_bytes(rand, &ctx->buffer[32], PACKET_SIZE);
+    Random_bytes(rand, (uint8_t*) ctx->keys, sizeof(ctx->keys));
+    crypto_box_curve25519xsalsa20poly1305_afternm(
+        ctx->sealed, ctx->buffer, sizeof(ctx->buffer), ctx->nonce, ctx->secret);
+    return ctx;
+}
+
+static void cryptoSeal(void* vctx, uint32_t count)
+{
+    struct Crypto* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        Bits_memset(ctx->buffer, 0, 32);
+        crypto_box_curve25519xsalsa20poly1305_afternm(
+            ctx->buffer, ctx->buffer, sizeof(ctx->buffer), ctx->nonce, ctx->secret);
+    }
+}
+
+static void cryptoOpen(void* vctx, uint32_t count)
+{
+    struct Crypto* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        Bits_memcpyConst(ctx->buffer, ctx->sealed, sizeof(ctx->buffer));
+        Assert_true(!crypto_box_curve25519xsalsa20poly1305_open_afternm(
+            ctx->buffer, ctx->buffer, sizeof(ctx->buffer), ctx->nonce, ctx->secret));
+    }
+}
+
+static void cryptoAddress(void* vctx, uint32_t count)
+{
+    struct Crypto* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        AddressCalc_addressForPublicKey(ctx->nonce, ctx->keys[i % 64]);
+    }
+}
+
+// switch
+
+/** Number of interfaces to switch between, the first is where all of the packets come in. */
+#define SWITCH_INTERFACES 32
+
+/** Number of distinct packets, they are sent over and over. */
+#define SWITCH_PACKETS 256
+
+struct Switch
+{
+    struct Interface ifaces[SWITCH_INTERFACES];
+    struct Message* msgs[SWITCH_PACKETS];
+    uint64_t labels_be[SWITCH_PACKETS];
+    uint64_t received;
+};
+
+static uint8_t switchReceive(struct Message* message, struct Interface* iface)
+{
+    struct Switch* ctx = iface->senderContext;
+    ctx->received++;
+    return 0;
+}
+
+static void* switchSetUp(struct Random* rand, struct Allocator* alloc)
+{
+    struct Switch* ctx = Allocator_calloc(alloc, sizeof(struct Switch), 1);
+    struct EventBase* base = EventBase_new(alloc);
+    struct SwitchCore* core = SwitchCore_newWithScheme("v4x8", NULL, base, alloc);
+    Assert_true(core);
+
+    // Slot 1 is the router, packets go to all of the others.
+    uint64_t labels[SWITCH_INTERFACES];
+    for (int i = 0; i < SWITCH_INTERFACES; i++) {
+        Bits_memcpyConst(&ctx->ifaces[i], (&(struct Interface) {
+            .sendMessage = switchReceive,
+            .senderContext = ctx,
+            .allocator = alloc
+        }), sizeof(struct Interface));
+        if (i == 1) {
+            SwitchCore_setRouterInterface(&ctx->ifaces[i], core);
+            labels[i] = 1;
+        } else {
+            Assert_true(!SwitchCore_addInterface(&ctx->ifaces[i], 0, &labels[i], core));
+        }
+    }
+    for (int i = 0; i < SWITCH_PACKETS; i++) {
+        uint64_t label = labels[1 + Random_uint32(rand) % (SWITCH_INTERFACES - 1)];
+        ctx->labels_be[i] = Endian_hostToBigEndian64(label);
+        ctx->msgs[i] = Message_new(PACKET_SIZE, 0, alloc);
+        Bits_memset(ctx->msgs[i]->bytes, 0, PACKET_SIZE);
+        struct Headers_SwitchHeader* hdr = (struct Headers_SwitchHeader*) ctx->msgs[i]->bytes;
+        Headers_setPriorityAndMessageType(hdr, 0, Headers_SwitchHeader_TYPE_DATA);
+    }
+    return ctx;
+}
+
+static void switchPacket(void* vctx, uint32_t count)
+{
+    struct Switch* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        // The label is rewritten as the packet is switched so it must be put back every time.
+        struct Message* msg = ctx->msgs[i % SWITCH_PACKETS];
+        ((struct Headers_SwitchHeader*) msg->bytes)->label_be = ctx->labels_be[i % SWITCH_PACKETS];
+        Interface_receiveMessage(&ctx->ifaces[0], msg);
+    }
+}
+
+// Map
+
+#define MAP_ENTRIES 4096
+
+struct MapLookup
+{
+    struct Map_OfBenchmarkValues* map;
+    uint32_t keys[MAP_ENTRIES];
+    uint32_t found;
+};
+
+static void* mapSetUp(struct Random* rand, struct Allocator* alloc)
+{
+    struct MapLookup* ctx = Allocator_calloc(alloc, sizeof(struct MapLookup), 1);
+    ctx->map = Map_OfBenchmarkValues_new(alloc);
+    for (int i = 0; i < MAP_ENTRIES; i++) {
+        ctx->keys[i] = Random_uint32(rand);
+        Map_OfBenchmarkValues_put(&ctx->keys[i], &ctx->keys[i], ctx->map);
+    }
+    return ctx;
+}
+
+static void mapGet(void* vctx, uint32_t count)
+{
+    struct MapLookup* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        // Stride through the keys so consecutive lookups do not hit the same cache lines.
+        int index = Map_OfBenchmarkValues_indexForKey(&ctx->keys[(i * 37) % MAP_ENTRIES], ctx->map);
+        ctx->found += (index >= 0);
+    }
+}
+
+// NodeStore
+
+/** The store is filled with one hop peers, as many as fit in the 8 bits of a v4x8 label. */
+#define NODESTORE_NODES 200
+
+#define NODESTORE_TARGETS 256
+
+struct NodeStoreSearch
+{
+    struct NodeStore* store;
+    struct Address targets[NODESTORE_TARGETS];
+    uint32_t found;
+};
+
+static void genAddress(struct Address* addr, struct Random* rand)
+{
+    do {
+        Random_bytes(rand, addr->key, Address_KEY_SIZE);
+    } while (!AddressCalc_addressForPublicKey(addr->ip6.bytes, addr->key));
+}
+
+static void* nodeStoreSetUp(struct Random* rand, struct Allocator* alloc)
+{
+    struct NodeStoreSearch* ctx = Allocator_calloc(alloc, sizeof(struct NodeStoreSearch), 1);
+    struct Address* myAddr = Allocator_calloc(alloc, sizeof(struct Address), 1);
+    genAddress(myAddr, rand);
+    myAddr->path = 1;
+    ctx->store = NodeStore_new(myAddr, NODESTORE_NODES * 2, alloc, NULL, rand);
+
+    for (uint32_t i = 2; i < NODESTORE_NODES + 2; i++) {
+        struct Address peer = { .path = 0 };
+        genAddress(&peer, rand);
+        uint32_t bits = NumberCompress_bitsUsedForNumber(i);
+        peer.path = NumberCompress_getCompressed(i, bits) | (((uint64_t)1) << bits);
+        NodeStore_addNode(ctx->store, &peer, 1, Version_CURRENT_PROTOCOL);
+    }
+    Assert_true(ctx->store->size >= NODESTORE_NODES);
+    for (int i = 0; i < NODESTORE_TARGETS; i++) {
+        Random_bytes(rand, ctx->targets[i].ip6.bytes, 16);
+        ctx->targets[i].ip6.bytes[0] = 0xfc;
+    }
+    return ctx;
+}
+
+static void nodeStoreGetBest(void* vctx, uint32_t count)
+{
+    struct NodeStoreSearch* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        ctx->found += !!NodeStore_getBest(&ctx->targets[i % NODESTORE_TARGETS], ctx->store);
+    }
+}
+
+// benc
+
+struct BencParse
+{
+    uint8_t buffer[1024];
+    uint32_t length;
+    struct Allocator* alloc;
+};
+
+/** A reply to a search as it comes over the wire, mostly the string full of nodes. */
+static void* bencSetUp(struct Random* rand, struct Allocator* alloc)
+{
+    struct BencParse* ctx = Allocator_calloc(alloc, sizeof(struct BencParse), 1);
+    ctx->alloc = alloc;
+
+    uint8_t nodes[8 * 40];
+    Random_bytes(rand, nodes, sizeof(nodes));
+    uint8_t txid[8];
+    Random_bytes(rand, txid, sizeof(txid));
+    Dict* reply = Dict_new(alloc);
+    Dict_putString(reply, String_CONST("n"), String_newBinary(nodes, sizeof(nodes), alloc), alloc);
+    Dict_putString(reply, String_CONST("np"), String_newBinary(nodes, 9, alloc), alloc);
+    Dict_putInt(reply, String_CONST("p"), Version_CURRENT_PROTOCOL, alloc);
+    Dict_putString(reply, String_CONST("txid"), String_newBinary(txid, 8, alloc), alloc);
+    Dict_putString(reply, String_CONST("es"), String_newBinary(txid, 3, alloc), alloc);
+
+    struct Writer* writer = ArrayWriter_new(ctx->buffer, sizeof(ctx->buffer), alloc);
+    Assert_true(!StandardBencSerializer_get()->serializeDictionary(writer, reply));
+    ctx->length = Writer_bytesWritten(writer);
+    return ctx;
+}
+
+static void bencParse(void* vctx, uint32_t count)
+{
+    struct BencParse* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        struct Allocator* alloc = Allocator_child(ctx->alloc);
+        struct Reader* reader = ArrayReader_new(ctx->buffer, ctx->length, alloc);
+        Dict* out = Dict_new(alloc);
+        Assert_true(!StandardBencSerializer_get()->parseDictionary(reader, alloc, out));
+        Allocator_free(alloc);
+    }
+}
+
+// checksum
+
+struct ChecksumEngine
+{
+    uint8_t buffer[PACKET_SIZE];
+    uint32_t sum;
+};
+
+static void* checksumSetUp(struct Random* rand, struct Allocator* alloc)
+{
+    struct ChecksumEngine* ctx = Allocator_calloc(alloc, sizeof(struct ChecksumEngine), 1);
+    Random_bytes(rand, ctx->buffer, PACKET_SIZE);
+    return ctx;
+}
+
+static void checksum(void* vctx, uint32_t count)
+{
+    struct ChecksumEngine* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        ctx->buffer[0] = i;
+        ctx->sum += Checksum_engine(ctx->buffer, PACKET_SIZE);
+    }
+}
+
+// labels
+
+#define LABELS 256
+
+struct Labels
+{
+    uint32_t numbers[LABELS];
+    uint64_t labels[LABELS];
+    struct EncodingScheme* scheme;
+    uint64_t sum;
+};
+
+/**
+ * Compressing and decompressing are inline so each scheme gets its own pair of cases,
+ * calling through NumberCompress_Scheme would measure the function pointer instead.
+ */
+#define Benchmarks_NUMBER_COMPRESS(type)                                                     \
+    static void* type ## SetUp(struct Random* rand, struct Allocator* alloc)                 \
+    {                                                                                        \
+        struct Labels* ctx = Allocator_calloc(alloc, sizeof(struct Labels), 1);              \
+        for (int i = 0; i < LABELS; i++) {                                                   \
+            ctx->numbers[i] = Random_uint32(rand) % NumberCompress_ ## type ## _INTERFACES;  \
+            uint32_t bits = NumberCompress_ ## type ## _bitsUsedForNumber(ctx->numbers[i]);  \
+            ctx->labels[i] = NumberCompress_ ## type ## _getCompressed(ctx->numbers[i], bits) \
+                | (((uint64_t)1) << bits);                                                   \
+        }                                                                                    \
+        return ctx;                                                                          \
+    }                                                                                        \
+    static void type ## Compress(void* vctx, uint32_t count)                                 \
+    {                                                                                        \
+        struct Labels* ctx = vctx;                                                           \
+        for (uint32_t i = 0; i < count; i++) {                                               \
+            uint32_t number = ctx->numbers[i % LABELS];                                      \
+            uint32_t bits = NumberCompress_ ## type ## _bitsUsedForNumber(number);           \
+            ctx->sum += NumberCompress_ ## type ## _getCompressed(number, bits);             \
+        }                                                                                    \
+    }                                                                                        \
+    static void type ## Decompress(void* vctx, uint32_t count)                               \
+    {                                                                                        \
+        struct Labels* ctx = vctx;                                                           \
+        for (uint32_t i = 0; i < count; i++) {                                               \
+            uint64_t label = ctx->labels[i % LABELS];                                        \
+            uint32_t bits = NumberCompress_ ## type ## _bitsUsedForLabel(label);             \
+            ctx->sum += NumberCompress_ ## type ## _getDecompressed(label, bits);            \
+        }                                                                                    \
+    }
+
+Benchmarks_NUMBER_COMPRESS(f4)
+Benchmarks_NUMBER_COMPRESS(f8)
+Benchmarks_NUMBER_COMPRESS(v3x5x8)
+Benchmarks_NUMBER_COMPRESS(v4x8)
+
+/** Routes of a few hops with every director in a random form of the three v3x5x8 forms. */
+static void* encodingSchemeSetUp(struct Random* rand, struct Allocator* alloc)
+{
+    struct Labels* ctx = Allocator_calloc(alloc, sizeof(struct Labels), 1);
+    ctx->scheme = NumberCompress_v3x5x8_defineScheme(alloc);
+    for (int i = 0; i < LABELS; i++) {
+        uint64_t label = 1;
+        for (int hop = 0; hop < 4; hop++) {
+            struct EncodingScheme_Form* form = &ctx->scheme->forms[Random_uint8(rand) % 3];
+            // Directors 0 and 1 are special, keep them out of the route so it converts.
+            uint64_t director = 2 + Random_uint32(rand) % ((1 << form->bitCount) - 2);
+            label = (((label << form->bitCount) | director) << form->prefixLen) | form->prefix;
+        }
+        ctx->labels[i] = label;
+        ctx->numbers[i] = EncodingScheme_getFormNum(ctx->scheme, label);
+    }
+    return ctx;
+}
+
+static void encodingSchemeGetFormNum(void* vctx, uint32_t count)
+{
+    struct Labels* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        ctx->sum += EncodingScheme_getFormNum(ctx->scheme, ctx->labels[i % LABELS]);
+    }
+}
+
+static void encodingSchemeToCannonical(void* vctx, uint32_t count)
+{
+    struct Labels* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        ctx->sum += EncodingScheme_convertLabel(ctx->scheme, ctx->labels[i % LABELS],
+            EncodingScheme_convertLabel_convertTo_CANNONICAL);
+    }
+}
+
+/** Each label is converted to the form after its own, some of which it will not fit in. */
+static void encodingSchemeToForm(void* vctx, uint32_t count)
+{
+    struct Labels* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        int form = (ctx->numbers[i % LABELS] + 1) % ctx->scheme->count;
+        ctx->sum += EncodingScheme_convertLabel(ctx->scheme, ctx->labels[i % LABELS], form);
+    }
+}
+
+// encoding
+
+struct Encoding
+{
+    uint8_t keys[64][32];
+    uint8_t base32[64][53];
+    uint8_t hex[64][65];
+    uint8_t out[128];
+    uint32_t sum;
+};
+
+static void* encodingSetUp(struct Random* rand, struct Allocator* alloc)
+{
+    struct Encoding* ctx = Allocator_calloc(alloc, sizeof(struct Encoding), 1);
+    Random_bytes(rand, (uint8_t*) ctx->keys, sizeof(ctx->keys));
+    for (int i = 0; i < 64; i++) {
+        Assert_true(Base32_encode(ctx->base32[i], 53, ctx->keys[i], 32) == 52);
+        Assert_true(Hex_encode(ctx->hex[i], 65, ctx->keys[i], 32) == 64);
+    }
+    return ctx;
+}
+
+static void base32Encode(void* vctx, uint32_t count)
+{
+    struct Encoding* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        ctx->sum += Base32_encode(ctx->out, sizeof(ctx->out), ctx->keys[i % 64], 32);
+    }
+}
+
+static void base32Decode(void* vctx, uint32_t count)
+{
+    struct Encoding* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        ctx->sum += Base32_decode(ctx->out, sizeof(ctx->out), ctx->base32[i % 64], 52);
+    }
+}
+
+static void hexEncode(void* vctx, uint32_t count)
+{
+    struct Encoding* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        ctx->sum += Hex_encode(ctx->out, sizeof(ctx->out), ctx->keys[i % 64], 32);
+    }
+}
+
+static void hexDecode(void* vctx, uint32_t count)
+{
+    struct Encoding* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        ctx->sum += Hex_decode(ctx->out, sizeof(ctx->out), ctx->hex[i % 64], 64);
+    }
+}
+
+static void printIp(void* vctx, uint32_t count)
+{
+    struct Encoding* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        AddrTools_printIp(ctx->out, ctx->keys[i % 64]);
+        ctx->sum += ctx->out[0];
+    }
+}
+
+/** The names are compared from one run to the next, do not rename them lightly. */
+static const struct Benchmark_Case CASES[] = {
+    { .name = "crypto.seal1280", .setUp = cryptoSetUp, .run = cryptoSeal,
+      .bytesPerOp = PACKET_SIZE },
+    { .name = "crypto.open1280", .setUp = cryptoSetUp, .run = cryptoOpen,
+      .bytesPerOp = PACKET_SIZE },
+    { .name = "crypto.addressForPublicKey", .setUp = cryptoSetUp, .run = cryptoAddress },
+    { .name = "switch.v4x8", .setUp = switchSetUp, .run = switchPacket },
+    { .name = "map.indexForKey", .setUp = mapSetUp, .run = mapGet },
+    { .name = "nodeStore.getBest", .setUp = nodeStoreSetUp, .run = nodeStoreGetBest },
+    { .name = "benc.parseSearchReply", .setUp = bencSetUp, .run = bencParse },
+    { .name = "checksum.1280", .setUp = checksumSetUp, .run = checksum,
+      .bytesPerOp = PACKET_SIZE },
+    { .name = "numberCompress.f4.compress", .setUp = f4SetUp, .run = f4Compress },
+    { .name = "numberCompress.f4.decompress", .setUp = f4SetUp, .run = f4Decompress },
+    { .name = "numberCompress.f8.compress", .setUp = f8SetUp, .run = f8Compress },
+    { .name = "numberCompress.f8.decompress", .setUp = f8SetUp, .run = f8Decompress },
+    { .name = "numberCompress.v3x5x8.compress", .setUp = v3x5x8SetUp, .run = v3x5x8Compress },
+    { .name = "numberCompress.v3x5x8.decompress", .setUp = v3x5x8SetUp,
+      .run = v3x5x8Decompress },
+    { .name = "numberCompress.v4x8.compress", .setUp = v4x8SetUp, .run = v4x8Compress },
+    { .name = "numberCompress.v4x8.decompress", .setUp = v4x8SetUp, .run = v4x8Decompress },
+    { .name = "encodingScheme.getFormNum", .setUp = encodingSchemeSetUp,
+      .run = encodingSchemeGetFormNum },
+    { .name = "encodingScheme.convertLabel.cannonical", .setUp = encodingSchemeSetUp,
+      .run = encodingSchemeToCannonical },
+    { .name = "encodingScheme.convertLabel.form", .setUp = encodingSchemeSetUp,
+      .run = encodingSchemeToForm },
+    { .name = "base32.encodeKey", .setUp = encodingSetUp, .run = base32Encode },
+    { .name = "base32.decodeKey", .setUp = encodingSetUp, .run = base32Decode },
+    { .name = "hex.encodeKey", .setUp = encodingSetUp, .run = hexEncode },
+    { .name = "hex.decodeKey", .setUp = encodingSetUp, .run = hexDecode },
+    { .name = "addrTools.printIp", .setUp = encodingSetUp, .run = printIp }
+};
+#define CASE_COUNT ((int) (sizeof(CASES) / sizeof(*CASES)))
+
+static bool hasPrefix(const char* name, const char* prefix)
+{
+    while (*prefix) {
+        if (*name++ != *prefix++) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** See: Benchmarks.h */
+List* Benchmarks_run(const char* prefix, struct Allocator* alloc)
+{
+    // List_addDict() prepends.
+    Dict* results[CASE_COUNT];
+    int count = 0;
+    for (int i = 0; i < CASE_COUNT; i++) {
+        if (prefix && !hasPrefix(CASES[i].name, prefix)) {
+            continue;
+        }
+        // A generator for each case so a case gets the same input whichever others are run.
+        struct Allocator* randAlloc = Allocator_child(alloc);
+        struct Random* rand =
+            Random_newWithSeed(randAlloc, NULL, DeterminentRandomSeed_new(randAlloc), NULL);
+        results[count++] = Benchmark_run(&CASES[i], rand, alloc);
+        Allocator_free(randAlloc);
+    }
+
+    List* out = NULL;
+    for (int i = count - 1; i >= 0; i--) {
+        out = List_addDict(out, results[i], alloc);
+    }
+    return out;
+}
@@ -0,0 +1,34 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef Benchmarks_H
+#define Benchmarks_H
+
+#include "benc/List.h"
+#include "memory/Allocator.h"
+#include "util/Linker.h"
+Linker_require("test/Benchmarks.c")
+
+/**
+ * Run the registered benchmark cases, they cover crypto, the switch, Map, NodeStore search,
+ * benc parsing and checksums. Each is timed with Benchmark_run() from a generator which is
+ * seeded the same way every time so runs on different commits can be compared.
+ *
+ * @param prefix if not NULL, only the cases whose names begin with this are run.
+ * @param alloc the results are allocated here.
+ * @return a list of the results of the cases which were run, NULL if none were.
+ */
+List* Benchmarks_run(const char* prefix, struct Allocator* alloc);
+
+#endif
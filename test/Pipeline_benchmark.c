@@ -0,0 +1,569 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "benc/serialization/json/JsonBencSerializer.h"
+#include "crypto/CryptoAuth.h"
+#include "crypto/random/Random.h"
+#include "crypto/random/test/DeterminentRandomSeed.h"
+#include "interface/Interface.h"
+#include "interface/InterfaceController.h"
+#include "interface/tuntap/TUNMessageType.h"
+#include "io/FileWriter.h"
+#include "memory/Allocator.h"
+#include "memory/PoolAllocator.h"
+#include "net/Ducttape.h"
+#include "test/Pipeline_benchmark.h"
+#include "test/TestFramework.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+#include "util/Order.h"
+#include "util/PacketCapture.h"
+#include "util/events/EventBase.h"
+#include "util/events/Time.h"
+#include "util/events/Timeout.h"
+#include "util/log/IndirectLog.h"
+#include "wire/Ethernet.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+#include <stdio.h>
+
+/** The keys from threeNodes_test, B's address is between A and C so A finds C by asking B. */
+static char* const KEYS[] = {
+    "\xad\x7e\xa3\x26\xaa\x01\x94\x0a\x25\xbc\x9e\x01\x26\x22\xdb\x69"
+    "\x4f\xd9\xb4\x17\x7c\xf3\xf8\x91\x16\xf3\xcf\xe8\x5c\x80\xe1\x4a",
+    "\xea\x8d\x34\x04\xa9\x7c\xe4\xf9\xca\x7e\x24\xe6\xf1\x85\xb9\x3f"
+    "\x01\x37\xb7\xa1\xf5\x2c\xce\xc0\x2c\xae\x03\xf1\x83\x38\x13\x24",
+    "\xd8\x54\x3e\x70\xb9\xae\x7c\x41\xbc\x18\xa4\x9a\x9c\xee\xca\x9c"
+    "\xdc\x45\x01\x96\x6b\xbd\x7e\x76\xcf\x3a\x9f\xbc\x12\xed\x8b\xb4"
+};
+
+#define MAX_NODES 3
+
+/** Sizes of the IPv6 packets which are sent. */
+static const int SIZES[] = { 64, 576, 1280 };
+#define SIZE_COUNT ((int) (sizeof(SIZES) / sizeof(*SIZES)))
+
+/** Number of packets which are timed for each size. */
+#define SAMPLES 20000
+
+/** Packets sent in each direction before timing so the sessions and routes are set up. */
+#define WARMUP 16
+
+static const char* STAGE_NAMES[][MAX_NODES] = {
+    { "send", "receive" },
+    { "send", "forward", "receive" }
+};
+
+struct Link
+{
+    struct Interface ifA;
+    struct Interface ifB;
+    struct Context* ctx;
+    Identity
+};
+
+struct Context
+{
+    struct TestFramework* nodes[MAX_NODES];
+    struct Interface tunIfs[MAX_NODES];
+    int nodeCount;
+
+    /** Where the copies of messages which cross a link are allocated. */
+    struct Allocator* packetAlloc;
+
+    /** The time when the current stage of the current packet began. */
+    uint64_t stageBegan;
+
+    /** Stages of the current packet which are done, each link and the final TUN ends one. */
+    int stage;
+    uint64_t stageTimes[MAX_NODES];
+
+    struct Allocator* alloc;
+    Identity
+};
+
+static void endStage(struct Context* ctx)
+{
+    uint64_t now = Time_hrtime();
+    if (ctx->stage < ctx->nodeCount) {
+        ctx->stageTimes[ctx->stage] = now - ctx->stageBegan;
+    }
+    ctx->stage++;
+    ctx->stageBegan = now;
+}
+
+/** Copy the message to the other end like the kernel would copy a UDP packet. */
+static uint8_t sendOverLink(struct Message* msg, struct Interface* iface)
+{
+    struct Link* link = Identity_cast((struct Link*) iface->senderContext);
+    struct Interface* dest = (iface == &link->ifA) ? &link->ifB : &link->ifA;
+    endStage(link->ctx);
+    return Interface_receiveMessage(dest, Message_clone(msg, link->ctx->packetAlloc));
+}
+
+static uint8_t receivedOnTun(struct Message* msg, struct Interface* iface)
+{
+    struct Context* ctx = Identity_cast((struct Context*) iface->senderContext);
+    endStage(ctx);
+    return 0;
+}
+
+static void linkNodes(struct Context* ctx,
+                      struct TestFramework* client,
+                      struct TestFramework* server)
+{
+    struct Link* link = Allocator_clone(ctx->alloc, (&(struct Link) {
+        .ctx = ctx
+    }));
+    Bits_memcpyConst(&link->ifA, (&(struct Interface) {
+        .sendMessage = sendOverLink,
+        .senderContext = link,
+        .allocator = ctx->alloc
+    }), sizeof(struct Interface));
+    Bits_memcpyConst(&link->ifB, &link->ifA, sizeof(struct Interface));
+    Identity_set(link);
+
+    String* password = String_CONST("benchmark");
+    InterfaceController_registerPeer(server->ifController, NULL, NULL, true, false, &link->ifB);
+    CryptoAuth_addUser(password, 1, String_CONST("bench"), server->cryptoAuth);
+    InterfaceController_registerPeer(client->ifController,
+                                     server->publicKey,
+                                     password,
+                                     false,
+                                     false,
+                                     &link->ifA);
+}
+
+/** If base and rand are NULL, each node gets an event base and a generator of its own. */
+static struct Context* setUp(int nodeCount,
+                             struct EventBase* base,
+                             struct Random* rand,
+                             struct Allocator* alloc)
+{
+    // Logging every packet would be the slowest stage.
+    struct Log* silent = IndirectLog_new(alloc);
+
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    ctx->alloc = alloc;
+    ctx->packetAlloc = alloc;
+    ctx->nodeCount = nodeCount;
+    Identity_set(ctx);
+
+    for (int i = 0; i < nodeCount; i++) {
+        ctx->nodes[i] = TestFramework_setUpOn(KEYS[i], base, rand, alloc, silent);
+        Bits_memcpyConst(&ctx->tunIfs[i], (&(struct Interface) {
+            .sendMessage = receivedOnTun,
+            .senderContext = ctx,
+            .allocator = alloc
+        }), sizeof(struct Interface));
+        Ducttape_setUserInterface(ctx->nodes[i]->ducttape, &ctx->tunIfs[i]);
+    }
+    for (int i = 1; i < nodeCount; i++) {
+        linkNodes(ctx, ctx->nodes[i], ctx->nodes[i - 1]);
+    }
+    return ctx;
+}
+
+/** The message is freed by sendFromTun(), along with the copies of it which cross the links. */
+static struct Message* newPacket(struct Context* ctx, int length)
+{
+    ctx->packetAlloc = Allocator_child(ctx->alloc);
+    return Message_new(length, 512, ctx->packetAlloc);
+}
+
+/** @return true if the IPv6 packet reached the TUN of the node at the other end. */
+static bool sendFromTun(struct Context* ctx, struct Message* msg, int from)
+{
+    TUNMessageType_push(msg, Ethernet_TYPE_IP6, NULL);
+
+    ctx->stage = 0;
+    ctx->stageBegan = Time_hrtime();
+    Interface_receiveMessage(&ctx->tunIfs[from], msg);
+
+    Allocator_free(ctx->packetAlloc);
+    ctx->packetAlloc = ctx->alloc;
+    return ctx->stage == ctx->nodeCount;
+}
+
+/** @return true if the packet reached the TUN of the node at the other end. */
+static bool sendPacket(struct Context* ctx, int size, bool forward)
+{
+    int from = (forward) ? 0 : ctx->nodeCount - 1;
+    int to = (forward) ? ctx->nodeCount - 1 : 0;
+
+    struct Message* msg = newPacket(ctx, size - Headers_IP6Header_SIZE);
+    Bits_memset(msg->bytes, 0, msg->length);
+    TestFramework_craftIPHeader(msg, ctx->nodes[from]->ip, ctx->nodes[to]->ip);
+    return sendFromTun(ctx, msg, from);
+}
+
+static int compareTimes(const void* a, const void* b)
+{
+    uint64_t x = *((uint64_t*) a);
+    uint64_t y = *((uint64_t*) b);
+    return (x > y) - (x < y);
+}
+
+static Dict* percentiles(uint64_t* times, int count, struct Allocator* alloc)
+{
+    Order_qsort(times, count, sizeof(uint64_t), compareTimes);
+    Dict* out = Dict_new(alloc);
+    Dict_putInt(out, String_new("p50Ns", alloc), times[count / 2], alloc);
+    Dict_putInt(out, String_new("p90Ns", alloc), times[count * 90 / 100], alloc);
+    Dict_putInt(out, String_new("p99Ns", alloc), times[count * 99 / 100], alloc);
+    printf("\tp50 %dns\tp90 %dns\tp99 %dns\n",
+           (int) times[count / 2], (int) times[count * 90 / 100], (int) times[count * 99 / 100]);
+    return out;
+}
+
+static Dict* timePackets(struct Context* ctx, int size, struct Allocator* alloc)
+{
+    uint64_t* times = Allocator_malloc(ctx->alloc, SAMPLES * sizeof(uint64_t) * (MAX_NODES + 1));
+    uint64_t total = 0;
+    int lost = 0;
+    int samples = 0;
+    struct PoolAllocator_Stats before;
+    PoolAllocator_getStats(ctx->alloc, &before);
+    while (samples < SAMPLES && lost < SAMPLES) {
+        uint64_t start = Time_hrtime();
+        bool delivered = sendPacket(ctx, size, true);
+        uint64_t time = Time_hrtime() - start;
+        total += time;
+        if (!delivered) {
+            lost++;
+            continue;
+        }
+        times[samples] = time;
+        for (int i = 0; i < ctx->nodeCount; i++) {
+            times[SAMPLES * (i + 1) + samples] = ctx->stageTimes[i];
+        }
+        samples++;
+    }
+    Assert_true(samples);
+
+    struct PoolAllocator_Stats after;
+    PoolAllocator_getStats(ctx->alloc, &after);
+    uint64_t mallocs = after.systemAllocations - before.systemAllocations;
+
+    uint64_t packetsPerSecond = (total) ? ((samples + lost) * 1000000000ull) / total : 0;
+    uint64_t mbps = (total) ? ((uint64_t) size * samples * 8 * 1000) / total : 0;
+    printf("%d byte packets, %d lost\t%d packets/s\t%d Mb/s\t%d calls to malloc()\n",
+           size, lost, (int) packetsPerSecond, (int) mbps, (int) mallocs);
+
+    // The keys must outlive this function.
+    Dict* out = Dict_new(alloc);
+    Dict_putInt(out, String_new("size", alloc), size, alloc);
+    Dict_putInt(out, String_new("lost", alloc), lost, alloc);
+    Dict_putInt(out, String_new("packetsPerSecond", alloc), packetsPerSecond, alloc);
+    Dict_putInt(out, String_new("mbps", alloc), mbps, alloc);
+    Dict_putInt(out, String_new("mallocs", alloc), mallocs, alloc);
+    printf("    total");
+    Dict_putDict(out, String_new("total", alloc), percentiles(times, samples, alloc), alloc);
+    for (int i = 0; i < ctx->nodeCount; i++) {
+        const char* name = STAGE_NAMES[ctx->nodeCount - 2][i];
+        printf("    %s", name);
+        Dict_putDict(out,
+                     String_new(name, alloc),
+                     percentiles(&times[SAMPLES * (i + 1)], samples, alloc),
+                     alloc);
+    }
+    return out;
+}
+
+static Dict* benchmarkNodes(int nodeCount, struct Allocator* alloc)
+{
+    printf("\nTest %d nodes in a line\n", nodeCount);
+
+    // The nodes are too big for the caller's allocator, the core runs on a pool too.
+    struct Allocator* nodeAlloc = PoolAllocator_new(1<<28);
+    struct Context* ctx = setUp(nodeCount, NULL, NULL, nodeAlloc);
+
+    for (int i = 0; i < WARMUP; i++) {
+        sendPacket(ctx, 64, true);
+        sendPacket(ctx, 64, false);
+    }
+
+    // List_addDict() prepends.
+    Dict* results[SIZE_COUNT];
+    for (int i = 0; i < SIZE_COUNT; i++) {
+        results[i] = timePackets(ctx, SIZES[i], alloc);
+    }
+    List* sizes = NULL;
+    for (int i = SIZE_COUNT - 1; i >= 0; i--) {
+        sizes = List_addDict(sizes, results[i], alloc);
+    }
+    Allocator_free(nodeAlloc);
+
+    Dict* out = Dict_new(alloc);
+    Dict_putInt(out, String_new("nodes", alloc), nodeCount, alloc);
+    Dict_putList(out, String_new("sizes", alloc), sizes, alloc);
+    return out;
+}
+
+void Pipeline_benchmark(struct EventBase* base,
+                        struct Log* logger,
+                        struct Allocator* alloc)
+{
+    printf("\nThese metrics are the speed of sending packets from the TUN of one node to the\n"
+           "TUN of another through Ducttape, CryptoAuth and the switch. Stages are timed from\n"
+           "the TUN or link where the packet comes in to the link or TUN where it goes out.\n");
+
+    Dict* twoNodes = benchmarkNodes(2, alloc);
+    Dict* threeNodes = benchmarkNodes(3, alloc);
+    List* results = List_addDict(List_addDict(NULL, threeNodes, alloc), twoNodes, alloc);
+
+    printf("\nJSON results:\n");
+    struct Writer* stdoutWriter = FileWriter_new(stdout, alloc);
+    JsonBencSerializer_get()->serializeList(stdoutWriter, results);
+    printf("\n");
+}
+
+/** pcapng block types and the byte order magic, see PacketCapture.c */
+#define BLOCK_SECTION_HEADER 0x0A0D0D0A
+#define BLOCK_ENHANCED_PACKET 6
+#define BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+/** The nodes which a replay goes through, so there is a send, forward and receive stage. */
+#define REPLAY_NODES 3
+
+/** A packet in the capture. */
+struct Recorded
+{
+    /** Nanoseconds since the epoch when the packet was captured, never before the last one. */
+    uint64_t time;
+
+    /** The captured bytes, in the capture. */
+    uint8_t* bytes;
+    uint32_t captured;
+
+    /** The length of the packet before it was snapped, the rest of it is replayed as zeros. */
+    uint32_t length;
+};
+
+struct Replay
+{
+    struct Context* ctx;
+    struct EventBase* base;
+
+    struct Recorded* packets;
+    int count;
+
+    /** The next packet to send. */
+    int next;
+
+    /** Virtual time in milliseconds when the first packet was sent. */
+    uint64_t startTime;
+
+    int delivered;
+    uint64_t bytes;
+    uint64_t packetNanoseconds;
+
+    /** The total time of each delivered packet then the time of each stage, like timePackets(). */
+    uint64_t* times;
+
+    struct Timeout* timeout;
+    Identity
+};
+
+static uint32_t get32(uint8_t* in)
+{
+    uint32_t out;
+    Bits_memcpy(&out, in, 4);
+    return out;
+}
+
+/**
+ * Find the IPv6 packets from the TUN in a capture which was written by PacketCapture_read(),
+ * the capture ends at the first block which is cut off or not in host byte order.
+ *
+ * @param pcapng the capture.
+ * @param length the size of the capture.
+ * @param out if not NULL, where the packets are written.
+ * @param skipped if not NULL, incremented for each packet which can not be replayed.
+ * @return the number of packets which can be replayed.
+ */
+static int findPackets(uint8_t* pcapng, uint32_t length, struct Recorded* out, int* skipped)
+{
+    int count = 0;
+    uint64_t last = 0;
+    for (uint32_t i = 0; length - i >= 12;) {
+        uint32_t type = get32(&pcapng[i]);
+        uint32_t blockLength = get32(&pcapng[i + 4]);
+        if (blockLength < 12 || blockLength % 4 || blockLength > length - i
+            || (type == BLOCK_SECTION_HEADER && get32(&pcapng[i + 8]) != BYTE_ORDER_MAGIC))
+        {
+            break;
+        }
+        if (type == BLOCK_ENHANCED_PACKET && blockLength >= 32) {
+            uint8_t* bytes = &pcapng[i + 28];
+            uint32_t captured = get32(&pcapng[i + 20]);
+            uint32_t original = get32(&pcapng[i + 24]);
+            if (get32(&pcapng[i + 8]) != PacketCapture_Point_TUN_IN
+                || captured > blockLength - 32
+                || captured < Headers_IP6Header_SIZE
+                || original < captured
+                || original > PacketCapture_MAX_SNAP_LENGTH
+                || Headers_getIpVersion(bytes) != 6)
+            {
+                if (skipped) {
+                    (*skipped)++;
+                }
+            } else {
+                uint64_t time = ((uint64_t) get32(&pcapng[i + 12]) << 32) | get32(&pcapng[i + 16]);
+                // Successive captures can be concatenated, time never goes back.
+                last = (time > last) ? time : last;
+                if (out) {
+                    out[count] = (struct Recorded) {
+                        .time = last,
+                        .bytes = bytes,
+                        .captured = captured,
+                        .length = original
+                    };
+                }
+                count++;
+            }
+        }
+        i += blockLength;
+    }
+    return count;
+}
+
+/** Send a recorded packet from the first node to the last as if it came from the TUN. */
+static void replayPacket(struct Replay* replay, struct Recorded* packet)
+{
+    struct Context* ctx = replay->ctx;
+    struct Message* msg = newPacket(ctx, packet->length);
+    Bits_memcpy(msg->bytes, packet->bytes, packet->captured);
+    Bits_memset(&msg->bytes[packet->captured], 0, packet->length - packet->captured);
+    struct Headers_IP6Header* ip6 = (struct Headers_IP6Header*) msg->bytes;
+    Bits_memcpyConst(ip6->sourceAddr, ctx->nodes[0]->ip, 16);
+    Bits_memcpyConst(ip6->destinationAddr, ctx->nodes[ctx->nodeCount - 1]->ip, 16);
+
+    uint64_t start = Time_hrtime();
+    bool delivered = sendFromTun(ctx, msg, 0);
+    uint64_t time = Time_hrtime() - start;
+    replay->packetNanoseconds += time;
+    if (!delivered) {
+        return;
+    }
+    replay->times[replay->delivered] = time;
+    for (int i = 0; i < ctx->nodeCount; i++) {
+        replay->times[replay->count * (i + 1) + replay->delivered] = ctx->stageTimes[i];
+    }
+    replay->delivered++;
+    replay->bytes += packet->length;
+}
+
+/** Milliseconds from the first packet of the capture until this one. */
+static inline uint64_t offsetOf(struct Replay* replay, int packet)
+{
+    return (replay->packets[packet].time - replay->packets[0].time) / 1000000;
+}
+
+/** Send the packets which are due by now then sleep until the next one. */
+static void replayDue(void* vreplay)
+{
+    struct Replay* replay = Identity_cast((struct Replay*) vreplay);
+    uint64_t now = Time_currentTimeMilliseconds(replay->base);
+    if (!replay->next) {
+        replay->startTime = now;
+    }
+    now -= replay->startTime;
+    while (replay->next < replay->count && offsetOf(replay, replay->next) <= now) {
+        replayPacket(replay, &replay->packets[replay->next++]);
+    }
+    if (replay->next == replay->count) {
+        EventBase_endLoop(replay->base);
+        return;
+    }
+    Timeout_resetTimeout(replay->timeout, offsetOf(replay, replay->next) - now);
+}
+
+/** See: Pipeline_benchmark.h */
+Dict* Pipeline_replay(uint8_t* pcapng, uint32_t length, struct Allocator* alloc)
+{
+    int skipped = 0;
+    int count = findPackets(pcapng, length, NULL, &skipped);
+    if (!count) {
+        return NULL;
+    }
+
+    struct Allocator* nodeAlloc = PoolAllocator_new(1<<28);
+    struct EventBase* base = EventBase_newVirtual(nodeAlloc);
+    struct Random* rand =
+        Random_newWithSeed(nodeAlloc, NULL, DeterminentRandomSeed_new(nodeAlloc), NULL);
+    struct Context* ctx = setUp(REPLAY_NODES, base, rand, nodeAlloc);
+
+    struct Replay* replay = Allocator_clone(nodeAlloc, (&(struct Replay) {
+        .ctx = ctx,
+        .base = base,
+        .packets = Allocator_malloc(nodeAlloc, count * sizeof(struct Recorded)),
+        .count = count,
+        .times = Allocator_malloc(nodeAlloc, count * sizeof(uint64_t) * (MAX_NODES + 1))
+    }));
+    Identity_set(replay);
+    findPackets(pcapng, length, replay->packets, NULL);
+
+    for (int i = 0; i < WARMUP; i++) {
+        sendPacket(ctx, 64, true);
+        sendPacket(ctx, 64, false);
+    }
+
+    // The timers of the nodes fire in between the packets but the clock jumps to each one.
+    replay->timeout = Timeout_setTimeout(replayDue, replay, 0, base, nodeAlloc);
+    uint64_t start = Time_hrtime();
+    EventBase_beginLoop(base);
+    uint64_t loopNanoseconds = Time_hrtime() - start;
+
+    uint64_t total = replay->packetNanoseconds;
+    uint64_t packetsPerSecond = (total) ? (count * 1000000000ull) / total : 0;
+    uint64_t mbps = (total) ? (replay->bytes * 8 * 1000) / total : 0;
+    uint64_t timerNanoseconds =
+        (loopNanoseconds > total) ? loopNanoseconds - total : 0;
+    printf("Replayed %d packets over %d recorded ms, %d delivered, %d skipped\n"
+           "%d packets/s\t%d Mb/s\t%dns in timers\n",
+           count, (int) offsetOf(replay, count - 1), replay->delivered, skipped,
+           (int) packetsPerSecond, (int) mbps, (int) timerNanoseconds);
+
+    Dict* out = Dict_new(alloc);
+    Dict_putInt(out, String_new("packets", alloc), count, alloc);
+    Dict_putInt(out, String_new("delivered", alloc), replay->delivered, alloc);
+    Dict_putInt(out, String_new("skipped", alloc), skipped, alloc);
+    Dict_putInt(out, String_new("recordedMilliseconds", alloc), offsetOf(replay, count - 1), alloc);
+    Dict_putInt(out, String_new("packetsPerSecond", alloc), packetsPerSecond, alloc);
+    Dict_putInt(out, String_new("mbps", alloc), mbps, alloc);
+    Dict_putInt(out, String_new("timerNanoseconds", alloc), timerNanoseconds, alloc);
+    if (replay->delivered) {
+        printf("    total");
+        Dict_putDict(out,
+                     String_new("total", alloc),
+                     percentiles(replay->times, replay->delivered, alloc),
+                     alloc);
+        for (int i = 0; i < ctx->nodeCount; i++) {
+            const char* name = STAGE_NAMES[ctx->nodeCount - 2][i];
+            printf("    %s", name);
+            Dict_putDict(out,
+                         String_new(name, alloc),
+                         percentiles(&replay->times[count * (i + 1)], replay->delivered, alloc),
+                         alloc);
+        }
+    }
+    Allocator_free(nodeAlloc);
+    return out;
+}
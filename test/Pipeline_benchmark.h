@@ -0,0 +1,52 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef Pipeline_benchmark_H
+#define Pipeline_benchmark_H
+
+#include "benc/Dict.h"
+#include "memory/Allocator.h"
+#include "util/log/Log.h"
+#include "util/events/EventBase.h"
+#include "util/Linker.h"
+Linker_require("test/Pipeline_benchmark.c")
+
+#include <stdint.h>
+
+/**
+ * Benchmark the whole path of a packet from the TUN of one node to the TUN of another,
+ * through Ducttape, both layers of CryptoAuth and the switch of every node on the way.
+ * The nodes are in the same process and are linked by interfaces which stand in for UDP.
+ */
+void Pipeline_benchmark(struct EventBase* base,
+                        struct Log* logger,
+                        struct Allocator* alloc);
+
+/**
+ * Replay the packets from the TUN in a capture which was made at the tunIn point so a recording
+ * of real traffic becomes a benchmark which can be run again on each commit. The packets go
+ * from the TUN of the first of three nodes in a line to the TUN of the last, each at the time
+ * when it was captured, with its addresses replaced by those of the nodes. The nodes run on a
+ * virtual event base so their timers fire in between as they would have but no time is spent
+ * waiting and the same capture always gives the same sequence of events.
+ *
+ * @param pcapng the output of PacketCapture_read(), successive reads may be concatenated.
+ * @param length the size of the capture.
+ * @param alloc the results are allocated here.
+ * @return the throughput and the percentiles of the time of each stage like
+ *         Pipeline_benchmark(), NULL if there are no packets from the TUN to replay.
+ */
+Dict* Pipeline_replay(uint8_t* pcapng, uint32_t length, struct Allocator* alloc);
+
+#endif
@@ -0,0 +1,78 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "test/Pipeline_benchmark.h"
+#include "test/TestFramework.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/PacketCapture.h"
+#include "util/events/EventBase.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+#define PACKETS 20
+#define BUFFER_SIZE 65536
+
+static int64_t getInt(Dict* result, char* key)
+{
+    int64_t* value = Dict_getInt(result, String_CONST(key));
+    Assert_always(value);
+    return *value;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct EventBase* base = EventBase_new(alloc);
+    struct PacketCapture* capture = PacketCapture_new(base, alloc);
+    uint8_t src[16] = { 0xfc, 1 };
+    uint8_t dest[16] = { 0xfc, 2 };
+
+    // Only what comes from the TUN can be replayed, the packets from a link are skipped.
+    PacketCapture_start(capture,
+                        (1 << PacketCapture_Point_TUN_IN) | (1 << PacketCapture_Point_LINK_IN),
+                        1,
+                        64);
+    for (int i = 0; i < PACKETS; i++) {
+        struct Message* msg = Message_new(50 * (i + 1), Headers_IP6Header_SIZE, alloc);
+        Bits_memset(msg->bytes, i, msg->length);
+        TestFramework_craftIPHeader(msg, src, dest);
+        PacketCapture_tap(capture, PacketCapture_Point_TUN_IN, msg);
+        if (!i) {
+            PacketCapture_tap(capture, PacketCapture_Point_LINK_IN, msg);
+        }
+    }
+    uint8_t* pcapng = Allocator_malloc(alloc, BUFFER_SIZE);
+    uint32_t length = PacketCapture_read(capture, pcapng, BUFFER_SIZE);
+
+    Dict* result = Pipeline_replay(pcapng, length, alloc);
+    Assert_always(result);
+    Assert_always(getInt(result, "packets") == PACKETS);
+    Assert_always(getInt(result, "delivered") == PACKETS);
+    Assert_always(getInt(result, "skipped") == 1);
+    Assert_always(Dict_getDict(result, String_CONST("forward")));
+
+    // A capture with nothing from the TUN has nothing to replay.
+    PacketCapture_start(capture, 1 << PacketCapture_Point_LINK_IN, 1, 64);
+    PacketCapture_tap(capture, PacketCapture_Point_LINK_IN, Message_new(100, 0, alloc));
+    length = PacketCapture_read(capture, pcapng, BUFFER_SIZE);
+    Assert_always(!Pipeline_replay(pcapng, length, alloc));
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,549 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crypto/AddressCalc.h"
+#include "crypto/random/Random.h"
+#include "crypto/random/test/DeterminentRandomSeed.h"
+#include "dht/Address.h"
+#include "dht/DHTMessage.h"
+#include "dht/DHTModule.h"
+#include "dht/DHTModuleRegistry.h"
+#include "dht/EncodingSchemeModule.h"
+#include "dht/ReplyModule.h"
+#include "dht/SerializationModule.h"
+#include "dht/dhtcore/Janitor.h"
+#include "dht/dhtcore/NodeList.h"
+#include "dht/dhtcore/NodeStore.h"
+#include "dht/dhtcore/RouteTracer.h"
+#include "dht/dhtcore/RouterModule.h"
+#include "dht/dhtcore/SearchRunner.h"
+#include "memory/Allocator.h"
+#include "switch/NumberCompress.h"
+#include "test/Simulator.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+#include "util/events/EventBase.h"
+#include "util/events/Time.h"
+#include "util/events/Timeout.h"
+#include "util/version/Version.h"
+
+#include <stdbool.h>
+
+/** The same as the maintenance intervals in Core.c. */
+#define LOCAL_MAINTENANCE_SEARCH_MILLISECONDS 1000
+#define GLOBAL_MAINTENANCE_SEARCH_MILLISECONDS 30000
+
+/** The time between one search ending and the next one starting. */
+#define SEARCH_SPACING_MILLISECONDS 100
+
+/** A packet which goes over more switches than this is dropped, it must be going in circles. */
+#define MAX_HOPS 64
+
+/** The interface number which means this node, numbers for links skip it. */
+#define SELF 1
+
+struct Simulator_Link
+{
+    /** The index of the node at the other end. */
+    uint32_t peer;
+
+    /** The number of this link's interface at the other end. */
+    uint32_t peerNumber;
+
+    uint32_t latency;
+};
+
+struct Simulator_Node
+{
+    struct DHTModule module;
+
+    struct Address addr;
+
+    struct DHTModuleRegistry* registry;
+    struct RouterModule* router;
+    struct NodeStore* store;
+    struct SearchRunner* searchRunner;
+
+    /** The link for each interface number, see linkIndex(). */
+    struct Simulator_Link links[Simulator_MAX_LINKS];
+    int linkCount;
+
+    uint64_t bytes;
+
+    struct Simulator* sim;
+
+    Identity
+};
+
+struct Simulator
+{
+    struct Simulator_Node* nodes;
+    int nodeCount;
+
+    struct EventBase* base;
+    struct Random* rand;
+    struct Allocator* alloc;
+
+    struct Simulator_Config* conf;
+    struct Simulator_Result* result;
+
+    /** The search which is running, freeing this cancels it. */
+    struct Allocator* searchAlloc;
+
+    Identity
+};
+
+struct Simulator_Packet
+{
+    struct Simulator_Node* to;
+
+    /** The sender as the receiver sees it, the path is the way back. */
+    struct Address from;
+
+    uint8_t bytes[DHTMessage_MAX_SIZE];
+    uint16_t length;
+
+    struct Allocator* alloc;
+
+    Identity
+};
+
+struct Simulator_Search
+{
+    struct Simulator_Node* source;
+    struct Simulator_Node* target;
+    uint64_t startTime;
+    uint32_t hops;
+    int complete;
+
+    struct Simulator* sim;
+
+    Identity
+};
+
+/** Interface numbers for links are 0, 2, 3... because 1 is the node itself. */
+static inline uint32_t linkNumber(int index)
+{
+    return (index) ? index + 1 : 0;
+}
+
+static inline int linkIndex(uint32_t number)
+{
+    return (number) ? (int) number - 1 : 0;
+}
+
+static int addLink(struct Simulator* sim, uint32_t a, uint32_t b)
+{
+    struct Simulator_Node* nodeA = &sim->nodes[a];
+    struct Simulator_Node* nodeB = &sim->nodes[b];
+    if (a == b
+        || nodeA->linkCount == Simulator_MAX_LINKS
+        || nodeB->linkCount == Simulator_MAX_LINKS)
+    {
+        return -1;
+    }
+    for (int i = 0; i < nodeA->linkCount; i++) {
+        if (nodeA->links[i].peer == b) {
+            return -1;
+        }
+    }
+    uint32_t min = sim->conf->minLatencyMilliseconds;
+    uint32_t latency =
+        min + Random_uint32(sim->rand) % (sim->conf->maxLatencyMilliseconds - min + 1);
+
+    nodeA->links[nodeA->linkCount] = (struct Simulator_Link) {
+        .peer = b,
+        .peerNumber = linkNumber(nodeB->linkCount),
+        .latency = latency
+    };
+    nodeB->links[nodeB->linkCount] = (struct Simulator_Link) {
+        .peer = a,
+        .peerNumber = linkNumber(nodeA->linkCount),
+        .latency = latency
+    };
+    nodeA->linkCount++;
+    nodeB->linkCount++;
+    return 0;
+}
+
+static void buildTopology(struct Simulator* sim)
+{
+    int count = sim->nodeCount;
+    int links = sim->conf->linksPerNode;
+    for (int i = 0; i < count; i++) {
+        if (sim->conf->topology == Simulator_Topology_RING) {
+            for (int j = 1; j <= links; j++) {
+                addLink(sim, i, (i + j) % count);
+            }
+            continue;
+        }
+        if (i > 0) {
+            addLink(sim, i, Random_uint32(sim->rand) % i);
+        }
+        for (int j = 1; j < links; j++) {
+            addLink(sim, i, Random_uint32(sim->rand) % count);
+        }
+    }
+}
+
+/**
+ * Follow a label from a node the way the switches would.
+ *
+ * @param from the sending node.
+ * @param label the label of the packet.
+ * @param returnLabel set to the label which leads back, as the receiver would see it.
+ * @param latency set to the time which the packet takes to get there.
+ * @return the receiving node or NULL if the label does not lead anywhere.
+ */
+static struct Simulator_Node* route(struct Simulator_Node* from,
+                                    uint64_t label,
+                                    uint64_t* returnLabel,
+                                    uint32_t* latency)
+{
+    struct Simulator* sim = from->sim;
+    struct Simulator_Node* node = from;
+    uint32_t sourceNumber = SELF;
+    uint64_t reverse = 0;
+    uint32_t reverseBits = 0;
+    *latency = 0;
+    for (int hops = 0; hops < MAX_HOPS; hops++) {
+        uint32_t bits = NumberCompress_bitsUsedForLabel(label);
+        uint32_t number = NumberCompress_getDecompressed(label, bits);
+        uint32_t sourceBits = NumberCompress_bitsUsedForNumber(sourceNumber);
+        if (number == SELF) {
+            // As the switch does, the way back is written with as many bits as it needs.
+            bits = (sourceBits > bits) ? sourceBits : bits;
+        } else {
+            int index = linkIndex(number);
+            if (index >= node->linkCount || number == sourceNumber || sourceBits > bits) {
+                return NULL;
+            }
+        }
+        if (reverseBits + bits > 64) {
+            return NULL;
+        }
+        reverse = (reverse << bits) | NumberCompress_getCompressed(sourceNumber, bits);
+        reverseBits += bits;
+        if (number == SELF) {
+            *returnLabel = reverse;
+            return node;
+        }
+        struct Simulator_Link* link = &node->links[linkIndex(number)];
+        *latency += link->latency;
+        sourceNumber = link->peerNumber;
+        node = &sim->nodes[link->peer];
+        label >>= bits;
+    }
+    return NULL;
+}
+
+static void deliver(void* vpacket)
+{
+    struct Simulator_Packet* packet = Identity_cast((struct Simulator_Packet*) vpacket);
+    struct DHTMessage dht;
+    Bits_memset(&dht, 0, sizeof(struct DHTMessage));
+    Bits_memcpy(dht.bytes, packet->bytes, packet->length);
+    dht.length = packet->length;
+    dht.address = &packet->from;
+    dht.allocator = packet->alloc;
+    packet->to->bytes += packet->length;
+    DHTModuleRegistry_handleIncoming(&dht, packet->to->registry);
+    Allocator_free(packet->alloc);
+}
+
+/** The last module in each registry, it carries the message to the node which it is for. */
+static int handleOutgoing(struct DHTMessage* dmessage, void* vnode)
+{
+    struct Simulator_Node* node = Identity_cast((struct Simulator_Node*) vnode);
+    struct Simulator* sim = node->sim;
+    node->bytes += dmessage->length;
+
+    uint64_t returnLabel;
+    uint32_t latency;
+    struct Simulator_Node* to = route(node, dmessage->address->path, &returnLabel, &latency);
+    if (!to) {
+        sim->result->packetsLost++;
+        return 0;
+    }
+
+    struct Allocator* alloc = Allocator_child(sim->alloc);
+    struct Simulator_Packet* packet = Allocator_calloc(alloc, sizeof(struct Simulator_Packet), 1);
+    packet->to = to;
+    packet->alloc = alloc;
+    Bits_memcpyConst(&packet->from, &node->addr, sizeof(struct Address));
+    packet->from.path = returnLabel;
+    packet->length = dmessage->length;
+    Bits_memcpy(packet->bytes, dmessage->bytes, dmessage->length);
+    Identity_set(packet);
+
+    Timeout_setTimeout(deliver, packet, latency, sim->base, alloc);
+    return 0;
+}
+
+static void genAddress(struct Address* addr, struct Random* rand)
+{
+    do {
+        Random_bytes(rand, addr->key, Address_KEY_SIZE);
+    } while (!AddressCalc_addressForPublicKey(addr->ip6.bytes, addr->key));
+    addr->path = 1;
+}
+
+static void startNode(struct Simulator* sim, struct Simulator_Node* node)
+{
+    struct Allocator* alloc = Allocator_child(sim->alloc);
+    struct Random* rand = Random_fork(sim->rand, alloc);
+    node->sim = sim;
+    Identity_set(node);
+
+    node->registry = DHTModuleRegistry_new(alloc);
+    ReplyModule_register(node->registry, alloc);
+    node->store = NodeStore_new(&node->addr, sim->conf->nodeStoreSize, alloc, NULL, rand);
+    node->router = RouterModule_register(node->registry,
+                                         alloc,
+                                         node->addr.key,
+                                         sim->base,
+                                         NULL,
+                                         rand,
+                                         node->store);
+    struct RouteTracer* tracer =
+        RouteTracer_new(node->store, node->router, node->addr.ip6.bytes, sim->base, NULL, alloc);
+    node->searchRunner =
+        SearchRunner_new(node->store, NULL, sim->base, node->router, node->addr.ip6.bytes, alloc);
+    Janitor_new(LOCAL_MAINTENANCE_SEARCH_MILLISECONDS,
+                GLOBAL_MAINTENANCE_SEARCH_MILLISECONDS,
+                node->router,
+                node->store,
+                node->searchRunner,
+                tracer,
+                NULL,
+                alloc,
+                sim->base,
+                rand);
+    EncodingSchemeModule_register(node->registry, node->store, NULL, sim->base, alloc);
+    SerializationModule_register(node->registry, NULL, alloc);
+
+    Bits_memcpyConst(&node->module, (&(struct DHTModule) {
+        .name = "Simulator",
+        .context = node,
+        .handleOutgoing = handleOutgoing
+    }), sizeof(struct DHTModule));
+    DHTModuleRegistry_register(&node->module, node->registry);
+}
+
+/** Tell each node about its peers as the InterfaceController would when the links come up. */
+static void addPeers(struct Simulator* sim, struct Simulator_Node* node)
+{
+    for (int i = 0; i < node->linkCount; i++) {
+        struct Address peer;
+        Bits_memcpyConst(&peer, &sim->nodes[node->links[i].peer].addr, sizeof(struct Address));
+        uint32_t number = linkNumber(i);
+        uint32_t bits = NumberCompress_bitsUsedForNumber(number);
+        peer.path = NumberCompress_getCompressed(number, bits) | (((uint64_t)1) << bits);
+        RouterModule_addNode(node->router, &peer, Version_CURRENT_PROTOCOL);
+    }
+}
+
+static void nextSearch(void* vsim);
+
+/** True when the source has a path to the target itself, not just to a node close to it. */
+static bool knowsTarget(struct Simulator_Search* search)
+{
+    struct Allocator* alloc = Allocator_child(search->sim->alloc);
+    struct NodeList* nodes =
+        NodeStore_getNodesByAddr(&search->target->addr, 1, alloc, search->source->store);
+    bool known = (nodes->size > 0);
+    Allocator_free(alloc);
+    return known;
+}
+
+static void searchOver(struct Simulator_Search* search)
+{
+    struct Simulator* sim = search->sim;
+    search->complete = 1;
+    Timeout_setTimeout(nextSearch, sim, SEARCH_SPACING_MILLISECONDS, sim->base, sim->searchAlloc);
+}
+
+static void found(struct Simulator_Search* search)
+{
+    struct Simulator_Result* result = search->sim->result;
+    result->found++;
+    Histogram_add(&result->hops, search->hops);
+    Histogram_add(&result->timeToRoute,
+                  Time_currentTimeMilliseconds(search->sim->base) - search->startTime);
+    searchOver(search);
+}
+
+static void searchCallback(struct RouterModule_Promise* promise,
+                           uint32_t lag,
+                           struct Node* fromNode,
+                           Dict* result)
+{
+    struct Simulator_Search* search = Identity_cast((struct Simulator_Search*) promise->userData);
+    if (search->complete) {
+        return;
+    }
+    if (fromNode) {
+        search->hops++;
+    }
+    if (knowsTarget(search)) {
+        found(search);
+    } else if (!fromNode) {
+        searchOver(search);
+    }
+}
+
+static void nextSearch(void* vsim)
+{
+    struct Simulator* sim = Identity_cast((struct Simulator*) vsim);
+    if (sim->searchAlloc) {
+        Allocator_free(sim->searchAlloc);
+    }
+    sim->searchAlloc = NULL;
+    if (sim->result->searches == sim->conf->searchCount) {
+        EventBase_endLoop(sim->base);
+        return;
+    }
+    sim->result->searches++;
+
+    uint32_t source = Random_uint32(sim->rand) % sim->nodeCount;
+    uint32_t target =
+        (source + 1 + Random_uint32(sim->rand) % (sim->nodeCount - 1)) % sim->nodeCount;
+    sim->searchAlloc = Allocator_child(sim->alloc);
+    struct Simulator_Search* search =
+        Allocator_clone(sim->searchAlloc, (&(struct Simulator_Search) {
+            .source = &sim->nodes[source],
+            .target = &sim->nodes[target],
+            .startTime = Time_currentTimeMilliseconds(sim->base),
+            .sim = sim
+        }));
+    Identity_set(search);
+
+    if (knowsTarget(search)) {
+        // Already known, the traffic would not have to wait at all.
+        found(search);
+        return;
+    }
+    struct RouterModule_Promise* promise =
+        SearchRunner_search(search->target->addr.ip6.bytes,
+                            SearchRunner_Priority_USER,
+                            search->source->searchRunner,
+                            sim->searchAlloc);
+    if (!promise) {
+        searchOver(search);
+        return;
+    }
+    promise->callback = searchCallback;
+    promise->userData = search;
+}
+
+static void setDefaults(struct Simulator_Config* conf)
+{
+    conf->nodeCount = (conf->nodeCount) ? conf->nodeCount : 1000;
+    conf->linksPerNode = (conf->linksPerNode) ? conf->linksPerNode : 3;
+    if (conf->linksPerNode > Simulator_MAX_LINKS / 2) {
+        conf->linksPerNode = Simulator_MAX_LINKS / 2;
+    }
+    if (!conf->minLatencyMilliseconds && !conf->maxLatencyMilliseconds) {
+        conf->minLatencyMilliseconds = 5;
+        conf->maxLatencyMilliseconds = 100;
+    }
+    if (conf->maxLatencyMilliseconds < conf->minLatencyMilliseconds) {
+        conf->maxLatencyMilliseconds = conf->minLatencyMilliseconds;
+    }
+    conf->nodeStoreSize = (conf->nodeStoreSize) ? conf->nodeStoreSize : 1024;
+    conf->warmupMilliseconds = (conf->warmupMilliseconds) ? conf->warmupMilliseconds : 60000;
+    conf->searchCount = (conf->searchCount) ? conf->searchCount : 200;
+}
+
+/** See: Simulator.h */
+struct Simulator_Result* Simulator_run(struct Simulator_Config* conf, struct Allocator* alloc)
+{
+    setDefaults(conf);
+    struct Simulator_Result* result = Allocator_calloc(alloc, sizeof(struct Simulator_Result), 1);
+    struct Allocator* simAlloc = Allocator_child(alloc);
+
+    struct Simulator* sim = Allocator_calloc(simAlloc, sizeof(struct Simulator), 1);
+    sim->base = EventBase_newVirtual(simAlloc);
+    sim->rand = Random_newWithSeed(simAlloc, NULL, DeterminentRandomSeed_new(simAlloc), NULL);
+    sim->alloc = simAlloc;
+    sim->conf = conf;
+    sim->result = result;
+    sim->nodeCount = (conf->nodeCount > 1) ? conf->nodeCount : 2;
+    sim->nodes = Allocator_calloc(simAlloc, sizeof(struct Simulator_Node), sim->nodeCount);
+    Identity_set(sim);
+
+    for (int i = 0; i < sim->nodeCount; i++) {
+        genAddress(&sim->nodes[i].addr, sim->rand);
+    }
+    buildTopology(sim);
+    for (int i = 0; i < sim->nodeCount; i++) {
+        startNode(sim, &sim->nodes[i]);
+    }
+    for (int i = 0; i < sim->nodeCount; i++) {
+        addPeers(sim, &sim->nodes[i]);
+    }
+
+    uint64_t startTime = Time_currentTimeMilliseconds(sim->base);
+    Timeout_setTimeout(nextSearch, sim, conf->warmupMilliseconds, sim->base, simAlloc);
+    EventBase_beginLoop(sim->base);
+    result->virtualMilliseconds = Time_currentTimeMilliseconds(sim->base) - startTime;
+
+    uint64_t totalBytes = 0;
+    uint64_t tableSizes = 0;
+    for (int i = 0; i < sim->nodeCount; i++) {
+        struct Simulator_Node* node = &sim->nodes[i];
+        totalBytes += node->bytes;
+        tableSizes += node->store->size;
+        if (node->bytes > result->maxBytesPerNode) {
+            result->maxBytesPerNode = node->bytes;
+        }
+    }
+    result->averageBytesPerNode = totalBytes / sim->nodeCount;
+    result->averageTableSize = tableSizes / sim->nodeCount;
+
+    Allocator_free(simAlloc);
+    return result;
+}
+
+/** See: Simulator.h */
+void Simulator_log(struct Simulator_Config* conf, struct Simulator_Result* result, struct Log* log)
+{
+    uint64_t seconds = result->virtualMilliseconds / 1000;
+    seconds = (seconds) ? seconds : 1;
+    Log_info(log, "Simulated [%d] nodes with [%d] links each in a %s for [%u] virtual seconds",
+             conf->nodeCount,
+             conf->linksPerNode,
+             (conf->topology == Simulator_Topology_RING) ? "ring" : "random graph",
+             (unsigned int) seconds);
+    Log_info(log, "Searches [%d] found [%d]", result->searches, result->found);
+    uint64_t hopsTenths = (result->hops.count) ? result->hops.total * 10 / result->hops.count : 0;
+    Log_info(log, "Search hops average [%u.%u] p50 [%u] p90 [%u] max [%u]",
+             (unsigned int) (hopsTenths / 10),
+             (unsigned int) (hopsTenths % 10),
+             (unsigned int) Histogram_percentile(&result->hops, 50),
+             (unsigned int) Histogram_percentile(&result->hops, 90),
+             (unsigned int) result->hops.max);
+    Log_info(log, "Time to route average [%u]ms p50 [%u]ms p90 [%u]ms p99 [%u]ms",
+             (unsigned int) Histogram_average(&result->timeToRoute),
+             (unsigned int) Histogram_percentile(&result->timeToRoute, 50),
+             (unsigned int) Histogram_percentile(&result->timeToRoute, 90),
+             (unsigned int) Histogram_percentile(&result->timeToRoute, 99));
+    Log_info(log, "DHT bytes per node average [%u] ([%u] per second) busiest [%u]",
+             (unsigned int) result->averageBytesPerNode,
+             (unsigned int) (result->averageBytesPerNode / seconds),
+             (unsigned int) result->maxBytesPerNode);
+    Log_info(log, "Routing table average size [%u] packets lost [%u]",
+             result->averageTableSize,
+             (unsigned int) result->packetsLost);
+}
@@ -0,0 +1,117 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef Simulator_H
+#define Simulator_H
+
+#include "memory/Allocator.h"
+#include "util/Histogram.h"
+#include "util/log/Log.h"
+#include "util/Linker.h"
+Linker_require("test/Simulator.c")
+
+#include <stdint.h>
+
+/**
+ * Simulates a whole network of DHT nodes in one process to see how the NodeStore, SearchRunner
+ * and Janitor behave with many more nodes than the tests can start.
+ * Each node has the DHT modules of a real core but no CryptoAuth or switch, packets are carried
+ * along their labels through the simulated topology, a switch hop at a time, and they arrive
+ * after the sum of the latencies of the links they went over. Everything runs on one virtual
+ * event base and the random numbers come from DeterminentRandomSeed so the same configuration
+ * always gives the same result.
+ *
+ * Once the Janitors have had some time to fill the routing tables, searches are made one after
+ * another from a random node for another random node.
+ */
+
+enum Simulator_Topology
+{
+    /** Node i is linked to the linksPerNode nodes after it, the end wraps around to the start. */
+    Simulator_Topology_RING,
+
+    /** Each node is linked to a random earlier node and linksPerNode - 1 more random nodes. */
+    Simulator_Topology_RANDOM
+};
+
+/** Any field which is left zero gets the default value. */
+struct Simulator_Config
+{
+    /** Default 1000. */
+    int nodeCount;
+
+    /** Default Simulator_Topology_RING. */
+    enum Simulator_Topology topology;
+
+    /** Default 3, no node can have more than Simulator_MAX_LINKS links. */
+    int linksPerNode;
+
+    /** The latency of each link is chosen at random between these, default 5 and 100. */
+    uint32_t minLatencyMilliseconds;
+    uint32_t maxLatencyMilliseconds;
+
+    /** The number of nodes each NodeStore can hold, default 1024. */
+    uint32_t nodeStoreSize;
+
+    /** Virtual time for the Janitors to work before the searches start, default 60 seconds. */
+    uint64_t warmupMilliseconds;
+
+    /** Default 200. */
+    int searchCount;
+};
+
+#define Simulator_MAX_LINKS 64
+
+struct Simulator_Result
+{
+    int searches;
+
+    /** The number of searches which found the node they were looking for. */
+    int found;
+
+    /** Nodes which answered a search before it found its target, for searches which did. */
+    struct Histogram hops;
+
+    /** Virtual milliseconds from starting a search until the target is in the routing table. */
+    struct Histogram timeToRoute;
+
+    /** The average number of DHT bytes sent plus received by a node over the whole run. */
+    uint64_t averageBytesPerNode;
+
+    /** The DHT bytes sent plus received by the node which had the most traffic. */
+    uint64_t maxBytesPerNode;
+
+    /** Packets which could not be delivered because their label led nowhere. */
+    uint64_t packetsLost;
+
+    /** The average number of nodes in a NodeStore at the end of the run. */
+    uint32_t averageTableSize;
+
+    /** The virtual time which the run took, the warmup and all of the searches. */
+    uint64_t virtualMilliseconds;
+};
+
+/**
+ * Build the network, run it and collect the results.
+ *
+ * @param conf the network to simulate, it is updated with the defaults of any fields left zero.
+ * @param alloc the allocator for the result, all of the nodes are freed before this returns.
+ * @return the result of the run.
+ */
+struct Simulator_Result* Simulator_run(struct Simulator_Config* conf, struct Allocator* alloc);
+
+/** Write a report of a run to the log. */
+void Simulator_log(struct Simulator_Config* conf, struct Simulator_Result* result, struct Log* log);
+
+#endif
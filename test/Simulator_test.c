@@ -0,0 +1,57 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "io/FileWriter.h"
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "test/Simulator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/log/WriterLog.h"
+
+#include <stdio.h>
+
+static struct Simulator_Result* run(enum Simulator_Topology topology, struct Allocator* alloc)
+{
+    struct Simulator_Config conf = {
+        .nodeCount = 64,
+        .topology = topology,
+        .linksPerNode = 3,
+        .warmupMilliseconds = 20000,
+        .searchCount = 20
+    };
+    struct Simulator_Result* result = Simulator_run(&conf, alloc);
+    struct Log* logger = WriterLog_new(FileWriter_new(stdout, alloc), alloc);
+    Simulator_log(&conf, result, logger);
+    return result;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<26);
+
+    struct Simulator_Result* ring = run(Simulator_Topology_RING, alloc);
+    Assert_always(ring->searches == 20);
+    Assert_always(ring->found > 0);
+    Assert_always(ring->averageBytesPerNode > 0);
+
+    // Virtual time and the determinent random seed make every run come out the same.
+    struct Simulator_Result* random = run(Simulator_Topology_RANDOM, alloc);
+    struct Simulator_Result* again = run(Simulator_Topology_RANDOM, alloc);
+    Assert_always(random->found > random->searches / 2);
+    Assert_always(!Bits_memcmp(random, again, sizeof(struct Simulator_Result)));
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -77,14 +77,27 @@ static uint8_t sendTo(struct Message* msg, struct Interface* iface)
 struct TestFramework* TestFramework_setUp(char* privateKey,
                                           struct Allocator* allocator,
                                           struct Log* logger)
+{
+    return TestFramework_setUpOn(privateKey, NULL, NULL, allocator, logger);
+}
+
+struct TestFramework* TestFramework_setUpOn(char* privateKey,
+                                            struct EventBase* base,
+                                            struct Random* rand,
+                                            struct Allocator* allocator,
+                                            struct Log* logger)
 {
     if (!logger) {
         struct Writer* logwriter = FileWriter_new(stdout, allocator);
         logger = WriterLog_new(logwriter, allocator);
     }
 
-    struct Random* rand = Random_new(allocator, logger, NULL);
-    struct EventBase* base = EventBase_new(allocator);
+    if (!rand) {
+        rand = Random_new(allocator, logger, NULL);
+    }
+    if (!base) {
+        base = EventBase_new(allocator);
+    }
 
     uint64_t pks[4];
     if (!privateKey) {
@@ -99,7 +112,7 @@ struct TestFramework* TestFramework_setUp(char* privateKey,
     Bits_memcpyConst(myAddress->key, publicKey, 32);
     AddressCalc_addressForPublicKey(myAddress->ip6.bytes, publicKey);
 
-    struct SwitchCore* switchCore = SwitchCore_new(logger, allocator);
+    struct SwitchCore* switchCore = SwitchCore_new(logger, base, allocator);
     struct CryptoAuth* ca = CryptoAuth_new(allocator, (uint8_t*)privateKey, base, logger, rand);
 
     struct DHTModuleRegistry* registry = DHTModuleRegistry_new(allocator);
@@ -133,6 +146,7 @@ struct TestFramework* TestFramework_setUp(char* privateKey,
                                        sp,
                                        rand,
                                        allocator);
+    Ducttape_setInterfaceController(dt, ifController);
 
     struct TestFramework* tf = Allocator_clone(allocator, (&(struct TestFramework) {
         .alloc = allocator,
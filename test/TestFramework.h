@@ -54,6 +54,16 @@ struct TestFramework* TestFramework_setUp(char* privateKey,
                                           struct Allocator* allocator,
                                           struct Log* logger);
 
+/**
+ * Set up a node which runs on an event base that it shares with other nodes, such as a virtual
+ * one, and takes its random numbers from the given generator so a run can be repeated.
+ */
+struct TestFramework* TestFramework_setUpOn(char* privateKey,
+                                            struct EventBase* base,
+                                            struct Random* rand,
+                                            struct Allocator* allocator,
+                                            struct Log* logger);
+
 void TestFramework_linkNodes(struct TestFramework* client, struct TestFramework* server);
 
 void TestFramework_craftIPHeader(struct Message* msg, uint8_t srcAddr[16], uint8_t destAddr[16]);
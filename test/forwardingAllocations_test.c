@@ -0,0 +1,193 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crypto/CryptoAuth.h"
+#include "interface/Interface.h"
+#include "interface/InterfaceController.h"
+#include "interface/tuntap/TUNMessageType.h"
+#include "memory/Allocator.h"
+#include "memory/PoolAllocator.h"
+#include "net/Ducttape.h"
+#include "test/TestFramework.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+#include "util/log/IndirectLog.h"
+#include "wire/Ethernet.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+#include <stdio.h>
+
+/** The keys from threeNodes_test, B's address is between A and C so A finds C by asking B. */
+static char* const KEYS[] = {
+    "\xad\x7e\xa3\x26\xaa\x01\x94\x0a\x25\xbc\x9e\x01\x26\x22\xdb\x69"
+    "\x4f\xd9\xb4\x17\x7c\xf3\xf8\x91\x16\xf3\xcf\xe8\x5c\x80\xe1\x4a",
+    "\xea\x8d\x34\x04\xa9\x7c\xe4\xf9\xca\x7e\x24\xe6\xf1\x85\xb9\x3f"
+    "\x01\x37\xb7\xa1\xf5\x2c\xce\xc0\x2c\xae\x03\xf1\x83\x38\x13\x24",
+    "\xd8\x54\x3e\x70\xb9\xae\x7c\x41\xbc\x18\xa4\x9a\x9c\xee\xca\x9c"
+    "\xdc\x45\x01\x96\x6b\xbd\x7e\x76\xcf\x3a\x9f\xbc\x12\xed\x8b\xb4"
+};
+
+#define NODES 3
+
+/** Sizes of the IPv6 packets which are sent, every size is sent while warming up. */
+#define MIN_SIZE 64
+#define SIZES 1217
+
+/** Packets counted in each direction, enough that a pool which grows would need a new slab. */
+#define PACKETS 2000
+
+struct Link
+{
+    struct Interface ifA;
+    struct Interface ifB;
+    struct Context* ctx;
+    Identity
+};
+
+struct Context
+{
+    struct TestFramework* nodes[NODES];
+    struct Interface tunIfs[NODES];
+
+    /** Each packet and the copies of it which cross the links are allocated here. */
+    struct Allocator* packetAlloc;
+
+    int delivered;
+
+    struct Allocator* alloc;
+    Identity
+};
+
+/** Copy the message to the other end like the kernel would copy a UDP packet. */
+static uint8_t sendOverLink(struct Message* msg, struct Interface* iface)
+{
+    struct Link* link = Identity_cast((struct Link*) iface->senderContext);
+    struct Interface* dest = (iface == &link->ifA) ? &link->ifB : &link->ifA;
+    return Interface_receiveMessage(dest, Message_clone(msg, link->ctx->packetAlloc));
+}
+
+static uint8_t receivedOnTun(struct Message* msg, struct Interface* iface)
+{
+    struct Context* ctx = Identity_cast((struct Context*) iface->senderContext);
+    ctx->delivered++;
+    return 0;
+}
+
+static void linkNodes(struct Context* ctx,
+                      struct TestFramework* client,
+                      struct TestFramework* server)
+{
+    struct Link* link = Allocator_clone(ctx->alloc, (&(struct Link) {
+        .ctx = ctx
+    }));
+    Bits_memcpyConst(&link->ifA, (&(struct Interface) {
+        .sendMessage = sendOverLink,
+        .senderContext = link,
+        .allocator = ctx->alloc
+    }), sizeof(struct Interface));
+    Bits_memcpyConst(&link->ifB, &link->ifA, sizeof(struct Interface));
+    Identity_set(link);
+
+    String* password = String_CONST("allocations");
+    InterfaceController_registerPeer(server->ifController, NULL, NULL, true, false, &link->ifB);
+    CryptoAuth_addUser(password, 1, String_CONST("test"), server->cryptoAuth);
+    InterfaceController_registerPeer(client->ifController,
+                                     server->publicKey,
+                                     password,
+                                     false,
+                                     false,
+                                     &link->ifA);
+}
+
+static void sendPacket(struct Context* ctx, int size, bool forward)
+{
+    int from = (forward) ? 0 : NODES - 1;
+    int to = (forward) ? NODES - 1 : 0;
+
+    ctx->packetAlloc = Allocator_child(ctx->alloc);
+    struct Message* msg = Message_new(size - Headers_IP6Header_SIZE, 512, ctx->packetAlloc);
+    Bits_memset(msg->bytes, 0, msg->length);
+    TestFramework_craftIPHeader(msg, ctx->nodes[from]->ip, ctx->nodes[to]->ip);
+    TUNMessageType_push(msg, Ethernet_TYPE_IP6, NULL);
+
+    Interface_receiveMessage(&ctx->tunIfs[from], msg);
+
+    Allocator_free(ctx->packetAlloc);
+    ctx->packetAlloc = ctx->alloc;
+}
+
+/**
+ * Once the sessions are up, sending packets from the TUN of one node through the switch and
+ * both layers of CryptoAuth of the node in the middle to the TUN of the last must neither
+ * malloc() nor keep memory, the pool serves everything from the blocks which the previous
+ * packet released.
+ */
+int main()
+{
+    struct Allocator* alloc = PoolAllocator_new(1<<28);
+
+    // Logging every packet would allocate.
+    struct Log* silent = IndirectLog_new(alloc);
+
+    struct Context* ctx = Allocator_calloc(alloc, sizeof(struct Context), 1);
+    ctx->alloc = alloc;
+    ctx->packetAlloc = alloc;
+    Identity_set(ctx);
+
+    for (int i = 0; i < NODES; i++) {
+        ctx->nodes[i] = TestFramework_setUp(KEYS[i], alloc, silent);
+        Bits_memcpyConst(&ctx->tunIfs[i], (&(struct Interface) {
+            .sendMessage = receivedOnTun,
+            .senderContext = ctx,
+            .allocator = alloc
+        }), sizeof(struct Interface));
+        Ducttape_setUserInterface(ctx->nodes[i]->ducttape, &ctx->tunIfs[i]);
+    }
+    for (int i = 1; i < NODES; i++) {
+        linkNodes(ctx, ctx->nodes[i], ctx->nodes[i - 1]);
+    }
+
+    // Set up the sessions and routes and let the pool cut a slab for every size of block.
+    for (int i = 0; i < SIZES; i++) {
+        sendPacket(ctx, MIN_SIZE + i, true);
+        sendPacket(ctx, MIN_SIZE + i, false);
+    }
+    Assert_always(ctx->delivered > 0);
+
+    struct PoolAllocator_Stats before;
+    PoolAllocator_getStats(alloc, &before);
+    ctx->delivered = 0;
+
+    for (int i = 0; i < PACKETS; i++) {
+        sendPacket(ctx, MIN_SIZE + (i % SIZES), true);
+        sendPacket(ctx, MIN_SIZE + (i % SIZES), false);
+    }
+
+    struct PoolAllocator_Stats after;
+    PoolAllocator_getStats(alloc, &after);
+
+    printf("%d of %d packets delivered, [%d] calls to malloc(), [%d] allocations kept\n",
+           ctx->delivered, PACKETS * 2,
+           (int) (after.systemAllocations - before.systemAllocations),
+           (int) (after.outstanding - before.outstanding));
+
+    Assert_always(ctx->delivered == PACKETS * 2);
+    Assert_always(after.systemAllocations == before.systemAllocations);
+    Assert_always(after.outstanding == before.outstanding);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -45,6 +45,12 @@ static uint8_t incomingTunC(struct Message* msg, struct Interface* iface)
 static uint8_t incomingTunB(struct Message* msg, struct Interface* iface)
 {
     Assert_always(TUNMessageType_pop(msg, NULL) == Ethernet_TYPE_IP6);
+    // Packets from A come with a compressed header which B must rebuild.
+    struct Headers_IP6Header* ip6 = (struct Headers_IP6Header*) msg->bytes;
+    Assert_always(Headers_getIpVersion(msg->bytes) == 6 && ip6->nextHeader == 123);
+    Assert_always(Endian_bigEndianToHost16(ip6->payloadLength_be)
+        == msg->length - Headers_IP6Header_SIZE);
+    Assert_always(ip6->sourceAddr[0] == 0xfc && ip6->destinationAddr[0] == 0xfc);
     Message_shift(msg, -Headers_IP6Header_SIZE, NULL);
     printf("Message from TUN in node B [%s]\n", msg->bytes);
     *((int*)iface->senderContext) = TUNB;
@@ -208,6 +214,8 @@ int main()
     sendMessage(tn, "cryptoauth", tn->nodeA, tn->nodeC);
     sendMessage(tn, "can", tn->nodeC, tn->nodeA);
     sendMessage(tn, "establish", tn->nodeA, tn->nodeC);
+    sendMessage(tn, "neighbors", tn->nodeA, tn->nodeB);
+    sendMessage(tn, "again", tn->nodeA, tn->nodeB);
 
     Allocator_free(alloc);
     return 0;
@@ -26,6 +26,8 @@
 #include "interface/tuntap/TUNMessageType.h"
 #include "memory/Allocator.h"
 #include "tunnel/IpTunnel.h"
+#include "tunnel/NatTable.h"
+#include "tunnel/RouteTable.h"
 #include "crypto/AddressCalc.h"
 #include "util/platform/libc/strlen.h"
 #include "util/Checksum.h"
@@ -39,6 +41,19 @@
 
 #include <stddef.h>
 
+/** A prefix which is routed to a client, see IpTunnel_addRoute(). */
+struct IpTunnel_Route
+{
+    uint8_t prefix[16];
+    uint8_t prefixLength;
+
+    /** 16 for IPv6 or 4 for IPv4. */
+    uint8_t addressLength;
+
+    /** The index of the connection in connectionList, incoming connections never move up. */
+    uint32_t connection;
+};
+
 struct IpTunnel_pvt
 {
     struct IpTunnel pub;
@@ -48,17 +63,34 @@ struct IpTunnel_pvt
 
     uint32_t connectionCapacity;
 
+    /**
+     * Open addressed hash tables of (index in connectionList + 1) keyed on the node's key and on
+     * the issued addresses and direction of the connection, zero is an empty slot.
+     * Always twice the size of connectionCapacity, they are rebuilt whenever a connection is
+     * added, removed or issued an address because that can move the other connections.
+     */
+    uint32_t* keyIndex;
+    uint32_t* ip6Index;
+    uint32_t* ip4Index;
+
+    /** The routed prefixes and longest prefix match tables of (index in connectionList + 1). */
+    struct IpTunnel_Route* routes;
+    uint32_t routeCount;
+    struct RouteTable* ip6Routes;
+    struct RouteTable* ip4Routes;
+
+    /** If not NULL then packets from clients are translated to the NAT's public address. */
+    struct NatTable* nat6;
+    struct NatTable* nat4;
+
+    struct EventBase* eventBase;
+
     /** An always incrementing number which represents the connections. */
     uint32_t nextConnectionNumber;
 
     /** The name of the TUN interface so that ip addresses can be added. */
     String* ifName;
 
-    /**
-     * Every 10 seconds check for connections which the other end has
-     * not provided ip addresses and send more requests.
-     */
-    struct Timeout* timeout;
     struct Random* rand;
 
     /** The angel connector for setting IP addresses. */
@@ -68,13 +100,110 @@ struct IpTunnel_pvt
     Identity
 };
 
+/** The issued addresses are often sequential so all of the bytes go into the hash. */
+static inline uint32_t hashCode(const uint8_t* bytes, uint32_t length, bool isOutgoing)
+{
+    uint32_t hash = 0x811c9dc5 ^ isOutgoing;
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x01000193;
+    }
+    return hash ^ (hash >> 16);
+}
+
+static inline uint32_t indexMask(struct IpTunnel_pvt* context)
+{
+    return context->connectionCapacity * 2 - 1;
+}
+
+static void indexConnection(uint32_t* table, uint32_t hash, uint32_t i, uint32_t mask)
+{
+    uint32_t slot = hash & mask;
+    while (table[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    table[slot] = i + 1;
+}
+
+static void reindex(struct IpTunnel_pvt* context)
+{
+    uint32_t mask = indexMask(context);
+    uint32_t size = (mask + 1) * sizeof(uint32_t);
+    Bits_memset(context->keyIndex, 0, size);
+    Bits_memset(context->ip6Index, 0, size);
+    Bits_memset(context->ip4Index, 0, size);
+    for (uint32_t i = 0; i < context->pub.connectionList.count; i++) {
+        struct IpTunnel_Connection* conn = &context->pub.connectionList.connections[i];
+        indexConnection(context->keyIndex, hashCode(conn->header.nodeKey, 32, 0), i, mask);
+        if (!Bits_isZero(conn->connectionIp6, 16)) {
+            uint32_t hash = hashCode(conn->connectionIp6, 16, conn->isOutgoing);
+            indexConnection(context->ip6Index, hash, i, mask);
+        }
+        if (!Bits_isZero(conn->connectionIp4, 4)) {
+            uint32_t hash = hashCode(conn->connectionIp4, 4, conn->isOutgoing);
+            indexConnection(context->ip4Index, hash, i, mask);
+        }
+    }
+}
+
+/**
+ * Find a connection by the address which was issued with it.
+ * If more than one have the same address then the one which is first on the list is returned.
+ *
+ * @param nodeKey if not NULL then only connections with this node are considered.
+ */
+static struct IpTunnel_Connection* connectionByAddress(const uint8_t* address,
+                                                       uint32_t length,
+                                                       bool isOutgoing,
+                                                       const uint8_t* nodeKey,
+                                                       struct IpTunnel_pvt* context)
+{
+    if (!context->connectionCapacity) {
+        return NULL;
+    }
+    uint32_t* table = (length == 16) ? context->ip6Index : context->ip4Index;
+    uint32_t mask = indexMask(context);
+    struct IpTunnel_Connection* out = NULL;
+    for (uint32_t slot = hashCode(address, length, isOutgoing) & mask;
+         table[slot];
+         slot = (slot + 1) & mask)
+    {
+        struct IpTunnel_Connection* conn =
+            &context->pub.connectionList.connections[table[slot] - 1];
+        uint8_t* connectionAddr = (length == 16) ? conn->connectionIp6 : conn->connectionIp4;
+        if (conn->isOutgoing == isOutgoing
+            && !Bits_memcmp(address, connectionAddr, length)
+            && (!nodeKey || !Bits_memcmp(nodeKey, conn->header.nodeKey, 32))
+            && (!out || conn < out))
+        {
+            out = conn;
+        }
+    }
+    return out;
+}
+
+/** Find the connection with the longest routed prefix which contains an address. */
+static struct IpTunnel_Connection* connectionByRoute(const uint8_t* address,
+                                                     uint32_t length,
+                                                     struct IpTunnel_pvt* context)
+{
+    uint32_t i = RouteTable_get(address, (length == 16) ? context->ip6Routes : context->ip4Routes);
+    return (i) ? &context->pub.connectionList.connections[i - 1] : NULL;
+}
+
 static struct IpTunnel_Connection* newConnection(bool isOutgoing, struct IpTunnel_pvt* context)
 {
     if (context->pub.connectionList.count == context->connectionCapacity) {
-        uint32_t newSize = (context->connectionCapacity + 4) * sizeof(struct IpTunnel_Connection);
+        // Kept at a power of 2 so that the indexes can be masked.
+        uint32_t capacity = (context->connectionCapacity) ? context->connectionCapacity * 2 : 4;
         context->pub.connectionList.connections =
-            Allocator_realloc(context->allocator, context->pub.connectionList.connections, newSize);
-        context->connectionCapacity += 4;
+            Allocator_realloc(context->allocator,
+                              context->pub.connectionList.connections,
+                              capacity * sizeof(struct IpTunnel_Connection));
+        uint32_t indexSize = capacity * 2 * sizeof(uint32_t);
+        context->keyIndex = Allocator_realloc(context->allocator, context->keyIndex, indexSize);
+        context->ip6Index = Allocator_realloc(context->allocator, context->ip6Index, indexSize);
+        context->ip4Index = Allocator_realloc(context->allocator, context->ip4Index, indexSize);
+        context->connectionCapacity = capacity;
     }
     struct IpTunnel_Connection* conn =
         &context->pub.connectionList.connections[context->pub.connectionList.count];
@@ -108,12 +237,22 @@ static struct IpTunnel_Connection* newConnection(bool isOutgoing, struct IpTunne
 static struct IpTunnel_Connection* connectionByPubKey(uint8_t pubKey[32],
                                                       struct IpTunnel_pvt* context)
 {
-    for (int i = 0; i < (int)context->pub.connectionList.count; i++) {
-        if (!Bits_memcmp(pubKey, context->pub.connectionList.connections[i].header.nodeKey, 32)) {
-            return &context->pub.connectionList.connections[i];
+    if (!context->connectionCapacity) {
+        return NULL;
+    }
+    uint32_t mask = indexMask(context);
+    struct IpTunnel_Connection* out = NULL;
+    for (uint32_t slot = hashCode(pubKey, 32, 0) & mask;
+         context->keyIndex[slot];
+         slot = (slot + 1) & mask)
+    {
+        struct IpTunnel_Connection* conn =
+            &context->pub.connectionList.connections[context->keyIndex[slot] - 1];
+        if (!Bits_memcmp(pubKey, conn->header.nodeKey, 32) && (!out || conn < out)) {
+            out = conn;
         }
     }
-    return NULL;
+    return out;
 }
 
 /**
@@ -150,6 +289,7 @@ int IpTunnel_allowConnection(uint8_t publicKeyOfAuthorizedNode[32],
     if (ip6Address) {
         Bits_memcpyConst(conn->connectionIp6, ip6Address, 16);
     }
+    reindex(context);
     return conn->number;
 }
 
@@ -234,6 +374,69 @@ static uint8_t requestAddresses(struct IpTunnel_Connection* conn,
     return ret;
 }
 
+/**
+ * Until an outgoing connection has been given addresses, the request is sent again after
+ * RETRY_MIN_MILLISECONDS, doubling each time up to RETRY_MAX_MILLISECONDS.
+ * Each connection has its own timer so the connections which don't need it cost nothing.
+ */
+#define RETRY_MIN_MILLISECONDS 10000
+#define RETRY_MAX_MILLISECONDS (10 * 60 * 1000)
+struct IpTunnel_Retry
+{
+    /** The connection is found by key and number since its place in the list can change. */
+    uint8_t nodeKey[32];
+    int number;
+
+    uint32_t backoffMilliseconds;
+
+    struct Timeout* timer;
+
+    /** Freed once the connection is gone or has addresses. */
+    struct Allocator* alloc;
+
+    struct IpTunnel_pvt* context;
+
+    Identity
+};
+
+static struct IpTunnel_Connection* connectionByNumber(uint8_t nodeKey[32],
+                                                      int number,
+                                                      struct IpTunnel_pvt* context)
+{
+    if (!context->connectionCapacity) {
+        return NULL;
+    }
+    uint32_t mask = indexMask(context);
+    for (uint32_t slot = hashCode(nodeKey, 32, 0) & mask;
+         context->keyIndex[slot];
+         slot = (slot + 1) & mask)
+    {
+        struct IpTunnel_Connection* conn =
+            &context->pub.connectionList.connections[context->keyIndex[slot] - 1];
+        if (conn->number == number) {
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+static void retryAddresses(void* vretry)
+{
+    struct IpTunnel_Retry* retry = Identity_cast((struct IpTunnel_Retry*) vretry);
+    struct IpTunnel_Connection* conn =
+        connectionByNumber(retry->nodeKey, retry->number, retry->context);
+    if (!conn || !Bits_isZero(conn->connectionIp6, 16) || !Bits_isZero(conn->connectionIp4, 4)) {
+        Allocator_free(retry->alloc);
+        return;
+    }
+    requestAddresses(conn, retry->context);
+    retry->backoffMilliseconds *= 2;
+    if (retry->backoffMilliseconds > RETRY_MAX_MILLISECONDS) {
+        retry->backoffMilliseconds = RETRY_MAX_MILLISECONDS;
+    }
+    Timeout_resetTimeout(retry->timer, retry->backoffMilliseconds);
+}
+
 /**
  * Connect to another node and get IPv4 and/or IPv6 addresses from it.
  *
@@ -248,6 +451,7 @@ int IpTunnel_connectTo(uint8_t publicKeyOfNodeToConnectTo[32], struct IpTunnel*
     struct IpTunnel_Connection* conn = newConnection(true, context);
     Bits_memcpyConst(conn->header.nodeKey, publicKeyOfNodeToConnectTo, 32);
     AddressCalc_addressForPublicKey(conn->header.nodeIp6Addr, publicKeyOfNodeToConnectTo);
+    reindex(context);
 
     #ifdef Log_DEBUG
         uint8_t addr[40];
@@ -257,9 +461,88 @@ int IpTunnel_connectTo(uint8_t publicKeyOfNodeToConnectTo[32], struct IpTunnel*
 
     requestAddresses(conn, context);
 
+    struct Allocator* alloc = Allocator_child(context->allocator);
+    struct IpTunnel_Retry* retry = Allocator_clone(alloc, (&(struct IpTunnel_Retry) {
+        .number = conn->number,
+        .backoffMilliseconds = RETRY_MIN_MILLISECONDS,
+        .alloc = alloc,
+        .context = context
+    }));
+    Bits_memcpyConst(retry->nodeKey, conn->header.nodeKey, 32);
+    Identity_set(retry);
+    retry->timer = Timeout_setTimeout(retryAddresses, retry, retry->backoffMilliseconds,
+                                      context->eventBase, alloc);
+
     return conn->number;
 }
 
+/** See: IpTunnel.h */
+int IpTunnel_addRoute(int connectionNumber,
+                      struct Sockaddr* prefix,
+                      uint8_t prefixLength,
+                      struct IpTunnel* tunnel)
+{
+    struct IpTunnel_pvt* context = Identity_cast((struct IpTunnel_pvt*)tunnel);
+
+    uint8_t* address = NULL;
+    int length = Sockaddr_getAddress(prefix, &address);
+    if ((length != 16 && length != 4) || prefixLength > length * 8) {
+        return IpTunnel_addRoute_INVALID;
+    }
+
+    for (uint32_t i = 0; i < context->pub.connectionList.count; i++) {
+        struct IpTunnel_Connection* conn = &context->pub.connectionList.connections[i];
+        if (conn->number != connectionNumber) {
+            continue;
+        }
+        if (conn->isOutgoing) {
+            return IpTunnel_addRoute_INVALID;
+        }
+        context->routes = Allocator_realloc(context->allocator,
+                                            context->routes,
+                                            (context->routeCount + 1)
+                                                * sizeof(struct IpTunnel_Route));
+        struct IpTunnel_Route* route = &context->routes[context->routeCount++];
+        Bits_memset(route, 0, sizeof(struct IpTunnel_Route));
+        Bits_memcpy(route->prefix, address, length);
+        route->prefixLength = prefixLength;
+        route->addressLength = length;
+        route->connection = i;
+        RouteTable_put(route->prefix,
+                       prefixLength,
+                       i + 1,
+                       (length == 16) ? context->ip6Routes : context->ip4Routes);
+        return 0;
+    }
+    return IpTunnel_addRoute_NOT_FOUND;
+}
+
+/**
+ * Drop the routes to a connection which was removed from the list, the connections after it
+ * have moved down by one so the tables are rebuilt.
+ */
+static void removeRoutes(uint32_t removed, struct IpTunnel_pvt* context)
+{
+    RouteTable_clear(context->ip6Routes);
+    RouteTable_clear(context->ip4Routes);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < context->routeCount; i++) {
+        struct IpTunnel_Route* route = &context->routes[i];
+        if (route->connection == removed) {
+            continue;
+        }
+        if (route->connection > removed) {
+            route->connection--;
+        }
+        RouteTable_put(route->prefix,
+                       route->prefixLength,
+                       route->connection + 1,
+                       (route->addressLength == 16) ? context->ip6Routes : context->ip4Routes);
+        Bits_memcpyConst(&context->routes[count++], route, sizeof(struct IpTunnel_Route));
+    }
+    context->routeCount = count;
+}
+
 /**
  * Disconnect from a node or remove authorization to connect.
  *
@@ -268,9 +551,23 @@ int IpTunnel_connectTo(uint8_t publicKeyOfNodeToConnectTo[32], struct IpTunnel*
  */
 int IpTunnel_removeConnection(int connectionNumber, struct IpTunnel* tunnel)
 {
-    //struct IpTunnel_pvt* context = Identity_cast((struct IpTunnel_pvt*)tunnel);
+    struct IpTunnel_pvt* context = Identity_cast((struct IpTunnel_pvt*)tunnel);
 
-    return 0;
+    struct IpTunnel_Connection* conns = context->pub.connectionList.connections;
+    uint32_t count = context->pub.connectionList.count;
+    for (uint32_t i = 0; i < count; i++) {
+        if (conns[i].number == connectionNumber) {
+            // Shift the rest down, the incoming connections must stay before the outgoing ones.
+            Bits_memmove(&conns[i],
+                         &conns[i + 1],
+                         (count - i - 1) * sizeof(struct IpTunnel_Connection));
+            context->pub.connectionList.count--;
+            reindex(context);
+            removeRoutes(i, context);
+            return 0;
+        }
+    }
+    return IpTunnel_removeConnection_NOT_FOUND;
 }
 
 static uint8_t isControlMessageInvalid(struct Message* message, struct IpTunnel_pvt* context)
@@ -466,6 +763,7 @@ static int incomingAddresses(Dict* d,
 
         addAddress(printedAddr, context);
     }
+    reindex(context);
     return 0;
 }
 
@@ -545,30 +843,68 @@ static struct IpTunnel_Connection* getConnection(struct IpTunnel_Connection* con
         }
     }
 
-    struct IpTunnel_Connection* lastConnection =
-        &context->pub.connectionList.connections[context->pub.connectionList.count];
+    // If this is an incoming message from the w0rld, and we're the client, we want
+    // to make sure it's addressed to us (destination), if we're the server we want to make
+    // sure our clients are using the addresses we gave them (source).
+    //
+    // If this is an outgoing message from the TUN, we just want to find a sutable server to
+    // handle it, a client which we gave the destination address to is preferred over a server
+    // which gave us the source address because incoming connections are first on the list.
+    // An issued address is more specific than any routed prefix so it is checked first.
+    if (isFromTun) {
+        struct IpTunnel_Connection* incoming =
+            connectionByAddress(destination, length, false, NULL, context);
+        if (!incoming) {
+            incoming = connectionByRoute(destination, length, context);
+        }
+        return (incoming) ? incoming : connectionByAddress(source, length, true, NULL, context);
+    }
 
-    do {
-        // If this is an incoming message from the w0rld, and we're the client, we want
-        // to make sure it's addressed to us (destination), if we're the server we want to make
-        // sure our clients are using the addresses we gave them (source).
-        //
-        // If this is an outgoing message from the TUN, we just want to find a sutable server to
-        // handle it. The behavior of this function relies on the fact that all incoming
-        // connections are first on the list.
-        //
-        uint8_t* compareAddr = (isFromTun)
-            ? ((conn->isOutgoing) ? source : destination)
-            : ((conn->isOutgoing) ? destination : source);
-
-        uint8_t* connectionAddr = (sourceAndDestIp6) ? conn->connectionIp6 : conn->connectionIp4;
-        if (!Bits_memcmp(compareAddr, connectionAddr, length)) {
-            return conn;
+    uint8_t* compareAddr = (conn->isOutgoing) ? destination : source;
+    struct IpTunnel_Connection* out = connectionByAddress(compareAddr,
+                                                          length,
+                                                          conn->isOutgoing,
+                                                          conn->header.nodeKey,
+                                                          context);
+    if (!out && !conn->isOutgoing) {
+        // A client may also send from within a prefix which is routed to it.
+        out = connectionByRoute(source, length, context);
+        if (out && Bits_memcmp(out->header.nodeKey, conn->header.nodeKey, 32)) {
+            out = NULL;
         }
-        conn++;
-    } while (conn <= lastConnection);
+    }
+    return out;
+}
 
-    return NULL;
+/**
+ * Translate a packet from the TUN which is addressed to the public address of the NAT back to
+ * the client whose flow it answers.
+ *
+ * @return 0 if the packet is not for the NAT or was translated, Error_INVALID if it is for the
+ *         NAT but not part of any flow.
+ */
+static uint8_t natIncoming(struct Message* message, struct IpTunnel_pvt* context)
+{
+    struct NatTable* nat = NULL;
+    uint8_t* destination = NULL;
+    if (message->length > 40 && Headers_getIpVersion(message->bytes) == 6 && context->nat6) {
+        nat = context->nat6;
+        destination = ((struct Headers_IP6Header*) message->bytes)->destinationAddr;
+    } else if (message->length > 20
+        && Headers_getIpVersion(message->bytes) == 4
+        && context->nat4)
+    {
+        nat = context->nat4;
+        destination = ((struct Headers_IP4Header*) message->bytes)->destAddr;
+    }
+    if (!nat || Bits_memcmp(destination, nat->publicAddr, nat->addressLength)) {
+        return 0;
+    }
+    if (NatTable_incoming(message, nat)) {
+        Log_debug(context->logger, "Dropping message to NAT address which is not part of a flow");
+        return Error_INVALID;
+    }
+    return 0;
 }
 
 static uint8_t incomingFromTun(struct Message* message, struct Interface* tunIf)
@@ -579,6 +915,10 @@ static uint8_t incomingFromTun(struct Message* message, struct Interface* tunIf)
         Log_debug(context->logger, "Dropping runt.");
     }
 
+    if (natIncoming(message, context)) {
+        return Error_INVALID;
+    }
+
     struct IpTunnel_Connection* conn = NULL;
     if (!context->pub.connectionList.connections) {
         // No connections authorized, fall through to "unrecognized address"
@@ -625,6 +965,10 @@ static uint8_t ip6FromNode(struct Message* message,
         Log_debug(context->logger, "Got message with wrong address for connection");
         return Error_INVALID;
     }
+    if (!conn->isOutgoing && context->nat6 && NatTable_outgoing(message, context->nat6)) {
+        Log_debug(context->logger, "Dropping message which can't go through the NAT");
+        return Error_INVALID;
+    }
 
     TUNMessageType_push(message, Ethernet_TYPE_IP6, NULL);
 
@@ -648,6 +992,10 @@ static uint8_t ip4FromNode(struct Message* message,
         Log_debug(context->logger, "Got message with wrong address for connection");
         return Error_INVALID;
     }
+    if (!conn->isOutgoing && context->nat4 && NatTable_outgoing(message, context->nat4)) {
+        Log_debug(context->logger, "Dropping message which can't go through the NAT");
+        return Error_INVALID;
+    }
 
     TUNMessageType_push(message, Ethernet_TYPE_IP4, NULL);
 
@@ -699,28 +1047,21 @@ static uint8_t incomingFromNode(struct Message* message, struct Interface* nodeI
     return 0;
 }
 
-static void timeout(void* vcontext)
+/** See: IpTunnel.h */
+int IpTunnel_setNat(struct Sockaddr* publicAddr, struct IpTunnel* ipTun)
 {
-    struct IpTunnel_pvt* context = vcontext;
-    Log_debug(context->logger, "Checking for connections to poll. Total connections [%u]",
-                                context->pub.connectionList.count);
-    if (!context->pub.connectionList.count) {
-        return;
+    struct IpTunnel_pvt* ctx = Identity_cast((struct IpTunnel_pvt*) ipTun);
+    uint8_t* address = NULL;
+    int length = Sockaddr_getAddress(publicAddr, &address);
+    if (length != 16 && length != 4) {
+        return IpTunnel_setNat_INVALID;
     }
-    uint32_t beginning = Random_uint32(context->rand) % context->pub.connectionList.count;
-    uint32_t i = beginning;
-    do {
-        Assert_true(i < context->pub.connectionList.count);
-        struct IpTunnel_Connection* conn = &context->pub.connectionList.connections[i];
-        if (conn->isOutgoing
-            && Bits_isZero(conn->connectionIp6, 16)
-            && Bits_isZero(conn->connectionIp4, 4))
-        {
-            requestAddresses(conn, context);
-            break;
-        }
-        i = (i + 1) % context->pub.connectionList.count;
-    } while (i != beginning);
+    struct NatTable** nat = (length == 16) ? &ctx->nat6 : &ctx->nat4;
+    if (*nat) {
+        return IpTunnel_setNat_ALREADY_SET;
+    }
+    *nat = NatTable_new(address, length, ctx->rand, ctx->eventBase, ctx->logger, ctx->allocator);
+    return 0;
 }
 
 void IpTunnel_setTunName(char* interfaceName, struct IpTunnel* ipTun)
@@ -743,9 +1084,11 @@ struct IpTunnel* IpTunnel_new(struct Log* logger,
         .allocator = alloc,
         .logger = logger,
         .rand = rand,
-        .hermes = hermes
+        .hermes = hermes,
+        .eventBase = eventBase,
+        .ip6Routes = RouteTable_new(16, alloc),
+        .ip4Routes = RouteTable_new(4, alloc)
     }));
-    context->timeout = Timeout_setInterval(timeout, context, 10000, eventBase, alloc);
     Identity_set(context);
 
     return &context->pub;
@@ -120,6 +120,28 @@ int IpTunnel_allowConnection(uint8_t publicKeyOfAuthorizedNode[32],
  */
 int IpTunnel_connectTo(uint8_t publicKeyOfNodeToConnectTo[32], struct IpTunnel* tunnel);
 
+/**
+ * Route a whole prefix to a node which is allowed to connect, packets from the TUN to addresses
+ * within the prefix are sent to the node and the node may send from addresses within it.
+ * If prefixes overlap, the longest one which contains the address is used and an address which
+ * was issued to a connection is used before any prefix.
+ * The route is removed when the connection is.
+ *
+ * @param connectionNumber the number which was returned by IpTunnel_allowConnection().
+ * @param prefix the address of the prefix, IPv6 or IPv4, bits after prefixLength are ignored.
+ * @param prefixLength the number of significant bits in the prefix.
+ * @param tunnel the IpTunnel.
+ * @return 0 if the route was added
+ *         IpTunnel_addRoute_NOT_FOUND if there is no such connection
+ *         IpTunnel_addRoute_INVALID if the prefix is invalid or the connection is outgoing.
+ */
+#define IpTunnel_addRoute_NOT_FOUND -1
+#define IpTunnel_addRoute_INVALID -2
+int IpTunnel_addRoute(int connectionNumber,
+                      struct Sockaddr* prefix,
+                      uint8_t prefixLength,
+                      struct IpTunnel* tunnel);
+
 /**
  * Disconnect from a node or remove authorization to connect.
  *
@@ -131,6 +153,22 @@ int IpTunnel_connectTo(uint8_t publicKeyOfNodeToConnectTo[32], struct IpTunnel*
 #define IpTunnel_removeConnection_NOT_FOUND -1
 int IpTunnel_removeConnection(int connectionNumber, struct IpTunnel* tunnel);
 
+/**
+ * Translate the packets which clients of this gateway send to the world so that they come from
+ * one public address, and the answers back to the clients, instead of using the kernel's NAT.
+ * The public address must be routed to the TUN device but not assigned to any interface or the
+ * answers will never be written to the TUN.
+ * This can be done once for IPv4 and once for IPv6.
+ *
+ * @param publicAddr the IPv4 or IPv6 address to translate clients to.
+ * @param ipTun the IpTunnel.
+ * @return 0 if NAT was set up
+ *         IpTunnel_setNat_INVALID if the address is not IPv4 or IPv6.
+ *         IpTunnel_setNat_ALREADY_SET if there is already a NAT for the address family.
+ */
+#define IpTunnel_setNat_INVALID -1
+#define IpTunnel_setNat_ALREADY_SET -2
+int IpTunnel_setNat(struct Sockaddr* publicAddr, struct IpTunnel* ipTun);
 
 void IpTunnel_setTunName(char* interfaceName, struct IpTunnel* ipTun);
 
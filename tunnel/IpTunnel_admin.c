@@ -116,14 +116,57 @@ static void removeConnection(Dict* args,
                              struct Allocator* requestAlloc)
 {
     struct Context* context = vcontext;
-/*
+
     int conn = (int) *(Dict_getInt(args, String_CONST("connection")));
     char* error = "none";
     if (IpTunnel_removeConnection_NOT_FOUND == IpTunnel_removeConnection(conn, context->ipTun)) {
         error = "not found";
     }
-*/
-    sendError("not implemented", txid, context->admin);
+    sendError(error, txid, context->admin);
+}
+
+static void addRoute(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    int conn = (int) *(Dict_getInt(args, String_CONST("connection")));
+    String* address = Dict_getString(args, String_CONST("address"));
+    int64_t prefixLen = *(Dict_getInt(args, String_CONST("prefixLen")));
+
+    struct Sockaddr_storage prefix;
+    char* error = "none";
+    if (Sockaddr_parse(address->bytes, &prefix)) {
+        error = "malformed address";
+    } else if (prefixLen < 0 || prefixLen > 128) {
+        error = "invalid prefixLen";
+    } else {
+        int ret = IpTunnel_addRoute(conn, &prefix.addr, (uint8_t) prefixLen, context->ipTun);
+        if (ret == IpTunnel_addRoute_NOT_FOUND) {
+            error = "not found";
+        } else if (ret == IpTunnel_addRoute_INVALID) {
+            error = "prefixLen too long or connection is outgoing";
+        }
+    }
+    sendError(error, txid, context->admin);
+}
+
+static void setNat(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    String* address = Dict_getString(args, String_CONST("address"));
+
+    struct Sockaddr_storage publicAddr;
+    char* error = "none";
+    if (Sockaddr_parse(address->bytes, &publicAddr)) {
+        error = "malformed address";
+    } else {
+        int ret = IpTunnel_setNat(&publicAddr.addr, context->ipTun);
+        if (ret == IpTunnel_setNat_INVALID) {
+            error = "address must be IPv4 or IPv6";
+        } else if (ret == IpTunnel_setNat_ALREADY_SET) {
+            error = "NAT is already set for this address family";
+        }
+    }
+    sendError(error, txid, context->admin);
 }
 
 static void listConnections(Dict* args,
@@ -213,6 +256,18 @@ void IpTunnel_admin_register(struct IpTunnel* ipTun, struct Admin* admin, struct
             { .name = "connection", .required = 1, .type = "Int" }
         }), admin);
 
+    Admin_registerFunction("IpTunnel_addRoute", addRoute, context, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "connection", .required = 1, .type = "Int" },
+            { .name = "address", .required = 1, .type = "String" },
+            { .name = "prefixLen", .required = 1, .type = "Int" }
+        }), admin);
+
+    Admin_registerFunction("IpTunnel_setNat", setNat, context, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "address", .required = 1, .type = "String" }
+        }), admin);
+
     Admin_registerFunction("IpTunnel_showConnection", showConnection, context, true,
         ((struct Admin_FunctionArg[]) {
             { .name = "connection", .required = 1, .type = "Int" }
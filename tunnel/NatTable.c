@@ -0,0 +1,465 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crypto/random/Random.h"
+#include "memory/Allocator.h"
+#include "tunnel/NatTable.h"
+#include "util/events/Timeout.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Checksum.h"
+#include "util/Endian.h"
+#include "util/Identity.h"
+#include "wire/Headers.h"
+
+#include <stdbool.h>
+
+#define BUCKETS NatTable_MAX_FLOWS
+Assert_compileTime(!(BUCKETS & (BUCKETS - 1)));
+
+/** Public ports are chosen at random from above the well known ports. */
+#define PORT_MIN 1024
+#define PORT_TRIES 64
+
+/** Idle timeouts from RFC 5382 (TCP), RFC 4787 (UDP) and RFC 5508 (ICMP). */
+#define TCP_TIMEOUT_MILLISECONDS (124 * 60 * 1000)
+#define TCP_CLOSING_TIMEOUT_MILLISECONDS (4 * 60 * 1000)
+#define UDP_TIMEOUT_MILLISECONDS (5 * 60 * 1000)
+#define ICMP_TIMEOUT_MILLISECONDS (60 * 1000)
+
+#define PROTOCOL_ICMP 1
+#define PROTOCOL_TCP 6
+#define PROTOCOL_UDP 17
+#define PROTOCOL_ICMP6 58
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_RST 0x04
+
+struct NatTable_Flow
+{
+    uint8_t clientAddr[16];
+    uint8_t remoteAddr[16];
+
+    /** For ICMP echo the client port is the identifier and the remote port is zero. */
+    uint16_t clientPort_be;
+    uint16_t remotePort_be;
+    uint16_t publicPort_be;
+
+    /** Zero if the flow is free. */
+    uint8_t protocol;
+
+    /** (index + 1) of the next flow in the same bucket, nextByClient also links the free list. */
+    uint32_t nextByClient;
+    uint32_t nextByPort;
+
+    /** Created the first time the flow is used. */
+    struct Timeout* timer;
+
+    struct NatTable_pvt* nat;
+};
+
+struct NatTable_pvt
+{
+    struct NatTable pub;
+
+    struct NatTable_Flow* flows;
+
+    /** (index + 1) of the first flow in each bucket, by client side and by public port. */
+    uint32_t byClient[BUCKETS];
+    uint32_t byPort[BUCKETS];
+
+    /** (index + 1) of the first free flow. */
+    uint32_t freeList;
+
+    struct EventBase* eventBase;
+    struct Random* rand;
+    struct Log* logger;
+    struct Allocator* alloc;
+
+    Identity
+};
+
+/** Where the fields of one packet are, in the direction which it is being translated. */
+struct NatTable_Packet
+{
+    uint8_t protocol;
+
+    /** The address and port which are rewritten, the client's going out or the public coming in. */
+    uint8_t* localAddr;
+    uint8_t* localPort;
+
+    uint8_t* remoteAddr;
+    uint16_t remotePort_be;
+
+    /** The transport checksum or NULL if there is none (UDP over IPv4 may leave it out). */
+    uint8_t* checksum;
+
+    /** True if the transport checksum covers the addresses. */
+    bool pseudoHeader;
+
+    /** The IPv4 header checksum or NULL for IPv6. */
+    uint8_t* ipChecksum;
+
+    uint8_t tcpFlags;
+};
+
+static int parse(struct Message* message,
+                 bool outgoing,
+                 struct NatTable_Packet* p,
+                 struct NatTable_pvt* nat)
+{
+    Bits_memset(p, 0, sizeof(struct NatTable_Packet));
+    uint8_t* transport;
+    uint32_t transportLength;
+    if (nat->pub.addressLength == 4) {
+        struct Headers_IP4Header* ip = (struct Headers_IP4Header*) message->bytes;
+        if (message->length < Headers_IP4Header_SIZE || Headers_getIpVersion(ip) != 4) {
+            return NatTable_DROP;
+        }
+        uint32_t headerLength = (ip->versionAndHeaderLength & 0x0f) * 4;
+        // The ports are only in the first fragment, the flags and offset are zero if unfragmented.
+        if (headerLength < Headers_IP4Header_SIZE
+            || (uint32_t)message->length < headerLength
+            || (Endian_bigEndianToHost16(ip->flagsAndFragmentOffset) & 0x3fff))
+        {
+            return NatTable_DROP;
+        }
+        p->protocol = ip->protocol;
+        p->localAddr = (outgoing) ? ip->sourceAddr : ip->destAddr;
+        p->remoteAddr = (outgoing) ? ip->destAddr : ip->sourceAddr;
+        p->ipChecksum = (uint8_t*) &ip->checksum_be;
+        transport = &message->bytes[headerLength];
+        transportLength = message->length - headerLength;
+    } else {
+        struct Headers_IP6Header* ip = (struct Headers_IP6Header*) message->bytes;
+        if (message->length < Headers_IP6Header_SIZE || Headers_getIpVersion(ip) != 6) {
+            return NatTable_DROP;
+        }
+        p->protocol = ip->nextHeader;
+        p->localAddr = (outgoing) ? ip->sourceAddr : ip->destinationAddr;
+        p->remoteAddr = (outgoing) ? ip->destinationAddr : ip->sourceAddr;
+        transport = &message->bytes[Headers_IP6Header_SIZE];
+        transportLength = message->length - Headers_IP6Header_SIZE;
+    }
+
+    uint16_t remotePort_be;
+    switch (p->protocol) {
+        case PROTOCOL_TCP:
+        case PROTOCOL_UDP:
+            if (p->protocol == PROTOCOL_TCP) {
+                if (transportLength < 20) {
+                    return NatTable_DROP;
+                }
+                p->checksum = &transport[16];
+                p->tcpFlags = transport[13];
+            } else {
+                if (transportLength < Headers_UDPHeader_SIZE) {
+                    return NatTable_DROP;
+                }
+                p->checksum = &transport[6];
+                if (nat->pub.addressLength == 4 && Bits_isZero(p->checksum, 2)) {
+                    p->checksum = NULL;
+                }
+            }
+            p->pseudoHeader = true;
+            p->localPort = (outgoing) ? &transport[0] : &transport[2];
+            Bits_memcpyConst(&remotePort_be, (outgoing) ? &transport[2] : &transport[0], 2);
+            p->remotePort_be = remotePort_be;
+            return 0;
+
+        case PROTOCOL_ICMP:
+        case PROTOCOL_ICMP6:
+            if (transportLength < 8
+                || (p->protocol == PROTOCOL_ICMP) != (nat->pub.addressLength == 4))
+            {
+                return NatTable_DROP;
+            }
+            // Only echo can be told apart by its identifier, the requests go out and replies in.
+            if (p->protocol == PROTOCOL_ICMP && transport[0] != ((outgoing) ? 8 : 0)) {
+                return NatTable_DROP;
+            }
+            if (p->protocol == PROTOCOL_ICMP6 && transport[0] != ((outgoing) ? 128 : 129)) {
+                return NatTable_DROP;
+            }
+            p->checksum = &transport[2];
+            p->pseudoHeader = (p->protocol == PROTOCOL_ICMP6);
+            p->localPort = &transport[4];
+            return 0;
+
+        default:
+            return NatTable_DROP;
+    }
+}
+
+static void updateChecksum(uint8_t* checksum, const uint8_t* old, const uint8_t* new, int length)
+{
+    uint16_t sum_be;
+    Bits_memcpyConst(&sum_be, checksum, 2);
+    sum_be = Checksum_update(sum_be, old, new, length);
+    Bits_memcpyConst(checksum, &sum_be, 2);
+}
+
+/** Rewrite an address or port and fix the checksums which cover it. */
+static void rewrite(struct NatTable_Packet* p, uint8_t* field, const uint8_t* value, int length)
+{
+    uint8_t old[16];
+    Bits_memcpy(old, field, length);
+    Bits_memcpy(field, value, length);
+    bool isAddress = (field == p->localAddr);
+    if (isAddress && p->ipChecksum) {
+        updateChecksum(p->ipChecksum, old, value, length);
+    }
+    if (p->checksum && (!isAddress || p->pseudoHeader)) {
+        updateChecksum(p->checksum, old, value, length);
+        // In UDP a checksum of zero means there is none.
+        if (p->protocol == PROTOCOL_UDP && Bits_isZero(p->checksum, 2)) {
+            Bits_memset(p->checksum, 0xff, 2);
+        }
+    }
+}
+
+static inline uint32_t hashBytes(uint32_t hash, const uint8_t* bytes, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+static inline uint32_t clientHash(uint8_t protocol,
+                                  const uint8_t* clientAddr,
+                                  uint16_t clientPort_be,
+                                  const uint8_t* remoteAddr,
+                                  uint16_t remotePort_be,
+                                  struct NatTable_pvt* nat)
+{
+    uint32_t hash = 0x811c9dc5 ^ protocol;
+    hash = hashBytes(hash, clientAddr, nat->pub.addressLength);
+    hash = hashBytes(hash, remoteAddr, nat->pub.addressLength);
+    hash = hashBytes(hash, (uint8_t*) &clientPort_be, 2);
+    hash = hashBytes(hash, (uint8_t*) &remotePort_be, 2);
+    return (hash ^ (hash >> 16)) & (BUCKETS - 1);
+}
+
+static inline uint32_t portHash(uint8_t protocol, uint16_t publicPort_be)
+{
+    uint32_t hash = hashBytes(0x811c9dc5 ^ protocol, (uint8_t*) &publicPort_be, 2);
+    return (hash ^ (hash >> 16)) & (BUCKETS - 1);
+}
+
+static struct NatTable_Flow* flowByPort(uint8_t protocol,
+                                        uint16_t publicPort_be,
+                                        struct NatTable_pvt* nat)
+{
+    for (uint32_t i = nat->byPort[portHash(protocol, publicPort_be)];
+         i;
+         i = nat->flows[i - 1].nextByPort)
+    {
+        struct NatTable_Flow* flow = &nat->flows[i - 1];
+        if (flow->protocol == protocol && flow->publicPort_be == publicPort_be) {
+            return flow;
+        }
+    }
+    return NULL;
+}
+
+/** Remove a flow from a bucket, the chains are short so they are walked to find it. */
+static void unlinkFlow(uint32_t* bucket, uint32_t index, bool byClient, struct NatTable_pvt* nat)
+{
+    uint32_t* next = bucket;
+    while (*next != index + 1) {
+        Assert_true(*next);
+        struct NatTable_Flow* flow = &nat->flows[*next - 1];
+        next = (byClient) ? &flow->nextByClient : &flow->nextByPort;
+    }
+    struct NatTable_Flow* flow = &nat->flows[index];
+    *next = (byClient) ? flow->nextByClient : flow->nextByPort;
+}
+
+static void expire(void* vflow)
+{
+    struct NatTable_Flow* flow = vflow;
+    struct NatTable_pvt* nat = Identity_cast(flow->nat);
+    uint32_t index = flow - nat->flows;
+    unlinkFlow(&nat->byClient[clientHash(flow->protocol,
+                                     flow->clientAddr,
+                                     flow->clientPort_be,
+                                     flow->remoteAddr,
+                                     flow->remotePort_be,
+                                     nat)], index, true, nat);
+    unlinkFlow(&nat->byPort[portHash(flow->protocol, flow->publicPort_be)], index, false, nat);
+    flow->protocol = 0;
+    flow->nextByClient = nat->freeList;
+    nat->freeList = index + 1;
+    nat->pub.flowCount--;
+}
+
+static void touch(struct NatTable_Flow* flow, uint8_t tcpFlags)
+{
+    uint64_t timeout = ICMP_TIMEOUT_MILLISECONDS;
+    if (flow->protocol == PROTOCOL_TCP) {
+        timeout = (tcpFlags & (TCP_FLAG_FIN | TCP_FLAG_RST))
+            ? TCP_CLOSING_TIMEOUT_MILLISECONDS : TCP_TIMEOUT_MILLISECONDS;
+    } else if (flow->protocol == PROTOCOL_UDP) {
+        timeout = UDP_TIMEOUT_MILLISECONDS;
+    }
+    if (flow->timer) {
+        Timeout_resetTimeout(flow->timer, timeout);
+    } else {
+        flow->timer =
+            Timeout_setTimeout(expire, flow, timeout, flow->nat->eventBase, flow->nat->alloc);
+    }
+}
+
+static struct NatTable_Flow* newFlow(struct NatTable_Packet* p, struct NatTable_pvt* nat)
+{
+    if (!nat->freeList) {
+        Log_debug(nat->logger, "Dropping new flow because the NAT table is full");
+        return NULL;
+    }
+    uint16_t publicPort_be = 0;
+    uint32_t port = PORT_MIN + Random_uint32(nat->rand) % (65536 - PORT_MIN);
+    for (int i = 0; i < PORT_TRIES; i++) {
+        uint16_t candidate_be = Endian_hostToBigEndian16(port);
+        if (!flowByPort(p->protocol, candidate_be, nat)) {
+            publicPort_be = candidate_be;
+            break;
+        }
+        port = (port == 65535) ? PORT_MIN : port + 1;
+    }
+    if (!publicPort_be) {
+        Log_debug(nat->logger, "Dropping new flow because no public port is free");
+        return NULL;
+    }
+
+    uint32_t index = nat->freeList - 1;
+    struct NatTable_Flow* flow = &nat->flows[index];
+    nat->freeList = flow->nextByClient;
+
+    Bits_memcpy(flow->clientAddr, p->localAddr, nat->pub.addressLength);
+    Bits_memcpy(flow->remoteAddr, p->remoteAddr, nat->pub.addressLength);
+    Bits_memcpyConst(&flow->clientPort_be, p->localPort, 2);
+    flow->remotePort_be = p->remotePort_be;
+    flow->publicPort_be = publicPort_be;
+    flow->protocol = p->protocol;
+
+    uint32_t* bucket = &nat->byClient[clientHash(flow->protocol,
+                                                 flow->clientAddr,
+                                                 flow->clientPort_be,
+                                                 flow->remoteAddr,
+                                                 flow->remotePort_be,
+                                                 nat)];
+    flow->nextByClient = *bucket;
+    *bucket = index + 1;
+    bucket = &nat->byPort[portHash(flow->protocol, publicPort_be)];
+    flow->nextByPort = *bucket;
+    *bucket = index + 1;
+
+    nat->pub.flowCount++;
+    return flow;
+}
+
+/** See: NatTable.h */
+int NatTable_outgoing(struct Message* message, struct NatTable* natTable)
+{
+    struct NatTable_pvt* nat = Identity_cast((struct NatTable_pvt*) natTable);
+    struct NatTable_Packet p;
+    if (parse(message, true, &p, nat)) {
+        return NatTable_DROP;
+    }
+    uint16_t clientPort_be;
+    Bits_memcpyConst(&clientPort_be, p.localPort, 2);
+
+    struct NatTable_Flow* flow = NULL;
+    for (uint32_t i = nat->byClient[clientHash(p.protocol,
+                                               p.localAddr,
+                                               clientPort_be,
+                                               p.remoteAddr,
+                                               p.remotePort_be,
+                                               nat)];
+         i;
+         i = nat->flows[i - 1].nextByClient)
+    {
+        struct NatTable_Flow* f = &nat->flows[i - 1];
+        if (f->protocol == p.protocol
+            && f->clientPort_be == clientPort_be
+            && f->remotePort_be == p.remotePort_be
+            && !Bits_memcmp(f->clientAddr, p.localAddr, nat->pub.addressLength)
+            && !Bits_memcmp(f->remoteAddr, p.remoteAddr, nat->pub.addressLength))
+        {
+            flow = f;
+            break;
+        }
+    }
+    if (!flow && !(flow = newFlow(&p, nat))) {
+        return NatTable_DROP;
+    }
+    touch(flow, p.tcpFlags);
+
+    rewrite(&p, p.localAddr, nat->pub.publicAddr, nat->pub.addressLength);
+    rewrite(&p, p.localPort, (uint8_t*) &flow->publicPort_be, 2);
+    return 0;
+}
+
+/** See: NatTable.h */
+int NatTable_incoming(struct Message* message, struct NatTable* natTable)
+{
+    struct NatTable_pvt* nat = Identity_cast((struct NatTable_pvt*) natTable);
+    struct NatTable_Packet p;
+    if (parse(message, false, &p, nat)) {
+        return NatTable_DROP;
+    }
+    uint16_t publicPort_be;
+    Bits_memcpyConst(&publicPort_be, p.localPort, 2);
+
+    // Only the remote end of the flow may answer it.
+    struct NatTable_Flow* flow = flowByPort(p.protocol, publicPort_be, nat);
+    if (!flow
+        || flow->remotePort_be != p.remotePort_be
+        || Bits_memcmp(flow->remoteAddr, p.remoteAddr, nat->pub.addressLength))
+    {
+        return NatTable_DROP;
+    }
+    touch(flow, p.tcpFlags);
+
+    rewrite(&p, p.localAddr, flow->clientAddr, nat->pub.addressLength);
+    rewrite(&p, p.localPort, (uint8_t*) &flow->clientPort_be, 2);
+    return 0;
+}
+
+/** See: NatTable.h */
+struct NatTable* NatTable_new(const uint8_t* publicAddr,
+                              uint32_t addressLength,
+                              struct Random* rand,
+                              struct EventBase* eventBase,
+                              struct Log* logger,
+                              struct Allocator* alloc)
+{
+    Assert_true(addressLength == 4 || addressLength == 16);
+    struct NatTable_pvt* nat = Allocator_calloc(alloc, sizeof(struct NatTable_pvt), 1);
+    Bits_memcpy(nat->pub.publicAddr, publicAddr, addressLength);
+    nat->pub.addressLength = addressLength;
+    nat->flows = Allocator_calloc(alloc, sizeof(struct NatTable_Flow), NatTable_MAX_FLOWS);
+    for (uint32_t i = 0; i < NatTable_MAX_FLOWS; i++) {
+        nat->flows[i].nat = nat;
+        nat->flows[i].nextByClient = (i + 1 < NatTable_MAX_FLOWS) ? i + 2 : 0;
+    }
+    nat->freeList = 1;
+    nat->eventBase = eventBase;
+    nat->rand = rand;
+    nat->logger = logger;
+    nat->alloc = alloc;
+    Identity_set(nat);
+    return &nat->pub;
+}
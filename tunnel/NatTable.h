@@ -0,0 +1,89 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NatTable_H
+#define NatTable_H
+
+#include "crypto/random/Random.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/log/Log.h"
+#include "wire/Message.h"
+#include "util/Linker.h"
+Linker_require("tunnel/NatTable.c")
+
+#include <stdint.h>
+
+/** The maximum number of flows which can be translated at once, new flows are dropped after. */
+#ifndef NatTable_MAX_FLOWS
+    #define NatTable_MAX_FLOWS 4096
+#endif
+
+/**
+ * Port translating NAT with connection tracking for one address family.
+ * Flows of TCP, UDP and ICMP echo from clients are rewritten to come from a single public
+ * address and a port which is unique to the flow, answers from the same remote address and port
+ * are rewritten back to the client and anything else sent to the public address is dropped.
+ * Checksums are updated incrementally and flows expire after they go idle.
+ * Fragmented packets and other protocols are not translated.
+ */
+struct NatTable
+{
+    /** The address which clients are translated to, 4 or 16 bytes. */
+    uint8_t publicAddr[16];
+
+    /** 4 for IPv4 or 16 for IPv6. */
+    uint32_t addressLength;
+
+    /** The number of flows which are being tracked. */
+    uint32_t flowCount;
+};
+
+/**
+ * Create a new NAT.
+ *
+ * @param publicAddr the address which clients will be translated to.
+ * @param addressLength the length of publicAddr, 4 for NAT44 or 16 for NAT66.
+ * @param rand a random generator for choosing public ports.
+ * @param eventBase the event base.
+ * @param logger the logger.
+ * @param alloc freeing this will drop all of the flows.
+ */
+struct NatTable* NatTable_new(const uint8_t* publicAddr,
+                              uint32_t addressLength,
+                              struct Random* rand,
+                              struct EventBase* eventBase,
+                              struct Log* logger,
+                              struct Allocator* alloc);
+
+/**
+ * Translate a packet from a client going out.
+ *
+ * @param message the packet beginning with the IP header.
+ * @param nat the NAT.
+ * @return 0 if the packet was translated or NatTable_DROP if it can't be.
+ */
+#define NatTable_DROP -1
+int NatTable_outgoing(struct Message* message, struct NatTable* nat);
+
+/**
+ * Translate a packet to the public address back to the client whose flow it answers.
+ *
+ * @param message the packet beginning with the IP header.
+ * @param nat the NAT.
+ * @return 0 if the packet was translated or NatTable_DROP if it is not part of any flow.
+ */
+int NatTable_incoming(struct Message* message, struct NatTable* nat);
+
+#endif
@@ -0,0 +1,149 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "tunnel/RouteTable.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+
+#define STRIDE 4
+#define SLOTS (1 << STRIDE)
+
+struct RouteTable_Slot
+{
+    /** The value for the longest prefix which covers this slot at this level, 0 if none. */
+    uint32_t value;
+
+    /** The index of the node for the next STRIDE bits of the address, 0 if none. */
+    uint32_t child;
+
+    /** The length of the prefix which value came from. */
+    uint8_t prefixLength;
+};
+
+struct RouteTable_Node
+{
+    struct RouteTable_Slot slots[SLOTS];
+};
+
+struct RouteTable_pvt
+{
+    struct RouteTable pub;
+
+    /** Node 0 is the root, it can never be a child so 0 marks an empty child. */
+    struct RouteTable_Node* nodes;
+    uint32_t nodeCount;
+    uint32_t nodeCapacity;
+
+    struct Allocator* alloc;
+
+    Identity
+};
+
+static inline uint32_t nibble(const uint8_t* address, uint32_t level)
+{
+    return (level & 1) ? (address[level >> 1] & 0x0f) : (address[level >> 1] >> 4);
+}
+
+static uint32_t newNode(struct RouteTable_pvt* rt)
+{
+    if (rt->nodeCount == rt->nodeCapacity) {
+        rt->nodeCapacity *= 2;
+        rt->nodes = Allocator_realloc(rt->alloc,
+                                      rt->nodes,
+                                      rt->nodeCapacity * sizeof(struct RouteTable_Node));
+    }
+    Bits_memset(&rt->nodes[rt->nodeCount], 0, sizeof(struct RouteTable_Node));
+    return rt->nodeCount++;
+}
+
+/** See: RouteTable.h */
+void RouteTable_put(const uint8_t* prefix,
+                    uint32_t prefixLength,
+                    uint32_t value,
+                    struct RouteTable* routeTable)
+{
+    struct RouteTable_pvt* rt = Identity_cast((struct RouteTable_pvt*) routeTable);
+    Assert_true(value);
+    Assert_true(prefixLength <= rt->pub.addressLength * 8);
+
+    // The prefix is expanded into the level which holds its last bit, a zero length prefix
+    // covers every slot of the root.
+    uint32_t level = (prefixLength) ? (prefixLength - 1) / STRIDE : 0;
+    uint32_t node = 0;
+    for (uint32_t i = 0; i < level; i++) {
+        struct RouteTable_Slot* slot = &rt->nodes[node].slots[nibble(prefix, i)];
+        if (!slot->child) {
+            // newNode() may move the nodes so the slot pointer can't be used across it.
+            uint32_t child = newNode(rt);
+            rt->nodes[node].slots[nibble(prefix, i)].child = child;
+        }
+        node = rt->nodes[node].slots[nibble(prefix, i)].child;
+    }
+
+    uint32_t bits = prefixLength - level * STRIDE;
+    uint32_t first = nibble(prefix, level) & ~((SLOTS - 1) >> bits);
+    for (uint32_t i = first; i < first + (SLOTS >> bits); i++) {
+        struct RouteTable_Slot* slot = &rt->nodes[node].slots[i];
+        if (!slot->value || slot->prefixLength <= prefixLength) {
+            slot->value = value;
+            slot->prefixLength = prefixLength;
+        }
+    }
+}
+
+/** See: RouteTable.h */
+uint32_t RouteTable_get(const uint8_t* address, struct RouteTable* routeTable)
+{
+    struct RouteTable_pvt* rt = Identity_cast((struct RouteTable_pvt*) routeTable);
+    uint32_t levels = rt->pub.addressLength * 8 / STRIDE;
+    uint32_t out = 0;
+    uint32_t node = 0;
+    for (uint32_t i = 0; i < levels; i++) {
+        struct RouteTable_Slot* slot = &rt->nodes[node].slots[nibble(address, i)];
+        // Anything found at a deeper level is from a longer prefix.
+        if (slot->value) {
+            out = slot->value;
+        }
+        if (!slot->child) {
+            break;
+        }
+        node = slot->child;
+    }
+    return out;
+}
+
+/** See: RouteTable.h */
+void RouteTable_clear(struct RouteTable* routeTable)
+{
+    struct RouteTable_pvt* rt = Identity_cast((struct RouteTable_pvt*) routeTable);
+    rt->nodeCount = 0;
+    newNode(rt);
+}
+
+/** See: RouteTable.h */
+struct RouteTable* RouteTable_new(uint32_t addressLength, struct Allocator* alloc)
+{
+    Assert_true(addressLength == 4 || addressLength == 16);
+    struct RouteTable_pvt* rt = Allocator_clone(alloc, (&(struct RouteTable_pvt) {
+        .pub = { .addressLength = addressLength },
+        .nodeCapacity = 8,
+        .alloc = alloc
+    }));
+    rt->nodes = Allocator_malloc(alloc, rt->nodeCapacity * sizeof(struct RouteTable_Node));
+    Identity_set(rt);
+    newNode(rt);
+    return &rt->pub;
+}
@@ -0,0 +1,75 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef RouteTable_H
+#define RouteTable_H
+
+#include "memory/Allocator.h"
+#include "util/Linker.h"
+Linker_require("tunnel/RouteTable.c")
+
+#include <stdint.h>
+
+/**
+ * A longest prefix match table of IPv4 or IPv6 prefixes.
+ * This is a multibit trie which consumes 4 bits of the address at each level and expands each
+ * prefix to fill all of the slots which it covers at its deepest level, so a lookup is one
+ * memory access per nibble of the longest prefix along the path, independent of the number of
+ * prefixes in the table. Removing a prefix is done by clearing the table and putting back the
+ * rest.
+ */
+struct RouteTable
+{
+    /** Either 4 or 16. */
+    uint32_t addressLength;
+};
+
+/**
+ * Create a new RouteTable.
+ *
+ * @param addressLength the length of the addresses in bytes, 4 for IPv4 or 16 for IPv6.
+ * @param alloc the allocator which holds the table, it grows as prefixes are added.
+ */
+struct RouteTable* RouteTable_new(uint32_t addressLength, struct Allocator* alloc);
+
+/**
+ * Add a prefix to the table, if the same prefix is already present, this replaces it.
+ *
+ * @param prefix the address of the prefix, bits after prefixLength are ignored.
+ * @param prefixLength the number of bits of prefix which are significant.
+ * @param value the value to return for addresses within the prefix, must not be zero.
+ * @param rt the table.
+ */
+void RouteTable_put(const uint8_t* prefix,
+                    uint32_t prefixLength,
+                    uint32_t value,
+                    struct RouteTable* rt);
+
+/**
+ * Get the value of the longest prefix which contains an address.
+ *
+ * @param address the address to look up, addressLength bytes.
+ * @param rt the table.
+ * @return the value which was given with the prefix or 0 if no prefix contains the address.
+ */
+uint32_t RouteTable_get(const uint8_t* address, struct RouteTable* rt);
+
+/**
+ * Remove all prefixes from the table, the memory which it uses is kept for reuse.
+ *
+ * @param rt the table.
+ */
+void RouteTable_clear(struct RouteTable* rt);
+
+#endif
@@ -0,0 +1,170 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "io/FileWriter.h"
+#include "util/log/Log.h"
+#include "util/log/WriterLog.h"
+#include "util/events/EventBase.h"
+#include "crypto/random/Random.h"
+#include "tunnel/IpTunnel.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "wire/Message.h"
+#include "wire/Headers.h"
+
+#include <stdbool.h>
+
+#define CONNECTIONS 40
+
+static uint8_t keys[CONNECTIONS][32];
+static uint8_t addrs[CONNECTIONS][16];
+static int toNode = -1;
+static int toTun = 0;
+
+static uint8_t messageToNode(struct Message* message, struct Interface* iface)
+{
+    struct IpTunnel_PacketInfoHeader* pi = (struct IpTunnel_PacketInfoHeader*) message->bytes;
+    for (int i = 0; i < CONNECTIONS; i++) {
+        if (!Bits_memcmp(pi->nodeKey, keys[i], 32)) {
+            toNode = i;
+        }
+    }
+    return 0;
+}
+
+static uint8_t messageToTun(struct Message* message, struct Interface* iface)
+{
+    toTun++;
+    return 0;
+}
+
+static struct Message* ip6Packet(uint8_t src[16], uint8_t dest[16], struct Allocator* alloc)
+{
+    struct Message* message = Message_new(Headers_IP6Header_SIZE + 8, 512, alloc);
+    Bits_memset(message->bytes, 0, message->length);
+    struct Headers_IP6Header* ip = (struct Headers_IP6Header*) message->bytes;
+    Headers_setIpVersion(ip);
+    ip->payloadLength_be = Endian_hostToBigEndian16(8);
+    ip->nextHeader = 17;
+    Bits_memcpyConst(ip->sourceAddr, src, 16);
+    Bits_memcpyConst(ip->destinationAddr, dest, 16);
+    return message;
+}
+
+/** Send a packet from the TUN to a client and return the connection it went to or -1. */
+static int fromTun(int client, struct IpTunnel* ipTun, struct Allocator* alloc)
+{
+    uint8_t internet[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+    toNode = -1;
+    struct Message* message = ip6Packet(internet, addrs[client], alloc);
+    ipTun->tunInterface.sendMessage(message, &ipTun->tunInterface);
+    return toNode;
+}
+
+/** Send a packet from a node with a source address and return true if it reached the TUN. */
+static bool fromNode(int node, uint8_t src[16], struct IpTunnel* ipTun, struct Allocator* alloc)
+{
+    uint8_t internet[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+    struct Message* message = ip6Packet(src, internet, alloc);
+    Message_shift(message, IpTunnel_PacketInfoHeader_SIZE, NULL);
+    struct IpTunnel_PacketInfoHeader* pi = (struct IpTunnel_PacketInfoHeader*) message->bytes;
+    Bits_memset(pi, 0, IpTunnel_PacketInfoHeader_SIZE);
+    Bits_memcpyConst(pi->nodeKey, keys[node], 32);
+    int before = toTun;
+    ipTun->nodeInterface.sendMessage(message, &ipTun->nodeInterface);
+    return toTun > before;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Writer* w = FileWriter_new(stdout, alloc);
+    struct Log* logger = WriterLog_new(w, alloc);
+    struct Random* rand = Random_new(alloc, logger, NULL);
+    struct EventBase* eb = EventBase_new(alloc);
+
+    struct IpTunnel* ipTun = IpTunnel_new(logger, eb, alloc, rand, NULL);
+    ipTun->nodeInterface.receiveMessage = messageToNode;
+    ipTun->tunInterface.receiveMessage = messageToTun;
+
+    int numbers[CONNECTIONS];
+    for (int i = 0; i < CONNECTIONS; i++) {
+        Random_bytes(rand, keys[i], 32);
+        // Sequential addresses, as a gateway would hand them out.
+        struct Sockaddr_storage ss;
+        Assert_always(!Sockaddr_parse("fd00::1", &ss));
+        uint8_t* addr = NULL;
+        Sockaddr_getAddress(&ss.addr, &addr);
+        addr[15] = i + 1;
+        Bits_memcpyConst(addrs[i], addr, 16);
+        numbers[i] = IpTunnel_allowConnection(keys[i], &ss.addr, NULL, ipTun);
+    }
+
+    for (int i = 0; i < CONNECTIONS; i++) {
+        Assert_always(fromTun(i, ipTun, alloc) == i);
+        Assert_always(fromNode(i, addrs[i], ipTun, alloc));
+    }
+
+    // A client may not use the address which was given to another client.
+    Assert_always(!fromNode(3, addrs[4], ipTun, alloc));
+
+    Assert_always(!IpTunnel_removeConnection(numbers[5], ipTun));
+    Assert_always(IpTunnel_removeConnection(numbers[5], ipTun)
+        == IpTunnel_removeConnection_NOT_FOUND);
+    Assert_always(fromTun(5, ipTun, alloc) == -1);
+    Assert_always(!fromNode(5, addrs[5], ipTun, alloc));
+    for (int i = 0; i < CONNECTIONS; i++) {
+        if (i != 5) {
+            Assert_always(fromTun(i, ipTun, alloc) == i);
+            Assert_always(fromNode(i, addrs[i], ipTun, alloc));
+        }
+    }
+
+    // Route prefixes to a couple of clients, the longest one wins.
+    uint8_t inPrefix[16] = { 0x20, 0x01, 0x0d, 0xb8, 0, 1, [15] = 9 };
+    uint8_t inLonger[16] = { 0x20, 0x01, 0x0d, 0xb8, 0, 1, 0, 2, [15] = 9 };
+    uint8_t outside[16] = { 0x20, 0x01, 0x0d, 0xb8, 0, 2, [15] = 9 };
+    struct Sockaddr_storage ss;
+    Assert_always(!Sockaddr_parse("2001:db8:1::", &ss));
+    Assert_always(!IpTunnel_addRoute(numbers[7], &ss.addr, 48, ipTun));
+    Assert_always(!Sockaddr_parse("2001:db8:1:2::", &ss));
+    Assert_always(!IpTunnel_addRoute(numbers[9], &ss.addr, 64, ipTun));
+    Assert_always(IpTunnel_addRoute(numbers[5], &ss.addr, 64, ipTun)
+        == IpTunnel_addRoute_NOT_FOUND);
+    Assert_always(IpTunnel_addRoute(numbers[9], &ss.addr, 129, ipTun)
+        == IpTunnel_addRoute_INVALID);
+
+    Bits_memcpyConst(addrs[0], inPrefix, 16);
+    Assert_always(fromTun(0, ipTun, alloc) == 7);
+    Bits_memcpyConst(addrs[0], inLonger, 16);
+    Assert_always(fromTun(0, ipTun, alloc) == 9);
+    Bits_memcpyConst(addrs[0], outside, 16);
+    Assert_always(fromTun(0, ipTun, alloc) == -1);
+    Assert_always(fromNode(7, inPrefix, ipTun, alloc));
+    Assert_always(!fromNode(8, inPrefix, ipTun, alloc));
+    Assert_always(!fromNode(7, inLonger, ipTun, alloc));
+
+    // Removing a connection takes its routes and moves the others down.
+    Assert_always(!IpTunnel_removeConnection(numbers[7], ipTun));
+    Bits_memcpyConst(addrs[0], inPrefix, 16);
+    Assert_always(fromTun(0, ipTun, alloc) == -1);
+    Bits_memcpyConst(addrs[0], inLonger, 16);
+    Assert_always(fromTun(0, ipTun, alloc) == 9);
+    Assert_always(fromNode(9, inLonger, ipTun, alloc));
+
+    Allocator_free(alloc);
+    return 0;
+}
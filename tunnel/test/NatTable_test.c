@@ -0,0 +1,181 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
+#include "tunnel/NatTable.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Checksum.h"
+#include "util/Endian.h"
+#include "util/events/EventBase.h"
+#include "wire/Headers.h"
+#include "wire/Message.h"
+
+static const uint8_t client6[16] = { 0xfd, 0, [15] = 2 };
+static const uint8_t public6[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+static const uint8_t remote6[16] = { 0x20, 0x01, 0x0d, 0xb8, 0xff, [15] = 1 };
+
+static const uint8_t client4[4] = { 10, 66, 0, 2 };
+static const uint8_t public4[4] = { 192, 0, 2, 1 };
+static const uint8_t remote4[4] = { 198, 51, 100, 7 };
+
+static struct Message* udp6(const uint8_t* src,
+                            uint16_t srcPort,
+                            const uint8_t* dest,
+                            uint16_t destPort,
+                            struct Allocator* alloc)
+{
+    struct Message* message = Message_new(Headers_IP6Header_SIZE + Headers_UDPHeader_SIZE + 5,
+                                          0,
+                                          alloc);
+    struct Headers_IP6Header* ip = (struct Headers_IP6Header*) message->bytes;
+    Bits_memset(ip, 0, message->length);
+    Headers_setIpVersion(ip);
+    ip->payloadLength_be = Endian_hostToBigEndian16(Headers_UDPHeader_SIZE + 5);
+    ip->nextHeader = 17;
+    Bits_memcpyConst(ip->sourceAddr, src, 16);
+    Bits_memcpyConst(ip->destinationAddr, dest, 16);
+    struct Headers_UDPHeader* udp = (struct Headers_UDPHeader*) &ip[1];
+    udp->srcPort_be = Endian_hostToBigEndian16(srcPort);
+    udp->destPort_be = Endian_hostToBigEndian16(destPort);
+    udp->length_be = Endian_hostToBigEndian16(Headers_UDPHeader_SIZE + 5);
+    Bits_memcpyConst(&udp[1], "hello", 5);
+    udp->checksum_be = Checksum_udpIp6(ip->sourceAddr, (uint8_t*) udp, Headers_UDPHeader_SIZE + 5);
+    return message;
+}
+
+static void checkUdp6(struct Message* message)
+{
+    struct Headers_IP6Header* ip = (struct Headers_IP6Header*) message->bytes;
+    // A correct checksum sums to zero when it is included.
+    Assert_always(!Checksum_udpIp6(ip->sourceAddr, (uint8_t*) &ip[1], Headers_UDPHeader_SIZE + 5));
+}
+
+static struct Message* ping4(const uint8_t* src,
+                             const uint8_t* dest,
+                             uint8_t type,
+                             uint16_t id,
+                             struct Allocator* alloc)
+{
+    struct Message* message = Message_new(Headers_IP4Header_SIZE + 8, 0, alloc);
+    struct Headers_IP4Header* ip = (struct Headers_IP4Header*) message->bytes;
+    Bits_memset(ip, 0, message->length);
+    ip->versionAndHeaderLength = 0x45;
+    ip->totalLength_be = Endian_hostToBigEndian16(message->length);
+    ip->ttl = 64;
+    ip->protocol = 1;
+    Bits_memcpyConst(ip->sourceAddr, src, 4);
+    Bits_memcpyConst(ip->destAddr, dest, 4);
+    ip->checksum_be = Checksum_engine((uint8_t*) ip, Headers_IP4Header_SIZE);
+    uint8_t* icmp = (uint8_t*) &ip[1];
+    icmp[0] = type;
+    uint16_t id_be = Endian_hostToBigEndian16(id);
+    Bits_memcpyConst(&icmp[4], &id_be, 2);
+    uint16_t checksum = Checksum_engine(icmp, 8);
+    Bits_memcpyConst(&icmp[2], &checksum, 2);
+    return message;
+}
+
+static void checkPing4(struct Message* message)
+{
+    Assert_always(!Checksum_engine(message->bytes, Headers_IP4Header_SIZE));
+    Assert_always(!Checksum_engine(&message->bytes[Headers_IP4Header_SIZE], 8));
+}
+
+static void nat66(struct Random* rand, struct EventBase* base, struct Allocator* alloc)
+{
+    struct NatTable* nat = NatTable_new(public6, 16, rand, base, NULL, alloc);
+
+    struct Message* out = udp6(client6, 5000, remote6, 53, alloc);
+    Assert_always(!NatTable_outgoing(out, nat));
+    struct Headers_IP6Header* ip = (struct Headers_IP6Header*) out->bytes;
+    struct Headers_UDPHeader* udp = (struct Headers_UDPHeader*) &ip[1];
+    Assert_always(!Bits_memcmp(ip->sourceAddr, public6, 16));
+    Assert_always(!Bits_memcmp(ip->destinationAddr, remote6, 16));
+    Assert_always(udp->destPort_be == Endian_hostToBigEndian16(53));
+    checkUdp6(out);
+    uint16_t publicPort = Endian_bigEndianToHost16(udp->srcPort_be);
+    Assert_always(nat->flowCount == 1);
+
+    // The same flow keeps its port.
+    out = udp6(client6, 5000, remote6, 53, alloc);
+    Assert_always(!NatTable_outgoing(out, nat));
+    udp = (struct Headers_UDPHeader*) &out->bytes[Headers_IP6Header_SIZE];
+    Assert_always(Endian_bigEndianToHost16(udp->srcPort_be) == publicPort);
+    Assert_always(nat->flowCount == 1);
+
+    struct Message* in = udp6(remote6, 53, public6, publicPort, alloc);
+    Assert_always(!NatTable_incoming(in, nat));
+    ip = (struct Headers_IP6Header*) in->bytes;
+    udp = (struct Headers_UDPHeader*) &ip[1];
+    Assert_always(!Bits_memcmp(ip->destinationAddr, client6, 16));
+    Assert_always(udp->destPort_be == Endian_hostToBigEndian16(5000));
+    checkUdp6(in);
+
+    // Only the remote end of the flow may answer.
+    in = udp6(remote6, 54, public6, publicPort, alloc);
+    Assert_always(NatTable_incoming(in, nat) == NatTable_DROP);
+    in = udp6(client6, 53, public6, publicPort, alloc);
+    Assert_always(NatTable_incoming(in, nat) == NatTable_DROP);
+    in = udp6(remote6, 53, public6, publicPort + 1, alloc);
+    Assert_always(NatTable_incoming(in, nat) == NatTable_DROP);
+
+    // Once the table is full new flows are dropped but known ones still pass.
+    for (int i = 1; i < NatTable_MAX_FLOWS; i++) {
+        out = udp6(client6, 5000 + i, remote6, 53, alloc);
+        Assert_always(!NatTable_outgoing(out, nat));
+    }
+    Assert_always(nat->flowCount == NatTable_MAX_FLOWS);
+    out = udp6(client6, 4999, remote6, 53, alloc);
+    Assert_always(NatTable_outgoing(out, nat) == NatTable_DROP);
+    out = udp6(client6, 5000, remote6, 53, alloc);
+    Assert_always(!NatTable_outgoing(out, nat));
+}
+
+static void nat44(struct Random* rand, struct EventBase* base, struct Allocator* alloc)
+{
+    struct NatTable* nat = NatTable_new(public4, 4, rand, base, NULL, alloc);
+
+    struct Message* out = ping4(client4, remote4, 8, 77, alloc);
+    Assert_always(!NatTable_outgoing(out, nat));
+    struct Headers_IP4Header* ip = (struct Headers_IP4Header*) out->bytes;
+    Assert_always(!Bits_memcmp(ip->sourceAddr, public4, 4));
+    checkPing4(out);
+    uint16_t id_be;
+    Bits_memcpyConst(&id_be, &out->bytes[Headers_IP4Header_SIZE + 4], 2);
+
+    struct Message* in = ping4(remote4, public4, 0, Endian_bigEndianToHost16(id_be), alloc);
+    Assert_always(!NatTable_incoming(in, nat));
+    ip = (struct Headers_IP4Header*) in->bytes;
+    Assert_always(!Bits_memcmp(ip->destAddr, client4, 4));
+    Bits_memcpyConst(&id_be, &in->bytes[Headers_IP4Header_SIZE + 4], 2);
+    Assert_always(id_be == Endian_hostToBigEndian16(77));
+    checkPing4(in);
+
+    // An echo request from outside is not an answer to anything.
+    in = ping4(remote4, public4, 8, 77, alloc);
+    Assert_always(NatTable_incoming(in, nat) == NatTable_DROP);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<24);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+    struct EventBase* base = EventBase_new(alloc);
+    nat66(rand, base, alloc);
+    nat44(rand, base, alloc);
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
+#include "tunnel/RouteTable.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#include <stdbool.h>
+
+#define PREFIXES 200
+#define LOOKUPS 2000
+
+struct Prefix
+{
+    uint8_t addr[16];
+    uint32_t length;
+};
+
+static bool contains(struct Prefix* p, uint8_t* address)
+{
+    for (uint32_t i = 0; i < p->length; i++) {
+        uint8_t bit = 0x80 >> (i % 8);
+        if ((p->addr[i / 8] & bit) != (address[i / 8] & bit)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** The value of the longest prefix in the list which contains the address, the slow way. */
+static uint32_t longestMatch(struct Prefix* prefixes, int count, uint8_t* address)
+{
+    uint32_t out = 0;
+    int32_t longest = -1;
+    for (int i = 0; i < count; i++) {
+        if ((int32_t)prefixes[i].length > longest && contains(&prefixes[i], address)) {
+            longest = prefixes[i].length;
+            out = i + 1;
+        }
+    }
+    return out;
+}
+
+/** Addresses are made from a few bases so that the prefixes nest and overlap. */
+static void randomAddress(uint8_t* out, uint32_t length, struct Random* rand)
+{
+    uint8_t bases[4][16] = { { 10 }, { 10, 1 }, { 192, 168 }, { 0x20, 0x01, 0x0d, 0xb8 } };
+    Bits_memcpyConst(out, bases[Random_uint32(rand) % 4], 16);
+    uint32_t fromByte = Random_uint32(rand) % length;
+    Random_bytes(rand, &out[fromByte], length - fromByte);
+}
+
+static void testTable(uint32_t length, struct Random* rand, struct Allocator* alloc)
+{
+    struct RouteTable* rt = RouteTable_new(length, alloc);
+    struct Prefix prefixes[PREFIXES];
+    for (int i = 0; i < PREFIXES; i++) {
+        randomAddress(prefixes[i].addr, length, rand);
+        prefixes[i].length = Random_uint32(rand) % (length * 8 + 1);
+        // Prefixes of the same length and address would make the expected answer ambiguous.
+        for (int j = 0; j < i; j++) {
+            if (prefixes[j].length == prefixes[i].length
+                && contains(&prefixes[j], prefixes[i].addr))
+            {
+                prefixes[i].length = (prefixes[i].length + 1) % (length * 8 + 1);
+                j = -1;
+            }
+        }
+        RouteTable_put(prefixes[i].addr, prefixes[i].length, i + 1, rt);
+    }
+
+    for (int i = 0; i < LOOKUPS; i++) {
+        uint8_t address[16];
+        if (i < PREFIXES) {
+            Bits_memcpyConst(address, prefixes[i].addr, 16);
+        } else {
+            randomAddress(address, length, rand);
+        }
+        Assert_always(RouteTable_get(address, rt) == longestMatch(prefixes, PREFIXES, address));
+    }
+
+    // Removing is clearing and putting back the rest.
+    RouteTable_clear(rt);
+    uint8_t zero[16] = {0};
+    Assert_always(!RouteTable_get(zero, rt));
+    for (int i = 0; i < PREFIXES / 2; i++) {
+        RouteTable_put(prefixes[i].addr, prefixes[i].length, i + 1, rt);
+    }
+    for (int i = 0; i < PREFIXES; i++) {
+        Assert_always(RouteTable_get(prefixes[i].addr, rt)
+            == longestMatch(prefixes, PREFIXES / 2, prefixes[i].addr));
+    }
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+    testTable(4, rand, alloc);
+    testTable(16, rand, alloc);
+    Allocator_free(alloc);
+    return 0;
+}
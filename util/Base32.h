@@ -65,6 +65,28 @@ static inline int Base32_decode(uint8_t* output,
     uint32_t nextByte = 0;
     uint32_t bits = 0;
 
+    // Eight characters are exactly five bytes, take them a group at a time while there is room.
+    // Characters with the high bit set or which map to 99 make bad greater than 31.
+    while (inputLength - inputIndex >= 8 && outLength - outIndex >= 5) {
+        const uint8_t* c = &in[inputIndex];
+        uint32_t bad = (c[0] | c[1] | c[2] | c[3] | c[4] | c[5] | c[6] | c[7]) & 0x80;
+        uint64_t group = 0;
+        for (int i = 0; i < 8; i++) {
+            uint8_t b = numForAscii[c[i] & 0x7f];
+            bad |= b;
+            group |= ((uint64_t) b) << (5 * i);
+        }
+        if (bad > 31) {
+            return Base32_BAD_INPUT;
+        }
+        output[outIndex++] = group;
+        output[outIndex++] = group >> 8;
+        output[outIndex++] = group >> 16;
+        output[outIndex++] = group >> 24;
+        output[outIndex++] = group >> 32;
+        inputIndex += 8;
+    }
+
     while (inputIndex < inputLength) {
         if (in[inputIndex] & 0x80) {
             return Base32_BAD_INPUT;
@@ -117,6 +139,25 @@ static inline int Base32_encode(uint8_t* output,
     uint32_t bits = 0;
     static const uint8_t* kChars = (uint8_t*) "0123456789bcdfghjklmnpqrstuvwxyz";
 
+    // Five bytes are exactly eight characters, take them a group at a time while there is room.
+    while (inputLength - inIndex >= 5 && outputLength - outIndex >= 8) {
+        const uint8_t* b = &in[inIndex];
+        uint64_t group = ((uint64_t) b[0])
+            | (((uint64_t) b[1]) << 8)
+            | (((uint64_t) b[2]) << 16)
+            | (((uint64_t) b[3]) << 24)
+            | (((uint64_t) b[4]) << 32);
+        output[outIndex++] = kChars[group & 31];
+        output[outIndex++] = kChars[(group >> 5) & 31];
+        output[outIndex++] = kChars[(group >> 10) & 31];
+        output[outIndex++] = kChars[(group >> 15) & 31];
+        output[outIndex++] = kChars[(group >> 20) & 31];
+        output[outIndex++] = kChars[(group >> 25) & 31];
+        output[outIndex++] = kChars[(group >> 30) & 31];
+        output[outIndex++] = kChars[(group >> 35) & 31];
+        inIndex += 5;
+    }
+
     while (inIndex < inputLength) {
         work |= ((unsigned) in[inIndex++]) << bits;
         bits += 8;
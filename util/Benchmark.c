@@ -0,0 +1,129 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "memory/Allocator.h"
+#include "util/Benchmark.h"
+#include "util/Order.h"
+#include "util/events/Time.h"
+
+#include <stdio.h>
+
+static uint64_t timeRun(const struct Benchmark_Case* bench, void* context, uint32_t count)
+{
+    uint64_t start = Time_hrtime();
+    bench->run(context, count);
+    return Time_hrtime() - start;
+}
+
+static int compareTimes(const void* a, const void* b)
+{
+    uint64_t x = *((uint64_t*) a);
+    uint64_t y = *((uint64_t*) b);
+    return (x > y) - (x < y);
+}
+
+static uint64_t squareRoot(uint64_t x)
+{
+    uint64_t root = 0;
+    for (uint64_t bit = 1ull << 62; bit; bit >>= 2) {
+        if (x >= root + bit) {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return root;
+}
+
+/** The standard deviation, the times are scaled down while squaring so they cannot overflow. */
+static uint64_t deviation(const uint64_t* times, int count, uint64_t mean)
+{
+    int shift = 0;
+    while ((times[count - 1] >> shift) > 0xffffffffull) {
+        shift++;
+    }
+    uint64_t sum = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t diff = ((times[i] > mean) ? times[i] - mean : mean - times[i]) >> shift;
+        sum += diff * diff / count;
+    }
+    return squareRoot(sum) << shift;
+}
+
+static void printTime(const char* label, uint64_t picoseconds)
+{
+    printf("  %s %u.%03uns",
+           label,
+           (unsigned) (picoseconds / 1000),
+           (unsigned) (picoseconds % 1000));
+}
+
+/** See: Benchmark.h */
+Dict* Benchmark_run(const struct Benchmark_Case* bench,
+                    struct Random* rand,
+                    struct Allocator* alloc)
+{
+    struct Allocator* caseAlloc = Allocator_child(alloc);
+    void* context = (bench->setUp) ? bench->setUp(rand, caseAlloc) : NULL;
+
+    uint32_t count = 1;
+    while (count < (1u << 30)
+        && timeRun(bench, context, count) < Benchmark_REPETITION_NANOSECONDS)
+    {
+        count *= 2;
+    }
+    for (int i = 0; i < Benchmark_WARMUP; i++) {
+        timeRun(bench, context, count);
+    }
+    uint64_t times[Benchmark_REPETITIONS];
+    uint64_t total = 0;
+    for (int i = 0; i < Benchmark_REPETITIONS; i++) {
+        times[i] = timeRun(bench, context, count) * 1000 / count;
+        total += times[i];
+    }
+    Allocator_free(caseAlloc);
+
+    Order_qsort(times, Benchmark_REPETITIONS, sizeof(uint64_t), compareTimes);
+    uint64_t min = times[0];
+    uint64_t median = times[Benchmark_REPETITIONS / 2];
+    uint64_t max = times[Benchmark_REPETITIONS - 1];
+    uint64_t mean = total / Benchmark_REPETITIONS;
+    uint64_t stddev = deviation(times, Benchmark_REPETITIONS, mean);
+
+    printf("%-40s", bench->name);
+    printTime("median", median);
+    printTime("min", min);
+    printf("  +-%u%%", (unsigned) ((mean) ? stddev * 100 / mean : 0));
+    if (bench->bytesPerOp && median) {
+        printf("  %uMB/s", (unsigned) ((uint64_t) bench->bytesPerOp * 1000000 / median));
+    }
+    printf("\n");
+
+    Dict* out = Dict_new(alloc);
+    Dict_putString(out, String_new("name", alloc), String_new(bench->name, alloc), alloc);
+    Dict_putInt(out, String_new("opsPerRepetition", alloc), count, alloc);
+    Dict_putInt(out, String_new("repetitions", alloc), Benchmark_REPETITIONS, alloc);
+    Dict_putInt(out, String_new("minPs", alloc), min, alloc);
+    Dict_putInt(out, String_new("medianPs", alloc), median, alloc);
+    Dict_putInt(out, String_new("meanPs", alloc), mean, alloc);
+    Dict_putInt(out, String_new("stddevPs", alloc), stddev, alloc);
+    Dict_putInt(out, String_new("maxPs", alloc), max, alloc);
+    if (bench->bytesPerOp) {
+        Dict_putInt(out, String_new("bytesPerOp", alloc), bench->bytesPerOp, alloc);
+    }
+    return out;
+}
@@ -0,0 +1,72 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef Benchmark_H
+#define Benchmark_H
+
+#include "benc/Dict.h"
+#include "crypto/random/Random.h"
+#include "memory/Allocator.h"
+#include "util/Linker.h"
+Linker_require("util/Benchmark.c")
+
+#include <stdint.h>
+
+/** Untimed repetitions of each case before the ones which are timed. */
+#define Benchmark_WARMUP 3
+
+/** Timed repetitions of each case, the results are summarized over these. */
+#define Benchmark_REPETITIONS 15
+
+/** The operations in one repetition are doubled until it takes at least this long. */
+#define Benchmark_REPETITION_NANOSECONDS 20000000
+
+/** A case which is timed by Benchmark_run(). */
+struct Benchmark_Case
+{
+    /** Identifies the case in the results which are compared from one commit to the next. */
+    const char* name;
+
+    /**
+     * Create whatever the case needs, this is not timed, may be NULL.
+     *
+     * @param rand a random generator, always seeded the same way.
+     * @param alloc freed once the case is done.
+     * @return the context which is passed to run().
+     */
+    void* (* setUp)(struct Random* rand, struct Allocator* alloc);
+
+    /** Do the operation which is being timed count times. */
+    void (* run)(void* context, uint32_t count);
+
+    /** Bytes which each operation processes, 0 if there is no sense in a throughput. */
+    uint32_t bytesPerOp;
+};
+
+/**
+ * Time a case and print a summary.
+ * The number of operations in a repetition is worked out first, then the case is repeated
+ * Benchmark_WARMUP times without timing and Benchmark_REPETITIONS times with.
+ *
+ * @param bench the case.
+ * @param rand passed to the setUp function of the case.
+ * @param alloc the results are allocated here.
+ * @return a dict with the name, the operations in each repetition and the min, median, mean,
+ *         standard deviation and max of the time of one operation in picoseconds.
+ */
+Dict* Benchmark_run(const struct Benchmark_Case* bench,
+                    struct Random* rand,
+                    struct Allocator* alloc);
+
+#endif
@@ -56,13 +56,10 @@ static inline int Bits_popCountx32(uint32_t number)
     return out;
 }
 
+/** Index of the highest set bit, log2(0) is 0. */
 static inline int Bits_log2x64(uint64_t number)
 {
-    int out = 0;
-    while (number >>= 1) {
-        out++;
-    }
-    return out;
+    return (number) ? 63 - __builtin_clzll(number) : 0;
 }
 
 /** Largest possible number whose log2 is bitCount. */
@@ -74,11 +71,7 @@ static inline uint64_t Bits_maxBits64(uint32_t bitCount)
 
 static inline int Bits_log2x32(uint32_t number)
 {
-    int out = 0;
-    while (number >>= 1) {
-        out++;
-    }
-    return out;
+    return (number) ? 31 - __builtin_clz(number) : 0;
 }
 
 static inline int Bits_log2x64_be(uint64_t number)
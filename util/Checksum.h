@@ -20,6 +20,12 @@
 
 #include <stdint.h>
 
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+#endif
+
 /**
  * buffer must be 2 byte aligned!
  */
@@ -27,8 +33,40 @@ static uint32_t Checksum_step(const uint8_t* buffer,
                               uint16_t length,
                               uint32_t state)
 {
+    uint32_t i = 0;
+
+    // Sum 16 bytes at a time into 32 bit lanes, a packet is at most 64k so no lane can overflow.
+    // The lanes are folded to 17 bits before adding them to the state so the state can't either.
+    #if defined(__SSE2__)
+        if (length >= 64) {
+            __m128i zero = _mm_setzero_si128();
+            __m128i sum = zero;
+            for (; i + 16 <= length; i += 16) {
+                __m128i words = _mm_loadu_si128((const __m128i*) &buffer[i]);
+                sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(words, zero));
+                sum = _mm_add_epi32(sum, _mm_unpackhi_epi16(words, zero));
+            }
+            uint32_t lanes[4];
+            _mm_storeu_si128((__m128i*) lanes, sum);
+            uint64_t total = (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            total = (total >> 16) + (total & 0xFFFF);
+            state += (total >> 16) + (total & 0xFFFF);
+        }
+    #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        if (length >= 64) {
+            uint32x4_t sum = vdupq_n_u32(0);
+            for (; i + 16 <= length; i += 16) {
+                sum = vpadalq_u16(sum, vreinterpretq_u16_u8(vld1q_u8(&buffer[i])));
+            }
+            uint64x2_t pairs = vpaddlq_u32(sum);
+            uint64_t total = vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1);
+            total = (total >> 16) + (total & 0xFFFF);
+            state += (total >> 16) + (total & 0xFFFF);
+        }
+    #endif
+
     // Checksum pairs.
-    for (uint32_t i = 0; i < length / 2; i++) {
+    for (i /= 2; i < length / 2u; i++) {
         state += ((uint16_t*) buffer)[i];
     }
 
@@ -66,6 +104,31 @@ static inline uint16_t Checksum_engine(const uint8_t* buffer, uint16_t length)
     return Checksum_complete(Checksum_step(buffer, length, 0));
 }
 
+/**
+ * Update a checksum to cover a change of some of the bytes which it covers without going over
+ * the rest of the packet again, see RFC 1624.
+ * The changed bytes must begin at an even offset from the start of the checksummed data.
+ *
+ * @param checksum_be the checksum as it is on the wire.
+ * @param oldBytes the bytes before they were changed.
+ * @param newBytes the bytes after they were changed.
+ * @param length the number of bytes which changed, must be even.
+ * @return the new checksum as it should be put on the wire.
+ */
+static inline uint16_t Checksum_update(uint16_t checksum_be,
+                                       const uint8_t* oldBytes,
+                                       const uint8_t* newBytes,
+                                       uint16_t length)
+{
+    Assert_true(!(length % 2));
+    uint32_t state = ~Endian_bigEndianToHost16(checksum_be) & 0xFFFF;
+    for (uint32_t i = 0; i < length; i += 2) {
+        state += ~((oldBytes[i] << 8) | oldBytes[i + 1]) & 0xFFFF;
+        state += (newBytes[i] << 8) | newBytes[i + 1];
+    }
+    return Endian_hostToBigEndian16(Checksum_complete(state));
+}
+
 /**
  * Generate a checksum for a generic content packet under an IPv6 header.
  * sourceAndDestAddrs and packetHeaderAndContent must be 2 byte aligned.
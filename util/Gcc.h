@@ -28,6 +28,9 @@
 #define Gcc_PURE \
     __attribute__ ((__pure__))
 
+#define Gcc_ALWAYS_INLINE \
+    __attribute__ ((__always_inline__))
+
 
 #else
 
@@ -35,6 +38,7 @@
 #define Gcc_NORETURN
 #define Gcc_NONNULL(num)
 #define Gcc_PURE
+#define Gcc_ALWAYS_INLINE
 
 #endif
 
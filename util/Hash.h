@@ -0,0 +1,41 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef Hash_H
+#define Hash_H
+
+#include <stdint.h>
+
+/**
+ * Mix the bits of a hash so that each bit of the input affects every bit of the output,
+ * this is the finalizer of MurmurHash3. Use it before taking a modulus or a mask of a hash
+ * which was built from fields that mostly differ in a few bits.
+ */
+static inline uint32_t Hash_mix32(uint32_t hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/** Add a 32 bit word to a hash, FNV-1a a word at a time, finish with Hash_mix32(). */
+static inline uint32_t Hash_add32(uint32_t hash, uint32_t word)
+{
+    return (hash ^ word) * 0x01000193;
+}
+
+#endif
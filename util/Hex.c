@@ -13,6 +13,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "util/Hex.h"
+#include "util/Bits.h"
+#include "util/Endian.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -42,7 +44,29 @@ int Hex_encode(uint8_t* output,
 
     static const char* hexEntities = "0123456789abcdef";
 
-    for (uint32_t i = 0; i < inputLength; i++) {
+    uint32_t i = 0;
+    if (!Endian_isBigEndian()) {
+        // Eight bytes at a time, each one in a 16 bit lane which then holds its two digits.
+        for (; i + 8 <= inputLength; i += 8) {
+            uint64_t chars[2];
+            for (int j = 0; j < 2; j++) {
+                const uint8_t* b = &in[i + j * 4];
+                uint64_t lanes = ((uint64_t) b[0])
+                    | (((uint64_t) b[1]) << 16)
+                    | (((uint64_t) b[2]) << 32)
+                    | (((uint64_t) b[3]) << 48);
+                uint64_t nibbles = ((lanes >> 4) & 0x000F000F000F000Full)
+                    | ((lanes & 0x000F000F000F000Full) << 8);
+
+                // Adding 6 carries exactly the nibbles 10 through 15 into bit 4, the letters.
+                uint64_t letters =
+                    ((nibbles + 0x0606060606060606ull) >> 4) & 0x0101010101010101ull;
+                chars[j] = nibbles + 0x3030303030303030ull + letters * ('a' - '0' - 10);
+            }
+            Bits_memcpyConst(&output[i * 2], chars, 16);
+        }
+    }
+    for (; i < inputLength; i++) {
         output[i * 2] = hexEntities[in[i] >> 4];
         output[i * 2 + 1] = hexEntities[in[i] & 15];
     }
@@ -70,7 +94,7 @@ int Hex_decode(uint8_t* output,
                const uint8_t* hex,
                const uint32_t length)
 {
-    if (length % 1) {
+    if (length % 2) {
         return Hex_BAD_INPUT;
     } else if (outLength < (length / 2)) {
         return Hex_TOO_BIG;
@@ -78,13 +102,14 @@ int Hex_decode(uint8_t* output,
         output[length / 2] = '\0';
     }
 
+    // Invalid characters are 99 in the table or have the high bit set, check once at the end.
+    uint32_t bad = 0;
     for (uint32_t i = 0; i < length; i += 2) {
-        int byte = Hex_decodeByte(hex[i], hex[i + 1]);
-        if (byte == -1) {
-            return Hex_BAD_INPUT;
-        }
-        output[i / 2] = (uint8_t) byte;
+        uint8_t high = numForAscii[hex[i] & 0x7f];
+        uint8_t low = numForAscii[hex[i + 1] & 0x7f];
+        bad |= high | low | ((hex[i] | hex[i + 1]) & 0x80);
+        output[i / 2] = (high << 4) | low;
     }
 
-    return length / 2;
+    return (bad > 15) ? Hex_BAD_INPUT : (int) (length / 2);
 }
@@ -0,0 +1,92 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "memory/Allocator.h"
+#include "util/Bits.h"
+#include "util/Histogram.h"
+
+/** The octave is the position of the highest set bit and the next two bits pick the quarter. */
+static int bucketFor(uint64_t value)
+{
+    if (value < 4) {
+        return value;
+    }
+    int octave = Bits_log2x64(value);
+    int bucket = octave * 4 + ((value >> (octave - 2)) & 3) - 4;
+    return (bucket < Histogram_BUCKETS) ? bucket : Histogram_BUCKETS - 1;
+}
+
+/** The largest value which falls in a bucket. */
+static uint64_t bucketTop(int bucket)
+{
+    if (bucket < 4) {
+        return bucket;
+    }
+    int octave = (bucket + 4) / 4;
+    return ((4ull | ((bucket + 4) % 4)) << (octave - 2)) + (1ull << (octave - 2)) - 1;
+}
+
+/** See: Histogram.h */
+void Histogram_add(struct Histogram* histogram, uint64_t value)
+{
+    histogram->count++;
+    histogram->total += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+    histogram->buckets[bucketFor(value)]++;
+}
+
+/** See: Histogram.h */
+void Histogram_merge(struct Histogram* into, const struct Histogram* from)
+{
+    into->count += from->count;
+    into->total += from->total;
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+    for (int i = 0; i < Histogram_BUCKETS; i++) {
+        into->buckets[i] += from->buckets[i];
+    }
+}
+
+/** See: Histogram.h */
+uint64_t Histogram_percentile(const struct Histogram* histogram, int percent)
+{
+    uint64_t target = (histogram->count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < Histogram_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= target && seen) {
+            uint64_t top = (i < Histogram_BUCKETS - 1) ? bucketTop(i) : histogram->max;
+            return (top < histogram->max) ? top : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/** See: Histogram.h */
+Dict* Histogram_toDict(const struct Histogram* histogram, struct Allocator* alloc)
+{
+    Dict* out = Dict_new(alloc);
+    Dict_putInt(out, String_new("count", alloc), histogram->count, alloc);
+    Dict_putInt(out, String_new("average", alloc), Histogram_average(histogram), alloc);
+    Dict_putInt(out, String_new("max", alloc), histogram->max, alloc);
+    Dict_putInt(out, String_new("p50", alloc), Histogram_percentile(histogram, 50), alloc);
+    Dict_putInt(out, String_new("p90", alloc), Histogram_percentile(histogram, 90), alloc);
+    Dict_putInt(out, String_new("p99", alloc), Histogram_percentile(histogram, 99), alloc);
+    return out;
+}
@@ -0,0 +1,71 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef Histogram_H
+#define Histogram_H
+
+#include "benc/Dict.h"
+#include "memory/Allocator.h"
+#include "util/Linker.h"
+Linker_require("util/Histogram.c")
+
+#include <stdint.h>
+
+/**
+ * Quarter octave buckets, values from 0 to 3 have a bucket each and then every power of two is
+ * split in four. A value is at most 25% below the top of its bucket, the last bucket holds
+ * everything from about 2^32 up.
+ */
+#define Histogram_BUCKETS (32 * 4)
+
+/**
+ * A histogram of latencies or other positive values, it is zeroed to begin and needs no
+ * allocation of its own so it can be a member of whatever collects the values.
+ */
+struct Histogram
+{
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint32_t buckets[Histogram_BUCKETS];
+};
+
+void Histogram_add(struct Histogram* histogram, uint64_t value);
+
+/** Add everything in one histogram to another, the sum is the same as if it got every value. */
+void Histogram_merge(struct Histogram* into, const struct Histogram* from);
+
+/**
+ * Get a percentile of the values.
+ *
+ * @param histogram the histogram.
+ * @param percent between 0 and 100.
+ * @return the top of the bucket which holds the percentile, or the largest value if that is
+ *         smaller, 0 if there are no values.
+ */
+uint64_t Histogram_percentile(const struct Histogram* histogram, int percent);
+
+static inline uint64_t Histogram_average(const struct Histogram* histogram)
+{
+    return (histogram->count) ? histogram->total / histogram->count : 0;
+}
+
+/**
+ * Get the histogram for the admin interface.
+ *
+ * @return a dict with count, average, max, p50, p90 and p99.
+ */
+Dict* Histogram_toDict(const struct Histogram* histogram, struct Allocator* alloc);
+
+#endif
@@ -17,6 +17,18 @@
 #endif // This header can be used multiple times as long as the name is different.
 
 #include "util/Bits.h"
+#include "util/Hash.h"
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+#endif
+
+/** Maps with at most this many entries are searched by scanning the hash codes directly. */
+#ifndef Map_SCAN_MAX
+    #define Map_SCAN_MAX 32
+#endif
 
 #if defined(Map_KEY_TYPE)
     Assert_compileTime(!(sizeof(Map_KEY_TYPE) % 4));
@@ -63,11 +75,29 @@ struct Map_CONTEXT
     #ifdef Map_ENABLE_KEYS
         uint32_t* hashCodes;
         Map_KEY_TYPE* keys;
+
+        /**
+         * Open addressed index of the entries by hash code, each slot holds the index of an
+         * entry plus one or zero if it is empty. The size is a power of 2 and at least twice
+         * the number of entries so probe sequences stay short.
+         */
+        uint32_t* table;
+        uint32_t tableSize;
     #endif
 
     #ifdef Map_ENABLE_HANDLES
         uint32_t* handles;
-        uint32_t nextHandle;
+
+        /**
+         * The low bits of a handle are the number of its slot so it can be found without a
+         * search. Each live slot holds the index of its entry and each free slot holds the
+         * number of the next free slot. The handle which will be given out next from each slot
+         * is kept so that stale handles are not recycled right away.
+         */
+        uint32_t* slotIndexes;
+        uint32_t* slotHandles;
+        uint32_t slotCount;
+        uint32_t freeSlot;
     #endif
 
     Map_VALUE_TYPE* values;
@@ -85,15 +115,121 @@ static inline struct Map_CONTEXT* Map_FUNCTION(new)(struct Allocator* allocator)
     }));
 }
 
+#ifdef Map_ENABLE_KEYS
+/** Spread the hash code so that keys which differ only in the high bits are not clustered. */
+static inline uint32_t Map_FUNCTION(slotForHash)(uint32_t hashCode, struct Map_CONTEXT* map)
+{
+    return Hash_mix32(hashCode) & (map->tableSize - 1);
+}
+
+/** @return the slot in the table which points to the entry at index. */
+static inline uint32_t Map_FUNCTION(slotForIndex)(uint32_t index, struct Map_CONTEXT* map)
+{
+    uint32_t slot = Map_FUNCTION(slotForHash)(map->hashCodes[index], map);
+    while (map->table[slot] != index + 1) {
+        slot = (slot + 1) & (map->tableSize - 1);
+    }
+    return slot;
+}
+
+static inline void Map_FUNCTION(tableInsert)(uint32_t index, struct Map_CONTEXT* map)
+{
+    uint32_t slot = Map_FUNCTION(slotForHash)(map->hashCodes[index], map);
+    while (map->table[slot]) {
+        slot = (slot + 1) & (map->tableSize - 1);
+    }
+    map->table[slot] = index + 1;
+}
+
+/** Empty a slot and shift back any entries after it which would otherwise become unreachable. */
+static inline void Map_FUNCTION(tableRemove)(uint32_t slot, struct Map_CONTEXT* map)
+{
+    uint32_t mask = map->tableSize - 1;
+    for (uint32_t next = (slot + 1) & mask; map->table[next]; next = (next + 1) & mask) {
+        uint32_t home = Map_FUNCTION(slotForHash)(map->hashCodes[map->table[next] - 1], map);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            map->table[slot] = map->table[next];
+            slot = next;
+        }
+    }
+    map->table[slot] = 0;
+}
+
+static inline void Map_FUNCTION(rehash)(uint32_t tableSize, struct Map_CONTEXT* map)
+{
+    map->table = Allocator_realloc(map->allocator, map->table, sizeof(uint32_t) * tableSize);
+    Bits_memset(map->table, 0, sizeof(uint32_t) * tableSize);
+    map->tableSize = tableSize;
+    for (uint32_t i = 0; i < map->count; i++) {
+        Map_FUNCTION(tableInsert)(i, map);
+    }
+}
+
+/**
+ * Compare the hash code against 4 entries at a time, in a small map this beats probing
+ * the table because the hash codes are contiguous and there is no slot to compute.
+ */
+static inline int Map_FUNCTION(scanForKey)(Map_KEY_TYPE* key,
+                                           uint32_t hashCode,
+                                           struct Map_CONTEXT* map)
+{
+    uint32_t i = 0;
+    #if defined(__SSE2__)
+        __m128i needle = _mm_set1_epi32((int) hashCode);
+        for (; i + 4 <= map->count; i += 4) {
+            __m128i codes = _mm_loadu_si128((__m128i*) &map->hashCodes[i]);
+            uint64_t hits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(codes, needle)));
+            for (; hits; hits &= hits - 1) {
+                uint32_t j = i + Bits_ffs64(hits) - 1;
+                if (Map_FUNCTION(compare)(key, &map->keys[j]) == 0) {
+                    return j;
+                }
+            }
+        }
+    #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        uint32x4_t needle = vdupq_n_u32(hashCode);
+        for (; i + 4 <= map->count; i += 4) {
+            uint32x4_t eq = vceqq_u32(vld1q_u32(&map->hashCodes[i]), needle);
+            // Narrow each lane to 16 bits so the whole result fits in one 64 bit word.
+            uint64_t hits = vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(eq)), 0);
+            while (hits) {
+                uint32_t lane = (Bits_ffs64(hits) - 1) / 16;
+                if (Map_FUNCTION(compare)(key, &map->keys[i + lane]) == 0) {
+                    return i + lane;
+                }
+                hits &= ~(((uint64_t) 0xffff) << (lane * 16));
+            }
+        }
+    #endif
+    for (; i < map->count; i++) {
+        if (map->hashCodes[i] == hashCode
+            && Map_FUNCTION(compare)(key, &map->keys[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
 /**
  * This is a very hot loop,
  * a large amount of code relies on this being fast so it is a good target for optimization.
  */
-#ifdef Map_ENABLE_KEYS
 static inline int Map_FUNCTION(indexForKey)(Map_KEY_TYPE* key, struct Map_CONTEXT* map)
 {
+    if (!map->count) {
+        return -1;
+    }
     uint32_t hashCode = (Map_FUNCTION(hash)(key));
-    for (uint32_t i = 0; i < map->count; i++) {
+    if (map->count <= Map_SCAN_MAX) {
+        return Map_FUNCTION(scanForKey)(key, hashCode, map);
+    }
+    uint32_t mask = map->tableSize - 1;
+    for (uint32_t slot = Map_FUNCTION(slotForHash)(hashCode, map);
+         map->table[slot];
+         slot = (slot + 1) & mask)
+    {
+        uint32_t i = map->table[slot] - 1;
         if (map->hashCodes[i] == hashCode
             && Map_FUNCTION(compare)(key, &map->keys[i]) == 0)
         {
@@ -107,19 +243,47 @@ static inline int Map_FUNCTION(indexForKey)(Map_KEY_TYPE* key, struct Map_CONTEX
 #ifdef Map_ENABLE_HANDLES
 static inline int Map_FUNCTION(indexForHandle)(uint32_t handle, struct Map_CONTEXT* map)
 {
-    uint32_t base = 0;
-    for (uint32_t bufferLen = map->count; bufferLen != 0; bufferLen /= 2) {
-        uint32_t currentHandle = map->handles[base + (bufferLen / 2)];
-        if (handle >= currentHandle) {
-            if (currentHandle == handle) {
-                return base + (bufferLen / 2);
-            }
-            base += (bufferLen / 2) + 1;
-            bufferLen--;
-        }
+    if (!map->count) {
+        return -1;
+    }
+    // A free slot may hold anything but no live entry with this handle can be found through it.
+    uint32_t index = map->slotIndexes[handle & (map->slotCount - 1)];
+    if (index < map->count && map->handles[index] == handle) {
+        return index;
     }
     return -1;
 }
+
+/**
+ * Double the number of slots, each new handle must still be congruent to its slot and
+ * greater than every handle which was given out from the slot it used to map to.
+ */
+static inline void Map_FUNCTION(growSlots)(struct Map_CONTEXT* map)
+{
+    uint32_t oldCount = map->slotCount;
+    uint32_t slotCount = (oldCount) ? oldCount * 2 : 16;
+    map->slotIndexes =
+        Allocator_realloc(map->allocator, map->slotIndexes, sizeof(uint32_t) * slotCount);
+    map->slotHandles =
+        Allocator_realloc(map->allocator, map->slotHandles, sizeof(uint32_t) * slotCount);
+    for (uint32_t i = slotCount; i-- > 0;) {
+        uint32_t next = (oldCount) ? map->slotHandles[i & (oldCount - 1)] : 0;
+        map->slotHandles[i] = next + ((i - next) & (slotCount - 1));
+        map->slotIndexes[i] = UINT32_MAX;
+    }
+    map->slotCount = slotCount;
+
+    for (uint32_t i = 0; i < map->count; i++) {
+        map->slotIndexes[map->handles[i] & (slotCount - 1)] = i;
+    }
+    map->freeSlot = UINT32_MAX;
+    for (uint32_t i = slotCount; i-- > 0;) {
+        if (map->slotIndexes[i] == UINT32_MAX) {
+            map->slotIndexes[i] = map->freeSlot;
+            map->freeSlot = i;
+        }
+    }
+}
 #endif
 
 /**
@@ -129,34 +293,35 @@ static inline int Map_FUNCTION(indexForHandle)(uint32_t handle, struct Map_CONTE
  */
 static inline int Map_FUNCTION(remove)(int index, struct Map_CONTEXT* map)
 {
+    #ifdef Map_ENABLE_KEYS
+        if (index >= 0 && index < (int) map->count) {
+            Map_FUNCTION(tableRemove)(Map_FUNCTION(slotForIndex)(index, map), map);
+            // The last entry is about to be moved into index.
+            if (index < (int) map->count - 1) {
+                map->table[Map_FUNCTION(slotForIndex)(map->count - 1, map)] = index + 1;
+            }
+        }
+    #endif
+    #ifdef Map_ENABLE_HANDLES
+        if (index >= 0 && index < (int) map->count) {
+            uint32_t slot = map->handles[index] & (map->slotCount - 1);
+            map->slotIndexes[slot] = map->freeSlot;
+            map->freeSlot = slot;
+            if (index < (int) map->count - 1) {
+                uint32_t last = map->handles[map->count - 1];
+                map->slotIndexes[last & (map->slotCount - 1)] = index;
+                map->handles[index] = last;
+            }
+        }
+    #endif
     if (index >= 0 && index < (int) map->count - 1) {
-        #ifdef Map_ENABLE_HANDLES
-            // If we use handels then we need to keep the map sorted.
-            #ifdef Map_ENABLE_KEYS
-                Bits_memmove(&map->hashCodes[index],
-                             &map->hashCodes[index + 1],
-                             (map->count - index - 1) * sizeof(uint32_t));
-
-                Bits_memmove(&map->keys[index],
-                             &map->keys[index + 1],
-                             (map->count - index - 1) * sizeof(Map_KEY_TYPE));
-            #endif
-            Bits_memmove(&map->handles[index],
-                         &map->handles[index + 1],
-                         (map->count - index - 1) * sizeof(uint32_t));
-
-            Bits_memmove(&map->values[index],
-                         &map->values[index + 1],
-                         (map->count - index - 1) * sizeof(Map_VALUE_TYPE));
-
-            map->count--;
-        #else
-            // No handles, we can just fold the top entry down on one to remove.
-            map->count--;
+        // Fold the top entry down on the one which is removed.
+        map->count--;
+        #ifdef Map_ENABLE_KEYS
             map->hashCodes[index] = map->hashCodes[map->count];
             Bits_memcpyConst(&map->keys[index], &map->keys[map->count], sizeof(Map_KEY_TYPE));
-            Bits_memcpyConst(&map->values[index], &map->values[map->count], sizeof(Map_VALUE_TYPE));
         #endif
+        Bits_memcpyConst(&map->values[index], &map->values[map->count], sizeof(Map_VALUE_TYPE));
         return 0;
     } else if (index == (int) map->count - 1) {
         map->count--;
@@ -175,26 +340,28 @@ static inline int Map_FUNCTION(put)(Map_VALUE_TYPE* value,
 #endif
 {
     if (map->count == map->capacity) {
+        // Grow by half again so that filling a large map does not copy it over and over.
+        uint32_t capacity = map->capacity + 10 + map->capacity / 2;
         #ifdef Map_ENABLE_KEYS
             map->hashCodes = Allocator_realloc(map->allocator,
                                                map->hashCodes,
-                                               sizeof(uint32_t) * (map->count + 10));
+                                               sizeof(uint32_t) * capacity);
             map->keys = Allocator_realloc(map->allocator,
                                           map->keys,
-                                          sizeof(Map_KEY_TYPE) * (map->count + 10));
+                                          sizeof(Map_KEY_TYPE) * capacity);
         #endif
 
         #ifdef Map_ENABLE_HANDLES
             map->handles = Allocator_realloc(map->allocator,
                                              map->handles,
-                                             sizeof(uint32_t) * (map->count + 10));
+                                             sizeof(uint32_t) * capacity);
         #endif
 
         map->values = Allocator_realloc(map->allocator,
                                         map->values,
-                                        sizeof(Map_VALUE_TYPE) * (map->count + 10));
+                                        sizeof(Map_VALUE_TYPE) * capacity);
 
-        map->capacity += 10;
+        map->capacity = capacity;
     }
 
     int i = -1;
@@ -205,13 +372,25 @@ static inline int Map_FUNCTION(put)(Map_VALUE_TYPE* value,
 
     if (i < 0) {
         i = map->count;
-        map->count++;
         #ifdef Map_ENABLE_HANDLES
-            map->handles[i] = map->nextHandle++;
+            if (map->count == map->slotCount) {
+                Map_FUNCTION(growSlots)(map);
+            }
+            uint32_t slot = map->freeSlot;
+            map->freeSlot = map->slotIndexes[slot];
+            map->slotIndexes[slot] = i;
+            map->handles[i] = map->slotHandles[slot];
+            map->slotHandles[slot] += map->slotCount;
         #endif
+        map->count++;
         #ifdef Map_ENABLE_KEYS
             map->hashCodes[i] = (Map_FUNCTION(hash)(key));
             Bits_memcpyConst(&map->keys[i], key, sizeof(Map_KEY_TYPE));
+            if (map->count * 2 > map->tableSize) {
+                Map_FUNCTION(rehash)((map->tableSize) ? map->tableSize * 2 : 16, map);
+            } else {
+                Map_FUNCTION(tableInsert)(i, map);
+            }
         #endif
     }
 
@@ -0,0 +1,127 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "util/Assert.h"
+#include "util/Histogram.h"
+#include "util/Metrics.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+struct Metrics* Metrics_new(struct Allocator* alloc)
+{
+    return Allocator_calloc(alloc, sizeof(struct Metrics), 1);
+}
+
+static struct Metrics_Entry* addEntry(struct Metrics* metrics,
+                                      enum Metrics_Type type,
+                                      const char* name,
+                                      const char* help)
+{
+    Assert_true(metrics->count < Metrics_MAX_ENTRIES);
+    struct Metrics_Entry* entry = &metrics->entries[metrics->count++];
+    entry->name = name;
+    entry->help = help;
+    entry->type = type;
+    return entry;
+}
+
+void Metrics_addCounter(struct Metrics* metrics,
+                        const char* name,
+                        const char* help,
+                        const uint64_t* value)
+{
+    addEntry(metrics, Metrics_Type_COUNTER, name, help)->value = value;
+}
+
+void Metrics_addRead(struct Metrics* metrics,
+                     enum Metrics_Type type,
+                     const char* name,
+                     const char* help,
+                     Metrics_Read read,
+                     void* context)
+{
+    Assert_true(type != Metrics_Type_SUMMARY);
+    struct Metrics_Entry* entry = addEntry(metrics, type, name, help);
+    entry->read = read;
+    entry->context = context;
+}
+
+void Metrics_addHistogram(struct Metrics* metrics,
+                          const char* name,
+                          const char* help,
+                          const struct Histogram* histogram)
+{
+    addEntry(metrics, Metrics_Type_SUMMARY, name, help)->histogram = histogram;
+}
+
+static const char* typeName(enum Metrics_Type type)
+{
+    switch (type) {
+        case Metrics_Type_COUNTER: return "counter";
+        case Metrics_Type_GAUGE: return "gauge";
+        default: return "summary";
+    }
+}
+
+static int writeEntry(struct Metrics_Entry* entry, char* buff, int length)
+{
+    const char* name = entry->name;
+    int len = snprintf(buff, length, "# HELP %s %s\n# TYPE %s %s\n",
+                       name, entry->help, name, typeName(entry->type));
+    if (len < 0 || len >= length) {
+        return -1;
+    }
+    int total = len;
+
+    if (entry->histogram) {
+        const struct Histogram* h = entry->histogram;
+        len = snprintf(&buff[total], length - total,
+                       "%s{quantile=\"0.5\"} %" PRIu64 "\n"
+                       "%s{quantile=\"0.9\"} %" PRIu64 "\n"
+                       "%s{quantile=\"0.99\"} %" PRIu64 "\n"
+                       "%s_sum %" PRIu64 "\n"
+                       "%s_count %" PRIu64 "\n",
+                       name, Histogram_percentile(h, 50),
+                       name, Histogram_percentile(h, 90),
+                       name, Histogram_percentile(h, 99),
+                       name, h->total,
+                       name, h->count);
+    } else {
+        uint64_t value = (entry->value) ? *entry->value : entry->read(entry->context);
+        len = snprintf(&buff[total], length - total, "%s %" PRIu64 "\n", name, value);
+    }
+    if (len < 0 || len >= length - total) {
+        return -1;
+    }
+    return total + len;
+}
+
+int Metrics_write(struct Metrics* metrics, char* buff, int length)
+{
+    if (length < 1) {
+        return -1;
+    }
+    buff[0] = '\0';
+    int total = 0;
+    for (int i = 0; i < metrics->count; i++) {
+        int len = writeEntry(&metrics->entries[i], &buff[total], length - total);
+        if (len < 0) {
+            return -1;
+        }
+        total += len;
+    }
+    return total;
+}
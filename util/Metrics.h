@@ -0,0 +1,117 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef Metrics_H
+#define Metrics_H
+
+#include "memory/Allocator.h"
+#include "util/Histogram.h"
+#include "util/Linker.h"
+Linker_require("util/Metrics.c")
+
+#include <stdint.h>
+
+/** The most metrics which can be registered. */
+#define Metrics_MAX_ENTRIES 64
+
+enum Metrics_Type
+{
+    /** A count which only goes up. */
+    Metrics_Type_COUNTER,
+
+    /** A value which goes up and down such as the size of a table. */
+    Metrics_Type_GAUGE,
+
+    /** The count, sum and percentiles of a Histogram. */
+    Metrics_Type_SUMMARY
+};
+
+/** Called to read a value when the metrics are written out. */
+typedef uint64_t (* Metrics_Read)(void* context);
+
+struct Metrics_Entry
+{
+    const char* name;
+    const char* help;
+    enum Metrics_Type type;
+
+    /** Where the value is read from, exactly one of these is non-NULL. */
+    const uint64_t* value;
+    Metrics_Read read;
+    const struct Histogram* histogram;
+
+    void* context;
+};
+
+/**
+ * A registry of the counters, gauges and histograms which modules keep anyway.
+ * The registry only holds pointers to them so registering and updating a metric never
+ * allocates and writing them out reads them in place, names and help strings must outlive
+ * the registry. Values are written in the Prometheus text exposition format.
+ */
+struct Metrics
+{
+    int count;
+    struct Metrics_Entry entries[Metrics_MAX_ENTRIES];
+};
+
+struct Metrics* Metrics_new(struct Allocator* alloc);
+
+/**
+ * Register a counter which is kept as a plain integer.
+ *
+ * @param metrics the registry.
+ * @param name the name of the metric, by convention it begins with cjdns_ and ends with _total.
+ * @param help a one line description.
+ * @param value the counter.
+ */
+void Metrics_addCounter(struct Metrics* metrics,
+                        const char* name,
+                        const char* help,
+                        const uint64_t* value);
+
+/**
+ * Register a counter or gauge which is computed when it is read.
+ *
+ * @param metrics the registry.
+ * @param type Metrics_Type_COUNTER or Metrics_Type_GAUGE.
+ * @param name the name of the metric.
+ * @param help a one line description.
+ * @param read the function which returns the value.
+ * @param context passed to read.
+ */
+void Metrics_addRead(struct Metrics* metrics,
+                     enum Metrics_Type type,
+                     const char* name,
+                     const char* help,
+                     Metrics_Read read,
+                     void* context);
+
+/** Register a histogram, it is written as a summary with the 50th, 90th and 99th percentiles. */
+void Metrics_addHistogram(struct Metrics* metrics,
+                          const char* name,
+                          const char* help,
+                          const struct Histogram* histogram);
+
+/**
+ * Write out every metric.
+ *
+ * @param metrics the registry.
+ * @param buff the buffer to write the text to, it is null terminated.
+ * @param length the size of the buffer, including space for the null.
+ * @return the length of the text or -1 if it did not fit in the buffer.
+ */
+int Metrics_write(struct Metrics* metrics, char* buff, int length);
+
+#endif
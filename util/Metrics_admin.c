@@ -0,0 +1,88 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/String.h"
+#include "exception/Jmp.h"
+#include "util/events/MetricsServer.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Metrics.h"
+#include "util/Metrics_admin.h"
+
+struct Context
+{
+    struct Metrics* metrics;
+    struct EventBase* base;
+    struct Log* logger;
+    struct Admin* admin;
+    struct Allocator* alloc;
+
+    /** NULL until Metrics_listen() is called. */
+    struct MetricsServer* server;
+};
+
+static void metricsListen(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = vcontext;
+    String* bind = Dict_getString(args, String_CONST("bind"));
+    char* err = "none";
+    struct Sockaddr_storage addr;
+    struct Jmp jmp;
+
+    if (ctx->server) {
+        err = "Already serving metrics";
+    } else if (Sockaddr_parse(bind->bytes, &addr)) {
+        err = "Failed to parse address";
+    } else {
+        struct Allocator* alloc = Allocator_child(ctx->alloc);
+        Jmp_try(jmp) {
+            ctx->server = MetricsServer_new(ctx->metrics,
+                                            &addr.addr,
+                                            ctx->base,
+                                            alloc,
+                                            &jmp.handler,
+                                            ctx->logger);
+        } Jmp_catch {
+            Allocator_free(alloc);
+            String* jmpErr = String_new(jmp.message, requestAlloc);
+            Dict out = Dict_CONST(String_CONST("error"), String_OBJ(jmpErr), NULL);
+            Admin_sendMessage(&out, txid, ctx->admin);
+            return;
+        }
+    }
+
+    Dict out = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(err)), NULL);
+    Admin_sendMessage(&out, txid, ctx->admin);
+}
+
+void Metrics_admin_register(struct Metrics* metrics,
+                            struct EventBase* base,
+                            struct Log* logger,
+                            struct Admin* admin,
+                            struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .metrics = metrics,
+        .base = base,
+        .logger = logger,
+        .admin = admin,
+        .alloc = alloc
+    }));
+
+    Admin_registerFunction("Metrics_listen", metricsListen, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "bind", .required = 1, .type = "String" }
+        }), admin);
+}
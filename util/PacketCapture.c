@@ -0,0 +1,226 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/CString.h"
+#include "util/PacketCapture.h"
+#include "util/events/Time.h"
+
+static const char* const POINT_NAMES[PacketCapture_Point_COUNT] = {
+    [PacketCapture_Point_LINK_IN] = "linkIn",
+    [PacketCapture_Point_SWITCH_IN] = "switchIn",
+    [PacketCapture_Point_SWITCH_OUT] = "switchOut",
+    [PacketCapture_Point_LINK_OUT] = "linkOut",
+    [PacketCapture_Point_TUN_IN] = "tunIn"
+};
+
+/** At the beginning of each slot of the ring, followed by the captured bytes. */
+struct Record
+{
+    /** Time_hrtime() when the packet was captured. */
+    uint64_t time;
+
+    /** The length of the packet and how much of it was kept. */
+    uint32_t length;
+    uint16_t captured;
+
+    uint8_t point;
+};
+
+#define BLOCK_SECTION_HEADER 0x0A0D0D0A
+#define BLOCK_INTERFACE_DESCRIPTION 1
+#define BLOCK_ENHANCED_PACKET 6
+#define BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define OPTION_END 0
+#define OPTION_IF_NAME 2
+#define OPTION_IF_TSRESOL 9
+
+/** Blocks and options are padded to 32 bits. */
+#define PAD4(x) (((x) + 3) & ~3u)
+
+static inline uint32_t slotSize(struct PacketCapture* capture)
+{
+    return sizeof(struct Record) + ((capture->snapLength + 7) & ~7u);
+}
+
+static inline struct Record* slot(struct PacketCapture* capture, uint64_t number)
+{
+    return (struct Record*) &capture->ring[(number % PacketCapture_SLOTS) * slotSize(capture)];
+}
+
+static uint8_t* put16(uint8_t* out, uint16_t value)
+{
+    Bits_memcpy(out, &value, 2);
+    return out + 2;
+}
+
+static uint8_t* put32(uint8_t* out, uint32_t value)
+{
+    Bits_memcpy(out, &value, 4);
+    return out + 4;
+}
+
+static uint8_t* putOption(uint8_t* out, uint16_t code, const void* value, uint16_t length)
+{
+    out = put16(out, code);
+    out = put16(out, length);
+    if (length) {
+        Bits_memset(out, 0, PAD4(length));
+        Bits_memcpy(out, value, length);
+    }
+    return out + PAD4(length);
+}
+
+/** Write the total length at both ends of a block which begins at block and ends at end. */
+static uint8_t* closeBlock(uint8_t* block, uint8_t* end)
+{
+    uint32_t length = end - block + 4;
+    put32(block + 4, length);
+    return put32(end, length);
+}
+
+/** The section header and a description of each point, in host byte order as pcapng allows. */
+static uint8_t* putHeader(struct PacketCapture* capture, uint8_t* out)
+{
+    uint8_t* block = out;
+    out = put32(out, BLOCK_SECTION_HEADER);
+    out += 4;
+    out = put32(out, BYTE_ORDER_MAGIC);
+    out = put16(out, 1);
+    out = put16(out, 0);
+    // The length of the section is not known.
+    out = put32(out, 0xffffffff);
+    out = put32(out, 0xffffffff);
+    out = closeBlock(block, out);
+
+    for (int i = 0; i < PacketCapture_Point_COUNT; i++) {
+        block = out;
+        out = put32(out, BLOCK_INTERFACE_DESCRIPTION);
+        out += 4;
+        out = put16(out, PacketCapture_LINKTYPE);
+        out = put16(out, 0);
+        out = put32(out, capture->snapLength);
+        out = putOption(out, OPTION_IF_NAME, POINT_NAMES[i], CString_strlen(POINT_NAMES[i]));
+        // Timestamps are in nanoseconds.
+        uint8_t resolution = 9;
+        out = putOption(out, OPTION_IF_TSRESOL, &resolution, 1);
+        out = putOption(out, OPTION_END, NULL, 0);
+        out = closeBlock(block, out);
+    }
+    return out;
+}
+
+static uint8_t* putPacket(struct PacketCapture* capture, struct Record* record, uint8_t* out)
+{
+    uint64_t time = capture->wallTime + (record->time - capture->hrtime);
+    uint8_t* block = out;
+    out = put32(out, BLOCK_ENHANCED_PACKET);
+    out += 4;
+    out = put32(out, record->point);
+    out = put32(out, time >> 32);
+    out = put32(out, time);
+    out = put32(out, record->captured);
+    out = put32(out, record->length);
+    Bits_memset(out, 0, PAD4(record->captured));
+    Bits_memcpy(out, &record[1], record->captured);
+    out += PAD4(record->captured);
+    return closeBlock(block, out);
+}
+
+/** See: PacketCapture.h */
+uint32_t PacketCapture_read(struct PacketCapture* capture, uint8_t* out, uint32_t length)
+{
+    Assert_true(length >= PacketCapture_MAX_SNAP_LENGTH + 256);
+    if (!capture->ring) {
+        return 0;
+    }
+    uint8_t* begin = out;
+    if (!capture->headerRead) {
+        out = putHeader(capture, out);
+        capture->headerRead = true;
+    }
+    while (capture->read < capture->written) {
+        struct Record* record = slot(capture, capture->read);
+        if ((uint32_t) (out - begin) + 32 + PAD4(record->captured) > length) {
+            break;
+        }
+        out = putPacket(capture, record, out);
+        capture->read++;
+    }
+    return out - begin;
+}
+
+/** See: PacketCapture.h */
+void PacketCapture_copy(struct PacketCapture* capture,
+                        enum PacketCapture_Point point,
+                        struct Message* msg)
+{
+    if (capture->written - capture->read == PacketCapture_SLOTS) {
+        capture->read++;
+        capture->lost++;
+    }
+    struct Record* record = slot(capture, capture->written++);
+    record->time = Time_hrtime();
+    record->length = msg->length;
+    record->captured = ((uint32_t) msg->length < capture->snapLength)
+        ? (uint32_t) msg->length : capture->snapLength;
+    record->point = point;
+    Bits_memcpy(&record[1], msg->bytes, record->captured);
+}
+
+/** See: PacketCapture.h */
+void PacketCapture_start(struct PacketCapture* capture,
+                         uint32_t points,
+                         uint32_t sampleEvery,
+                         uint32_t snapLength)
+{
+    Assert_true(points && sampleEvery);
+    Assert_true(snapLength && snapLength <= PacketCapture_MAX_SNAP_LENGTH);
+    if (capture->ringAlloc) {
+        Allocator_free(capture->ringAlloc);
+    }
+    capture->ringAlloc = Allocator_child(capture->alloc);
+    capture->snapLength = snapLength;
+    capture->ring = Allocator_malloc(capture->ringAlloc, PacketCapture_SLOTS * slotSize(capture));
+    capture->written = capture->read = capture->lost = 0;
+    capture->headerRead = false;
+    capture->wallTime = Time_currentTimeMilliseconds(capture->eventBase) * 1000000;
+    capture->hrtime = Time_hrtime();
+    capture->sampleEvery = sampleEvery;
+    capture->unsampled = 0;
+    capture->points = points;
+}
+
+/** See: PacketCapture.h */
+void PacketCapture_stop(struct PacketCapture* capture)
+{
+    capture->points = 0;
+}
+
+/** See: PacketCapture.h */
+const char* PacketCapture_pointName(enum PacketCapture_Point point)
+{
+    return (point < PacketCapture_Point_COUNT) ? POINT_NAMES[point] : "invalid";
+}
+
+/** See: PacketCapture.h */
+struct PacketCapture* PacketCapture_new(struct EventBase* eventBase, struct Allocator* alloc)
+{
+    struct PacketCapture* capture = Allocator_calloc(alloc, sizeof(struct PacketCapture), 1);
+    capture->alloc = alloc;
+    capture->eventBase = eventBase;
+    return capture;
+}
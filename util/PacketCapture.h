@@ -0,0 +1,161 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PacketCapture_H
+#define PacketCapture_H
+
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "wire/Message.h"
+#include "util/Linker.h"
+Linker_require("util/PacketCapture.c")
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Each place where packets can be captured, they are the interfaces in the pcapng output. */
+enum PacketCapture_Point
+{
+    /** As it comes from a link, before the peer's CryptoAuth decrypts it. */
+    PacketCapture_Point_LINK_IN,
+
+    /** Decrypted by the peer's CryptoAuth on the way into the switch. */
+    PacketCapture_Point_SWITCH_IN,
+
+    /** Out of the switch toward a peer, before the peer's CryptoAuth encrypts it. */
+    PacketCapture_Point_SWITCH_OUT,
+
+    /** Encrypted by the peer's CryptoAuth just before it is sent on a link. */
+    PacketCapture_Point_LINK_OUT,
+
+    /** An IP packet from the TUN before Ducttape routes it, these can be replayed. */
+    PacketCapture_Point_TUN_IN,
+
+    PacketCapture_Point_COUNT
+};
+
+/**
+ * Captured packets are kept in this many slots, once they are all full the oldest is dropped to
+ * make room for the next.
+ */
+#define PacketCapture_SLOTS 512
+
+#define PacketCapture_MAX_SNAP_LENGTH 2048
+
+/**
+ * The pcapng link type, LINKTYPE_USER0, for all capture points. The data of each packet is exactly
+ * the bytes of the message at that point so the switch points begin with the switch header, the
+ * link points begin with the CryptoAuth header and the TUN point begins with the IP header.
+ */
+#define PacketCapture_LINKTYPE 147
+
+/**
+ * Copies packets into a ring while it is on, when it is off all that is done for a packet is
+ * to check that no capture point is on.
+ */
+struct PacketCapture
+{
+    /** Bit (1 << point) is set for each point which is captured, 0 if capture is off. */
+    uint32_t points;
+
+    /** Capture one in this many packets which pass a captured point. */
+    uint32_t sampleEvery;
+
+    /** Packets since the last one which was captured. */
+    uint32_t unsampled;
+
+    /** The number of bytes of each packet which are kept. */
+    uint32_t snapLength;
+
+    /** Count of packets which were captured and which were read, the ring is the difference. */
+    uint64_t written;
+    uint64_t read;
+
+    /** Packets which were captured but dropped before they were read. */
+    uint64_t lost;
+
+    /** Nanoseconds since the epoch, at the time given by (hrtime), when capture was started. */
+    uint64_t wallTime;
+    uint64_t hrtime;
+
+    /** True once the section and interface blocks are read for the current capture. */
+    bool headerRead;
+
+    /** PacketCapture_SLOTS, each of a record followed by snapLength bytes, NULL until started. */
+    uint8_t* ring;
+
+    /** Holds the ring, replaced when capture is started again. */
+    struct Allocator* ringAlloc;
+
+    struct Allocator* alloc;
+    struct EventBase* eventBase;
+};
+
+struct PacketCapture* PacketCapture_new(struct EventBase* eventBase, struct Allocator* alloc);
+
+/** @return the name of the point as it is used in admin and the pcapng interface name. */
+const char* PacketCapture_pointName(enum PacketCapture_Point point);
+
+/**
+ * Start capturing, anything captured before which was not read is dropped.
+ *
+ * @param capture the capture.
+ * @param points bit (1 << point) set for each point to capture, must be non-zero.
+ * @param sampleEvery capture one of this many packets, must be non-zero.
+ * @param snapLength keep this many bytes of each packet, up to PacketCapture_MAX_SNAP_LENGTH.
+ */
+void PacketCapture_start(struct PacketCapture* capture,
+                         uint32_t points,
+                         uint32_t sampleEvery,
+                         uint32_t snapLength);
+
+/** Stop capturing, what was captured can still be read. */
+void PacketCapture_stop(struct PacketCapture* capture);
+
+/**
+ * Read what has been captured as pcapng, the first read after a start begins with the section
+ * header and an interface description for each point so the output of successive reads can be
+ * concatenated into one file.
+ *
+ * @param capture the capture.
+ * @param out the buffer to write to.
+ * @param length the size of the buffer, at least PacketCapture_MAX_SNAP_LENGTH + 256.
+ * @return the number of bytes which were written, 0 if nothing was ever captured.
+ */
+uint32_t PacketCapture_read(struct PacketCapture* capture, uint8_t* out, uint32_t length);
+
+void PacketCapture_copy(struct PacketCapture* capture,
+                        enum PacketCapture_Point point,
+                        struct Message* msg);
+
+/**
+ * Call with each packet which passes a point.
+ *
+ * @param capture the capture, if NULL then nothing is captured.
+ * @param point where the packet is.
+ * @param msg the packet, it is not changed.
+ */
+static inline void PacketCapture_tap(struct PacketCapture* capture,
+                                     enum PacketCapture_Point point,
+                                     struct Message* msg)
+{
+    if (capture && (capture->points & (1u << point))) {
+        if (++capture->unsampled >= capture->sampleEvery) {
+            capture->unsampled = 0;
+            PacketCapture_copy(capture, point, msg);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,124 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/Int.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "util/CString.h"
+#include "util/PacketCapture.h"
+#include "util/PacketCapture_admin.h"
+
+/** The most pcapng which is sent in one response, well inside of Admin_MAX_RESPONSE_SIZE. */
+#define READ_MAX 32768
+
+struct Context
+{
+    struct PacketCapture* capture;
+    struct Admin* admin;
+};
+
+static void sendError(char* err, String* txid, struct Admin* admin)
+{
+    Dict d = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(err)), NULL);
+    Admin_sendMessage(&d, txid, admin);
+}
+
+/** @return the bit for each of the named points, 0 if any name is not a point. */
+static uint32_t parsePoints(List* names)
+{
+    uint32_t points = 0;
+    for (int i = 0; i < List_size(names); i++) {
+        String* name = List_getString(names, i);
+        int point = 0;
+        while (name && point < PacketCapture_Point_COUNT
+            && CString_strcmp(name->bytes, PacketCapture_pointName(point)))
+        {
+            point++;
+        }
+        if (!name || point == PacketCapture_Point_COUNT) {
+            return 0;
+        }
+        points |= 1u << point;
+    }
+    return points;
+}
+
+static void start(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    List* names = Dict_getList(args, String_CONST("points"));
+    int64_t* sampleEvery = Dict_getInt(args, String_CONST("sampleEvery"));
+    int64_t* snapLength = Dict_getInt(args, String_CONST("snapLength"));
+
+    uint32_t points = (names) ? parsePoints(names) : (1u << PacketCapture_Point_COUNT) - 1;
+    if (!points) {
+        sendError("points must be a list of linkIn, switchIn, switchOut, linkOut and tunIn.",
+                  txid, context->admin);
+    } else if (sampleEvery && (*sampleEvery < 1 || *sampleEvery > UINT32_MAX)) {
+        sendError("sampleEvery must be between 1 and 2^32-1.", txid, context->admin);
+    } else if (snapLength && (*snapLength < 1 || *snapLength > PacketCapture_MAX_SNAP_LENGTH)) {
+        sendError("snapLength must be between 1 and 2048.", txid, context->admin);
+    } else {
+        PacketCapture_start(context->capture,
+                            points,
+                            (sampleEvery) ? *sampleEvery : 1,
+                            (snapLength) ? *snapLength : 128);
+        sendError("none", txid, context->admin);
+    }
+}
+
+static void stop(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    PacketCapture_stop(context->capture);
+    sendError("none", txid, context->admin);
+}
+
+static void readCapture(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    struct PacketCapture* capture = context->capture;
+    String* pcapng = String_newBinary(NULL, READ_MAX, requestAlloc);
+    pcapng->len = PacketCapture_read(capture, (uint8_t*) pcapng->bytes, READ_MAX);
+    Dict response = Dict_CONST(
+        String_CONST("error"), String_OBJ(String_CONST("none")), Dict_CONST(
+        String_CONST("lost"), Int_OBJ(capture->lost), Dict_CONST(
+        String_CONST("more"), Int_OBJ(capture->written - capture->read), Dict_CONST(
+        String_CONST("pcapng"), String_OBJ(pcapng), NULL
+    ))));
+    Admin_sendMessage(&response, txid, context->admin);
+}
+
+void PacketCapture_admin_register(struct PacketCapture* capture,
+                                  struct Admin* admin,
+                                  struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .capture = capture,
+        .admin = admin
+    }));
+
+    Admin_registerFunction("PacketCapture_start", start, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "points", .required = 0, .type = "List" },
+            { .name = "sampleEvery", .required = 0, .type = "Int" },
+            { .name = "snapLength", .required = 0, .type = "Int" }
+        }), admin);
+
+    Admin_registerFunction("PacketCapture_stop", stop, ctx, true, NULL, admin);
+
+    Admin_registerFunction("PacketCapture_read", readCapture, ctx, true, NULL, admin);
+}
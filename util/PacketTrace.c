@@ -0,0 +1,70 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "util/Bits.h"
+#include "util/PacketTrace.h"
+#include "util/events/Time.h"
+
+static const char* const STAGE_NAMES[PacketTrace_Stage_COUNT] = {
+    [PacketTrace_Stage_LINK_DECRYPT] = "linkDecrypt",
+    [PacketTrace_Stage_SWITCH] = "switch",
+    [PacketTrace_Stage_DUCTTAPE_DECRYPT] = "ducttapeDecrypt",
+    [PacketTrace_Stage_TO_TUN] = "toTun",
+    [PacketTrace_Stage_DUCTTAPE_ENCRYPT] = "ducttapeEncrypt",
+    [PacketTrace_Stage_LINK_ENCRYPT] = "linkEncrypt",
+    [PacketTrace_Stage_TOTAL] = "total"
+};
+
+/** See: PacketTrace.h */
+void PacketTrace_start(struct PacketTrace* trace)
+{
+    Bits_memset(trace->stageNs, 0, sizeof(trace->stageNs));
+    trace->timeBegan = trace->stageBegan = Time_hrtime();
+    trace->active = true;
+}
+
+/** See: PacketTrace.h */
+void PacketTrace_finish(struct PacketTrace* trace, enum PacketTrace_Stage stage)
+{
+    PacketTrace_stamp(trace, stage);
+    trace->active = false;
+    trace->stageNs[PacketTrace_Stage_TOTAL] = trace->stageBegan - trace->timeBegan;
+    for (int i = 0; i < PacketTrace_Stage_COUNT; i++) {
+        if (trace->stageNs[i]) {
+            Histogram_add(&trace->histograms[i], trace->stageNs[i]);
+        }
+    }
+}
+
+/** See: PacketTrace.h */
+void PacketTrace_setSampling(struct PacketTrace* trace, uint32_t sampleEvery)
+{
+    trace->sampleEvery = sampleEvery;
+    trace->untraced = 0;
+    trace->active = false;
+    Bits_memset(trace->histograms, 0, sizeof(trace->histograms));
+}
+
+/** See: PacketTrace.h */
+const char* PacketTrace_stageName(enum PacketTrace_Stage stage)
+{
+    return (stage < PacketTrace_Stage_COUNT) ? STAGE_NAMES[stage] : "invalid";
+}
+
+/** See: PacketTrace.h */
+struct PacketTrace* PacketTrace_new(struct Allocator* alloc)
+{
+    return Allocator_calloc(alloc, sizeof(struct PacketTrace), 1);
+}
@@ -0,0 +1,130 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PacketTrace_H
+#define PacketTrace_H
+
+#include "memory/Allocator.h"
+#include "util/Histogram.h"
+#include "util/events/Time.h"
+#include "util/Linker.h"
+Linker_require("util/PacketTrace.c")
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Each part of the path of a packet through the node, a stage is timed from the end of the stage
+ * before it. A packet may go through a stage more than once, for example when it is decrypted
+ * by two layers of CryptoAuth in Ducttape, the times are summed.
+ */
+enum PacketTrace_Stage
+{
+    /** From the link until the peer's CryptoAuth has decrypted it and hands it to the switch. */
+    PacketTrace_Stage_LINK_DECRYPT,
+
+    /** Through the switch to a peer or to Ducttape. */
+    PacketTrace_Stage_SWITCH,
+
+    /** Through Ducttape until a layer of CryptoAuth has decrypted it. */
+    PacketTrace_Stage_DUCTTAPE_DECRYPT,
+
+    /** Through Ducttape until it is written to the TUN. */
+    PacketTrace_Stage_TO_TUN,
+
+    /** Through Ducttape until a layer of CryptoAuth has encrypted it. */
+    PacketTrace_Stage_DUCTTAPE_ENCRYPT,
+
+    /** From the switch until the peer's CryptoAuth has encrypted it and it is sent on the link. */
+    PacketTrace_Stage_LINK_ENCRYPT,
+
+    /** The whole time from when the packet came in to when it went out. */
+    PacketTrace_Stage_TOTAL,
+
+    PacketTrace_Stage_COUNT
+};
+
+/**
+ * Samples the time which packets spend in each stage.
+ * A packet is handled from the link or TUN where it comes in all the way to the link or TUN where
+ * it goes out in one call from the event loop so only one packet at a time is traced and the
+ * trace lives here rather than with the message.
+ */
+struct PacketTrace
+{
+    /** Trace one in this many packets, 0 to trace none. Change with PacketTrace_setSampling(). */
+    uint32_t sampleEvery;
+
+    /** Packets since the last one which was traced. */
+    uint32_t untraced;
+
+    /** True while a packet is being traced. */
+    bool active;
+
+    uint64_t timeBegan;
+    uint64_t stageBegan;
+    uint64_t stageNs[PacketTrace_Stage_COUNT];
+
+    /** Nanoseconds in each stage of the traced packets which went through it. */
+    struct Histogram histograms[PacketTrace_Stage_COUNT];
+};
+
+struct PacketTrace* PacketTrace_new(struct Allocator* alloc);
+
+/** Change the sampling rate and forget everything which was traced before. */
+void PacketTrace_setSampling(struct PacketTrace* trace, uint32_t sampleEvery);
+
+/** @return the name of the stage as it appears in the admin output. */
+const char* PacketTrace_stageName(enum PacketTrace_Stage stage);
+
+void PacketTrace_start(struct PacketTrace* trace);
+
+void PacketTrace_finish(struct PacketTrace* trace, enum PacketTrace_Stage stage);
+
+/**
+ * Call when a packet comes in from a link or the TUN.
+ *
+ * @param trace the trace, if NULL then nothing is traced.
+ */
+static inline void PacketTrace_begin(struct PacketTrace* trace)
+{
+    if (!trace) {
+        return;
+    }
+    trace->active = false;
+    if (trace->sampleEvery && ++trace->untraced >= trace->sampleEvery) {
+        trace->untraced = 0;
+        PacketTrace_start(trace);
+    }
+}
+
+/** Call when the packet which is being handled has been through a stage. */
+static inline void PacketTrace_stamp(struct PacketTrace* trace, enum PacketTrace_Stage stage)
+{
+    if (trace && trace->active) {
+        uint64_t now = Time_hrtime();
+        trace->stageNs[stage] += now - trace->stageBegan;
+        trace->stageBegan = now;
+    }
+}
+
+/** Call when the packet which is being handled is sent out on a link or the TUN. */
+static inline void PacketTrace_end(struct PacketTrace* trace, enum PacketTrace_Stage stage)
+{
+    if (trace && trace->active) {
+        PacketTrace_finish(trace, stage);
+    }
+}
+
+#endif
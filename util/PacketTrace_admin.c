@@ -0,0 +1,75 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/Int.h"
+#include "benc/String.h"
+#include "util/Histogram.h"
+#include "util/PacketTrace.h"
+#include "util/PacketTrace_admin.h"
+
+struct Context
+{
+    struct PacketTrace* trace;
+    struct Admin* admin;
+};
+
+static void setSampling(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    int64_t* sampleEvery = Dict_getInt(args, String_CONST("sampleEvery"));
+    char* err = "none";
+    if (*sampleEvery < 0 || *sampleEvery > UINT32_MAX) {
+        err = "sampleEvery must be between 0 and 2^32-1.";
+    } else {
+        PacketTrace_setSampling(context->trace, *sampleEvery);
+    }
+    Dict d = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(err)), NULL);
+    Admin_sendMessage(&d, txid, context->admin);
+}
+
+static void stats(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* context = vcontext;
+    Dict* stages = Dict_new(requestAlloc);
+    for (int i = 0; i < PacketTrace_Stage_COUNT; i++) {
+        Dict_putDict(stages,
+                     String_new(PacketTrace_stageName(i), requestAlloc),
+                     Histogram_toDict(&context->trace->histograms[i], requestAlloc),
+                     requestAlloc);
+    }
+    Dict response = Dict_CONST(
+        String_CONST("sampleEvery"), Int_OBJ(context->trace->sampleEvery), Dict_CONST(
+        String_CONST("stages"), Dict_OBJ(stages), NULL
+    ));
+    Admin_sendMessage(&response, txid, context->admin);
+}
+
+void PacketTrace_admin_register(struct PacketTrace* trace,
+                                struct Admin* admin,
+                                struct Allocator* alloc)
+{
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .trace = trace,
+        .admin = admin
+    }));
+
+    Admin_registerFunction("PacketTrace_setSampling", setSampling, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "sampleEvery", .required = 1, .type = "Int" }
+        }), admin);
+
+    Admin_registerFunction("PacketTrace_stats", stats, ctx, false, NULL, admin);
+}
@@ -0,0 +1,48 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef Probe_H
+#define Probe_H
+
+/**
+ * Static tracepoints at the events which matter for following the router in production with
+ * bpftrace or perf, they are all in the provider "cjdns", eg:
+ *
+ *     bpftrace -e 'usdt:./cjdroute:cjdns:switchForward { @[arg1] = count(); }'
+ *
+ * switchForward(sourceIndex, destIndex, length) a packet was switched.
+ * decryptFail(nonce, length) a packet of an established CryptoAuth session did not decrypt.
+ * sessionNew(ip6, handle) a session with a node was created, ip6 points to 16 bytes.
+ * searchBegin(target, priority) a search was started, target points to 16 bytes.
+ * searchEnd(target, requests) a search was freed, found or not.
+ * nodeAdd(ip6, path, reach) a path to a node was entered in the NodeStore.
+ * nodeEvict(ip6, path, reach) a path to a node was removed from the NodeStore.
+ *
+ * The probes are compiled in when Probe_USDT is defined, the build defines it if USDT_PROBES is
+ * set in the environment and it needs <sys/sdt.h> from systemtap. A probe which is compiled in
+ * is a nop until a tracer attaches, otherwise the probes are nothing at all and their arguments
+ * are not evaluated so they must not have side effects.
+ */
+#ifdef Probe_USDT
+    #include <sys/sdt.h>
+    #define Probe_fire2(name, a, b) \
+        DTRACE_PROBE2(cjdns, name, a, b)
+    #define Probe_fire3(name, a, b, c) \
+        DTRACE_PROBE3(cjdns, name, a, b, c)
+#else
+    #define Probe_fire2(name, a, b)
+    #define Probe_fire3(name, a, b, c)
+#endif
+
+#endif
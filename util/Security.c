@@ -43,7 +43,7 @@ int Security_setUser(char* userName, struct Log* logger, struct Except* eh)
     return 0;
 }
 
-static void noFiles(struct Except* eh)
+static void noFiles(int spareFiles, struct Except* eh)
 {
     #if !defined(RLIMIT_NOFILE) && defined(RLIMIT_OFILE)
         #define RLIMIT_NOFILE RLIMIT_OFILE
@@ -54,9 +54,14 @@ static void noFiles(struct Except* eh)
         Except_throw(eh, "Unable to dupe stdin");
     }
     close(file);
-    if (setrlimit(RLIMIT_NOFILE, &(struct rlimit){ 0, 0 })) {
+    // New descriptors are always the lowest free number so this leaves room for spareFiles more.
+    rlim_t limit = (spareFiles > 0) ? file + spareFiles : 0;
+    if (setrlimit(RLIMIT_NOFILE, &(struct rlimit){ limit, limit })) {
         Except_throw(eh, "Failed to set open file limit to [%s]", strerror(errno));
     }
+    if (spareFiles > 0) {
+        return;
+    }
     file = dup(0);
     close(file);
     if (file >= 0) {
@@ -96,10 +101,10 @@ static void maxMemory(unsigned long max, struct Except* eh)
     }
 }
 
-void Security_dropPermissions(struct Except* eh)
+void Security_dropPermissions(int spareFiles, struct Except* eh)
 {
     maxMemory(100000000, eh);
-    noFiles(eh);
+    noFiles(spareFiles, eh);
 return;
     noForks(eh);
 }
@@ -28,6 +28,13 @@
 #define Security_setUser_PERMISSION -1
 int Security_setUser(char* userName, struct Log* logger, struct Except* eh);
 
-void Security_dropPermissions(struct Except* eh);
+/**
+ * Limit the memory of the process and stop it from opening files or sockets.
+ *
+ * @param spareFiles the number of descriptors which can still be opened, for servers which
+ *                   must accept connections, 0 for none.
+ * @param eh the handler for failure to drop the permissions.
+ */
+void Security_dropPermissions(int spareFiles, struct Except* eh);
 
 #endif
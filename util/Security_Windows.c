@@ -23,6 +23,6 @@ int Security_setUser(char* userName, struct Log* logger, struct Except* eh)
     return 0;
 }
 
-void Security_dropPermissions(struct Except* eh)
+void Security_dropPermissions(int spareFiles, struct Except* eh)
 {
 }
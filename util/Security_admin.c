@@ -53,8 +53,9 @@ static void dropPermissions(Dict* args, void* vctx, String* txid, struct Allocat
 {
     struct Context* const ctx = (struct Context*) vctx;
     struct Jmp jmp;
+    int64_t* spareFiles = Dict_getInt(args, String_CONST("spareFiles"));
     Jmp_try(jmp) {
-        Security_dropPermissions(&jmp.handler);
+        Security_dropPermissions((spareFiles) ? *spareFiles : 0, &jmp.handler);
     } Jmp_catch {
         sendError(jmp.message, txid, ctx->admin);
         return;
@@ -72,5 +73,8 @@ void Security_admin_register(struct Allocator* alloc, struct Log* logger, struct
         { .name = "user", .required = 1, .type = "String" }
     };
     Admin_registerFunction("Security_setUser", setUser, ctx, true, setUserArgs, admin);
-    Admin_registerFunction("Security_dropPermissions", dropPermissions, ctx, true, NULL, admin);
+    Admin_registerFunction("Security_dropPermissions", dropPermissions, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "spareFiles", .required = 0, .type = "Int" }
+        }), admin);
 }
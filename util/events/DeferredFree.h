@@ -0,0 +1,39 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DeferredFree_H
+#define DeferredFree_H
+
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/DeferredFree.c")
+
+/** The number of allocators which are freed in each turn of the event loop. */
+#ifndef DeferredFree_BATCH
+    #define DeferredFree_BATCH 64
+#endif
+
+/**
+ * Free an allocator a little at a time over the following turns of the event loop so that
+ * freeing a large tree does not stall it, see Allocator_freeSome().
+ * If the allocator's parent is freed first, whatever is left is freed along with it.
+ * This uses Allocator_onFree() on toFree so it cannot be used with a scratch allocator.
+ *
+ * @param toFree the allocator to free, it must not be used again after this call.
+ * @param eventBase the event base to use.
+ */
+void DeferredFree_free(struct Allocator* toFree, struct EventBase* eventBase);
+
+#endif
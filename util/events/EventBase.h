@@ -19,17 +19,101 @@
 #include "util/Linker.h"
 Linker_require("util/events/libuv/EventBase.c")
 
+#include <stdint.h>
+
 struct EventBase
 {
-    int unused;
+    /** The uv loop's time at the start of the current iteration in milliseconds, see Time.h. */
+    const uint64_t* loopTime;
+
+    /** Added to loopTime to make milliseconds since the epoch. */
+    uint64_t baseTime;
+};
+
+/** Where a callback from the event loop came from, see: EventBase_Stats. */
+enum EventBase_Source
+{
+    EventBase_Source_TIMER,
+    EventBase_Source_UDP,
+    EventBase_Source_TCP,
+    EventBase_Source_PIPE,
+    EventBase_Source_EVENT,
+    EventBase_Source_DEVICE,
+    EventBase_Source_MAILBOX,
+    EventBase_Source_COUNT
+};
+
+/** Callbacks which take longer than this are counted as stalls unless it is changed. */
+#define EventBase_STALL_MILLISECONDS 100
+
+/** Where the time of the event loop goes, see: EventBase_stats(). */
+struct EventBase_Stats
+{
+    /**
+     * Nanoseconds which were spent running callbacks and waiting for events since the loop
+     * began, the waiting is only measured for a loop which is not virtual.
+     */
+    uint64_t busyNanoseconds;
+    uint64_t idleNanoseconds;
+
+    /** The number of callbacks from each source. */
+    uint64_t callbacks[EventBase_Source_COUNT];
+
+    /** The longest callback, reset this to 0 to find the longest over an interval. */
+    uint64_t longestNanoseconds;
+    enum EventBase_Source longestSource;
+
+    /** The number of callbacks which took longer than stallNanoseconds. */
+    uint64_t stalls;
+    uint64_t stallNanoseconds;
 };
 
 struct EventBase* EventBase_new(struct Allocator* alloc);
 
+/**
+ * Create an event base with a clock of its own which only moves when EventBase_beginLoop()
+ * jumps it forward to the next timeout, so a run takes as long as the work in it and gives the
+ * same result every time. Only timeouts are supported, this is for simulating many nodes in one
+ * process, see test/Simulator.h.
+ */
+struct EventBase* EventBase_newVirtual(struct Allocator* alloc);
+
 int EventBase_eventCount(struct EventBase* eventBase);
 
 void EventBase_beginLoop(struct EventBase* eventBase);
 
 void EventBase_endLoop(struct EventBase* eventBase);
 
+/**
+ * Keep running the loop without blocking for up to this many microseconds after the last
+ * event before waiting for the next one, this trades CPU for the time which it takes to wake
+ * up. The period is halved each time it passes without an event and grows back when events
+ * come sooner than it after blocking. Sockets which are opened afterward are also asked to
+ * busy poll their device with SO_BUSY_POLL where it is supported.
+ * Zero, the default, never spins. A virtual event base ignores this.
+ */
+void EventBase_setBusyPoll(struct EventBase* eventBase, uint32_t microseconds);
+
+/** @return the microseconds given to EventBase_setBusyPoll(). */
+uint32_t EventBase_busyPoll(struct EventBase* eventBase);
+
+/** The most microseconds which EventBase_setBusyPoll() accepts. */
+#define EventBase_MAX_BUSY_POLL_MICROSECONDS 100000
+
+/**
+ * Run the thread of the event loop only on the CPUs whose bits are set in cpuMask, bit 0 is
+ * CPU 0. Must be called on the thread of the loop. Threads of the thread pool which are started
+ * afterward inherit the mask, as does memory first touched afterward on NUMA systems which
+ * place pages on the node of the CPU which touches them first.
+ *
+ * @return 0 if the mask was applied, -1 if it was empty, refused or is not supported here.
+ */
+int EventBase_setCpuAffinity(struct EventBase* eventBase, uint64_t cpuMask);
+
+/** Get the statistics of the loop, stallNanoseconds may be changed. */
+struct EventBase_Stats* EventBase_stats(struct EventBase* eventBase);
+
+/** The name of a source of callbacks, eg: "timer" */
+const char* EventBase_sourceName(enum EventBase_Source source);
+
 #endif
@@ -0,0 +1,38 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef EventBase_admin_H
+#define EventBase_admin_H
+
+#include "admin/Admin.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/log/Log.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/EventBase_admin.c")
+
+/** How often the loop is checked for stalls and the interval statistics are taken. */
+#define EventBase_admin_INTERVAL_MILLISECONDS 10000
+
+/**
+ * Register the admin functions for the event loop statistics, see: EventBase_Stats.
+ * Every EventBase_admin_INTERVAL_MILLISECONDS a warning is logged if any callback took longer
+ * than the stall threshold.
+ */
+void EventBase_admin_register(struct EventBase* base,
+                              struct Log* logger,
+                              struct Admin* admin,
+                              struct Allocator* alloc);
+
+#endif
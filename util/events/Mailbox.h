@@ -0,0 +1,56 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef Mailbox_H
+#define Mailbox_H
+
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/Mailbox.c")
+
+/**
+ * A way for other threads to hand work to an event loop. Any number of threads may post
+ * messages without locking and each message is passed to the callback on the loop's own thread,
+ * messages from one thread arrive in the order which they were posted.
+ *
+ * Allocators are not shared between threads so a message must be memory which the sender is
+ * able to give away, from the time it is posted the message belongs to the receiver.
+ */
+struct Mailbox_Message
+{
+    /** Used by the mailbox. */
+    struct Mailbox_Message* next;
+};
+
+typedef void (* Mailbox_OnMessage)(struct Mailbox_Message* msg, void* context);
+
+struct Mailbox;
+
+/**
+ * @param onMessage called on the event loop for each message.
+ * @param context passed to onMessage.
+ * @param eventBase the event loop to deliver messages on.
+ * @param alloc freeing this discards any messages not yet delivered, nothing may post to the
+ *              mailbox after it is freed.
+ */
+struct Mailbox* Mailbox_new(Mailbox_OnMessage onMessage,
+                            void* context,
+                            struct EventBase* eventBase,
+                            struct Allocator* alloc);
+
+/** Post a message, this may be called from any thread. */
+void Mailbox_post(struct Mailbox* mailbox, struct Mailbox_Message* msg);
+
+#endif
@@ -0,0 +1,60 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MetricsServer_H
+#define MetricsServer_H
+
+#include "exception/Except.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/log/Log.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Metrics.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/MetricsServer.c")
+
+/** Largest request which will be read, the rest of a bigger request is not looked at. */
+#define MetricsServer_MAX_REQUEST 2048
+
+/** Space for the metrics text of one response. */
+#define MetricsServer_MAX_RESPONSE 65536
+
+/** Connections which have not sent a whole request by then are closed. */
+#define MetricsServer_TIMEOUT_MILLISECONDS 5000
+
+struct MetricsServer
+{
+    /** The address which the server is listening on. */
+    struct Sockaddr* addr;
+};
+
+/**
+ * Serve the metrics over HTTP so that they can be scraped, GET /metrics returns them in the
+ * text exposition format and the connection is closed after each response.
+ *
+ * @param metrics the registry to serve.
+ * @param bindAddr the address to listen on, it should normally be a loopback address.
+ * @param base the event loop.
+ * @param alloc freeing this stops the server.
+ * @param eh the handler for failure to bind.
+ * @param logger
+ */
+struct MetricsServer* MetricsServer_new(struct Metrics* metrics,
+                                        struct Sockaddr* bindAddr,
+                                        struct EventBase* base,
+                                        struct Allocator* alloc,
+                                        struct Except* eh,
+                                        struct Log* logger);
+
+#endif
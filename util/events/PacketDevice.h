@@ -0,0 +1,57 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PacketDevice_H
+#define PacketDevice_H
+
+#include "exception/Except.h"
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/log/Log.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/PacketDevice.c")
+
+/**
+ * A file descriptor which reads and writes whole packets, such as a TUN device.
+ * Unlike Pipe there is no stream buffering, every read() is one message and every message
+ * is written with one write().
+ */
+struct PacketDevice
+{
+    struct Interface iface;
+};
+
+#define PacketDevice_PADDING_AMOUNT Interface_PADDING
+#define PacketDevice_BUFFER_CAP 4000
+
+/** Maximum number of packets read each time the device becomes readable. */
+#define PacketDevice_READ_BATCH 32
+
+/**
+ * @param fd the file descriptor, it will be made non-blocking and closed when alloc is freed.
+ * @param bufferSize the largest packet which can be read, usually PacketDevice_BUFFER_CAP.
+ * @param base the event loop.
+ * @param logger
+ * @param eh
+ * @param alloc
+ */
+struct PacketDevice* PacketDevice_forFd(int fd,
+                                        uint32_t bufferSize,
+                                        struct EventBase* base,
+                                        struct Log* logger,
+                                        struct Except* eh,
+                                        struct Allocator* alloc);
+
+#endif
@@ -46,7 +46,7 @@ struct Pipe
     struct Log* logger;
 };
 
-#define Pipe_PADDING_AMOUNT 512
+#define Pipe_PADDING_AMOUNT Interface_PADDING
 #define Pipe_BUFFER_CAP 4000
 
 struct Pipe* Pipe_named(const char* name,
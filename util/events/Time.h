@@ -24,8 +24,19 @@ Linker_require("util/events/libuv/Time.c")
 /** Nanosecond time which has no relationship to any wall clock. */
 uint64_t Time_hrtime();
 
-uint64_t Time_currentTimeMilliseconds(struct EventBase* eventBase);
+/**
+ * Milliseconds since the epoch as of the start of the current event loop iteration.
+ * Everything handled in one iteration sees the same time and reading it costs a load and an add
+ * so it is fine to call for every packet.
+ */
+static inline uint64_t Time_currentTimeMilliseconds(struct EventBase* eventBase)
+{
+    return *eventBase->loopTime + eventBase->baseTime;
+}
 
-uint64_t Time_currentTimeSeconds(struct EventBase* eventBase);
+static inline uint64_t Time_currentTimeSeconds(struct EventBase* eventBase)
+{
+    return Time_currentTimeMilliseconds(eventBase) / 1024;
+}
 
 #endif
@@ -0,0 +1,46 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WorkQueue_H
+#define WorkQueue_H
+
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/Linker.h"
+Linker_require("util/events/libuv/WorkQueue.c")
+
+/**
+ * Run a function on a thread from the event base's thread pool and then call another one back
+ * on the event loop when it's done. The number of threads in the pool is set by the
+ * UV_THREADPOOL_SIZE environment variable and defaults to 4.
+ *
+ * The work function runs concurrently with the event loop so it must not allocate, log or
+ * touch anything that it does not have to itself until onComplete is called.
+ *
+ * @param work the function to run on the thread pool.
+ * @param onComplete the function to call on the event loop once work has returned.
+ * @param callbackContext a pointer to be passed to both functions.
+ * @param eventBase the event base to use.
+ * @param allocator the memory allocator to create the job with, if this is freed before the
+ *                  job is complete, freeing waits until work has returned and onComplete is
+ *                  not called.
+ * @return 0 if the job was queued, -1 otherwise.
+ */
+int WorkQueue_run(void (* const work)(void* callbackContext),
+                  void (* const onComplete)(void* callbackContext),
+                  void* const callbackContext,
+                  struct EventBase* eventBase,
+                  struct Allocator* allocator);
+
+#endif
@@ -0,0 +1,81 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "memory/Allocator.h"
+#include "util/events/libuv/EventBase_pvt.h"
+#include "util/events/DeferredFree.h"
+#include "util/events/Timeout.h"
+#include "util/Identity.h"
+
+struct DeferredFree
+{
+    /** The allocator which is being freed. */
+    struct Allocator* toFree;
+
+    /** Called when toFree is finally freed, by us or by its parent. */
+    struct Allocator_OnFreeJob* onFreed;
+
+    /** Holds this structure and the timeout, a child of the event base's allocator. */
+    struct Allocator* alloc;
+
+    struct Timeout* timeout;
+
+    Identity
+};
+
+static void tick(void* vdf)
+{
+    struct DeferredFree* df = Identity_cast((struct DeferredFree*) vdf);
+    // If this frees toFree then toFreeFreed() has freed df too.
+    if (Allocator_freeSome(df->toFree, DeferredFree_BATCH)) {
+        Timeout_resetTimeout(df->timeout, 0);
+    }
+}
+
+static int toFreeFreed(struct Allocator_OnFreeJob* job)
+{
+    struct DeferredFree* df = Identity_cast((struct DeferredFree*) job->userData);
+    df->onFreed = NULL;
+    Allocator_free(df->alloc);
+    return 0;
+}
+
+static int eventBaseFreed(struct Allocator_OnFreeJob* job)
+{
+    struct DeferredFree* df = Identity_cast((struct DeferredFree*) job->userData);
+    if (df->onFreed) {
+        // The event loop is going away, finish the job right now.
+        Allocator_cancelOnFree(df->onFreed);
+        df->onFreed = NULL;
+        Allocator_free(df->toFree);
+    }
+    return 0;
+}
+
+/** See: DeferredFree.h */
+void DeferredFree_free(struct Allocator* toFree, struct EventBase* eventBase)
+{
+    struct EventBase_pvt* base = EventBase_privatize(eventBase);
+    struct Allocator* alloc = Allocator_child(base->alloc);
+    struct DeferredFree* df = Allocator_clone(alloc, (&(struct DeferredFree) {
+        .toFree = toFree,
+        .alloc = alloc
+    }));
+    Identity_set(df);
+
+    df->onFreed = Allocator_onFree(toFree, toFreeFreed, df);
+    Allocator_onFree(alloc, eventBaseFreed, df);
+    df->timeout = Timeout_setTimeout(tick, df, 0, eventBase, alloc);
+}
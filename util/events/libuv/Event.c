@@ -31,7 +31,7 @@ struct Event_pvt
     Identity
 };
 
-static void handleEvent(uv_poll_t* handle, int status, int events)
+static void handleEvent2(uv_poll_t* handle, int status, int events)
 {
     struct Event_pvt* event =
         Identity_cast((struct Event_pvt*) (((char*)handle) - offsetof(struct Event_pvt, handler)));
@@ -41,6 +41,14 @@ static void handleEvent(uv_poll_t* handle, int status, int events)
     }
 }
 
+static void handleEvent(uv_poll_t* handle, int status, int events)
+{
+    uv_loop_t* loop = handle->loop;
+    uint64_t begin = EventBase_callbackBegin();
+    handleEvent2(handle, status, events);
+    EventBase_callbackEnd(loop, EventBase_Source_EVENT, begin);
+}
+
 static void freeEvent2(uv_handle_t* handle)
 {
     Allocator_onFreeComplete((struct Allocator_OnFreeJob*)handle->data);
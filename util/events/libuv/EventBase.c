@@ -18,6 +18,10 @@
 #include "util/Assert.h"
 #include "util/Identity.h"
 
+#ifdef linux
+    #include <sched.h>
+#endif
+
 #ifdef win32
     #include <sys/timeb.h>
     #include <time.h>
@@ -56,7 +60,56 @@ static void calibrateTime(struct EventBase_pvt* base)
         milliseconds = tv.tv_usec / 1000;
     #endif
 
-    base->baseTime = (seconds * 1000) + milliseconds - uv_now(base->loop);
+    base->pub.baseTime = (seconds * 1000) + milliseconds - uv_now(base->loop);
+}
+
+static void beforePoll(uv_prepare_t* handle, int status)
+{
+    struct EventBase_pvt* base = Identity_cast((struct EventBase_pvt*) handle->data);
+    uint64_t now = uv_hrtime();
+    base->stats.busyNanoseconds += now - base->timeOfLastPoll;
+    base->timeOfLastPoll = now;
+    base->pollCallbackNanoseconds = 0;
+    base->inPoll = 1;
+}
+
+static void afterPoll(uv_check_t* handle, int status)
+{
+    struct EventBase_pvt* base = Identity_cast((struct EventBase_pvt*) handle->data);
+    uint64_t now = uv_hrtime();
+    uint64_t polling = now - base->timeOfLastPoll;
+    uint64_t callbacks = base->pollCallbackNanoseconds;
+
+    // Callbacks for sockets and pipes happen while the loop is polling.
+    if (callbacks > polling) {
+        callbacks = polling;
+    }
+    base->stats.busyNanoseconds += callbacks;
+    base->stats.idleNanoseconds += polling - callbacks;
+    base->timeOfLastPoll = now;
+    base->inPoll = 0;
+}
+
+/** See: EventBase_pvt.h */
+void EventBase_callbackEnd(uv_loop_t* loop, enum EventBase_Source source, uint64_t begin)
+{
+    struct EventBase_pvt* base = Identity_cast((struct EventBase_pvt*) loop->data);
+    uint64_t nanoseconds = uv_hrtime() - begin;
+    struct EventBase_Stats* stats = &base->stats;
+    stats->callbacks[source]++;
+    if (nanoseconds > stats->longestNanoseconds) {
+        stats->longestNanoseconds = nanoseconds;
+        stats->longestSource = source;
+    }
+    if (nanoseconds > stats->stallNanoseconds) {
+        stats->stalls++;
+    }
+    if (base->inPoll) {
+        base->pollCallbackNanoseconds += nanoseconds;
+    } else if (base->isVirtual) {
+        // There is no polling to measure so the callbacks are all of the busy time.
+        stats->busyNanoseconds += nanoseconds;
+    }
 }
 
 struct EventBase* EventBase_new(struct Allocator* allocator)
@@ -64,14 +117,99 @@ struct EventBase* EventBase_new(struct Allocator* allocator)
     struct Allocator* alloc = Allocator_child(allocator);
     struct EventBase_pvt* base = Allocator_calloc(alloc, sizeof(struct EventBase_pvt), 1);
     base->loop = uv_loop_new();
+    base->loop->data = base;
+    // uv_now() is just this field.
+    base->pub.loopTime = &base->loop->time;
     base->alloc = alloc;
+    base->stats.stallNanoseconds = EventBase_STALL_MILLISECONDS * 1000000ull;
     Identity_set(base);
 
+    // Unreferenced so that they do not keep the loop running.
+    uv_prepare_init(base->loop, &base->beforePoll);
+    base->beforePoll.data = base;
+    uv_prepare_start(&base->beforePoll, beforePoll);
+    uv_unref((uv_handle_t*) &base->beforePoll);
+    uv_check_init(base->loop, &base->afterPoll);
+    base->afterPoll.data = base;
+    uv_check_start(&base->afterPoll, afterPoll);
+    uv_unref((uv_handle_t*) &base->afterPoll);
+
     Allocator_onFree(alloc, onFree, base);
     calibrateTime(base);
     return &base->pub;
 }
 
+/** Where the virtual clock starts, midnight on the first of January 2014. */
+#define VIRTUAL_EPOCH_MILLISECONDS 1388534400000ull
+
+struct EventBase* EventBase_newVirtual(struct Allocator* allocator)
+{
+    struct EventBase_pvt* base = EventBase_privatize(EventBase_new(allocator));
+    base->isVirtual = 1;
+    base->pub.loopTime = &base->virtualTime;
+    base->pub.baseTime = VIRTUAL_EPOCH_MILLISECONDS;
+    return &base->pub;
+}
+
+/** Busy polling which has halved below this stops until events come quickly again. */
+#define MIN_BUSY_POLL_NANOSECONDS 1000
+
+static uint64_t callbackCount(struct EventBase_pvt* base)
+{
+    uint64_t count = 0;
+    for (int i = 0; i < EventBase_Source_COUNT; i++) {
+        count += base->stats.callbacks[i];
+    }
+    return count;
+}
+
+/**
+ * Run the loop without blocking for as long as an event comes within the spin period of the
+ * last one, then block for the next event. See EventBase_setBusyPoll().
+ *
+ * @return zero if the loop has nothing left to wait for.
+ */
+static int busyPoll(struct EventBase_pvt* ctx)
+{
+    ctx->stopped = 0;
+    uint64_t spin = ctx->busyPollNanoseconds;
+    while (!ctx->stopped && !ctx->busyPollChanged) {
+        uint64_t lastEvent = uv_hrtime();
+        uint64_t callbacks = callbackCount(ctx);
+        for (;;) {
+            if (!uv_run(ctx->loop, UV_RUN_NOWAIT)) {
+                return 0;
+            }
+            if (ctx->stopped || ctx->busyPollChanged) {
+                return 1;
+            }
+            uint64_t now = uv_hrtime();
+            uint64_t count = callbackCount(ctx);
+            if (count != callbacks) {
+                callbacks = count;
+                lastEvent = now;
+            } else if (now - lastEvent >= spin) {
+                break;
+            }
+        }
+
+        // A whole period went by without an event, spin for less next time.
+        spin = (spin / 2 < MIN_BUSY_POLL_NANOSECONDS) ? 0 : spin / 2;
+
+        uint64_t blocked = uv_hrtime();
+        if (!uv_run(ctx->loop, UV_RUN_ONCE)) {
+            return 0;
+        }
+
+        // The event came soon enough that spinning longer would have caught it.
+        if (uv_hrtime() - blocked < ctx->busyPollNanoseconds) {
+            spin = (spin) ? spin * 2 : MIN_BUSY_POLL_NANOSECONDS;
+            spin = (spin > ctx->busyPollNanoseconds) ? ctx->busyPollNanoseconds : spin;
+        }
+    }
+    return 1;
+}
+
 void EventBase_beginLoop(struct EventBase* eventBase)
 {
     struct EventBase_pvt* ctx = Identity_cast((struct EventBase_pvt*) eventBase);
@@ -80,7 +218,23 @@ void EventBase_beginLoop(struct EventBase* eventBase)
     ctx->running = 1;
 
     // start the loop.
-    uv_run(ctx->loop, UV_RUN_DEFAULT);
+    if (ctx->isVirtual) {
+        ctx->stopped = 0;
+        while (!ctx->stopped) {
+            if (!ctx->runVirtual || !ctx->runVirtual(ctx)) {
+                break;
+            }
+        }
+    } else {
+        ctx->timeOfLastPoll = uv_hrtime();
+        int alive;
+        do {
+            ctx->busyPollChanged = 0;
+            alive = (ctx->busyPollNanoseconds)
+                ? busyPoll(ctx)
+                : uv_run(ctx->loop, UV_RUN_DEFAULT);
+        } while (alive && ctx->busyPollChanged);
+    }
 
     ctx->running = 0;
 
@@ -94,13 +248,58 @@ void EventBase_beginLoop(struct EventBase* eventBase)
 void EventBase_endLoop(struct EventBase* eventBase)
 {
     struct EventBase_pvt* ctx = Identity_cast((struct EventBase_pvt*) eventBase);
+    ctx->stopped = 1;
     uv_stop(ctx->loop);
 }
 
+void EventBase_setBusyPoll(struct EventBase* eventBase, uint32_t microseconds)
+{
+    struct EventBase_pvt* ctx = Identity_cast((struct EventBase_pvt*) eventBase);
+    Assert_true(microseconds <= EventBase_MAX_BUSY_POLL_MICROSECONDS);
+    if (!ctx->busyPollNanoseconds != !microseconds && ctx->running) {
+        // Get the loop out of uv_run() or busyPoll() so that it starts again the other way.
+        ctx->busyPollChanged = 1;
+        uv_stop(ctx->loop);
+    }
+    ctx->busyPollNanoseconds = microseconds * 1000ull;
+}
+
+uint32_t EventBase_busyPoll(struct EventBase* eventBase)
+{
+    struct EventBase_pvt* ctx = Identity_cast((struct EventBase_pvt*) eventBase);
+    return ctx->busyPollNanoseconds / 1000;
+}
+
+int EventBase_setCpuAffinity(struct EventBase* eventBase, uint64_t cpuMask)
+{
+    Identity_check((struct EventBase_pvt*) eventBase);
+    if (!cpuMask) {
+        return -1;
+    }
+    #ifdef linux
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int i = 0; i < 64; i++) {
+            if (cpuMask & (1ull << i)) {
+                CPU_SET(i, &set);
+            }
+        }
+        // Zero is the calling thread, not the whole process.
+        return (sched_setaffinity(0, sizeof(cpu_set_t), &set)) ? -1 : 0;
+    #else
+        return -1;
+    #endif
+}
+
 static void countCallback(uv_handle_t* event, void* vEventCount)
 {
     int* eventCount = (int*) vEventCount;
-    if (!uv_is_closing(event)) {
+    // The timer behind Timeout is kept when it is stopped but then nothing is waiting on it.
+    // The handles which watch the polling belong to the event base.
+    if (!uv_is_closing(event)
+        && (event->type != UV_TIMER || uv_is_active(event))
+        && event->data != event->loop->data)
+    {
         *eventCount = *eventCount + 1;
     }
 }
@@ -113,6 +312,28 @@ int EventBase_eventCount(struct EventBase* eventBase)
     return eventCount;
 }
 
+/** See: EventBase.h */
+struct EventBase_Stats* EventBase_stats(struct EventBase* eventBase)
+{
+    struct EventBase_pvt* ctx = Identity_cast((struct EventBase_pvt*) eventBase);
+    return &ctx->stats;
+}
+
+/** See: EventBase.h */
+const char* EventBase_sourceName(enum EventBase_Source source)
+{
+    switch (source) {
+        case EventBase_Source_TIMER: return "timer";
+        case EventBase_Source_UDP: return "udp";
+        case EventBase_Source_TCP: return "tcp";
+        case EventBase_Source_PIPE: return "pipe";
+        case EventBase_Source_EVENT: return "event";
+        case EventBase_Source_DEVICE: return "device";
+        case EventBase_Source_MAILBOX: return "mailbox";
+        default: return "unknown";
+    }
+}
+
 struct EventBase_pvt* EventBase_privatize(struct EventBase* base)
 {
     return Identity_cast((struct EventBase_pvt*) base);
@@ -0,0 +1,198 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "admin/Admin.h"
+#include "benc/Dict.h"
+#include "benc/Int.h"
+#include "benc/List.h"
+#include "benc/String.h"
+#include "util/events/EventBase.h"
+#include "util/events/EventBase_admin.h"
+#include "util/events/Timeout.h"
+#include "util/Identity.h"
+#include "util/log/Log.h"
+
+struct Context
+{
+    struct EventBase* base;
+    struct Log* logger;
+    struct Admin* admin;
+
+    /** The totals when the current interval began. */
+    uint64_t busyNanoseconds;
+    uint64_t idleNanoseconds;
+    uint64_t stalls;
+
+    /** How the loop did over the last whole interval. */
+    uint32_t utilizationPercent;
+    uint64_t longestNanoseconds;
+    enum EventBase_Source longestSource;
+
+    Identity
+};
+
+static void endInterval(void* vcontext)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    struct EventBase_Stats* stats = EventBase_stats(ctx->base);
+
+    uint64_t busy = stats->busyNanoseconds - ctx->busyNanoseconds;
+    uint64_t total = busy + stats->idleNanoseconds - ctx->idleNanoseconds;
+    ctx->utilizationPercent = (total) ? (busy * 100) / total : 0;
+    ctx->longestNanoseconds = stats->longestNanoseconds;
+    ctx->longestSource = stats->longestSource;
+
+    uint64_t stalls = stats->stalls - ctx->stalls;
+    if (stalls) {
+        Log_warn(ctx->logger, "[%u] callbacks took longer than [%u]ms in the last [%u] seconds, "
+                              "the longest took [%u]ms from [%s], the loop was [%u]%% busy",
+                 (uint32_t) stalls,
+                 (uint32_t) (stats->stallNanoseconds / 1000000),
+                 EventBase_admin_INTERVAL_MILLISECONDS / 1000,
+                 (uint32_t) (ctx->longestNanoseconds / 1000000),
+                 EventBase_sourceName(ctx->longestSource),
+                 ctx->utilizationPercent);
+    }
+
+    ctx->busyNanoseconds = stats->busyNanoseconds;
+    ctx->idleNanoseconds = stats->idleNanoseconds;
+    ctx->stalls = stats->stalls;
+    stats->longestNanoseconds = 0;
+}
+
+static void adminStats(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    struct EventBase_Stats* stats = EventBase_stats(ctx->base);
+
+    Dict* callbacks = Dict_new(requestAlloc);
+    for (int i = 0; i < EventBase_Source_COUNT; i++) {
+        Dict_putInt(callbacks,
+                    String_new(EventBase_sourceName(i), requestAlloc),
+                    stats->callbacks[i],
+                    requestAlloc);
+    }
+
+    Dict* out = Dict_new(requestAlloc);
+    Dict_putInt(out, String_CONST("busyNanoseconds"), stats->busyNanoseconds, requestAlloc);
+    Dict_putInt(out, String_CONST("idleNanoseconds"), stats->idleNanoseconds, requestAlloc);
+    Dict_putInt(out, String_CONST("utilizationPercent"), ctx->utilizationPercent, requestAlloc);
+    Dict_putInt(out, String_CONST("longestMicroseconds"),
+                ctx->longestNanoseconds / 1000, requestAlloc);
+    Dict_putString(out, String_CONST("longestSource"),
+                   String_new(EventBase_sourceName(ctx->longestSource), requestAlloc),
+                   requestAlloc);
+    Dict_putInt(out, String_CONST("stalls"), stats->stalls, requestAlloc);
+    Dict_putInt(out, String_CONST("stallMilliseconds"),
+                stats->stallNanoseconds / 1000000, requestAlloc);
+    Dict_putDict(out, String_CONST("callbacks"), callbacks, requestAlloc);
+    Dict_putString(out, String_CONST("error"), String_CONST("none"), requestAlloc);
+    Admin_sendMessage(out, txid, ctx->admin);
+}
+
+static void setStallThreshold(Dict* args,
+                              void* vcontext,
+                              String* txid,
+                              struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    int64_t* milliseconds = Dict_getInt(args, String_CONST("milliseconds"));
+    char* err = "none";
+    if (*milliseconds < 1 || *milliseconds > 60000) {
+        err = "milliseconds must be between 1 and 60000";
+    } else {
+        EventBase_stats(ctx->base)->stallNanoseconds = *milliseconds * 1000000ull;
+    }
+    Dict out = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(err)), NULL);
+    Admin_sendMessage(&out, txid, ctx->admin);
+}
+
+static void setBusyPoll(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    int64_t* microseconds = Dict_getInt(args, String_CONST("microseconds"));
+    char* err = "none";
+    if (*microseconds < 0 || *microseconds > EventBase_MAX_BUSY_POLL_MICROSECONDS) {
+        err = "microseconds must be between 0 and 100000";
+    } else {
+        EventBase_setBusyPoll(ctx->base, *microseconds);
+    }
+    Dict out = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(err)), NULL);
+    Admin_sendMessage(&out, txid, ctx->admin);
+}
+
+static char* cpuAffinity(List* cpus, struct Context* ctx)
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < List_size(cpus); i++) {
+        int64_t* cpu = List_getInt(cpus, i);
+        if (!cpu || *cpu < 0 || *cpu > 63) {
+            return "cpus must be a list of numbers between 0 and 63";
+        }
+        mask |= 1ull << *cpu;
+    }
+    if (!mask) {
+        return "cpus must not be empty";
+    }
+    if (EventBase_setCpuAffinity(ctx->base, mask)) {
+        return "failed to set the affinity, it may not be supported on this system";
+    }
+    Log_info(ctx->logger, "Event loop pinned to the CPUs in mask [0x%llx]",
+             (unsigned long long) mask);
+    return "none";
+}
+
+static void setCpuAffinity(Dict* args,
+                           void* vcontext,
+                           String* txid,
+                           struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_cast((struct Context*) vcontext);
+    char* err = cpuAffinity(Dict_getList(args, String_CONST("cpus")), ctx);
+    Dict out = Dict_CONST(String_CONST("error"), String_OBJ(String_CONST(err)), NULL);
+    Admin_sendMessage(&out, txid, ctx->admin);
+}
+
+void EventBase_admin_register(struct EventBase* base,
+                              struct Log* logger,
+                              struct Admin* admin,
+                              struct Allocator* alloc)
+{
+    struct EventBase_Stats* stats = EventBase_stats(base);
+    struct Context* ctx = Allocator_clone(alloc, (&(struct Context) {
+        .base = base,
+        .logger = logger,
+        .admin = admin,
+        .busyNanoseconds = stats->busyNanoseconds,
+        .idleNanoseconds = stats->idleNanoseconds,
+        .stalls = stats->stalls
+    }));
+    Identity_set(ctx);
+
+    Timeout_setInterval(endInterval, ctx, EventBase_admin_INTERVAL_MILLISECONDS, base, alloc);
+
+    Admin_registerFunction("EventBase_stats", adminStats, ctx, true, NULL, admin);
+    Admin_registerFunction("EventBase_setStallThreshold", setStallThreshold, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "milliseconds", .required = 1, .type = "Int" }
+        }), admin);
+    Admin_registerFunction("EventBase_setBusyPoll", setBusyPoll, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "microseconds", .required = 1, .type = "Int" }
+        }), admin);
+    Admin_registerFunction("EventBase_setCpuAffinity", setCpuAffinity, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "cpus", .required = 1, .type = "List" }
+        }), admin);
+}
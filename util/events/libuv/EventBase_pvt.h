@@ -29,21 +29,73 @@ struct EventBase_pvt
 
     struct Allocator* alloc;
 
+    /** The timing wheel which holds every Timeout, created by the first one. */
+    struct Timeout_Wheel* timeouts;
+
     /** True if the loop is running. */
     int running;
 
+    /** Non-zero if the clock is virtual, see EventBase_newVirtual(). */
+    int isVirtual;
+
+    /** Set by EventBase_endLoop() to stop a virtual or busy polling loop. */
+    int stopped;
+
+    /** See EventBase_setBusyPoll(), zero if the loop blocks as soon as it is idle. */
+    uint64_t busyPollNanoseconds;
+
+    /** Set when busy polling is turned on or off so that the running loop switches. */
+    int busyPollChanged;
+
+    /** The time of a virtual event base, loopTime points here. */
+    uint64_t virtualTime;
+
+    /**
+     * Move the clock of a virtual event base forward to the next timeout and fire it,
+     * set by Timeout.c when the first timeout is made because it drives the timing wheel.
+     *
+     * @return zero if there are no timeouts left.
+     */
+    int (* runVirtual)(struct EventBase_pvt* base);
+
+    struct EventBase_Stats stats;
+
+    /** Watch the loop going in and out of waiting for events, to tell busy from idle. */
+    uv_prepare_t beforePoll;
+    uv_check_t afterPoll;
+
+    /** When the loop last went in or out of waiting, from uv_hrtime(). */
+    uint64_t timeOfLastPoll;
+
+    /** Time spent in callbacks while the loop was waiting, which is not idle time. */
+    uint64_t pollCallbackNanoseconds;
+    int inPoll;
+
     /**
      * The onFree job which is passed from onFree() to EventLoop_begin()
      * so it can be completed after the loop has ended.
      */
     struct Allocator_OnFreeJob* onFree;
 
-    /** Number of milliseconds since epoch when the clock was calibrated. */
-    uint64_t baseTime;
-
     Identity
 };
 
 struct EventBase_pvt* EventBase_privatize(struct EventBase* base);
 
+/** Get the time before running a callback from the loop, see: EventBase_callbackEnd(). */
+static inline uint64_t EventBase_callbackBegin()
+{
+    return uv_hrtime();
+}
+
+/**
+ * Account for a callback from the loop in the EventBase_Stats. The loop is passed rather than
+ * the event base so that the event base can be found from any handle.
+ *
+ * @param loop the loop the callback came from.
+ * @param source the kind of thing which the callback was for.
+ * @param begin the result of EventBase_callbackBegin() from before the callback.
+ */
+void EventBase_callbackEnd(uv_loop_t* loop, enum EventBase_Source source, uint64_t begin);
+
 #endif
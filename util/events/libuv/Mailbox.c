@@ -0,0 +1,136 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "memory/Allocator.h"
+#include "util/events/libuv/EventBase_pvt.h"
+#include "util/events/Mailbox.h"
+#include "util/Identity.h"
+
+/*
+ * An intrusive multi producer single consumer queue (Vyukov), posting is one atomic exchange.
+ * The producers push onto head and the event loop consumes from tail, the stub keeps the queue
+ * from ever being empty so a producer never has to touch tail.
+ */
+struct Mailbox
+{
+    uv_async_t async;
+
+    /** The message most recently posted, shared with the producers. */
+    struct Mailbox_Message* head;
+
+    /** The next message to deliver, only touched by the event loop. */
+    struct Mailbox_Message* tail;
+
+    struct Mailbox_Message stub;
+
+    Mailbox_OnMessage onMessage;
+    void* context;
+
+    Identity
+};
+
+static void push(struct Mailbox* mb, struct Mailbox_Message* msg)
+{
+    __atomic_store_n(&msg->next, NULL, __ATOMIC_RELAXED);
+    struct Mailbox_Message* prev = __atomic_exchange_n(&mb->head, msg, __ATOMIC_ACQ_REL);
+    // Until this store the message is unreachable, pop() sees it next time.
+    __atomic_store_n(&prev->next, msg, __ATOMIC_RELEASE);
+}
+
+/** @return the next message or NULL if there are none or one is partly posted. */
+static struct Mailbox_Message* pop(struct Mailbox* mb)
+{
+    struct Mailbox_Message* tail = mb->tail;
+    struct Mailbox_Message* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &mb->stub) {
+        if (!next) {
+            return NULL;
+        }
+        mb->tail = tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        mb->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&mb->head, __ATOMIC_ACQUIRE)) {
+        // A producer is between the exchange and the store, it will wake the loop again.
+        return NULL;
+    }
+    // tail is the last message, put the stub behind it so it can be taken.
+    push(mb, &mb->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        mb->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static void deliver2(uv_async_t* handle, int status)
+{
+    struct Mailbox* mb = Identity_cast((struct Mailbox*) handle->data);
+    struct Mailbox_Message* msg;
+    while ((msg = pop(mb))) {
+        mb->onMessage(msg, mb->context);
+    }
+}
+
+static void deliver(uv_async_t* handle, int status)
+{
+    uv_loop_t* loop = handle->loop;
+    uint64_t begin = EventBase_callbackBegin();
+    deliver2(handle, status);
+    EventBase_callbackEnd(loop, EventBase_Source_MAILBOX, begin);
+}
+
+static void onFree2(uv_handle_t* handle)
+{
+    Allocator_onFreeComplete(handle->data);
+}
+
+static int onFree(struct Allocator_OnFreeJob* job)
+{
+    struct Mailbox* mb = Identity_cast((struct Mailbox*) job->userData);
+    mb->async.data = job;
+    uv_close((uv_handle_t*) &mb->async, onFree2);
+    return Allocator_ONFREE_ASYNC;
+}
+
+/** See: Mailbox.h */
+struct Mailbox* Mailbox_new(Mailbox_OnMessage onMessage,
+                            void* context,
+                            struct EventBase* eventBase,
+                            struct Allocator* alloc)
+{
+    struct EventBase_pvt* base = EventBase_privatize(eventBase);
+    struct Mailbox* mb = Allocator_calloc(alloc, sizeof(struct Mailbox), 1);
+    mb->onMessage = onMessage;
+    mb->context = context;
+    mb->head = mb->tail = &mb->stub;
+    Identity_set(mb);
+
+    uv_async_init(base->loop, &mb->async, deliver);
+    mb->async.data = mb;
+    Allocator_onFree(alloc, onFree, mb);
+    return mb;
+}
+
+/** See: Mailbox.h */
+void Mailbox_post(struct Mailbox* mailbox, struct Mailbox_Message* msg)
+{
+    push(mailbox, msg);
+    uv_async_send(&mailbox->async);
+}
@@ -0,0 +1,272 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "exception/Except.h"
+#include "memory/Allocator.h"
+#include "util/events/libuv/EventBase_pvt.h"
+#include "util/events/MetricsServer.h"
+#include "util/events/Timeout.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Bits.h"
+#include "util/CString.h"
+#include "util/Identity.h"
+#include "util/Metrics.h"
+
+#include <stdio.h>
+
+#define LISTEN_BACKLOG 16
+
+struct MetricsServer_pvt
+{
+    struct MetricsServer pub;
+    struct Metrics* metrics;
+    struct EventBase* base;
+    struct Log* logger;
+    struct Allocator* alloc;
+    uv_tcp_t server;
+
+    /** Job to close the handle when the allocator is freed */
+    struct Allocator_OnFreeJob* closeHandleOnFree;
+
+    Identity
+};
+
+struct MetricsServer_Conn
+{
+    uv_tcp_t handle;
+    uv_write_t writeReq;
+    struct MetricsServer_pvt* server;
+
+    /** Freeing this closes the connection. */
+    struct Allocator* alloc;
+
+    /** Job to close the handle when the allocator is freed */
+    struct Allocator_OnFreeJob* closeHandleOnFree;
+
+    /** Nonzero once the response is being written, anything more which is read is ignored. */
+    int responding;
+
+    char request[MetricsServer_MAX_REQUEST];
+    int requestLen;
+
+    char header[128];
+
+    Identity
+};
+
+static void writeComplete(uv_write_t* req, int status)
+{
+    struct MetricsServer_Conn* conn = Identity_cast((struct MetricsServer_Conn*) req->data);
+    Allocator_free(conn->alloc);
+}
+
+static void respond(struct MetricsServer_Conn* conn,
+                    const char* status,
+                    const char* body,
+                    int length)
+{
+    conn->responding = 1;
+    int headerLen = snprintf(conn->header, sizeof(conn->header),
+                             "HTTP/1.0 %s\r\n"
+                             "Content-Type: text/plain; version=0.0.4\r\n"
+                             "Content-Length: %d\r\n"
+                             "Connection: close\r\n\r\n", status, length);
+    uv_buf_t bufs[2] = {
+        { .base = conn->header, .len = headerLen },
+        { .base = (char*) body, .len = length }
+    };
+    conn->writeReq.data = conn;
+    if (uv_write(&conn->writeReq, (uv_stream_t*) &conn->handle, bufs, 2, writeComplete)) {
+        Log_debug(conn->server->logger, "Failed to write metrics [%s]",
+                  uv_err_name(uv_last_error(conn->handle.loop)));
+        Allocator_free(conn->alloc);
+    }
+}
+
+static int isPath(struct MetricsServer_Conn* conn, const char* path)
+{
+    int len = CString_strlen(path);
+    return conn->requestLen > len
+        && !Bits_memcmp(conn->request, path, len)
+        && (conn->request[len] == ' ' || conn->request[len] == '?');
+}
+
+static void requestReceived(struct MetricsServer_Conn* conn)
+{
+    if (!isPath(conn, "GET /metrics") && !isPath(conn, "GET /")) {
+        respond(conn, "404 Not Found", "", 0);
+        return;
+    }
+    char* body = Allocator_malloc(conn->alloc, MetricsServer_MAX_RESPONSE);
+    int length = Metrics_write(conn->server->metrics, body, MetricsServer_MAX_RESPONSE);
+    if (length < 0) {
+        Log_warn(conn->server->logger, "Metrics do not fit in [%d] bytes",
+                 MetricsServer_MAX_RESPONSE);
+        respond(conn, "500 Internal Server Error", "", 0);
+        return;
+    }
+    respond(conn, "200 OK", body, length);
+}
+
+static void incoming(uv_stream_t* stream, ssize_t nread, uv_buf_t buf)
+{
+    struct MetricsServer_Conn* conn = Identity_cast((struct MetricsServer_Conn*) stream->data);
+    if (conn->responding) {
+        return;
+    }
+    if (nread < 0) {
+        Allocator_free(conn->alloc);
+        return;
+    }
+    conn->requestLen += nread;
+    for (int i = 3; i < conn->requestLen; i++) {
+        if (!Bits_memcmp(&conn->request[i - 3], "\r\n\r\n", 4)) {
+            requestReceived(conn);
+            return;
+        }
+    }
+    if (conn->requestLen == MetricsServer_MAX_REQUEST) {
+        requestReceived(conn);
+    }
+}
+
+static uv_buf_t allocate(uv_handle_t* handle, size_t size)
+{
+    struct MetricsServer_Conn* conn = Identity_cast((struct MetricsServer_Conn*) handle->data);
+    if (conn->responding) {
+        // Only the first request is served, whatever follows it is read and thrown away.
+        conn->requestLen = 0;
+    }
+    return (uv_buf_t) {
+        .base = &conn->request[conn->requestLen],
+        .len = MetricsServer_MAX_REQUEST - conn->requestLen
+    };
+}
+
+static void timedOut(void* vconn)
+{
+    struct MetricsServer_Conn* conn = Identity_cast((struct MetricsServer_Conn*) vconn);
+    if (!conn->responding) {
+        Allocator_free(conn->alloc);
+    }
+}
+
+static void onConnClosed(uv_handle_t* wasClosed)
+{
+    struct MetricsServer_Conn* conn = Identity_cast((struct MetricsServer_Conn*) wasClosed->data);
+    Allocator_onFreeComplete((struct Allocator_OnFreeJob*) conn->closeHandleOnFree);
+}
+
+static int closeConnOnFree(struct Allocator_OnFreeJob* job)
+{
+    struct MetricsServer_Conn* conn = Identity_cast((struct MetricsServer_Conn*) job->userData);
+    conn->closeHandleOnFree = job;
+    uv_close((uv_handle_t*) &conn->handle, onConnClosed);
+    return Allocator_ONFREE_ASYNC;
+}
+
+static void onConnection(uv_stream_t* stream, int status)
+{
+    struct MetricsServer_pvt* server = Identity_cast((struct MetricsServer_pvt*) stream->data);
+    if (status) {
+        Log_info(server->logger, "Failed to accept connection [%s]",
+                 uv_err_name(uv_last_error(stream->loop)));
+        return;
+    }
+    struct Allocator* alloc = Allocator_child(server->alloc);
+    struct MetricsServer_Conn* conn =
+        Allocator_calloc(alloc, sizeof(struct MetricsServer_Conn), 1);
+    conn->server = server;
+    conn->alloc = alloc;
+    Identity_set(conn);
+
+    uv_tcp_init(server->server.loop, &conn->handle);
+    conn->handle.data = conn;
+    Allocator_onFree(alloc, closeConnOnFree, conn);
+
+    if (uv_accept(stream, (uv_stream_t*) &conn->handle)
+        || uv_read_start((uv_stream_t*) &conn->handle, allocate, incoming))
+    {
+        Log_info(server->logger, "Failed to accept connection [%s]",
+                 uv_err_name(uv_last_error(stream->loop)));
+        Allocator_free(alloc);
+        return;
+    }
+    Timeout_setTimeout(timedOut, conn, MetricsServer_TIMEOUT_MILLISECONDS, server->base, alloc);
+}
+
+static void onClosed(uv_handle_t* wasClosed)
+{
+    struct MetricsServer_pvt* server =
+        Identity_cast((struct MetricsServer_pvt*) wasClosed->data);
+    Allocator_onFreeComplete((struct Allocator_OnFreeJob*) server->closeHandleOnFree);
+}
+
+static int closeHandleOnFree(struct Allocator_OnFreeJob* job)
+{
+    struct MetricsServer_pvt* server =
+        Identity_cast((struct MetricsServer_pvt*) job->userData);
+    server->closeHandleOnFree = job;
+    uv_close((uv_handle_t*) &server->server, onClosed);
+    return Allocator_ONFREE_ASYNC;
+}
+
+struct MetricsServer* MetricsServer_new(struct Metrics* metrics,
+                                        struct Sockaddr* bindAddr,
+                                        struct EventBase* eventBase,
+                                        struct Allocator* alloc,
+                                        struct Except* eh,
+                                        struct Log* logger)
+{
+    struct EventBase_pvt* base = EventBase_privatize(eventBase);
+    struct MetricsServer_pvt* server = Allocator_clone(alloc, (&(struct MetricsServer_pvt) {
+        .metrics = metrics,
+        .base = eventBase,
+        .logger = logger,
+        .alloc = alloc
+    }));
+    Identity_set(server);
+
+    uv_tcp_init(base->loop, &server->server);
+    server->server.data = server;
+
+    int ret;
+    void* native = Sockaddr_asNative(bindAddr);
+    if (Sockaddr_getFamily(bindAddr) == Sockaddr_AF_INET6) {
+        ret = uv_tcp_bind6(&server->server, *((struct sockaddr_in6*)native));
+    } else {
+        ret = uv_tcp_bind(&server->server, *((struct sockaddr_in*)native));
+    }
+    if (ret || uv_listen((uv_stream_t*) &server->server, LISTEN_BACKLOG, onConnection)) {
+        const char* err = uv_err_name(uv_last_error(base->loop));
+        uv_close((uv_handle_t*) &server->server, NULL);
+        Except_throw(eh, "failed to listen on TCP socket [%s]", err);
+    }
+
+    struct Sockaddr_storage ss;
+    int nameLen = sizeof(struct Sockaddr_storage);
+    Bits_memset(&ss, 0, sizeof(struct Sockaddr_storage));
+    if (uv_tcp_getsockname(&server->server, (void*)ss.nativeAddr, &nameLen)) {
+        const char* err = uv_err_name(uv_last_error(base->loop));
+        uv_close((uv_handle_t*) &server->server, NULL);
+        Except_throw(eh, "uv_tcp_getsockname() failed [%s]", err);
+    }
+    ss.addr.addrLen = nameLen + 8;
+    server->pub.addr = Sockaddr_clone(&ss.addr, alloc);
+    Log_info(logger, "Serving metrics on [%s]", Sockaddr_print(server->pub.addr, alloc));
+
+    Allocator_onFree(alloc, closeHandleOnFree, server);
+    return &server->pub;
+}
@@ -0,0 +1,189 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define string_strerror
+#include "util/events/libuv/UvWrapper.h"
+#include "exception/Except.h"
+#include "interface/Interface.h"
+#include "memory/Allocator.h"
+#include "util/events/PacketDevice.h"
+#include "util/events/libuv/EventBase_pvt.h"
+#include "util/platform/libc/string.h"
+#include "util/log/Log.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+#include "wire/Error.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct PacketDevice_pvt
+{
+    struct PacketDevice pub;
+
+    int fd;
+
+    /** Largest packet which will be read. */
+    uint32_t bufferSize;
+
+    uv_poll_t pollHandle;
+
+    struct Log* logger;
+
+    /** Job to close the handle when the allocator is freed */
+    struct Allocator_OnFreeJob* closeHandleOnFree;
+
+    /** Job which blocks the freeing until the callback completes */
+    struct Allocator_OnFreeJob* blockFreeInsideCallback;
+
+    /** true if we are inside of the callback, used by blockFreeInsideCallback */
+    int inCallback;
+
+    Identity
+};
+
+static uint8_t sendMessage(struct Message* m, struct Interface* iface)
+{
+    struct PacketDevice_pvt* ctx = Identity_cast((struct PacketDevice_pvt*) iface);
+
+    ssize_t ret;
+    do {
+        ret = write(ctx->fd, m->bytes, m->length);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            Log_debug(ctx->logger, "DROP device is busy");
+            return Error_LINK_LIMIT_EXCEEDED;
+        }
+        Log_info(ctx->logger, "DROP Failed to write to device [%s]", strerror(errno));
+    }
+    return Error_NONE;
+}
+
+static void incoming2(uv_poll_t* handle, int status, int events)
+{
+    struct PacketDevice_pvt* ctx = Identity_cast((struct PacketDevice_pvt*) handle->data);
+
+    if (status < 0) {
+        Log_warn(ctx->logger, "encountered error [%s]",
+                 uv_err_name(uv_last_error(handle->loop)) );
+        return;
+    }
+
+    ctx->inCallback = 1;
+
+    // Packets are drained a batch at a time rather than going back to the loop for each one.
+    for (int i = 0; i < PacketDevice_READ_BATCH && !ctx->blockFreeInsideCallback; i++) {
+        // Enough scratch space for one packet and the struct Message which wraps it.
+        struct Allocator* alloc = Allocator_scratch(ctx->pub.iface.allocator,
+            PacketDevice_PADDING_AMOUNT + ctx->bufferSize + sizeof(struct Message) + 64);
+        struct Message* m = Message_new(ctx->bufferSize, PacketDevice_PADDING_AMOUNT, alloc);
+
+        ssize_t ret = read(ctx->fd, m->bytes, m->length);
+        if (ret <= 0) {
+            if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                Log_info(ctx->logger, "Failed to read from device [%s]", strerror(errno));
+            }
+            Allocator_free(alloc);
+            break;
+        }
+
+        m->length = ret;
+        if (ctx->pub.iface.receiveMessage) {
+            Interface_receiveMessage(&ctx->pub.iface, m);
+        }
+        Allocator_free(alloc);
+    }
+
+    ctx->inCallback = 0;
+    if (ctx->blockFreeInsideCallback) {
+        Allocator_onFreeComplete((struct Allocator_OnFreeJob*) ctx->blockFreeInsideCallback);
+    }
+}
+
+static void incoming(uv_poll_t* handle, int status, int events)
+{
+    uv_loop_t* loop = handle->loop;
+    uint64_t begin = EventBase_callbackBegin();
+    incoming2(handle, status, events);
+    EventBase_callbackEnd(loop, EventBase_Source_DEVICE, begin);
+}
+
+static void onClosed(uv_handle_t* wasClosed)
+{
+    struct PacketDevice_pvt* ctx = Identity_cast((struct PacketDevice_pvt*) wasClosed->data);
+    close(ctx->fd);
+    Allocator_onFreeComplete((struct Allocator_OnFreeJob*) ctx->closeHandleOnFree);
+}
+
+static int closeHandleOnFree(struct Allocator_OnFreeJob* job)
+{
+    struct PacketDevice_pvt* ctx = Identity_cast((struct PacketDevice_pvt*) job->userData);
+    ctx->closeHandleOnFree = job;
+    uv_close((uv_handle_t*)&ctx->pollHandle, onClosed);
+    return Allocator_ONFREE_ASYNC;
+}
+
+static int blockFreeInsideCallback(struct Allocator_OnFreeJob* job)
+{
+    struct PacketDevice_pvt* ctx = Identity_cast((struct PacketDevice_pvt*) job->userData);
+    if (!ctx->inCallback) {
+        return 0;
+    }
+    ctx->blockFreeInsideCallback = job;
+    return Allocator_ONFREE_ASYNC;
+}
+
+struct PacketDevice* PacketDevice_forFd(int fd,
+                                        uint32_t bufferSize,
+                                        struct EventBase* eventBase,
+                                        struct Log* logger,
+                                        struct Except* eh,
+                                        struct Allocator* alloc)
+{
+    struct EventBase_pvt* base = EventBase_privatize(eventBase);
+
+    struct PacketDevice_pvt* ctx = Allocator_clone(alloc, (&(struct PacketDevice_pvt) {
+        .pub = {
+            .iface = {
+                .sendMessage = sendMessage,
+                .allocator = alloc
+            }
+        },
+        .fd = fd,
+        .bufferSize = bufferSize,
+        .logger = logger
+    }));
+    Identity_set(ctx);
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        Except_throw(eh, "fcntl(O_NONBLOCK) [%s]", strerror(errno));
+    }
+
+    if (uv_poll_init(base->loop, &ctx->pollHandle, fd)
+        || uv_poll_start(&ctx->pollHandle, UV_READABLE, incoming))
+    {
+        Except_throw(eh, "uv_poll_start() failed [%s]",
+                     uv_err_name(uv_last_error(base->loop)));
+    }
+    ctx->pollHandle.data = ctx;
+
+    Allocator_onFree(alloc, closeHandleOnFree, ctx);
+    Allocator_onFree(alloc, blockFreeInsideCallback, ctx);
+
+    return &ctx->pub;
+}
@@ -26,6 +26,16 @@
 #include <inttypes.h>
 #include <stdio.h>
 
+/**
+ * Most messages which are written with one uv_write() call, windows pipes only take one
+ * buffer at a time.
+ */
+#ifdef win32
+    #define MAX_BATCH 1
+#else
+    #define MAX_BATCH 32
+#endif
+
 struct Pipe_WriteRequest_pvt;
 
 struct Pipe_pvt
@@ -50,13 +60,31 @@ struct Pipe_pvt
     /** 1 when the pipe becomes active. */
     int isActive;
 
+    /** Bytes which have been accepted by sendMessage() and not yet written. */
     int queueLen;
 
     /** Used by blockFreeInsideCallback */
     int isInCallback;
 
-    /** only non-null before the connection is setup. */
-    struct Pipe_WriteRequest_pvt* bufferedRequest;
+    /**
+     * 1 if the other end reads a stream so messages may be written together.
+     * A file such as a TUN device takes each write as one packet so they are written one by one.
+     */
+    int isStream;
+
+    /** Writes which have been passed to uv_write() and have not completed yet. */
+    int writesInFlight;
+
+    /**
+     * Messages which are waiting to be written, on a stream they wait for the write before
+     * them to complete so they can be written together. Before the connection is setup,
+     * everything waits here.
+     */
+    struct Pipe_WriteRequest_pvt* queueHead;
+    struct Pipe_WriteRequest_pvt* queueTail;
+
+    /** Requests which have completed, kept for reuse. */
+    struct Pipe_WriteRequest_pvt* freeRequests;
 
     struct Allocator* alloc;
 
@@ -66,41 +94,98 @@ struct Pipe_pvt
 struct Pipe_WriteRequest_pvt {
     uv_write_t uvReq;
     struct Pipe_pvt* pipe;
-    struct Message* msg;
+
+    struct Message* msgs[MAX_BATCH];
+    int count;
+
+    /** Total length of msgs. */
+    int length;
+
+    /** Holds the messages until they are written, NULL while the request is unused. */
     struct Allocator* alloc;
+
+    /** The next in the queue or in the free list. */
+    struct Pipe_WriteRequest_pvt* next;
+
     Identity
 };
 
-static void sendMessageCallback(uv_write_t* uvReq, int error)
+/** Get a request from the free list or make a new one if there are none. */
+static struct Pipe_WriteRequest_pvt* getRequest(struct Pipe_pvt* pipe)
 {
-    struct Pipe_WriteRequest_pvt* req = Identity_cast((struct Pipe_WriteRequest_pvt*) uvReq);
-    if (error) {
-        Log_info(req->pipe->pub.logger, "Failed to write to pipe [%s] [%s]",
-                 req->pipe->pub.fullName, uv_err_name(uv_last_error(req->pipe->out->loop)) );
+    struct Pipe_WriteRequest_pvt* req = pipe->freeRequests;
+    if (req) {
+        pipe->freeRequests = req->next;
+    } else {
+        req = Allocator_malloc(pipe->alloc, sizeof(struct Pipe_WriteRequest_pvt));
+        Identity_set(req);
+        req->pipe = pipe;
     }
-    req->pipe->queueLen -= req->msg->length;
-    Assert_true(req->pipe->queueLen >= 0);
-    Allocator_free(req->alloc);
+    req->count = 0;
+    req->length = 0;
+    req->next = NULL;
+    req->alloc = Allocator_child(pipe->alloc);
+    return req;
 }
 
-static uint8_t sendMessage2(struct Pipe_WriteRequest_pvt* req)
+static void releaseRequest(struct Pipe_WriteRequest_pvt* req)
 {
     struct Pipe_pvt* pipe = req->pipe;
-    struct Message* m = req->msg;
+    pipe->queueLen -= req->length;
+    Assert_true(pipe->queueLen >= 0);
+    Allocator_free(req->alloc);
+    req->alloc = NULL;
+    req->next = pipe->freeRequests;
+    pipe->freeRequests = req;
+}
 
-    uv_buf_t buffers[] = {
-        { .base = (char*)m->bytes, .len = m->length }
-    };
+static void flush(struct Pipe_pvt* pipe);
 
-    if (uv_write(&req->uvReq, (uv_stream_t*) pipe->out, buffers, 1, sendMessageCallback)) {
-        Log_info(pipe->pub.logger, "Failed writing to pipe [%s] [%s]",
+static void sendMessageCallback(uv_write_t* uvReq, int error)
+{
+    struct Pipe_WriteRequest_pvt* req = Identity_cast((struct Pipe_WriteRequest_pvt*) uvReq);
+    struct Pipe_pvt* pipe = req->pipe;
+    if (error) {
+        Log_info(pipe->pub.logger, "Failed to write to pipe [%s] [%s]",
                  pipe->pub.fullName, uv_err_name(uv_last_error(pipe->out->loop)) );
-        Allocator_free(req->alloc);
-        return Error_UNDELIVERABLE;
     }
-    pipe->queueLen += m->length;
+    pipe->writesInFlight--;
+    releaseRequest(req);
 
-    return Error_NONE;
+    // Whatever came in while this was being written goes out together, unless the pipe is
+    // being closed.
+    if (!error) {
+        flush(pipe);
+    }
+}
+
+/** Write every queued request, each with a single uv_write(). */
+static void flush(struct Pipe_pvt* pipe)
+{
+    while (pipe->isActive && pipe->queueHead) {
+        struct Pipe_WriteRequest_pvt* req = pipe->queueHead;
+        pipe->queueHead = req->next;
+        if (!pipe->queueHead) {
+            pipe->queueTail = NULL;
+        }
+        req->next = NULL;
+
+        uv_buf_t buffers[MAX_BATCH];
+        for (int i = 0; i < req->count; i++) {
+            buffers[i].base = (char*) req->msgs[i]->bytes;
+            buffers[i].len = req->msgs[i]->length;
+        }
+
+        if (uv_write(&req->uvReq, (uv_stream_t*) pipe->out, buffers, req->count,
+                     sendMessageCallback))
+        {
+            Log_info(pipe->pub.logger, "Failed writing to pipe [%s] [%s]",
+                     pipe->pub.fullName, uv_err_name(uv_last_error(pipe->out->loop)) );
+            releaseRequest(req);
+            continue;
+        }
+        pipe->writesInFlight++;
+    }
 }
 
 static uint8_t sendMessage(struct Message* m, struct Interface* iface)
@@ -111,43 +196,32 @@ static uint8_t sendMessage(struct Message* m, struct Interface* iface)
         return Error_LINK_LIMIT_EXCEEDED;
     }
 
-    // This allocator will hold the message allocator in existance after it is freed.
-    struct Allocator* reqAlloc = Allocator_child(pipe->alloc);
+    struct Pipe_WriteRequest_pvt* req = pipe->queueTail;
+    int batchLimit = (pipe->isStream) ? MAX_BATCH : 1;
+    if (!req || req->count >= batchLimit) {
+        req = getRequest(pipe);
+        if (pipe->queueTail) {
+            pipe->queueTail->next = req;
+        } else {
+            pipe->queueHead = req;
+        }
+        pipe->queueTail = req;
+    }
+
+    // The request's allocator will hold the message allocator in existance after it is freed.
     if (m->alloc) {
-        Allocator_adopt(reqAlloc, m->alloc);
+        Allocator_adopt(req->alloc, m->alloc);
     } else {
-        m = Message_clone(m, reqAlloc);
+        m = Message_clone(m, req->alloc);
     }
+    req->msgs[req->count++] = m;
+    req->length += m->length;
+    pipe->queueLen += m->length;
 
-    struct Pipe_WriteRequest_pvt* req =
-        Allocator_clone(reqAlloc, (&(struct Pipe_WriteRequest_pvt) {
-            .pipe = pipe,
-            .msg = m,
-            .alloc = reqAlloc
-        }));
-    Identity_set(req);
-
-    if (pipe->isActive) {
-        sendMessage2(req);
-    } else {
-        if (!pipe->bufferedRequest) {
-            Log_debug(pipe->pub.logger, "Buffering a message");
-            pipe->bufferedRequest = req;
-        } else {
-            Log_debug(pipe->pub.logger, "Appending to the buffered message");
-            uint8_t* buff =
-                Allocator_malloc(reqAlloc, m->length + pipe->bufferedRequest->msg->length);
-            Bits_memcpy(buff,
-                        pipe->bufferedRequest->msg->bytes,
-                        pipe->bufferedRequest->msg->length);
-            Bits_memcpy(buff+pipe->bufferedRequest->msg->length, m->bytes, m->length);
-            m->length += pipe->bufferedRequest->msg->length;
-            m->capacity = m->length;
-            m->bytes = buff;
-
-            Allocator_free(pipe->bufferedRequest->alloc);
-            pipe->bufferedRequest = req;
-        }
+    if (!pipe->isActive) {
+        Log_debug(pipe->pub.logger, "Buffering a message");
+    } else if (!pipe->isStream || !pipe->writesInFlight) {
+        flush(pipe);
     }
     return Error_NONE;
 }
@@ -167,7 +241,7 @@ static void onClose(uv_handle_t* handle)
 #endif
 #define ALLOC(buff) (((struct Allocator**) &(buff[-(8 + (((uintptr_t)buff) % 8))]))[0])
 
-static void incoming(uv_stream_t* stream, ssize_t nread, uv_buf_t buf)
+static void incoming2(uv_stream_t* stream, ssize_t nread, uv_buf_t buf)
 {
     struct Pipe_pvt* pipe = Identity_cast((struct Pipe_pvt*) stream->data);
 
@@ -212,13 +286,23 @@ static void incoming(uv_stream_t* stream, ssize_t nread, uv_buf_t buf)
     }
 }
 
+static void incoming(uv_stream_t* stream, ssize_t nread, uv_buf_t buf)
+{
+    uv_loop_t* loop = stream->loop;
+    uint64_t begin = EventBase_callbackBegin();
+    incoming2(stream, nread, buf);
+    EventBase_callbackEnd(loop, EventBase_Source_PIPE, begin);
+}
+
 static uv_buf_t allocate(uv_handle_t* handle, size_t size)
 {
     struct Pipe_pvt* pipe = Identity_cast((struct Pipe_pvt*) handle->data);
     size = Pipe_BUFFER_CAP;
     size_t fullSize = size + Pipe_PADDING_AMOUNT;
 
-    struct Allocator* child = Allocator_child(pipe->alloc);
+    // Space for the buffer and the struct Message which incoming() will allocate.
+    struct Allocator* child =
+        Allocator_scratch(pipe->alloc, fullSize + sizeof(struct Message) + 64);
     char* buff = Allocator_malloc(child, fullSize);
     buff += Pipe_PADDING_AMOUNT;
 
@@ -251,10 +335,9 @@ static void connected(uv_connect_t* req, int status)
         }
 
         // If there's anything buffered then send it.
-        if (pipe->bufferedRequest) {
-            Log_debug(pipe->pub.logger, "Sending buffered message");
-            sendMessage2(pipe->bufferedRequest);
-            pipe->bufferedRequest = NULL;
+        if (pipe->queueHead) {
+            Log_debug(pipe->pub.logger, "Sending buffered messages");
+            flush(pipe);
         }
     }
 }
@@ -416,6 +499,7 @@ struct Pipe* Pipe_named(const char* name,
 {
     struct Pipe_pvt* out = newPipe(eb, name, eh, userAlloc);
     struct EventBase_pvt* ctx = EventBase_privatize(eb);
+    out->isStream = 1;
 
     // Attempt to create pipe.
     if (!uv_pipe_bind(&out->server, out->pub.fullName)) {
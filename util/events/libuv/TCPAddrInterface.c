@@ -0,0 +1,528 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "exception/Except.h"
+#include "interface/Interface.h"
+#include "interface/FramingInterface.h"
+#include "interface/addressable/TCPAddrInterface.h"
+#include "memory/Allocator.h"
+#include "util/events/libuv/EventBase_pvt.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+#include "wire/Message.h"
+#include "wire/Error.h"
+
+#ifndef win32
+    #include <sys/socket.h>
+#endif
+
+/** Most messages which will be gathered into one uv_write() for a connection. */
+#define BATCH_SIZE 64
+
+/** Kernel send and receive buffer size for each connection. */
+#define SOCKET_BUFFER_SIZE (1 << 18)
+
+#define LISTEN_BACKLOG 16
+
+struct TCPAddrInterface_pvt;
+
+struct TCPAddrInterface_Conn
+{
+    uv_tcp_t handle;
+
+    /** The byte stream, FramingInterface wraps this. */
+    struct Interface stream;
+
+    /** Whole messages to and from the peer. */
+    struct Interface* framed;
+
+    /** The address of the peer, only the first tcp->pub.addr->addrLen bytes are used. */
+    struct Sockaddr_storage peer;
+
+    struct TCPAddrInterface_pvt* tcp;
+
+    /** Freeing this closes the connection. */
+    struct Allocator* alloc;
+
+    /** Job to close the handle when the allocator is freed */
+    struct Allocator_OnFreeJob* closeHandleOnFree;
+
+    uv_connect_t connectReq;
+
+    /** 0 until an outgoing connection succeeds. */
+    int connected;
+
+    /** Holds the messages in batch until they are written. */
+    struct Allocator* batchAlloc;
+    uv_buf_t batch[BATCH_SIZE];
+    int batchCount;
+
+    /** Bytes which are batched or being written. */
+    int queueLen;
+
+    struct TCPAddrInterface_Conn* next;
+
+    Identity
+};
+
+struct TCPAddrInterface_WriteRequest
+{
+    uv_write_t uvReq;
+    struct TCPAddrInterface_Conn* conn;
+    struct Allocator* alloc;
+    int length;
+    Identity
+};
+
+struct TCPAddrInterface_pvt
+{
+    struct AddrInterface pub;
+    struct Log* logger;
+    struct Allocator* alloc;
+
+    uv_tcp_t server;
+
+    /** Writes out the batches once per event loop iteration, before blocking for I/O. */
+    uv_prepare_t flushHandle;
+
+    /** Job to close the handles when the allocator is freed */
+    struct Allocator_OnFreeJob* closeHandlesOnFree;
+    int handlesOpen;
+
+    struct TCPAddrInterface_Conn* conns;
+
+    Identity
+};
+
+static void writeComplete(uv_write_t* uvReq, int error)
+{
+    struct TCPAddrInterface_WriteRequest* req =
+        Identity_cast((struct TCPAddrInterface_WriteRequest*) uvReq);
+    struct TCPAddrInterface_Conn* conn = req->conn;
+    if (error) {
+        Log_info(conn->tcp->logger, "DROP Failed to write to TCPAddrInterface [%s]",
+                 uv_err_name(uv_last_error(conn->handle.loop)) );
+    }
+    conn->queueLen -= req->length;
+    Assert_true(conn->queueLen >= 0);
+    Allocator_free(req->alloc);
+}
+
+/** Write everything which is batched for a connection with one vectored write. */
+static void flushConn(struct TCPAddrInterface_Conn* conn)
+{
+    if (!conn->connected || !conn->batchCount) {
+        return;
+    }
+    int length = 0;
+    for (int i = 0; i < conn->batchCount; i++) {
+        length += conn->batch[i].len;
+    }
+    struct TCPAddrInterface_WriteRequest* req =
+        Allocator_clone(conn->batchAlloc, (&(struct TCPAddrInterface_WriteRequest) {
+            .conn = conn,
+            .alloc = conn->batchAlloc,
+            .length = length
+        }));
+    Identity_set(req);
+
+    if (uv_write(&req->uvReq, (uv_stream_t*) &conn->handle,
+                 conn->batch, conn->batchCount, writeComplete))
+    {
+        Log_info(conn->tcp->logger, "DROP Failed writing to TCPAddrInterface [%s]",
+                 uv_err_name(uv_last_error(conn->handle.loop)) );
+        conn->queueLen -= length;
+        Allocator_free(req->alloc);
+    }
+    conn->batchAlloc = NULL;
+    conn->batchCount = 0;
+}
+
+static void flushCallback(uv_prepare_t* handle, int status)
+{
+    struct TCPAddrInterface_pvt* tcp =
+        Identity_cast((struct TCPAddrInterface_pvt*) handle->data);
+    for (struct TCPAddrInterface_Conn* conn = tcp->conns; conn; conn = conn->next) {
+        flushConn(conn);
+    }
+    uv_prepare_stop(&tcp->flushHandle);
+}
+
+/** Called by FramingInterface with the length-prefixed message. */
+static uint8_t streamSend(struct Message* m, struct Interface* iface)
+{
+    struct TCPAddrInterface_Conn* conn =
+        Identity_cast((struct TCPAddrInterface_Conn*) iface->senderContext);
+
+    if (conn->batchCount == BATCH_SIZE) {
+        flushConn(conn);
+        if (conn->batchCount == BATCH_SIZE) {
+            Log_debug(conn->tcp->logger, "DROP connection is not established");
+            return Error_NONE;
+        }
+    }
+
+    if (!conn->batchAlloc) {
+        conn->batchAlloc = Allocator_child(conn->alloc);
+    }
+    // This allocator will hold the message allocator in existance until it is written.
+    if (m->alloc) {
+        Allocator_adopt(conn->batchAlloc, m->alloc);
+    } else {
+        m = Message_clone(m, conn->batchAlloc);
+    }
+    conn->batch[conn->batchCount++] = (uv_buf_t) { .base = (char*)m->bytes, .len = m->length };
+    conn->queueLen += m->length;
+
+    uv_prepare_start(&conn->tcp->flushHandle, flushCallback);
+    return Error_NONE;
+}
+
+/**
+ * Frames are copied out of the read buffer because the headers which are pushed in front of
+ * one frame would otherwise land on the tail of the frame before it, which may still be queued.
+ */
+static uint8_t frameReceived(struct Message* frame, struct Interface* iface)
+{
+    struct TCPAddrInterface_Conn* conn =
+        Identity_cast((struct TCPAddrInterface_Conn*) iface->receiverContext);
+    struct TCPAddrInterface_pvt* tcp = conn->tcp;
+
+    if (!tcp->pub.generic.receiveMessage) {
+        return Error_NONE;
+    }
+    uint32_t addrLen = tcp->pub.addr->addrLen;
+    struct Allocator* alloc = Allocator_scratch(tcp->alloc,
+        TCPAddrInterface_PADDING_AMOUNT + addrLen + frame->length + sizeof(struct Message) + 64);
+    struct Message* m =
+        Message_new(frame->length, TCPAddrInterface_PADDING_AMOUNT + addrLen, alloc);
+    Bits_memcpy(m->bytes, frame->bytes, frame->length);
+    Message_push(m, conn->peer.nativeAddr, addrLen - 8, NULL);
+    Message_push(m, &tcp->pub.addr->addrLen, 8, NULL);
+    Interface_receiveMessage(&tcp->pub.generic, m);
+    Allocator_free(alloc);
+    return Error_NONE;
+}
+
+#if TCPAddrInterface_PADDING_AMOUNT < 8
+    #error
+#endif
+#define ALLOC(buff) (((struct Allocator**) &(buff[-(8 + (((uintptr_t)buff) % 8))]))[0])
+
+static void incoming2(uv_stream_t* stream, ssize_t nread, uv_buf_t buf)
+{
+    struct TCPAddrInterface_Conn* conn =
+        Identity_cast((struct TCPAddrInterface_Conn*) stream->data);
+
+    // Grab out the allocator which was placed there by allocate()
+    struct Allocator* alloc = buf.base ? ALLOC(buf.base) : NULL;
+
+    int shouldClose = 0;
+    if (nread < 0) {
+        if (uv_last_error(stream->loop).code == UV_EOF) {
+            Log_debug(conn->tcp->logger, "Connection closed by peer");
+        } else {
+            Log_info(conn->tcp->logger, "Connection encountered error [%s]",
+                     uv_err_name(uv_last_error(stream->loop)) );
+        }
+        shouldClose = 1;
+
+    } else if (nread > 0) {
+        struct Message* m = Allocator_malloc(alloc, sizeof(struct Message));
+        m->length = nread;
+        m->padding = TCPAddrInterface_PADDING_AMOUNT;
+        m->capacity = buf.len;
+        m->bytes = (uint8_t*)buf.base;
+        m->alloc = alloc;
+        if (Interface_receiveMessage(&conn->stream, m) == Error_OVERSIZE_MESSAGE) {
+            Log_info(conn->tcp->logger, "Closing connection which sent an oversize frame");
+            shouldClose = 1;
+        }
+    }
+
+    if (alloc) {
+        Allocator_free(alloc);
+    }
+    if (shouldClose) {
+        Allocator_free(conn->alloc);
+    }
+}
+
+static void incoming(uv_stream_t* stream, ssize_t nread, uv_buf_t buf)
+{
+    uv_loop_t* loop = stream->loop;
+    uint64_t begin = EventBase_callbackBegin();
+    incoming2(stream, nread, buf);
+    EventBase_callbackEnd(loop, EventBase_Source_TCP, begin);
+}
+
+static uv_buf_t allocate(uv_handle_t* handle, size_t size)
+{
+    struct TCPAddrInterface_Conn* conn =
+        Identity_cast((struct TCPAddrInterface_Conn*) handle->data);
+
+    size = TCPAddrInterface_BUFFER_CAP;
+    size_t fullSize = size + TCPAddrInterface_PADDING_AMOUNT;
+
+    // Space for the buffer and the struct Message which incoming() will allocate.
+    struct Allocator* child =
+        Allocator_scratch(conn->alloc, fullSize + sizeof(struct Message) + 64);
+    char* buff = Allocator_malloc(child, fullSize);
+    buff += TCPAddrInterface_PADDING_AMOUNT;
+
+    ALLOC(buff) = child;
+
+    return (uv_buf_t) { .base = buff, .len = size };
+}
+
+static void onConnClosed(uv_handle_t* wasClosed)
+{
+    struct TCPAddrInterface_Conn* conn =
+        Identity_cast((struct TCPAddrInterface_Conn*) wasClosed->data);
+    Allocator_onFreeComplete((struct Allocator_OnFreeJob*) conn->closeHandleOnFree);
+}
+
+static int closeConnOnFree(struct Allocator_OnFreeJob* job)
+{
+    struct TCPAddrInterface_Conn* conn =
+        Identity_cast((struct TCPAddrInterface_Conn*) job->userData);
+    struct TCPAddrInterface_Conn** connPtr = &conn->tcp->conns;
+    while (*connPtr && *connPtr != conn) {
+        connPtr = &(*connPtr)->next;
+    }
+    if (*connPtr) {
+        *connPtr = conn->next;
+    }
+    conn->closeHandleOnFree = job;
+    uv_close((uv_handle_t*)&conn->handle, onConnClosed);
+    return Allocator_ONFREE_ASYNC;
+}
+
+static struct TCPAddrInterface_Conn* newConn(struct TCPAddrInterface_pvt* tcp)
+{
+    struct Allocator* alloc = Allocator_child(tcp->alloc);
+    struct TCPAddrInterface_Conn* conn =
+        Allocator_calloc(alloc, sizeof(struct TCPAddrInterface_Conn), 1);
+    Bits_memcpyConst(&conn->stream, (&(struct Interface) {
+        .sendMessage = streamSend,
+        .senderContext = conn,
+        .allocator = alloc
+    }), sizeof(struct Interface));
+    conn->tcp = tcp;
+    conn->alloc = alloc;
+    Identity_set(conn);
+
+    conn->framed = FramingInterface_new(TCPAddrInterface_MAX_FRAME, &conn->stream, alloc);
+    conn->framed->receiveMessage = frameReceived;
+    conn->framed->receiverContext = conn;
+
+    uv_tcp_init(tcp->server.loop, &conn->handle);
+    conn->handle.data = conn;
+    conn->connectReq.data = conn;
+    Allocator_onFree(alloc, closeConnOnFree, conn);
+
+    conn->next = tcp->conns;
+    tcp->conns = conn;
+    return conn;
+}
+
+/** Once the connection is up. */
+static void setupConn(struct TCPAddrInterface_Conn* conn)
+{
+    conn->connected = 1;
+    uv_tcp_nodelay(&conn->handle, 1);
+    #ifndef win32
+        int size = SOCKET_BUFFER_SIZE;
+        setsockopt(conn->handle.io_watcher.fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(int));
+        setsockopt(conn->handle.io_watcher.fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(int));
+    #endif
+    if (uv_read_start((uv_stream_t*) &conn->handle, allocate, incoming)) {
+        Log_info(conn->tcp->logger, "uv_read_start() failed [%s]",
+                 uv_err_name(uv_last_error(conn->handle.loop)));
+        Allocator_free(conn->alloc);
+    }
+}
+
+static void connected(uv_connect_t* req, int status)
+{
+    struct TCPAddrInterface_Conn* conn = Identity_cast((struct TCPAddrInterface_Conn*) req->data);
+    if (status) {
+        Log_info(conn->tcp->logger, "Failed to connect to [%s] [%s]",
+                 Sockaddr_print(&conn->peer.addr, conn->alloc),
+                 uv_err_name(uv_last_error(conn->handle.loop)));
+        Allocator_free(conn->alloc);
+        return;
+    }
+    setupConn(conn);
+    flushConn(conn);
+}
+
+static struct TCPAddrInterface_Conn* connectTo(struct TCPAddrInterface_pvt* tcp,
+                                               struct Sockaddr_storage* peer)
+{
+    struct TCPAddrInterface_Conn* conn = newConn(tcp);
+    Bits_memcpy(&conn->peer, peer, peer->addr.addrLen);
+
+    int ret;
+    if (Sockaddr_getFamily(&peer->addr) == Sockaddr_AF_INET6) {
+        ret = uv_tcp_connect6(&conn->connectReq, &conn->handle,
+                              *((struct sockaddr_in6*)peer->nativeAddr), connected);
+    } else {
+        ret = uv_tcp_connect(&conn->connectReq, &conn->handle,
+                             *((struct sockaddr_in*)peer->nativeAddr), connected);
+    }
+    if (ret) {
+        Log_info(tcp->logger, "DROP Failed to connect [%s]",
+                 uv_err_name(uv_last_error(tcp->server.loop)));
+        Allocator_free(conn->alloc);
+        return NULL;
+    }
+    return conn;
+}
+
+static uint8_t sendMessage(struct Message* m, struct Interface* iface)
+{
+    struct TCPAddrInterface_pvt* tcp = Identity_cast((struct TCPAddrInterface_pvt*) iface);
+
+    struct Sockaddr_storage ss;
+    Message_pop(m, &ss, tcp->pub.addr->addrLen, NULL);
+    Assert_true(ss.addr.addrLen == tcp->pub.addr->addrLen);
+
+    struct TCPAddrInterface_Conn* conn = tcp->conns;
+    while (conn && Bits_memcmp(conn->peer.nativeAddr, ss.nativeAddr, ss.addr.addrLen - 8)) {
+        conn = conn->next;
+    }
+    if (!conn && !(conn = connectTo(tcp, &ss))) {
+        return Error_NONE;
+    }
+
+    if (conn->queueLen > TCPAddrInterface_MAX_QUEUE) {
+        Log_debug(tcp->logger, "DROP Maximum queue length reached");
+        return Error_LINK_LIMIT_EXCEEDED;
+    }
+    return Interface_sendMessage(conn->framed, m);
+}
+
+static void onConnection(uv_stream_t* server, int status)
+{
+    struct TCPAddrInterface_pvt* tcp = Identity_cast((struct TCPAddrInterface_pvt*) server->data);
+    if (status) {
+        Log_info(tcp->logger, "Failed to accept connection [%s]",
+                 uv_err_name(uv_last_error(server->loop)));
+        return;
+    }
+    struct TCPAddrInterface_Conn* conn = newConn(tcp);
+    int nameLen = Sockaddr_MAXSIZE;
+    if (uv_accept(server, (uv_stream_t*) &conn->handle)
+        || uv_tcp_getpeername(&conn->handle, (void*)conn->peer.nativeAddr, &nameLen))
+    {
+        Log_info(tcp->logger, "Failed to accept connection [%s]",
+                 uv_err_name(uv_last_error(server->loop)));
+        Allocator_free(conn->alloc);
+        return;
+    }
+    Sockaddr_normalizeNative(conn->peer.nativeAddr);
+    Bits_memcpyConst(&conn->peer.addr, tcp->pub.addr, Sockaddr_OVERHEAD);
+    setupConn(conn);
+}
+
+static void onClosed(uv_handle_t* wasClosed)
+{
+    struct TCPAddrInterface_pvt* tcp =
+        Identity_cast((struct TCPAddrInterface_pvt*) wasClosed->data);
+    if (!--tcp->handlesOpen) {
+        Allocator_onFreeComplete((struct Allocator_OnFreeJob*) tcp->closeHandlesOnFree);
+    }
+}
+
+static int closeHandlesOnFree(struct Allocator_OnFreeJob* job)
+{
+    struct TCPAddrInterface_pvt* tcp =
+        Identity_cast((struct TCPAddrInterface_pvt*) job->userData);
+    tcp->closeHandlesOnFree = job;
+    tcp->handlesOpen = 2;
+    uv_close((uv_handle_t*)&tcp->flushHandle, onClosed);
+    uv_close((uv_handle_t*)&tcp->server, onClosed);
+    return Allocator_ONFREE_ASYNC;
+}
+
+struct AddrInterface* TCPAddrInterface_new(struct EventBase* eventBase,
+                                           struct Sockaddr* addr,
+                                           struct Allocator* alloc,
+                                           struct Except* exHandler,
+                                           struct Log* logger)
+{
+    struct EventBase_pvt* base = EventBase_privatize(eventBase);
+
+    struct TCPAddrInterface_pvt* tcp =
+        Allocator_clone(alloc, (&(struct TCPAddrInterface_pvt) {
+            .pub = {
+                .generic = {
+                    .sendMessage = sendMessage,
+                    .allocator = alloc
+                },
+            },
+            .logger = logger,
+            .alloc = alloc
+        }));
+    Identity_set(tcp);
+
+    if (addr) {
+        Log_debug(logger, "Binding to address [%s]", Sockaddr_print(addr, alloc));
+    }
+
+    struct Sockaddr_storage ss;
+    if (!addr) {
+        Sockaddr_parse("0.0.0.0:0", &ss);
+        addr = &ss.addr;
+    }
+
+    uv_tcp_init(base->loop, &tcp->server);
+    tcp->server.data = tcp;
+
+    int ret;
+    void* native = Sockaddr_asNative(addr);
+    if (Sockaddr_getFamily(addr) == Sockaddr_AF_INET6) {
+        ret = uv_tcp_bind6(&tcp->server, *((struct sockaddr_in6*)native));
+    } else {
+        ret = uv_tcp_bind(&tcp->server, *((struct sockaddr_in*)native));
+    }
+    if (ret || uv_listen((uv_stream_t*) &tcp->server, LISTEN_BACKLOG, onConnection)) {
+        const char* err = uv_err_name(uv_last_error(base->loop));
+        uv_close((uv_handle_t*) &tcp->server, NULL);
+        Except_throw(exHandler, "failed to listen on TCP socket [%s]", err);
+    }
+
+    int nameLen = sizeof(struct Sockaddr_storage);
+    Bits_memset(&ss, 0, sizeof(struct Sockaddr_storage));
+    if (uv_tcp_getsockname(&tcp->server, (void*)ss.nativeAddr, &nameLen)) {
+        const char* err = uv_err_name(uv_last_error(base->loop));
+        uv_close((uv_handle_t*) &tcp->server, NULL);
+        Except_throw(exHandler, "uv_tcp_getsockname() failed [%s]", err);
+    }
+    ss.addr.addrLen = nameLen + 8;
+
+    tcp->pub.addr = Sockaddr_clone(&ss.addr, alloc);
+    Log_debug(logger, "Listening on [%s]", Sockaddr_print(tcp->pub.addr, alloc));
+
+    uv_prepare_init(base->loop, &tcp->flushHandle);
+    tcp->flushHandle.data = tcp;
+
+    Allocator_onFree(alloc, closeHandlesOnFree, tcp);
+
+    return &tcp->pub;
+}
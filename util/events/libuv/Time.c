@@ -14,20 +14,8 @@
  */
 #include "util/events/libuv/UvWrapper.h"
 #include "util/events/Time.h"
-#include "util/events/libuv/EventBase_pvt.h"
 
 uint64_t Time_hrtime()
 {
     return uv_hrtime();
 }
-
-uint64_t Time_currentTimeMilliseconds(struct EventBase* eventBase)
-{
-    struct EventBase_pvt* base = EventBase_privatize(eventBase);
-    return uv_now(base->loop) + base->baseTime;
-}
-
-uint64_t Time_currentTimeSeconds(struct EventBase* eventBase)
-{
-    return Time_currentTimeMilliseconds(eventBase) / 1024;
-}
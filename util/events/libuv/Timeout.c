@@ -16,39 +16,374 @@
 #include "memory/Allocator.h"
 #include "util/events/libuv/EventBase_pvt.h"
 #include "util/events/Timeout.h"
+#include "util/Assert.h"
 #include "util/Identity.h"
 
-struct Timeout
+#include <stdbool.h>
+
+/**
+ * Timeouts are kept on a hierarchical timing wheel, one per event base, which is driven by a
+ * single libuv timer. Each level has 64 slots, a slot in level 0 is one millisecond and a slot
+ * in each level above covers a whole turn of the level below it. A timeout goes in the lowest
+ * level where it is in the current turn and it is moved down a level when its slot comes up so
+ * it is only ever touched a few times before it fires. Each level keeps a bitmap of which slots
+ * are occupied so the libuv timer can be armed for the next time anything needs doing and
+ * the wheel never ticks through empty milliseconds.
+ */
+#define BITS 6
+#define SLOTS (1 << BITS)
+#define MASK (SLOTS - 1)
+#define LEVELS 8
+
+/** Timeouts which are further out than this are pulled in to it, this is about 4000 years. */
+#define MAX_MILLISECONDS ((((uint64_t)1) << (BITS * LEVELS - 1)) - 1)
+
+#define NOT_ARMED UINT64_MAX
+
+struct Timeout_Link
+{
+    struct Timeout_Link* next;
+    struct Timeout_Link* prev;
+};
+
+struct Timeout_Wheel
 {
     uv_timer_t timer;
 
+    /** The clock of the event base, the time of the uv loop unless it is virtual. */
+    const uint64_t* now;
+
+    /** Non-zero if the event base is virtual, then the libuv timer is never started. */
+    int isVirtual;
+
+    /** The time when the wheel was created, all ticks are relative to this. */
+    uint64_t baseTime;
+
+    /** The tick which the wheel has advanced to. */
+    uint64_t current;
+
+    /** The tick which the libuv timer is set for or NOT_ARMED. */
+    uint64_t armed;
+
+    /** The number of timeouts which are scheduled, the timer is stopped when there are none. */
+    uint32_t count;
+
+    /** Non-zero while timeouts are firing, the timer is armed once they are done. */
+    int firing;
+
+    /** Non-zero once the event base is freed. */
+    int freed;
+
+    /** The timeouts which are firing in this tick, they are in no slot. */
+    struct Timeout_Link* batch;
+
+    /** One bit for each slot which is not empty. */
+    uint64_t occupied[LEVELS];
+
+    struct Timeout_Link slots[LEVELS * SLOTS];
+
+    Identity
+};
+
+struct Timeout
+{
+    /** Must be first, NULL if the timeout is not scheduled. */
+    struct Timeout_Link link;
+
+    /** The tick when the timeout is due. */
+    uint64_t due;
+
+    /** The number of milliseconds between firings, zero if it only fires once. */
+    uint64_t interval;
+
+    /** The index of the slot which the timeout is in, -1 if it is in the firing batch. */
+    int slot;
+
     void (* callback)(void* callbackContext);
 
     void* callbackContext;
 
+    struct Timeout_Wheel* wheel;
+
     Identity
 };
 
+static inline uint64_t wheelTime(struct Timeout_Wheel* wheel)
+{
+    return *wheel->now - wheel->baseTime;
+}
+
+static inline bool isEmpty(struct Timeout_Link* list)
+{
+    return list->next == list;
+}
+
+static inline void listInit(struct Timeout_Link* list)
+{
+    list->next = list->prev = list;
+}
+
+static inline void listAppend(struct Timeout_Link* list, struct Timeout_Link* link)
+{
+    link->prev = list->prev;
+    link->next = list;
+    list->prev->next = link;
+    list->prev = link;
+}
+
+/** Move everything from one list to another empty list. */
+static inline void listMove(struct Timeout_Link* from, struct Timeout_Link* to)
+{
+    if (isEmpty(from)) {
+        listInit(to);
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    listInit(from);
+}
+
+static void removeTimeout(struct Timeout* timeout)
+{
+    struct Timeout_Link* link = &timeout->link;
+    if (!link->next) {
+        return;
+    }
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->next = link->prev = NULL;
+    struct Timeout_Wheel* wheel = timeout->wheel;
+    if (timeout->slot >= 0 && isEmpty(&wheel->slots[timeout->slot])) {
+        wheel->occupied[timeout->slot / SLOTS] &= ~(((uint64_t)1) << (timeout->slot % SLOTS));
+    }
+    if (!--wheel->count && !wheel->firing) {
+        // Let the loop end if there is nothing else for it to do.
+        uv_timer_stop(&wheel->timer);
+        wheel->armed = NOT_ARMED;
+    }
+}
+
+/** Put a timeout in the lowest level where it falls within the current turn. */
+static void place(struct Timeout_Wheel* wheel, struct Timeout* timeout)
+{
+    int level = 0;
+    while ((timeout->due >> (BITS * (level + 1))) != (wheel->current >> (BITS * (level + 1)))) {
+        level++;
+    }
+    Assert_true(level < LEVELS);
+    int slot = (timeout->due >> (BITS * level)) & MASK;
+    timeout->slot = level * SLOTS + slot;
+    listAppend(&wheel->slots[timeout->slot], &timeout->link);
+    wheel->occupied[level] |= ((uint64_t)1) << slot;
+    wheel->count++;
+}
+
+/**
+ * Find the next tick when something needs doing, either a slot in level 0 is due or a slot
+ * in one of the levels above needs to be moved down.
+ *
+ * @return the tick or NOT_ARMED if there are no timeouts.
+ */
+static uint64_t nextTick(struct Timeout_Wheel* wheel)
+{
+    uint64_t next = NOT_ARMED;
+    for (int level = 0; level < LEVELS; level++) {
+        int shift = BITS * level;
+        int position = (wheel->current >> shift) & MASK;
+        // Level 0 may have timeouts in the current slot, above that they are always ahead.
+        int first = (level) ? position + 1 : position;
+        if (first >= SLOTS) {
+            continue;
+        }
+        uint64_t ahead = wheel->occupied[level] >> first;
+        if (!ahead) {
+            continue;
+        }
+        uint64_t turn = (wheel->current >> (shift + BITS)) << (shift + BITS);
+        uint64_t tick = turn + (((uint64_t) (first + __builtin_ctzll(ahead))) << shift);
+        if (tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+static void handleEvent(uv_timer_t* handle, int status);
+
+static void arm(struct Timeout_Wheel* wheel, uint64_t tick)
+{
+    wheel->armed = tick;
+    if (wheel->isVirtual) {
+        // Timeout_runVirtual() picks it up.
+        return;
+    }
+    uint64_t time = wheelTime(wheel);
+    uv_timer_start(&wheel->timer, handleEvent, (tick > time) ? tick - time : 0, 0);
+}
+
+static void schedule(struct Timeout* timeout, uint64_t milliseconds)
+{
+    struct Timeout_Wheel* wheel = timeout->wheel;
+    if (milliseconds > MAX_MILLISECONDS) {
+        milliseconds = MAX_MILLISECONDS;
+    }
+    timeout->due = wheelTime(wheel) + milliseconds;
+    if (timeout->due < wheel->current) {
+        timeout->due = wheel->current;
+    }
+    place(wheel, timeout);
+    if (!wheel->firing && timeout->due < wheel->armed) {
+        arm(wheel, timeout->due);
+    }
+}
+
+/** Advance the wheel to a tick, moving down any slots which come up and firing level 0. */
+static void processTick(struct Timeout_Wheel* wheel, uint64_t tick)
+{
+    wheel->current = tick;
+    for (int level = LEVELS - 1; level > 0; level--) {
+        int shift = BITS * level;
+        if (tick & ((((uint64_t)1) << shift) - 1)) {
+            continue;
+        }
+        int slot = (tick >> shift) & MASK;
+        struct Timeout_Link moving;
+        listMove(&wheel->slots[level * SLOTS + slot], &moving);
+        wheel->occupied[level] &= ~(((uint64_t)1) << slot);
+        while (!isEmpty(&moving)) {
+            struct Timeout* timeout = Identity_cast((struct Timeout*) moving.next);
+            timeout->slot = -1;
+            removeTimeout(timeout);
+            place(wheel, timeout);
+        }
+    }
+
+    int slot = tick & MASK;
+    struct Timeout_Link batch;
+    listMove(&wheel->slots[slot], &batch);
+    wheel->occupied[0] &= ~(((uint64_t)1) << slot);
+    for (struct Timeout_Link* link = batch.next; link != &batch; link = link->next) {
+        ((struct Timeout*) link)->slot = -1;
+    }
+
+    // A callback may clear or free any of the timeouts in the batch, they unlink themselves.
+    wheel->batch = &batch;
+    uv_loop_t* loop = wheel->timer.loop;
+    while (!isEmpty(&batch) && !wheel->freed) {
+        struct Timeout* timeout = Identity_cast((struct Timeout*) batch.next);
+        removeTimeout(timeout);
+        if (timeout->interval) {
+            schedule(timeout, timeout->interval);
+        }
+        uint64_t begin = EventBase_callbackBegin();
+        timeout->callback(timeout->callbackContext);
+        EventBase_callbackEnd(loop, EventBase_Source_TIMER, begin);
+    }
+    wheel->batch = NULL;
+}
+
+/** Fire everything which is due and arm the timer for whatever comes next. */
+static void fire(struct Timeout_Wheel* wheel)
+{
+    wheel->armed = NOT_ARMED;
+    wheel->firing = 1;
+    uint64_t time = wheelTime(wheel);
+    uint64_t tick;
+    // Each tick is processed once, anything which is scheduled for the current tick while it
+    // is firing will wait for the next turn of the event loop.
+    for (uint64_t last = NOT_ARMED; (tick = nextTick(wheel)) <= time && tick != last;) {
+        processTick(wheel, tick);
+        last = tick;
+    }
+    wheel->firing = 0;
+    if (wheel->freed) {
+        return;
+    }
+    tick = nextTick(wheel);
+    if (tick == NOT_ARMED) {
+        uv_timer_stop(&wheel->timer);
+    } else {
+        arm(wheel, tick);
+    }
+}
+
 /**
  * The callback to be called by libuv.
  */
 static void handleEvent(uv_timer_t* handle, int status)
 {
-    struct Timeout* timeout = Identity_cast((struct Timeout*) handle);
-    timeout->callback(timeout->callbackContext);
+    struct Timeout_Wheel* wheel = Identity_cast((struct Timeout_Wheel*) handle);
+    fire(wheel);
+}
+
+/** See: EventBase_pvt.h */
+static int runVirtual(struct EventBase_pvt* base)
+{
+    struct Timeout_Wheel* wheel = base->timeouts;
+    if (!wheel || wheel->freed || wheel->armed == NOT_ARMED) {
+        return 0;
+    }
+    uint64_t due = wheel->baseTime + wheel->armed;
+    if (due > base->virtualTime) {
+        base->virtualTime = due;
+    }
+    fire(wheel);
+    return 1;
+}
+
+static void detachAll(struct Timeout_Link* list)
+{
+    while (!isEmpty(list)) {
+        struct Timeout_Link* link = list->next;
+        list->next = link->next;
+        link->next = link->prev = NULL;
+    }
 }
 
-static void onFree2(uv_handle_t* timer)
+static int onFreeWheel(struct Allocator_OnFreeJob* job)
 {
-    Allocator_onFreeComplete(timer->data);
+    struct Timeout_Wheel* wheel = Identity_cast((struct Timeout_Wheel*) job->userData);
+    // The loop is deleted along with the event base so the timer needs no closing but any
+    // timeouts which outlive the wheel must not touch it.
+    for (int i = 0; i < LEVELS * SLOTS; i++) {
+        detachAll(&wheel->slots[i]);
+    }
+    if (wheel->batch) {
+        detachAll(wheel->batch);
+    }
+    wheel->freed = 1;
+    return 0;
+}
+
+static struct Timeout_Wheel* getWheel(struct EventBase_pvt* base)
+{
+    if (!base->timeouts) {
+        struct Timeout_Wheel* wheel =
+            Allocator_calloc(base->alloc, sizeof(struct Timeout_Wheel), 1);
+        for (int i = 0; i < LEVELS * SLOTS; i++) {
+            listInit(&wheel->slots[i]);
+        }
+        uv_timer_init(base->loop, &wheel->timer);
+        wheel->now = base->pub.loopTime;
+        wheel->isVirtual = base->isVirtual;
+        wheel->baseTime = *wheel->now;
+        wheel->armed = NOT_ARMED;
+        Identity_set(wheel);
+        wheel->timer.data = wheel;
+        Allocator_onFree(base->alloc, onFreeWheel, wheel);
+        base->timeouts = wheel;
+        base->runVirtual = runVirtual;
+    }
+    return base->timeouts;
 }
 
 static int onFree(struct Allocator_OnFreeJob* job)
 {
     struct Timeout* t = Identity_cast((struct Timeout*) job->userData);
-    t->timer.data = job;
-    uv_close((uv_handle_t*) &t->timer, onFree2);
-    return Allocator_ONFREE_ASYNC;
+    removeTimeout(t);
+    return 0;
 }
 
 /**
@@ -76,12 +411,11 @@ static struct Timeout* setTimeout(void (* const callback)(void* callbackContext)
 
     timeout->callback = callback;
     timeout->callbackContext = callbackContext;
+    timeout->interval = (interval) ? milliseconds : 0;
+    timeout->wheel = getWheel(base);
     Identity_set(timeout);
 
-    uv_timer_init(base->loop, &timeout->timer);
-    uv_timer_start(&timeout->timer, handleEvent, milliseconds, (interval) ? milliseconds : 0);
-
-    timeout->timer.data = timeout;
+    schedule(timeout, milliseconds);
 
     Allocator_onFree(allocator, onFree, timeout);
 
@@ -113,13 +447,14 @@ void Timeout_resetTimeout(struct Timeout* timeout,
                           const uint64_t milliseconds)
 {
     Timeout_clearTimeout(timeout);
-    uv_timer_start(&timeout->timer, handleEvent, milliseconds, 0);
+    timeout->interval = 0;
+    if (!timeout->wheel->freed) {
+        schedule(timeout, milliseconds);
+    }
 }
 
 /** See: Timeout.h */
 void Timeout_clearTimeout(struct Timeout* timeout)
 {
-    if (!uv_is_closing((uv_handle_t*) &timeout->timer)) {
-        uv_timer_stop(&timeout->timer);
-    }
+    removeTimeout(timeout);
 }
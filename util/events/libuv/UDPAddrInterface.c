@@ -12,6 +12,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define string_strerror
 #include "util/events/libuv/UvWrapper.h"
 #include "exception/Except.h"
 #include "interface/Interface.h"
@@ -24,6 +25,59 @@
 #include "wire/Message.h"
 #include "wire/Error.h"
 
+#ifdef linux
+    #include "util/platform/libc/string.h"
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/udp.h>
+    #include <errno.h>
+
+    /**
+     * On Linux, datagrams are moved with recvmmsg() and sendmmsg() so that a burst costs one
+     * syscall rather than one per packet (and one allocator per packet in libuv's allocate()).
+     */
+    #define UDPAddrInterface_MMSG 1
+
+    /** With CAP_NET_ADMIN the socket buffers can grow past net.core.rmem_max and wmem_max. */
+    #ifdef SO_RCVBUFFORCE
+        #define RCVBUF_FORCE SO_RCVBUFFORCE
+        #define SNDBUF_FORCE SO_SNDBUFFORCE
+    #else
+        #define RCVBUF_FORCE 0
+        #define SNDBUF_FORCE 0
+    #endif
+
+    /** Number of datagrams which can be moved by a single recvmmsg() or sendmmsg() call. */
+    #define BATCH_SIZE 32
+
+    /** Enough scratch space for one receive buffer and the struct Message which wraps it. */
+    #define RECV_ALLOC_SIZE \
+        (UDPAddrInterface_BUFFER_CAP + UDPAddrInterface_PADDING_AMOUNT \
+            + Sockaddr_OVERHEAD + Sockaddr_MAXSIZE + sizeof(struct Message) + 64)
+
+    #if defined(UDP_SEGMENT) && defined(UDP_GRO)
+        /**
+         * Runs of same sized packets to one peer are sent as a single UDP_SEGMENT (GSO)
+         * datagram and the kernel is allowed to hand us coalesced UDP_GRO datagrams which
+         * are split here. Both are probed at startup and skipped if the kernel refuses.
+         */
+        #define UDPAddrInterface_GSO 1
+
+        /** A coalesced datagram must fit in one IP packet. */
+        #define GSO_MAX_BYTES 65000
+
+        /** Kernel limit on segments per GSO datagram (UDP_MAX_SEGMENTS). */
+        #define GSO_MAX_SEGMENTS 64
+
+        /**
+         * GRO buffers must hold the biggest coalesced datagram, so there are only a few of them
+         * but each can carry up to GSO_MAX_SEGMENTS packets.
+         */
+        #define GRO_BATCH_SIZE 4
+        #define GRO_BUFFER_SIZE 65536
+    #endif
+#endif
+
 struct UDPAddrInterface_pvt
 {
     struct AddrInterface pub;
@@ -38,9 +92,69 @@ struct UDPAddrInterface_pvt
     uv_udp_t uvHandle;
     int queueLen;
 
+#ifdef UDPAddrInterface_MMSG
+    /** Watches the socket for readability, used in place of uv_udp_recv_start(). */
+    uv_poll_t pollHandle;
+
+    /** Flushes the send batch once per event loop iteration, before blocking for I/O. */
+    uv_prepare_t flushHandle;
+
+    /** Number of handles which are still waiting for their close callback. */
+    int handlesOpen;
+
+    /** File descriptor of the socket owned by uvHandle. */
+    int fd;
+
+    /**
+     * Receive ring, each slot is a scratch allocator with a buffer which recvmmsg() fills in.
+     * Slots which were delivered are refilled before the next call, the rest are reused as-is.
+     */
+    struct Allocator* recvAlloc[BATCH_SIZE];
+    uint8_t* recvBuff[BATCH_SIZE];
+    struct iovec recvIov[BATCH_SIZE];
+    struct mmsghdr recvHdr[BATCH_SIZE];
+    struct Sockaddr_storage recvAddr[BATCH_SIZE];
+
+    /** Send batch, each slot holds the allocator of the message which it is sending. */
+    struct Allocator* sendAlloc[BATCH_SIZE];
+    struct iovec sendIov[BATCH_SIZE];
+    struct Sockaddr_storage sendAddr[BATCH_SIZE];
+    int sendCount;
+
+    /** The last batch was cut short by a full socket buffer, the next send reports it. */
+    int sendBufferFull;
+
+    /** One header per sendmmsg() datagram, several messages may share one under GSO. */
+    struct mmsghdr sendHdr[BATCH_SIZE];
+
+    /** Room for a UDP_GRO segment size and a SO_RXQ_OVFL drop count. */
+    uint64_t recvControl[BATCH_SIZE][(CMSG_SPACE(sizeof(int)) + CMSG_SPACE(4) + 7) / 8];
+
+    /** Non-zero if the kernel reports its receive drops, the count it sent last. */
+    int rxqOvfl;
+    uint32_t lastKernelDrops;
+
+    #ifdef UDPAddrInterface_GSO
+        uint64_t sendControl[BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t)) / 8];
+
+        /** Non-zero if the kernel accepts UDP_SEGMENT and UDP_GRO respectively. */
+        int gso;
+        int gro;
+    #endif
+#endif
+
     /** true if we are inside of the callback, used by blockFreeInsideCallback */
     int inCallback;
 
+    struct UDPAddrInterface_Stats stats;
+
+    /** Limit for growing the socket buffers, see UDPAddrInterface_setMaxBufferSize(). */
+    int32_t maxBufferSize;
+
+    /** See UDPAddrInterface_setBurstHandler(), NULL if there is none. */
+    UDPAddrInterface_BurstHandler burstHandler;
+    void* burstContext;
+
     Identity
 };
 
@@ -59,6 +173,414 @@ struct UDPAddrInterface_pvt* ifaceForHandle(uv_udp_t* handle)
     return Identity_cast((struct UDPAddrInterface_pvt*) hp);
 }
 
+#ifdef UDPAddrInterface_MMSG
+
+#ifdef UDPAddrInterface_GSO
+/**
+ * @return the index after the last message which can be sent as one GSO datagram together
+ *         with message number first. Every segment but the last must be the same size.
+ */
+static int gsoRunEnd(struct UDPAddrInterface_pvt* context, int first)
+{
+    int end = first + 1;
+    if (!context->gso) {
+        return end;
+    }
+    size_t segSize = context->sendIov[first].iov_len;
+    size_t total = segSize;
+    struct Sockaddr* dest = &context->sendAddr[first].addr;
+    while (end < context->sendCount && end - first < GSO_MAX_SEGMENTS) {
+        size_t len = context->sendIov[end].iov_len;
+        if (len > segSize || total + len > GSO_MAX_BYTES
+            || Bits_memcmp(&context->sendAddr[end], dest, dest->addrLen))
+        {
+            break;
+        }
+        total += len;
+        end++;
+        if (len < segSize) {
+            break;
+        }
+    }
+    return end;
+}
+#else
+    #define gsoRunEnd(context, first) ((first) + 1)
+#endif
+
+/**
+ * Fill in sendHdr for the messages from first onward.
+ *
+ * @param firstMessage will be set to the index of the first message in each datagram.
+ * @return the number of datagrams.
+ */
+static int buildSendHeaders(struct UDPAddrInterface_pvt* context,
+                            int first,
+                            int firstMessage[BATCH_SIZE + 1])
+{
+    int count = 0;
+    for (int i = first; i < context->sendCount; count++) {
+        int end = gsoRunEnd(context, i);
+        struct Sockaddr_storage* ss = &context->sendAddr[i];
+        context->sendHdr[count] = (struct mmsghdr) {
+            .msg_hdr = {
+                .msg_name = ss->nativeAddr,
+                .msg_namelen = ss->addr.addrLen - Sockaddr_OVERHEAD,
+                .msg_iov = &context->sendIov[i],
+                .msg_iovlen = end - i
+            }
+        };
+        #ifdef UDPAddrInterface_GSO
+            if (end - i > 1) {
+                struct msghdr* hdr = &context->sendHdr[count].msg_hdr;
+                hdr->msg_control = context->sendControl[count];
+                hdr->msg_controllen = sizeof(context->sendControl[count]);
+                struct cmsghdr* cm = CMSG_FIRSTHDR(hdr);
+                cm->cmsg_level = IPPROTO_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segSize = context->sendIov[i].iov_len;
+                Bits_memcpy(CMSG_DATA(cm), &segSize, sizeof(uint16_t));
+            }
+        #endif
+        firstMessage[count] = i;
+        i = end;
+    }
+    firstMessage[count] = context->sendCount;
+    return count;
+}
+
+/**
+ * Double a socket buffer after packets were dropped for want of space, up to maxBufferSize.
+ *
+ * @param option SO_RCVBUF or SO_SNDBUF.
+ * @param forceOption the same option which ignores the system limit, if the process is allowed.
+ * @param size the size in stats, updated with what the kernel reports.
+ * @param growths the counter in stats which is incremented if the buffer grew.
+ */
+static void growBuffer(struct UDPAddrInterface_pvt* context,
+                       int option,
+                       int forceOption,
+                       int32_t* size,
+                       uint32_t* growths)
+{
+    // Linux reports twice the size which was asked for, asking for the reported size doubles it.
+    int want = (*size < context->maxBufferSize) ? *size : context->maxBufferSize;
+    if (want <= 0 || want * 2 <= *size) {
+        return;
+    }
+    if ((!forceOption || setsockopt(context->fd, SOL_SOCKET, forceOption, &want, sizeof(int)))
+        && setsockopt(context->fd, SOL_SOCKET, option, &want, sizeof(int)))
+    {
+        return;
+    }
+    int current = 0;
+    socklen_t len = sizeof(int);
+    if (getsockopt(context->fd, SOL_SOCKET, option, &current, &len) || current <= *size) {
+        // Held down by the system limit, don't try again.
+        context->maxBufferSize = *size / 2;
+        Log_info(context->logger, "Socket buffer stays at [%d] bytes, see net.core.%s",
+                 *size, (option == SO_RCVBUF) ? "rmem_max" : "wmem_max");
+        return;
+    }
+    Log_info(context->logger, "Grew socket %s buffer from [%d] to [%d] bytes after drops",
+             (option == SO_RCVBUF) ? "receive" : "send", *size, current);
+    *size = current;
+    (*growths)++;
+}
+
+static void flushSendBatch(struct UDPAddrInterface_pvt* context)
+{
+    int firstMessage[BATCH_SIZE + 1];
+    int i = 0;
+    while (i < context->sendCount) {
+        int count = buildSendHeaders(context, i, firstMessage);
+        int ret = sendmmsg(context->fd, context->sendHdr, count, MSG_DONTWAIT);
+        if (ret > 0) {
+            i = firstMessage[ret];
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            Log_warn(context->logger, "DROP [%d] packets, socket buffer is full",
+                     context->sendCount - i);
+            context->stats.sendDrops += context->sendCount - i;
+            context->sendBufferFull = 1;
+            growBuffer(context, SO_SNDBUF, SNDBUF_FORCE,
+                       &context->stats.sendBufferSize, &context->stats.sendBufferGrowths);
+            break;
+        #ifdef UDPAddrInterface_GSO
+        } else if (context->gso && firstMessage[1] - firstMessage[0] > 1) {
+            // Typically EIO because the device can't checksum segments, send them one by one.
+            Log_info(context->logger, "Disabling UDP_SEGMENT after error [%s]",
+                     strerror(errno));
+            context->gso = 0;
+        #endif
+        } else {
+            // The first datagram of the remaining batch failed, skip it and try the rest.
+            Log_info(context->logger, "DROP Failed to write to UDPAddrInterface [%s]",
+                     strerror(errno));
+            i = firstMessage[1];
+        }
+    }
+    for (i = 0; i < context->sendCount; i++) {
+        Allocator_free(context->sendAlloc[i]);
+        context->sendAlloc[i] = NULL;
+    }
+    context->sendCount = 0;
+    uv_prepare_stop(&context->flushHandle);
+}
+
+static void flushCallback(uv_prepare_t* handle, int status)
+{
+    struct UDPAddrInterface_pvt* context =
+        Identity_cast((struct UDPAddrInterface_pvt*) handle->data);
+    flushSendBatch(context);
+}
+
+static uint8_t sendMessage(struct Message* m, struct Interface* iface)
+{
+    struct UDPAddrInterface_pvt* context = Identity_cast((struct UDPAddrInterface_pvt*) iface);
+
+    if (context->sendCount == BATCH_SIZE) {
+        flushSendBatch(context);
+    }
+    if (context->sendBufferFull) {
+        // Error_LINK_LIMIT_EXCEEDED is what starts the FairQueue in front of the link.
+        context->sendBufferFull = 0;
+        return Error_LINK_LIMIT_EXCEEDED;
+    }
+    int slot = context->sendCount;
+
+    // This allocator will hold the message allocator in existance until the batch is flushed.
+    struct Allocator* reqAlloc = Allocator_child(context->pub.generic.allocator);
+    if (m->alloc) {
+        Allocator_adopt(reqAlloc, m->alloc);
+    } else {
+        m = Message_clone(m, reqAlloc);
+    }
+
+    struct Sockaddr_storage* ss = &context->sendAddr[slot];
+    Message_pop(m, ss, context->pub.addr->addrLen, NULL);
+    Assert_true(ss->addr.addrLen == context->pub.addr->addrLen);
+
+    context->sendAlloc[slot] = reqAlloc;
+    context->sendIov[slot] = (struct iovec) { .iov_base = m->bytes, .iov_len = m->length };
+    if (!context->sendCount++) {
+        uv_prepare_start(&context->flushHandle, flushCallback);
+    }
+
+    return Error_NONE;
+}
+
+/** Give every slot which was delivered (or never filled) a fresh buffer. */
+static void refillRecvRing(struct UDPAddrInterface_pvt* context)
+{
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        if (context->recvAlloc[i]) {
+            continue;
+        }
+        struct Allocator* alloc =
+            Allocator_scratch(context->pub.generic.allocator, RECV_ALLOC_SIZE);
+        size_t headroom = UDPAddrInterface_PADDING_AMOUNT + context->pub.addr->addrLen;
+        uint8_t* buff = Allocator_malloc(alloc, UDPAddrInterface_BUFFER_CAP + headroom);
+        context->recvAlloc[i] = alloc;
+        context->recvBuff[i] = buff + headroom;
+        context->recvIov[i] = (struct iovec) {
+            .iov_base = context->recvBuff[i],
+            .iov_len = UDPAddrInterface_BUFFER_CAP
+        };
+    }
+}
+
+/** recvmmsg() overwrites the name and control lengths so they are reset before each call. */
+static void resetRecvHeaders(struct UDPAddrInterface_pvt* context, int count)
+{
+    for (int i = 0; i < count; i++) {
+        context->recvHdr[i] = (struct mmsghdr) {
+            .msg_hdr = {
+                .msg_name = context->recvAddr[i].nativeAddr,
+                .msg_namelen = Sockaddr_MAXSIZE,
+                .msg_iov = &context->recvIov[i],
+                .msg_iovlen = 1
+            }
+        };
+        int control = context->rxqOvfl;
+        #ifdef UDPAddrInterface_GSO
+            control |= context->gro;
+        #endif
+        if (control) {
+            context->recvHdr[i].msg_hdr.msg_control = context->recvControl[i];
+            context->recvHdr[i].msg_hdr.msg_controllen = sizeof(context->recvControl[i]);
+        }
+    }
+}
+
+/**
+ * Each datagram carries the number which the kernel has dropped on this socket so far,
+ * when it goes up the receive buffer was too small for the burst.
+ */
+static void checkKernelDrops(struct UDPAddrInterface_pvt* context, struct msghdr* hdr)
+{
+    #ifdef SO_RXQ_OVFL
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(hdr); cm; cm = CMSG_NXTHDR(hdr, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SO_RXQ_OVFL) {
+            continue;
+        }
+        uint32_t drops;
+        Bits_memcpyConst(&drops, CMSG_DATA(cm), 4);
+        uint32_t newDrops = drops - context->lastKernelDrops;
+        context->lastKernelDrops = drops;
+        if (newDrops) {
+            Log_debug(context->logger, "DROP kernel dropped [%u] incoming packets", newDrops);
+            context->stats.recvDrops += newDrops;
+            growBuffer(context, SO_RCVBUF, RCVBUF_FORCE,
+                       &context->stats.recvBufferSize, &context->stats.recvBufferGrowths);
+        }
+    }
+    #endif
+}
+
+static void deliver(struct UDPAddrInterface_pvt* context,
+                    struct Allocator* alloc,
+                    uint8_t* bytes,
+                    uint32_t length,
+                    struct sockaddr* addr)
+{
+    struct Message* m = Allocator_malloc(alloc, sizeof(struct Message));
+    m->length = length;
+    m->padding = UDPAddrInterface_PADDING_AMOUNT + context->pub.addr->addrLen;
+    m->capacity = UDPAddrInterface_BUFFER_CAP;
+    m->bytes = bytes;
+    m->alloc = alloc;
+    Message_push(m, addr, context->pub.addr->addrLen - 8, NULL);
+    Message_push(m, &context->pub.addr->addrLen, 8, NULL);
+    Interface_receiveMessage(&context->pub.generic, m);
+}
+
+#ifdef UDPAddrInterface_GSO
+/**
+ * Split a datagram which the kernel may have coalesced out of the GRO buffer in slot i,
+ * each segment is copied out so that the buffer stays in the ring.
+ */
+static void deliverSegments(struct UDPAddrInterface_pvt* context, int i, struct sockaddr* addr)
+{
+    uint32_t length = context->recvHdr[i].msg_len;
+    uint32_t segSize = length;
+    struct msghdr* hdr = &context->recvHdr[i].msg_hdr;
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(hdr); cm; cm = CMSG_NXTHDR(hdr, cm)) {
+        if (cm->cmsg_level == IPPROTO_UDP && cm->cmsg_type == UDP_GRO) {
+            int size;
+            Bits_memcpy(&size, CMSG_DATA(cm), sizeof(int));
+            segSize = (size > 0) ? (uint32_t) size : length;
+        }
+    }
+    for (uint32_t offset = 0; offset < length; offset += segSize) {
+        if (context->blockFreeInsideCallback) {
+            return;
+        }
+        uint32_t len = (length - offset < segSize) ? length - offset : segSize;
+        if (len > UDPAddrInterface_BUFFER_CAP) {
+            Log_debug(context->logger, "DROP oversize [%u] byte segment", len);
+            continue;
+        }
+        struct Allocator* alloc =
+            Allocator_scratch(context->pub.generic.allocator, RECV_ALLOC_SIZE);
+        size_t headroom = UDPAddrInterface_PADDING_AMOUNT + context->pub.addr->addrLen;
+        uint8_t* buff = Allocator_malloc(alloc, UDPAddrInterface_BUFFER_CAP + headroom);
+        Bits_memcpy(buff + headroom, &context->recvBuff[i][offset], len);
+        deliver(context, alloc, buff + headroom, len, addr);
+        Allocator_free(alloc);
+    }
+}
+#endif
+
+static void incoming2(uv_poll_t* handle, int status, int events)
+{
+    struct UDPAddrInterface_pvt* context =
+        Identity_cast((struct UDPAddrInterface_pvt*) handle->data);
+
+    if (status < 0) {
+        Log_warn(context->logger, "DROP encountered error [%s]",
+                 uv_err_name(uv_last_error(handle->loop)) );
+        return;
+    }
+
+    int batchSize = BATCH_SIZE;
+    #ifdef UDPAddrInterface_GSO
+        if (context->gro) {
+            // GRO slots own fixed buffers which are never handed out.
+            batchSize = GRO_BATCH_SIZE;
+        } else {
+            refillRecvRing(context);
+        }
+    #else
+        refillRecvRing(context);
+    #endif
+    resetRecvHeaders(context, batchSize);
+
+    int count = recvmmsg(context->fd, context->recvHdr, batchSize, MSG_DONTWAIT, NULL);
+    if (count < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            // probably causes a drop
+            Log_warn(context->logger, "DROP encountered error [%s]", strerror(errno));
+        }
+        return;
+    }
+
+    if (context->rxqOvfl && count > 0) {
+        // The count is a running total so the newest one is all that matters.
+        checkKernelDrops(context, &context->recvHdr[count - 1].msg_hdr);
+    }
+
+    context->inCallback = 1;
+    if (context->burstHandler) {
+        context->burstHandler(context->burstContext, true);
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct sockaddr* addr = (struct sockaddr*) context->recvAddr[i].nativeAddr;
+        Sockaddr_normalizeNative(addr);
+
+        int deliverable = context->recvHdr[i].msg_len > 0
+            && context->pub.generic.receiveMessage
+            && !context->blockFreeInsideCallback;
+
+        #ifdef UDPAddrInterface_GSO
+            if (context->gro) {
+                if (deliverable) {
+                    deliverSegments(context, i, addr);
+                }
+                continue;
+            }
+        #endif
+
+        struct Allocator* alloc = context->recvAlloc[i];
+        context->recvAlloc[i] = NULL;
+        if (deliverable) {
+            deliver(context, alloc, context->recvBuff[i], context->recvHdr[i].msg_len, addr);
+        }
+        Allocator_free(alloc);
+    }
+
+    if (context->burstHandler) {
+        context->burstHandler(context->burstContext, false);
+    }
+    context->inCallback = 0;
+    if (context->blockFreeInsideCallback) {
+        Allocator_onFreeComplete((struct Allocator_OnFreeJob*) context->blockFreeInsideCallback);
+    }
+}
+
+static void incoming(uv_poll_t* handle, int status, int events)
+{
+    uv_loop_t* loop = handle->loop;
+    uint64_t begin = EventBase_callbackBegin();
+    incoming2(handle, status, events);
+    EventBase_callbackEnd(loop, EventBase_Source_UDP, begin);
+}
+
+#else
+
 static void sendComplete(uv_udp_send_t* uvReq, int error)
 {
     struct UDPAddrInterface_WriteRequest_pvt* req =
@@ -79,9 +601,8 @@ static uint8_t sendMessage(struct Message* m, struct Interface* iface)
     struct UDPAddrInterface_pvt* context = Identity_cast((struct UDPAddrInterface_pvt*) iface);
 
     if (context->queueLen > UDPAddrInterface_MAX_QUEUE) {
-        Log_warn(context->logger, "DROP Maximum queue length reached");
-        return Error_NONE;
-        //return Error_UNDELIVERABLE;
+        Log_debug(context->logger, "DROP Maximum queue length reached");
+        return Error_LINK_LIMIT_EXCEEDED;
     }
 
     // This allocator will hold the message allocator in existance after it is freed.
@@ -110,21 +631,21 @@ static uint8_t sendMessage(struct Message* m, struct Interface* iface)
         { .base = (char*)m->bytes, .len = m->length }
     };
 
-    int ret = 0;
+    int ret;
     if (ss.addr.addrLen == sizeof(struct sockaddr_in6) + Sockaddr_OVERHEAD) {
-        uv_udp_send6(&req->uvReq, &context->uvHandle, buffers, 1,
-                     *((struct sockaddr_in6*)ss.nativeAddr), sendComplete);
+        ret = uv_udp_send6(&req->uvReq, &context->uvHandle, buffers, 1,
+                           *((struct sockaddr_in6*)ss.nativeAddr), sendComplete);
     } else {
-        uv_udp_send(&req->uvReq, &context->uvHandle, buffers, 1,
-                     *((struct sockaddr_in*)ss.nativeAddr), sendComplete);
+        ret = uv_udp_send(&req->uvReq, &context->uvHandle, buffers, 1,
+                          *((struct sockaddr_in*)ss.nativeAddr), sendComplete);
     }
 
     if (ret) {
+        // The write was refused outright rather than queued, a full queue is caught above.
         Log_info(context->logger, "DROP Failed writing to UDPAddrInterface [%s]",
                  uv_err_name(uv_last_error(context->uvHandle.loop)) );
         Allocator_free(req->alloc);
-        return Error_NONE;
-        //return Error_UNDELIVERABLE;
+        return Error_UNDELIVERABLE;
     }
     context->queueLen += m->length;
 
@@ -186,7 +707,9 @@ static uv_buf_t allocate(uv_handle_t* handle, size_t size)
     size = UDPAddrInterface_BUFFER_CAP;
     size_t fullSize = size + UDPAddrInterface_PADDING_AMOUNT + context->pub.addr->addrLen;
 
-    struct Allocator* child = Allocator_child(context->pub.generic.allocator);
+    // Space for the buffer and the struct Message which incoming() will allocate.
+    struct Allocator* child = Allocator_scratch(context->pub.generic.allocator,
+                                                fullSize + sizeof(struct Message) + 64);
     char* buff = Allocator_malloc(child, fullSize);
     buff += UDPAddrInterface_PADDING_AMOUNT + context->pub.addr->addrLen;
 
@@ -195,10 +718,17 @@ static uv_buf_t allocate(uv_handle_t* handle, size_t size)
     return (uv_buf_t) { .base = buff, .len = size };
 }
 
+#endif
+
 static void onClosed(uv_handle_t* wasClosed)
 {
     struct UDPAddrInterface_pvt* context =
         Identity_cast((struct UDPAddrInterface_pvt*) wasClosed->data);
+    #ifdef UDPAddrInterface_MMSG
+    if (--context->handlesOpen) {
+        return;
+    }
+    #endif
     Allocator_onFreeComplete((struct Allocator_OnFreeJob*) context->closeHandleOnFree);
 }
 
@@ -207,6 +737,12 @@ static int closeHandleOnFree(struct Allocator_OnFreeJob* job)
     struct UDPAddrInterface_pvt* context =
         Identity_cast((struct UDPAddrInterface_pvt*) job->userData);
     context->closeHandleOnFree = job;
+    #ifdef UDPAddrInterface_MMSG
+    // The poll handle must let go of the fd before the udp handle closes it.
+    context->handlesOpen = 3;
+    uv_close((uv_handle_t*)&context->pollHandle, onClosed);
+    uv_close((uv_handle_t*)&context->flushHandle, onClosed);
+    #endif
     uv_close((uv_handle_t*)&context->uvHandle, onClosed);
     return Allocator_ONFREE_ASYNC;
 }
@@ -238,7 +774,8 @@ struct AddrInterface* UDPAddrInterface_new(struct EventBase* eventBase,
                     .allocator = alloc
                 },
             },
-            .logger = logger
+            .logger = logger,
+            .maxBufferSize = UDPAddrInterface_MAX_BUFFER_SIZE
         }));
     Identity_set(context);
 
@@ -268,11 +805,61 @@ struct AddrInterface* UDPAddrInterface_new(struct EventBase* eventBase,
                      uv_err_name(uv_last_error(base->loop)));
     }
 
+    #ifdef UDPAddrInterface_MMSG
+    // libuv 0.10 has no uv_fileno(), the udp handle is only used for binding and closing.
+    context->fd = context->uvHandle.io_watcher.fd;
+    if (uv_poll_init_socket(base->loop, &context->pollHandle, context->fd)
+        || uv_poll_start(&context->pollHandle, UV_READABLE, incoming))
+    {
+        const char* err = uv_err_name(uv_last_error(base->loop));
+        uv_close((uv_handle_t*) &context->uvHandle, NULL);
+        Except_throw(exHandler, "uv_poll_start() failed [%s]", err);
+    }
+    context->pollHandle.data = context;
+    uv_prepare_init(base->loop, &context->flushHandle);
+    context->flushHandle.data = context;
+
+    #ifdef SO_BUSY_POLL
+        int busyPoll = EventBase_busyPoll(eventBase);
+        if (busyPoll
+            && setsockopt(context->fd, SOL_SOCKET, SO_BUSY_POLL, &busyPoll, sizeof(int)))
+        {
+            Log_info(logger, "Failed to set SO_BUSY_POLL [%s]", strerror(errno));
+        }
+    #endif
+
+    #ifdef SO_RXQ_OVFL
+        int ovfl = 1;
+        context->rxqOvfl = !setsockopt(context->fd, SOL_SOCKET, SO_RXQ_OVFL, &ovfl, sizeof(int));
+    #endif
+    socklen_t optLen = sizeof(int);
+    getsockopt(context->fd, SOL_SOCKET, SO_RCVBUF, &context->stats.recvBufferSize, &optLen);
+    optLen = sizeof(int);
+    getsockopt(context->fd, SOL_SOCKET, SO_SNDBUF, &context->stats.sendBufferSize, &optLen);
+
+    #ifdef UDPAddrInterface_GSO
+        // A zero default segment size leaves GSO off unless a message asks for it.
+        int zero = 0;
+        context->gso = !setsockopt(context->fd, IPPROTO_UDP, UDP_SEGMENT, &zero, sizeof(int));
+        int one = 1;
+        context->gro = !setsockopt(context->fd, IPPROTO_UDP, UDP_GRO, &one, sizeof(int));
+        for (int i = 0; context->gro && i < GRO_BATCH_SIZE; i++) {
+            context->recvBuff[i] = Allocator_malloc(alloc, GRO_BUFFER_SIZE);
+            context->recvIov[i] = (struct iovec) {
+                .iov_base = context->recvBuff[i],
+                .iov_len = GRO_BUFFER_SIZE
+            };
+        }
+        Log_debug(logger, "UDP_SEGMENT [%s] UDP_GRO [%s]",
+                  context->gso ? "on" : "off", context->gro ? "on" : "off");
+    #endif
+    #else
     if (uv_udp_recv_start(&context->uvHandle, allocate, incoming)) {
         const char* err = uv_err_name(uv_last_error(base->loop));
         uv_close((uv_handle_t*) &context->uvHandle, NULL);
         Except_throw(exHandler, "uv_udp_recv_start() failed [%s]", err);
     }
+    #endif
 
     int nameLen = sizeof(struct Sockaddr_storage);
     Bits_memset(&ss, 0, sizeof(struct Sockaddr_storage));
@@ -291,3 +878,24 @@ struct AddrInterface* UDPAddrInterface_new(struct EventBase* eventBase,
 
     return &context->pub;
 }
+
+void UDPAddrInterface_getStats(struct AddrInterface* iface, struct UDPAddrInterface_Stats* out)
+{
+    struct UDPAddrInterface_pvt* context = Identity_cast((struct UDPAddrInterface_pvt*) iface);
+    Bits_memcpyConst(out, &context->stats, sizeof(struct UDPAddrInterface_Stats));
+}
+
+void UDPAddrInterface_setMaxBufferSize(struct AddrInterface* iface, int32_t maxBytes)
+{
+    struct UDPAddrInterface_pvt* context = Identity_cast((struct UDPAddrInterface_pvt*) iface);
+    context->maxBufferSize = maxBytes;
+}
+
+void UDPAddrInterface_setBurstHandler(struct AddrInterface* iface,
+                                      UDPAddrInterface_BurstHandler handler,
+                                      void* handlerContext)
+{
+    struct UDPAddrInterface_pvt* context = Identity_cast((struct UDPAddrInterface_pvt*) iface);
+    context->burstHandler = handler;
+    context->burstContext = handlerContext;
+}
@@ -0,0 +1,89 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "memory/Allocator.h"
+#include "util/events/libuv/EventBase_pvt.h"
+#include "util/events/WorkQueue.h"
+#include "util/Identity.h"
+
+struct WorkQueue_Job
+{
+    uv_work_t req;
+
+    void (* work)(void* callbackContext);
+
+    void (* onComplete)(void* callbackContext);
+
+    void* callbackContext;
+
+    /** True until work has returned. */
+    int running;
+
+    /** Set if the allocator was freed while work was running. */
+    struct Allocator_OnFreeJob* freeJob;
+
+    Identity
+};
+
+static void doWork(uv_work_t* req)
+{
+    struct WorkQueue_Job* job = Identity_cast((struct WorkQueue_Job*) req->data);
+    job->work(job->callbackContext);
+}
+
+static void afterWork(uv_work_t* req, int status)
+{
+    struct WorkQueue_Job* job = Identity_cast((struct WorkQueue_Job*) req->data);
+    job->running = 0;
+    if (job->freeJob) {
+        // Not safe to touch job after this.
+        Allocator_onFreeComplete(job->freeJob);
+        return;
+    }
+    job->onComplete(job->callbackContext);
+}
+
+static int onFree(struct Allocator_OnFreeJob* freeJob)
+{
+    struct WorkQueue_Job* job = Identity_cast((struct WorkQueue_Job*) freeJob->userData);
+    if (!job->running) {
+        return 0;
+    }
+    job->freeJob = freeJob;
+    return Allocator_ONFREE_ASYNC;
+}
+
+/** See: WorkQueue.h */
+int WorkQueue_run(void (* const work)(void* callbackContext),
+                  void (* const onComplete)(void* callbackContext),
+                  void* const callbackContext,
+                  struct EventBase* eventBase,
+                  struct Allocator* allocator)
+{
+    struct EventBase_pvt* base = EventBase_privatize(eventBase);
+    struct WorkQueue_Job* job = Allocator_calloc(allocator, sizeof(struct WorkQueue_Job), 1);
+    job->work = work;
+    job->onComplete = onComplete;
+    job->callbackContext = callbackContext;
+    job->req.data = job;
+    Identity_set(job);
+
+    if (uv_queue_work(base->loop, &job->req, doWork, afterWork)) {
+        return -1;
+    }
+    job->running = 1;
+    Allocator_onFree(allocator, onFree, job);
+    return 0;
+}
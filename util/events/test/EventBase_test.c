@@ -0,0 +1,81 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Time.h"
+#include "util/events/Timeout.h"
+#include "util/Assert.h"
+
+/** Long enough to count as a stall. */
+#define SLOW_NANOSECONDS 5000000
+
+static void slow(void* vbase)
+{
+    uint64_t begin = Time_hrtime();
+    while (Time_hrtime() - begin < SLOW_NANOSECONDS) {
+        // spin
+    }
+}
+
+static void fast(void* vbase)
+{
+}
+
+static void busyPollOff(void* vbase)
+{
+    EventBase_setBusyPoll((struct EventBase*) vbase, 0);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct EventBase* base = EventBase_new(alloc);
+    struct EventBase_Stats* stats = EventBase_stats(base);
+
+    // The handles which measure the loop are not events.
+    Assert_always(EventBase_eventCount(base) == 0);
+
+    stats->stallNanoseconds = SLOW_NANOSECONDS / 2;
+    Timeout_setTimeout(fast, base, 10, base, alloc);
+    Timeout_setTimeout(slow, base, 20, base, alloc);
+    Timeout_setTimeout(fast, base, 40, base, alloc);
+
+    // Returns by itself once there are no more timeouts scheduled.
+    EventBase_beginLoop(base);
+
+    Assert_always(stats->callbacks[EventBase_Source_TIMER] == 3);
+    Assert_always(stats->callbacks[EventBase_Source_UDP] == 0);
+    Assert_always(stats->stalls == 1);
+    Assert_always(stats->longestSource == EventBase_Source_TIMER);
+    Assert_always(stats->longestNanoseconds >= SLOW_NANOSECONDS);
+    Assert_always(stats->busyNanoseconds >= SLOW_NANOSECONDS);
+
+    // Most of the 40 milliseconds was spent waiting for the timeouts.
+    Assert_always(stats->idleNanoseconds > stats->busyNanoseconds);
+
+    // Busy polling, turning it off while the loop runs switches back to blocking.
+    EventBase_setBusyPoll(base, 1000);
+    Assert_always(EventBase_busyPoll(base) == 1000);
+    Timeout_setTimeout(fast, base, 5, base, alloc);
+    Timeout_setTimeout(busyPollOff, base, 10, base, alloc);
+    Timeout_setTimeout(fast, base, 20, base, alloc);
+    EventBase_beginLoop(base);
+    Assert_always(stats->callbacks[EventBase_Source_TIMER] == 6);
+    Assert_always(EventBase_busyPoll(base) == 0);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "util/events/libuv/UvWrapper.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Mailbox.h"
+#include "util/Assert.h"
+
+#include <stdint.h>
+
+#define THREADS 4
+#define MESSAGES 20000
+
+struct TestMessage
+{
+    struct Mailbox_Message msg;
+    int thread;
+    int number;
+};
+
+struct Context
+{
+    struct Mailbox* mailbox;
+    struct EventBase* base;
+    struct TestMessage messages[THREADS][MESSAGES];
+    int nextExpected[THREADS];
+    int received;
+};
+
+struct Sender
+{
+    struct Context* ctx;
+    int thread;
+};
+
+static void sendAll(void* vSender)
+{
+    struct Sender* s = vSender;
+    for (int i = 0; i < MESSAGES; i++) {
+        struct TestMessage* m = &s->ctx->messages[s->thread][i];
+        m->thread = s->thread;
+        m->number = i;
+        Mailbox_post(s->ctx->mailbox, &m->msg);
+    }
+}
+
+static void onMessage(struct Mailbox_Message* msg, void* vContext)
+{
+    struct Context* ctx = vContext;
+    struct TestMessage* m = (struct TestMessage*) msg;
+    // Messages from each thread arrive in order and only once.
+    Assert_always(m->number == ctx->nextExpected[m->thread]);
+    ctx->nextExpected[m->thread]++;
+    if (++ctx->received == THREADS * MESSAGES) {
+        EventBase_endLoop(ctx->base);
+    }
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    static struct Context ctx;
+    ctx.base = EventBase_new(alloc);
+    ctx.mailbox = Mailbox_new(onMessage, &ctx, ctx.base, alloc);
+
+    uv_thread_t threads[THREADS];
+    struct Sender senders[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        senders[i] = (struct Sender) { .ctx = &ctx, .thread = i };
+        Assert_always(!uv_thread_create(&threads[i], sendAll, &senders[i]));
+    }
+
+    EventBase_beginLoop(ctx.base);
+
+    for (int i = 0; i < THREADS; i++) {
+        uv_thread_join(&threads[i]);
+    }
+    Assert_always(ctx.received == THREADS * MESSAGES);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,95 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/MetricsServer.h"
+#include "util/events/Timeout.h"
+#include "util/platform/Sockaddr.h"
+#include "util/Assert.h"
+#include "util/CString.h"
+#include "util/Metrics.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define REQUEST "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+struct Context
+{
+    int fd;
+    char response[4096];
+    int length;
+    struct Allocator* serverAlloc;
+    struct Allocator* pollAlloc;
+};
+
+static void poll(void* vctx)
+{
+    struct Context* ctx = vctx;
+    int len = read(ctx->fd, &ctx->response[ctx->length], sizeof(ctx->response) - ctx->length - 1);
+    if (len > 0) {
+        ctx->length += len;
+    } else if (len == 0) {
+        // The server closes the connection after the response.
+        Allocator_free(ctx->pollAlloc);
+        Allocator_free(ctx->serverAlloc);
+    }
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct EventBase* base = EventBase_new(alloc);
+
+    uint64_t packets = 12;
+    struct Histogram times = { .count = 0 };
+    Histogram_add(&times, 100);
+    struct Metrics* metrics = Metrics_new(alloc);
+    Metrics_addCounter(metrics, "cjdns_test_packets_total", "Test packets.", &packets);
+    Metrics_addHistogram(metrics, "cjdns_test_milliseconds", "Test times.", &times);
+
+    struct Context ctx = {
+        .serverAlloc = Allocator_child(alloc),
+        .pollAlloc = Allocator_child(alloc)
+    };
+    struct Sockaddr_storage ss;
+    Assert_always(!Sockaddr_parse("127.0.0.1:0", &ss));
+    struct MetricsServer* server =
+        MetricsServer_new(metrics, &ss.addr, base, ctx.serverAlloc, NULL, NULL);
+
+    // The kernel completes the connection before the server accepts it.
+    ctx.fd = socket(AF_INET, SOCK_STREAM, 0);
+    Assert_always(ctx.fd >= 0);
+    Assert_always(!connect(ctx.fd, Sockaddr_asNative(server->addr), sizeof(struct sockaddr_in)));
+    Assert_always(write(ctx.fd, REQUEST, CString_strlen(REQUEST)) == (int)CString_strlen(REQUEST));
+    fcntl(ctx.fd, F_SETFL, O_NONBLOCK);
+
+    Timeout_setInterval(poll, &ctx, 1, base, ctx.pollAlloc);
+    EventBase_beginLoop(base);
+    close(ctx.fd);
+
+    ctx.response[ctx.length] = '\0';
+    Assert_always(CString_strstr(ctx.response, "HTTP/1.0 200 OK\r\n") == ctx.response);
+    Assert_always(CString_strstr(ctx.response, "\r\n\r\n# HELP cjdns_test_packets_total"));
+    Assert_always(CString_strstr(ctx.response, "\ncjdns_test_packets_total 12\n"));
+    Assert_always(CString_strstr(ctx.response, "# TYPE cjdns_test_milliseconds summary\n"));
+    Assert_always(CString_strstr(ctx.response, "\ncjdns_test_milliseconds_count 1\n"));
+
+    Allocator_free(alloc);
+    return 0;
+}
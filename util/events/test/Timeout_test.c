@@ -0,0 +1,127 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Time.h"
+#include "util/events/Timeout.h"
+#include "util/Assert.h"
+
+#define COUNT 8
+
+struct Context
+{
+    struct EventBase* base;
+    struct Timeout* timeouts[COUNT];
+    struct Allocator* allocs[COUNT];
+    uint64_t due[COUNT];
+    int fired[COUNT];
+    uint64_t startTime;
+    int order;
+};
+
+static struct Context* fire(void* vctx, int i)
+{
+    struct Context* ctx = vctx;
+    Assert_always(Time_currentTimeMilliseconds(ctx->base) >= ctx->startTime + ctx->due[i]);
+    ctx->fired[i]++;
+    ctx->order = ctx->order * 10 + i;
+    return ctx;
+}
+
+static void timeout0(void* vctx)
+{
+    fire(vctx, 0);
+}
+
+static void timeout1(void* vctx)
+{
+    struct Context* ctx = fire(vctx, 1);
+    // Due at the same time, freeing it here must stop it from firing.
+    Allocator_free(ctx->allocs[2]);
+}
+
+static void timeout2(void* vctx)
+{
+    fire(vctx, 2);
+}
+
+static void timeout3(void* vctx)
+{
+    fire(vctx, 3);
+}
+
+static void interval4(void* vctx)
+{
+    struct Context* ctx = fire(vctx, 4);
+    ctx->due[4] += 20;
+    if (ctx->fired[4] == 3) {
+        Timeout_clearTimeout(ctx->timeouts[4]);
+    }
+}
+
+static void timeout5(void* vctx)
+{
+    struct Context* ctx = fire(vctx, 5);
+    // Further out than one turn of the lowest level.
+    if (ctx->fired[5] == 1) {
+        ctx->due[5] = Time_currentTimeMilliseconds(ctx->base) - ctx->startTime + 100;
+        Timeout_resetTimeout(ctx->timeouts[5], 100);
+    }
+}
+
+static void neverFires(void* vctx)
+{
+    Assert_always(0);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Context ctx = { .base = EventBase_new(alloc) };
+    ctx.startTime = Time_currentTimeMilliseconds(ctx.base);
+
+    void (* callbacks[COUNT])(void*) = {
+        timeout0, timeout1, timeout2, timeout3, interval4, timeout5, neverFires, neverFires
+    };
+    uint64_t due[COUNT] = { 0, 30, 30, 70, 20, 300, 40, 100 };
+    for (int i = 0; i < COUNT; i++) {
+        ctx.allocs[i] = Allocator_child(alloc);
+        ctx.due[i] = due[i];
+        if (i == 4) {
+            ctx.timeouts[i] =
+                Timeout_setInterval(callbacks[i], &ctx, due[i], ctx.base, ctx.allocs[i]);
+        } else {
+            ctx.timeouts[i] =
+                Timeout_setTimeout(callbacks[i], &ctx, due[i], ctx.base, ctx.allocs[i]);
+        }
+    }
+    Timeout_clearTimeout(ctx.timeouts[6]);
+    Allocator_free(ctx.allocs[7]);
+
+    // Returns by itself once there are no more timeouts scheduled.
+    EventBase_beginLoop(ctx.base);
+
+    Assert_always(ctx.fired[0] == 1);
+    Assert_always(ctx.fired[1] == 1);
+    Assert_always(ctx.fired[2] == 0);
+    Assert_always(ctx.fired[3] == 1);
+    Assert_always(ctx.fired[4] == 3);
+    Assert_always(ctx.fired[5] == 2);
+    Assert_always(ctx.order == 4144355);
+
+    Allocator_free(alloc);
+    return 0;
+}
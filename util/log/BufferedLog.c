@@ -0,0 +1,167 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "util/log/BufferedLog.h"
+#include "util/log/Log_impl.h"
+#include "util/events/Timeout.h"
+#include "util/Bits.h"
+#include "util/Identity.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** Followed by the message and a null, padded to a multiple of 8 bytes. */
+struct Record
+{
+    const char* file;
+    uint32_t line;
+    uint16_t level;
+    uint16_t length;
+};
+
+#define RECORD_SIZE(len) (((sizeof(struct Record) + (len) + 1) + 7) & ~7)
+
+/** Long lines are cut to this, WriterLog does the same. */
+#define MAX_MESSAGE 1023
+
+struct BufferedLog
+{
+    struct Log pub;
+    struct Log* wrapped;
+    struct Timeout* flushTimeout;
+    bool flushPending;
+    uint32_t used;
+    uint32_t dropped;
+    uint64_t buffer[BufferedLog_SIZE / 8];
+    Identity
+};
+
+/** Log_callback takes a va_list so the message needs to be passed through "%s". */
+static void forward(struct Log* log,
+                    enum Log_Level logLevel,
+                    const char* file,
+                    int line,
+                    const char* format,
+                    ...)
+{
+    va_list args;
+    va_start(args, format);
+    log->print(log, logLevel, file, line, format, args);
+    va_end(args);
+}
+
+static void flush(void* vBufferedLog)
+{
+    struct BufferedLog* bl = Identity_cast((struct BufferedLog*) vBufferedLog);
+    bl->flushPending = false;
+
+    // Anything the wrapped log adds while this runs waits for the next flush.
+    uint32_t end = bl->used;
+    uint8_t* buff = (uint8_t*) bl->buffer;
+    for (uint32_t i = 0; i < end;) {
+        struct Record* r = (struct Record*) &buff[i];
+        forward(bl->wrapped, r->level, r->file, r->line, "%s", (char*) &r[1]);
+        i += RECORD_SIZE(r->length);
+    }
+    if (bl->used > end) {
+        Bits_memmove(buff, &buff[end], bl->used - end);
+    }
+    bl->used -= end;
+
+    if (bl->dropped) {
+        uint32_t dropped = bl->dropped;
+        bl->dropped = 0;
+        forward(bl->wrapped, Log_Level_ERROR, Gcc_SHORT_FILE, Gcc_LINE,
+                "There were [%u] log messages dropped because the buffer was full", dropped);
+    }
+    if (bl->used && !bl->flushPending) {
+        bl->flushPending = true;
+        Timeout_resetTimeout(bl->flushTimeout, 0);
+    }
+}
+
+static void print(struct Log* genericLog,
+                  enum Log_Level logLevel,
+                  const char* file,
+                  int line,
+                  const char* format,
+                  va_list args)
+{
+    struct BufferedLog* bl = Identity_cast((struct BufferedLog*) genericLog);
+
+    if (logLevel >= Log_Level_ERROR) {
+        // Urgent, and the program might be about to stop.
+        flush(bl);
+        bl->wrapped->print(bl->wrapped, logLevel, file, line, format, args);
+        return;
+    }
+
+    uint8_t* buff = (uint8_t*) bl->buffer;
+    uint32_t space = BufferedLog_SIZE - bl->used;
+    if (space < RECORD_SIZE(0)) {
+        bl->dropped++;
+        return;
+    }
+    struct Record* r = (struct Record*) &buff[bl->used];
+    char* message = (char*) &r[1];
+    uint32_t room = space - sizeof(struct Record);
+    int len = vsnprintf(message, (room > MAX_MESSAGE + 1) ? MAX_MESSAGE + 1 : room, format, args);
+    if (len < 0) {
+        return;
+    }
+    if ((uint32_t) len > MAX_MESSAGE) {
+        len = MAX_MESSAGE;
+    }
+    if (RECORD_SIZE(len) > space) {
+        // Truncated by lack of space rather than by being too long.
+        bl->dropped++;
+        return;
+    }
+    r->file = file;
+    r->line = line;
+    r->level = logLevel;
+    r->length = len;
+    bl->used += RECORD_SIZE(len);
+
+    if (!bl->flushPending) {
+        bl->flushPending = true;
+        Timeout_resetTimeout(bl->flushTimeout, 0);
+    }
+}
+
+static bool isEnabled(struct Log* genericLog,
+                      enum Log_Level logLevel,
+                      const char* file,
+                      int line)
+{
+    struct BufferedLog* bl = Identity_cast((struct BufferedLog*) genericLog);
+    return !bl->wrapped->isEnabled || bl->wrapped->isEnabled(bl->wrapped, logLevel, file, line);
+}
+
+/** See: BufferedLog.h */
+struct Log* BufferedLog_new(struct Log* wrapped,
+                            struct EventBase* eventBase,
+                            struct Allocator* alloc)
+{
+    struct BufferedLog* bl = Allocator_calloc(alloc, sizeof(struct BufferedLog), 1);
+    bl->pub.print = print;
+    bl->pub.isEnabled = isEnabled;
+    bl->wrapped = wrapped;
+    Identity_set(bl);
+    bl->flushTimeout = Timeout_setTimeout(flush, bl, 0, eventBase, alloc);
+    Timeout_clearTimeout(bl->flushTimeout);
+    return &bl->pub;
+}
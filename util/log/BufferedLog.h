@@ -0,0 +1,42 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BufferedLog_H
+#define BufferedLog_H
+
+#include "memory/Allocator.h"
+#include "util/events/EventBase.h"
+#include "util/log/Log.h"
+#include "util/Linker.h"
+Linker_require("util/log/BufferedLog.c")
+
+/** The number of bytes of formatted messages which can be waiting to be passed on. */
+#define BufferedLog_SIZE (1<<15)
+
+/**
+ * Create a log which formats each message at once, because its arguments might not outlive
+ * the call, and passes it to the wrapped log from the event loop once the current event has been
+ * handled. A burst of logging then costs the formatting rather than a write for every message.
+ * Messages of level ERROR or higher are passed on immediately, after any which are waiting,
+ * and if the buffer is full then messages are dropped and counted.
+ *
+ * @param wrapped the log which will print the messages.
+ * @param eventBase the event base.
+ * @param alloc the allocator, when freed any waiting messages are discarded.
+ */
+struct Log* BufferedLog_new(struct Log* wrapped,
+                            struct EventBase* eventBase,
+                            struct Allocator* alloc);
+
+#endif
@@ -39,11 +39,23 @@ static void doLog(struct Log* genericLog,
     }
 }
 
+static bool isEnabled(struct Log* genericLog,
+                      enum Log_Level logLevel,
+                      const char* file,
+                      int lineNum)
+{
+    struct IndirectLog_pvt* il = Identity_cast((struct IndirectLog_pvt*) genericLog);
+    return il->wrapped
+        && (!il->wrapped->isEnabled
+            || il->wrapped->isEnabled(il->wrapped, logLevel, file, lineNum));
+}
+
 struct Log* IndirectLog_new(struct Allocator* alloc)
 {
     struct IndirectLog_pvt* il = Allocator_clone(alloc, (&(struct IndirectLog_pvt) {
         .log = {
-            .print = doLog
+            .print = doLog,
+            .isEnabled = isEnabled
         }
     }));
     Identity_set(il);
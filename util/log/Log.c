@@ -19,6 +19,11 @@
 
 #include <stdarg.h>
 
+bool Log_shouldPrint(struct Log* log, enum Log_Level logLevel, const char* file, int line)
+{
+    return !log->isEnabled || log->isEnabled(log, logLevel, file, line);
+}
+
 void Log_print(struct Log* log,
                enum Log_Level logLevel,
                const char* file,
@@ -26,11 +31,9 @@ void Log_print(struct Log* log,
                const char* format,
                ...)
 {
-    static int inLogger;
-    static int droppedMessages;
-    if (inLogger++) {
+    if (log->inLogger++) {
         // return prevent stack overflow.
-        droppedMessages++;
+        log->droppedMessages++;
         return;
     }
 
@@ -39,16 +42,17 @@ void Log_print(struct Log* log,
     log->print(log, logLevel, file, line, format, args);
     va_end(args);
 
-    inLogger--;
+    log->inLogger--;
 
-    if (droppedMessages && !inLogger) {
+    if (log->droppedMessages && !log->inLogger) {
+        int droppedMessages = log->droppedMessages;
+        log->droppedMessages = 0;
         Log_print(log,
                   Log_Level_ERROR,
                   Gcc_SHORT_FILE,
                   Gcc_LINE,
                   "There were [%d] dropped log messages.",
                   droppedMessages);
-        droppedMessages = 0;
     }
 }
 
@@ -19,6 +19,9 @@
 #include "util/Linker.h"
 Linker_require("util/log/Log.c")
 
+#include <stdbool.h>
+#include <stdint.h>
+
 enum Log_Level
 {
     Log_Level_KEYS,
@@ -68,11 +71,18 @@ void Log_print(struct Log* log,
                const char* format,
                ...);
 
+/**
+ * Ask a log whether it would print messages from a call site, a log which has a lot of
+ * statements to turn away keeps its own cache of the answers.
+ * This is checked before the arguments of a log statement are evaluated.
+ */
+bool Log_shouldPrint(struct Log* log, enum Log_Level logLevel, const char* file, int line);
+
 #define Log_printf(log, level, ...) \
-    do {                                                                   \
-        if (log) {                                                         \
-            Log_print(log, level, Gcc_SHORT_FILE, Gcc_LINE, __VA_ARGS__);  \
-        }                                                                  \
+    do {                                                                                   \
+        if ((log) && Log_shouldPrint((log), level, Gcc_SHORT_FILE, Gcc_LINE)) {            \
+            Log_print(log, level, Gcc_SHORT_FILE, Gcc_LINE, __VA_ARGS__);                  \
+        }                                                                                  \
     } while (0)
 // CHECKFILES_IGNORE missing ;
 
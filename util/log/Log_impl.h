@@ -18,6 +18,7 @@
 #include "util/log/Log.h"
 
 #include <stdarg.h>
+#include <stdbool.h>
 
 typedef void (* Log_callback) (struct Log* log,
                                enum Log_Level logLevel,
@@ -26,9 +27,28 @@ typedef void (* Log_callback) (struct Log* log,
                                const char* format,
                                va_list args);
 
+/**
+ * @return false if nothing would be printed from log statements at this level, file and line.
+ *         This is asked for every log statement so it should be cheap.
+ */
+typedef bool (* Log_isEnabled) (struct Log* log,
+                                enum Log_Level logLevel,
+                                const char* file,
+                                int line);
+
 struct Log
 {
     Log_callback print;
+
+    /** If NULL then every message is printed. */
+    Log_isEnabled isEnabled;
+
+    /**
+     * Non-zero while a message is being printed, anything which is logged to this log from
+     * inside of print is dropped and counted. This is per log because each thread has its own.
+     */
+    int inLogger;
+    int droppedMessages;
 };
 
 #endif
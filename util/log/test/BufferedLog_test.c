@@ -0,0 +1,111 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/MallocAllocator.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/log/BufferedLog.h"
+#include "util/log/Log_impl.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+
+#define string_strcmp
+#define string_strstr
+#include "util/platform/libc/string.h"
+
+#include <stdio.h>
+
+/** Records what reaches the wrapped log. */
+struct TestLog
+{
+    struct Log pub;
+    int count;
+    enum Log_Level lastLevel;
+    int lastLine;
+    char last[2048];
+};
+
+static void testPrint(struct Log* genericLog,
+                      enum Log_Level logLevel,
+                      const char* file,
+                      int line,
+                      const char* format,
+                      va_list args)
+{
+    struct TestLog* tl = (struct TestLog*) genericLog;
+    tl->count++;
+    tl->lastLevel = logLevel;
+    tl->lastLine = line;
+    vsnprintf(tl->last, sizeof(tl->last), format, args);
+}
+
+static void endLoop(void* vEventBase)
+{
+    EventBase_endLoop((struct EventBase*) vEventBase);
+}
+
+static void runLoop(struct EventBase* base, struct Allocator* alloc)
+{
+    Timeout_setTimeout(endLoop, base, 1, base, alloc);
+    EventBase_beginLoop(base);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct EventBase* base = EventBase_new(alloc);
+    struct TestLog tl = { .pub = { .print = testPrint } };
+    struct Log* log = BufferedLog_new(&tl.pub, base, alloc);
+
+    // Nothing gets through until the event loop runs.
+    char buff[32];
+    snprintf(buff, 32, "temporary");
+    Log_info(log, "hello [%s] [%d]", buff, 1);
+    buff[0] = '\0';
+    Log_info(log, "second");
+    Assert_always(tl.count == 0);
+    runLoop(base, alloc);
+    Assert_always(tl.count == 2);
+    Assert_always(!strcmp(tl.last, "second"));
+
+    // The arguments were captured at the call, not when the message was written.
+    Log_debug(log, "hello [%s]", "world");
+    runLoop(base, alloc);
+    Assert_always(tl.count == 3);
+    Assert_always(!strcmp(tl.last, "hello [world]"));
+    Assert_always(tl.lastLevel == Log_Level_DEBUG);
+
+    // Errors go first, after what was waiting.
+    Log_info(log, "waiting");
+    Log_error(log, "urgent");
+    Assert_always(tl.count == 5);
+    Assert_always(!strcmp(tl.last, "urgent"));
+
+    // Long lines are cut, and when the buffer fills up messages are dropped and counted.
+    char longLine[2000];
+    Bits_memset(longLine, 'x', sizeof(longLine) - 1);
+    longLine[sizeof(longLine) - 1] = '\0';
+    int tooMany = BufferedLog_SIZE / 1024 + 10;
+    for (int i = 0; i < tooMany; i++) {
+        Log_info(log, "%s", longLine);
+    }
+    tl.count = 0;
+    runLoop(base, alloc);
+    Assert_always(tl.count < tooMany + 1);
+    Assert_always(tl.lastLevel == Log_Level_ERROR);
+    Assert_always(strstr(tl.last, "dropped"));
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -155,6 +155,31 @@ struct Sockaddr* Sockaddr_clone(const struct Sockaddr* addr, struct Allocator* a
                                alloc);
 }
 
+int Sockaddr_asKey(const struct Sockaddr* sockaddr, struct Sockaddr_Key* out)
+{
+    const struct Sockaddr_pvt* sa = (const struct Sockaddr_pvt*) sockaddr;
+    if (sockaddr->addrLen == sizeof(struct sockaddr_in) + Sockaddr_OVERHEAD
+        && sa->ss.ss_family == AF_INET)
+    {
+        const struct sockaddr_in* in = (const struct sockaddr_in*) &sa->ss;
+        uint8_t* bytes = (uint8_t*) out->addr;
+        Bits_memset(bytes, 0, 10);
+        bytes[10] = bytes[11] = 0xff;
+        Bits_memcpyConst(&bytes[12], &in->sin_addr, 4);
+        out->portFamilyAndScope = in->sin_port | (((uint64_t)1) << 16);
+        return 0;
+    }
+    if (sockaddr->addrLen == sizeof(struct sockaddr_in6) + Sockaddr_OVERHEAD
+        && sa->ss.ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*) &sa->ss;
+        Bits_memcpyConst(out->addr, &in6->sin6_addr, 16);
+        out->portFamilyAndScope = in6->sin6_port | (((uint64_t)in6->sin6_scope_id) << 32);
+        return 0;
+    }
+    return -1;
+}
+
 char* Sockaddr_print(struct Sockaddr* sockaddr, struct Allocator* alloc)
 {
     if (sockaddr->addrLen < (2 + Sockaddr_OVERHEAD)
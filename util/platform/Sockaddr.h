@@ -16,6 +16,7 @@
 #define Sockaddr_H
 
 #include "memory/Allocator.h"
+#include "util/Assert.h"
 #include "util/Endian.h"
 #include "util/Linker.h"
 Linker_require("util/platform/Sockaddr.c")
@@ -133,4 +134,44 @@ struct Sockaddr* Sockaddr_clone(const struct Sockaddr* addr, struct Allocator* a
  */
 void Sockaddr_normalizeNative(void* nativeSockaddr);
 
+/**
+ * A fixed size form of an IPv4 or IPv6 sockaddr for looking up peers and clients by address,
+ * it is made on the stack and hashed and compared without looping over bytes.
+ */
+struct Sockaddr_Key
+{
+    /** The address, IPv4 addresses are given as ::ffff:a.b.c.d so all keys are the same size. */
+    uint64_t addr[2];
+
+    /** The port in network byte order, 1 << 16 if the address was IPv4 and the IPv6 scope id. */
+    uint64_t portFamilyAndScope;
+};
+#define Sockaddr_Key_SIZE 24
+Assert_compileTime(sizeof(struct Sockaddr_Key) == Sockaddr_Key_SIZE);
+
+/**
+ * Get the key for an address.
+ *
+ * @param sa an IPv4 or IPv6 sockaddr.
+ * @param out the key to populate.
+ * @return 0 if all goes well, -1 if the sockaddr is of some other family.
+ */
+int Sockaddr_asKey(const struct Sockaddr* sa, struct Sockaddr_Key* out);
+
+static inline uint32_t Sockaddr_Key_hash(const struct Sockaddr_Key* key)
+{
+    uint64_t hash = key->addr[0] * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ key->addr[1]) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ key->portFamilyAndScope) * 0x9E3779B97F4A7C15ull;
+    return hash >> 32;
+}
+
+/** @return 0 if the keys are the same, non-zero otherwise. */
+static inline int Sockaddr_Key_compare(const struct Sockaddr_Key* a, const struct Sockaddr_Key* b)
+{
+    return ((a->addr[0] ^ b->addr[0])
+        | (a->addr[1] ^ b->addr[1])
+        | (a->portFamilyAndScope ^ b->portFamilyAndScope)) != 0;
+}
+
 #endif
@@ -13,96 +13,170 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "util/platform/netdev/NetPlatform.h"
-#define string_strncpy
-#define string_strlen
 #define string_strerror
 #include "util/platform/libc/string.h"
 #include "util/platform/Sockaddr.h"
 #include "util/Bits.h"
 
 #include <errno.h>
-#include <stdio.h>
-#include <sys/ioctl.h>
-#include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <stdlib.h>
-#include <stddef.h>
 #include <net/if.h>
-#include <arpa/inet.h>
+#include <netinet/in.h>
 
 #include <linux/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
-/**
- * This hack exists because linux/in.h and linux/in6.h define
- * the same structures, leading to redefinition errors.
+/*
+ * Changes are made over rtnetlink, every message of a batch goes to the kernel in one send()
+ * and asks for an acknowledgement so each one is checked in the same round trip.
  */
-#ifndef _LINUX_IN6_H
-    struct in6_ifreq
-    {
-        struct in6_addr ifr6_addr;
-        uint32_t ifr6_prefixlen;
-        int ifr6_ifindex;
-    };
-#endif
+
+#define NetPlatform_linux_BATCH_SIZE 1024
+#define NetPlatform_linux_BATCH_MESSAGES 8
+
+struct NetPlatform_linux_Batch
+{
+    union {
+        struct nlmsghdr align;
+        uint8_t bytes[NetPlatform_linux_BATCH_SIZE];
+    } buff;
+    int length;
+
+    /** The number of messages, the sequence number of each one is its index + 1. */
+    int count;
+
+    /** What each message does, for the error message if it fails. */
+    const char* what[NetPlatform_linux_BATCH_MESSAGES];
+};
 
 /**
- * Get a socket and ifRequest for a given interface by name.
+ * Append a message to a batch.
  *
- * @param interfaceName the name of the interface, eg: tun0
- * @param af either AF_INET or AF_INET6
- * @param eg an exception handler in case something goes wrong.
- *           this will send a -1 for all errors.
- * @param ifRequestOut an ifreq which will be populated with the interface index of the interface.
- * @return a socket for interacting with this interface.
+ * @param batch the batch to add to.
+ * @param type the message type, eg: RTM_NEWADDR
+ * @param flags the NLM_F_ flags other than NLM_F_REQUEST and NLM_F_ACK which are always set.
+ * @param body the fixed size header which follows the nlmsghdr, eg: a struct ifaddrmsg
+ * @param bodyLen the length of the body.
+ * @param what a description of the change for error messages.
+ * @return the message so that attributes can be added to it with addAttribute().
  */
-static int socketForIfName(const char* interfaceName,
-                           int af,
-                           struct Except* eh,
-                           struct ifreq* ifRequestOut)
+static struct nlmsghdr* addMessage(struct NetPlatform_linux_Batch* batch,
+                                   int type,
+                                   int flags,
+                                   const void* body,
+                                   int bodyLen,
+                                   const char* what)
 {
-    int s;
+    int len = NLMSG_LENGTH(bodyLen);
+    Assert_true(batch->count < NetPlatform_linux_BATCH_MESSAGES);
+    Assert_true(batch->length + NLMSG_ALIGN(len) <= NetPlatform_linux_BATCH_SIZE);
+
+    struct nlmsghdr* msg = (struct nlmsghdr*) &batch->buff.bytes[batch->length];
+    Bits_memset(msg, 0, NLMSG_ALIGN(len));
+    msg->nlmsg_len = len;
+    msg->nlmsg_type = type;
+    msg->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    msg->nlmsg_seq = ++batch->count;
+    Bits_memcpy(NLMSG_DATA(msg), body, bodyLen);
+
+    batch->what[batch->count - 1] = what;
+    batch->length += NLMSG_ALIGN(len);
+    return msg;
+}
 
-    if ((s = socket(af, SOCK_DGRAM, 0)) < 0) {
-        Except_throw(eh, "socket() [%s]", strerror(errno));
-    }
+/** Append an attribute to msg which must be the last message in the batch. */
+static void addAttribute(struct NetPlatform_linux_Batch* batch,
+                         struct nlmsghdr* msg,
+                         int type,
+                         const void* data,
+                         int dataLen)
+{
+    int len = RTA_LENGTH(dataLen);
+    Assert_true(batch->length + RTA_ALIGN(len) <= NetPlatform_linux_BATCH_SIZE);
 
-    Bits_memset(ifRequestOut, 0, sizeof(struct ifreq));
-    strncpy(ifRequestOut->ifr_name, interfaceName, IFNAMSIZ);
+    struct rtattr* attr = (struct rtattr*) &batch->buff.bytes[batch->length];
+    Bits_memset(attr, 0, RTA_ALIGN(len));
+    attr->rta_type = type;
+    attr->rta_len = len;
+    Bits_memcpy(RTA_DATA(attr), data, dataLen);
 
-    if (ioctl(s, SIOCGIFINDEX, ifRequestOut) < 0) {
-        int err = errno;
-        close(s);
-        Except_throw(eh, "ioctl(SIOCGIFINDEX) [%s]", strerror(err));
-    }
-    return s;
+    msg->nlmsg_len = NLMSG_ALIGN(msg->nlmsg_len) + RTA_ALIGN(len);
+    batch->length += RTA_ALIGN(len);
 }
 
-static void checkInterfaceUp(int socket,
-                             struct ifreq* ifRequest,
-                             struct Log* logger,
-                             struct Except* eh)
+/**
+ * Send every message in a batch and wait for all of the acknowledgements.
+ * The kernel carries on with the rest of the batch if one message fails,
+ * the first failure is the one which is reported.
+ */
+static void sendBatch(struct NetPlatform_linux_Batch* batch,
+                      const char* interfaceName,
+                      struct Except* eh)
 {
-    if (ioctl(socket, SIOCGIFFLAGS, ifRequest) < 0) {
+    int s = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (s < 0) {
+        Except_throw(eh, "socket(AF_NETLINK) [%s]", strerror(errno));
+    }
+
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    if (sendto(s, batch->buff.bytes, batch->length, 0,
+               (struct sockaddr*) &kernel, sizeof(struct sockaddr_nl)) != batch->length)
+    {
         int err = errno;
-        close(socket);
-        Except_throw(eh, "ioctl(SIOCGIFFLAGS) [%s]", strerror(err));
+        close(s);
+        Except_throw(eh, "sendto(AF_NETLINK) [%s]", strerror(err));
     }
 
-    if (ifRequest->ifr_flags & IFF_UP & IFF_RUNNING) {
-        // already up.
-        return;
+    int acked = 0;
+    int error = 0;
+    int failedSeq = 0;
+    while (acked < batch->count) {
+        union {
+            struct nlmsghdr align;
+            uint8_t bytes[4096];
+        } reply;
+        int len = recv(s, reply.bytes, sizeof(reply), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            int err = errno;
+            close(s);
+            Except_throw(eh, "recv(AF_NETLINK) [%s]", strerror(err));
+        }
+        for (struct nlmsghdr* msg = &reply.align; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            if (msg->nlmsg_type != NLMSG_ERROR
+                || msg->nlmsg_seq < 1
+                || (int) msg->nlmsg_seq > batch->count)
+            {
+                continue;
+            }
+            acked++;
+            struct nlmsgerr* ack = NLMSG_DATA(msg);
+            if (ack->error && !error) {
+                error = -ack->error;
+                failedSeq = msg->nlmsg_seq;
+            }
+        }
     }
+    close(s);
 
-    Log_info(logger, "Bringing up interface [%s]", ifRequest->ifr_name);
+    if (error) {
+        Except_throw(eh, "%s for [%s] failed [%s]",
+                     batch->what[failedSeq - 1], interfaceName, strerror(error));
+    }
+}
 
-    ifRequest->ifr_flags |= IFF_UP | IFF_RUNNING;
-    if (ioctl(socket, SIOCSIFFLAGS, ifRequest) < 0) {
-        int err = errno;
-        close(socket);
-        Except_throw(eh, "ioctl(SIOCSIFFLAGS) [%s]", strerror(err));
+static int ifIndexForName(const char* interfaceName, struct Except* eh)
+{
+    int ifIndex = if_nametoindex(interfaceName);
+    if (!ifIndex) {
+        Except_throw(eh, "if_nametoindex(%s) [%s]", interfaceName, strerror(errno));
     }
+    return ifIndex;
 }
 
 void NetPlatform_addAddress(const char* interfaceName,
@@ -112,53 +186,39 @@ void NetPlatform_addAddress(const char* interfaceName,
                             struct Log* logger,
                             struct Except* eh)
 {
-    struct ifreq ifRequest;
-    int s = socketForIfName(interfaceName, addrFam, eh, &ifRequest);
-    int ifIndex = ifRequest.ifr_ifindex;
-
-    // checkInterfaceUp() clobbers the ifindex.
-    checkInterfaceUp(s, &ifRequest, logger, eh);
+    int ifIndex = ifIndexForName(interfaceName, eh);
+    struct NetPlatform_linux_Batch batch = { .length = 0 };
+
+    Log_info(logger, "Bringing up interface [%s]", interfaceName);
+    struct ifinfomsg link = {
+        .ifi_family = AF_UNSPEC,
+        .ifi_index = ifIndex,
+        .ifi_flags = IFF_UP,
+        .ifi_change = IFF_UP
+    };
+    addMessage(&batch, RTM_NEWLINK, 0, &link, sizeof(struct ifinfomsg), "Bringing up interface");
 
+    int addrLen;
     if (addrFam == Sockaddr_AF_INET6) {
-        struct in6_ifreq ifr6 = {
-            .ifr6_ifindex = ifIndex,
-            .ifr6_prefixlen = prefixLen
-        };
-        Bits_memcpyConst(&ifr6.ifr6_addr, address, 16);
-
-        if (ioctl(s, SIOCSIFADDR, &ifr6) < 0) {
-            int err = errno;
-            close(s);
-            Except_throw(eh, "ioctl(SIOCSIFADDR) [%s]", strerror(err));
-        }
-
-
+        addrLen = 16;
     } else if (addrFam == Sockaddr_AF_INET) {
-        struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = 0 };
-        Bits_memcpyConst(&sin.sin_addr.s_addr, address, 4);
-        Bits_memcpyConst(&ifRequest.ifr_addr, &sin, sizeof(struct sockaddr));
-
-        if (ioctl(s, SIOCSIFADDR, &ifRequest) < 0) {
-            int err = errno;
-            close(s);
-            Except_throw(eh, "ioctl(SIOCSIFADDR) failed: [%s]", strerror(err));
-        }
-
-        uint32_t x = ~0 << (32 - prefixLen);
-        x = Endian_hostToBigEndian32(x);
-        Bits_memcpyConst(&sin.sin_addr, &x, 4);
-        Bits_memcpyConst(&ifRequest.ifr_addr, &sin, sizeof(struct sockaddr_in));
-
-        if (ioctl(s, SIOCSIFNETMASK, &ifRequest) < 0) {
-            int err = errno;
-            close(s);
-            Except_throw(eh, "ioctl(SIOCSIFNETMASK) failed: [%s]", strerror(err));
-        }
+        addrLen = 4;
     } else {
         Assert_always(0);
     }
 
-    close(s);
+    struct ifaddrmsg addr = {
+        .ifa_family = (addrLen == 16) ? AF_INET6 : AF_INET,
+        .ifa_prefixlen = prefixLen,
+        .ifa_scope = RT_SCOPE_UNIVERSE,
+        .ifa_index = ifIndex
+    };
+    struct nlmsghdr* msg = addMessage(&batch, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE,
+                                      &addr, sizeof(struct ifaddrmsg), "Setting address");
+    addAttribute(&batch, msg, IFA_LOCAL, address, addrLen);
+    addAttribute(&batch, msg, IFA_ADDRESS, address, addrLen);
+
+    sendBatch(&batch, interfaceName, eh);
 }
 
 void NetPlatform_setMTU(const char* interfaceName,
@@ -166,17 +226,15 @@ void NetPlatform_setMTU(const char* interfaceName,
                         struct Log* logger,
                         struct Except* eh)
 {
-    struct ifreq ifRequest;
-    int s = socketForIfName(interfaceName, AF_INET6, eh, &ifRequest);
+    int ifIndex = ifIndexForName(interfaceName, eh);
+    struct NetPlatform_linux_Batch batch = { .length = 0 };
 
     Log_info(logger, "Setting MTU for device [%s] to [%u] bytes.", interfaceName, mtu);
 
-    ifRequest.ifr_mtu = mtu;
-    if (ioctl(s, SIOCSIFMTU, &ifRequest) < 0) {
-        int err = errno;
-        close(s);
-        Except_throw(eh, "ioctl(SIOCSIFMTU) [%s]", strerror(err));
-    }
+    struct ifinfomsg link = { .ifi_family = AF_UNSPEC, .ifi_index = ifIndex };
+    struct nlmsghdr* msg =
+        addMessage(&batch, RTM_NEWLINK, 0, &link, sizeof(struct ifinfomsg), "Setting MTU");
+    addAttribute(&batch, msg, IFLA_MTU, &mtu, 4);
 
-    close(s);
+    sendBatch(&batch, interfaceName, eh);
 }
@@ -80,10 +80,44 @@ static void fromName()
     Allocator_free(alloc);
 }
 
+static void keyFor(char* address, struct Sockaddr_Key* key)
+{
+    struct Sockaddr_storage ss;
+    Assert_always(!Sockaddr_parse(address, &ss));
+    Assert_always(!Sockaddr_asKey(&ss.addr, key));
+}
+
+static void keys()
+{
+    struct Sockaddr_Key a;
+    struct Sockaddr_Key b;
+    keyFor("1.2.3.4:5", &a);
+    keyFor("1.2.3.4:5", &b);
+    Assert_always(!Sockaddr_Key_compare(&a, &b));
+    Assert_always(Sockaddr_Key_hash(&a) == Sockaddr_Key_hash(&b));
+
+    keyFor("1.2.3.4:6", &b);
+    Assert_always(Sockaddr_Key_compare(&a, &b));
+    Assert_always(Sockaddr_Key_hash(&a) != Sockaddr_Key_hash(&b));
+
+    // The same address as an IPv6 mapped address is still a different key.
+    keyFor("[::ffff:1.2.3.4]:5", &b);
+    Assert_always(Sockaddr_Key_compare(&a, &b));
+
+    keyFor("[fc00::1]:5", &a);
+    keyFor("[fc00::1]:5", &b);
+    Assert_always(!Sockaddr_Key_compare(&a, &b));
+    keyFor("[fc00::2]:5", &b);
+    Assert_always(Sockaddr_Key_compare(&a, &b));
+
+    struct Sockaddr notInet = { .addrLen = Sockaddr_OVERHEAD };
+    Assert_always(Sockaddr_asKey(&notInet, &a));
+}
 
 int main()
 {
     parse();
     fromName();
+    keys();
     return 0;
 }
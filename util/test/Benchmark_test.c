@@ -0,0 +1,79 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/String.h"
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Benchmark.h"
+
+struct Context
+{
+    int setUps;
+    uint64_t ops;
+    volatile uint32_t sink;
+};
+
+static struct Context context;
+
+static void* setUp(struct Random* rand, struct Allocator* alloc)
+{
+    context.setUps++;
+    return &context;
+}
+
+static void run(void* vctx, uint32_t count)
+{
+    struct Context* ctx = vctx;
+    for (uint32_t i = 0; i < count; i++) {
+        ctx->sink = ctx->sink * 31 + i;
+        ctx->ops++;
+    }
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+    const struct Benchmark_Case bench = {
+        .name = "test.multiply",
+        .setUp = setUp,
+        .run = run,
+        .bytesPerOp = 4
+    };
+    Dict* d = Benchmark_run(&bench, rand, alloc);
+
+    Assert_always(context.setUps == 1);
+    Assert_always(String_equals(Dict_getString(d, String_CONST("name")),
+                                String_CONST("test.multiply")));
+    int64_t ops = *Dict_getInt(d, String_CONST("opsPerRepetition"));
+    Assert_always(ops > 0);
+    Assert_always(*Dict_getInt(d, String_CONST("repetitions")) == Benchmark_REPETITIONS);
+
+    // Every repetition and the ones which work out the count run the whole count.
+    Assert_always(context.ops >= (uint64_t) ops * (Benchmark_WARMUP + Benchmark_REPETITIONS));
+
+    int64_t min = *Dict_getInt(d, String_CONST("minPs"));
+    int64_t median = *Dict_getInt(d, String_CONST("medianPs"));
+    int64_t mean = *Dict_getInt(d, String_CONST("meanPs"));
+    int64_t max = *Dict_getInt(d, String_CONST("maxPs"));
+    Assert_always(min > 0);
+    Assert_always(min <= median && median <= max);
+    Assert_always(min <= mean && mean <= max);
+    Assert_always(*Dict_getInt(d, String_CONST("stddevPs")) <= max - min);
+    Assert_always(*Dict_getInt(d, String_CONST("bytesPerOp")) == 4);
+
+    Allocator_free(alloc);
+    return 0;
+}
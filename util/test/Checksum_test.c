@@ -12,6 +12,8 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include "crypto/random/Random.h"
+#include "memory/MallocAllocator.h"
 #include "util/Checksum.h"
 #include "util/Bits.h"
 #include "util/Endian.h"
@@ -122,11 +124,73 @@ static void icmp6ChecksumTest()
     Assert_always(checksum == calcatedSum);
 }
 
+static void updateTest()
+{
+    uint8_t packet[UDP6_PACKET_SIZE + 1];
+    Hex_decode(packet, UDP6_PACKET_SIZE, udp6PacketHex, UDP6_PACKET_SIZE * 2);
+
+    // Change the source address and port as a NAT would, odd bytes included.
+    uint8_t newSource[18] = { 0x20, 0x01, 0x0d, 0xb8, [13] = 0xff, [15] = 0x01, 0x9e, 0x07 };
+    uint8_t oldSource[18];
+    Bits_memcpyConst(oldSource, &packet[8], 16);
+    Bits_memcpyConst(&oldSource[16], &packet[40], 2);
+    Bits_memcpyConst(&packet[8], newSource, 16);
+    Bits_memcpyConst(&packet[40], &newSource[16], 2);
+
+    uint16_t checksum;
+    Bits_memcpyConst(&checksum, &packet[46], 2);
+    uint16_t updated = Checksum_update(checksum, oldSource, newSource, 16);
+    updated = Checksum_update(updated, &oldSource[16], &newSource[16], 2);
+
+    packet[46] = 0;
+    packet[47] = 0;
+    Assert_always(updated == Checksum_udpIp6(&packet[8], &packet[40], 25));
+}
+
+/** The checksum of native order words done one at a time, to compare with the fast version. */
+static uint16_t slowChecksum(const uint8_t* buffer, uint32_t length)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i + 1 < length; i += 2) {
+        sum += Endian_isBigEndian()
+            ? ((buffer[i] << 8) | buffer[i + 1]) : ((buffer[i + 1] << 8) | buffer[i]);
+    }
+    if (length % 2) {
+        sum += Endian_isBigEndian() ? (buffer[length - 1] << 8) : buffer[length - 1];
+    }
+    while (sum > 0xFFFF) {
+        sum = (sum >> 16) + (sum & 0xFFFF);
+    }
+    return ~sum;
+}
+
+static void largePacketTest()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Random* rand = Random_new(alloc, NULL, NULL);
+    uint16_t buffer[32768];
+    uint8_t* bytes = (uint8_t*) buffer;
+
+    // All ones is the worst case for carries.
+    Bits_memset(buffer, 0xff, sizeof(buffer));
+    Assert_always(Checksum_engine(bytes, 65535) == slowChecksum(bytes, 65535));
+
+    for (int i = 0; i < 200; i++) {
+        uint32_t length = Random_uint16(rand) % 1600;
+        uint32_t offset = (Random_uint8(rand) % 16) * 2;
+        Random_bytes(rand, bytes, length + offset);
+        Assert_always(Checksum_engine(&bytes[offset], length)
+            == slowChecksum(&bytes[offset], length));
+    }
+    Allocator_free(alloc);
+}
 
 int main()
 {
     checksumAlgorithmTest();
     udp6ChecksumTest();
     icmp6ChecksumTest();
+    updateTest();
+    largePacketTest();
     return 0;
 }
@@ -0,0 +1,77 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/events/DeferredFree.h"
+#include "util/events/EventBase.h"
+#include "util/events/Timeout.h"
+#include "util/Assert.h"
+
+struct Context
+{
+    struct EventBase* base;
+    int freed;
+    int ticks;
+};
+
+static int onFree(struct Allocator_OnFreeJob* job)
+{
+    struct Context* ctx = job->userData;
+    ctx->freed++;
+    return 0;
+}
+
+static void check(void* vctx)
+{
+    struct Context* ctx = vctx;
+    if (!ctx->freed) {
+        ctx->ticks++;
+        return;
+    }
+    EventBase_endLoop(ctx->base);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct Context ctx = { .base = EventBase_new(alloc) };
+
+    struct Allocator* big = Allocator_child(alloc);
+    Allocator_onFree(big, onFree, &ctx);
+    for (int i = 0; i < DeferredFree_BATCH * 4; i++) {
+        Allocator_child(big);
+    }
+
+    DeferredFree_free(big, ctx.base);
+    Assert_always(!ctx.freed);
+    Timeout_setInterval(check, &ctx, 1, ctx.base, alloc);
+    EventBase_beginLoop(ctx.base);
+    Assert_always(ctx.freed == 1);
+
+    // If the parent is freed first, whatever is left goes with it.
+    struct Allocator* parent = Allocator_child(alloc);
+    big = Allocator_child(parent);
+    Allocator_onFree(big, onFree, &ctx);
+    for (int i = 0; i < DeferredFree_BATCH * 4; i++) {
+        Allocator_child(big);
+    }
+    DeferredFree_free(big, ctx.base);
+    Allocator_free(parent);
+    Assert_always(ctx.freed == 2);
+
+    Allocator_free(alloc);
+
+    return 0;
+}
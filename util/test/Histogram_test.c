@@ -0,0 +1,73 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "benc/String.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/Histogram.h"
+
+/** The percentile must be at or above the true value and not more than 25% over it. */
+static void checkPercentile(struct Histogram* histogram, int percent, uint64_t expected)
+{
+    uint64_t value = Histogram_percentile(histogram, percent);
+    Assert_always(value >= expected);
+    Assert_always(value <= expected + expected / 4);
+}
+
+int main()
+{
+    struct Histogram histogram;
+    Bits_memset(&histogram, 0, sizeof(struct Histogram));
+    Assert_always(Histogram_percentile(&histogram, 50) == 0);
+    Assert_always(Histogram_average(&histogram) == 0);
+
+    for (uint64_t i = 1; i <= 1000; i++) {
+        Histogram_add(&histogram, i);
+    }
+    Assert_always(histogram.count == 1000);
+    Assert_always(histogram.max == 1000);
+    Assert_always(Histogram_average(&histogram) == 500);
+    checkPercentile(&histogram, 50, 500);
+    checkPercentile(&histogram, 90, 900);
+    checkPercentile(&histogram, 99, 990);
+    Assert_always(Histogram_percentile(&histogram, 100) == 1000);
+
+    // Small values are exact.
+    struct Histogram small;
+    Bits_memset(&small, 0, sizeof(struct Histogram));
+    Histogram_add(&small, 0);
+    Histogram_add(&small, 3);
+    Assert_always(Histogram_percentile(&small, 50) == 0);
+    Assert_always(Histogram_percentile(&small, 99) == 3);
+
+    // Huge values go in the last bucket.
+    Histogram_add(&small, UINT64_MAX / 2);
+    Assert_always(Histogram_percentile(&small, 99) == UINT64_MAX / 2);
+
+    struct Histogram merged;
+    Bits_memset(&merged, 0, sizeof(struct Histogram));
+    Histogram_merge(&merged, &histogram);
+    Histogram_merge(&merged, &histogram);
+    Assert_always(merged.count == 2000);
+    Assert_always(merged.max == 1000);
+    checkPercentile(&merged, 50, 500);
+
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    Dict* d = Histogram_toDict(&histogram, alloc);
+    Assert_always(*Dict_getInt(d, String_CONST("count")) == 1000);
+    Assert_always(*Dict_getInt(d, String_CONST("max")) == 1000);
+    Allocator_free(alloc);
+    return 0;
+}
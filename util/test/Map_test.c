@@ -22,11 +22,124 @@
 #define Map_ENABLE_HANDLES
 #include "util/Map.h"
 
+#define Map_NAME OfIntegersByInteger
+#define Map_KEY_TYPE uint32_t
+#define Map_VALUE_TYPE uint32_t
+#include "util/Map.h"
+
+// Only a few distinct hash codes so that lookups must skip over many matching codes.
+#define Map_NAME OfIntegersByColliding
+#define Map_KEY_TYPE uint32_t
+#define Map_VALUE_TYPE uint32_t
+#define Map_USE_HASH
+#include "util/Map.h"
+static inline uint32_t Map_OfIntegersByColliding_hash(uint32_t* key)
+{
+    return *key & 3;
+}
+
 #include <stdio.h>
 #include <stdbool.h>
 
 #define CYCLES 1
 
+/** Every key which is in the map must be found at the right index and removed ones must not. */
+static void checkKeys(struct Map_OfIntegersByInteger* map, uint32_t* present, uint32_t max)
+{
+    uint32_t count = 0;
+    for (uint32_t key = 0; key < max; key++) {
+        int index = Map_OfIntegersByInteger_indexForKey(&key, map);
+        if (present[key]) {
+            Assert_always(index >= 0 && map->keys[index] == key && map->values[index] == key * 3);
+            count++;
+        } else {
+            Assert_always(index == -1);
+        }
+    }
+    Assert_always(count == map->count);
+}
+
+static void putAndRemove(struct Random* rand)
+{
+    #define MAX_KEY 2048
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Map_OfIntegersByInteger* map = Map_OfIntegersByInteger_new(alloc);
+    uint32_t present[MAX_KEY] = { 0 };
+
+    for (int round = 0; round < 8; round++) {
+        for (int i = 0; i < 1000; i++) {
+            // Keys which are multiples of a power of two collide in the low bits.
+            uint32_t key = (Random_uint32(rand) % (MAX_KEY / 8)) * ((round & 1) ? 8 : 1);
+            uint32_t val = key * 3;
+            Map_OfIntegersByInteger_put(&key, &val, map);
+            present[key] = 1;
+        }
+        checkKeys(map, present, MAX_KEY);
+        for (int i = 0; i < 600; i++) {
+            uint32_t key = Random_uint32(rand) % MAX_KEY;
+            int index = Map_OfIntegersByInteger_indexForKey(&key, map);
+            Assert_always((index >= 0) == (present[key] == 1));
+            if (index >= 0) {
+                Assert_always(!Map_OfIntegersByInteger_remove(index, map));
+                present[key] = 0;
+            }
+        }
+        checkKeys(map, present, MAX_KEY);
+    }
+    Allocator_free(alloc);
+    #undef MAX_KEY
+}
+
+/** Removed handles must stay dead while their slots are reused and the slots grow. */
+static void staleHandles(struct Random* rand)
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Map_OfLongsByInteger* map = Map_OfLongsByInteger_new(alloc);
+    #define STALE 64
+    uint32_t stale[STALE];
+    uint32_t staleCount = 0;
+    for (uint32_t i = 0; i < 3000; i++) {
+        uint32_t key = i;
+        uint64_t val = i;
+        Map_OfLongsByInteger_put(&key, &val, map);
+        if (Random_uint32(rand) % 3 == 0) {
+            int index = Random_uint32(rand) % map->count;
+            stale[staleCount++ % STALE] = map->handles[index];
+            Assert_always(!Map_OfLongsByInteger_remove(index, map));
+        }
+        for (uint32_t j = 0; j < staleCount && j < STALE; j++) {
+            Assert_always(Map_OfLongsByInteger_indexForHandle(stale[j], map) == -1);
+        }
+    }
+    for (int i = 0; i < (int)map->count; i++) {
+        Assert_always(Map_OfLongsByInteger_indexForHandle(map->handles[i], map) == i);
+        Assert_always(Map_OfLongsByInteger_indexForKey(&map->keys[i], map) == i);
+        Assert_always(map->values[i] == map->keys[i]);
+    }
+    Allocator_free(alloc);
+    #undef STALE
+}
+
+/** Grow a map past Map_SCAN_MAX so lookups are checked on both sides of the threshold. */
+static void smallMaps()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<16);
+    struct Map_OfIntegersByColliding* map = Map_OfIntegersByColliding_new(alloc);
+    for (uint32_t count = 0; count < Map_SCAN_MAX + 8; count++) {
+        uint32_t key = count * 5;
+        Map_OfIntegersByColliding_put(&key, &count, map);
+        for (uint32_t k = 0; k <= count * 5 + 1; k++) {
+            int index = Map_OfIntegersByColliding_indexForKey(&k, map);
+            if (k % 5) {
+                Assert_always(index == -1);
+            } else {
+                Assert_always(index >= 0 && map->values[index] == k / 5);
+            }
+        }
+    }
+    Allocator_free(alloc);
+}
+
 int main()
 {
     struct Allocator* mainAlloc = MallocAllocator_new(20000);
@@ -54,21 +167,26 @@ int main()
             int index = map->keys[i] % size;
             uint32_t handle = map->handles[index];
             if (index != Map_OfLongsByInteger_indexForHandle(handle, map)) {
-                uint32_t num = 0;
-                for (int i = 0; i < (int)map->count; i++) {
-                    if (num > map->handles[i]) {
-                        Assert_always(!"map out of order");
-                    }
-                    num = map->handles[i];
-                }
                 printf("failed to find the correct index for the handle "
                        "handle[%u], index[%u], indexForHandle[%u]\n",
                        handle, index, Map_OfLongsByInteger_indexForHandle(handle, map));
                 Assert_always(false);
             }
         }
+
+        // Removing entries moves others into their place, they must still be found.
+        for (int i = 0; i < 50; i++) {
+            Map_OfLongsByInteger_remove(Random_uint32(rand) % map->count, map);
+        }
+        for (int i = 0; i < (int)map->count; i++) {
+            Assert_always(Map_OfLongsByInteger_indexForKey(&map->keys[i], map) == i);
+        }
         Allocator_free(alloc);
     }
+    putAndRemove(rand);
+    smallMaps();
+    staleHandles(rand);
+
     Allocator_free(mainAlloc);
     return 0;
 }
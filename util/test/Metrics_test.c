@@ -0,0 +1,61 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/CString.h"
+#include "util/Histogram.h"
+#include "util/Metrics.h"
+
+static uint64_t readGauge(void* vvalue)
+{
+    return *((int*) vvalue) * 2;
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct Metrics* metrics = Metrics_new(alloc);
+
+    uint64_t counter = 5;
+    int gauge = 21;
+    struct Histogram histogram = { .count = 0 };
+    Metrics_addCounter(metrics, "cjdns_a_total", "A counter.", &counter);
+    Metrics_addRead(metrics, Metrics_Type_GAUGE, "cjdns_b", "A gauge.", readGauge, &gauge);
+    Metrics_addHistogram(metrics, "cjdns_c", "A summary.", &histogram);
+
+    // Values are read when they are written out, not when they are registered.
+    counter++;
+    Histogram_add(&histogram, 10);
+    Histogram_add(&histogram, 20);
+
+    char buff[1024];
+    int length = Metrics_write(metrics, buff, sizeof(buff));
+    Assert_always(length > 0 && buff[length] == '\0');
+    Assert_always(CString_strstr(buff, "# HELP cjdns_a_total A counter.\n"
+                                       "# TYPE cjdns_a_total counter\n"
+                                       "cjdns_a_total 6\n") == buff);
+    Assert_always(CString_strstr(buff, "# TYPE cjdns_b gauge\ncjdns_b 42\n"));
+    Assert_always(CString_strstr(buff, "# TYPE cjdns_c summary\n"));
+    Assert_always(CString_strstr(buff, "\ncjdns_c_sum 30\ncjdns_c_count 2\n"));
+    Assert_always(buff[length - 1] == '\n');
+
+    // Anything short of the whole text is an error rather than a truncated scrape.
+    Assert_always(Metrics_write(metrics, buff, length) == -1);
+    Assert_always(Metrics_write(metrics, buff, length + 1) == length);
+
+    Allocator_free(alloc);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/Bits.h"
+#include "util/PacketCapture.h"
+#include "util/events/EventBase.h"
+#include "wire/Message.h"
+
+#define BUFFER_SIZE 8192
+
+struct Blocks
+{
+    int sections;
+    int interfaces;
+    int packets;
+
+    /** Of the last packet. */
+    uint32_t interface;
+    uint32_t captured;
+    uint32_t length;
+    uint8_t firstByte;
+};
+
+static uint32_t get32(uint8_t* in)
+{
+    uint32_t out;
+    Bits_memcpy(&out, in, 4);
+    return out;
+}
+
+/** Walk the blocks checking that the lengths at both ends agree. */
+static void parse(uint8_t* buffer, uint32_t length, struct Blocks* out)
+{
+    Bits_memset(out, 0, sizeof(struct Blocks));
+    uint32_t i = 0;
+    while (i < length) {
+        uint32_t type = get32(&buffer[i]);
+        uint32_t blockLength = get32(&buffer[i + 4]);
+        Assert_always(blockLength % 4 == 0 && i + blockLength <= length);
+        Assert_always(get32(&buffer[i + blockLength - 4]) == blockLength);
+        if (type == 0x0A0D0D0A) {
+            Assert_always(get32(&buffer[i + 8]) == 0x1A2B3C4D);
+            out->sections++;
+        } else if (type == 1) {
+            Assert_always((get32(&buffer[i + 8]) & 0xffff) == PacketCapture_LINKTYPE);
+            out->interfaces++;
+        } else {
+            Assert_always(type == 6);
+            out->interface = get32(&buffer[i + 8]);
+            out->captured = get32(&buffer[i + 20]);
+            out->length = get32(&buffer[i + 24]);
+            out->firstByte = buffer[i + 28];
+            out->packets++;
+        }
+        i += blockLength;
+    }
+    Assert_always(i == length);
+}
+
+static void tapAll(struct PacketCapture* capture, struct Message* msg, int count)
+{
+    for (int i = 0; i < count; i++) {
+        msg->bytes[0] = i;
+        for (int point = 0; point < PacketCapture_Point_COUNT; point++) {
+            PacketCapture_tap(capture, point, msg);
+        }
+    }
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<22);
+    struct EventBase* base = EventBase_new(alloc);
+    struct PacketCapture* capture = PacketCapture_new(base, alloc);
+    struct Message* msg = Message_new(100, 0, alloc);
+    Bits_memset(msg->bytes, 0xee, msg->length);
+    uint8_t* buffer = Allocator_malloc(alloc, BUFFER_SIZE);
+    struct Blocks blocks;
+
+    // Nothing is copied until capture is started.
+    tapAll(capture, msg, 10);
+    Assert_always(capture->written == 0);
+    Assert_always(PacketCapture_read(capture, buffer, BUFFER_SIZE) == 0);
+
+    // One in two packets at the switch, the first read has the headers.
+    uint32_t points = (1 << PacketCapture_Point_SWITCH_IN) | (1 << PacketCapture_Point_SWITCH_OUT);
+    PacketCapture_start(capture, points, 2, 30);
+    tapAll(capture, msg, 10);
+    Assert_always(capture->written == 10);
+    parse(buffer, PacketCapture_read(capture, buffer, BUFFER_SIZE), &blocks);
+    Assert_always(blocks.sections == 1);
+    Assert_always(blocks.interfaces == PacketCapture_Point_COUNT);
+    Assert_always(blocks.packets == 10);
+    Assert_always(blocks.interface == PacketCapture_Point_SWITCH_OUT);
+    Assert_always(blocks.captured == 30 && blocks.length == 100);
+    Assert_always(blocks.firstByte == 9);
+
+    // Later reads only have the new packets.
+    tapAll(capture, msg, 2);
+    parse(buffer, PacketCapture_read(capture, buffer, BUFFER_SIZE), &blocks);
+    Assert_always(blocks.sections == 0 && blocks.interfaces == 0 && blocks.packets == 2);
+
+    // Older packets are dropped once the ring is full and a read takes what fits,
+    // 208 bytes of headers then 60 packets of 132 bytes.
+    PacketCapture_start(capture, 1 << PacketCapture_Point_LINK_IN, 1,
+                        PacketCapture_MAX_SNAP_LENGTH);
+    tapAll(capture, msg, PacketCapture_SLOTS + 5);
+    Assert_always(capture->lost == 5);
+    parse(buffer, PacketCapture_read(capture, buffer, BUFFER_SIZE), &blocks);
+    Assert_always(blocks.sections == 1 && blocks.packets == 60);
+    Assert_always(blocks.interface == PacketCapture_Point_LINK_IN && blocks.captured == 100);
+    Assert_always(blocks.firstByte == 64);
+
+    // Once stopped nothing more is copied but what is left can still be read.
+    PacketCapture_stop(capture);
+    tapAll(capture, msg, 10);
+    Assert_always(capture->written == PacketCapture_SLOTS + 5);
+    uint32_t total = 0;
+    for (uint32_t length; (length = PacketCapture_read(capture, buffer, BUFFER_SIZE)); ) {
+        parse(buffer, length, &blocks);
+        total += blocks.packets;
+    }
+    Assert_always(total == PacketCapture_SLOTS - 60);
+
+    Allocator_free(alloc);
+    return 0;
+}
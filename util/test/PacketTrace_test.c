@@ -0,0 +1,81 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "memory/MallocAllocator.h"
+#include "util/Assert.h"
+#include "util/PacketTrace.h"
+#include "util/events/Time.h"
+
+static void spin(uint64_t nanoseconds)
+{
+    uint64_t end = Time_hrtime() + nanoseconds;
+    while (Time_hrtime() < end) ;
+}
+
+static void checkStats(struct PacketTrace* trace, enum PacketTrace_Stage stage, uint64_t count)
+{
+    Assert_always(trace->histograms[stage].count == count);
+}
+
+int main()
+{
+    struct Allocator* alloc = MallocAllocator_new(1<<20);
+    struct PacketTrace* trace = PacketTrace_new(alloc);
+
+    // Nothing is traced until sampling is turned on.
+    PacketTrace_begin(trace);
+    PacketTrace_end(trace, PacketTrace_Stage_LINK_ENCRYPT);
+    checkStats(trace, PacketTrace_Stage_TOTAL, 0);
+
+    PacketTrace_setSampling(trace, 4);
+    for (int i = 0; i < 100; i++) {
+        PacketTrace_begin(trace);
+        spin(1000);
+        PacketTrace_stamp(trace, PacketTrace_Stage_LINK_DECRYPT);
+        spin(1000);
+        PacketTrace_stamp(trace, PacketTrace_Stage_SWITCH);
+        PacketTrace_end(trace, PacketTrace_Stage_LINK_ENCRYPT);
+    }
+    checkStats(trace, PacketTrace_Stage_LINK_DECRYPT, 25);
+    checkStats(trace, PacketTrace_Stage_SWITCH, 25);
+    checkStats(trace, PacketTrace_Stage_LINK_ENCRYPT, 25);
+    checkStats(trace, PacketTrace_Stage_TOTAL, 25);
+    checkStats(trace, PacketTrace_Stage_TO_TUN, 0);
+
+    Assert_always(Histogram_percentile(&trace->histograms[PacketTrace_Stage_TOTAL], 50) >= 2000);
+
+    // A packet which is dropped before it goes out is not counted.
+    for (int i = 0; i < 4; i++) {
+        PacketTrace_begin(trace);
+        PacketTrace_stamp(trace, PacketTrace_Stage_LINK_DECRYPT);
+    }
+    PacketTrace_begin(trace);
+    PacketTrace_end(trace, PacketTrace_Stage_LINK_ENCRYPT);
+    checkStats(trace, PacketTrace_Stage_TOTAL, 25);
+
+    PacketTrace_setSampling(trace, 1);
+    checkStats(trace, PacketTrace_Stage_TOTAL, 0);
+
+    // Stamping the same stage twice counts the packet once.
+    PacketTrace_begin(trace);
+    spin(100);
+    PacketTrace_stamp(trace, PacketTrace_Stage_DUCTTAPE_DECRYPT);
+    spin(100);
+    PacketTrace_stamp(trace, PacketTrace_Stage_DUCTTAPE_DECRYPT);
+    PacketTrace_end(trace, PacketTrace_Stage_TO_TUN);
+    checkStats(trace, PacketTrace_Stage_DUCTTAPE_DECRYPT, 1);
+
+    Allocator_free(alloc);
+    return 0;
+}
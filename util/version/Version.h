@@ -202,6 +202,51 @@
     ((x == 5) ? (y > 4) : Version_isCompat5(x, y))
 /*
  * Drop support for versions older than 5
+ *
+ * ----------------------------------
+ *
+ * Version 7:
+ * October 14, 2026
+ */
+#define Version_isCompat7(x, y) \
+    ((x == 7) ? (y > 4) : Version_isCompat6(x, y))
+/*
+ * Packets between routers which are direct peers may skip the router to router CryptoAuth
+ * session because the link between the peers is already encrypted and authenticated with the
+ * same keys. Such a packet carries the send handle of the session followed by the nonce
+ * 0xfffffffe (see ONE_HOP_NONCE in Ducttape.c) and then the cleartext content. It may only be sent
+ * over an established link to the peer whose key is the key of the session and only once the
+ * other node is known to be version 7 or higher, it must be dropped if it arrives from anywhere
+ * but a peer with the key of the session.
+ *
+ * ----------------------------------
+ *
+ * Version 8:
+ * October 14, 2026
+ */
+#define Version_isCompat8(x, y) \
+    ((x == 8) ? (y > 4) : Version_isCompat7(x, y))
+/*
+ * A packet from a router to the node at the other end of its router to router session may carry
+ * a compressed IPv6 header once the other node is known to be version 8 or higher, the source and
+ * destination addresses are those of the session's keys and the payload length is what remains
+ * of the packet. The header is 4 bytes: 0x80, or 0x81 if the traffic class and flow label follow
+ * in the next 4 bytes as they are in an IPv6 header, then the next header and the hop limit and
+ * a zero byte. No IPv4 or IPv6 packet begins with either of those bytes.
+ *
+ * ----------------------------------
+ *
+ * Version 9:
+ * October 14, 2026
+ */
+#define Version_isCompat9(x, y) \
+    ((x == 9) ? (y > 4) : Version_isCompat8(x, y))
+/*
+ * Small switch packets to a peer which is known to be version 9 or higher may be bundled into
+ * one packet of the peer's CryptoAuth session if both ends have coalescing switched on. A bundle
+ * begins with a switch header which has label 0 and message type 2 (see
+ * Headers_SwitchHeader_TYPE_BUNDLE), then each packet follows as a 2 byte big endian length,
+ * 2 zero bytes and the packet itself padded with zeros to a multiple of 4 bytes.
  */
 
 
@@ -214,13 +259,13 @@
  * numbered isCompat macro.
  */
 #define Version_isCompatConst(x, y) \
-    ((x > y) ? Version_isCompat6(x, y) : Version_isCompat6(y, x))
+    ((x > y) ? Version_isCompat9(x, y) : Version_isCompat9(y, x))
 
 
 /**
  * The current protocol version.
  */
-#define Version_CURRENT_PROTOCOL 6
+#define Version_CURRENT_PROTOCOL 9
 #define Version_5_COMPAT
 
 #define Version_MINIMUM_COMPATIBLE 5
@@ -246,16 +291,22 @@ static inline int Version_isCompatible(uint32_t version1, uint32_t version2)
         Version_isCompatConst(col,3), \
         Version_isCompatConst(col,4), \
         Version_isCompatConst(col,5), \
-        Version_isCompatConst(col,6)  \
+        Version_isCompatConst(col,6), \
+        Version_isCompatConst(col,7), \
+        Version_isCompatConst(col,8), \
+        Version_isCompatConst(col,9)  \
     }
-    static const uint8_t table[7][7] = {
+    static const uint8_t table[10][10] = {
         Version_TABLE_ROW(0),
         Version_TABLE_ROW(1),
         Version_TABLE_ROW(2),
         Version_TABLE_ROW(3),
         Version_TABLE_ROW(4),
         Version_TABLE_ROW(5),
-        Version_TABLE_ROW(6)
+        Version_TABLE_ROW(6),
+        Version_TABLE_ROW(7),
+        Version_TABLE_ROW(8),
+        Version_TABLE_ROW(9)
     };
 
     #define Version_TABLE_HEIGHT (sizeof(table) / sizeof(table[0]))
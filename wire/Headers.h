@@ -19,6 +19,7 @@
 #include "util/Endian.h"
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * The header which switches use to decide where to route traffic.
@@ -30,12 +31,18 @@
  *    +                         Switch Label                          +
  *  4 |                                                               |
  *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
- *  8 |      Type     |                  Priority                     |
+ *  8 |      Type     |C|                Priority                     |
  *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * C is the congestion flag, Headers_SwitchHeader_CONGESTED.
+ * The rest of the priority is the flow tag, see Headers_getFlowTag().
  */
 #define Headers_SwitchHeader_TYPE_DATA 0
 #define Headers_SwitchHeader_TYPE_CONTROL 1
 
+/** Several packets for the same peer, never switched, see Coalescer.h. */
+#define Headers_SwitchHeader_TYPE_BUNDLE 2
+
 #pragma pack(push)
 #pragma pack(4)
 struct Headers_SwitchHeader
@@ -49,6 +56,7 @@ struct Headers_SwitchHeader
      *
      * Bottom 24 bits: priority
      * Anti-flooding, this is a big endian uint32_t with the high 8 bits cut off.
+     * The highest bit of it is the congestion flag, see Headers_setCongested().
      *
      * This entire number is in big endian encoding.
      */
@@ -77,6 +85,43 @@ static inline void Headers_setPriorityAndMessageType(struct Headers_SwitchHeader
         Endian_hostToBigEndian32( (priority & ((1 << 24) - 1)) | messageType << 24 );
 }
 
+/**
+ * Set by a node whose queue toward the next hop is building up, the switches along the path
+ * keep it and the destination passes it on to the traffic inside as an ECN mark so the hosts
+ * at each end can slow down before packets are lost.
+ */
+#define Headers_SwitchHeader_CONGESTED (1 << 23)
+
+static inline bool Headers_isCongested(const struct Headers_SwitchHeader* header)
+{
+    return Endian_bigEndianToHost32(header->lowBits_be) & Headers_SwitchHeader_CONGESTED;
+}
+
+static inline void Headers_setCongested(struct Headers_SwitchHeader* header)
+{
+    header->lowBits_be |= Endian_hostToBigEndian32(Headers_SwitchHeader_CONGESTED);
+}
+
+/**
+ * A hash which the sender gives each flow inside the packets it sends, 0 for none.
+ * The encrypted packets of different flows in one session look alike so the queues along the
+ * path use this to tell them apart, see FairQueue.h.
+ */
+#define Headers_SwitchHeader_FLOW_TAG_MASK (Headers_SwitchHeader_CONGESTED - 1)
+
+static inline uint32_t Headers_getFlowTag(const struct Headers_SwitchHeader* header)
+{
+    return Endian_bigEndianToHost32(header->lowBits_be) & Headers_SwitchHeader_FLOW_TAG_MASK;
+}
+
+static inline void Headers_setFlowTag(struct Headers_SwitchHeader* header, uint32_t tag)
+{
+    uint32_t lowBits = Endian_bigEndianToHost32(header->lowBits_be);
+    lowBits = (lowBits & ~Headers_SwitchHeader_FLOW_TAG_MASK)
+        | (tag & Headers_SwitchHeader_FLOW_TAG_MASK);
+    header->lowBits_be = Endian_hostToBigEndian32(lowBits);
+}
+
 /**
  * Header for nodes authenticating to one another.
  *
@@ -313,6 +358,28 @@ struct Headers_IP6Header
 #define Headers_IP6Header_SIZE 40
 Assert_compileTime(sizeof(struct Headers_IP6Header) == Headers_IP6Header_SIZE);
 
+/** The ECN field is the low 2 bits of the traffic class, see RFC 3168. */
+#define Headers_IP6Header_ECN_SHIFT 4
+#define Headers_IP6Header_ECN_NOT_ECT 0
+#define Headers_IP6Header_ECN_CE 3
+
+/**
+ * Mark a packet with Congestion Experienced if it was sent by an ECN capable transport.
+ *
+ * @return true if the packet was marked.
+ */
+static inline bool Headers_IP6Header_markCongested(struct Headers_IP6Header* header)
+{
+    uint16_t word = Endian_bigEndianToHost16(header->versionClassAndFlowLabel);
+    uint16_t ecn = (word >> Headers_IP6Header_ECN_SHIFT) & 3;
+    if (ecn == Headers_IP6Header_ECN_NOT_ECT || ecn == Headers_IP6Header_ECN_CE) {
+        return false;
+    }
+    word |= Headers_IP6Header_ECN_CE << Headers_IP6Header_ECN_SHIFT;
+    header->versionClassAndFlowLabel = Endian_hostToBigEndian16(word);
+    return true;
+}
+
 struct Headers_IP6Fragment
 {
     uint8_t nextHeader;
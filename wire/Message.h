@@ -99,13 +99,15 @@ static inline void Message_copyOver(struct Message* output,
 /**
  * Pretend to shift the content forward by amount.
  * Really it shifts the bytes value backward.
+ * This never throws so it is for the per-packet paths where a malformed packet should be
+ * dropped rather than handled with an Except.
+ *
+ * @return 0 if the message was shifted, -1 if there was not enough padding or content.
  */
-static inline int Message_shift(struct Message* toShift, int32_t amount, struct Except* eh)
+static inline int Message_tryShift(struct Message* toShift, int32_t amount)
 {
-    if (amount > 0 && toShift->padding < amount) {
-        Except_throw(eh, "buffer overflow");
-    } else if (toShift->length < (-amount)) {
-        Except_throw(eh, "buffer underflow");
+    if ((amount > 0 && toShift->padding < amount) || toShift->length < (-amount)) {
+        return -1;
     }
 
     toShift->length += amount;
@@ -113,9 +115,41 @@ static inline int Message_shift(struct Message* toShift, int32_t amount, struct
     toShift->bytes -= amount;
     toShift->padding -= amount;
 
+    return 0;
+}
+
+static inline int Message_shift(struct Message* toShift, int32_t amount, struct Except* eh)
+{
+    if (Message_tryShift(toShift, amount)) {
+        Except_throw(eh, "buffer %s", (amount > 0) ? "overflow" : "underflow");
+    }
     return 1;
 }
 
+/** @return 0 on success, -1 if there is not enough padding, the message is left unchanged. */
+static inline int Message_tryPush(struct Message* restrict msg,
+                                  const void* restrict object,
+                                  size_t size)
+{
+    if (Message_tryShift(msg, (int)size)) {
+        return -1;
+    }
+    Bits_memcpy(msg->bytes, object, size);
+    return 0;
+}
+
+/** @return 0 on success, -1 if the message is too short, the message is left unchanged. */
+static inline int Message_tryPop(struct Message* restrict msg,
+                                 void* restrict object,
+                                 size_t size)
+{
+    if (Message_tryShift(msg, -((int)size))) {
+        return -1;
+    }
+    Bits_memcpy(object, &msg->bytes[-((int)size)], size);
+    return 0;
+}
+
 static inline void Message_push(struct Message* restrict msg,
                                 const void* restrict object,
                                 size_t size,